@@ -127,6 +127,12 @@ public:
     */
     void EncodeFrame(std::vector<std::vector<uint8_t>> &vPacket, NV_ENC_PIC_PARAMS *pPicParams = nullptr);
 
+    /**
+    *  @brief  This function is used to get the average QP of each packet returned
+    *  by the last EncodeFrame() or EndEncode() call, in the same order.
+    */
+    const std::vector<uint32_t> &GetPacketAverageQP() const { return m_vPacketAverageQP; }
+
     /**
     *  @brief  This function to flush the encoder queue.
     *  The encoder might be queuing frames for B picture encoding or lookahead;
@@ -436,4 +442,5 @@ private:
     uint32_t m_nMaxEncodeWidth = 0;
     uint32_t m_nMaxEncodeHeight = 0;
     void* m_hModule = nullptr;
+    std::vector<uint32_t> m_vPacketAverageQP;
 };
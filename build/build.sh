@@ -179,6 +179,12 @@ case "$PACKAGE" in
         cp    LICENSE                _package/momo-${MOMO_VERSION}_${PACKAGE}/
         cp    NOTICE                 _package/momo-${MOMO_VERSION}_${PACKAGE}/
         cp -r html                   _package/momo-${MOMO_VERSION}_${PACKAGE}/html
+        # ROS 版は nodelet も ROS のパッケージとして同梱する
+        if [ -e _build/${PACKAGE}/libmomo_nodelet.so ]; then
+          mkdir -p _package/momo-${MOMO_VERSION}_${PACKAGE}/ros/momo/lib
+          cp    ros/momo/*.xml                      _package/momo-${MOMO_VERSION}_${PACKAGE}/ros/momo/
+          cp    _build/${PACKAGE}/libmomo_nodelet.so _package/momo-${MOMO_VERSION}_${PACKAGE}/ros/momo/lib/
+        fi
         pushd _package
           tar czf momo-${MOMO_VERSION}_${PACKAGE}.tar.gz momo-${MOMO_VERSION}_${PACKAGE}
         popd
@@ -0,0 +1,73 @@
+# test モードで配信するファイルを、バイト列として C++ のソースに埋め込む。
+#
+# cmake -DSOURCE_DIR=<dir> -DFILES=<SOURCE_DIR からの相対パスのリスト> -DOUTPUT=<出力する .cpp>
+#       [-DGZIP_EXECUTABLE=<gzip>] -P EmbedFiles.cmake
+#
+# リクエストのパスは "/" + 相対パスになる。
+# GZIP_EXECUTABLE を指定した場合は gzip で圧縮したものも埋め込む。
+
+function(_embed_bytes path name out)
+  file(READ "${path}" _hex HEX)
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," _hex "${_hex}")
+  # CMake の正規表現には {16} が無いので、16 バイト分のパターンを並べて改行を入れる
+  string(REPEAT "0x[0-9a-f][0-9a-f]," 16 _line)
+  string(REGEX REPLACE "(${_line})" "\\1\n    " _hex "${_hex}")
+  set(${out} "constexpr uint8_t ${name}[] = {\n    ${_hex}\n};\n" PARENT_SCOPE)
+endfunction()
+
+set(_arrays "")
+set(_entries "")
+set(_index 0)
+foreach(_file ${FILES})
+  set(_path "${SOURCE_DIR}/${_file}")
+  file(MD5 "${_path}" _md5)
+  _embed_bytes("${_path}" "kData${_index}" _array)
+  string(APPEND _arrays "${_array}")
+
+  set(_gzip_data "nullptr")
+  set(_gzip_size "0")
+  if (GZIP_EXECUTABLE)
+    get_filename_component(_name "${_file}" NAME)
+    set(_gz "${OUTPUT}.${_index}.${_name}.gz")
+    execute_process(
+      COMMAND "${GZIP_EXECUTABLE}" -9 -n -c "${_path}"
+      OUTPUT_FILE "${_gz}"
+      RESULT_VARIABLE _result)
+    if (NOT _result EQUAL 0)
+      message(FATAL_ERROR "Failed to compress ${_path}")
+    endif()
+    _embed_bytes("${_gz}" "kData${_index}Gzip" _array)
+    string(APPEND _arrays "${_array}")
+    set(_gzip_data "kData${_index}Gzip")
+    set(_gzip_size "sizeof(kData${_index}Gzip)")
+  endif()
+
+  string(APPEND _entries
+    "    {\"/${_file}\", \"${_md5}\", kData${_index}, sizeof(kData${_index}),\n"
+    "     ${_gzip_data}, ${_gzip_size}},\n")
+  math(EXPR _index "${_index} + 1")
+endforeach()
+
+set(_content "// cmake/EmbedFiles.cmake が生成したファイル。編集しないこと
+
+#include \"p2p/embedded_files.h\"
+
+namespace {
+
+${_arrays}
+}  // namespace
+
+const EmbeddedFile kEmbeddedFiles[] = {
+${_entries}};
+const size_t kNumEmbeddedFiles =
+    sizeof(kEmbeddedFiles) / sizeof(kEmbeddedFiles[0]);
+")
+
+# 中身が変わらない場合は書き換えず、再コンパイルさせない
+if (EXISTS "${OUTPUT}")
+  file(READ "${OUTPUT}" _old)
+  if (_old STREQUAL _content)
+    return()
+  endif()
+endif()
+file(WRITE "${OUTPUT}" "${_content}")
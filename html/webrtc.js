@@ -53,6 +53,18 @@ function onWsMessage(event) {
       candidates.push(candidate);
     }
   }
+  else if (message.type === 'candidates') {
+    // --ice-candidate-batch-ms を指定すると、複数の candidate がまとめて送られてくる
+    console.log('Received ICE candidates ...');
+    message.candidates.forEach((ice) => {
+      const candidate = new RTCIceCandidate(ice);
+      if (hasReceivedSdp) {
+        addIceCandidate(candidate);
+      } else {
+        candidates.push(candidate);
+      }
+    });
+  }
   else if (message.type === 'close') {
     console.log('peer connection is closed ...');
   }
@@ -380,4 +392,110 @@ function sendDataChannel() {
   }
   dataChannel.send(new TextEncoder().encode(textData));
   dataTextInput.value = "";
-}
\ No newline at end of file
+}
+
+// --latency-marker を指定した Momo の映像の左上に書き込まれたキャプチャ時刻を読み取って、遅延を計測する
+// Momo とブラウザが別のマシンの場合は、NTP などで時計を合わせておくこと
+const latencyText = document.getElementById('latency');
+const latencyCanvas = document.createElement('canvas');
+const LATENCY_MARKER_BLOCKS = 40;
+let latencyMeasuring = false;
+let latencySamples = [];
+let latencyMissing = 0;
+let latencyTimer = null;
+
+function readLatencyMarker() {
+  const width = remoteVideo.videoWidth;
+  const blockSize = width / LATENCY_MARKER_BLOCKS;
+  if (blockSize < 4) {
+    return null;
+  }
+  const height = Math.ceil(blockSize);
+  latencyCanvas.width = width;
+  latencyCanvas.height = height;
+  const context = latencyCanvas.getContext('2d');
+  context.drawImage(remoteVideo, 0, 0, width, height, 0, 0, width, height);
+  const pixels = context.getImageData(0, 0, width, height).data;
+
+  // ブロックの境界はエンコードで滲むので、中央の半分だけを見る
+  const half = Math.max(1, Math.floor(blockSize / 4));
+  const centerY = Math.floor(blockSize / 2);
+  const bits = [];
+  for (let i = 0; i < LATENCY_MARKER_BLOCKS; i++) {
+    const centerX = Math.floor((i + 0.5) * blockSize);
+    let sum = 0;
+    let count = 0;
+    for (let y = centerY - half; y < centerY + half; y++) {
+      for (let x = centerX - half; x < centerX + half; x++) {
+        const offset = (y * width + x) * 4;
+        sum += 0.299 * pixels[offset] + 0.587 * pixels[offset + 1] + 0.114 * pixels[offset + 2];
+        count++;
+      }
+    }
+    bits.push(sum / count >= 128 ? 1 : 0);
+  }
+
+  let value = 0;
+  const bytes = [0, 0, 0, 0];
+  for (let i = 0; i < 32; i++) {
+    value = value * 2 + bits[i];
+    bytes[Math.floor(i / 8)] = bytes[Math.floor(i / 8)] * 2 + bits[i];
+  }
+  let checksum = 0;
+  for (let i = 32; i < LATENCY_MARKER_BLOCKS; i++) {
+    checksum = checksum * 2 + bits[i];
+  }
+  if ((((bytes[0] + bytes[1] + bytes[2] + bytes[3]) & 0xff) ^ 0xa5) !== checksum) {
+    return null;
+  }
+  return value;
+}
+
+function onLatencyFrame() {
+  if (!latencyMeasuring) {
+    return;
+  }
+  const value = readLatencyMarker();
+  if (value === null) {
+    latencyMissing++;
+  } else {
+    // 下位 32 ビットしか無いので、差を符号付きで解釈する
+    let latency = (Date.now() - value) % 4294967296;
+    if (latency >= 2147483648) {
+      latency -= 4294967296;
+    }
+    latencySamples.push(latency);
+  }
+  if ('requestVideoFrameCallback' in remoteVideo) {
+    remoteVideo.requestVideoFrameCallback(onLatencyFrame);
+  } else {
+    requestAnimationFrame(onLatencyFrame);
+  }
+}
+
+function reportLatency() {
+  if (latencySamples.length === 0) {
+    latencyText.textContent = 'no marker found (' + latencyMissing + ' frames)';
+  } else {
+    const sorted = latencySamples.sort((a, b) => a - b);
+    const percentile = (p) => sorted[Math.floor((sorted.length - 1) * p / 100)];
+    latencyText.textContent = 'p50=' + percentile(50) + 'ms p90=' + percentile(90) +
+      'ms p99=' + percentile(99) + 'ms max=' + sorted[sorted.length - 1] +
+      'ms (' + sorted.length + ' frames, ' + latencyMissing + ' missing)';
+    console.log('latency', latencyText.textContent);
+  }
+  latencySamples = [];
+  latencyMissing = 0;
+}
+
+function toggleLatency() {
+  latencyMeasuring = !latencyMeasuring;
+  if (latencyMeasuring) {
+    onLatencyFrame();
+    latencyTimer = setInterval(reportLatency, 1000);
+  } else {
+    clearInterval(latencyTimer);
+    latencyTimer = null;
+    latencyText.textContent = '';
+  }
+}
@@ -20,6 +20,7 @@ apt-get -y install \
   libnss3-dev \
   libpulse-dev \
   libudev-dev \
+  libva-dev \
   lsb-release \
   python \
   python-dev \
@@ -0,0 +1,143 @@
+#!/bin/bash
+
+# test モードの Momo にテストパターンを送らせて momo_bench loopback で受信し、
+# シナリオ毎の結果を _build/<パッケージ名>/loopback_bench.json に書き出す。
+# netem を使うシナリオでは lo に tc qdisc を設定するので、root か sudo が必要。
+
+set -e
+
+# ヘルプ表示
+function show_help() {
+  echo ""
+  echo "$0 <パッケージ名> [シナリオファイル]"
+  echo ""
+  echo "シナリオファイルは 1 行に 1 つ、次の形式でシナリオを書く (# で始まる行は無視する)"
+  echo ""
+  echo "  <名前>|<コーデック>|<netem の設定>|<Momo のオプション>"
+  echo ""
+  echo "例:"
+  echo "  hd-h264-loss2|H264|loss 2%|--resolution HD --use-native"
+  echo ""
+}
+
+# 引数のチェック
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+  show_help
+  exit 1
+fi
+
+PACKAGE_NAME="$1"
+SCENARIO_FILE="$2"
+
+cd "`dirname $0`/.."
+
+BUILD_DIR="_build/$PACKAGE_NAME"
+MOMO="$BUILD_DIR/momo"
+MOMO_BENCH="$BUILD_DIR/momo_bench"
+OUTPUT="$BUILD_DIR/loopback_bench.json"
+
+PORT=${LOOPBACK_BENCH_PORT:-18080}
+DURATION=${LOOPBACK_BENCH_DURATION:-20}
+WARMUP=${LOOPBACK_BENCH_WARMUP:-5}
+
+if [ ! -x "$MOMO" ] || [ ! -x "$MOMO_BENCH" ]; then
+  echo "エラー: $MOMO と $MOMO_BENCH が見つかりません。BUILD_MOMO_BENCH を有効にしてビルドしてください"
+  exit 1
+fi
+
+DEFAULT_SCENARIOS="\
+vga-h264|H264||--resolution VGA
+hd-h264|H264||--resolution HD
+fhd-h264|H264||--resolution FHD
+hd-h264-native|H264||--resolution HD --use-native
+hd-vp8|VP8||--resolution HD
+hd-vp9|VP9||--resolution HD
+hd-h264-loss2|H264|loss 2%|--resolution HD
+hd-h264-wan|H264|delay 40ms 10ms loss 1%|--resolution HD
+"
+
+if [ -n "$SCENARIO_FILE" ]; then
+  SCENARIOS="`cat $SCENARIO_FILE`"
+else
+  SCENARIOS="$DEFAULT_SCENARIOS"
+fi
+
+SUDO=""
+if [ "`id -u`" != "0" ]; then
+  SUDO="sudo"
+fi
+
+MOMO_PID=""
+function cleanup() {
+  if [ -n "$MOMO_PID" ]; then
+    kill $MOMO_PID 2> /dev/null || true
+    wait $MOMO_PID 2> /dev/null || true
+    MOMO_PID=""
+  fi
+  $SUDO tc qdisc del dev lo root 2> /dev/null || true
+}
+trap cleanup EXIT
+
+# test モードの HTTP サーバが接続を受け付けるまで待つ
+function wait_for_port() {
+  for i in `seq 1 100`; do
+    if (exec 3<> /dev/tcp/127.0.0.1/$PORT) 2> /dev/null; then
+      return 0
+    fi
+    sleep 0.1
+  done
+  return 1
+}
+
+RESULTS=""
+FAILURES=0
+while IFS='|' read -r NAME CODEC NETEM OPTIONS; do
+  if [ -z "$NAME" ] || [[ "$NAME" == \#* ]]; then
+    continue
+  fi
+  echo "scenario: $NAME" 1>&2
+
+  if [ -n "$NETEM" ]; then
+    if ! $SUDO tc qdisc add dev lo root netem $NETEM < /dev/null; then
+      echo "エラー: netem を設定できませんでした: $NETEM" 1>&2
+      FAILURES=$((FAILURES + 1))
+      continue
+    fi
+  fi
+
+  $MOMO --no-audio-device --video-pattern bars --latency-marker \
+    --stats-interval-ms 1000 $OPTIONS test --port $PORT 1>&2 < /dev/null &
+  MOMO_PID=$!
+
+  RESULT=""
+  if wait_for_port; then
+    RESULT="`$MOMO_BENCH loopback --port $PORT --codec $CODEC \
+      --duration $DURATION --warmup $WARMUP --scenario $NAME --json < /dev/null`" || RESULT=""
+  fi
+  if [ -n "$RESULT" ]; then
+    if [ -n "$RESULTS" ]; then
+      RESULTS="$RESULTS,"
+    fi
+    RESULTS="$RESULTS$RESULT"
+  else
+    echo "エラー: $NAME を計測できませんでした" 1>&2
+    FAILURES=$((FAILURES + 1))
+  fi
+  cleanup
+done <<< "$SCENARIOS"
+
+source VERSION
+cat << EOF > $OUTPUT
+{
+  "package": "$PACKAGE_NAME",
+  "momo_version": "$MOMO_VERSION",
+  "momo_commit": "`git rev-parse HEAD 2> /dev/null`",
+  "date": "`date -u +%Y-%m-%dT%H:%M:%SZ`",
+  "results": [$RESULTS]
+}
+EOF
+echo "$OUTPUT" 1>&2
+
+if [ $FAILURES -ne 0 ]; then
+  exit 1
+fi
@@ -7,9 +7,12 @@
 #include <nlohmann/json.hpp>
 
 #include "momo_version.h"
+#include "rtc/startup_timer.h"
 #include "ssl_verifier.h"
 #include "url_parts.h"
 #include "util.h"
+#include "ws/dns_cache.h"
+#include "ws/signaling_message.h"
 
 using json = nlohmann::json;
 
@@ -37,6 +40,8 @@ boost::asio::ssl::context AyameWebsocketClient::createSSLContext() const {
                   boost::asio::ssl::context::no_sslv2 |
                   boost::asio::ssl::context::no_sslv3 |
                   boost::asio::ssl::context::single_dh_use);
+  // ルート証明書は全ての接続で共有しているものを使う
+  SSLVerifier::ApplyTo(ctx.native_handle());
   return ctx;
 }
 
@@ -58,20 +63,33 @@ AyameWebsocketClient::AyameWebsocketClient(boost::asio::io_context& ioc,
                                            RTCManager* manager,
                                            ConnectionSettings conn_settings)
     : ioc_(ioc),
-      resolver_(ioc),
       manager_(manager),
       retry_count_(0),
       conn_settings_(conn_settings),
       watchdog_(ioc,
                 std::bind(&AyameWebsocketClient::onWatchdogExpired, this)) {
+  candidate_batcher_ = IceCandidateBatcher::Create(
+      ioc, conn_settings_.ice_candidate_batch_ms,
+      conn_settings_.ice_candidate_batch_size,
+      std::bind(&AyameWebsocketClient::sendCandidates, this, std::placeholders::_1));
   reset();
 }
 
 void AyameWebsocketClient::reset() {
   connection_ = nullptr;
+  if (connector_) {
+    connector_->Cancel();
+    connector_ = nullptr;
+  }
+  // 前の接続の candidate は送らない
+  if (candidate_batcher_) {
+    candidate_batcher_->Clear();
+  }
   connected_ = false;
   is_send_offer_ = false;
   has_is_exist_user_flag_ = false;
+  is_offerer_ = false;
+  ice_restarting_ = false;
   ice_servers_.clear();
 
   if (parseURL(parts_)) {
@@ -101,6 +119,11 @@ void AyameWebsocketClient::reset() {
                                    boost::asio::error::get_ssl_category()};
       MOMO_BOOST_ERROR(ec, "SSL_set_tlsext_host_name");
     }
+
+    if (conn_settings_.fast_reconnect) {
+      reconnect_cache_.applySession(
+          ws_->nativeSecureSocket().next_layer().native_handle());
+    }
   } else {
     boost::beast::websocket::stream<boost::asio::ip::tcp::socket> ws(ioc_);
     ws_.reset(new Websocket(ioc_));
@@ -108,6 +131,13 @@ void AyameWebsocketClient::reset() {
 }
 
 void AyameWebsocketClient::release() {
+  if (candidate_batcher_) {
+    candidate_batcher_->Stop();
+  }
+  if (connector_) {
+    connector_->Cancel();
+    connector_ = nullptr;
+  }
   connection_ = nullptr;
 }
 
@@ -118,20 +148,22 @@ bool AyameWebsocketClient::connect() {
     return false;
   }
 
-  std::string port;
   if (parts_.port.empty()) {
-    port = ws_->isSSL() ? "443" : "80";
+    port_ = ws_->isSSL() ? "443" : "80";
   } else {
-    port = parts_.port;
+    port_ = parts_.port;
   }
 
-  // DNS ルックアップ
-  resolver_.async_resolve(
-      parts_.host, port,
-      boost::asio::bind_executor(
-          ws_->strand(),
-          std::bind(&AyameWebsocketClient::onResolve, shared_from_this(),
-                    std::placeholders::_1, std::placeholders::_2)));
+  // DNS ルックアップ。キャッシュされていればすぐに返ってくる
+  auto self = shared_from_this();
+  DnsCache::Instance().Resolve(
+      ioc_, parts_.host, port_,
+      [self](boost::system::error_code ec,
+             boost::asio::ip::tcp::resolver::results_type results,
+             bool from_cache) {
+        self->using_cached_endpoints_ = from_cache;
+        self->onResolve(ec, std::move(results));
+      });
 
   watchdog_.enable(30);
 
@@ -149,9 +181,29 @@ void AyameWebsocketClient::reconnectAfter() {
   retry_count_++;
 }
 
+// キャッシュしたアドレスに繋がらなかった場合は、待たずに DNS ルックアップからやり直す
+bool AyameWebsocketClient::retryWithoutCachedEndpoints() {
+  if (!using_cached_endpoints_) {
+    return false;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  DnsCache::Instance().Invalidate(parts_.host, port_);
+  auto self = shared_from_this();
+  boost::asio::post(ioc_, [self]() {
+    self->reset();
+    self->connect();
+  });
+  return true;
+}
+
 void AyameWebsocketClient::onWatchdogExpired() {
   RTC_LOG(LS_WARNING) << __FUNCTION__;
 
+  // 接続中にタイムアウトした場合は、キャッシュしたアドレスが繋がらなくなっている可能性がある
+  if (!connected_) {
+    DnsCache::Instance().Invalidate(parts_.host, port_);
+  }
+
   RTC_LOG(LS_INFO) << __FUNCTION__ << " reconnecting...:";
   reset();
   connect();
@@ -166,27 +218,33 @@ void AyameWebsocketClient::onResolve(
   }
 
   // DNS ルックアップで得られたエンドポイントに対して接続する
+  connector_ = HappyEyeballsConnector::Connect(
+      ioc_, results,
+      std::bind(&AyameWebsocketClient::onTCPConnect, shared_from_this(),
+                std::placeholders::_1, std::placeholders::_2));
+}
+
+void AyameWebsocketClient::onTCPConnect(boost::system::error_code ec,
+                                        boost::asio::ip::tcp::socket socket) {
+  connector_ = nullptr;
   if (ws_->isSSL()) {
-    boost::asio::async_connect(
-        ws_->nativeSecureSocket().next_layer().next_layer(), results.begin(),
-        results.end(),
-        boost::asio::bind_executor(
-            ws_->strand(),
-            std::bind(&AyameWebsocketClient::onSSLConnect, shared_from_this(),
-                      std::placeholders::_1)));
+    if (!ec) {
+      ws_->nativeSecureSocket().next_layer().next_layer() = std::move(socket);
+    }
+    onSSLConnect(ec);
   } else {
-    boost::asio::async_connect(
-        ws_->nativeSocket().next_layer(), results.begin(), results.end(),
-        boost::asio::bind_executor(
-            ws_->strand(),
-            std::bind(&AyameWebsocketClient::onConnect, shared_from_this(),
-                      std::placeholders::_1)));
+    if (!ec) {
+      ws_->nativeSocket().next_layer() = std::move(socket);
+    }
+    onConnect(ec);
   }
 }
 
 void AyameWebsocketClient::onSSLConnect(boost::system::error_code ec) {
   if (ec) {
-    reconnectAfter();
+    if (!retryWithoutCachedEndpoints()) {
+      reconnectAfter();
+    }
     return MOMO_BOOST_ERROR(ec, "SSLConnect");
   }
 
@@ -200,10 +258,17 @@ void AyameWebsocketClient::onSSLConnect(boost::system::error_code ec) {
 
 void AyameWebsocketClient::onSSLHandshake(boost::system::error_code ec) {
   if (ec) {
+    // 再開しようとしたセッションが原因の可能性もあるので捨てておく
+    reconnect_cache_.clearSession();
     reconnectAfter();
     return MOMO_BOOST_ERROR(ec, "SSLHandshake");
   }
 
+  if (conn_settings_.fast_reconnect) {
+    reconnect_cache_.saveSession(
+        ws_->nativeSecureSocket().next_layer().native_handle());
+  }
+
   // Websocket のハンドシェイク
   ws_->nativeSecureSocket().async_handshake(
       parts_.host, parts_.path_query_fragment,
@@ -214,7 +279,9 @@ void AyameWebsocketClient::onSSLHandshake(boost::system::error_code ec) {
 
 void AyameWebsocketClient::onConnect(boost::system::error_code ec) {
   if (ec) {
-    reconnectAfter();
+    if (!retryWithoutCachedEndpoints()) {
+      reconnectAfter();
+    }
     return MOMO_BOOST_ERROR(ec, "connect");
   }
   // Websocket のハンドシェイク
@@ -232,6 +299,7 @@ void AyameWebsocketClient::onHandshake(boost::system::error_code ec) {
   }
 
   connected_ = true;
+  StartupTimer::Instance().Mark("signaling_connected");
 
   ws_->startToRead(std::bind(&AyameWebsocketClient::onRead, this,
                              std::placeholders::_1, std::placeholders::_2,
@@ -259,8 +327,7 @@ void AyameWebsocketClient::doRegister() {
 }
 
 void AyameWebsocketClient::doSendPong() {
-  json json_message = {{"type", "pong"}};
-  ws_->sendText(json_message.dump());
+  ws_->sendText(R"({"type":"pong"})");
 }
 
 void AyameWebsocketClient::setIceServersFromConfig(json json_message) {
@@ -298,7 +365,8 @@ void AyameWebsocketClient::createPeerConnection() {
   webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
 
   rtc_config.servers = ice_servers_;
-  connection_ = manager_->createConnection(rtc_config, this);
+  connection_ = manager_->createConnection(
+      rtc_config, this, "ayame:" + conn_settings_.ayame_room_id);
 }
 
 void AyameWebsocketClient::close() {
@@ -355,13 +423,24 @@ void AyameWebsocketClient::onRead(boost::system::error_code ec,
     return;
   }
 
-  if (ec)
+  if (ec) {
+    // --fast-reconnect の場合は ping のタイムアウトを待たずに再接続する
+    if (conn_settings_.fast_reconnect) {
+      reconnectAfter();
+    }
     return MOMO_BOOST_ERROR(ec, "Read");
+  }
 
   RTC_LOG(LS_INFO) << __FUNCTION__ << ": text=" << text;
 
-  auto json_message = json::parse(text);
-  const std::string type = json_message["type"];
+  // candidate と ping は DOM を作らずに必要な値だけを取り出す
+  SignalingMessage message;
+  if (!message.Parse(text, {"candidate", "ping"})) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to parse JSON";
+    return;
+  }
+  const std::string& type = message.type();
+  json& json_message = message.json();
   if (type == "accept") {
     setIceServersFromConfig(json_message);
     createPeerConnection();
@@ -375,6 +454,7 @@ void AyameWebsocketClient::onRead(boost::system::error_code ec,
     if (is_exist_user) {
       RTC_LOG(LS_INFO) << __FUNCTION__ << ": exist_user";
       is_send_offer_ = true;
+      is_offerer_ = true;
       connection_->createOffer();
     } else if (!has_is_exist_user_flag_) {
       // フラグがない場合とりあえず送信
@@ -393,10 +473,12 @@ void AyameWebsocketClient::onRead(boost::system::error_code ec,
   } else if (type == "candidate") {
     int sdp_mlineindex = 0;
     std::string sdp_mid, candidate;
-    json ice = json_message["ice"];
-    sdp_mid = ice["sdpMid"].get<std::string>();
-    sdp_mlineindex = ice["sdpMLineIndex"].get<int>();
-    candidate = ice["candidate"].get<std::string>();
+    if (!message.GetString("ice.sdpMid", &sdp_mid) ||
+        !message.GetInt("ice.sdpMLineIndex", &sdp_mlineindex) ||
+        !message.GetString("ice.candidate", &candidate)) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Invalid candidate";
+      return;
+    }
     connection_->addIceCandidate(sdp_mid, sdp_mlineindex, candidate);
   } else if (type == "ping") {
     watchdog_.reset();
@@ -420,23 +502,44 @@ void AyameWebsocketClient::onIceConnectionStateChange(
 void AyameWebsocketClient::onIceCandidate(const std::string sdp_mid,
                                           const int sdp_mlineindex,
                                           const std::string sdp) {
+  if (candidate_batcher_) {
+    candidate_batcher_->Add(sdp_mid, sdp_mlineindex, sdp);
+    return;
+  }
+  ws_->sendText(candidateMessage(sdp_mid, sdp_mlineindex, sdp));
+}
+
+std::string AyameWebsocketClient::candidateMessage(const std::string& sdp_mid,
+                                                   int sdp_mlineindex,
+                                                   const std::string& sdp) {
   // ayame では candidate sdp の交換で `ice` プロパティを用いる。 `candidate` ではないので注意
-  json json_message = {
-      {"type", "candidate"},
-  };
   // ice プロパティの中に object で candidate 情報をセットして送信する
-  json_message["ice"] = {{"candidate", sdp},
-                         {"sdpMLineIndex", sdp_mlineindex},
-                         {"sdpMid", sdp_mid}};
-  ws_->sendText(json_message.dump());
+  return SignalingWriter("candidate", sdp.size() + sdp_mid.size() + 64)
+      .BeginObject("ice")
+      .Add("candidate", sdp)
+      .Add("sdpMLineIndex", sdp_mlineindex)
+      .Add("sdpMid", sdp_mid)
+      .Finish();
+}
+
+void AyameWebsocketClient::sendCandidates(
+    std::vector<IceCandidateBatcher::Candidate> candidates) {
+  // Ayame は 1 つのメッセージに 1 つの candidate しか入れられないので、送信だけまとめる
+  std::vector<std::string> messages;
+  messages.reserve(candidates.size());
+  for (const auto& c : candidates) {
+    messages.push_back(candidateMessage(c.sdp_mid, c.sdp_mlineindex, c.sdp));
+  }
+  ws_->sendTexts(std::move(messages));
 }
 
 void AyameWebsocketClient::onCreateDescription(webrtc::SdpType type,
                                                const std::string sdp) {
   RTC_LOG(LS_INFO) << __FUNCTION__
                    << " SdpType: " << webrtc::SdpTypeToString(type);
-  json json_message = {{"type", webrtc::SdpTypeToString(type)}, {"sdp", sdp}};
-  ws_->sendText(json_message.dump());
+  ws_->sendText(SignalingWriter(webrtc::SdpTypeToString(type), sdp.size())
+                    .Add("sdp", sdp)
+                    .Finish());
 }
 
 void AyameWebsocketClient::onSetDescription(webrtc::SdpType type) {
@@ -457,11 +560,20 @@ void AyameWebsocketClient::doIceConnectionStateChange(
     case webrtc::PeerConnectionInterface::IceConnectionState::
         kIceConnectionConnected:
       retry_count_ = 0;
+      ice_restarting_ = false;
       watchdog_.enable(60);
       break;
+    case webrtc::PeerConnectionInterface::IceConnectionState::
+        kIceConnectionDisconnected:
+      // --fast-reconnect の場合は、failed になるのを待たずに ICE restart を試す
+      tryIceRestart();
+      break;
     // ice connection state が failed になったら close(); を呼んで、WebSocket 接続を閉じる
     case webrtc::PeerConnectionInterface::IceConnectionState::
         kIceConnectionFailed:
+      if (tryIceRestart()) {
+        break;
+      }
       // close(); で WebSocket が閉じられたら、onClose(); -> reconnectAfter(); -> onWatchdogExpired(); の順に関数が呼ばれることで
       // WebSocket の再接続が行われる
       close();
@@ -480,3 +592,22 @@ void AyameWebsocketClient::doSetDescription(webrtc::SdpType type) {
     is_send_offer_ = false;
   }
 }
+
+// WebSocket と PeerConnection を維持したまま ICE restart の offer を送る。
+// ICE restart 中か、ICE restart を開始した場合は true を返す
+bool AyameWebsocketClient::tryIceRestart() {
+  if (!conn_settings_.fast_reconnect || !connected_ || !connection_ ||
+      !is_offerer_) {
+    return false;
+  }
+  if (ice_restarting_) {
+    return true;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  ice_restarting_ = true;
+  is_send_offer_ = true;
+  connection_->createOffer(true);
+  // 一定時間内に復旧しなければ onWatchdogExpired(); で最初から接続し直す
+  watchdog_.enable(10);
+  return true;
+}
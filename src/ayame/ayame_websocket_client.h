@@ -16,6 +16,9 @@
 #include "rtc/messagesender.h"
 #include "url_parts.h"
 #include "watchdog.h"
+#include "ws/happy_eyeballs_connector.h"
+#include "ws/ice_candidate_batcher.h"
+#include "ws/reconnect_cache.h"
 #include "ws/websocket.h"
 
 class AyameWebsocketClient
@@ -23,7 +26,9 @@ class AyameWebsocketClient
       public RTCMessageSender {
   boost::asio::io_context& ioc_;
 
-  boost::asio::ip::tcp::resolver resolver_;
+  // DNS ルックアップに使うポート
+  std::string port_;
+  std::shared_ptr<HappyEyeballsConnector> connector_;
 
   std::unique_ptr<Websocket> ws_;
 
@@ -37,15 +42,28 @@ class AyameWebsocketClient
   webrtc::PeerConnectionInterface::IceConnectionState rtc_state_;
 
   WatchDog watchdog_;
+  // --ice-candidate-batch-ms が指定されていない場合は nullptr
+  std::shared_ptr<IceCandidateBatcher> candidate_batcher_;
+  // --fast-reconnect の場合に、前回の接続で得た TLS セッションを覚えておく
+  ReconnectCache reconnect_cache_;
+  // DnsCache にキャッシュされていた結果に接続しているかどうか
+  bool using_cached_endpoints_ = false;
 
   bool connected_;
   bool is_send_offer_;
   bool has_is_exist_user_flag_;
+  // こちらから offer を送った接続かどうか。ICE restart はこちらが offer を送った場合だけ行う
+  bool is_offerer_;
+  bool ice_restarting_;
 
   webrtc::PeerConnectionInterface::IceServers ice_servers_;
 
  private:
   bool parseURL(URLParts& parts) const;
+  static std::string candidateMessage(const std::string& sdp_mid,
+                                      int sdp_mlineindex,
+                                      const std::string& sdp);
+  void sendCandidates(std::vector<IceCandidateBatcher::Candidate> candidates);
   boost::asio::ssl::context createSSLContext() const;
 
  public:
@@ -70,11 +88,14 @@ class AyameWebsocketClient
 
  private:
   void reconnectAfter();
+  bool retryWithoutCachedEndpoints();
   void onWatchdogExpired();
 
  private:
   void onResolve(boost::system::error_code ec,
                  boost::asio::ip::tcp::resolver::results_type results);
+  void onTCPConnect(boost::system::error_code ec,
+                    boost::asio::ip::tcp::socket socket);
   void onSSLConnect(boost::system::error_code ec);
   void onSSLHandshake(boost::system::error_code ec);
   void onConnect(boost::system::error_code ec);
@@ -114,6 +135,7 @@ class AyameWebsocketClient
   void doIceConnectionStateChange(
       webrtc::PeerConnectionInterface::IceConnectionState new_state);
   void doSetDescription(webrtc::SdpType type);
+  bool tryIceRestart();
 };
 
 #endif  // AYAME_WEBSOCKET_CLIENT_
@@ -0,0 +1,419 @@
+#include "encoder_bench.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if USE_NVCODEC_ENCODER && defined(__linux__)
+#include "dyn/dyn.h"
+#endif
+
+#include "absl/strings/match.h"
+#include "api/video/video_bitrate_allocation.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "api/video_codecs/video_codec.h"
+#include "api/video_codecs/video_encoder.h"
+#include "connection_settings.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc/file_video_capturer.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+#if defined(__linux__)
+const char kJetsonGpuLoad[] = "/sys/devices/gpu.0/load";
+#endif
+
+int64_t ProcessCpuTimeUs() {
+#if defined(_WIN32)
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel,
+                       &user)) {
+    return 0;
+  }
+  auto to_us = [](const FILETIME& t) {
+    return ((static_cast<int64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) /
+           10;
+  };
+  return to_us(kernel) + to_us(user);
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+// GPU の使用率を読む。Jetson は sysfs の GPU の負荷、
+// NVIDIA の GPU は NVML (libnvidia-ml.so) の NVENC の使用率を使う
+class GpuLoad {
+ public:
+  GpuLoad() {
+#if defined(__linux__)
+    std::ifstream ifs(kJetsonGpuLoad);
+    if (ifs) {
+      source_ = "jetson-gpu";
+      return;
+    }
+#endif
+#if USE_NVCODEC_ENCODER && defined(__linux__)
+    void* module = dyn::DynModule::Instance().Get("libnvidia-ml.so.1");
+    if (module == nullptr) {
+      return;
+    }
+    auto init = (int (*)())dlsym(module, "nvmlInit_v2");
+    auto get_handle =
+        (int (*)(unsigned int, void**))dlsym(module,
+                                             "nvmlDeviceGetHandleByIndex_v2");
+    get_encoder_utilization_ =
+        (int (*)(void*, unsigned int*, unsigned int*))dlsym(
+            module, "nvmlDeviceGetEncoderUtilization");
+    if (init == nullptr || get_handle == nullptr ||
+        get_encoder_utilization_ == nullptr || init() != 0 ||
+        get_handle(0, &device_) != 0) {
+      return;
+    }
+    source_ = "nvenc";
+#endif
+  }
+
+  const std::string& source() const { return source_; }
+
+  // 0 から 100 の値を返す。読めない場合は負の値を返す
+  double Read() {
+#if defined(__linux__)
+    if (source_ == "jetson-gpu") {
+      std::ifstream ifs(kJetsonGpuLoad);
+      int load = -1;
+      ifs >> load;
+      // 1000 で 100% になる
+      return load < 0 ? -1 : load / 10.0;
+    }
+#endif
+#if USE_NVCODEC_ENCODER && defined(__linux__)
+    if (source_ == "nvenc") {
+      unsigned int utilization = 0;
+      unsigned int period_us = 0;
+      if (get_encoder_utilization_(device_, &utilization, &period_us) != 0) {
+        return -1;
+      }
+      return utilization;
+    }
+#endif
+    return -1;
+  }
+
+ private:
+  std::string source_;
+#if USE_NVCODEC_ENCODER && defined(__linux__)
+  void* device_ = nullptr;
+  int (*get_encoder_utilization_)(void*, unsigned int*, unsigned int*) =
+      nullptr;
+#endif
+};
+
+// キャプチャラーから受け取ったフレームをエンコーダに渡し、出力を集計する
+class BenchSink : public rtc::VideoSinkInterface<webrtc::VideoFrame>,
+                  public webrtc::EncodedImageCallback {
+ public:
+  explicit BenchSink(webrtc::VideoEncoder* encoder) : encoder_(encoder) {}
+
+  void SetWindow(int64_t start_us, int64_t end_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_start_us_ = start_us;
+    window_end_us_ = end_us;
+  }
+
+  void Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    const int64_t now_us = rtc::TimeMicros();
+    // 出力と対応付けるために、RTP のタイムスタンプを入れておく
+    webrtc::VideoFrame input(frame);
+    input.set_timestamp(static_cast<uint32_t>(now_us * 90 / 1000));
+    std::vector<webrtc::VideoFrameType> types = {
+        webrtc::VideoFrameType::kVideoFrameDelta};
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopped_) {
+        return;
+      }
+      if (first_frame_) {
+        types[0] = webrtc::VideoFrameType::kVideoFrameKey;
+        first_frame_ = false;
+      }
+      pending_[input.timestamp()] = now_us;
+      if (InWindow(now_us)) {
+        input_frames_++;
+      }
+    }
+    if (encoder_->Encode(input, &types) != WEBRTC_VIDEO_CODEC_OK) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.erase(input.timestamp());
+    }
+  }
+
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override {
+    const int64_t now_us = rtc::TimeMicros();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.find(encoded_image.Timestamp());
+    if (it != pending_.end()) {
+      if (InWindow(it->second)) {
+        latencies_us_.push_back(now_us - it->second);
+        bytes_ += encoded_image.size();
+        if (encoded_image._frameType ==
+            webrtc::VideoFrameType::kVideoFrameKey) {
+          key_frames_++;
+        }
+      }
+      pending_.erase(it);
+    }
+    return Result(Result::OK);
+  }
+
+  void Collect(EncoderBench::Result* result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const double duration_sec =
+        (window_end_us_ - window_start_us_) / 1000000.0;
+    result->input_frames = input_frames_;
+    result->encoded_frames = latencies_us_.size();
+    result->dropped_frames =
+        std::max<int64_t>(0, input_frames_ - result->encoded_frames);
+    result->key_frames = key_frames_;
+    result->fps = result->encoded_frames / duration_sec;
+    result->actual_kbps = bytes_ * 8 / duration_sec / 1000;
+    result->bitrate_accuracy_percent =
+        result->actual_kbps * 100 / result->config.bitrate_kbps;
+    if (latencies_us_.empty()) {
+      return;
+    }
+    std::sort(latencies_us_.begin(), latencies_us_.end());
+    auto percentile = [this](double p) {
+      size_t index = static_cast<size_t>(p * (latencies_us_.size() - 1));
+      return latencies_us_[index] / 1000.0;
+    };
+    result->latency_p50_ms = percentile(0.5);
+    result->latency_p90_ms = percentile(0.9);
+    result->latency_p99_ms = percentile(0.99);
+    result->latency_max_ms = latencies_us_.back() / 1000.0;
+  }
+
+ private:
+  bool InWindow(int64_t time_us) const {
+    return time_us >= window_start_us_ && time_us < window_end_us_;
+  }
+
+  webrtc::VideoEncoder* encoder_;
+  std::mutex mutex_;
+  bool stopped_ = false;
+  bool first_frame_ = true;
+  int64_t window_start_us_ = 0;
+  int64_t window_end_us_ = 0;
+  // Encode() したフレームの RTP タイムスタンプとその時刻
+  std::map<uint32_t, int64_t> pending_;
+  int64_t input_frames_ = 0;
+  int64_t key_frames_ = 0;
+  int64_t bytes_ = 0;
+  std::vector<int64_t> latencies_us_;
+};
+
+webrtc::VideoCodec CreateCodecSettings(const EncoderBench::Config& config,
+                                       webrtc::VideoCodecType type) {
+  webrtc::VideoCodec codec;
+  codec.codecType = type;
+  codec.width = config.width;
+  codec.height = config.height;
+  codec.startBitrate = config.bitrate_kbps;
+  codec.maxBitrate = config.bitrate_kbps;
+  codec.minBitrate = std::min(30, config.bitrate_kbps);
+  codec.maxFramerate = config.framerate;
+  codec.qpMax = type == webrtc::kVideoCodecH264 ? 51 : 56;
+  codec.mode = webrtc::VideoCodecMode::kRealtimeVideo;
+  codec.numberOfSimulcastStreams = 1;
+
+  webrtc::SimulcastStream& stream = codec.simulcastStream[0];
+  stream.width = config.width;
+  stream.height = config.height;
+  stream.maxFramerate = config.framerate;
+  stream.numberOfTemporalLayers = 1;
+  stream.maxBitrate = config.bitrate_kbps;
+  stream.targetBitrate = config.bitrate_kbps;
+  stream.minBitrate = codec.minBitrate;
+  stream.qpMax = codec.qpMax;
+  stream.active = true;
+
+  switch (type) {
+    case webrtc::kVideoCodecVP8:
+      *codec.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+      break;
+    case webrtc::kVideoCodecVP9:
+      *codec.VP9() = webrtc::VideoEncoder::GetDefaultVp9Settings();
+      codec.VP9()->numberOfSpatialLayers = 1;
+      codec.spatialLayers[0] = stream;
+      break;
+    case webrtc::kVideoCodecH264:
+      *codec.H264() = webrtc::VideoEncoder::GetDefaultH264Settings();
+      break;
+    default:
+      break;
+  }
+  return codec;
+}
+
+}  // namespace
+
+nlohmann::json EncoderBench::Result::ToJson() const {
+  nlohmann::json json = {
+      {"codec", config.codec},
+      {"implementation", implementation},
+      {"width", config.width},
+      {"height", config.height},
+      {"bitrate_kbps", config.bitrate_kbps},
+      {"framerate", config.framerate},
+      {"use_native", config.use_native},
+      {"pattern", config.pattern},
+      {"input_frames", input_frames},
+      {"encoded_frames", encoded_frames},
+      {"dropped_frames", dropped_frames},
+      {"key_frames", key_frames},
+      {"fps", fps},
+      {"latency_p50_ms", latency_p50_ms},
+      {"latency_p90_ms", latency_p90_ms},
+      {"latency_p99_ms", latency_p99_ms},
+      {"latency_max_ms", latency_max_ms},
+      {"actual_kbps", actual_kbps},
+      {"bitrate_accuracy_percent", bitrate_accuracy_percent},
+      {"cpu_percent", cpu_percent},
+  };
+  if (gpu_percent >= 0) {
+    json["gpu_percent"] = gpu_percent;
+    json["gpu_source"] = gpu_source;
+  }
+  return json;
+}
+
+bool EncoderBench::Run(webrtc::VideoEncoderFactory* factory,
+                       const Config& config,
+                       Result* result,
+                       std::string* error) {
+  *result = Result();
+  result->config = config;
+
+  std::vector<webrtc::SdpVideoFormat> formats = factory->GetSupportedFormats();
+  auto format = std::find_if(formats.begin(), formats.end(),
+                             [&config](const webrtc::SdpVideoFormat& f) {
+                               return absl::EqualsIgnoreCase(f.name,
+                                                             config.codec);
+                             });
+  if (format == formats.end()) {
+    *error = config.codec + " is not supported";
+    return false;
+  }
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory->CreateVideoEncoder(*format);
+  if (!encoder) {
+    *error = "Failed to create " + config.codec + " encoder";
+    return false;
+  }
+
+  webrtc::VideoCodec codec = CreateCodecSettings(
+      config, webrtc::PayloadStringToCodecType(format->name));
+  webrtc::VideoEncoder::Settings settings(
+      webrtc::VideoEncoder::Capabilities(false),
+      std::max(1u, std::thread::hardware_concurrency()), 1200);
+  int32_t ret = encoder->InitEncode(&codec, settings);
+  if (ret != WEBRTC_VIDEO_CODEC_OK) {
+    *error = "InitEncode failed. error=" + std::to_string(ret);
+    return false;
+  }
+  webrtc::VideoBitrateAllocation allocation;
+  allocation.SetBitrate(0, 0, config.bitrate_kbps * 1000);
+  encoder->SetRates(webrtc::VideoEncoder::RateControlParameters(
+      allocation, config.framerate));
+  result->implementation = encoder->GetEncoderInfo().implementation_name;
+
+  BenchSink sink(encoder.get());
+  encoder->RegisterEncodeCompleteCallback(&sink);
+  const int64_t start_us =
+      rtc::TimeMicros() + config.warmup_sec * rtc::kNumMicrosecsPerSec;
+  const int64_t end_us =
+      start_us + config.duration_sec * rtc::kNumMicrosecsPerSec;
+  sink.SetWindow(start_us, end_us);
+
+  ConnectionSettings cs;
+  cs.resolution =
+      std::to_string(config.width) + "x" + std::to_string(config.height);
+  cs.framerate = config.framerate;
+  cs.use_native = config.use_native;
+  cs.video_pattern = config.pattern;
+  rtc::scoped_refptr<FileVideoCapturer> capturer =
+      FileVideoCapturer::Create(cs);
+  if (!capturer) {
+    encoder->Release();
+    *error = "Failed to create the frame source";
+    return false;
+  }
+  capturer->AddOrUpdateSink(&sink, rtc::VideoSinkWants());
+
+  GpuLoad gpu_load;
+  auto sleep_until = [](int64_t time_us) {
+    const int64_t now_us = rtc::TimeMicros();
+    if (time_us > now_us) {
+      std::this_thread::sleep_for(std::chrono::microseconds(time_us - now_us));
+    }
+  };
+  sleep_until(start_us);
+  const int64_t cpu_start_us = ProcessCpuTimeUs();
+  double gpu_sum = 0;
+  int gpu_samples = 0;
+  for (int64_t t = start_us; t < end_us; t += 100 * 1000) {
+    sleep_until(t);
+    const double load = gpu_load.Read();
+    if (load >= 0) {
+      gpu_sum += load;
+      gpu_samples++;
+    }
+  }
+  sleep_until(end_us);
+  const int64_t cpu_end_us = ProcessCpuTimeUs();
+
+  // 集計期間に Encode() したフレームが出力されるのを少し待つ
+  capturer->RemoveSink(&sink);
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  sink.Stop();
+  capturer = nullptr;
+  encoder->Release();
+
+  sink.Collect(result);
+  result->cpu_percent = (cpu_end_us - cpu_start_us) * 100.0 /
+                        (config.duration_sec * rtc::kNumMicrosecsPerSec);
+  if (gpu_samples > 0) {
+    result->gpu_percent = gpu_sum / gpu_samples;
+    result->gpu_source = gpu_load.source();
+  }
+  return true;
+}
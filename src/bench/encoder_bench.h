@@ -0,0 +1,65 @@
+#ifndef ENCODER_BENCH_H_
+#define ENCODER_BENCH_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "api/video_codecs/video_encoder_factory.h"
+
+// PeerConnection を使わずに、ファクトリが作るエンコーダに合成したフレームを直接渡して性能を測る。
+//
+// フレームは FileVideoCapturer のテストパターンを framerate の間隔で生成するので、
+// カメラを繋いだ時と同じく I420 か NativeBuffer がエンコーダに渡る。
+// 最初の warmup_sec 秒は集計せず、その後の duration_sec 秒に Encode() したフレームを集計する。
+class EncoderBench {
+ public:
+  struct Config {
+    std::string codec = "H264";
+    int width = 640;
+    int height = 480;
+    int bitrate_kbps = 1000;
+    int framerate = 30;
+    bool use_native = false;
+    // bars か noise
+    std::string pattern = "bars";
+    int duration_sec = 10;
+    int warmup_sec = 2;
+  };
+
+  struct Result {
+    Config config;
+    std::string implementation;
+    int64_t input_frames = 0;
+    int64_t encoded_frames = 0;
+    // Encode() が失敗したか、エンコーダが出力しなかったフレーム数
+    int64_t dropped_frames = 0;
+    int64_t key_frames = 0;
+    double fps = 0;
+    // Encode() を呼んでから EncodedImageCallback に出力されるまでの時間
+    double latency_p50_ms = 0;
+    double latency_p90_ms = 0;
+    double latency_p99_ms = 0;
+    double latency_max_ms = 0;
+    double actual_kbps = 0;
+    // 実際のビットレートが目標の何 % だったか
+    double bitrate_accuracy_percent = 0;
+    // プロセス全体の CPU 時間。100% で 1 コア分になる。パターンの生成も含む
+    double cpu_percent = 0;
+    // 取得できない環境では負の値になる
+    double gpu_percent = -1;
+    std::string gpu_source;
+
+    nlohmann::json ToJson() const;
+  };
+
+  // エンコーダを作れなかった場合は false を返して error に理由を入れる
+  static bool Run(webrtc::VideoEncoderFactory* factory,
+                  const Config& config,
+                  Result* result,
+                  std::string* error);
+};
+
+#endif  // ENCODER_BENCH_H_
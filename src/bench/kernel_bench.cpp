@@ -0,0 +1,314 @@
+#include "kernel_bench.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <regex>
+#include <thread>
+
+#include "api/video/i420_buffer.h"
+#include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "connection_settings.h"
+#include "momo_version.h"
+#include "rtc/frame_buffer_pool.h"
+#include "rtc/native_buffer.h"
+#include "rtc/parallel_scaler.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+namespace {
+
+struct Case {
+  std::string name;
+  // 入力のフレームの大きさ
+  size_t bytes;
+  std::function<void()> run;
+};
+
+std::string SizeName(int width, int height) {
+  return std::to_string(width) + "x" + std::to_string(height);
+}
+
+// 縮小やエンコーダで差が出ないように、位置だけで決まるなだらかな絵にする
+rtc::scoped_refptr<webrtc::I420Buffer> CreateSource(int width, int height) {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      webrtc::I420Buffer::Create(width, height);
+  for (int y = 0; y < height; y++) {
+    uint8_t* row = buffer->MutableDataY() + buffer->StrideY() * y;
+    for (int x = 0; x < width; x++) {
+      row[x] = static_cast<uint8_t>(x + y);
+    }
+  }
+  for (int y = 0; y < buffer->ChromaHeight(); y++) {
+    uint8_t* u = buffer->MutableDataU() + buffer->StrideU() * y;
+    uint8_t* v = buffer->MutableDataV() + buffer->StrideV() * y;
+    for (int x = 0; x < buffer->ChromaWidth(); x++) {
+      u[x] = static_cast<uint8_t>(x * 2);
+      v[x] = static_cast<uint8_t>(y * 2);
+    }
+  }
+  return buffer;
+}
+
+// V4L2VideoCapture::ConvertCapturedBuffer と同じ変換
+void ConvertCapturedBuffer(const uint8_t* data,
+                   size_t size,
+                   int width,
+                   int height,
+                   webrtc::VideoType video_type) {
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+      FrameBufferPool::Instance().CreateI420Buffer(width, height);
+  libyuv::ConvertToI420(data, size, i420_buffer->MutableDataY(),
+                        i420_buffer->StrideY(), i420_buffer->MutableDataU(),
+                        i420_buffer->StrideU(), i420_buffer->MutableDataV(),
+                        i420_buffer->StrideV(), 0, 0, width, height, width,
+                        height, libyuv::kRotate0, ConvertVideoType(video_type));
+}
+
+rtc::scoped_refptr<NativeBuffer> CreateNativeBuffer(
+    webrtc::VideoType video_type,
+    int width,
+    int height,
+    const std::vector<uint8_t>& data) {
+  rtc::scoped_refptr<NativeBuffer> buffer =
+      NativeBuffer::Create(video_type, width, height);
+  memcpy(buffer->MutableData(), data.data(), data.size());
+  buffer->SetLength(data.size());
+  return buffer;
+}
+
+void AddPackedCases(const char* format,
+                    webrtc::VideoType video_type,
+                    int width,
+                    int height,
+                    std::vector<uint8_t> data,
+                    std::vector<Case>* cases) {
+  auto shared = std::make_shared<std::vector<uint8_t>>(std::move(data));
+  cases->push_back({std::string("ConvertToI420/") + format + "/" +
+                        SizeName(width, height),
+                    shared->size(), [=]() {
+                      ConvertCapturedBuffer(shared->data(), shared->size(),
+                                            width, height, video_type);
+                    }});
+  // NativeBuffer の領域は幅 x 高さ x 4 バイトなので、それより大きい JPEG は扱えない
+  if (shared->size() > static_cast<size_t>(width) * height * 4) {
+    return;
+  }
+  rtc::scoped_refptr<NativeBuffer> native =
+      CreateNativeBuffer(video_type, width, height, *shared);
+  // ToI420() の結果はキャッシュされるので、SetScaledSize() で捨ててから毎回変換させる
+  cases->push_back(
+      {std::string("NativeBuffer::ToI420/") + format + "/" +
+           SizeName(width, height),
+       shared->size(), [=]() {
+         native->SetScaledSize(width, height);
+         native->ToI420();
+       }});
+  // 縮小を指定した場合は、その解像度に直接変換する (MJPEG は DCT の段階で縮小する)
+  const int half_width = width / 2 / 2 * 2;
+  const int half_height = height / 2 / 2 * 2;
+  cases->push_back(
+      {std::string("NativeBuffer::ToI420/") + format + "/" +
+           SizeName(width, height) + "/" + SizeName(half_width, half_height),
+       shared->size(), [=]() {
+         native->SetScaledSize(half_width, half_height);
+         native->ToI420();
+       }});
+}
+
+void AddCases(int width, int height, std::vector<Case>* cases) {
+  rtc::scoped_refptr<webrtc::I420Buffer> source = CreateSource(width, height);
+  const size_t i420_size =
+      webrtc::CalcBufferSize(webrtc::VideoType::kI420, width, height);
+
+  std::vector<uint8_t> yuy2(
+      webrtc::CalcBufferSize(webrtc::VideoType::kYUY2, width, height));
+  libyuv::I420ToYUY2(source->DataY(), source->StrideY(), source->DataU(),
+                     source->StrideU(), source->DataV(), source->StrideV(),
+                     yuy2.data(), width * 2, width, height);
+  AddPackedCases("YUY2", webrtc::VideoType::kYUY2, width, height,
+                 std::move(yuy2), cases);
+
+  std::vector<uint8_t> uyvy(
+      webrtc::CalcBufferSize(webrtc::VideoType::kUYVY, width, height));
+  libyuv::I420ToUYVY(source->DataY(), source->StrideY(), source->DataU(),
+                     source->StrideU(), source->DataV(), source->StrideV(),
+                     uyvy.data(), width * 2, width, height);
+  AddPackedCases("UYVY", webrtc::VideoType::kUYVY, width, height,
+                 std::move(uyvy), cases);
+
+  // NV12 の NativeBuffer は Y と UV が隙間なく並んでいるので、そのまま ConvertToI420 にも渡せる
+  rtc::scoped_refptr<NativeBuffer> nv12 =
+      NativeBuffer::Create(webrtc::VideoType::kNV12, width, height);
+  libyuv::I420ToNV12(source->DataY(), source->StrideY(), source->DataU(),
+                     source->StrideU(), source->DataV(), source->StrideV(),
+                     nv12->MutableDataY(), nv12->StrideY(),
+                     nv12->MutableDataUV(), nv12->StrideUV(), width, height);
+  const size_t nv12_size =
+      webrtc::CalcBufferSize(webrtc::VideoType::kNV12, width, height);
+  nv12->SetLength(nv12_size);
+  cases->push_back({"ConvertToI420/NV12/" + SizeName(width, height),
+                    nv12_size, [=]() {
+                      ConvertCapturedBuffer(nv12->Data(), nv12_size, width,
+                                            height, webrtc::VideoType::kNV12);
+                    }});
+  cases->push_back({"NativeBuffer::ToI420/NV12/" + SizeName(width, height),
+                    nv12_size, [=]() {
+                      nv12->SetScaledSize(width, height);
+                      nv12->ToI420();
+                    }});
+
+  // VideoAdapter は 3/4 と 1/2 を繰り返して縮小するので、その 2 つを測る
+  const int ratios[][2] = {{3, 4}, {1, 2}};
+  for (const auto& ratio : ratios) {
+    const int scaled_width = width * ratio[0] / ratio[1] / 2 * 2;
+    const int scaled_height = height * ratio[0] / ratio[1] / 2 * 2;
+    const std::string suffix = SizeName(width, height) + "/" +
+                               SizeName(scaled_width, scaled_height);
+    // 1 つのスレッドでの I420 と NV12 の縮小
+    cases->push_back({"I420Buffer::ScaleFrom/I420/" + suffix, i420_size,
+                      [=]() {
+                        rtc::scoped_refptr<webrtc::I420Buffer> scaled =
+                            FrameBufferPool::Instance().CreateI420Buffer(
+                                scaled_width, scaled_height);
+                        scaled->ScaleFrom(*source);
+                      }});
+    cases->push_back(
+        {"NV12Scale/NV12/" + suffix, nv12_size, [=]() {
+           rtc::scoped_refptr<NativeBuffer> scaled =
+               FrameBufferPool::Instance().CreateNativeBuffer(
+                   webrtc::VideoType::kNV12, scaled_width, scaled_height);
+           libyuv::NV12Scale(nv12->DataY(), nv12->StrideY(), nv12->DataUV(),
+                             nv12->StrideUV(), width, height,
+                             scaled->MutableDataY(), scaled->StrideY(),
+                             scaled->MutableDataUV(), scaled->StrideUV(),
+                             scaled_width, scaled_height, libyuv::kFilterBox);
+         }});
+    // momo の中では ParallelScaler で帯に分けて縮小する
+    cases->push_back({"ParallelScaler::ScaleFrom/I420/" + suffix, i420_size,
+                      [=]() {
+                        rtc::scoped_refptr<webrtc::I420Buffer> scaled =
+                            FrameBufferPool::Instance().CreateI420Buffer(
+                                scaled_width, scaled_height);
+                        ParallelScaler::Instance().ScaleFrom(*source,
+                                                             scaled.get());
+                      }});
+    cases->push_back(
+        {"ParallelScaler::NV12Scale/NV12/" + suffix, nv12_size, [=]() {
+           rtc::scoped_refptr<NativeBuffer> scaled =
+               FrameBufferPool::Instance().CreateNativeBuffer(
+                   webrtc::VideoType::kNV12, scaled_width, scaled_height);
+           ParallelScaler::Instance().NV12Scale(
+               nv12->DataY(), nv12->StrideY(), nv12->DataUV(),
+               nv12->StrideUV(), width, height, scaled->MutableDataY(),
+               scaled->StrideY(), scaled->MutableDataUV(), scaled->StrideUV(),
+               scaled_width, scaled_height, libyuv::kFilterBox);
+         }});
+  }
+}
+
+KernelBench::Result Measure(const Case& c, double min_time_sec) {
+  // 1 回目はバッファの確保などが入るので測らない
+  c.run();
+
+  const int64_t min_time_ns =
+      static_cast<int64_t>(min_time_sec * rtc::kNumNanosecsPerSec);
+  const int64_t start_ns = rtc::TimeNanos();
+  const clock_t start_clock = clock();
+  int64_t iterations = 0;
+  int64_t elapsed_ns = 0;
+  do {
+    c.run();
+    iterations++;
+    elapsed_ns = rtc::TimeNanos() - start_ns;
+  } while (elapsed_ns < min_time_ns);
+  const double cpu_ns = static_cast<double>(clock() - start_clock) *
+                        rtc::kNumNanosecsPerSec / CLOCKS_PER_SEC;
+
+  KernelBench::Result result;
+  result.name = c.name;
+  result.iterations = iterations;
+  result.real_time_ns = static_cast<double>(elapsed_ns) / iterations;
+  result.cpu_time_ns = cpu_ns / iterations;
+  result.bytes_per_second = c.bytes * iterations * 1e9 / elapsed_ns;
+  return result;
+}
+
+}  // namespace
+
+bool KernelBench::Run(const Config& config,
+                      std::function<void(const Result&)> on_result,
+                      std::string* error) {
+  std::vector<uint8_t> jpeg;
+  int jpeg_width = 0;
+  int jpeg_height = 0;
+  if (!config.mjpeg_file.empty()) {
+    std::ifstream ifs(config.mjpeg_file, std::ios::binary);
+    jpeg.assign(std::istreambuf_iterator<char>(ifs),
+                std::istreambuf_iterator<char>());
+    if (jpeg.empty() || libyuv::MJPGSize(jpeg.data(), jpeg.size(),
+                                         &jpeg_width, &jpeg_height) != 0) {
+      *error = "Failed to read JPEG: " + config.mjpeg_file;
+      return false;
+    }
+  }
+
+  std::regex filter(config.filter.empty() ? std::string(".") : config.filter);
+  auto run_cases = [&](const std::vector<Case>& cases) {
+    for (const auto& c : cases) {
+      if (std::regex_search(c.name, filter)) {
+        on_result(Measure(c, config.min_time_sec));
+      }
+    }
+  };
+
+  // 4K のバッファを全部同時に持たないように、解像度毎に作って捨てる
+  for (const auto& resolution : config.resolutions) {
+    ConnectionSettings cs;
+    cs.resolution = resolution;
+    auto size = cs.getSize();
+    std::vector<Case> cases;
+    AddCases(size.width, size.height, &cases);
+    run_cases(cases);
+    FrameBufferPool::Instance().Release();
+  }
+  if (!jpeg.empty()) {
+    // MJPEG は縮小せずにデコードするので、解像度は JPEG のものになる
+    std::vector<Case> cases;
+    AddPackedCases("MJPEG", webrtc::VideoType::kMJPEG, jpeg_width, jpeg_height,
+                   std::move(jpeg), &cases);
+    run_cases(cases);
+    FrameBufferPool::Instance().Release();
+  }
+  return true;
+}
+
+nlohmann::json KernelBench::ToJson(const std::vector<Result>& results) {
+  nlohmann::json benchmarks = nlohmann::json::array();
+  for (const auto& result : results) {
+    benchmarks.push_back({
+        {"name", result.name},
+        {"run_name", result.name},
+        {"run_type", "iteration"},
+        {"iterations", result.iterations},
+        {"real_time", result.real_time_ns},
+        {"cpu_time", result.cpu_time_ns},
+        {"time_unit", "ns"},
+        {"bytes_per_second", result.bytes_per_second},
+    });
+  }
+  return {
+      {"context",
+       {
+           {"executable", "momo_bench"},
+           {"num_cpus", std::thread::hardware_concurrency()},
+           {"momo_version", MomoVersion::GetClientName()},
+           {"libwebrtc_version", MomoVersion::GetLibwebrtcName()},
+           {"environment", MomoVersion::GetEnvironmentName()},
+       }},
+      {"benchmarks", benchmarks},
+  };
+}
@@ -0,0 +1,46 @@
+#ifndef KERNEL_BENCH_H_
+#define KERNEL_BENCH_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// キャプチャから描画までの経路で、フレーム毎に呼ばれる変換と縮小の処理だけを繰り返し実行して時間を測る。
+//
+// 各処理は momo の中と同じ関数を同じ引数で呼ぶので、libyuv の NEON や AVX2 の経路の違いや、
+// 変更による性能の変化をカメラ無しで比べられる。
+// JSON の出力は Google Benchmark と同じ形式なので、compare.py などでそのまま比較できる。
+class KernelBench {
+ public:
+  struct Config {
+    std::vector<std::string> resolutions = {"VGA", "HD", "FHD", "4K"};
+    // 空でなければ、名前がこの正規表現に一致するものだけを実行する
+    std::string filter;
+    // 1 つの処理を繰り返す最低の時間
+    double min_time_sec = 0.5;
+    // MJPEG の入力に使う JPEG ファイル。空の場合は MJPEG の処理を実行しない
+    std::string mjpeg_file;
+  };
+
+  struct Result {
+    std::string name;
+    int64_t iterations = 0;
+    double real_time_ns = 0;
+    double cpu_time_ns = 0;
+    // 入力のフレームの大きさから求めた 1 秒あたりの処理量
+    double bytes_per_second = 0;
+  };
+
+  // 結果が出る度に on_result を呼ぶ。入力を用意できなかった場合は false を返して error に理由を入れる
+  static bool Run(const Config& config,
+                  std::function<void(const Result&)> on_result,
+                  std::string* error);
+
+  static nlohmann::json ToJson(const std::vector<Result>& results);
+};
+
+#endif  // KERNEL_BENCH_H_
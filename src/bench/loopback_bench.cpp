@@ -0,0 +1,424 @@
+#include "loopback_bench.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http.hpp>
+
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "connection_settings.h"
+#include "rtc/connection.h"
+#include "rtc/latency_marker.h"
+#include "rtc/manager.h"
+#include "rtc/messagesender.h"
+#include "rtc/video_track_receiver.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "util.h"
+#include "ws/signaling_message.h"
+#include "ws/websocket.h"
+
+namespace {
+
+// /metrics を読んで、メトリクス名毎に全てのラベルの値を合計したものを返す
+bool FetchMetrics(const std::string& host,
+                  int port,
+                  std::map<std::string, double>* metrics) {
+  namespace http = boost::beast::http;
+  boost::asio::io_context ioc;
+  boost::asio::ip::tcp::resolver resolver(ioc);
+  boost::beast::tcp_stream stream(ioc);
+  boost::system::error_code ec;
+  auto results = resolver.resolve(host, std::to_string(port), ec);
+  if (ec) {
+    return false;
+  }
+  stream.expires_after(std::chrono::seconds(2));
+  stream.connect(results, ec);
+  if (ec) {
+    return false;
+  }
+  http::request<http::empty_body> req(http::verb::get, "/metrics", 11);
+  req.set(http::field::host, host);
+  http::write(stream, req, ec);
+  if (ec) {
+    return false;
+  }
+  boost::beast::flat_buffer buffer;
+  http::response<http::string_body> res;
+  http::read(stream, buffer, res, ec);
+  stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  if (res.result() != http::status::ok) {
+    return false;
+  }
+
+  metrics->clear();
+  std::istringstream body(res.body());
+  std::string line;
+  while (std::getline(body, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t name_end = line.find_first_of("{ ");
+    size_t value_start = line.rfind(' ');
+    if (name_end == std::string::npos || value_start == std::string::npos) {
+      continue;
+    }
+    (*metrics)[line.substr(0, name_end)] +=
+        strtod(line.c_str() + value_start + 1, nullptr);
+  }
+  return true;
+}
+
+// 受信専用の PeerConnection で、テストモードのページと同じように offer を送って映像を受け取る
+class LoopbackReceiver : public RTCMessageSender,
+                         public VideoTrackReceiver,
+                         public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  explicit LoopbackReceiver(Websocket* ws) : ws_(ws) {}
+
+  void SetConnection(std::shared_ptr<RTCConnection> connection) {
+    connection_ = std::move(connection);
+  }
+
+  void SetWindow(int64_t start_us, int64_t end_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_start_us_ = start_us;
+    window_end_us_ = end_us;
+  }
+
+  bool WaitFirstFrame(int timeout_sec) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cond_.wait_for(lock, std::chrono::seconds(timeout_sec),
+                          [this]() { return first_frame_received_; });
+  }
+
+  // OnFrame() はトラックのロックを取った状態で呼ばれるので、mutex_ を取ったまま
+  // AddOrUpdateSink() や RemoveSink() を呼ばないこと
+  void RemoveAllTracks() {
+    std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> tracks;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tracks.swap(tracks_);
+    }
+    for (auto track : tracks) {
+      track->RemoveSink(this);
+    }
+  }
+
+  void OnMessage(const std::string& text) {
+    nlohmann::json message = nlohmann::json::parse(text, nullptr, false);
+    if (message.is_discarded() || !message.is_object()) {
+      return;
+    }
+    const std::string type = message.value("type", "");
+    try {
+      if (type == "answer") {
+        connection_->setAnswer(message["sdp"].get<std::string>());
+      } else if (type == "candidate") {
+        const nlohmann::json& ice = message["ice"];
+        connection_->addIceCandidate(ice["sdpMid"].get<std::string>(),
+                                     ice["sdpMLineIndex"].get<int>(),
+                                     ice["candidate"].get<std::string>());
+      } else if (type == "candidates") {
+        for (const auto& ice : message["candidates"]) {
+          connection_->addIceCandidate(ice["sdpMid"].get<std::string>(),
+                                       ice["sdpMLineIndex"].get<int>(),
+                                       ice["candidate"].get<std::string>());
+        }
+      } else if (type == "ping") {
+        ws_->sendText(R"({"type":"pong"})");
+      }
+    } catch (nlohmann::json::exception& e) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Invalid message: " << e.what();
+    }
+  }
+
+  void Collect(LoopbackBench::Result* result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const double duration_sec =
+        (window_end_us_ - window_start_us_) / 1000000.0;
+    result->width = width_;
+    result->height = height_;
+    result->received_frames = received_frames_;
+    result->missing_frames = missing_frames_;
+    result->fps = received_frames_ / duration_sec;
+    if (latencies_ms_.empty()) {
+      return;
+    }
+    std::sort(latencies_ms_.begin(), latencies_ms_.end());
+    auto percentile = [this](double p) {
+      size_t index = static_cast<size_t>(p * (latencies_ms_.size() - 1));
+      return static_cast<double>(latencies_ms_[index]);
+    };
+    result->latency_p50_ms = percentile(0.5);
+    result->latency_p90_ms = percentile(0.9);
+    result->latency_p99_ms = percentile(0.99);
+    result->latency_max_ms = latencies_ms_.back();
+  }
+
+  // RTCMessageSender
+  void onIceConnectionStateChange(
+      webrtc::PeerConnectionInterface::IceConnectionState new_state) override {
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": "
+                     << Util::iceConnectionStateToString(new_state);
+  }
+  void onIceCandidate(const std::string sdp_mid,
+                      const int sdp_mlineindex,
+                      const std::string sdp) override {
+    ws_->sendText(SignalingWriter("candidate", sdp.size() + sdp_mid.size() + 64)
+                      .BeginObject("ice")
+                      .Add("candidate", sdp)
+                      .Add("sdpMLineIndex", sdp_mlineindex)
+                      .Add("sdpMid", sdp_mid)
+                      .Finish());
+  }
+  void onCreateDescription(webrtc::SdpType type,
+                           const std::string sdp) override {
+    ws_->sendText(SignalingWriter(webrtc::SdpTypeToString(type), sdp.size())
+                      .Add("sdp", sdp)
+                      .Finish());
+  }
+  void onSetDescription(webrtc::SdpType type) override {}
+
+  // VideoTrackReceiver
+  void AddTrack(webrtc::VideoTrackInterface* track) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tracks_.push_back(track);
+    }
+    track->AddOrUpdateSink(this, rtc::VideoSinkWants());
+  }
+  void RemoveTrack(webrtc::VideoTrackInterface* track) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = std::find(tracks_.begin(), tracks_.end(), track);
+      if (it == tracks_.end()) {
+        return;
+      }
+      tracks_.erase(it);
+    }
+    track->RemoveSink(this);
+  }
+
+  // rtc::VideoSinkInterface
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    const int64_t now_us = rtc::TimeMicros();
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+        frame.video_frame_buffer()->ToI420();
+    uint32_t timestamp_ms;
+    const bool found =
+        LatencyMarker::Read(buffer->DataY(), buffer->StrideY(),
+                            buffer->width(), buffer->height(), &timestamp_ms);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!first_frame_received_) {
+      first_frame_received_ = true;
+      cond_.notify_all();
+    }
+    if (now_us < window_start_us_ || now_us >= window_end_us_) {
+      return;
+    }
+    width_ = frame.width();
+    height_ = frame.height();
+    received_frames_++;
+    if (!found) {
+      missing_frames_++;
+      return;
+    }
+    // 下位 32 ビットしか無いので、差を符号付きで解釈する
+    latencies_ms_.push_back(
+        static_cast<int32_t>(LatencyMarker::NowMs() - timestamp_ms));
+  }
+
+ private:
+  Websocket* ws_;
+  std::shared_ptr<RTCConnection> connection_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> tracks_;
+  bool first_frame_received_ = false;
+  int64_t window_start_us_ = 0;
+  int64_t window_end_us_ = 0;
+  int width_ = 0;
+  int height_ = 0;
+  int64_t received_frames_ = 0;
+  int64_t missing_frames_ = 0;
+  std::vector<int64_t> latencies_ms_;
+};
+
+}  // namespace
+
+nlohmann::json LoopbackBench::Result::ToJson() const {
+  nlohmann::json json = {
+      {"scenario", config.scenario},
+      {"codec", config.codec},
+      {"width", width},
+      {"height", height},
+      {"received_frames", received_frames},
+      {"missing_frames", missing_frames},
+      {"fps", fps},
+      {"latency_p50_ms", latency_p50_ms},
+      {"latency_p90_ms", latency_p90_ms},
+      {"latency_p99_ms", latency_p99_ms},
+      {"latency_max_ms", latency_max_ms},
+  };
+  auto add_if_valid = [&json](const char* key, double value) {
+    if (value >= 0) {
+      json[key] = value;
+    }
+  };
+  add_if_valid("sender_fps", sender_fps);
+  add_if_valid("encode_ms", encode_ms);
+  add_if_valid("video_kbps", video_kbps);
+  add_if_valid("loss_rate", loss_rate);
+  add_if_valid("sender_cpu_percent", sender_cpu_percent);
+  add_if_valid("sender_rss_bytes", sender_rss_bytes);
+  return json;
+}
+
+bool LoopbackBench::Run(const Config& config,
+                        Result* result,
+                        std::string* error) {
+  *result = Result();
+  result->config = config;
+
+  boost::asio::io_context ioc;
+  auto work_guard = boost::asio::make_work_guard(ioc);
+  Websocket ws(ioc);
+  {
+    boost::system::error_code ec;
+    boost::asio::ip::tcp::resolver resolver(ioc);
+    auto results =
+        resolver.resolve(config.host, std::to_string(config.port), ec);
+    if (!ec) {
+      boost::asio::connect(ws.nativeSocket().next_layer(), results, ec);
+    }
+    if (!ec) {
+      ws.nativeSocket().handshake(
+          config.host + ":" + std::to_string(config.port), "/ws", ec);
+    }
+    if (ec) {
+      *error = "Failed to connect to ws://" + config.host + ":" +
+               std::to_string(config.port) + "/ws: " + ec.message();
+      return false;
+    }
+  }
+
+  LoopbackReceiver receiver(&ws);
+  ws.startToRead([&receiver](boost::system::error_code ec,
+                             std::size_t bytes_transferred, std::string text) {
+    if (!ec) {
+      receiver.OnMessage(text);
+    }
+  });
+  std::thread ioc_thread([&ioc]() { ioc.run(); });
+
+  // 音声も映像も送らず、受信した映像だけをデコードする
+  ConnectionSettings cs;
+  cs.no_video_device = true;
+  cs.no_audio_device = true;
+  cs.rtc_config.codec_preference = {config.codec};
+  std::unique_ptr<RTCManager> rtc_manager(new RTCManager(
+      cs, std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>>(),
+      &receiver));
+  std::shared_ptr<RTCConnection> connection = rtc_manager->createConnection(
+      webrtc::PeerConnectionInterface::RTCConfiguration(), &receiver);
+  bool ok = connection != nullptr;
+  if (!ok) {
+    *error = "Failed to create the PeerConnection";
+  } else {
+    receiver.SetConnection(connection);
+    connection->createOffer();
+    ok = receiver.WaitFirstFrame(config.connect_timeout_sec);
+    if (!ok) {
+      *error = "No video frame received in " +
+               std::to_string(config.connect_timeout_sec) + " seconds";
+    }
+  }
+
+  if (ok) {
+    const int64_t start_us =
+        rtc::TimeMicros() + config.warmup_sec * rtc::kNumMicrosecsPerSec;
+    const int64_t end_us =
+        start_us + config.duration_sec * rtc::kNumMicrosecsPerSec;
+    receiver.SetWindow(start_us, end_us);
+    auto sleep_until = [](int64_t time_us) {
+      const int64_t now_us = rtc::TimeMicros();
+      if (time_us > now_us) {
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(time_us - now_us));
+      }
+    };
+
+    // 送信側の値は 1 秒毎に読んで、ゲージは平均、CPU 時間は最初と最後の差を使う
+    std::map<std::string, double> sums;
+    std::map<std::string, int> counts;
+    double cpu_start = -1;
+    double cpu_end = -1;
+    for (int64_t t = start_us; t <= end_us; t += rtc::kNumMicrosecsPerSec) {
+      sleep_until(t);
+      std::map<std::string, double> metrics;
+      if (!FetchMetrics(config.host, config.port, &metrics)) {
+        continue;
+      }
+      for (const auto& m : metrics) {
+        sums[m.first] += m.second;
+        counts[m.first]++;
+      }
+      auto cpu = metrics.find("momo_thread_cpu_seconds_total");
+      if (cpu != metrics.end()) {
+        if (cpu_start < 0) {
+          cpu_start = cpu->second;
+        }
+        cpu_end = cpu->second;
+      }
+      auto rss = metrics.find("momo_process_resident_bytes");
+      if (rss != metrics.end()) {
+        result->sender_rss_bytes =
+            std::max(result->sender_rss_bytes, rss->second);
+      }
+    }
+    auto average = [&sums, &counts](const std::string& name,
+                                    double scale) -> double {
+      auto it = counts.find(name);
+      if (it == counts.end()) {
+        return -1;
+      }
+      return sums[name] / it->second * scale;
+    };
+    result->sender_fps = average("momo_stats_video_fps", 1);
+    result->encode_ms = average("momo_stats_encode_seconds_per_frame", 1000);
+    result->video_kbps = average("momo_stats_video_bitrate_bps", 0.001);
+    result->loss_rate = average("momo_stats_loss_rate", 1);
+    if (cpu_start >= 0) {
+      result->sender_cpu_percent =
+          (cpu_end - cpu_start) * 100 / config.duration_sec;
+    }
+    sleep_until(end_us);
+    receiver.Collect(result);
+  }
+
+  receiver.RemoveAllTracks();
+  connection = nullptr;
+  rtc_manager = nullptr;
+  work_guard.reset();
+  ioc.stop();
+  ioc_thread.join();
+  return ok;
+}
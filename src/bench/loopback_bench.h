@@ -0,0 +1,65 @@
+#ifndef LOOPBACK_BENCH_H_
+#define LOOPBACK_BENCH_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+// test モードで起動した Momo に P2PServer の WebSocket で繋いで映像を受信し、
+// キャプチャから受信までの全体の性能を測る。
+//
+// ブラウザの代わりに受信専用の PeerConnection を作って offer を送り、届いたフレームの
+// 左上のマーカー (--latency-marker) を読んで glass-to-glass の遅延を集計する。
+// 送信側のエンコード時間、CPU 使用率、RSS は、同じポートの /metrics から 1 秒毎に読む。
+// 送信側では --latency-marker と --stats-interval-ms を指定しておくこと。
+//
+// 最初の warmup_sec 秒は集計せず、その後の duration_sec 秒に受信したフレームを集計する。
+class LoopbackBench {
+ public:
+  struct Config {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    // offer で優先するコーデック。送信側はこの順序に従って選ぶ
+    std::string codec = "H264";
+    int duration_sec = 10;
+    int warmup_sec = 3;
+    // 最初のフレームが届くまで待つ時間
+    int connect_timeout_sec = 10;
+    // レポートで結果を区別するための名前
+    std::string scenario;
+  };
+
+  struct Result {
+    Config config;
+    // 最後に受信したフレームの大きさ
+    int width = 0;
+    int height = 0;
+    int64_t received_frames = 0;
+    // マーカーが読み取れなかったフレーム数
+    int64_t missing_frames = 0;
+    double fps = 0;
+    // キャプチャしてから受信側でデコードされるまでの時間
+    double latency_p50_ms = 0;
+    double latency_p90_ms = 0;
+    double latency_p99_ms = 0;
+    double latency_max_ms = 0;
+    // 以下は送信側の /metrics から読んだ値。読めなかった場合は負の値になる
+    double sender_fps = -1;
+    double encode_ms = -1;
+    double video_kbps = -1;
+    double loss_rate = -1;
+    // 送信側の全てのスレッドの CPU 時間。100% で 1 コア分になる
+    double sender_cpu_percent = -1;
+    // 集計期間中の送信側の RSS の最大値
+    double sender_rss_bytes = -1;
+
+    nlohmann::json ToJson() const;
+  };
+
+  // 繋がらなかった場合やフレームが届かなかった場合は false を返して error に理由を入れる
+  static bool Run(const Config& config, Result* result, std::string* error);
+};
+
+#endif  // LOOPBACK_BENCH_H_
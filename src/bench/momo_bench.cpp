@@ -0,0 +1,296 @@
+#include <stdio.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <CLI/CLI.hpp>
+#include <nlohmann/json.hpp>
+
+#include "api/video_codecs/video_encoder_factory.h"
+#include "connection_settings.h"
+#include "encoder_bench.h"
+#include "kernel_bench.h"
+#include "loopback_bench.h"
+#include "rtc_base/logging.h"
+
+#ifdef __APPLE__
+#include "mac_helper/objc_codec_factory_helper.h"
+#else
+#include "api/video_codecs/builtin_video_encoder_factory.h"
+#endif
+
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+    USE_V4L2_M2M || USE_VAAPI_ENCODER
+#include "rtc/hw_video_encoder_factory.h"
+#endif
+
+namespace {
+
+int RunKernelBench(const KernelBench::Config& config, bool json) {
+  if (!json) {
+    printf("%-52s %14s %14s %10s %12s\n", "Benchmark", "Time", "CPU",
+           "Iterations", "Throughput");
+  }
+  std::vector<KernelBench::Result> results;
+  std::string error;
+  bool ok = KernelBench::Run(
+      config,
+      [&results, json](const KernelBench::Result& result) {
+        results.push_back(result);
+        if (json) {
+          return;
+        }
+        printf("%-52s %11.0f ns %11.0f ns %10lld %7.0f MB/s\n",
+               result.name.c_str(), result.real_time_ns, result.cpu_time_ns,
+               (long long)result.iterations,
+               result.bytes_per_second / 1024 / 1024);
+        fflush(stdout);
+      },
+      &error);
+  if (!ok) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  if (json) {
+    std::cout << KernelBench::ToJson(results).dump(2) << std::endl;
+  }
+  return 0;
+}
+
+int RunLoopbackBench(const LoopbackBench::Config& config, bool json) {
+  LoopbackBench::Result result;
+  std::string error;
+  if (!LoopbackBench::Run(config, &result, &error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  if (json) {
+    std::cout << result.ToJson().dump(2) << std::endl;
+    return 0;
+  }
+  auto value = [](double v, const char* format) {
+    char buf[32];
+    if (v < 0) {
+      return std::string("-");
+    }
+    snprintf(buf, sizeof(buf), format, v);
+    return std::string(buf);
+  };
+  std::string size_str =
+      std::to_string(result.width) + "x" + std::to_string(result.height);
+  printf("%-16s %-6s %-10s %7s %7s %7s %7s %7s %7s %7s %8s %6s %6s %8s\n",
+         "scenario", "codec", "size", "fps", "p50ms", "p90ms", "p99ms",
+         "maxms", "miss", "encms", "kbps", "loss%", "cpu%", "rssMB");
+  printf(
+      "%-16s %-6s %-10s %7.1f %7.1f %7.1f %7.1f %7.1f %7lld %7s %8s %6s %6s "
+      "%8s\n",
+      config.scenario.c_str(), config.codec.c_str(), size_str.c_str(),
+      result.fps, result.latency_p50_ms, result.latency_p90_ms,
+      result.latency_p99_ms, result.latency_max_ms,
+      (long long)result.missing_frames,
+      value(result.encode_ms, "%.1f").c_str(),
+      value(result.video_kbps, "%.0f").c_str(),
+      value(result.loss_rate < 0 ? -1 : result.loss_rate * 100, "%.1f")
+          .c_str(),
+      value(result.sender_cpu_percent, "%.1f").c_str(),
+      value(result.sender_rss_bytes < 0 ? -1
+                                        : result.sender_rss_bytes / 1024 / 1024,
+            "%.1f")
+          .c_str());
+  return 0;
+}
+
+}  // namespace
+
+// momo と同じエンコーダのファクトリを使って、コーデック、解像度、ビットレート、
+// --use-native の組み合わせ毎にエンコーダの性能を測る。
+// kernels サブコマンドの場合は、キャプチャの経路の変換と縮小の処理だけを測る。
+// loopback サブコマンドの場合は、test モードの Momo から映像を受信して全体の性能を測る
+int main(int argc, char* argv[]) {
+  std::vector<std::string> codecs = {"H264"};
+  std::vector<std::string> resolutions = {"VGA", "HD", "FHD"};
+  std::vector<int> bitrates = {1000};
+  std::string buffer = "i420";
+  EncoderBench::Config base;
+  bool nvcodec_async = false;
+  bool mmal_low_latency = false;
+  bool low_latency_rate_control = false;
+  bool json = false;
+  int log_level = rtc::LS_NONE;
+
+  CLI::App app("Momo - encoder benchmark");
+  app.add_option("--codec", codecs, "Video codecs (VP8, VP9, AV1, H264)")
+      ->delimiter(',');
+  app.add_option("--resolution", resolutions,
+                 "Video resolutions (QVGA, VGA, HD, FHD, 4K, or [WIDTH]x[HEIGHT])")
+      ->delimiter(',');
+  app.add_option("--bitrate", bitrates, "Video bitrates (kbps)")
+      ->check(CLI::Range(1, 100000))
+      ->delimiter(',');
+  app.add_option("--framerate", base.framerate, "Video framerate")
+      ->check(CLI::Range(1, 60));
+  app.add_option("--duration", base.duration_sec,
+                 "Measurement duration per case (sec)")
+      ->check(CLI::Range(1, 3600));
+  app.add_option("--warmup", base.warmup_sec,
+                 "Warmup duration per case, not measured (sec)")
+      ->check(CLI::Range(0, 60));
+  app.add_set("--buffer", buffer, {"i420", "native", "both"},
+              "Frame buffer passed to the encoder (native is the same as --use-native)");
+  app.add_set("--pattern", base.pattern, {"bars", "noise"},
+              "Test pattern of the input frames");
+  app.add_flag("--nvcodec-async", nvcodec_async,
+               "Use NVIDIA VIDEO CODEC SDK asynchronous mode");
+  app.add_flag("--mmal-low-latency", mmal_low_latency,
+               "Use low latency mode of MMAL encoder");
+  app.add_flag("--low-latency-rate-control", low_latency_rate_control,
+               "Use low latency rate control of hardware encoders");
+  app.add_flag("--json", json, "Print results as JSON");
+  app.add_option("--log-level", log_level, "Log severity level threshold")
+      ->check(CLI::Range((int)rtc::LS_VERBOSE, (int)rtc::LS_NONE));
+
+  KernelBench::Config kernel_config;
+  auto kernels = app.add_subcommand(
+      "kernels", "Measure frame conversion and scaling on the capture path");
+  kernels
+      ->add_option("--resolution", kernel_config.resolutions,
+                   "Frame resolutions (QVGA, VGA, HD, FHD, 4K, or [WIDTH]x[HEIGHT])")
+      ->delimiter(',');
+  kernels->add_option("--filter", kernel_config.filter,
+                      "Run only benchmarks whose name matches this regex");
+  kernels
+      ->add_option("--min-time", kernel_config.min_time_sec,
+                   "Minimum time to run each benchmark (sec)")
+      ->check(CLI::Range(0.01, 60.0));
+  kernels
+      ->add_option("--mjpeg-file", kernel_config.mjpeg_file,
+                   "JPEG file used as the MJPEG input")
+      ->check(CLI::ExistingFile);
+  kernels->add_flag("--json", json,
+                    "Print results as JSON (Google Benchmark format)");
+
+  LoopbackBench::Config loopback_config;
+  auto loopback = app.add_subcommand(
+      "loopback",
+      "Receive video from momo running in test mode and measure end-to-end "
+      "performance");
+  loopback->add_option("--host", loopback_config.host,
+                       "Host of momo running in test mode");
+  loopback->add_option("--port", loopback_config.port, "Port of momo")
+      ->check(CLI::Range(1, 65535));
+  loopback->add_option("--codec", loopback_config.codec,
+                       "Video codec to prefer (VP8, VP9, AV1, H264)");
+  loopback
+      ->add_option("--duration", loopback_config.duration_sec,
+                   "Measurement duration (sec)")
+      ->check(CLI::Range(1, 3600));
+  loopback
+      ->add_option("--warmup", loopback_config.warmup_sec,
+                   "Warmup duration, not measured (sec)")
+      ->check(CLI::Range(0, 60));
+  loopback
+      ->add_option("--connect-timeout", loopback_config.connect_timeout_sec,
+                   "Time to wait for the first video frame (sec)")
+      ->check(CLI::Range(1, 60));
+  loopback->add_option("--scenario", loopback_config.scenario,
+                       "Name of the scenario written to the result");
+  loopback->add_flag("--json", json, "Print the result as JSON");
+
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    exit(app.exit(e));
+  }
+
+  rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+  rtc::LogMessage::LogTimestamps();
+  rtc::LogMessage::LogThreads();
+
+  if (*kernels) {
+    return RunKernelBench(kernel_config, json);
+  }
+  if (*loopback) {
+    return RunLoopbackBench(loopback_config, json);
+  }
+
+#ifdef __APPLE__
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory =
+      CreateObjCEncoderFactory();
+#elif USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+    USE_V4L2_M2M || USE_VAAPI_ENCODER
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory(
+      new HWVideoEncoderFactory(false, nvcodec_async, mmal_low_latency,
+                                low_latency_rate_control));
+#else
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory =
+      webrtc::CreateBuiltinVideoEncoderFactory();
+#endif
+
+  std::vector<bool> use_natives;
+  if (buffer != "native") {
+    use_natives.push_back(false);
+  }
+  if (buffer != "i420") {
+    use_natives.push_back(true);
+  }
+
+  if (!json) {
+    printf("%-6s %-10s %6s %-6s %-22s %7s %7s %7s %7s %7s %8s %6s %6s %6s\n",
+           "codec", "size", "kbps", "fmt", "implementation", "fps", "p50ms",
+           "p90ms", "p99ms", "maxms", "outkbps", "acc%", "cpu%", "gpu%");
+  }
+  nlohmann::json results = nlohmann::json::array();
+  int failures = 0;
+  for (const auto& codec : codecs) {
+    for (const auto& resolution : resolutions) {
+      ConnectionSettings cs;
+      cs.resolution = resolution;
+      auto size = cs.getSize();
+      for (int bitrate : bitrates) {
+        for (bool use_native : use_natives) {
+          EncoderBench::Config config = base;
+          config.codec = codec;
+          config.width = size.width;
+          config.height = size.height;
+          config.bitrate_kbps = bitrate;
+          config.use_native = use_native;
+
+          EncoderBench::Result result;
+          std::string error;
+          if (!EncoderBench::Run(factory.get(), config, &result, &error)) {
+            failures++;
+            std::cerr << codec << " " << size.width << "x" << size.height
+                      << " " << bitrate << "kbps"
+                      << (use_native ? " native" : "") << ": " << error
+                      << std::endl;
+            continue;
+          }
+          if (json) {
+            results.push_back(result.ToJson());
+            continue;
+          }
+          std::string size_str =
+              std::to_string(size.width) + "x" + std::to_string(size.height);
+          std::string gpu = result.gpu_percent < 0
+                                ? "-"
+                                : std::to_string((int)result.gpu_percent);
+          printf(
+              "%-6s %-10s %6d %-6s %-22s %7.1f %7.1f %7.1f %7.1f %7.1f %8.0f "
+              "%6.1f %6.1f %6s\n",
+              codec.c_str(), size_str.c_str(), bitrate,
+              use_native ? "native" : "i420", result.implementation.c_str(),
+              result.fps, result.latency_p50_ms, result.latency_p90_ms,
+              result.latency_p99_ms, result.latency_max_ms, result.actual_kbps,
+              result.bitrate_accuracy_percent, result.cpu_percent, gpu.c_str());
+          fflush(stdout);
+        }
+      }
+    }
+  }
+  if (json) {
+    std::cout << results.dump(2) << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
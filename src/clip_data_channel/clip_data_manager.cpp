@@ -0,0 +1,56 @@
+#include "clip_data_manager.h"
+
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+
+class ClipDataManager::Channel : public webrtc::DataChannelObserver {
+ public:
+  Channel(ClipDataManager* manager,
+          rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+      : manager_(manager), data_channel_(data_channel) {
+    data_channel_->RegisterObserver(this);
+  }
+  ~Channel() { data_channel_->UnregisterObserver(); }
+
+  void OnStateChange() override {
+    if (data_channel_->state() == webrtc::DataChannelInterface::kClosed) {
+      manager_->OnClosed(this);
+    }
+  }
+  void OnMessage(const webrtc::DataBuffer& buffer) override {
+    std::string path = manager_->save_clip_();
+    RTC_LOG(LS_INFO) << "ClipDataManager: requested by "
+                     << data_channel_->label() << ", path=" << path;
+    data_channel_->Send(webrtc::DataBuffer(path));
+  }
+  void OnBufferedAmountChange(uint64_t previous_amount) override {}
+
+ private:
+  ClipDataManager* manager_;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+};
+
+ClipDataManager::ClipDataManager(std::function<std::string()> save_clip)
+    : save_clip_(std::move(save_clip)) {}
+
+ClipDataManager::~ClipDataManager() = default;
+
+void ClipDataManager::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  channels_.emplace_back(new Channel(this, data_channel));
+}
+
+void ClipDataManager::OnClosed(Channel* channel) {
+  // ロックを外してから Channel を破棄する
+  std::unique_ptr<Channel> closed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(
+      channels_.begin(), channels_.end(),
+      [channel](const std::unique_ptr<Channel>& c) { return c.get() == channel; });
+  if (it != channels_.end()) {
+    closed = std::move(*it);
+    channels_.erase(it);
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef CLIP_DATA_MANAGER_H_
+#define CLIP_DATA_MANAGER_H_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rtc/data_manager.h"
+
+// 相手が作った DataChannel にメッセージが届く度に save_clip を呼び、
+// 返ってきたパス (書き出せなかった場合は空文字列) をその DataChannel に送り返すクラス。
+// メッセージの内容は見ない。
+class ClipDataManager : public RTCDataManager {
+ public:
+  explicit ClipDataManager(std::function<std::string()> save_clip);
+  ~ClipDataManager();
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+
+ private:
+  class Channel;
+  void OnClosed(Channel* channel);
+
+  std::function<std::string()> save_clip_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Channel>> channels_;
+};
+
+#endif
@@ -4,8 +4,10 @@
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <vector>
 
 #include "api/rtp_parameters.h"
+#include "rtc/rtc_config.h"
 
 struct ConnectionSettings {
   std::string camera_name = "";
@@ -17,13 +19,162 @@ struct ConnectionSettings {
 #endif
 
   bool no_google_stun = false;
+  // 0 より大きい場合は、ローカルの ICE candidate をこの時間 (ミリ秒) だけ溜めてからまとめて送る
+  int ice_candidate_batch_ms = 0;
+  // この数だけ溜まったら時間が経っていなくても送る
+  int ice_candidate_batch_size = 16;
+  // シグナリングサーバの DNS ルックアップの結果をキャッシュする秒数
+  int dns_cache_ttl = 60;
+  // 再接続時に TLS セッションと DTLS 証明書を使い回し、
+  // シグナリングが生きていれば ICE restart で復旧を試みる
+  bool fast_reconnect = false;
+  // 複数の経路がある場合に優先するネットワークの種類。ethernet, wifi, cellular, vpn のどれか。
+  // 空の場合は libwebrtc の既定のコスト (有線、Wi-Fi、モバイルの順) で選ぶ
+  std::string network_preference = "";
+  // ICE の candidate を集めないネットワークの種類
+  std::vector<std::string> network_ignores;
+  // 0 より大きい場合、選んだ経路と予備の経路の両方をこの間隔 (ミリ秒) で確認し、
+  // 選んだ経路から受信できなくなったら ICE の失敗を待たずに予備の経路に切り替える。
+  // 新しいネットワークの candidate も集め続ける
+  int ice_check_interval_ms = 0;
+  // 送信するパケットに、トラックの優先度に応じた DSCP を付ける
+  bool dscp = false;
+  // 映像と音声のトラックの優先度 (very-low, low, medium, high)。
+  // --dscp の場合に付ける DSCP の値が変わる。空の場合は libwebrtc の既定 (low)
+  std::string video_network_priority = "";
+  std::string audio_network_priority = "";
+  // PeerConnectionFactory の作成をカメラを開くのやシグナリングの接続と並行して行い、
+  // その間にエンコーダを 1 回初期化しておく
+  bool fast_startup = false;
+  // default か ultra-low。ultra-low では受信したトラックのジッターバッファの遅延を最小にして、
+  // デコードしたフレームをすぐに描画する。送信する映像にも playout-delay の 0 を付けて、相手にも同じようにしてもらう
+  std::string latency_profile = "default";
   bool no_video_device = false;
   bool no_audio_device = false;
+  // 受信だけを行う。カメラを開かず、マイクの音声トラックや APM、ハードウェアエンコーダも作らない。
+  // Sora の --role downstream と recvonly では常に有効になる
+  bool recv_only = false;
+  // 起動時にハードウェアエンコーダを初期化できるか確かめ、使えるコーデックを優先して交渉する
+  bool prefer_hw_codec = false;
   bool force_i420 = false;
   bool use_native = false;
+  bool use_dmabuf = false;
+  // Raspberry Pi で libcamera からキャプチャし、ISP の dmabuf をコピーせずに
+  // V4L2 M2M のエンコーダへ渡す。サイマルキャストの場合は ISP の低解像度出力も使う
+  bool use_libcamera = false;
+  // Windows で --use-native の場合、カメラの MJPEG を Media Foundation の
+  // ハードウェアデコーダで NV12 にデコードする
+  bool mf_hardware_decode = false;
+  int v4l2_buffers = 4;
+  // 空でなければ、調べたカメラの対応形式をこのファイルに保存して次回の起動時に使う
+  std::string video_device_cache = "";
+  bool capture_pipeline = false;
+  int mjpeg_decoder_threads = 1;
+  // 大きなフレームの縮小に使うスレッド数。0 の場合は CPU の数から決める。ParallelScaler を参照
+  int scaler_threads = 0;
+  // io_context を回すスレッドの数。2 以上の場合は DataChannel の入出力と
+  // HTTP サーバーをシグナリングとは別のスレッドで処理する。MomoApp::Run() を参照
+  int io_threads = 1;
+  // 空でなければゲートウェイモードで動かし、このファイルの各行を 1 つのセッションの引数として使う。
+  // MomoGateway を参照
+  std::string gateway_config = "";
+  bool nvcodec_async = false;
+  // NvCodec の H264 で作る時間方向のレイヤーの数 (1 から 3)。TemporalLayers を参照
+  int nvcodec_temporal_layers = 1;
+  // 動きのある領域や DataChannel で指定された領域の QP を変える (NvCodec と Jetson のみ)。RoiHints を参照
+  bool roi_motion = false;
+  int roi_motion_threshold = 6;
+  int roi_motion_qp_delta = -6;
+  int roi_background_qp_delta = 0;
+  // 空でなければ、このラベルの DataChannel で領域を受け取る
+  std::string roi_label = "";
+  // ハードウェアエンコーダを低遅延のレート制御で動かす。LowLatencyRateControl を参照
+  bool low_latency_rate_control = false;
+  // ハードウェアエンコーダが IDR を送る最小の間隔。その間のキーフレームの要求はまとめる。KeyFrameThrottle を参照
+  int key_frame_min_interval_ms = 0;
+  bool key_frame_intra_refresh = false;
+  // 同じ設定の接続でエンコーダを共有して、1 回のエンコードの結果を全ての接続に送る
+  bool shared_encoder = false;
+  // MMAL の H264 エンコーダをスライス毎に出力させる
+  bool mmal_encoder_low_latency = false;
+  // MMAL の H264 デコーダの設定
+  bool mmal_decoder_zero_copy = false;
+  int mmal_decoder_input_buffers = 3;
+  int mmal_decoder_output_buffers = 3;
+  // 0 より大きい場合、同時に使うハードウェアデコーダをこの数までにする。超えた分はソフトウェアでデコードする
+  int max_hw_decoders = 0;
+  // エンコーダが詰まっている間はキャプチャしたフレームを変換する前に間引く
+  bool encoder_backpressure = false;
+  // 0 より大きい場合、映像の遅延がこれを超えないようにビットレート、フレームレート、解像度を調整する。
+  // LatencyController を参照
+  int latency_target_ms = 0;
+  int latency_min_bitrate = 100;
+  int latency_min_framerate = 5;
+  // 0 より大きい場合、接続の帯域推定の開始、下限、上限のビットレート (kbps) にする。
+  // 0 の場合は libwebrtc の既定値を使う
+  int start_bitrate = 0;
+  int min_bitrate = 0;
+  int max_bitrate = 0;
+  // 空でなければ、接続先毎に最後に推定できた帯域をこの JSON ファイルに覚えておき、
+  // 次に同じ接続先に繋ぐ時の開始ビットレートにする。BitrateCache を参照
+  std::string bitrate_cache = "";
+  // 0 より大きい場合、この間隔で全ての接続の統計情報を取得して差分を溜めておく。
+  // StatsSampler を参照。--latency-target-ms か --bitrate-cache を指定した場合、0 なら 1000 になる
+  int stats_interval_ms = 0;
+  int stats_history = 60;
+  bool stats_log = false;
+  // 溜めた値を JSON で返す DataChannel のラベル
+  std::string stats_label = "stats";
+  // 空でなければ、DataChannel で要求されたこのディレクトリ以下のファイルを送り返す。
+  // FileTransferDataManager を参照
+  std::string file_transfer_root = "";
+  std::string file_transfer_label = "file";
+  // ファイルを送る速さの上限 (kbps)
+  int file_transfer_max_kbps = 2000;
+  // 空でなければ、送信する H.264 と Opus をこのディレクトリに MPEG-TS で記録する
+  std::string record_dir = "";
+  int record_segment_sec = 60;
+  // セグメントを開いた時に確保しておく大きさ (MB)
+  int record_preallocate_mb = 0;
+  // O_DIRECT でページキャッシュを通さずに書き込む
+  bool record_direct_io = false;
+  // 0 より大きい場合は常には記録せず、直近のこの秒数分をメモリに保持して
+  // DataChannel や HTTP で要求された時に書き出す
+  int record_preroll_sec = 0;
+  int record_preroll_mb = 32;
+  // 書き出しを要求する DataChannel のラベル
+  std::string record_clip_label = "clip";
+  // 遅延計測用のマーカーを送信する映像に書き込み、受信した映像から読み取る
+  bool latency_marker = false;
   std::string video_device = "";
+  // 指定した場合はカメラの代わりにファイルの映像か、bars, noise のパターンを流す
+  std::string video_file = "";
+  std::string video_pattern = "";
+  // 指定した場合はカメラの代わりに、この名前の POSIX 共有メモリに他のプロセスが書いたフレームを流す。
+  // ShmVideoCapturer を参照 (Linux のみ)
+  std::string video_shm = "";
+  // カメラの代わりに X11 の画面をキャプチャする。X11ScreenCapturer を参照 (Linux のみ)
+  bool screen_capture = false;
+  // 同時にキャプチャして、別のトラックとして送信するカメラ
+  std::vector<std::string> additional_video_devices;
+  // カメラ毎にキャプチャスレッドを割り当てる CPU。video_device、additional_video_devices の順
+  std::vector<int> capture_cpus;
+  // 空でない場合は全てのカメラを 1 つの映像に合成して送信する ("grid" または "pip")
+  std::string compositor = "";
+  // スレッドの役割毎の CPU と優先度 (ROLE=CPUS[:PRIORITY])。ThreadPlacement を参照
+  std::vector<std::string> thread_placements;
+  // このカメラのキャプチャスレッドを割り当てる CPU。-1 の場合は割り当てない
+  int capture_cpu = -1;
   std::string resolution = "VGA";
   int framerate = 30;
+  // キャプチャした映像を時計回りに回転させる角度 (0, 90, 180, 270)。
+  // ScalableVideoTrackSource::SetRotation() を参照
+  int video_rotation = 0;
+  // 0 より大きい場合、映像が static_scene_delay_ms の間変化しなければこのフレームレートまで間引く
+  int static_scene_fps = 0;
+  int static_scene_delay_ms = 2000;
+  // 変化とみなす、縮小した輝度の差
+  int static_scene_threshold = 8;
   bool fixed_resolution = false;
   std::string priority = "BALANCE";
   bool use_sdl = false;
@@ -31,9 +182,66 @@ struct ConnectionSettings {
   int window_width = 640;
   int window_height = 480;
   bool fullscreen = false;
+  // 0 より大きい場合、全てのトラックを合わせてこのフレームレートまでしか描画しない。
+  // 各トラックにはトラック数で割ったフレームレートを割り当てる
+  int sdl_render_budget_fps = 0;
+  // SDL の代わりに DRM/KMS で直接ディスプレイに表示する
+  bool use_drm = false;
+  std::string drm_device = "/dev/dri/card0";
   std::string serial_device = "";
   unsigned int serial_rate = 9600;
+  // シリアルポートのデータの区切り方 (line, cobs, length)
+  std::string serial_framing = "line";
+  // LABEL=udp://HOST:PORT または LABEL=unix://PATH。受け取ったデータを LABEL の DataChannel で送る
+  std::vector<std::string> data_channel_sources;
+  // -1 の場合は届くまで再送する
+  int data_channel_max_retransmits = 0;
+  bool data_channel_ordered = false;
+  bool data_channel_coalesce = false;
+  // --data-channel-source の DataChannel の優先度 (very-low, low, medium, high)。空の場合は libwebrtc の既定
+  std::string data_channel_priority = "";
   bool insecure = false;
+  // 空でない場合、この PEM ファイルのルート証明書も信頼する。更新されたら読み込み直す
+  std::string ssl_root_file = "";
+  // OS の証明書ストアのルート証明書を信頼しない
+  bool disable_system_ssl_roots = false;
+  // 0 以上の場合はこのポートでメトリクスを返す HTTP サーバを立てる
+  int metrics_port = -1;
+  // 0 以上の場合はこのポートで送信している H.264 を RTSP で配信する
+  int rtsp_port = -1;
+  // 0 より大きい場合、ログファイルへは別スレッドから書き込み、溜めておけるメッセージの数をこれにする。
+  // 0 の場合はログを出力したスレッドで書き込む
+  int log_queue_size = 4096;
+  // 0 より大きい場合、フレームの処理の各段階をスレッド毎にこの数まで記録する。
+  // SIGUSR1 を受け取ったら trace_file に書き出す。--metrics-port の /trace でも取得できる
+  int trace_events = 0;
+  std::string trace_file = "momo_trace.json";
+  // 0 より大きい場合、キャプチャしたフレームがこの間届かなければデバイスを開き直す。
+  // MediaWatchdog を参照
+  int capture_stall_ms = 0;
+  // V4L2 のカメラで、映像を見ている相手がいる間だけキャプチャする。
+  // 最後の相手がいなくなってから on_demand_linger_ms 経つとキャプチャを止める
+  bool on_demand_capture = false;
+  int on_demand_linger_ms = 5000;
+  // on_demand_capture に加えて、キャプチャを止めている間は ISP のコンポーネントや
+  // フレームバッファのプールも解放する
+  bool low_power_idle = false;
+  // 0 より大きい場合、エンコーダに渡したフレームがこの数だけ出てこなければエンコーダを作り直す
+  int encoder_stall_frames = 0;
+  // 0 より大きい場合、受信した映像のフレームがこの間届かなければ警告をログに出す
+  int renderer_stall_ms = 0;
+  // 空でない場合、最初のカメラのフレームをこの名前の POSIX 共有メモリに書き出す (Linux のみ)。
+  // ShmFrameExporter を参照
+  std::string shm_export = "";
+  int shm_export_slots = 3;
+  // 0 より大きい場合、起動時に見積もったメモリ (MB) がこれに収まるようにバッファの数や解像度を減らす。
+  // MemoryBudget を参照
+  int memory_budget_mb = 0;
+  // 最新のフレームを JPEG で返せるようにする。SnapshotSink を参照。
+  // --metrics-port の GET /snapshot.jpg と、snapshot_label の DataChannel で取得する
+  bool snapshot = false;
+  int snapshot_quality = 85;
+  std::string snapshot_label = "snapshot";
 
   std::string sora_signaling_host = "wss://example.com/signaling";
   std::string sora_channel_id;
@@ -50,7 +258,15 @@ struct ConnectionSettings {
   // upstream or downstream
   std::string sora_role = "upstream";
   bool sora_multistream = false;
+  bool sora_simulcast = false;
   int sora_spotlight = -1;
+  // スポットライトでフォーカスされていない間は、サムネイルの大きさ、フレームレート、ビットレートでエンコードする
+  bool sora_spotlight_power_save = false;
+  // 解像度を縦横それぞれこの数で割る
+  int sora_spotlight_thumbnail_scale = 4;
+  int sora_spotlight_thumbnail_fps = 10;
+  // kbps
+  int sora_spotlight_thumbnail_bitrate = 200;
   int sora_port = -1;
 
   std::string test_document_root;
@@ -67,12 +283,24 @@ struct ConnectionSettings {
   bool disable_highpass_filter = false;
   bool disable_typing_detection = false;
   bool disable_residual_echo_detector = false;
+  // 音声処理 (APM) の構成。default, light, bypass のどれか
+  std::string audio_processing = "default";
+  // APM の処理毎の CPU 時間を計測して表示し、終了する
+  bool audio_processing_benchmark = false;
+  // Opus の設定。low-cpu, low-bandwidth, loss-resilient, low-latency のどれか。空の場合は変更しない
+  std::string audio_profile = "";
+  // 映像のパケットロスへの対策。nack, ulpfec, flexfec のどれか。空の場合は変更しない
+  std::string video_protection = "";
+  // フィールドトライアルや H264 の広告などを書いた JSON ファイル。
+  // 起動時に読み込んだ内容を rtc_config に入れる
+  std::string rtc_config_file = "";
+  RtcConfig rtc_config;
 
   struct Size {
     int width;
     int height;
   };
-  Size getSize() {
+  Size getSize() const {
     if (resolution == "QVGA") {
       return {320, 240};
     } else if (resolution == "VGA") {
@@ -96,7 +324,7 @@ struct ConnectionSettings {
   }
 
   // FRAMERATE が優先のときは RESOLUTION をデグレさせていく
-  webrtc::DegradationPreference getPriority() {
+  webrtc::DegradationPreference getPriority() const {
     if (priority == "FRAMERATE") {
       return webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
     } else if (priority == "RESOLUTION") {
@@ -105,16 +333,64 @@ struct ConnectionSettings {
     return webrtc::DegradationPreference::BALANCED;
   }
 
+  // --video-network-priority などで指定した優先度
+  static webrtc::Priority getNetworkPriority(const std::string& name) {
+    if (name == "very-low") {
+      return webrtc::Priority::kVeryLow;
+    } else if (name == "medium") {
+      return webrtc::Priority::kMedium;
+    } else if (name == "high") {
+      return webrtc::Priority::kHigh;
+    }
+    return webrtc::Priority::kLow;
+  }
+
   friend std::ostream& operator<<(std::ostream& os,
                                   const ConnectionSettings& cs) {
     os << "no_google_stun: " << (cs.no_google_stun ? "true" : "false")
        << "\n";
+    os << "fast_startup: " << (cs.fast_startup ? "true" : "false") << "\n";
+    os << "network_preference: " << cs.network_preference << "\n";
+    os << "ice_check_interval_ms: " << cs.ice_check_interval_ms << "\n";
+    os << "dscp: " << (cs.dscp ? "true" : "false") << "\n";
+    os << "video_network_priority: " << cs.video_network_priority << "\n";
+    os << "audio_network_priority: " << cs.audio_network_priority << "\n";
+    os << "latency_profile: " << cs.latency_profile << "\n";
+    os << "video_protection: " << cs.video_protection << "\n";
+    os << "start_bitrate: " << cs.start_bitrate << "\n";
+    os << "min_bitrate: " << cs.min_bitrate << "\n";
+    os << "max_bitrate: " << cs.max_bitrate << "\n";
+    os << "bitrate_cache: " << cs.bitrate_cache << "\n";
+    os << "rtc_config_file: " << cs.rtc_config_file << "\n";
     os << "no_video_device: " << (cs.no_video_device ? "true" : "false")
        << "\n";
     os << "no_audio_device: " << (cs.no_audio_device ? "true" : "false")
        << "\n";
+    os << "recv_only: " << (cs.recv_only ? "true" : "false") << "\n";
+    os << "prefer_hw_codec: " << (cs.prefer_hw_codec ? "true" : "false")
+       << "\n";
     os << "resolution: " << cs.resolution << "\n";
     os << "framerate: " << cs.framerate << "\n";
+    os << "video_rotation: " << cs.video_rotation << "\n";
+    os << "static_scene_fps: " << cs.static_scene_fps << "\n";
+    os << "video_file: " << cs.video_file << "\n";
+    os << "video_pattern: " << cs.video_pattern << "\n";
+    os << "video_shm: " << cs.video_shm << "\n";
+    os << "screen_capture: " << (cs.screen_capture ? "true" : "false")
+       << "\n";
+    os << "use_libcamera: " << (cs.use_libcamera ? "true" : "false") << "\n";
+    os << "scaler_threads: " << cs.scaler_threads << "\n";
+    os << "io_threads: " << cs.io_threads << "\n";
+    os << "gateway_config: " << cs.gateway_config << "\n";
+    os << "memory_budget_mb: " << cs.memory_budget_mb << "\n";
+    os << "roi_motion: " << (cs.roi_motion ? "true" : "false") << "\n";
+    os << "roi_label: " << cs.roi_label << "\n";
+    os << "file_transfer_root: " << cs.file_transfer_root << "\n";
+    os << "file_transfer_label: " << cs.file_transfer_label << "\n";
+    os << "file_transfer_max_kbps: " << cs.file_transfer_max_kbps << "\n";
+    os << "snapshot: " << (cs.snapshot ? "true" : "false") << "\n";
+    os << "snapshot_quality: " << cs.snapshot_quality << "\n";
+    os << "snapshot_label: " << cs.snapshot_label << "\n";
     os << "fixed_resolution: " << (cs.fixed_resolution ? "true" : "false")
        << "\n";
     os << "priority: " << cs.priority << "\n";
@@ -131,6 +407,8 @@ struct ConnectionSettings {
        << "\n";
     os << "sora_metadata: " << cs.sora_metadata << "\n";
     os << "sora_port: " << cs.sora_port << "\n";
+    os << "metrics_port: " << cs.metrics_port << "\n";
+    os << "rtsp_port: " << cs.rtsp_port << "\n";
     os << "test_document_root: " << cs.test_document_root << "\n";
     os << "test_port: " << cs.test_port << "\n";
     return os;
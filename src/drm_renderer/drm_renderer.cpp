@@ -0,0 +1,561 @@
+#include "drm_renderer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+
+#include "api/video/i420_buffer.h"
+#include "rtc/thread_placement.h"
+#include "rtc_base/logging.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+namespace {
+
+// インポートした DMABUF のフレームバッファをこれ以上溜めない
+const size_t kMaxImportedBuffers = 32;
+
+}  // namespace
+
+std::unique_ptr<DRMRenderer> DRMRenderer::Create(const std::string& device,
+                                                 bool latency_marker) {
+  int fd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to open " << device << ": "
+                      << strerror(errno);
+    return nullptr;
+  }
+  std::unique_ptr<DRMRenderer> renderer(new DRMRenderer(fd, latency_marker));
+  if (!renderer->Init()) {
+    return nullptr;
+  }
+  return renderer;
+}
+
+DRMRenderer::DRMRenderer(int fd, bool latency_marker)
+    : fd_(fd), latency_marker_(latency_marker) {}
+
+DRMRenderer::~DRMRenderer() {
+  {
+    std::lock_guard<std::mutex> lock(sinks_mutex_);
+    sinks_.clear();
+  }
+  if (render_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(frame_mutex_);
+      running_ = false;
+    }
+    frame_cond_.notify_all();
+    render_thread_->Stop();
+    render_thread_.reset();
+  }
+
+  Clear();
+  if (saved_crtc_ != nullptr) {
+    // 起動前の表示に戻す
+    drmModeSetCrtc(fd_, saved_crtc_->crtc_id, saved_crtc_->buffer_id,
+                   saved_crtc_->x, saved_crtc_->y, &connector_id_, 1,
+                   &saved_crtc_->mode);
+    drmModeFreeCrtc(saved_crtc_);
+  }
+  for (DumbBuffer& buffer : dumb_buffers_) {
+    DestroyDumbBuffer(&buffer);
+  }
+  DestroyDumbBuffer(&background_);
+  close(fd_);
+}
+
+bool DRMRenderer::Init() {
+  drmModeRes* res = drmModeGetResources(fd_);
+  if (res == nullptr) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": drmModeGetResources failed: "
+                      << strerror(errno);
+    return false;
+  }
+
+  // 接続されている最初のディスプレイに表示する
+  drmModeConnector* connector = nullptr;
+  for (int i = 0; i < res->count_connectors && connector == nullptr; i++) {
+    drmModeConnector* c = drmModeGetConnector(fd_, res->connectors[i]);
+    if (c != nullptr && c->connection == DRM_MODE_CONNECTED &&
+        c->count_modes > 0) {
+      connector = c;
+    } else {
+      drmModeFreeConnector(c);
+    }
+  }
+  if (connector == nullptr) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": No connected display";
+    drmModeFreeResources(res);
+    return false;
+  }
+  connector_id_ = connector->connector_id;
+  mode_ = connector->modes[0];
+  for (int i = 0; i < connector->count_modes; i++) {
+    if (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+      mode_ = connector->modes[i];
+      break;
+    }
+  }
+
+  // 今使われている CRTC があればそれを使い、無ければ繋げられる CRTC を探す
+  if (connector->encoder_id != 0) {
+    drmModeEncoder* encoder = drmModeGetEncoder(fd_, connector->encoder_id);
+    if (encoder != nullptr) {
+      crtc_id_ = encoder->crtc_id;
+      drmModeFreeEncoder(encoder);
+    }
+  }
+  for (int i = 0; i < connector->count_encoders && crtc_id_ == 0; i++) {
+    drmModeEncoder* encoder = drmModeGetEncoder(fd_, connector->encoders[i]);
+    if (encoder == nullptr) {
+      continue;
+    }
+    for (int j = 0; j < res->count_crtcs; j++) {
+      if (encoder->possible_crtcs & (1 << j)) {
+        crtc_id_ = res->crtcs[j];
+        break;
+      }
+    }
+    drmModeFreeEncoder(encoder);
+  }
+  int crtc_index = -1;
+  for (int i = 0; i < res->count_crtcs; i++) {
+    if (res->crtcs[i] == crtc_id_) {
+      crtc_index = i;
+    }
+  }
+  drmModeFreeConnector(connector);
+  drmModeFreeResources(res);
+  if (crtc_index < 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": No CRTC for connector "
+                      << connector_id_;
+    return false;
+  }
+
+  // NV12 を表示できるオーバーレイプレーンを探す
+  drmModePlaneRes* planes = drmModeGetPlaneResources(fd_);
+  if (planes == nullptr) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": drmModeGetPlaneResources failed: "
+                      << strerror(errno);
+    return false;
+  }
+  for (uint32_t i = 0; i < planes->count_planes && plane_id_ == 0; i++) {
+    drmModePlane* plane = drmModeGetPlane(fd_, planes->planes[i]);
+    if (plane == nullptr) {
+      continue;
+    }
+    if ((plane->possible_crtcs & (1 << crtc_index)) &&
+        (plane->crtc_id == 0 || plane->crtc_id == crtc_id_)) {
+      bool nv12 = false;
+      bool yuv420 = false;
+      for (uint32_t j = 0; j < plane->count_formats; j++) {
+        nv12 |= plane->formats[j] == DRM_FORMAT_NV12;
+        yuv420 |= plane->formats[j] == DRM_FORMAT_YUV420;
+      }
+      if (nv12) {
+        plane_id_ = plane->plane_id;
+        plane_supports_yuv420_ = yuv420;
+      }
+    }
+    drmModeFreePlane(plane);
+  }
+  drmModeFreePlaneResources(planes);
+  if (plane_id_ == 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": No plane supports NV12";
+    return false;
+  }
+
+  // コンソールなどが表示されたままにならないように、背景を黒で塗りつぶす
+  if (!CreateDumbBuffer(DRM_FORMAT_XRGB8888, mode_.hdisplay, mode_.vdisplay,
+                        &background_)) {
+    return false;
+  }
+  memset(background_.data, 0, background_.size);
+  saved_crtc_ = drmModeGetCrtc(fd_, crtc_id_);
+  if (drmModeSetCrtc(fd_, crtc_id_, background_.fb_id, 0, 0, &connector_id_,
+                     1, &mode_) < 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": drmModeSetCrtc failed: "
+                      << strerror(errno)
+                      << " (other display server may be running)";
+    return false;
+  }
+
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": connector=" << connector_id_
+                   << " crtc=" << crtc_id_ << " plane=" << plane_id_
+                   << " mode=" << mode_.hdisplay << "x" << mode_.vdisplay
+                   << "@" << mode_.vrefresh;
+
+  render_thread_.reset(new rtc::PlatformThread(
+      DRMRenderer::RenderThread, this, "DRMRenderer", rtc::kHighPriority));
+  render_thread_->Start();
+  return true;
+}
+
+bool DRMRenderer::CreateDumbBuffer(uint32_t format,
+                                   int width,
+                                   int height,
+                                   DumbBuffer* buffer) {
+  const bool is_nv12 = format == DRM_FORMAT_NV12;
+  struct drm_mode_create_dumb create = {};
+  create.width = width;
+  // NV12 は Y プレーンの後ろに半分の高さの UV プレーンを置く
+  create.height = is_nv12 ? height * 3 / 2 : height;
+  create.bpp = is_nv12 ? 8 : 32;
+  if (drmIoctl(fd_, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": DRM_IOCTL_MODE_CREATE_DUMB failed: "
+                      << strerror(errno);
+    return false;
+  }
+  buffer->handle = create.handle;
+  buffer->pitch = create.pitch;
+  buffer->size = create.size;
+  buffer->width = width;
+  buffer->height = height;
+
+  uint32_t handles[4] = {create.handle};
+  uint32_t pitches[4] = {create.pitch};
+  uint32_t offsets[4] = {0};
+  if (is_nv12) {
+    handles[1] = create.handle;
+    pitches[1] = create.pitch;
+    offsets[1] = create.pitch * height;
+  }
+  if (drmModeAddFB2(fd_, width, height, format, handles, pitches, offsets,
+                    &buffer->fb_id, 0) < 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": drmModeAddFB2 failed: "
+                      << strerror(errno);
+    buffer->fb_id = 0;
+    DestroyDumbBuffer(buffer);
+    return false;
+  }
+
+  struct drm_mode_map_dumb map = {};
+  map.handle = create.handle;
+  if (drmIoctl(fd_, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": DRM_IOCTL_MODE_MAP_DUMB failed: "
+                      << strerror(errno);
+    DestroyDumbBuffer(buffer);
+    return false;
+  }
+  void* data = mmap(nullptr, create.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd_, map.offset);
+  if (data == MAP_FAILED) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": mmap failed: " << strerror(errno);
+    DestroyDumbBuffer(buffer);
+    return false;
+  }
+  buffer->data = static_cast<uint8_t*>(data);
+  return true;
+}
+
+void DRMRenderer::DestroyDumbBuffer(DumbBuffer* buffer) {
+  if (buffer->data != nullptr) {
+    munmap(buffer->data, buffer->size);
+  }
+  if (buffer->fb_id != 0) {
+    drmModeRmFB(fd_, buffer->fb_id);
+  }
+  if (buffer->handle != 0) {
+    struct drm_mode_destroy_dumb destroy = {};
+    destroy.handle = buffer->handle;
+    drmIoctl(fd_, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+  }
+  *buffer = DumbBuffer();
+}
+
+void DRMRenderer::ClearImportedBuffers() {
+  for (const auto& p : imported_buffers_) {
+    drmModeRmFB(fd_, p.second.fb_id);
+    struct drm_gem_close gem_close = {};
+    gem_close.handle = p.first;
+    drmIoctl(fd_, DRM_IOCTL_GEM_CLOSE, &gem_close);
+  }
+  imported_buffers_.clear();
+}
+
+void DRMRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
+  std::unique_ptr<Sink> sink(new Sink(this, track));
+  Sink* active_sink = sink.get();
+  {
+    std::lock_guard<std::mutex> lock(sinks_mutex_);
+    sinks_.push_back(std::make_pair(track, std::move(sink)));
+  }
+  std::lock_guard<std::mutex> lock(frame_mutex_);
+  active_sink_ = active_sink;
+  pending_buffer_ = nullptr;
+}
+
+void DRMRenderer::RemoveTrack(webrtc::VideoTrackInterface* track) {
+  Sink* active_sink = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(sinks_mutex_);
+    sinks_.erase(
+        std::remove_if(sinks_.begin(), sinks_.end(),
+                       [track](const decltype(sinks_)::value_type& sink) {
+                         return sink.first == track;
+                       }),
+        sinks_.end());
+    if (!sinks_.empty()) {
+      active_sink = sinks_.back().second.get();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (active_sink_ == active_sink) {
+      return;
+    }
+    // 別のトラックに切り替わるまでは何も表示しない
+    active_sink_ = active_sink;
+    pending_buffer_ = nullptr;
+    clear_pending_ = true;
+  }
+  frame_cond_.notify_all();
+}
+
+void DRMRenderer::SetFrame(
+    Sink* sink,
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer) {
+  {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (sink != active_sink_) {
+      return;
+    }
+    // 表示が追いつかない場合は古いフレームを捨てる
+    pending_buffer_ = std::move(buffer);
+    clear_pending_ = false;
+  }
+  frame_cond_.notify_all();
+}
+
+void DRMRenderer::RenderThread(void* obj) {
+  static_cast<DRMRenderer*>(obj)->RenderLoop();
+}
+
+void DRMRenderer::RenderLoop() {
+  ThreadPlacement::Instance().Apply("renderer");
+  while (true) {
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+    bool clear;
+    {
+      std::unique_lock<std::mutex> lock(frame_mutex_);
+      frame_cond_.wait(lock, [this]() {
+        return !running_ || pending_buffer_ || clear_pending_;
+      });
+      if (!running_) {
+        return;
+      }
+      buffer = std::move(pending_buffer_);
+      pending_buffer_ = nullptr;
+      clear = clear_pending_;
+      clear_pending_ = false;
+    }
+    if (clear) {
+      Clear();
+    }
+    if (buffer) {
+      Show(buffer);
+    }
+  }
+}
+
+void DRMRenderer::Show(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer) {
+  int width = 0;
+  int height = 0;
+  uint32_t fb_id = 0;
+
+  NativeBuffer* native_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(buffer.get())
+          : nullptr;
+  if (native_buffer != nullptr && native_buffer->dmabuf_fd() >= 0 &&
+      (native_buffer->VideoType() == webrtc::VideoType::kNV12 ||
+       (native_buffer->VideoType() == webrtc::VideoType::kI420 &&
+        plane_supports_yuv420_))) {
+    fb_id = ImportDmabuf(native_buffer);
+    width = native_buffer->raw_width();
+    height = native_buffer->raw_height();
+  }
+  if (fb_id == 0) {
+    fb_id = CopyToDumbBuffer(buffer.get(), &width, &height);
+    // コピーしたのでバッファはもう要らない
+    buffer = nullptr;
+  }
+  if (fb_id == 0) {
+    return;
+  }
+
+  // アスペクト比を保ったまま画面一杯に表示する
+  int dst_width = mode_.hdisplay;
+  int dst_height = mode_.vdisplay;
+  if (width * mode_.vdisplay > height * mode_.hdisplay) {
+    dst_height = height * mode_.hdisplay / width;
+  } else {
+    dst_width = width * mode_.vdisplay / height;
+  }
+  int dst_x = (mode_.hdisplay - dst_width) / 2;
+  int dst_y = (mode_.vdisplay - dst_height) / 2;
+
+  // src の座標は 16.16 の固定小数点で指定する
+  if (drmModeSetPlane(fd_, plane_id_, crtc_id_, fb_id, 0, dst_x, dst_y,
+                      dst_width, dst_height, 0, 0, width << 16,
+                      height << 16) < 0) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": drmModeSetPlane failed: "
+                      << strerror(errno) << " src=" << width << "x" << height
+                      << " dst=" << dst_width << "x" << dst_height;
+    return;
+  }
+  prev_scanout_buffer_ = std::move(scanout_buffer_);
+  scanout_buffer_ = std::move(buffer);
+}
+
+void DRMRenderer::Clear() {
+  if (plane_id_ != 0) {
+    drmModeSetPlane(fd_, plane_id_, crtc_id_, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  }
+  ClearImportedBuffers();
+  scanout_buffer_ = nullptr;
+  prev_scanout_buffer_ = nullptr;
+}
+
+uint32_t DRMRenderer::ImportDmabuf(NativeBuffer* buffer) {
+  // 同じ DMABUF は同じ GEM ハンドルになるので、ハンドル毎にフレームバッファを作っておく
+  uint32_t handle;
+  if (drmPrimeFDToHandle(fd_, buffer->dmabuf_fd(), &handle) < 0) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": drmPrimeFDToHandle failed: "
+                        << strerror(errno);
+    return 0;
+  }
+  const bool is_nv12 = buffer->VideoType() == webrtc::VideoType::kNV12;
+  const uint32_t format = is_nv12 ? DRM_FORMAT_NV12 : DRM_FORMAT_YUV420;
+  auto it = imported_buffers_.find(handle);
+  if (it != imported_buffers_.end() && it->second.format == format &&
+      it->second.width == buffer->raw_width() &&
+      it->second.height == buffer->raw_height()) {
+    return it->second.fb_id;
+  }
+
+  // 解像度が変わったかプールが作り直されたので、古いものは全て捨てる
+  if (it != imported_buffers_.end() ||
+      imported_buffers_.size() >= kMaxImportedBuffers) {
+    ClearImportedBuffers();
+    prev_scanout_buffer_ = nullptr;
+    scanout_buffer_ = nullptr;
+    if (drmPrimeFDToHandle(fd_, buffer->dmabuf_fd(), &handle) < 0) {
+      return 0;
+    }
+  }
+
+  // 全てのプレーンが同じ DMABUF に入っている
+  uint32_t handles[4] = {handle, handle, is_nv12 ? 0 : handle};
+  uint32_t pitches[4] = {0};
+  uint32_t offsets[4] = {0};
+  uint32_t fb_id = 0;
+  if (!buffer->GetDmabufPlanes(offsets, pitches) ||
+      drmModeAddFB2(fd_, buffer->raw_width(), buffer->raw_height(), format,
+                    handles, pitches, offsets, &fb_id, 0) < 0) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": drmModeAddFB2 failed: "
+                        << strerror(errno);
+    struct drm_gem_close gem_close = {};
+    gem_close.handle = handle;
+    drmIoctl(fd_, DRM_IOCTL_GEM_CLOSE, &gem_close);
+    return 0;
+  }
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": handle=" << handle
+                      << " fb_id=" << fb_id;
+  imported_buffers_[handle] = ImportedBuffer{
+      fb_id, format, buffer->raw_width(), buffer->raw_height()};
+  return fb_id;
+}
+
+uint32_t DRMRenderer::CopyToDumbBuffer(webrtc::VideoFrameBuffer* buffer,
+                                       int* width,
+                                       int* height) {
+  NativeBuffer* native_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(buffer)
+          : nullptr;
+  const bool is_nv12 = native_buffer != nullptr &&
+                       native_buffer->VideoType() == webrtc::VideoType::kNV12;
+  *width = is_nv12 ? native_buffer->raw_width() : buffer->width();
+  *height = is_nv12 ? native_buffer->raw_height() : buffer->height();
+
+  DumbBuffer* dst = &dumb_buffers_[next_dumb_buffer_];
+  if (dst->width != *width || dst->height != *height) {
+    DestroyDumbBuffer(dst);
+    if (!CreateDumbBuffer(DRM_FORMAT_NV12, *width, *height, dst)) {
+      return 0;
+    }
+  }
+  next_dumb_buffer_ = (next_dumb_buffer_ + 1) % 2;
+
+  uint8_t* dst_y = dst->data;
+  uint8_t* dst_uv = dst->data + dst->pitch * dst->height;
+  if (is_nv12) {
+    libyuv::CopyPlane(native_buffer->DataY(), native_buffer->StrideY(), dst_y,
+                      dst->pitch, *width, *height);
+    libyuv::CopyPlane(native_buffer->DataUV(), native_buffer->StrideUV(),
+                      dst_uv, dst->pitch, (*width + 1) / 2 * 2,
+                      (*height + 1) / 2);
+  } else {
+    rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer =
+        buffer->ToI420();
+    libyuv::I420ToNV12(i420_buffer->DataY(), i420_buffer->StrideY(),
+                       i420_buffer->DataU(), i420_buffer->StrideU(),
+                       i420_buffer->DataV(), i420_buffer->StrideV(), dst_y,
+                       dst->pitch, dst_uv, dst->pitch, *width, *height);
+  }
+  return dst->fb_id;
+}
+
+DRMRenderer::Sink::Sink(DRMRenderer* renderer,
+                        webrtc::VideoTrackInterface* track)
+    : renderer_(renderer), track_(track) {
+  if (renderer_->latency_marker_) {
+    latency_stats_.reset(new LatencyStats("DRMRenderer " + track_->id()));
+  }
+  // プレーンの回転は使わないので、回転済みのフレームを要求する
+  rtc::VideoSinkWants wants;
+  wants.rotation_applied = true;
+  track_->AddOrUpdateSink(this, wants);
+}
+
+DRMRenderer::Sink::~Sink() {
+  track_->RemoveSink(this);
+}
+
+void DRMRenderer::Sink::MeasureLatency(const webrtc::VideoFrame& frame) {
+  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+      frame.video_frame_buffer()->ToI420();
+  uint32_t timestamp_ms;
+  if (!LatencyMarker::Read(buffer->DataY(), buffer->StrideY(),
+                           buffer->width(), buffer->height(), &timestamp_ms)) {
+    latency_stats_->AddMissing();
+    return;
+  }
+  // 下位 32 ビットしか無いので、差を符号付きで解釈する
+  latency_stats_->Add(
+      static_cast<int32_t>(LatencyMarker::NowMs() - timestamp_ms));
+}
+
+void DRMRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
+  if (frame.width() == 0 || frame.height() == 0)
+    return;
+  if (latency_stats_) {
+    MeasureLatency(frame);
+  }
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  // ソース側で回転できなかった場合はここで回転する
+  if (frame.rotation() != webrtc::kVideoRotation_0) {
+    buffer = webrtc::I420Buffer::Rotate(*buffer->ToI420(), frame.rotation());
+  }
+  renderer_->SetFrame(this, std::move(buffer));
+}
@@ -0,0 +1,136 @@
+#ifndef DRM_RENDERER_H_
+#define DRM_RENDERER_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <xf86drmMode.h>
+
+#include "api/media_stream_interface.h"
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "rtc/latency_marker.h"
+#include "rtc/native_buffer.h"
+#include "rtc/video_track_receiver.h"
+#include "rtc_base/platform_thread.h"
+
+// DRM/KMS のオーバーレイプレーンに直接映像を表示するクラス。
+//
+// X11 や OpenGL を介さずに、接続されているディスプレイ全体に
+// 最後に追加されたトラックを 1 つだけ表示する。
+// 拡大縮小はプレーンのスケーラで行うので、CPU での縮小や色変換はしない。
+//
+// DMABUF の fd を持つ NV12 (プレーンが対応していれば I420) の NativeBuffer は
+// そのままインポートして表示し、それ以外のフレームは NV12 のダムバッファにコピーしてから表示する。
+class DRMRenderer : public VideoTrackReceiver {
+ public:
+  // デバイスを開けなかったり、表示できるディスプレイが無い場合は nullptr を返す
+  static std::unique_ptr<DRMRenderer> Create(const std::string& device,
+                                             bool latency_marker);
+  ~DRMRenderer();
+
+  void AddTrack(webrtc::VideoTrackInterface* track) override;
+  void RemoveTrack(webrtc::VideoTrackInterface* track) override;
+
+ private:
+  class Sink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+   public:
+    Sink(DRMRenderer* renderer, webrtc::VideoTrackInterface* track);
+    ~Sink();
+
+    void OnFrame(const webrtc::VideoFrame& frame) override;
+
+   private:
+    void MeasureLatency(const webrtc::VideoFrame& frame);
+
+    DRMRenderer* renderer_;
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> track_;
+    std::unique_ptr<LatencyStats> latency_stats_;
+  };
+
+  // 自前で確保してマップしたバッファ
+  struct DumbBuffer {
+    uint32_t handle = 0;
+    uint32_t pitch = 0;
+    uint64_t size = 0;
+    uint8_t* data = nullptr;
+    uint32_t fb_id = 0;
+    int width = 0;
+    int height = 0;
+  };
+  // 外部の DMABUF をインポートしたバッファ
+  struct ImportedBuffer {
+    uint32_t fb_id;
+    uint32_t format;
+    int width;
+    int height;
+  };
+
+  DRMRenderer(int fd, bool latency_marker);
+  bool Init();
+  bool CreateDumbBuffer(uint32_t format,
+                        int width,
+                        int height,
+                        DumbBuffer* buffer);
+  void DestroyDumbBuffer(DumbBuffer* buffer);
+  void ClearImportedBuffers();
+
+  void SetFrame(Sink* sink, rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer);
+  static void RenderThread(void* obj);
+  void RenderLoop();
+  void Show(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer);
+  void Clear();
+  // 失敗した場合は 0 を返す
+  uint32_t ImportDmabuf(NativeBuffer* buffer);
+  uint32_t CopyToDumbBuffer(webrtc::VideoFrameBuffer* buffer,
+                            int* width,
+                            int* height);
+
+  const int fd_;
+  const bool latency_marker_;
+  uint32_t connector_id_ = 0;
+  uint32_t crtc_id_ = 0;
+  uint32_t plane_id_ = 0;
+  // I420 の DMABUF をそのままプレーンに表示できるか
+  bool plane_supports_yuv420_ = false;
+  drmModeModeInfo mode_;
+  // 終了時に元の表示に戻すために、起動時の CRTC の状態を覚えておく
+  drmModeCrtc* saved_crtc_ = nullptr;
+  // プレーンの後ろに表示する黒い背景
+  DumbBuffer background_;
+
+  std::mutex sinks_mutex_;
+  std::vector<std::pair<webrtc::VideoTrackInterface*, std::unique_ptr<Sink>>>
+      sinks_;
+
+  std::mutex frame_mutex_;
+  std::condition_variable frame_cond_;
+  bool running_ = true;
+  // 表示する Sink 以外からのフレームは捨てる
+  Sink* active_sink_ = nullptr;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> pending_buffer_;
+  // 表示するトラックが無くなったのでプレーンを消す
+  bool clear_pending_ = false;
+
+  // 以下はレンダースレッドだけが触る
+  // 表示中のバッファを書き換えないように、2 面を交互に使う
+  DumbBuffer dumb_buffers_[2];
+  int next_dumb_buffer_ = 0;
+  // GEM ハンドル毎のフレームバッファ
+  std::map<uint32_t, ImportedBuffer> imported_buffers_;
+  // スキャンアウト中の DMABUF をプールに返さないように参照を持っておく。
+  // 切り替えは次の vblank で反映されるので、1 つ前のバッファも持っておく
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> scanout_buffer_;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> prev_scanout_buffer_;
+
+  std::unique_ptr<rtc::PlatformThread> render_thread_;
+};
+
+#endif  // DRM_RENDERER_H_
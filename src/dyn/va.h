@@ -0,0 +1,42 @@
+#ifndef DYN_VA_H_
+#define DYN_VA_H_
+
+#include <va/va.h>
+#include <va/va_drm.h>
+
+#include "dyn.h"
+
+namespace dyn {
+
+static const char VA_SO[] = "libva.so.2";
+DYN_REGISTER(VA_SO, vaInitialize);
+DYN_REGISTER(VA_SO, vaTerminate);
+DYN_REGISTER(VA_SO, vaErrorStr);
+DYN_REGISTER(VA_SO, vaMaxNumEntrypoints);
+DYN_REGISTER(VA_SO, vaQueryConfigEntrypoints);
+DYN_REGISTER(VA_SO, vaGetConfigAttributes);
+DYN_REGISTER(VA_SO, vaCreateConfig);
+DYN_REGISTER(VA_SO, vaDestroyConfig);
+DYN_REGISTER(VA_SO, vaCreateSurfaces);
+DYN_REGISTER(VA_SO, vaDestroySurfaces);
+DYN_REGISTER(VA_SO, vaCreateContext);
+DYN_REGISTER(VA_SO, vaDestroyContext);
+DYN_REGISTER(VA_SO, vaCreateBuffer);
+DYN_REGISTER(VA_SO, vaDestroyBuffer);
+DYN_REGISTER(VA_SO, vaMapBuffer);
+DYN_REGISTER(VA_SO, vaUnmapBuffer);
+DYN_REGISTER(VA_SO, vaCreateImage);
+DYN_REGISTER(VA_SO, vaDeriveImage);
+DYN_REGISTER(VA_SO, vaDestroyImage);
+DYN_REGISTER(VA_SO, vaPutImage);
+DYN_REGISTER(VA_SO, vaBeginPicture);
+DYN_REGISTER(VA_SO, vaRenderPicture);
+DYN_REGISTER(VA_SO, vaEndPicture);
+DYN_REGISTER(VA_SO, vaSyncSurface);
+
+static const char VA_DRM_SO[] = "libva-drm.so.2";
+DYN_REGISTER(VA_DRM_SO, vaGetDisplayDRM);
+
+}  // namespace dyn
+
+#endif  // DYN_VA_H_
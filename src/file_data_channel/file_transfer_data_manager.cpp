@@ -0,0 +1,376 @@
+#include "file_transfer_data_manager.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <nlohmann/json.hpp>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// WebRTC
+#include "rtc_base/copy_on_write_buffer.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+const uint64_t FileTransferDataManager::kHighWaterMark;
+const uint64_t FileTransferDataManager::kLowWaterMark;
+const int FileTransferDataManager::kMinRateBps;
+
+// 送るファイルを先頭から順に読むクラス
+class FileTransferDataManager::FileSource {
+ public:
+  ~FileSource() {
+#if defined(__linux__)
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif
+  }
+
+  bool Open(const std::string& path) {
+#if defined(__linux__)
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      return false;
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+#else
+    ifs_.open(path, std::ios::binary);
+    if (!ifs_) {
+      return false;
+    }
+    ifs_.seekg(0, std::ios::end);
+    size_ = static_cast<uint64_t>(ifs_.tellg());
+    return static_cast<bool>(ifs_);
+#endif
+  }
+
+  uint64_t size() const { return size_; }
+
+  // offset から length バイトを読む。途中で切り詰められて読めなかった場合は false を返す
+  bool Read(uint64_t offset, size_t length, rtc::CopyOnWriteBuffer* data) {
+    data->SetSize(length);
+#if defined(__linux__)
+    size_t done = 0;
+    while (done < length) {
+      ssize_t n = pread(fd_, data->data() + done, length - done,
+                        static_cast<off_t>(offset + done));
+      if (n <= 0) {
+        return false;
+      }
+      done += static_cast<size_t>(n);
+    }
+    // 一度しか読まないので、送ったログでページキャッシュを埋めないようにする
+    posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(length),
+                  POSIX_FADV_DONTNEED);
+    return true;
+#else
+    ifs_.seekg(static_cast<std::streamoff>(offset));
+    ifs_.read(reinterpret_cast<char*>(data->data()), length);
+    return static_cast<size_t>(ifs_.gcount()) == length;
+#endif
+  }
+
+ private:
+#if defined(__linux__)
+  int fd_ = -1;
+#else
+  std::ifstream ifs_;
+#endif
+  uint64_t size_ = 0;
+};
+
+// DataChannel 毎の送信の状態。
+// 要求の処理と送信は全て io_context のスレッドで行う。
+// タイマーを待っている間はハンドラが shared_ptr を持っているので、
+// DataChannel が閉じても io_context のスレッドで破棄される。
+class FileTransferDataManager::Channel
+    : public webrtc::DataChannelObserver,
+      public std::enable_shared_from_this<Channel> {
+ public:
+  Channel(FileTransferDataManager* manager,
+          rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+      : manager_(manager), data_channel_(data_channel), timer_(manager->ioc_) {}
+  ~Channel() { data_channel_->UnregisterObserver(); }
+
+  // shared_from_this() を使うので、shared_ptr に入れてから呼ぶ
+  void Start() { data_channel_->RegisterObserver(this); }
+
+  void OnStateChange() override {
+    if (data_channel_->state() == webrtc::DataChannelInterface::kClosed) {
+      manager_->OnClosed(this);
+    }
+  }
+  void OnMessage(const webrtc::DataBuffer& buffer) override {
+    if (buffer.binary) {
+      return;
+    }
+    std::string text(buffer.data.data<char>(), buffer.data.size());
+    std::weak_ptr<Channel> weak = shared_from_this();
+    boost::asio::post(manager_->ioc_, [weak, text]() {
+      if (auto self = weak.lock()) {
+        self->OnRequest(text);
+      }
+    });
+  }
+  void OnBufferedAmountChange(uint64_t previous_amount) override {
+    if (data_channel_->buffered_amount() > kLowWaterMark) {
+      return;
+    }
+    std::weak_ptr<Channel> weak = shared_from_this();
+    boost::asio::post(manager_->ioc_, [weak]() {
+      if (auto self = weak.lock()) {
+        self->Pump();
+      }
+    });
+  }
+
+ private:
+  void OnRequest(const std::string& text) {
+    std::string path = text;
+    uint64_t offset = 0;
+    if (!text.empty() && text[0] == '{') {
+      try {
+        nlohmann::json json = nlohmann::json::parse(text);
+        path = json.at("path").get<std::string>();
+        if (json.contains("offset")) {
+          offset = json["offset"].get<uint64_t>();
+        }
+      } catch (const nlohmann::json::exception& e) {
+        SendError(text, std::string("invalid request: ") + e.what());
+        return;
+      }
+    }
+    if (file_) {
+      SendError(path, "another file is being sent");
+      return;
+    }
+
+    std::string resolved;
+    std::string error;
+    if (!manager_->ResolvePath(path, &resolved, &error)) {
+      SendError(path, error);
+      return;
+    }
+    std::unique_ptr<FileSource> file(new FileSource());
+    if (!file->Open(resolved)) {
+      SendError(path, "failed to open");
+      return;
+    }
+    if (offset > file->size()) {
+      SendError(path, "offset is larger than the file size");
+      return;
+    }
+
+    RTC_LOG(LS_INFO) << "FileTransferDataManager: sending " << resolved
+                     << " to " << data_channel_->label()
+                     << ", offset=" << offset << ", size=" << file->size();
+    path_ = path;
+    offset_ = offset;
+    end_ = file->size();
+    sent_ = 0;
+    start_ms_ = rtc::TimeMillis();
+    next_send_us_ = rtc::TimeMicros();
+    file_ = std::move(file);
+    SendJson({{"type", "begin"},
+              {"path", path_},
+              {"size", end_},
+              {"offset", offset_}});
+    Pump();
+  }
+
+  void Pump() {
+    if (!file_ || timer_pending_) {
+      return;
+    }
+    if (data_channel_->state() != webrtc::DataChannelInterface::kOpen) {
+      file_.reset();
+      return;
+    }
+    const int64_t now_us = rtc::TimeMicros();
+    while (offset_ < end_) {
+      // 続きは OnBufferedAmountChange() から再開する
+      if (data_channel_->buffered_amount() > kHighWaterMark) {
+        return;
+      }
+      if (next_send_us_ > now_us) {
+        Wait(next_send_us_ - now_us);
+        return;
+      }
+      const size_t length = static_cast<size_t>(std::min<uint64_t>(
+          manager_->settings_.chunk_size, end_ - offset_));
+      rtc::CopyOnWriteBuffer data;
+      if (!file_->Read(offset_, length, &data)) {
+        SendError(path_, "failed to read (truncated?)");
+        file_.reset();
+        return;
+      }
+      if (!data_channel_->Send(webrtc::DataBuffer(data, true))) {
+        RTC_LOG(LS_WARNING) << "FileTransferDataManager: failed to send "
+                            << path_;
+        file_.reset();
+        return;
+      }
+      offset_ += length;
+      sent_ += length;
+      next_send_us_ = std::max(next_send_us_, now_us) +
+                      static_cast<int64_t>(length) * 8 *
+                          rtc::kNumMicrosecsPerSec / manager_->RateBps();
+    }
+
+    const int64_t elapsed_ms = rtc::TimeMillis() - start_ms_;
+    RTC_LOG(LS_INFO) << "FileTransferDataManager: sent " << path_ << ", "
+                     << sent_ << " bytes in " << elapsed_ms << " ms";
+    SendJson({{"type", "end"},
+              {"path", path_},
+              {"bytes", sent_},
+              {"elapsed_ms", elapsed_ms}});
+    file_.reset();
+  }
+
+  void Wait(int64_t delay_us) {
+    timer_pending_ = true;
+    timer_.expires_after(std::chrono::microseconds(delay_us));
+    auto self = shared_from_this();
+    timer_.async_wait([self](const boost::system::error_code& ec) {
+      self->timer_pending_ = false;
+      if (ec != boost::asio::error::operation_aborted) {
+        self->Pump();
+      }
+    });
+  }
+
+  void SendError(const std::string& path, const std::string& message) {
+    RTC_LOG(LS_WARNING) << "FileTransferDataManager: " << path << ": "
+                        << message;
+    SendJson({{"type", "error"}, {"path", path}, {"message", message}});
+  }
+
+  void SendJson(const nlohmann::json& json) {
+    data_channel_->Send(webrtc::DataBuffer(json.dump()));
+  }
+
+  FileTransferDataManager* manager_;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+  boost::asio::steady_timer timer_;
+  bool timer_pending_ = false;
+
+  std::unique_ptr<FileSource> file_;
+  std::string path_;
+  uint64_t offset_ = 0;
+  uint64_t end_ = 0;
+  uint64_t sent_ = 0;
+  int64_t start_ms_ = 0;
+  // 次のチャンクを送って良い時刻
+  int64_t next_send_us_ = 0;
+};
+
+std::unique_ptr<FileTransferDataManager> FileTransferDataManager::Create(
+    boost::asio::io_context& ioc,
+    std::shared_ptr<StatsSampler> sampler,
+    Settings settings) {
+  boost::system::error_code ec;
+  if (!boost::filesystem::is_directory(settings.root, ec)) {
+    RTC_LOG(LS_ERROR) << "FileTransferDataManager: not a directory: "
+                      << settings.root;
+    return nullptr;
+  }
+  return std::unique_ptr<FileTransferDataManager>(
+      new FileTransferDataManager(ioc, std::move(sampler), std::move(settings)));
+}
+
+FileTransferDataManager::FileTransferDataManager(
+    boost::asio::io_context& ioc,
+    std::shared_ptr<StatsSampler> sampler,
+    Settings settings)
+    : ioc_(ioc), sampler_(std::move(sampler)), settings_(std::move(settings)) {}
+
+FileTransferDataManager::~FileTransferDataManager() = default;
+
+void FileTransferDataManager::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  std::shared_ptr<Channel> channel(new Channel(this, data_channel));
+  channel->Start();
+  std::lock_guard<std::mutex> lock(mutex_);
+  channels_.push_back(channel);
+}
+
+void FileTransferDataManager::OnClosed(Channel* channel) {
+  // ロックを外してから Channel を破棄する
+  std::shared_ptr<Channel> closed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(
+      channels_.begin(), channels_.end(),
+      [channel](const std::shared_ptr<Channel>& c) { return c.get() == channel; });
+  if (it != channels_.end()) {
+    closed = std::move(*it);
+    channels_.erase(it);
+  }
+}
+
+int FileTransferDataManager::RateBps() {
+  const int max_bps = settings_.max_kbps * 1000;
+  if (!sampler_) {
+    return max_bps;
+  }
+  // 複数の接続がある場合は、一番空きが少ない接続に合わせる
+  double headroom_bps = max_bps * 2.0;
+  for (const StatsSampler::Series& series : sampler_->GetLatest()) {
+    if (series.samples.empty()) {
+      continue;
+    }
+    const StatsSampler::Sample& sample = series.samples.back();
+    if (sample.available_outgoing_bitrate_bps <= 0) {
+      continue;
+    }
+    headroom_bps = std::min(headroom_bps, sample.available_outgoing_bitrate_bps -
+                                              sample.video_bitrate_bps -
+                                              sample.audio_bitrate_bps);
+  }
+  return std::min(max_bps,
+                  std::max(kMinRateBps, static_cast<int>(headroom_bps / 2)));
+}
+
+bool FileTransferDataManager::ResolvePath(const std::string& path,
+                                          std::string* resolved,
+                                          std::string* error) {
+  boost::system::error_code ec;
+  const boost::filesystem::path root =
+      boost::filesystem::canonical(settings_.root, ec);
+  if (ec) {
+    *error = "root is not available";
+    return false;
+  }
+  // シンボリックリンクや .. を解決してから、root の下にあるかを確かめる
+  const boost::filesystem::path p =
+      boost::filesystem::canonical(root / path, ec);
+  if (ec) {
+    *error = "not found";
+    return false;
+  }
+  auto it = std::mismatch(root.begin(), root.end(), p.begin(), p.end());
+  if (it.first != root.end()) {
+    *error = "outside of the root";
+    return false;
+  }
+  if (!boost::filesystem::is_regular_file(p, ec)) {
+    *error = "not a regular file";
+    return false;
+  }
+  *resolved = p.string();
+  return true;
+}
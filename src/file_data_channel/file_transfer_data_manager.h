@@ -0,0 +1,76 @@
+#ifndef FILE_TRANSFER_DATA_MANAGER_H_
+#define FILE_TRANSFER_DATA_MANAGER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+#include "rtc/data_manager.h"
+#include "rtc/stats_sampler.h"
+
+// 相手が作った DataChannel で要求されたファイルを、root 以下から読んで送り返すクラス。
+//
+// 要求はファイルのパス (root からの相対パス) か、{"path": "...", "offset": N} の JSON で送る。
+// 応答は次の順に送る。
+//   {"type": "begin", "path": "...", "size": 全体の大きさ, "offset": N}
+//   ファイルの中身 (バイナリ、最大 chunk_size ずつ)
+//   {"type": "end", "path": "...", "bytes": 送った大きさ, "elapsed_ms": 時間}
+// 失敗した場合は {"type": "error", "path": "...", "message": "..."} を送る。
+// 1 つの DataChannel で同時に送るファイルは 1 つだけで、送っている間の要求はエラーにする。
+//
+// 送信は io_context のスレッドで行い、映像を邪魔しないように次の 2 つで抑える。
+// - DataChannel の bufferedAmount が kHighWaterMark を超えたら止め、kLowWaterMark まで減ったら再開する
+// - StatsSampler がある場合は、輻輳制御が推定した送信可能なビットレートから映像と音声の分を引いた
+//   残りの半分まで (max_kbps が上限) に送信レートを抑える。無い場合は max_kbps で送る
+// ファイルは送り始めた時点の大きさまでを送る。途中で切り詰められたログでも落ちないように
+// mmap は使わず、Linux では読んだ範囲をページキャッシュから捨てながら順に読む。
+class FileTransferDataManager : public RTCDataManager {
+ public:
+  struct Settings {
+    std::string root;
+    int max_kbps = 2000;
+    size_t chunk_size = 16 * 1024;
+  };
+
+  // root が存在しないディレクトリの場合は nullptr を返す
+  static std::unique_ptr<FileTransferDataManager> Create(
+      boost::asio::io_context& ioc,
+      std::shared_ptr<StatsSampler> sampler,
+      Settings settings);
+  ~FileTransferDataManager();
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+
+ private:
+  class Channel;
+  class FileSource;
+
+  FileTransferDataManager(boost::asio::io_context& ioc,
+                          std::shared_ptr<StatsSampler> sampler,
+                          Settings settings);
+  void OnClosed(Channel* channel);
+  // 今使って良い送信レート (bps)
+  int RateBps();
+  // root 以下のファイルであれば、その絶対パスを返す
+  bool ResolvePath(const std::string& path,
+                   std::string* resolved,
+                   std::string* error);
+
+  // bufferedAmount がこの量を超えたら送信を止めて、kLowWaterMark まで減ったら再開する
+  static const uint64_t kHighWaterMark = 1024 * 1024;
+  static const uint64_t kLowWaterMark = 256 * 1024;
+  // 映像が帯域を使い切っていても、この速さまでは送る
+  static const int kMinRateBps = 64 * 1000;
+
+  boost::asio::io_context& ioc_;
+  std::shared_ptr<StatsSampler> sampler_;
+  const Settings settings_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<Channel>> channels_;
+};
+
+#endif
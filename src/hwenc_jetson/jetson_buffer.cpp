@@ -0,0 +1,136 @@
+#include "jetson_buffer.h"
+
+#include <string.h>
+
+#include "api/video/i420_buffer.h"
+#include "nvbuf_utils.h"
+#include "rtc/frame_buffer_pool.h"
+#include "rtc/parallel_scaler.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+
+rtc::scoped_refptr<JetsonBufferPool> JetsonBufferPool::Create(
+    int width,
+    int height,
+    int num_buffers) {
+  rtc::scoped_refptr<JetsonBufferPool> pool(
+      new rtc::RefCountedObject<JetsonBufferPool>(width, height));
+  for (int i = 0; i < num_buffers; i++) {
+    NvBufferCreateParams params = {0};
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.width = width;
+    params.height = height;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = NvBufferColorFormat_YUV420;
+    params.nvbuf_tag = NvBufferTag_VIDEO_DEC;
+    int fd;
+    if (NvBufferCreateEx(&fd, &params) == -1) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to NvBufferCreateEx";
+      return nullptr;
+    }
+    pool->fds_.push_back(fd);
+    pool->free_fds_.push_back(fd);
+  }
+  return pool;
+}
+
+rtc::scoped_refptr<JetsonBuffer> JetsonBufferPool::CreateBuffer() {
+  int fd;
+  {
+    rtc::CritScope lock(&crit_);
+    if (free_fds_.empty()) {
+      return nullptr;
+    }
+    fd = free_fds_.back();
+    free_fds_.pop_back();
+  }
+  return new rtc::RefCountedObject<JetsonBuffer>(this, fd, width_, height_);
+}
+
+JetsonBufferPool::JetsonBufferPool(int width, int height)
+    : width_(width), height_(height) {}
+
+JetsonBufferPool::~JetsonBufferPool() {
+  for (int fd : fds_) {
+    NvBufferDestroy(fd);
+  }
+}
+
+void JetsonBufferPool::Release(int fd) {
+  rtc::CritScope lock(&crit_);
+  free_fds_.push_back(fd);
+}
+
+JetsonBuffer::JetsonBuffer(rtc::scoped_refptr<JetsonBufferPool> pool,
+                           int fd,
+                           int width,
+                           int height)
+    : NativeBuffer(webrtc::VideoType::kI420, width, height, nullptr, 0),
+      pool_(pool),
+      fd_(fd) {}
+
+JetsonBuffer::~JetsonBuffer() {
+  pool_->Release(fd_);
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> JetsonBuffer::ToI420() {
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+      FrameBufferPool::Instance().CreateI420Buffer(raw_width(), raw_height());
+
+  NvBufferParams params;
+  if (NvBufferGetParams(fd_, &params) == -1) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to NvBufferGetParams";
+    return i420_buffer;
+  }
+  for (uint32_t i = 0; i < 3; i++) {
+    uint8_t* dst_data;
+    int dst_stride;
+    if (i == 0) {
+      dst_data = i420_buffer->MutableDataY();
+      dst_stride = i420_buffer->StrideY();
+    } else if (i == 1) {
+      dst_data = i420_buffer->MutableDataU();
+      dst_stride = i420_buffer->StrideU();
+    } else {
+      dst_data = i420_buffer->MutableDataV();
+      dst_stride = i420_buffer->StrideV();
+    }
+    void* src_data;
+    if (NvBufferMemMap(fd_, i, NvBufferMem_Read, &src_data) == -1) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to NvBufferMemMap";
+      break;
+    }
+    NvBufferMemSyncForCpu(fd_, i, &src_data);
+    for (uint32_t j = 0; j < params.height[i]; j++) {
+      memcpy(dst_data + j * dst_stride,
+             static_cast<uint8_t*>(src_data) + j * params.pitch[i],
+             params.width[i]);
+    }
+    NvBufferMemUnMap(fd_, i, &src_data);
+  }
+
+  if (width() == raw_width() && height() == raw_height()) {
+    return i420_buffer;
+  }
+  rtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer =
+      FrameBufferPool::Instance().CreateI420Buffer(width(), height());
+  ParallelScaler::Instance().ScaleFrom(*i420_buffer, scaled_buffer.get());
+  return scaled_buffer;
+}
+
+int JetsonBuffer::dmabuf_fd() const {
+  return fd_;
+}
+
+bool JetsonBuffer::GetDmabufPlanes(uint32_t offsets[3],
+                                   uint32_t pitches[3]) const {
+  NvBufferParams params;
+  if (NvBufferGetParams(fd_, &params) == -1) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    offsets[i] = params.offset[i];
+    pitches[i] = params.pitch[i];
+  }
+  return true;
+}
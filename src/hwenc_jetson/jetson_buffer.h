@@ -0,0 +1,69 @@
+#ifndef JETSON_BUFFER_H_
+#define JETSON_BUFFER_H_
+
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "rtc/native_buffer.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/ref_count.h"
+
+class JetsonBuffer;
+
+// JetsonVideoDecoder のデコード結果を書き込む NvBuffer (YUV420 のピッチリニア) のプール。
+//
+// NvBuffer はこのクラスの参照が全て無くなるまで解放しないので、
+// デコーダを作り直した後もデコード済みのフレームは安全に扱える。
+class JetsonBufferPool : public rtc::RefCountInterface {
+ public:
+  // NvBuffer を確保できなかった場合は nullptr を返す
+  static rtc::scoped_refptr<JetsonBufferPool> Create(int width,
+                                                     int height,
+                                                     int num_buffers);
+
+  // 空いている NvBuffer を返す。全て使用中の場合は nullptr を返す
+  rtc::scoped_refptr<JetsonBuffer> CreateBuffer();
+
+ protected:
+  JetsonBufferPool(int width, int height);
+  ~JetsonBufferPool() override;
+
+ private:
+  friend class JetsonBuffer;
+  void Release(int fd);
+
+  const int width_;
+  const int height_;
+  rtc::CriticalSection crit_;
+  std::vector<int> fds_;
+  std::vector<int> free_fds_ RTC_GUARDED_BY(crit_);
+};
+
+// デコードした映像を NvBuffer に持ったままにする NativeBuffer。
+//
+// dmabuf_fd() の NvBuffer をそのまま NvBufferTransform やディスプレイに渡せるので、
+// 再エンコードや表示の際に CPU でのコピーが発生しない。
+// CPU のメモリには何も持っていないので Data() は nullptr で、
+// CPU から参照する場合は ToI420() を呼ぶとその時だけマップしてコピーする。
+// 最後の参照が無くなった時点で NvBuffer をプールに返却する。
+class JetsonBuffer : public NativeBuffer {
+ public:
+  rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override;
+  int dmabuf_fd() const override;
+  bool GetDmabufPlanes(uint32_t offsets[3], uint32_t pitches[3]) const override;
+
+ protected:
+  JetsonBuffer(rtc::scoped_refptr<JetsonBufferPool> pool,
+               int fd,
+               int width,
+               int height);
+  ~JetsonBuffer() override;
+
+ private:
+  friend class JetsonBufferPool;
+
+  const rtc::scoped_refptr<JetsonBufferPool> pool_;
+  const int fd_;
+};
+
+#endif  // JETSON_BUFFER_H_
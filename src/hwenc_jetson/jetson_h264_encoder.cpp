@@ -14,49 +14,104 @@
 #include <limits>
 #include <string>
 
+#include "absl/strings/match.h"
 #include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "media/base/media_constants.h"
+#include "modules/video_coding/utility/vp9_uncompressed_header_parser.h"
 #include "nvbuf_utils.h"
+#include "rtc/low_latency_rate_control.h"
+#include "rtc/memory_accounting.h"
 #include "rtc/native_buffer.h"
+#include "rtc/simulcast_frame_buffer.h"
+#include "rtc/thread_placement.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/time_utils.h"
 #include "system_wrappers/include/metrics.h"
 #include "third_party/libyuv/include/libyuv/convert.h"
 #include "third_party/libyuv/include/libyuv/convert_from.h"
+#include "third_party/libyuv/include/libyuv/planar_functions.h"
 #include "third_party/libyuv/include/libyuv/video_common.h"
 
 #define H264HWENC_HEADER_DEBUG 0
 #define INIT_ERROR(cond, desc)                 \
   if (cond) {                                  \
     RTC_LOG(LS_ERROR) << __FUNCTION__ << desc; \
-    Release();                                 \
+    JetsonRelease();                           \
     return WEBRTC_VIDEO_CODEC_ERROR;           \
   }
 
 namespace {
-struct nal_entry {
-  size_t offset;
-  size_t size;
-};
-
 const int kLowH264QpThreshold = 34;
 const int kHighH264QpThreshold = 40;
+// libvpx の VP9 エンコーダと同じ値
+const int kLowVp9QpThreshold = 149;
+const int kHighVp9QpThreshold = 205;
+// MJPEG をデコードしておくバッファの数。デコードと変換、エンコードを重ねるのに 3 つ使う
+const int kJpegDecodeSlots = 3;
+
+int64_t PlaneBytes(NvV4l2ElementPlane& plane) {
+  int64_t bytes = 0;
+  for (uint32_t i = 0; i < plane.getNumBuffers(); i++) {
+    NvBuffer* buffer = plane.getNthBuffer(i);
+    for (uint32_t j = 0; j < buffer->n_planes; j++) {
+      bytes += buffer->planes[j].length;
+    }
+  }
+  return bytes;
+}
+
+webrtc::VideoCodecType CodecTypeFromName(const std::string& name) {
+  if (absl::EqualsIgnoreCase(name, cricket::kVp9CodecName)) {
+    return webrtc::kVideoCodecVP9;
+  }
+  return webrtc::kVideoCodecH264;
+}
 
 }  // namespace
 
-JetsonH264Encoder::JetsonH264Encoder(const cricket::VideoCodec& codec)
-    : callback_(nullptr),
-      decoder_(nullptr),
+JetsonH264Encoder::JetsonH264Encoder(
+    const cricket::VideoCodec& codec,
+    bool low_latency_rate_control,
+    KeyFrameThrottle::Settings key_frame_throttle)
+    : HWVideoEncoder(CodecTypeFromName(codec.name) == webrtc::kVideoCodecVP9
+                         ? "Jetson VP9"
+                         : "Jetson H264",
+                     key_frame_throttle),
+      codec_type_(CodecTypeFromName(codec.name)),
+      low_latency_rate_control_(low_latency_rate_control),
       converter_(nullptr),
       encoder_(nullptr),
-      bitrate_adjuster_(.5, .95),
       configured_framerate_(30),
+      key_frame_interval_(0),
       configured_width_(0),
       configured_height_(0),
-      use_mjpeg_(false) {}
+      use_mjpeg_(false),
+      use_nv12_(false),
+      configured_nv12_(false),
+      use_dmabuf_(false),
+      configured_dmabuf_(false) {}
 
 JetsonH264Encoder::~JetsonH264Encoder() {
-  Release();
+  JetsonRelease();
+}
+
+bool JetsonH264Encoder::IsVP9Supported() {
+  // VP9 のエンコードに対応しているのは Xavier 以降なので、実際に設定できるかで判断する
+  static const bool supported = []() {
+    NvVideoEncoder* encoder = NvVideoEncoder::createVideoEncoder("enc_probe");
+    if (!encoder) {
+      return false;
+    }
+    bool result =
+        encoder->setCapturePlaneFormat(V4L2_PIX_FMT_VP9, 640, 480,
+                                       1024 * 1024) >= 0;
+    delete encoder;
+    RTC_LOG(LS_INFO) << "Jetson VP9 encoder is "
+                     << (result ? "supported" : "not supported");
+    return result;
+  }();
+  return supported;
 }
 
 int32_t JetsonH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
@@ -64,38 +119,55 @@ int32_t JetsonH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
                                       size_t max_payload_size) {
   RTC_LOG(LS_INFO) << __FUNCTION__ << " Start";
   RTC_DCHECK(codec_settings);
-  RTC_DCHECK_EQ(codec_settings->codecType, webrtc::kVideoCodecH264);
+  RTC_DCHECK_EQ(codec_settings->codecType, codec_type_);
+
+  // サイマルキャストは SimulcastEncoderAdapter に任せる
+  if (codec_settings->numberOfSimulcastStreams > 1) {
+    return WEBRTC_VIDEO_CODEC_ERR_SIMULCAST_PARAMETERS_NOT_SUPPORTED;
+  }
 
   int32_t release_ret = Release();
   if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
     return release_ret;
   }
 
+  const int previous_key_frame_interval = key_frame_interval_;
   width_ = codec_settings->width;
   height_ = codec_settings->height;
-  target_bitrate_bps_ = codec_settings->startBitrate * 1000;
-  key_frame_interval_ = codec_settings->H264().keyFrameInterval;
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
+  SetTargetBitrateBps(codec_settings->startBitrate * 1000);
+  if (codec_type_ == webrtc::kVideoCodecVP9) {
+    key_frame_interval_ = codec_settings->VP9().keyFrameInterval;
+    // 単一レイヤーで全てのフレームが直前のフレームを参照する
+    gof_.SetGofInfoVP9(webrtc::kTemporalStructureMode1);
+  } else {
+    key_frame_interval_ = codec_settings->H264().keyFrameInterval;
+  }
   framerate_ = codec_settings->maxFramerate;
 
   RTC_LOG(LS_INFO) << "InitEncode " << framerate_ << "fps "
                    << target_bitrate_bps_ << "bit/sec　"
                    << codec_settings->maxBitrate << "kbit/sec　";
 
-  // Initialize encoded image. Default buffer size: size of unencoded data.
-  encoded_image_._completeFrame = true;
-  encoded_image_._encodedWidth = 0;
-  encoded_image_._encodedHeight = 0;
-  encoded_image_.set_size(0);
-  encoded_image_.timing_.flags =
-      webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
-  encoded_image_.content_type_ =
-      (codec_settings->mode == webrtc::VideoCodecMode::kScreensharing)
-          ? webrtc::VideoContentType::SCREENSHARE
-          : webrtc::VideoContentType::UNSPECIFIED;
-
-  decoder_ = NvJPEGDecoder::createJPEGDecoder("jpegdec");
-  INIT_ERROR(!decoder_, "Failed to createJPEGDecoder");
+  InitEncodedImage(*codec_settings);
+
+  if (!jpeg_stage_) {
+    jpeg_stage_.reset(new JetsonJpegDecodeStage(kJpegDecodeSlots, &metrics_));
+    INIT_ERROR(jpeg_stage_->num_slots() == 0,
+               "Failed to create JetsonJpegDecodeStage");
+  }
+
+  // IDR の間隔はエンコーダを作る時にしか設定しないので、変わった場合は作り直す。
+  // それ以外の設定が同じなら、Release() で残しておいたエンコーダをそのまま使い、
+  // 解像度や入力の形式が変わった場合は最初の Encode() で作り直す
+  if (encoder_ && key_frame_interval_ != previous_key_frame_interval) {
+    JetsonRelease();
+  }
+  // Release() で止めたキャプチャプレーンを動かし直す
+  if (encoder_ && StartCapturePlane() != WEBRTC_VIDEO_CODEC_OK) {
+    JetsonRelease();
+  }
+  idr_needed_ = encoder_ != nullptr;
+  released_ = false;
 
   RTC_LOG(LS_INFO) << __FUNCTION__ << " End";
   return WEBRTC_VIDEO_CODEC_OK;
@@ -103,10 +175,16 @@ int32_t JetsonH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
 
 int32_t JetsonH264Encoder::Release() {
   RTC_LOG(LS_INFO) << __FUNCTION__ << " Start";
-  JetsonRelease();
-  if (decoder_) {
-    delete decoder_;
-    decoder_ = nullptr;
+  // 解像度の変更や再ネゴシエーションでは Release() の後にすぐ InitEncode() が呼ばれるので、
+  // エンコーダや変換器は破棄せずに残しておく。破棄するのはデストラクタ。
+  // 残っているフレームの出力はもうコールバックに渡さない
+  released_ = true;
+  ClearFrameParams();
+  // 戻った後に EncodeFinishedCallback() が呼ばれないように、キャプチャプレーンを止めて
+  // DQ スレッドが終わるのを待つ。止めると DQ スレッドの dqBuffer() が失敗して終わる
+  if (encoder_ && encoder_->capture_plane.getStreamStatus()) {
+    encoder_->capture_plane.setStreamStatus(false);
+    encoder_->capture_plane.waitForDQThread(2000);
   }
   RTC_LOG(LS_INFO) << __FUNCTION__ << " End";
   return WEBRTC_VIDEO_CODEC_OK;
@@ -119,7 +197,7 @@ int32_t JetsonH264Encoder::JetsonConfigure() {
     enc0_buffer_queue_ = new std::queue<NvBuffer*>;
 
     converter_ = NvVideoConverter::createVideoConverter("conv");
-    INIT_ERROR(!decoder_, "Failed to createVideoConverter");
+    INIT_ERROR(!converter_, "Failed to createVideoConverter");
 
     ret = converter_->setOutputPlaneFormat(
         decode_pixfmt_, raw_width_, raw_height_, V4L2_NV_BUFFER_LAYOUT_PITCH);
@@ -132,8 +210,8 @@ int32_t JetsonH264Encoder::JetsonConfigure() {
     ret = converter_->setCropRect(0, 0, raw_width_, raw_height_);
     INIT_ERROR(ret < 0, "Failed to converter setCropRect");
 
-    ret = converter_->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 1, false,
-                                              false);
+    ret = converter_->output_plane.setupPlane(
+        V4L2_MEMORY_DMABUF, jpeg_stage_->num_slots(), false, false);
     INIT_ERROR(ret < 0, "Failed to setupPlane at converter output_plane");
 
     ret = converter_->capture_plane.setupPlane(V4L2_MEMORY_MMAP, 10, false,
@@ -153,29 +231,39 @@ int32_t JetsonH264Encoder::JetsonConfigure() {
   encoder_ = NvVideoEncoder::createVideoEncoder("enc0");
   INIT_ERROR(!encoder_, "Failed to createVideoEncoder");
 
-  ret = encoder_->setCapturePlaneFormat(V4L2_PIX_FMT_H264, width_, height_,
-                                        4 * 1024 * 1024);
+  ret = encoder_->setCapturePlaneFormat(
+      codec_type_ == webrtc::kVideoCodecVP9 ? V4L2_PIX_FMT_VP9
+                                            : V4L2_PIX_FMT_H264,
+      width_, height_, 4 * 1024 * 1024);
   INIT_ERROR(ret < 0, "Failed to encoder setCapturePlaneFormat");
 
-  ret = encoder_->setOutputPlaneFormat(V4L2_PIX_FMT_YUV420M, width_, height_);
+  ret = encoder_->setOutputPlaneFormat(
+      use_nv12_ ? V4L2_PIX_FMT_NV12M : V4L2_PIX_FMT_YUV420M, width_, height_);
   INIT_ERROR(ret < 0, "Failed to encoder setOutputPlaneFormat");
 
-  ret = encoder_->setBitrate(bitrate_adjuster_.GetAdjustedBitrateBps());
+  configured_bitrate_bps_ = bitrate_adjuster_.GetAdjustedBitrateBps();
+  ret = encoder_->setBitrate(configured_bitrate_bps_);
   INIT_ERROR(ret < 0, "Failed to setBitrate");
 
-  ret = encoder_->setProfile(V4L2_MPEG_VIDEO_H264_PROFILE_HIGH);
-  INIT_ERROR(ret < 0, "Failed to setProfile");
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    ret = encoder_->setProfile(V4L2_MPEG_VIDEO_H264_PROFILE_HIGH);
+    INIT_ERROR(ret < 0, "Failed to setProfile");
 
-  ret = encoder_->setLevel(V4L2_MPEG_VIDEO_H264_LEVEL_5_1);
-  INIT_ERROR(ret < 0, "Failed to setLevel");
+    ret = encoder_->setLevel(V4L2_MPEG_VIDEO_H264_LEVEL_5_1);
+    INIT_ERROR(ret < 0, "Failed to setLevel");
+  }
 
   ret = encoder_->setRateControlMode(V4L2_MPEG_VIDEO_BITRATE_MODE_CBR);
   INIT_ERROR(ret < 0, "Failed to setRateControlMode");
 
-  ret = encoder_->setIDRInterval(key_frame_interval_);
+  // 低遅延のレート制御では定期的な IDR を送らず、キーフレームは要求された時だけにする
+  const uint32_t key_frame_interval =
+      low_latency_rate_control_ ? std::numeric_limits<uint32_t>::max()
+                                : key_frame_interval_;
+  ret = encoder_->setIDRInterval(key_frame_interval);
   INIT_ERROR(ret < 0, "Failed to setIDRInterval");
 
-  ret = encoder_->setIFrameInterval(key_frame_interval_);
+  ret = encoder_->setIFrameInterval(key_frame_interval);
   INIT_ERROR(ret < 0, "Failed to setIFrameInterval");
 
   ret = encoder_->setFrameRate(framerate_, 1);
@@ -192,16 +280,63 @@ int32_t JetsonH264Encoder::JetsonConfigure() {
   //ret = encoder_->setConstantQp(30);
   //INIT_ERROR(ret < 0, "Failed to setConstantQp");
 
-  ret = encoder_->setInsertSpsPpsAtIdrEnabled(true);
-  INIT_ERROR(ret < 0, "Failed to setInsertSpsPpsAtIdrEnabled");
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    ret = encoder_->setInsertSpsPpsAtIdrEnabled(true);
+    INIT_ERROR(ret < 0, "Failed to setInsertSpsPpsAtIdrEnabled");
+
+    ret = encoder_->setInsertVuiEnabled(true);
+    INIT_ERROR(ret < 0, "Failed to setInsertSpsPpsAtIdrEnabled");
+  }
+
+  if (low_latency_rate_control_) {
+    ret = encoder_->setVirtualBufferSize(LowLatencyRateControl::VbvBufferBits(
+        configured_bitrate_bps_, framerate_));
+    INIT_ERROR(ret < 0, "Failed to setVirtualBufferSize");
+  }
+
+  intra_refresh_ = codec_type_ == webrtc::kVideoCodecH264 &&
+                   (low_latency_rate_control_ ||
+                    key_frame_throttle_.settings().intra_refresh);
+  if (intra_refresh_) {
+    ret = encoder_->setSliceIntrarefresh(
+        LowLatencyRateControl::IntraRefreshFrames(framerate_));
+    INIT_ERROR(ret < 0, "Failed to setSliceIntrarefresh");
+  }
 
-  ret = encoder_->setInsertVuiEnabled(true);
-  INIT_ERROR(ret < 0, "Failed to setInsertSpsPpsAtIdrEnabled");
+  // ROI は H264 の場合のみ使う。プレーンを用意する前に有効にしておく必要がある
+  roi_enabled_ = codec_type_ == webrtc::kVideoCodecH264 &&
+                 RoiHints::Instance().enabled();
+  if (roi_enabled_) {
+    v4l2_enc_enable_roi_param enable_roi;
+    memset(&enable_roi, 0, sizeof(enable_roi));
+    enable_roi.bEnableROI = 1;
+    ret = encoder_->enableROI(enable_roi);
+    INIT_ERROR(ret < 0, "Failed to enableROI");
+  }
 
   if (use_mjpeg_) {
     ret =
         encoder_->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 10, false, false);
     INIT_ERROR(ret < 0, "Failed to setupPlane at encoder output_plane");
+  } else if (use_dmabuf_) {
+    ret =
+        encoder_->output_plane.setupPlane(V4L2_MEMORY_DMABUF, 10, false, false);
+    INIT_ERROR(ret < 0, "Failed to setupPlane at encoder output_plane");
+
+    NvBufferCreateParams params;
+    memset(&params, 0, sizeof(params));
+    params.width = width_;
+    params.height = height_;
+    params.layout = NvBufferLayout_Pitch;
+    params.colorFormat = NvBufferColorFormat_YUV420;
+    params.payloadType = NvBufferPayload_SurfArray;
+    params.nvbuf_tag = NvBufferTag_VIDEO_ENC;
+    for (uint32_t i = 0; i < encoder_->output_plane.getNumBuffers(); i++) {
+      int fd;
+      ret = NvBufferCreateEx(&fd, &params);
+      INIT_ERROR(ret < 0, "Failed to NvBufferCreateEx");
+      dmabuf_fds_.push_back(fd);
+    }
   } else {
     ret = encoder_->output_plane.setupPlane(V4L2_MEMORY_MMAP, 10, true, false);
     INIT_ERROR(ret < 0, "Failed to setupPlane at encoder output_plane");
@@ -241,9 +376,38 @@ int32_t JetsonH264Encoder::JetsonConfigure() {
   encoder_->capture_plane.setDQThreadCallback(EncodeFinishedCallbackFunction);
   if (use_mjpeg_) {
     encoder_->output_plane.startDQThread(this);
+    jpeg_stage_->Start(converter_);
+  }
+  INIT_ERROR(StartCapturePlane() != WEBRTC_VIDEO_CODEC_OK,
+             "Failed to start encoder capture_plane");
+
+  buffer_bytes_ = PlaneBytes(encoder_->output_plane) +
+                  PlaneBytes(encoder_->capture_plane) +
+                  (int64_t)dmabuf_fds_.size() * width_ * height_ * 3 / 2;
+  if (use_mjpeg_) {
+    buffer_bytes_ += PlaneBytes(converter_->capture_plane);
+  }
+  MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder,
+                                   buffer_bytes_);
+
+  configured_framerate_ = framerate_;
+  configured_width_ = width_;
+  configured_height_ = height_;
+  configured_nv12_ = use_nv12_;
+  configured_dmabuf_ = use_dmabuf_;
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t JetsonH264Encoder::StartCapturePlane() {
+  if (!encoder_->capture_plane.getStreamStatus() &&
+      encoder_->capture_plane.setStreamStatus(true) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to setStreamStatus at encoder capture_plane";
+    return WEBRTC_VIDEO_CODEC_ERROR;
   }
   encoder_->capture_plane.startDQThread(this);
 
+  // ストリームを止めるとキューにあったバッファは全て戻ってくるので、全て積み直す
   for (uint32_t i = 0; i < encoder_->capture_plane.getNumBuffers(); i++) {
     struct v4l2_buffer v4l2_buf;
     struct v4l2_plane planes[MAX_PLANES];
@@ -251,21 +415,26 @@ int32_t JetsonH264Encoder::JetsonConfigure() {
     memset(planes, 0, MAX_PLANES * sizeof(struct v4l2_plane));
     v4l2_buf.index = i;
     v4l2_buf.m.planes = planes;
-    ret = encoder_->capture_plane.qBuffer(v4l2_buf, NULL);
-    INIT_ERROR(ret < 0, "Failed to qBuffer at encoder capture_plane");
+    if (encoder_->capture_plane.qBuffer(v4l2_buf, NULL) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to qBuffer at encoder capture_plane";
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
   }
-
-  configured_framerate_ = framerate_;
-  configured_width_ = width_;
-  configured_height_ = height_;
-
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
 void JetsonH264Encoder::JetsonRelease() {
   if (!encoder_)
     return;
+  // 次の Encode() で作り直す
+  configured_width_ = 0;
+  configured_height_ = 0;
+  MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder,
+                                   -buffer_bytes_);
+  buffer_bytes_ = 0;
   if (converter_) {
+    // デコードスレッドが converter に渡さないように先に止める
+    jpeg_stage_->Stop();
     SendEOS(converter_);
   } else {
     SendEOS(encoder_);
@@ -278,6 +447,10 @@ void JetsonH264Encoder::JetsonRelease() {
   }
   delete encoder_;
   encoder_ = nullptr;
+  for (int fd : dmabuf_fds_) {
+    NvBufferDestroy(fd);
+  }
+  dmabuf_fds_.clear();
   if (converter_) {
     converter_->capture_plane.waitForDQThread(2000);
     delete converter_;
@@ -313,6 +486,8 @@ bool JetsonH264Encoder::ConvertFinishedCallbackFunction(
     NvBuffer* buffer,
     NvBuffer* shared_buffer,
     void* data) {
+  // DQ スレッドは NvV4l2ElementPlane が作るので、最初のコールバックで設定する
+  ThreadPlacement::Instance().ApplyOnce("encoder", "JetsonConvert");
   return ((JetsonH264Encoder*)data)
       ->ConvertFinishedCallback(v4l2_buf, buffer, shared_buffer);
 }
@@ -328,6 +503,9 @@ bool JetsonH264Encoder::ConvertFinishedCallback(struct v4l2_buffer* v4l2_buf,
     RTC_LOG(LS_INFO) << __FUNCTION__ << " v4l2_buf is null";
     return false;
   }
+  jpeg_stage_->OnConverted(
+      v4l2_buf->timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
+      v4l2_buf->timestamp.tv_usec);
   {
     std::unique_lock<std::mutex> lock(enc0_buffer_mtx_);
     while (enc0_buffer_queue_->empty()) {
@@ -352,6 +530,10 @@ bool JetsonH264Encoder::ConvertFinishedCallback(struct v4l2_buffer* v4l2_buf,
   enc0_qbuf.timestamp.tv_sec = v4l2_buf->timestamp.tv_sec;
   enc0_qbuf.timestamp.tv_usec = v4l2_buf->timestamp.tv_usec;
 
+  // デコード結果は CPU から読めないので、動きは検出しない
+  SetRoiParams(&convert_roi_map_, enc0_qbuf.index, configured_width_,
+               configured_height_, nullptr, 0, 0, 0);
+
   if (encoder_->output_plane.qBuffer(enc0_qbuf, buffer) < 0) {
     RTC_LOG(LS_ERROR) << __FUNCTION__
                       << " Failed to qBuffer at encoder output_plane";
@@ -371,6 +553,8 @@ bool JetsonH264Encoder::EncodeOutputCallbackFunction(
     NvBuffer* buffer,
     NvBuffer* shared_buffer,
     void* data) {
+  // DQ スレッドは NvV4l2ElementPlane が作るので、最初のコールバックで設定する
+  ThreadPlacement::Instance().ApplyOnce("encoder", "JetsonEncOut");
   return ((JetsonH264Encoder*)data)
       ->EncodeOutputCallback(v4l2_buf, buffer, shared_buffer);
 }
@@ -417,6 +601,8 @@ bool JetsonH264Encoder::EncodeFinishedCallbackFunction(
     NvBuffer* buffer,
     NvBuffer* shared_buffer,
     void* data) {
+  // DQ スレッドは NvV4l2ElementPlane が作るので、最初のコールバックで設定する
+  ThreadPlacement::Instance().ApplyOnce("encoder", "JetsonEncCap");
   return ((JetsonH264Encoder*)data)
       ->EncodeFinishedCallback(v4l2_buf, buffer, shared_buffer);
 }
@@ -432,42 +618,31 @@ bool JetsonH264Encoder::EncodeFinishedCallback(struct v4l2_buffer* v4l2_buf,
     RTC_LOG(LS_INFO) << __FUNCTION__ << " buffer size is zero";
     return false;
   }
+  if (released_) {
+    return encoder_->capture_plane.qBuffer(*v4l2_buf, NULL) >= 0;
+  }
 
   uint64_t timestamp = v4l2_buf->timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
                  v4l2_buf->timestamp.tv_usec;
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " timestamp:" << timestamp
-                   << " bytesused:" << buffer->planes[0].bytesused;
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " timestamp:" << timestamp
+                      << " bytesused:" << buffer->planes[0].bytesused;
 
-  std::unique_ptr<FrameParams> params;
-  {
-    rtc::CritScope lock(&frame_params_lock_);
-    do {
-      if (frame_params_.empty()) {
-        RTC_LOG(LS_WARNING)
-            << __FUNCTION__
-            << "Frame parameter is not found. SkipFrame timestamp:" << timestamp;
-        return true;
-      }
-      params = std::move(frame_params_.front());
-      frame_params_.pop();
-    } while (params->timestamp_us < timestamp);
-    if (params->timestamp_us != timestamp) {
-      RTC_LOG(LS_WARNING) << __FUNCTION__
-                          << "Frame parameter is not found. SkipFrame timestamp:"
-                          << timestamp;
-      return true;
+  std::unique_ptr<FrameParams> params = PopFrameParams(timestamp);
+  if (!params) {
+    return true;
+  }
+  SetEncodedImageParams(*params);
+
+  // H.264 の場合は、エンコーダが出力バッファ毎に返す平均の QP を使う
+  int qp = -1;
+  if (codec_type_ == webrtc::kVideoCodecH264) {
+    v4l2_ctrl_videoenc_outputbuf_metadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    if (encoder_->getMetadata(v4l2_buf->index, metadata) == 0) {
+      qp = metadata.AvgQP;
     }
   }
-
-  encoded_image_._encodedWidth = params->width;
-  encoded_image_._encodedHeight = params->height;
-  encoded_image_.capture_time_ms_ = params->render_time_ms;
-  encoded_image_.ntp_time_ms_ = params->ntp_time_ms;
-  encoded_image_.SetTimestamp(params->timestamp_rtp);
-  encoded_image_.rotation_ = params->rotation;
-  encoded_image_.SetColorSpace(params->color_space);
-
-  SendFrame(buffer->planes[0].data, buffer->planes[0].bytesused);
+  SendFrame(buffer->planes[0].data, buffer->planes[0].bytesused, qp);
 
   if (encoder_->capture_plane.qBuffer(*v4l2_buf, NULL) < 0) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to qBuffer at capture_plane";
@@ -492,8 +667,7 @@ void JetsonH264Encoder::SetRates(const RateControlParameters& parameters) {
   RTC_LOG(LS_INFO) << __FUNCTION__ << " framerate:" << parameters.framerate_fps
                    << " bitrate:" << parameters.bitrate.get_sum_bps();
   framerate_ = parameters.framerate_fps;
-  target_bitrate_bps_ = parameters.bitrate.get_sum_bps();
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
+  SetTargetBitrateBps(parameters.bitrate.get_sum_bps());
   return;
 }
 
@@ -518,20 +692,36 @@ void JetsonH264Encoder::SetBitrateBps(uint32_t bitrate_bps) {
   if (bitrate_bps < 300000 || configured_bitrate_bps_ == bitrate_bps) {
     return;
   }
+  if (low_latency_rate_control_ &&
+      !LowLatencyRateControl::ShouldUpdateBitrate(configured_bitrate_bps_,
+                                                  bitrate_bps)) {
+    return;
+  }
   RTC_LOG(LS_INFO) << __FUNCTION__ << " " << bitrate_bps << "bit/sec";
   if (encoder_->setBitrate(bitrate_bps) < 0) {
     RTC_LOG(LS_ERROR) << "Failed to setBitrate";
     return;
   }
   configured_bitrate_bps_ = bitrate_bps;
+  if (low_latency_rate_control_ &&
+      encoder_->setVirtualBufferSize(LowLatencyRateControl::VbvBufferBits(
+          bitrate_bps, configured_framerate_)) < 0) {
+    RTC_LOG(LS_WARNING) << "Failed to setVirtualBufferSize";
+  }
 }
 
 webrtc::VideoEncoder::EncoderInfo JetsonH264Encoder::GetEncoderInfo() const {
   EncoderInfo info;
   info.supports_native_handle = true;
-  info.implementation_name = "Jetson H264";
-  info.scaling_settings =
-      VideoEncoder::ScalingSettings(kLowH264QpThreshold, kHighH264QpThreshold);
+  if (codec_type_ == webrtc::kVideoCodecVP9) {
+    info.implementation_name = "Jetson VP9";
+    info.scaling_settings =
+        VideoEncoder::ScalingSettings(kLowVp9QpThreshold, kHighVp9QpThreshold);
+  } else {
+    info.implementation_name = "Jetson H264";
+    info.scaling_settings = VideoEncoder::ScalingSettings(kLowH264QpThreshold,
+                                                          kHighH264QpThreshold);
+  }
   info.is_hardware_accelerated = true;
   info.has_internal_source = false;
   return info;
@@ -547,60 +737,104 @@ int32_t JetsonH264Encoder::Encode(
     return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
   }
 
-  int fd = 0;
+  // YUYV と UYVY のキャプチャバッファを、NV12M のプレーンに直接変換する
+  bool packed_input = false;
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer =
-      input_frame.video_frame_buffer();
+      SimulcastFrameBuffer::SelectLayer(input_frame.video_frame_buffer(),
+                                        width_, height_);
+  NativeBuffer* native_buffer = nullptr;
   if (frame_buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
+    native_buffer = dynamic_cast<NativeBuffer*>(frame_buffer.get());
+  }
+  if (native_buffer && native_buffer->dmabuf_fd() >= 0 &&
+      native_buffer->VideoType() != webrtc::VideoType::kMJPEG) {
+    use_mjpeg_ = false;
+    use_nv12_ = false;
+    use_dmabuf_ = true;
+  } else if (native_buffer &&
+             native_buffer->VideoType() == webrtc::VideoType::kNV12) {
+    use_mjpeg_ = false;
+    use_nv12_ = true;
+    use_dmabuf_ = false;
+  } else if (native_buffer &&
+             (native_buffer->VideoType() == webrtc::VideoType::kYUY2 ||
+              native_buffer->VideoType() == webrtc::VideoType::kUYVY)) {
+    // 縮小する場合は I420 を経由する
+    packed_input = native_buffer->raw_width() == frame_buffer->width() &&
+                   native_buffer->raw_height() == frame_buffer->height();
+    use_mjpeg_ = false;
+    use_nv12_ = packed_input;
+    use_dmabuf_ = false;
+  } else if (native_buffer) {
+    // デコードは JetsonJpegDecodeStage のスレッドで行う
     use_mjpeg_ = true;
-    NativeBuffer* native_buffer =
-        dynamic_cast<NativeBuffer*>(frame_buffer.get());
-    int ret = decoder_->decodeToFd(fd, (unsigned char*)native_buffer->Data(),
-                                   native_buffer->length(), decode_pixfmt_,
-                                   raw_width_, raw_height_);
-    if (ret < 0) {
-      RTC_LOG(LS_ERROR) << "Failed to decodeToFd";
-      return WEBRTC_VIDEO_CODEC_ERROR;
-    }
+    use_nv12_ = false;
+    use_dmabuf_ = false;
   } else {
     use_mjpeg_ = false;
+    use_nv12_ = false;
+    use_dmabuf_ = false;
   }
 
-  if (frame_buffer->width() != configured_width_ ||
-      frame_buffer->height() != configured_height_) {
+  // 出力が止まっている場合も、PeerConnection はそのままでエンコーダだけを作り直す
+  const bool stalled = metrics_.IsStalled();
+  if (stalled) {
+    metrics_.OnStallReset();
+  }
+  if (stalled || frame_buffer->width() != configured_width_ ||
+      frame_buffer->height() != configured_height_ ||
+      use_nv12_ != configured_nv12_ || use_dmabuf_ != configured_dmabuf_) {
     RTC_LOG(LS_INFO) << "Encoder reinitialized from " << configured_width_
                      << "x" << configured_height_ << " to "
                      << frame_buffer->width() << "x" << frame_buffer->height()
                      << " framerate:" << framerate_;
     JetsonRelease();
+    // converter の設定に JPEG の形式が必要なので、最初のフレームはここでデコードする
+    if (use_mjpeg_ && !jpeg_stage_->Probe(native_buffer, &decode_pixfmt_,
+                                          &raw_width_, &raw_height_)) {
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
     if (JetsonConfigure() != WEBRTC_VIDEO_CODEC_OK) {
       RTC_LOG(LS_ERROR) << "Failed to JetsonConfigure";
       return WEBRTC_VIDEO_CODEC_ERROR;
     }
+    // 作り直したエンコーダは最初に IDR を出す
+    key_frame_throttle_.OnKeyFrame(rtc::TimeMillis());
+  } else if (idr_needed_) {
+    // Release() で残しておいたエンコーダを使い続ける場合は、最初のフレームを IDR にする
+    if (encoder_->forceIDR() < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to forceIDR";
+    }
+    key_frame_throttle_.OnKeyFrame(rtc::TimeMillis());
   }
+  idr_needed_ = false;
 
-  bool force_key_frame = false;
+  bool key_frame_requested = false;
   if (frame_types != nullptr) {
     RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
     if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+      metrics_.OnSkipped();
       return WEBRTC_VIDEO_CODEC_OK;
     }
-    if ((*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey) {
-      if (encoder_->forceIDR() < 0) {
-        RTC_LOG(LS_ERROR) << "Failed to forceIDR";
-      }
+    key_frame_requested =
+        (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+  }
+  // イントラリフレッシュは常に行っているので、その場合は何もしなくても復旧する
+  const KeyFrameThrottle::Action key_frame_action = key_frame_throttle_.Update(
+      key_frame_requested, intra_refresh_, rtc::TimeMillis());
+  if (key_frame_action == KeyFrameThrottle::Action::kKeyFrame) {
+    if (encoder_->forceIDR() < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to forceIDR";
     }
+  } else if (key_frame_requested) {
+    metrics_.OnKeyFrameRequestCoalesced();
   }
 
   SetFramerate(framerate_);
   SetBitrateBps(bitrate_adjuster_.GetAdjustedBitrateBps());
-  {
-    rtc::CritScope lock(&frame_params_lock_);
-    frame_params_.push(absl::make_unique<FrameParams>(
-        frame_buffer->width(), frame_buffer->height(),
-        input_frame.render_time_ms(), input_frame.ntp_time_ms(),
-        input_frame.timestamp_us(), input_frame.timestamp(),
-        input_frame.rotation(), input_frame.color_space()));
-  }
+  PushFrameParams(FrameParams(input_frame, frame_buffer->width(),
+                              frame_buffer->height()));
+  metrics_.OnSubmit(input_frame.timestamp());
 
   struct v4l2_buffer v4l2_buf;
   struct v4l2_plane planes[MAX_PLANES];
@@ -610,18 +844,40 @@ int32_t JetsonH264Encoder::Encode(
   v4l2_buf.m.planes = planes;
 
   if (use_mjpeg_) {
+    // デコード待ちが溢れた場合はこのフレームを捨てる。FrameParams は出力時に読み飛ばす
+    if (!jpeg_stage_->Push(frame_buffer, input_frame.timestamp_us())) {
+      metrics_.OnDropped();
+    }
+  } else if (use_dmabuf_) {
     NvBuffer* buffer;
-    if (converter_->output_plane.getNumQueuedBuffers() ==
-        converter_->output_plane.getNumBuffers()) {
-      if (converter_->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
-        RTC_LOG(LS_ERROR) << "Failed to dqBuffer at converter output_plane";
+    if (encoder_->output_plane.getNumQueuedBuffers() ==
+        encoder_->output_plane.getNumBuffers()) {
+      if (encoder_->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
+        RTC_LOG(LS_ERROR) << "Failed to dqBuffer at encoder output_plane";
         return WEBRTC_VIDEO_CODEC_ERROR;
       }
+    } else {
+      v4l2_buf.index = encoder_->output_plane.getNumQueuedBuffers();
     }
 
-    v4l2_buf.index = 0;
-    planes[0].m.fd = fd;
-    planes[0].bytesused = 1234;
+    // 色変換と縮小を VIC で行い、エンコーダ用の NvBuffer に書き込む
+    int dst_fd = dmabuf_fds_[v4l2_buf.index];
+    NvBufferTransformParams transform_params;
+    memset(&transform_params, 0, sizeof(transform_params));
+    transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    transform_params.transform_filter = NvBufferTransform_Filter_Smart;
+    if (NvBufferTransform(native_buffer->dmabuf_fd(), dst_fd,
+                          &transform_params) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to NvBufferTransform";
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+
+    for (uint32_t i = 0; i < encoder_->output_plane.getNumPlanes(); i++) {
+      planes[i].m.fd = dst_fd;
+      planes[i].bytesused = 1;
+    }
+    SetRoiParams(&roi_map_, v4l2_buf.index, frame_buffer->width(),
+                 frame_buffer->height(), nullptr, 0, 0, 0);
 
     v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
     v4l2_buf.timestamp.tv_sec =
@@ -629,8 +885,8 @@ int32_t JetsonH264Encoder::Encode(
     v4l2_buf.timestamp.tv_usec =
         input_frame.timestamp_us() % rtc::kNumMicrosecsPerSec;
 
-    if (converter_->output_plane.qBuffer(v4l2_buf, nullptr) < 0) {
-      RTC_LOG(LS_ERROR) << "Failed to qBuffer at converter output_plane";
+    if (encoder_->output_plane.qBuffer(v4l2_buf, nullptr) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to qBuffer at encoder output_plane";
       return WEBRTC_VIDEO_CODEC_ERROR;
     }
   } else {
@@ -653,32 +909,83 @@ int32_t JetsonH264Encoder::Encode(
       v4l2_buf.index = encoder_->output_plane.getNumQueuedBuffers();
     }
 
-    rtc::scoped_refptr<const webrtc::I420BufferInterface> i420_buffer =
-        frame_buffer->ToI420();
-    for (uint32_t i = 0; i < buffer->n_planes; i++) {
-      const uint8_t* source_data;
-      int source_stride;
-      if (i == 0) {
-        source_data = i420_buffer->DataY();
-        source_stride = i420_buffer->StrideY();
-      } else if (i == 1) {
-        source_data = i420_buffer->DataU();
-        source_stride = i420_buffer->StrideU();
-      } else if (i == 2) {
-        source_data = i420_buffer->DataV();
-        source_stride = i420_buffer->StrideV();
+    rtc::scoped_refptr<const webrtc::I420BufferInterface> i420_buffer;
+    if (!use_nv12_) {
+      i420_buffer = frame_buffer->ToI420();
+    }
+    if (packed_input) {
+      // キャプチャバッファを 1 回読むだけで、エンコーダのプレーンに書き込む
+      NvBuffer::NvBufferPlane& y_plane = buffer->planes[0];
+      NvBuffer::NvBufferPlane& uv_plane = buffer->planes[1];
+      const int src_stride = native_buffer->raw_width() * 2;
+      if (native_buffer->VideoType() == webrtc::VideoType::kYUY2) {
+        libyuv::YUY2ToNV12(native_buffer->Data(), src_stride, y_plane.data,
+                           y_plane.fmt.stride, uv_plane.data,
+                           uv_plane.fmt.stride, frame_buffer->width(),
+                           frame_buffer->height());
       } else {
-        break;
+        libyuv::UYVYToNV12(native_buffer->Data(), src_stride, y_plane.data,
+                           y_plane.fmt.stride, uv_plane.data,
+                           uv_plane.fmt.stride, frame_buffer->width(),
+                           frame_buffer->height());
       }
-      NvBuffer::NvBufferPlane& plane = buffer->planes[i];
-      std::streamsize bytes_to_read = plane.fmt.bytesperpixel * plane.fmt.width;
-      uint8_t* input_data = plane.data;
-      plane.bytesused = 0;
-      for (uint32_t j = 0; j < plane.fmt.height; j++) {
-        memcpy(input_data, source_data + (source_stride * j), bytes_to_read);
-        input_data += plane.fmt.stride;
+      y_plane.bytesused = y_plane.fmt.stride * y_plane.fmt.height;
+      uv_plane.bytesused = uv_plane.fmt.stride * uv_plane.fmt.height;
+    } else {
+      for (uint32_t i = 0; i < buffer->n_planes; i++) {
+        const uint8_t* source_data;
+        int source_stride;
+        if (use_nv12_) {
+          // NV12M のプレーンにそのままコピーする
+          if (i == 0) {
+            source_data = native_buffer->DataY();
+            source_stride = native_buffer->StrideY();
+          } else if (i == 1) {
+            source_data = native_buffer->DataUV();
+            source_stride = native_buffer->StrideUV();
+          } else {
+            break;
+          }
+        } else if (i == 0) {
+          source_data = i420_buffer->DataY();
+          source_stride = i420_buffer->StrideY();
+        } else if (i == 1) {
+          source_data = i420_buffer->DataU();
+          source_stride = i420_buffer->StrideU();
+        } else if (i == 2) {
+          source_data = i420_buffer->DataV();
+          source_stride = i420_buffer->StrideV();
+        } else {
+          break;
+        }
+        NvBuffer::NvBufferPlane& plane = buffer->planes[i];
+        std::streamsize bytes_to_read =
+            plane.fmt.bytesperpixel * plane.fmt.width;
+        uint8_t* input_data = plane.data;
+        plane.bytesused = 0;
+        for (uint32_t j = 0; j < plane.fmt.height; j++) {
+          memcpy(input_data, source_data + (source_stride * j),
+                 bytes_to_read);
+          input_data += plane.fmt.stride;
+        }
+        plane.bytesused = plane.fmt.stride * plane.fmt.height;
       }
-      plane.bytesused = plane.fmt.stride * plane.fmt.height;
+    }
+    if (packed_input) {
+      SetRoiParams(&roi_map_, v4l2_buf.index, frame_buffer->width(),
+                   frame_buffer->height(), buffer->planes[0].data,
+                   buffer->planes[0].fmt.stride, frame_buffer->width(),
+                   frame_buffer->height());
+    } else if (use_nv12_) {
+      SetRoiParams(&roi_map_, v4l2_buf.index, frame_buffer->width(),
+                   frame_buffer->height(), native_buffer->DataY(),
+                   native_buffer->StrideY(), native_buffer->raw_width(),
+                   native_buffer->raw_height());
+    } else {
+      SetRoiParams(&roi_map_, v4l2_buf.index, frame_buffer->width(),
+                   frame_buffer->height(), i420_buffer->DataY(),
+                   i420_buffer->StrideY(), i420_buffer->width(),
+                   i420_buffer->height());
     }
 
     v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
@@ -704,61 +1011,92 @@ int32_t JetsonH264Encoder::Encode(
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
-int32_t JetsonH264Encoder::SendFrame(unsigned char* buffer, size_t size) {
-  encoded_image_.set_buffer(buffer, size);
-  encoded_image_.set_size(size);
-  encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameDelta;
-
-  uint8_t zero_count = 0;
-  size_t nal_start_idx = 0;
-  std::vector<nal_entry> nals;
-  for (size_t i = 0; i < size; i++) {
-    uint8_t data = buffer[i];
-    if ((i != 0) && (i == nal_start_idx)) {
-      if ((data & 0x1F) == 0x05) {
-        encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameKey;
-      }
-    }
-    if (data == 0x01 && zero_count >= 2) {
-      if (nal_start_idx != 0) {
-        nals.push_back(
-            {nal_start_idx, i - nal_start_idx + 1 - (zero_count == 2 ? 3 : 4)});
-      }
-      nal_start_idx = i + 1;
-    }
-    if (data == 0x00) {
-      zero_count++;
-    } else {
-      zero_count = 0;
-    }
+void JetsonH264Encoder::SetRoiParams(RoiMap* roi_map,
+                                     uint32_t index,
+                                     int width,
+                                     int height,
+                                     const uint8_t* y,
+                                     int stride_y,
+                                     int y_width,
+                                     int y_height) {
+  if (!roi_enabled_) {
+    return;
+  }
+  // 領域が無くなった場合も前のフレームの設定が残らないように毎回設定する
+  roi_map->Update(width, height, y, stride_y, y_width, y_height);
+  std::vector<RoiMap::Rect> rects = roi_map->ToRects(V4L2_MAX_ROI_REGIONS);
+
+  v4l2_enc_frame_ROI_params roi_params;
+  memset(&roi_params, 0, sizeof(roi_params));
+  roi_params.num_ROI_regions = rects.size();
+  for (size_t i = 0; i < rects.size(); i++) {
+    roi_params.ROI_params[i].ROIRect.left = rects[i].x;
+    roi_params.ROI_params[i].ROIRect.top = rects[i].y;
+    roi_params.ROI_params[i].ROIRect.width = rects[i].width;
+    roi_params.ROI_params[i].ROIRect.height = rects[i].height;
+    roi_params.ROI_params[i].QPdelta = rects[i].qp_delta;
   }
-  if (nal_start_idx != 0) {
-    nals.push_back({nal_start_idx, size - nal_start_idx});
+  roi_params.config_store = index;
+
+  v4l2_ctrl_videoenc_input_metadata metadata;
+  memset(&metadata, 0, sizeof(metadata));
+  metadata.flag = V4L2_ENC_INPUT_ROI_PARAM_FLAG;
+  metadata.VideoEncROIParams = &roi_params;
+  metadata.config_store = index;
+  if (encoder_->SetInputMetaParams(index, metadata) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to SetInputMetaParams";
   }
+}
 
-  webrtc::RTPFragmentationHeader frag_header;
-  frag_header.VerifyAndAllocateFragmentationHeader(nals.size());
-  for (size_t i = 0; i < nals.size(); i++) {
-    frag_header.fragmentationOffset[i] = nals[i].offset;
-    frag_header.fragmentationLength[i] = nals[i].size;
+int32_t JetsonH264Encoder::SendFrame(unsigned char* buffer,
+                                     size_t size,
+                                     int qp) {
+  if (codec_type_ == webrtc::kVideoCodecVP9) {
+    return SendVP9Frame(buffer, size);
   }
 
-  webrtc::CodecSpecificInfo codec_specific;
-  codec_specific.codecType = webrtc::kVideoCodecH264;
-  codec_specific.codecSpecific.H264.packetization_mode =
-      webrtc::H264PacketizationMode::NonInterleaved;
+  encoded_image_.set_buffer(buffer, size);
+  return SendH264Frame(buffer, size, qp);
+}
 
-  h264_bitstream_parser_.ParseBitstream(buffer, size);
-  h264_bitstream_parser_.GetLastSliceQp(&encoded_image_.qp_);
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " last slice qp:" << encoded_image_.qp_;
+int32_t JetsonH264Encoder::SendVP9Frame(unsigned char* buffer, size_t size) {
+  if (size == 0) {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  encoded_image_.set_buffer(buffer, size);
+  encoded_image_.set_size(size);
 
-  webrtc::EncodedImageCallback::Result result =
-      callback_->OnEncodedImage(encoded_image_, &codec_specific, &frag_header);
-  if (result.error != webrtc::EncodedImageCallback::Result::OK) {
-    RTC_LOG(LS_ERROR) << __FUNCTION__
-                      << " OnEncodedImage failed error:" << result.error;
-    return WEBRTC_VIDEO_CODEC_ERROR;
+  // uncompressed header の frame_type を見る (profile 0 なので先頭バイトの 2 bit 目)
+  bool is_key_frame = ((buffer[0] >> 2) & 0x01) == 0;
+  encoded_image_._frameType = is_key_frame
+                                  ? webrtc::VideoFrameType::kVideoFrameKey
+                                  : webrtc::VideoFrameType::kVideoFrameDelta;
+
+  webrtc::CodecSpecificInfo codec_specific;
+  codec_specific.codecType = webrtc::kVideoCodecVP9;
+  webrtc::CodecSpecificInfoVP9& vp9_info = codec_specific.codecSpecific.VP9;
+  vp9_info.first_frame_in_picture = true;
+  vp9_info.inter_pic_predicted = !is_key_frame;
+  vp9_info.flexible_mode = false;
+  vp9_info.ss_data_available = is_key_frame;
+  vp9_info.non_ref_for_inter_layer_pred = true;
+  vp9_info.temporal_idx = webrtc::kNoTemporalIdx;
+  vp9_info.temporal_up_switch = false;
+  vp9_info.inter_layer_predicted = false;
+  vp9_info.gof_idx = 0;
+  vp9_info.num_spatial_layers = 1;
+  vp9_info.first_active_layer = 0;
+  vp9_info.end_of_picture = true;
+  if (is_key_frame) {
+    vp9_info.spatial_layer_resolution_present = true;
+    vp9_info.width[0] = encoded_image_._encodedWidth;
+    vp9_info.height[0] = encoded_image_._encodedHeight;
+    vp9_info.gof.CopyGofInfoVP9(gof_);
+  } else {
+    vp9_info.spatial_layer_resolution_present = false;
   }
-  bitrate_adjuster_.Update(size);
-  return WEBRTC_VIDEO_CODEC_OK;
+
+  webrtc::vp9::GetQp(buffer, size, &encoded_image_.qp_);
+
+  return SendEncodedImage(codec_specific, nullptr);
 }
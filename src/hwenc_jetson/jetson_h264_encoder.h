@@ -14,26 +14,41 @@
 
 #include <linux/videodev2.h>
 
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <queue>
+#include <vector>
 
-#include "NvJpegDecoder.h"
 #include "NvVideoConverter.h"
 #include "NvVideoEncoder.h"
 #include "api/video_codecs/video_encoder.h"
-#include "common_video/h264/h264_bitstream_parser.h"
-#include "common_video/include/bitrate_adjuster.h"
 #include "modules/video_coding/codecs/h264/include/h264.h"
-#include "rtc_base/critical_section.h"
+#include "modules/video_coding/codecs/vp9/include/vp9_globals.h"
+#include "jetson_jpeg_decode_stage.h"
+#include "rtc/hw_video_encoder.h"
+#include "rtc/key_frame_throttle.h"
+#include "rtc/roi_map.h"
 
 class ProcessThread;
 
-class JetsonH264Encoder : public webrtc::VideoEncoder {
+// Jetson のハードウェアエンコーダ。
+// codec の名前に応じて H264 と VP9 (Xavier のみ) のどちらかでエンコードする。
+class JetsonH264Encoder : public HWVideoEncoder {
  public:
-  explicit JetsonH264Encoder(const cricket::VideoCodec& codec);
+  // low_latency_rate_control が true の場合、VBV のバッファを 1 フレーム分にして、
+  // 定期的な IDR の代わりにイントラリフレッシュを使う。LowLatencyRateControl を参照。
+  // key_frame_throttle でキーフレームの要求をまとめる。Jetson は要求された時だけ
+  // イントラリフレッシュすることができないので、intra_refresh の場合は常にイントラリフレッシュする
+  JetsonH264Encoder(const cricket::VideoCodec& codec,
+                    bool low_latency_rate_control = false,
+                    KeyFrameThrottle::Settings key_frame_throttle =
+                        KeyFrameThrottle::Settings());
   ~JetsonH264Encoder() override;
 
+  // このデバイスのエンコーダが VP9 に対応しているかどうか
+  static bool IsVP9Supported();
+
   int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
                      int32_t number_of_cores,
                      size_t max_payload_size) override;
@@ -47,35 +62,9 @@ class JetsonH264Encoder : public webrtc::VideoEncoder {
   webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
 
  private:
-  struct FrameParams {
-    FrameParams(int32_t w,
-                int32_t h,
-                int64_t rtms,
-                int64_t ntpms,
-                int64_t tsus,
-                int64_t rtpts,
-                webrtc::VideoRotation r,
-                absl::optional<webrtc::ColorSpace> c)
-        : width(w),
-          height(h),
-          render_time_ms(rtms),
-          ntp_time_ms(ntpms),
-          timestamp_us(tsus),
-          timestamp_rtp(rtpts),
-          rotation(r),
-          color_space(c) {}
-
-    int32_t width;
-    int32_t height;
-    int64_t render_time_ms;
-    int64_t ntp_time_ms;
-    int64_t timestamp_us;
-    int64_t timestamp_rtp;
-    webrtc::VideoRotation rotation;
-    absl::optional<webrtc::ColorSpace> color_space;
-  };
-
   int32_t JetsonConfigure();
+  // エンコーダのキャプチャプレーンを動かし、DQ スレッドを始めてバッファを積む
+  int32_t StartCapturePlane();
   void JetsonRelease();
   void SendEOS(NvV4l2Element* element);
   static bool ConvertFinishedCallbackFunction(struct v4l2_buffer* v4l2_buf,
@@ -101,18 +90,31 @@ class JetsonH264Encoder : public webrtc::VideoEncoder {
                               NvBuffer* shared_buffer);
   void SetFramerate(uint32_t framerate);
   void SetBitrateBps(uint32_t bitrate_bps);
-  int32_t SendFrame(unsigned char* buffer, size_t size);
+  // ROI が有効なら、output_plane の index 番目のバッファに ROI の矩形を設定する。
+  // y が nullptr の場合は指定された領域だけを使う
+  void SetRoiParams(RoiMap* roi_map,
+                    uint32_t index,
+                    int width,
+                    int height,
+                    const uint8_t* y,
+                    int stride_y,
+                    int y_width,
+                    int y_height);
+  // qp はエンコーダから取得した QP。負の場合はスライスヘッダから読む
+  int32_t SendFrame(unsigned char* buffer, size_t size, int qp);
+  int32_t SendVP9Frame(unsigned char* buffer, size_t size);
 
-  webrtc::EncodedImageCallback* callback_;
-  NvJPEGDecoder* decoder_;
+  const webrtc::VideoCodecType codec_type_;
+  const bool low_latency_rate_control_;
+  std::unique_ptr<JetsonJpegDecodeStage> jpeg_stage_;
   NvVideoConverter* converter_;
   NvVideoEncoder* encoder_;
-  webrtc::BitrateAdjuster bitrate_adjuster_;
   uint32_t framerate_;
   int32_t configured_framerate_;
-  uint32_t target_bitrate_bps_;
   uint32_t configured_bitrate_bps_;
   int key_frame_interval_;
+  // イントラリフレッシュを有効にしてエンコーダを設定した
+  bool intra_refresh_ = false;
   uint32_t decode_pixfmt_;
   uint32_t raw_width_;
   uint32_t raw_height_;
@@ -121,16 +123,32 @@ class JetsonH264Encoder : public webrtc::VideoEncoder {
   int32_t configured_width_;
   int32_t configured_height_;
   bool use_mjpeg_;
+  // NV12 のネイティブバッファを変換せずにエンコーダへ渡す
+  bool use_nv12_;
+  bool configured_nv12_;
+  // NvBuffer の fd を持つネイティブバッファを NvBufferTransform で変換して fd で渡す
+  bool use_dmabuf_;
+  bool configured_dmabuf_;
+  // use_dmabuf_ の場合に、エンコーダの output_plane に渡す NvBuffer
+  std::vector<int> dmabuf_fds_;
+  // MemoryAccounting に計上しているプレーンのバッファの大きさ
+  int64_t buffer_bytes_ = 0;
+  bool roi_enabled_ = false;
+  RoiMap roi_map_;
+  // MJPEG の場合は変換後のコールバックで設定するので、そのスレッド専用のものを使う
+  RoiMap convert_roi_map_;
 
-  webrtc::H264BitstreamParser h264_bitstream_parser_;
+  // VP9 の場合に RTP に載せる GOF の情報
+  webrtc::GofInfoVP9 gof_;
 
-  rtc::CriticalSection frame_params_lock_;
-  std::queue<std::unique_ptr<FrameParams>> frame_params_;
   std::mutex enc0_buffer_mtx_;
   std::condition_variable enc0_buffer_cond_;
   bool enc0_buffer_ready_ = false;
   std::queue<NvBuffer*>* enc0_buffer_queue_;
-  webrtc::EncodedImage encoded_image_;
+  // Release() が呼ばれてから次の InitEncode() までの間は、エンコード結果を捨てる
+  std::atomic<bool> released_{false};
+  // Release() で残しておいたエンコーダを使い続ける場合に、次のフレームを IDR にする
+  bool idr_needed_ = false;
 };
 
 #endif  // Jetson_H264_ENCODER_H_
@@ -0,0 +1,220 @@
+#include "jetson_jpeg_decode_stage.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "rtc/native_buffer.h"
+#include "rtc/thread_placement.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+JetsonJpegDecodeStage::JetsonJpegDecodeStage(int num_slots,
+                                             EncoderMetrics* metrics)
+    : metrics_(metrics) {
+  for (int i = 0; i < num_slots; i++) {
+    NvJPEGDecoder* decoder = NvJPEGDecoder::createJPEGDecoder(
+        ("jpegdec" + std::to_string(i)).c_str());
+    if (!decoder) {
+      RTC_LOG(LS_ERROR) << "Failed to createJPEGDecoder";
+      break;
+    }
+    decoders_.push_back(decoder);
+  }
+}
+
+JetsonJpegDecodeStage::~JetsonJpegDecodeStage() {
+  Stop();
+  for (NvJPEGDecoder* decoder : decoders_) {
+    delete decoder;
+  }
+}
+
+bool JetsonJpegDecodeStage::Probe(NativeBuffer* buffer,
+                                  uint32_t* pixfmt,
+                                  uint32_t* width,
+                                  uint32_t* height) {
+  if (decoders_.empty() || converter_) {
+    return false;
+  }
+  int fd = 0;
+  int64_t start_us = rtc::TimeMicros();
+  probed_buffer_ = nullptr;
+  if (decoders_[0]->decodeToFd(fd, (unsigned char*)buffer->Data(),
+                               buffer->length(), *pixfmt, *width,
+                               *height) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to decodeToFd";
+    return false;
+  }
+  metrics_->OnStage("jpeg_decode", rtc::TimeMicros() - start_us);
+  probed_buffer_ = buffer;
+  probed_fd_ = fd;
+  return true;
+}
+
+void JetsonJpegDecodeStage::Start(NvVideoConverter* converter) {
+  Stop();
+  converter_ = converter;
+  free_slots_.clear();
+  for (uint32_t i = 0; i < decoders_.size(); i++) {
+    free_slots_.push_back(i);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = false;
+  }
+  thread_.reset(new rtc::PlatformThread(JetsonJpegDecodeStage::DecodeThread,
+                                        this, "JetsonJpegDec",
+                                        rtc::kHighPriority));
+  thread_->Start();
+}
+
+void JetsonJpegDecodeStage::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+    jobs_.clear();
+    converting_.clear();
+    probed_buffer_ = nullptr;
+  }
+  cond_.notify_all();
+  thread_->Stop();
+  thread_.reset();
+  converter_ = nullptr;
+}
+
+bool JetsonJpegDecodeStage::Push(
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+    int64_t timestamp_us) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_ || jobs_.size() >= decoders_.size()) {
+      RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " Drop frame";
+      return false;
+    }
+    Job job;
+    job.probed = probed_buffer_ && static_cast<NativeBuffer*>(buffer.get()) ==
+                                       probed_buffer_.get();
+    // Probe() の結果を使えるのは、その直後に Push() されたフレームだけ
+    probed_buffer_ = nullptr;
+    job.buffer = std::move(buffer);
+    job.timestamp_us = timestamp_us;
+    job.pushed_us = rtc::TimeMicros();
+    jobs_.push_back(std::move(job));
+  }
+  cond_.notify_one();
+  return true;
+}
+
+void JetsonJpegDecodeStage::OnConverted(int64_t timestamp_us) {
+  int64_t queued_us = -1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!converting_.empty() && converting_.front().first <= timestamp_us) {
+      if (converting_.front().first == timestamp_us) {
+        queued_us = converting_.front().second;
+      }
+      converting_.pop_front();
+    }
+  }
+  if (queued_us >= 0) {
+    metrics_->OnStage("convert", rtc::TimeMicros() - queued_us);
+  }
+}
+
+void JetsonJpegDecodeStage::DecodeThread(void* obj) {
+  ThreadPlacement::Instance().Apply("encoder");
+  static_cast<JetsonJpegDecodeStage*>(obj)->DecodeLoop();
+}
+
+void JetsonJpegDecodeStage::DecodeLoop() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return quit_ || !jobs_.empty(); });
+      if (quit_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    DecodeAndQueue(job);
+  }
+}
+
+bool JetsonJpegDecodeStage::DecodeAndQueue(const Job& job) {
+  struct v4l2_buffer v4l2_buf;
+  struct v4l2_plane planes[MAX_PLANES];
+
+  // 全てのスロットを converter に渡している場合は、変換が終わったものを待つ
+  if (free_slots_.empty()) {
+    NvBuffer* buffer;
+    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+    memset(planes, 0, sizeof(planes));
+    v4l2_buf.m.planes = planes;
+    if (converter_->output_plane.dqBuffer(v4l2_buf, &buffer, NULL, 10) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to dqBuffer at converter output_plane";
+      return false;
+    }
+    free_slots_.push_back(v4l2_buf.index);
+  }
+  // Probe() でデコードしたフレームは、0 番のデコーダの出力をそのまま渡す
+  auto slot = free_slots_.end() - 1;
+  bool reuse_probed = false;
+  if (job.probed) {
+    auto it = std::find(free_slots_.begin(), free_slots_.end(), 0u);
+    if (it != free_slots_.end()) {
+      slot = it;
+      reuse_probed = true;
+    }
+  }
+  const uint32_t index = *slot;
+
+  const int64_t start_us = rtc::TimeMicros();
+  metrics_->OnStage("jpeg_queue", start_us - job.pushed_us);
+
+  int fd = reuse_probed ? probed_fd_ : 0;
+  if (!reuse_probed) {
+    NativeBuffer* native_buffer = static_cast<NativeBuffer*>(job.buffer.get());
+    uint32_t pixfmt;
+    uint32_t width;
+    uint32_t height;
+    if (decoders_[index]->decodeToFd(fd, (unsigned char*)native_buffer->Data(),
+                                     native_buffer->length(), pixfmt, width,
+                                     height) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to decodeToFd";
+      return false;
+    }
+  }
+  const int64_t decoded_us = rtc::TimeMicros();
+  if (!reuse_probed) {
+    metrics_->OnStage("jpeg_decode", decoded_us - start_us);
+  }
+
+  memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+  memset(planes, 0, sizeof(planes));
+  v4l2_buf.m.planes = planes;
+  v4l2_buf.index = index;
+  planes[0].m.fd = fd;
+  planes[0].bytesused = 1234;
+
+  v4l2_buf.flags |= V4L2_BUF_FLAG_TIMESTAMP_COPY;
+  v4l2_buf.timestamp.tv_sec = job.timestamp_us / rtc::kNumMicrosecsPerSec;
+  v4l2_buf.timestamp.tv_usec = job.timestamp_us % rtc::kNumMicrosecsPerSec;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    converting_.push_back(std::make_pair(job.timestamp_us, decoded_us));
+  }
+  if (converter_->output_plane.qBuffer(v4l2_buf, nullptr) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to qBuffer at converter output_plane";
+    return false;
+  }
+  free_slots_.erase(slot);
+  return true;
+}
@@ -0,0 +1,90 @@
+#ifndef JETSON_JPEG_DECODE_STAGE_H_
+#define JETSON_JPEG_DECODE_STAGE_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "NvJpegDecoder.h"
+#include "NvVideoConverter.h"
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame_buffer.h"
+#include "rtc/encoder_metrics.h"
+#include "rtc_base/platform_thread.h"
+
+class NativeBuffer;
+
+// JetsonH264Encoder で MJPEG を NvJPEGDecoder でデコードして、NvVideoConverter に渡す段。
+//
+// デコードは専用のスレッドで行うので、フレーム N+1 のデコードと
+// フレーム N の変換やエンコードが重なり、Encode() はデコードを待たない。
+// NvJPEGDecoder は自分の持つ 1 枚のバッファにデコードするので、スロットの数だけデコーダを作り、
+// converter の output_plane の index 番目のバッファには index 番目のデコーダの出力を渡す。
+//
+// デコード待ち、デコード、変換にかかった時間は EncoderMetrics::OnStage() に記録する。
+class JetsonJpegDecodeStage {
+ public:
+  JetsonJpegDecodeStage(int num_slots, EncoderMetrics* metrics);
+  ~JetsonJpegDecodeStage();
+
+  // converter の output_plane は num_slots() 個の V4L2_MEMORY_DMABUF で設定すること
+  int num_slots() const { return (int)decoders_.size(); }
+
+  // Start() する前に JPEG を 1 枚デコードして、converter の設定に必要な形式と大きさを調べる。
+  // 次に同じ buffer を Push() した場合は、デコードし直さずにこの結果を使う
+  bool Probe(NativeBuffer* buffer,
+             uint32_t* pixfmt,
+             uint32_t* width,
+             uint32_t* height);
+
+  // デコードしたフレームを converter に渡し始める
+  void Start(NvVideoConverter* converter);
+  // デコード待ちのフレームを捨ててスレッドを止める。converter を破棄する前に呼ぶこと
+  void Stop();
+
+  // デコード待ちのフレームが溢れた場合は false を返す。
+  // buffer はデコードが終わるまで参照を持っておく
+  bool Push(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+            int64_t timestamp_us);
+  // converter の capture_plane から timestamp_us のフレームが出てきた
+  void OnConverted(int64_t timestamp_us);
+
+ private:
+  struct Job {
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+    int64_t timestamp_us;
+    int64_t pushed_us;
+    // Probe() でデコードしたフレーム
+    bool probed;
+  };
+
+  static void DecodeThread(void* obj);
+  void DecodeLoop();
+  bool DecodeAndQueue(const Job& job);
+
+  EncoderMetrics* const metrics_;
+  std::vector<NvJPEGDecoder*> decoders_;
+  NvVideoConverter* converter_ = nullptr;
+  // Probe() でデコードしたフレームと、その出力の fd。
+  // 出力は 0 番のデコーダのバッファに残っているので、0 番のスロットで converter に渡す
+  rtc::scoped_refptr<NativeBuffer> probed_buffer_;
+  int probed_fd_ = -1;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool quit_ = false;
+  std::deque<Job> jobs_;
+  // converter に渡していないスロット。デコードスレッドだけが触る
+  std::vector<uint32_t> free_slots_;
+  // converter に渡した時刻。converter に渡した順番に並んでいる
+  std::deque<std::pair<int64_t, int64_t>> converting_;
+
+  std::unique_ptr<rtc::PlatformThread> thread_;
+};
+
+#endif  // JETSON_JPEG_DECODE_STAGE_H_
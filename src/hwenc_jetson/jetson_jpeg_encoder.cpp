@@ -0,0 +1,123 @@
+#include "jetson_jpeg_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvbuf_utils.h"
+#include "rtc/native_buffer.h"
+#include "rtc_base/logging.h"
+
+std::unique_ptr<JetsonJpegEncoder> JetsonJpegEncoder::Create() {
+  NvJPEGEncoder* encoder = NvJPEGEncoder::createJPEGEncoder("jpegenc");
+  if (encoder == nullptr) {
+    RTC_LOG(LS_ERROR) << "Failed to createJPEGEncoder";
+    return nullptr;
+  }
+  return std::unique_ptr<JetsonJpegEncoder>(new JetsonJpegEncoder(encoder));
+}
+
+JetsonJpegEncoder::JetsonJpegEncoder(NvJPEGEncoder* encoder)
+    : encoder_(encoder) {}
+
+JetsonJpegEncoder::~JetsonJpegEncoder() {
+  if (fd_ != -1) {
+    NvBufferDestroy(fd_);
+  }
+  delete encoder_;
+}
+
+bool JetsonJpegEncoder::Encode(
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+    int quality,
+    std::string* jpeg) {
+  if (!PrepareBuffer(buffer->width(), buffer->height())) {
+    return false;
+  }
+
+  NativeBuffer* native_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(buffer.get())
+          : nullptr;
+  if (native_buffer && native_buffer->dmabuf_fd() >= 0) {
+    NvBufferTransformParams transform_params;
+    memset(&transform_params, 0, sizeof(transform_params));
+    transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    transform_params.transform_filter = NvBufferTransform_Filter_Smart;
+    if (NvBufferTransform(native_buffer->dmabuf_fd(), fd_,
+                          &transform_params) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to NvBufferTransform";
+      return false;
+    }
+  } else {
+    rtc::scoped_refptr<webrtc::I420BufferInterface> i420 = buffer->ToI420();
+    if (!i420 || !CopyFromI420(*i420)) {
+      return false;
+    }
+  }
+
+  // 足りない場合は libjpeg が malloc で確保し直す
+  unsigned long size = static_cast<unsigned long>(width_) * height_ * 3 / 2;
+  std::unique_ptr<unsigned char[]> out(new unsigned char[size]);
+  unsigned char* data = out.get();
+  if (encoder_->encodeFromFd(fd_, JCS_YCbCr, &data, size, quality) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to encodeFromFd";
+    return false;
+  }
+  jpeg->assign(reinterpret_cast<const char*>(data), size);
+  if (data != out.get()) {
+    free(data);
+  }
+  return true;
+}
+
+bool JetsonJpegEncoder::PrepareBuffer(int width, int height) {
+  if (fd_ != -1 && width_ == width && height_ == height) {
+    return true;
+  }
+  if (fd_ != -1) {
+    NvBufferDestroy(fd_);
+    fd_ = -1;
+  }
+  NvBufferCreateParams params;
+  memset(&params, 0, sizeof(params));
+  params.width = width;
+  params.height = height;
+  params.layout = NvBufferLayout_Pitch;
+  params.colorFormat = NvBufferColorFormat_YUV420;
+  params.payloadType = NvBufferPayload_SurfArray;
+  params.nvbuf_tag = NvBufferTag_JPEG;
+  if (NvBufferCreateEx(&fd_, &params) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to NvBufferCreateEx";
+    fd_ = -1;
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  return true;
+}
+
+bool JetsonJpegEncoder::CopyFromI420(const webrtc::I420BufferInterface& i420) {
+  NvBufferParams params;
+  if (NvBufferGetParams(fd_, &params) == -1) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to NvBufferGetParams";
+    return false;
+  }
+  for (uint32_t i = 0; i < 3; i++) {
+    const uint8_t* src_data =
+        i == 0 ? i420.DataY() : i == 1 ? i420.DataU() : i420.DataV();
+    const int src_stride =
+        i == 0 ? i420.StrideY() : i == 1 ? i420.StrideU() : i420.StrideV();
+    void* dst_data;
+    if (NvBufferMemMap(fd_, i, NvBufferMem_Write, &dst_data) == -1) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to NvBufferMemMap";
+      return false;
+    }
+    for (uint32_t j = 0; j < params.height[i]; j++) {
+      memcpy(static_cast<uint8_t*>(dst_data) + j * params.pitch[i],
+             src_data + j * src_stride, params.width[i]);
+    }
+    NvBufferMemSyncForDevice(fd_, i, &dst_data);
+    NvBufferMemUnMap(fd_, i, &dst_data);
+  }
+  return true;
+}
@@ -0,0 +1,37 @@
+#ifndef JETSON_JPEG_ENCODER_H_
+#define JETSON_JPEG_ENCODER_H_
+
+#include <memory>
+#include <string>
+
+#include "NvJpegEncoder.h"
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame_buffer.h"
+
+// NvJPEGEncoder でフレームを JPEG にするクラス。
+//
+// DMABUF の NativeBuffer は VIC で YUV420 の NvBuffer に変換 (縮小も同時に行う) するので、
+// CPU でのコピーは発生しない。それ以外のフレームは I420 にしてから NvBuffer にコピーする。
+// 変換先の NvBuffer はフレームの大きさが変わるまで使い回す。スレッドセーフではない。
+class JetsonJpegEncoder {
+ public:
+  // NvJPEGEncoder を作れなかった場合は nullptr を返す
+  static std::unique_ptr<JetsonJpegEncoder> Create();
+  ~JetsonJpegEncoder();
+
+  bool Encode(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+              int quality,
+              std::string* jpeg);
+
+ private:
+  explicit JetsonJpegEncoder(NvJPEGEncoder* encoder);
+  bool PrepareBuffer(int width, int height);
+  bool CopyFromI420(const webrtc::I420BufferInterface& i420);
+
+  NvJPEGEncoder* const encoder_;
+  int fd_ = -1;
+  int width_ = 0;
+  int height_ = 0;
+};
+
+#endif  // JETSON_JPEG_ENCODER_H_
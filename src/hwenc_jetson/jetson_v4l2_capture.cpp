@@ -0,0 +1,213 @@
+#include "jetson_v4l2_capture.h"
+
+#include <errno.h>
+#include <linux/videodev2.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "modules/video_capture/video_capture_factory.h"
+#include "nvbuf_utils.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+
+rtc::scoped_refptr<V4L2VideoCapture> JetsonV4L2Capture::Create(
+    ConnectionSettings cs) {
+  rtc::scoped_refptr<V4L2VideoCapture> capturer;
+  if (!cs.video_device_cache.empty()) {
+    // デバイスの列挙には時間がかかるので、前回使ったデバイスを先に試す
+    capturer = new rtc::RefCountedObject<JetsonV4L2Capture>();
+    if (capturer->InitFromCache(cs) && capturer->StartCapture(cs) == 0) {
+      RTC_LOG(LS_INFO) << "Get Capture from cache";
+      if (cs.on_demand_capture || cs.low_power_idle) {
+        capturer->EnableOnDemand(cs.on_demand_linger_ms, cs.low_power_idle);
+      }
+      return capturer;
+    }
+    capturer = nullptr;
+  }
+  std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> device_info(
+      webrtc::VideoCaptureFactory::CreateDeviceInfo());
+  if (!device_info) {
+    RTC_LOG(LS_ERROR) << "Failed to CreateDeviceInfo";
+    return nullptr;
+  }
+
+  LogDeviceList(device_info.get());
+
+  for (int i = 0; i < device_info->NumberOfDevices(); ++i) {
+    capturer = Create(device_info.get(), cs, i);
+    if (capturer) {
+      RTC_LOG(LS_INFO) << "Get Capture";
+      if (cs.on_demand_capture || cs.low_power_idle) {
+        capturer->EnableOnDemand(cs.on_demand_linger_ms, cs.low_power_idle);
+      }
+      return capturer;
+    }
+  }
+  RTC_LOG(LS_ERROR) << "Failed to create JetsonV4L2Capture";
+  return nullptr;
+}
+
+rtc::scoped_refptr<V4L2VideoCapture> JetsonV4L2Capture::Create(
+    webrtc::VideoCaptureModule::DeviceInfo* device_info,
+    ConnectionSettings cs,
+    size_t capture_device_index) {
+  char device_name[256];
+  char unique_name[256];
+  if (device_info->GetDeviceName(static_cast<uint32_t>(capture_device_index),
+                                 device_name, sizeof(device_name), unique_name,
+                                 sizeof(unique_name)) != 0) {
+    RTC_LOG(LS_WARNING) << "Failed to GetDeviceName";
+    return nullptr;
+  }
+  rtc::scoped_refptr<V4L2VideoCapture> v4l2_capturer(
+      new rtc::RefCountedObject<JetsonV4L2Capture>());
+  if (v4l2_capturer->Init((const char*)&unique_name, cs.video_device) < 0) {
+    RTC_LOG(LS_WARNING) << "Failed to create JetsonV4L2Capture(" << unique_name
+                        << ")";
+    return nullptr;
+  }
+  if (v4l2_capturer->StartCapture(cs) < 0) {
+    auto size = cs.getSize();
+    RTC_LOG(LS_WARNING) << "Failed to start JetsonV4L2Capture(w = "
+                        << size.width << ", h = " << size.height
+                        << ", fps = " << cs.framerate << ")";
+    return nullptr;
+  }
+  return v4l2_capturer;
+}
+
+JetsonV4L2Capture::JetsonV4L2Capture() {}
+
+JetsonV4L2Capture::~JetsonV4L2Capture() {}
+
+bool JetsonV4L2Capture::useNativeBuffer() {
+  // NvBuffer にキャプチャしている場合は、形式に関わらず fd ごと渡す
+  // mmap したキャプチャバッファを参照で渡す場合も、形式に関わらずそのまま渡す
+  if (_dmabufPool && (_memoryType == V4L2_MEMORY_DMABUF || _passMapped)) {
+    return true;
+  }
+  return V4L2VideoCapture::useNativeBuffer();
+}
+
+bool JetsonV4L2Capture::CanPassDmabuf(webrtc::VideoType video_type) {
+  // YUYV と UYVY は NvBuffer にキャプチャできた場合だけ fd を渡す (AllocateVideoBuffers() を参照)。
+  // MJPEG は EXPBUF したドライバのバッファを渡し、JetsonH264Encoder が NvJPEGDecoder でデコードする
+  return video_type == webrtc::VideoType::kYUY2 ||
+         video_type == webrtc::VideoType::kUYVY ||
+         video_type == webrtc::VideoType::kMJPEG;
+}
+
+bool JetsonV4L2Capture::CanPassMappedBuffer(webrtc::VideoType video_type) {
+  return video_type == webrtc::VideoType::kYUY2 ||
+         video_type == webrtc::VideoType::kUYVY;
+}
+
+bool JetsonV4L2Capture::AllocateVideoBuffers() {
+  if (_useDmabuf && (_captureVideoType == webrtc::VideoType::kYUY2 ||
+                     _captureVideoType == webrtc::VideoType::kUYVY)) {
+    if (AllocateNvBuffers()) {
+      return true;
+    }
+    RTC_LOG(LS_WARNING) << "Failed to capture into NvBuffer. "
+                           "Fallback to V4L2_MEMORY_MMAP";
+    // EXPBUF したドライバのバッファは NvBuffer ではないので NvBufferTransform に渡せない。
+    // dmabuf は使わずに、mmap したバッファを参照で渡すかコピーする
+    _useDmabuf = false;
+  }
+  return V4L2VideoCapture::AllocateVideoBuffers();
+}
+
+bool JetsonV4L2Capture::AllocateNvBuffers() {
+  struct v4l2_requestbuffers rbuffer;
+  memset(&rbuffer, 0, sizeof(v4l2_requestbuffers));
+  rbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  rbuffer.memory = V4L2_MEMORY_DMABUF;
+  rbuffer.count = _buffersRequested;
+  if (ioctl(_deviceFd, VIDIOC_REQBUFS, &rbuffer) < 0) {
+    RTC_LOG(LS_INFO) << "V4L2_MEMORY_DMABUF is not supported. errno = "
+                     << errno;
+    return false;
+  }
+  if (rbuffer.count > static_cast<uint32_t>(_buffersRequested))
+    rbuffer.count = _buffersRequested;
+
+  NvBufferCreateParams params;
+  memset(&params, 0, sizeof(params));
+  params.width = _currentWidth;
+  params.height = _currentHeight;
+  params.layout = NvBufferLayout_Pitch;
+  params.colorFormat = _captureVideoType == webrtc::VideoType::kYUY2
+                           ? NvBufferColorFormat_YUYV
+                           : NvBufferColorFormat_UYVY;
+  params.payloadType = NvBufferPayload_SurfArray;
+  params.nvbuf_tag = NvBufferTag_CAMERA;
+
+  rtc::scoped_refptr<V4L2DmabufPool> pool = V4L2DmabufPool::Create(_deviceFd);
+  _pool = new Buffer[rbuffer.count];
+  _buffersAllocatedByDevice = 0;
+  for (unsigned int i = 0; i < rbuffer.count; i++) {
+    int fd = -1;
+    if (NvBufferCreateEx(&fd, &params) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to NvBufferCreateEx";
+      break;
+    }
+    NvBufferParams buffer_params;
+    void* start = nullptr;
+    if (NvBufferGetParams(fd, &buffer_params) < 0 ||
+        NvBufferMemMap(fd, 0, NvBufferMem_Read_Write, &start) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to map NvBuffer";
+      NvBufferDestroy(fd);
+      break;
+    }
+    size_t length = buffer_params.psize[0];
+    // ドライバは詰めて書き込むので、NvBuffer 側に行の余白があると使えない
+    if (buffer_params.pitch[0] != static_cast<uint32_t>(_currentWidth * 2)) {
+      RTC_LOG(LS_WARNING) << "NvBuffer pitch mismatch: "
+                          << buffer_params.pitch[0];
+      NvBufferMemUnMap(fd, 0, &start);
+      NvBufferDestroy(fd);
+      break;
+    }
+    // プールが破棄されるまで NvBuffer は解放しない
+    pool->Import(i, fd, start, length, [fd, start]() mutable {
+      NvBufferMemUnMap(fd, 0, &start);
+      NvBufferDestroy(fd);
+    });
+    _pool[i].start = start;
+    _pool[i].length = length;
+
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(v4l2_buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_DMABUF;
+    buffer.index = i;
+    buffer.m.fd = fd;
+    buffer.length = length;
+    if (ioctl(_deviceFd, VIDIOC_QBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to VIDIOC_QBUF. errno = " << errno;
+      break;
+    }
+    _buffersAllocatedByDevice = i + 1;
+  }
+
+  if (_buffersAllocatedByDevice != static_cast<int32_t>(rbuffer.count)) {
+    // 確保できた分はプールの破棄時に解放される
+    pool->Stop();
+    delete[] _pool;
+    _pool = nullptr;
+    _buffersAllocatedByDevice = -1;
+    memset(&rbuffer, 0, sizeof(v4l2_requestbuffers));
+    rbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    rbuffer.memory = V4L2_MEMORY_DMABUF;
+    rbuffer.count = 0;
+    ioctl(_deviceFd, VIDIOC_REQBUFS, &rbuffer);
+    return false;
+  }
+
+  RTC_LOG(LS_INFO) << "Allocated " << rbuffer.count
+                   << " NvBuffers for capture";
+  _dmabufPool = pool;
+  _memoryType = V4L2_MEMORY_DMABUF;
+  return true;
+}
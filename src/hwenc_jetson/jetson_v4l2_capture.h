@@ -0,0 +1,39 @@
+#ifndef JETSON_V4L2_CAPTURE_H_
+#define JETSON_V4L2_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "v4l2_video_capturer/v4l2_video_capturer.h"
+
+// キャプチャバッファを NvBuffer で確保して V4L2_MEMORY_DMABUF でキャプチャするクラス。
+//
+// キャプチャしたフレームは NvBuffer の fd ごと JetsonH264Encoder に渡され、
+// NvBufferTransform で変換・縮小してからエンコーダに fd で queue される。
+// そのため CPU でのコピーが一度も発生しない。
+//
+// NvBuffer にそのままキャプチャできるのは YUYV と UYVY のみなので、
+// それ以外の形式の場合は V4L2VideoCapture と同じ動作になる。
+// --use-dmabuf を指定しない場合も、YUYV と UYVY は mmap したキャプチャバッファを参照で渡し、
+// JetsonH264Encoder がエンコーダの NV12M のプレーンに直接変換する。
+class JetsonV4L2Capture : public V4L2VideoCapture {
+ public:
+  static rtc::scoped_refptr<V4L2VideoCapture> Create(ConnectionSettings cs);
+  JetsonV4L2Capture();
+  ~JetsonV4L2Capture();
+
+  bool useNativeBuffer() override;
+
+ private:
+  static rtc::scoped_refptr<V4L2VideoCapture> Create(
+      webrtc::VideoCaptureModule::DeviceInfo* device_info,
+      ConnectionSettings cs,
+      size_t capture_device_index);
+
+  bool AllocateVideoBuffers() override;
+  bool CanPassDmabuf(webrtc::VideoType video_type) override;
+  bool CanPassMappedBuffer(webrtc::VideoType video_type) override;
+  bool AllocateNvBuffers();
+};
+
+#endif  // JETSON_V4L2_CAPTURE_H_
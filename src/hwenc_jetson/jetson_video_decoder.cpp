@@ -15,11 +15,10 @@
 
 #include "modules/video_coding/include/video_error_codes.h"
 #include "nvbuf_utils.h"
+#include "rtc/thread_placement.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/time_utils.h"
-#include "system_wrappers/include/metrics.h"
-#include "third_party/libyuv/include/libyuv/convert.h"
 
 #define INIT_ERROR(cond, desc)                 \
   if (cond) {                                  \
@@ -28,15 +27,15 @@
     return WEBRTC_VIDEO_CODEC_ERROR;           \
   }
 #define CHUNK_SIZE 4000000
+// 表示や再エンコードで保持される分も含めたデコード結果のバッファ数
+#define DST_BUFFER_NUM 10
 
 JetsonVideoDecoder::JetsonVideoDecoder(uint32_t input_format)
     : input_format_(input_format),
       decoder_(nullptr),
       decode_complete_callback_(nullptr),
-      buffer_pool_(false, 300 /* max_number_of_buffers*/),
       eos_(false),
-      got_error_(false),
-      dst_dma_fd_(-1) {}
+      got_error_(false) {}
 
 JetsonVideoDecoder::~JetsonVideoDecoder() {
   Release();
@@ -105,8 +104,9 @@ int32_t JetsonVideoDecoder::Decode(const webrtc::EncodedImage& input_image,
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " timestamp:" << input_image.Timestamp()
-                   << " bytesused:" << buffer->planes[0].bytesused;
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__
+                      << " timestamp:" << input_image.Timestamp()
+                      << " bytesused:" << buffer->planes[0].bytesused;
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
@@ -118,7 +118,6 @@ int32_t JetsonVideoDecoder::RegisterDecodeCompleteCallback(
 
 int32_t JetsonVideoDecoder::Release() {
   JetsonRelease();
-  buffer_pool_.Release();
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
@@ -194,10 +193,8 @@ bool JetsonVideoDecoder::JetsonRelease() {
     delete decoder_;
     decoder_ = nullptr;
   }
-  if (dst_dma_fd_ != -1) {
-    NvBufferDestroy(dst_dma_fd_);
-    dst_dma_fd_ = -1;
-  }
+  // 外部で保持されているバッファがあれば、それが解放されたときに破棄される
+  dst_pool_ = nullptr;
   return true;
 }
 
@@ -225,6 +222,7 @@ void JetsonVideoDecoder::SendEOS(NvV4l2Element* element) {
 }
 
 void JetsonVideoDecoder::CaptureLoopFunction(void* obj) {
+  ThreadPlacement::Instance().Apply("decoder");
   JetsonVideoDecoder* _this = static_cast<JetsonVideoDecoder*>(obj);
   _this->CaptureLoop();
 }
@@ -284,77 +282,44 @@ void JetsonVideoDecoder::CaptureLoop() {
       uint64_t pts = v4l2_buf.timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
                      v4l2_buf.timestamp.tv_usec;
 
-      NvBufferRect src_rect, dest_rect;
-      src_rect.top = 0;
-      src_rect.left = 0;
-      src_rect.width = buffer->planes[0].fmt.width;
-      src_rect.height = buffer->planes[0].fmt.height;
-      dest_rect.top = 0;
-      dest_rect.left = 0;
-      dest_rect.width = buffer->planes[0].fmt.width;
-      dest_rect.height = buffer->planes[0].fmt.height;
-
-      NvBufferTransformParams transform_params;
-      memset(&transform_params, 0, sizeof(transform_params));
-      transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
-      transform_params.transform_flip = NvBufferTransform_None;
-      transform_params.transform_filter = NvBufferTransform_Filter_Smart;
-      transform_params.src_rect = src_rect;
-      transform_params.dst_rect = dest_rect;
-      ret = NvBufferTransform(buffer->planes[0].fd, dst_dma_fd_,
-                              &transform_params);
-      if (ret == -1) {
-        RTC_LOG(LS_ERROR) << __FUNCTION__ << " Transform failed";
-        break;
-      }
-
-      rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-          buffer_pool_.CreateBuffer(buffer->planes[0].fmt.width,
-                                    buffer->planes[0].fmt.height);
-      if (!i420_buffer.get()) {
-        // Pool has too many pending frames.
-        RTC_HISTOGRAM_BOOLEAN(
-            "WebRTC.Video.LibvpxVp8Decoder.TooManyPendingFrames", 1);
-        got_error_ = true;
-        break;
-      }
-
-      NvBufferParams parm;
-      ret = NvBufferGetParams(dst_dma_fd_, &parm);
-
-      void* src_data;
-      uint8_t* dst_data;
-      int dst_stride;
-      for (uint32_t i = 0; i < MAX_PLANES; i++) {
-        if (i == 0) {
-          dst_data = i420_buffer->MutableDataY();
-          dst_stride = i420_buffer->StrideY();
-        } else if (i == 1) {
-          dst_data = i420_buffer->MutableDataU();
-          dst_stride = i420_buffer->StrideU();
-        } else if (i == 2) {
-          dst_data = i420_buffer->MutableDataV();
-          dst_stride = i420_buffer->StrideV();
+      // CPU にはコピーせず、NvBuffer のままデコード結果として渡す
+      rtc::scoped_refptr<JetsonBuffer> dst_buffer = dst_pool_->CreateBuffer();
+      if (!dst_buffer) {
+        RTC_LOG(LS_WARNING) << __FUNCTION__
+                            << " All NvBuffers are in use, dropping frame";
+      } else {
+        NvBufferRect src_rect, dest_rect;
+        src_rect.top = 0;
+        src_rect.left = 0;
+        src_rect.width = buffer->planes[0].fmt.width;
+        src_rect.height = buffer->planes[0].fmt.height;
+        dest_rect.top = 0;
+        dest_rect.left = 0;
+        dest_rect.width = buffer->planes[0].fmt.width;
+        dest_rect.height = buffer->planes[0].fmt.height;
+
+        NvBufferTransformParams transform_params;
+        memset(&transform_params, 0, sizeof(transform_params));
+        transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+        transform_params.transform_flip = NvBufferTransform_None;
+        transform_params.transform_filter = NvBufferTransform_Filter_Smart;
+        transform_params.src_rect = src_rect;
+        transform_params.dst_rect = dest_rect;
+        ret = NvBufferTransform(buffer->planes[0].fd, dst_buffer->dmabuf_fd(),
+                                &transform_params);
+        if (ret == -1) {
+          RTC_LOG(LS_ERROR) << __FUNCTION__ << " Transform failed";
         } else {
-          break;
+          webrtc::VideoFrame decoded_image =
+              webrtc::VideoFrame::Builder()
+                  .set_video_frame_buffer(dst_buffer)
+                  .set_timestamp_rtp(pts)
+                  .build();
+          decode_complete_callback_->Decoded(decoded_image, absl::nullopt,
+                                             absl::nullopt);
         }
-        ret = NvBufferMemMap(dst_dma_fd_, i, NvBufferMem_Read, &src_data);
-        NvBufferMemSyncForCpu(dst_dma_fd_, i, &src_data);
-        for (uint32_t j = 0; j < parm.height[i]; j++) {
-          memcpy(dst_data + j * dst_stride, (char*)src_data + j * parm.pitch[i],
-                 parm.width[i]);
-        }
-        NvBufferMemUnMap(dst_dma_fd_, i, &src_data);
       }
 
-      webrtc::VideoFrame decoded_image =
-          webrtc::VideoFrame::Builder()
-              .set_video_frame_buffer(i420_buffer)
-              .set_timestamp_rtp(pts)
-              .build();
-      decode_complete_callback_->Decoded(decoded_image, absl::nullopt,
-                                         absl::nullopt);
-
       if (decoder_->capture_plane.qBuffer(v4l2_buf, NULL) < 0) {
         RTC_LOG(LS_ERROR) << __FUNCTION__
                           << "Failed to qBuffer at capture_plane";
@@ -380,21 +345,9 @@ int JetsonVideoDecoder::SetCapture() {
                    << " " << format.fmt.pix_mp.width << "x"
                    << format.fmt.pix_mp.height;
 
-  if (dst_dma_fd_ != -1) {
-    NvBufferDestroy(dst_dma_fd_);
-    dst_dma_fd_ = -1;
-  }
-
-  NvBufferCreateParams input_params = {0};
-  input_params.payloadType = NvBufferPayload_SurfArray;
-  input_params.width = crop.c.width;
-  input_params.height = crop.c.height;
-  input_params.layout = NvBufferLayout_Pitch;
-  input_params.colorFormat = NvBufferColorFormat_YUV420;
-  input_params.nvbuf_tag = NvBufferTag_VIDEO_DEC;
-
-  ret = NvBufferCreateEx(&dst_dma_fd_, &input_params);
-  INIT_ERROR(ret == -1, "create dmabuf failed");
+  dst_pool_ =
+      JetsonBufferPool::Create(crop.c.width, crop.c.height, DST_BUFFER_NUM);
+  INIT_ERROR(!dst_pool_, "create dmabuf failed");
 
   decoder_->capture_plane.deinitPlane();
 
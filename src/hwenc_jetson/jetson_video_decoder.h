@@ -14,7 +14,7 @@
 
 #include "NvVideoDecoder.h"
 #include "api/video_codecs/video_decoder.h"
-#include "common_video/include/i420_buffer_pool.h"
+#include "jetson_buffer.h"
 #include "rtc_base/platform_thread.h"
 
 class JetsonVideoDecoder : public webrtc::VideoDecoder {
@@ -52,11 +52,11 @@ class JetsonVideoDecoder : public webrtc::VideoDecoder {
   uint32_t input_format_;
   NvVideoDecoder* decoder_;
   webrtc::DecodedImageCallback* decode_complete_callback_;
-  webrtc::I420BufferPool buffer_pool_;
   std::unique_ptr<rtc::PlatformThread> capture_loop_;
   std::atomic<bool> eos_;
   std::atomic<bool> got_error_;
-  int dst_dma_fd_;
+  // デコード結果を NvBufferTransform で書き出す先
+  rtc::scoped_refptr<JetsonBufferPool> dst_pool_;
 };
 
 #endif  // Jetson_VIDEO_ENCODER_H_
\ No newline at end of file
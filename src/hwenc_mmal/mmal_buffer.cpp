@@ -4,10 +4,36 @@
 #include "rtc_base/checks.h"
 #include "third_party/libyuv/include/libyuv.h"
 
+rtc::scoped_refptr<MMALPool> MMALPool::Create(unsigned int num,
+                                              uint32_t size) {
+  return new rtc::RefCountedObject<MMALPool>(num, size);
+}
+
+MMAL_POOL_T* MMALPool::get() const {
+  return pool_;
+}
+
+MMALPool::MMALPool(unsigned int num, uint32_t size)
+    : pool_(mmal_pool_create(num, size)) {}
+
+MMALPool::~MMALPool() {
+  if (pool_ != nullptr) {
+    mmal_pool_destroy(pool_);
+  }
+}
+
 rtc::scoped_refptr<MMALBuffer> MMALBuffer::Create(MMAL_BUFFER_HEADER_T* buffer,
                                                   int width,
                                                   int height) {
-  return new rtc::RefCountedObject<MMALBuffer>(buffer, width, height);
+  return Create(buffer, width, height, nullptr);
+}
+
+rtc::scoped_refptr<MMALBuffer> MMALBuffer::Create(
+    MMAL_BUFFER_HEADER_T* buffer,
+    int width,
+    int height,
+    rtc::scoped_refptr<MMALPool> pool) {
+  return new rtc::RefCountedObject<MMALBuffer>(buffer, width, height, pool);
 }
 
 webrtc::VideoFrameBuffer::Type MMALBuffer::type() const {
@@ -51,9 +77,13 @@ const size_t MMALBuffer::length() const {
   return buffer_->length;
 }
 
-MMALBuffer::MMALBuffer(MMAL_BUFFER_HEADER_T* buffer, int width, int height)
-    : buffer_(buffer), width_(width), height_(height) {}
+MMALBuffer::MMALBuffer(MMAL_BUFFER_HEADER_T* buffer,
+                       int width,
+                       int height,
+                       rtc::scoped_refptr<MMALPool> pool)
+    : buffer_(buffer), pool_(pool), width_(width), height_(height) {}
 
 MMALBuffer::~MMALBuffer() {
+  // pool_ より先にバッファを返却する
   mmal_buffer_header_release((MMAL_BUFFER_HEADER_T*)buffer_);
 }
\ No newline at end of file
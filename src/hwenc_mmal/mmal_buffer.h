@@ -1,5 +1,5 @@
-#ifndef NATIVE_BUFFER_H_
-#define NATIVE_BUFFER_H_
+#ifndef MMAL_BUFFER_H_
+#define MMAL_BUFFER_H_
 
 extern "C" {
 #include "interface/mmal/mmal.h"
@@ -8,12 +8,36 @@ extern "C" {
 #include "api/video/video_frame.h"
 #include "common_video/include/video_frame_buffer.h"
 #include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "rtc_base/ref_count.h"
+
+// mmal_pool_create で作ったプールを、参照が全て無くなるまで破棄しないためのクラス。
+// デコーダやキャプチャを破棄した後も、MMALBuffer が残っている間はバッファを安全に扱える。
+class MMALPool : public rtc::RefCountInterface {
+ public:
+  static rtc::scoped_refptr<MMALPool> Create(unsigned int num, uint32_t size);
+
+  // 作成に失敗した場合は nullptr
+  MMAL_POOL_T* get() const;
+
+ protected:
+  MMALPool(unsigned int num, uint32_t size);
+  ~MMALPool() override;
+
+ private:
+  MMAL_POOL_T* const pool_;
+};
 
 class MMALBuffer : public webrtc::I420BufferInterface {
  public:
   static rtc::scoped_refptr<MMALBuffer> Create(MMAL_BUFFER_HEADER_T* buffer,
                                                int width,
                                                int height);
+  // buffer が pool のものである場合に、MMALBuffer が残っている間 pool を破棄させない
+  static rtc::scoped_refptr<MMALBuffer> Create(
+      MMAL_BUFFER_HEADER_T* buffer,
+      int width,
+      int height,
+      rtc::scoped_refptr<MMALPool> pool);
   Type type() const override;
   int width() const override;
   int height() const override;
@@ -27,12 +51,16 @@ class MMALBuffer : public webrtc::I420BufferInterface {
   const size_t length() const;
 
  protected:
-  MMALBuffer(MMAL_BUFFER_HEADER_T* buffer, int width, int height);
+  MMALBuffer(MMAL_BUFFER_HEADER_T* buffer,
+             int width,
+             int height,
+             rtc::scoped_refptr<MMALPool> pool);
   ~MMALBuffer() override;
 
  private:
   const MMAL_BUFFER_HEADER_T* buffer_;
+  const rtc::scoped_refptr<MMALPool> pool_;
   const int width_;
   const int height_;
 };
-#endif  // NATIVE_BUFFER_H_
+#endif  // MMAL_BUFFER_H_
@@ -15,14 +15,22 @@
 
 #include "common_video/libyuv/include/webrtc_libyuv.h"
 #include "modules/video_coding/include/video_error_codes.h"
+#include "rtc/thread_placement.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/time_utils.h"
 #include "system_wrappers/include/metrics.h"
 #include "third_party/libyuv/include/libyuv/convert.h"
 
-MMALH264Decoder::MMALH264Decoder()
+MMALH264Decoder::MMALH264Decoder(bool zero_copy,
+                                 int input_buffers,
+                                 int output_buffers)
     : decoder_(nullptr),
+      zero_copy_(zero_copy),
+      input_buffers_(input_buffers),
+      output_buffers_(output_buffers),
+      pool_in_(nullptr),
+      pool_out_(nullptr),
       width_(0),
       height_(0),
       decode_complete_callback_(nullptr),
@@ -61,6 +69,14 @@ int32_t MMALH264Decoder::Decode(const webrtc::EncodedImage& input_image,
 
   RTC_LOG(LS_INFO) << __FUNCTION__;
 
+  if (input_image.size() > decoder_->input[0]->buffer_size) {
+    RTC_LOG(LS_ERROR) << "Input image is too large: " << input_image.size();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  // 破棄されたフレームのバッファがプールに戻っていれば、デコーダに渡し直す
+  FillOutputBuffer();
+
   MMAL_BUFFER_HEADER_T* buffer;
   if ((buffer = mmal_queue_get(pool_in_->queue)) != nullptr) {
     buffer->pts = buffer->dts = input_image.Timestamp();
@@ -71,8 +87,9 @@ int32_t MMALH264Decoder::Decode(const webrtc::EncodedImage& input_image,
       RTC_LOG(LS_ERROR) << "Failed to send input buffer";
       return WEBRTC_VIDEO_CODEC_ERROR;
     }
-    RTC_LOG(LS_INFO) << __FUNCTION__ << " timestamp:" << input_image.Timestamp()
-                     << " size:" << input_image.size();
+    RTC_LOG(LS_VERBOSE) << __FUNCTION__
+                        << " timestamp:" << input_image.Timestamp()
+                        << " size:" << input_image.size();
     return WEBRTC_VIDEO_CODEC_OK;
   } else {
     RTC_LOG(LS_ERROR) << "Failed to get buffer from input queue";
@@ -115,13 +132,14 @@ void MMALH264Decoder::MMALInputCallbackFunction(MMAL_PORT_T* port,
 void MMALH264Decoder::MMALOutputCallbackFunction(MMAL_PORT_T* port,
                                                  MMAL_BUFFER_HEADER_T* buffer) {
   RTC_LOG(LS_INFO) << __FUNCTION__;
+  ThreadPlacement::Instance().ApplyOnce("decoder", "MMALDecoder");
   ((MMALH264Decoder*)port->userdata)->MMALOutputCallback(port, buffer);
 }
 
 void MMALH264Decoder::MMALOutputCallback(MMAL_PORT_T* port,
                                          MMAL_BUFFER_HEADER_T* buffer) {
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " cmd:" << buffer->cmd
-                   << " length:" << buffer->length;
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " cmd:" << buffer->cmd
+                      << " length:" << buffer->length;
 
   if (buffer->cmd == MMAL_EVENT_FORMAT_CHANGED) {
     rtc::CritScope lock(&config_lock_);
@@ -143,7 +161,7 @@ void MMALH264Decoder::MMALOutputCallback(MMAL_PORT_T* port,
     }
 
     port_out->buffer_size = port_out->buffer_size_recommended;
-    port_out->buffer_num = 3;
+    port_out->buffer_num = output_buffers_;
     port_out->userdata = (MMAL_PORT_USERDATA_T*)this;
   } else {
     SendFrame(buffer);
@@ -154,16 +172,24 @@ void MMALH264Decoder::MMALOutputCallback(MMAL_PORT_T* port,
 }
 
 void MMALH264Decoder::SendFrame(MMAL_BUFFER_HEADER_T* buffer) {
-  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-      buffer_pool_.CreateBuffer(width_, height_);
-  if (!i420_buffer.get()) {
-    return;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer;
+  if (zero_copy_) {
+    // 呼び出し元で release されるので、MMALBuffer の分の参照を増やしておく
+    mmal_buffer_header_acquire(buffer);
+    frame_buffer =
+        MMALBuffer::Create(buffer, width_, height_, zero_copy_pool_);
+  } else {
+    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+        buffer_pool_.CreateBuffer(width_, height_);
+    if (!i420_buffer.get()) {
+      return;
+    }
+    memcpy(i420_buffer->MutableDataY(), buffer->data, buffer->length);
+    frame_buffer = i420_buffer;
   }
 
-  memcpy(i420_buffer->MutableDataY(), buffer->data, buffer->length);
-
   webrtc::VideoFrame decoded_image = webrtc::VideoFrame::Builder()
-                                         .set_video_frame_buffer(i420_buffer)
+                                         .set_video_frame_buffer(frame_buffer)
                                          .set_timestamp_rtp(buffer->pts)
                                          .build();
   decode_complete_callback_->Decoded(decoded_image, absl::nullopt,
@@ -202,9 +228,9 @@ int32_t MMALH264Decoder::MMALConfigure() {
     return -1;
   }
 
-  port_in->buffer_num = 3;
+  port_in->buffer_num = input_buffers_;
   port_in->buffer_size = 256 << 10;
-  port_out->buffer_num = 3;
+  port_out->buffer_num = output_buffers_;
   port_out->buffer_size = 256;
 
   port_in->userdata = (MMAL_PORT_USERDATA_T*)this;
@@ -234,9 +260,23 @@ int32_t MMALH264Decoder::MMALConfigure() {
 
   pool_in_ =
       mmal_port_pool_create(port_in, port_in->buffer_num, port_in->buffer_size);
-  pool_out_ = mmal_port_pool_create(
-      port_out, port_out->buffer_num,
-      webrtc::CalcBufferSize(webrtc::VideoType::kI420, 1920, 1088));
+  if (zero_copy_) {
+    // フレームが残っている間に作り直されても大丈夫なように、プールは一度だけ作る
+    if (!zero_copy_pool_) {
+      zero_copy_pool_ = MMALPool::Create(
+          output_buffers_,
+          webrtc::CalcBufferSize(webrtc::VideoType::kI420, 1920, 1088));
+    }
+    pool_out_ = zero_copy_pool_->get();
+    if (pool_out_ == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to create output pool";
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+  } else {
+    pool_out_ = mmal_port_pool_create(
+        port_out, port_out->buffer_num,
+        webrtc::CalcBufferSize(webrtc::VideoType::kI420, 1920, 1088));
+  }
 
   if (mmal_component_enable(decoder_) != MMAL_SUCCESS) {
     RTC_LOG(LS_ERROR) << "Failed to enable component";
@@ -254,7 +294,9 @@ void MMALH264Decoder::MMALRelease() {
     mmal_port_disable(decoder_->input[0]);
     mmal_port_pool_destroy(decoder_->input[0], pool_in_);
     mmal_port_disable(decoder_->output[0]);
-    mmal_port_pool_destroy(decoder_->output[0], pool_out_);
+    if (!zero_copy_) {
+      mmal_port_pool_destroy(decoder_->output[0], pool_out_);
+    }
     mmal_component_destroy(decoder_);
     decoder_ = nullptr;
   }
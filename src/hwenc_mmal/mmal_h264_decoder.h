@@ -25,11 +25,15 @@ extern "C" {
 
 #include "api/video_codecs/video_decoder.h"
 #include "common_video/include/i420_buffer_pool.h"
+#include "mmal_buffer.h"
 #include "rtc_base/critical_section.h"
 
 class MMALH264Decoder : public webrtc::VideoDecoder {
  public:
-  MMALH264Decoder();
+  // zero_copy が true の場合、デコードしたバッファを I420Buffer にコピーせずに
+  // MMALBuffer で包んで渡す。バッファはフレームが破棄された時点でプールに返却されるので、
+  // 表示などで保持される分も考えて output_buffers を多めにしておくこと
+  MMALH264Decoder(bool zero_copy, int input_buffers, int output_buffers);
   ~MMALH264Decoder() override;
 
   int32_t InitDecode(const webrtc::VideoCodec* codec_settings,
@@ -64,8 +68,13 @@ class MMALH264Decoder : public webrtc::VideoDecoder {
 
   rtc::CriticalSection config_lock_;
   MMAL_COMPONENT_T* decoder_;
+  const bool zero_copy_;
+  const int input_buffers_;
+  const int output_buffers_;
   MMAL_POOL_T* pool_in_;
   MMAL_POOL_T* pool_out_;
+  // zero_copy_ の場合は pool_out_ はこのプールのもので、デコーダを作り直しても使い回す
+  rtc::scoped_refptr<MMALPool> zero_copy_pool_;
   int32_t width_;
   int32_t height_;
   webrtc::DecodedImageCallback* decode_complete_callback_;
@@ -16,8 +16,14 @@
 
 #include "common_video/libyuv/include/webrtc_libyuv.h"
 #include "mmal_buffer.h"
+#include "rtc/deferred_i420_buffer.h"
+#include "rtc/low_latency_rate_control.h"
+#include "rtc/memory_accounting.h"
+#include "rtc/simulcast_frame_buffer.h"
+#include "rtc/thread_placement.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
 #include "system_wrappers/include/metrics.h"
 #include "third_party/libyuv/include/libyuv/convert.h"
 #include "third_party/libyuv/include/libyuv/convert_from.h"
@@ -26,14 +32,12 @@
 #define H264HWENC_HEADER_DEBUG 0
 
 namespace {
-struct nal_entry {
-  size_t offset;
-  size_t size;
-};
-
 const int kLowH264QpThreshold = 34;
 const int kHighH264QpThreshold = 40;
 
+// 低遅延モードで 1 フレームを分割するスライスの数
+const int kLowLatencySlices = 4;
+
 int I420DataSize(const webrtc::I420BufferInterface& frame_buffer) {
   return frame_buffer.StrideY() * frame_buffer.height() +
          (frame_buffer.StrideU() + frame_buffer.StrideV()) *
@@ -42,18 +46,27 @@ int I420DataSize(const webrtc::I420BufferInterface& frame_buffer) {
 
 }  // namespace
 
-MMALH264Encoder::MMALH264Encoder(const cricket::VideoCodec& codec)
-    : callback_(nullptr),
+MMALH264Encoder::MMALH264Encoder(const cricket::VideoCodec& codec,
+                                 bool low_latency,
+                                 bool low_latency_rate_control,
+                                 KeyFrameThrottle::Settings key_frame_throttle)
+    : HWVideoEncoder("MMAL H264", key_frame_throttle),
+      low_latency_(low_latency),
+      low_latency_rate_control_(low_latency_rate_control),
       encoder_(nullptr),
+      encoder_pool_in_(nullptr),
       encoder_pool_out_(nullptr),
-      bitrate_adjuster_(.5, .95),
+      intra_refresh_(low_latency_rate_control ||
+                     key_frame_throttle.intra_refresh),
       target_framerate_fps_(30),
       configured_framerate_fps_(30),
       configured_width_(0),
-      configured_height_(0),
-      encoded_buffer_length_(0) {}
+      configured_height_(0) {}
 
-MMALH264Encoder::~MMALH264Encoder() {}
+MMALH264Encoder::~MMALH264Encoder() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  MMALRelease();
+}
 
 int32_t MMALH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
                                     int32_t number_of_cores,
@@ -61,6 +74,11 @@ int32_t MMALH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
   RTC_DCHECK(codec_settings);
   RTC_DCHECK_EQ(codec_settings->codecType, webrtc::kVideoCodecH264);
 
+  // サイマルキャストは SimulcastEncoderAdapter に任せる
+  if (codec_settings->numberOfSimulcastStreams > 1) {
+    return WEBRTC_VIDEO_CODEC_ERR_SIMULCAST_PARAMETERS_NOT_SUPPORTED;
+  }
+
   int32_t release_ret = Release();
   if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
     return release_ret;
@@ -70,29 +88,20 @@ int32_t MMALH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
 
   width_ = codec_settings->width;
   height_ = codec_settings->height;
-  target_bitrate_bps_ = codec_settings->startBitrate * 1000;
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
+  SetTargetBitrateBps(codec_settings->startBitrate * 1000);
 
   RTC_LOG(LS_INFO) << "InitEncode " << target_bitrate_bps_ << "bit/sec";
 
-  // Initialize encoded image. Default buffer size: size of unencoded data.
-  encoded_image_._completeFrame = true;
-  encoded_image_._encodedWidth = 0;
-  encoded_image_._encodedHeight = 0;
-  encoded_image_.set_size(0);
-  encoded_image_.timing_.flags =
-      webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
-  encoded_image_.content_type_ =
-      (codec_settings->mode == webrtc::VideoCodecMode::kScreensharing)
-          ? webrtc::VideoContentType::SCREENSHARE
-          : webrtc::VideoContentType::UNSPECIFIED;
+  InitEncodedImage(*codec_settings);
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
 int32_t MMALH264Encoder::Release() {
   std::lock_guard<std::mutex> lock(mtx_);
-  MMALRelease();
+  // 解像度の変更や再ネゴシエーションでは Release() の後にすぐ InitEncode() が呼ばれるので、
+  // ポートを止めるだけにしてコンポーネントとプールは残しておく。破棄するのはデストラクタ
+  MMALStop();
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
@@ -100,10 +109,78 @@ int32_t MMALH264Encoder::MMALConfigure() {
   if (mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER, &encoder_) !=
       MMAL_SUCCESS) {
     RTC_LOG(LS_ERROR) << "Failed to create mmal encoder";
-    Release();
+    encoder_ = nullptr;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  encoder_->input[0]->userdata = (MMAL_PORT_USERDATA_T*)this;
+  encoder_->output[0]->userdata = (MMAL_PORT_USERDATA_T*)this;
+
+  if (MMALSetFormat() != WEBRTC_VIDEO_CODEC_OK) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  if (mmal_component_enable(encoder_) != MMAL_SUCCESS) {
+    RTC_LOG(LS_ERROR) << "Failed to enable component";
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  if (MMALStart() != WEBRTC_VIDEO_CODEC_OK) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  // 入力のプールは最初に設定した解像度で確保しておき、
+  // それより小さい解像度に設定し直す場合はそのまま使う
+  MMAL_PORT_T* encoder_port_in = encoder_->input[0];
+  encoder_pool_in_ =
+      mmal_port_pool_create(encoder_port_in, encoder_port_in->buffer_num,
+                            encoder_port_in->buffer_size);
+  encoder_pool_in_size_ = encoder_port_in->buffer_size;
+
+  MMAL_PORT_T* encoder_port_out = encoder_->output[0];
+  encoder_pool_out_ =
+      mmal_port_pool_create(encoder_port_out, encoder_port_out->buffer_num,
+                            encoder_port_out->buffer_size);
+  pool_bytes_ =
+      (int64_t)encoder_port_in->buffer_num * encoder_port_in->buffer_size +
+      (int64_t)encoder_port_out->buffer_num * encoder_port_out->buffer_size;
+  MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder, pool_bytes_);
+
+  EncoderFillBuffer();
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t MMALH264Encoder::MMALReconfigure() {
+  MMALStop();
+
+  if (MMALSetFormat() != WEBRTC_VIDEO_CODEC_OK) {
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
+  MMAL_PORT_T* encoder_port_in = encoder_->input[0];
+  if (encoder_port_in->buffer_size > encoder_pool_in_size_) {
+    // ポートを止めたので全てのバッファはプールに戻っている
+    if (mmal_pool_resize(encoder_pool_in_, encoder_port_in->buffer_num,
+                         encoder_port_in->buffer_size) != MMAL_SUCCESS) {
+      RTC_LOG(LS_ERROR) << "Failed to resize encoder input pool";
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    const int64_t grown = (int64_t)encoder_port_in->buffer_num *
+                          (encoder_port_in->buffer_size - encoder_pool_in_size_);
+    MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder, grown);
+    pool_bytes_ += grown;
+    encoder_pool_in_size_ = encoder_port_in->buffer_size;
+  }
+
+  if (MMALStart() != WEBRTC_VIDEO_CODEC_OK) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  EncoderFillBuffer();
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t MMALH264Encoder::MMALSetFormat() {
   MMAL_PORT_T* encoder_port_in = encoder_->input[0];
   encoder_port_in->format->type = MMAL_ES_TYPE_VIDEO;
   encoder_port_in->format->encoding = MMAL_ENCODING_I420;
@@ -118,7 +195,6 @@ int32_t MMALH264Encoder::MMALConfigure() {
   if (encoder_port_in->buffer_size < encoder_port_in->buffer_size_min)
     encoder_port_in->buffer_size = encoder_port_in->buffer_size_min;
   encoder_port_in->buffer_num = 1;
-  encoder_port_in->userdata = (MMAL_PORT_USERDATA_T*)this;
 
   if (mmal_port_format_commit(encoder_port_in) != MMAL_SUCCESS) {
     RTC_LOG(LS_ERROR) << "Failed to commit encoder input port format";
@@ -135,12 +211,13 @@ int32_t MMALH264Encoder::MMALConfigure() {
 
   encoder_port_out->buffer_size = 256 << 10;
   encoder_port_out->buffer_num = 4;
-  encoder_port_out->userdata = (MMAL_PORT_USERDATA_T*)this;
 
   if (mmal_port_format_commit(encoder_port_out) != MMAL_SUCCESS) {
     RTC_LOG(LS_ERROR) << "Failed to commit encoder output port format";
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
+  configured_bitrate_bps_ = encoder_port_out->format->bitrate;
+  configured_framerate_fps_ = 30;
 
   MMAL_PARAMETER_VIDEO_PROFILE_T video_profile;
   video_profile.hdr.id = MMAL_PARAMETER_PROFILE;
@@ -155,8 +232,11 @@ int32_t MMALH264Encoder::MMALConfigure() {
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
+  // 低遅延のレート制御では最初の I フレームの後は P フレームだけにして、
+  // キーフレームは要求された時だけ送る
   if (mmal_port_parameter_set_uint32(
-          encoder_port_out, MMAL_PARAMETER_INTRAPERIOD, 500) != MMAL_SUCCESS) {
+          encoder_port_out, MMAL_PARAMETER_INTRAPERIOD,
+          low_latency_rate_control_ ? 0 : 500) != MMAL_SUCCESS) {
     RTC_LOG(LS_ERROR) << "Failed to set intra period";
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
@@ -175,13 +255,69 @@ int32_t MMALH264Encoder::MMALConfigure() {
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
-  encoded_image_buffer_.reset(new uint8_t[encoder_port_out->buffer_size]);
+  if (low_latency_) {
+    // スライス毎に出力させて、フレーム全体のエンコードを待たずに受け取る
+    int mb_rows = VCOS_ALIGN_UP(height_, 16) / 16;
+    uint32_t rows_per_slice =
+        (mb_rows + kLowLatencySlices - 1) / kLowLatencySlices;
+    if (mmal_port_parameter_set_uint32(encoder_port_out,
+                                       MMAL_PARAMETER_MB_ROWS_PER_SLICE,
+                                       rows_per_slice) != MMAL_SUCCESS) {
+      RTC_LOG(LS_WARNING) << "Failed to set mb rows per slice";
+    }
+    if (mmal_port_parameter_set_boolean(
+            encoder_port_out, MMAL_PARAMETER_VIDEO_ENCODE_H264_LOW_LATENCY,
+            MMAL_TRUE) != MMAL_SUCCESS) {
+      RTC_LOG(LS_WARNING) << "Failed to set enable low latency";
+    }
+  }
+
+  if (low_latency_rate_control_) {
+    // ファームウェアによっては対応していない設定もあるので、失敗しても続ける
+    MMAL_PARAMETER_VIDEO_RATECONTROL_T rate_control;
+    rate_control.hdr.id = MMAL_PARAMETER_RATECONTROL;
+    rate_control.hdr.size = sizeof(rate_control);
+    rate_control.control = MMAL_VIDEO_RATECONTROL_CONSTANT;
+    if (mmal_port_parameter_set(encoder_port_out, &rate_control.hdr) !=
+        MMAL_SUCCESS) {
+      RTC_LOG(LS_WARNING) << "Failed to set constant rate control";
+    }
 
-  if (mmal_component_enable(encoder_) != MMAL_SUCCESS) {
-    RTC_LOG(LS_ERROR) << "Failed to enable component";
-    return WEBRTC_VIDEO_CODEC_ERROR;
+    SetFrameLimitBits(configured_bitrate_bps_);
   }
 
+  if (intra_refresh_) {
+    MMAL_PARAMETER_VIDEO_INTRA_REFRESH_T intra_refresh;
+    intra_refresh.hdr.id = MMAL_PARAMETER_VIDEO_INTRA_REFRESH;
+    intra_refresh.hdr.size = sizeof(intra_refresh);
+    if (mmal_port_parameter_get(encoder_port_out, &intra_refresh.hdr) !=
+        MMAL_SUCCESS) {
+      memset(&intra_refresh, 0, sizeof(intra_refresh));
+      intra_refresh.hdr.id = MMAL_PARAMETER_VIDEO_INTRA_REFRESH;
+      intra_refresh.hdr.size = sizeof(intra_refresh);
+    }
+    const uint32_t mbs =
+        (VCOS_ALIGN_UP(width_, 16) / 16) * (VCOS_ALIGN_UP(height_, 16) / 16);
+    const uint32_t frames =
+        LowLatencyRateControl::IntraRefreshFrames(configured_framerate_fps_);
+    intra_refresh.refresh_mode = MMAL_VIDEO_INTRA_REFRESH_CYCLIC;
+    intra_refresh.cir_mbs = (mbs + frames - 1) / frames;
+    if (mmal_port_parameter_set(encoder_port_out, &intra_refresh.hdr) !=
+        MMAL_SUCCESS) {
+      RTC_LOG(LS_WARNING) << "Failed to set intra refresh";
+    }
+  }
+
+  configured_width_ = width_;
+  configured_height_ = height_;
+  stride_width_ = VCOS_ALIGN_UP(width_, 32);
+  stride_height_ = VCOS_ALIGN_UP(height_, 16);
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t MMALH264Encoder::MMALStart() {
+  MMAL_PORT_T* encoder_port_out = encoder_->output[0];
   if (mmal_port_parameter_set_boolean(encoder_port_out,
                                       MMAL_PARAMETER_ZERO_COPY,
                                       MMAL_TRUE) != MMAL_SUCCESS) {
@@ -189,52 +325,55 @@ int32_t MMALH264Encoder::MMALConfigure() {
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
-  if (mmal_port_enable(encoder_port_in, EncoderInputCallbackFunction) !=
+  if (mmal_port_enable(encoder_->input[0], EncoderInputCallbackFunction) !=
       MMAL_SUCCESS) {
     RTC_LOG(LS_ERROR) << "Failed to enable encoder input port";
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
-  encoder_pool_in_ =
-      mmal_port_pool_create(encoder_port_in, encoder_port_in->buffer_num,
-                            encoder_port_in->buffer_size);
-
   if (mmal_port_enable(encoder_port_out, EncoderOutputCallbackFunction) !=
       MMAL_SUCCESS) {
     RTC_LOG(LS_ERROR) << "Failed to enable encoder output port";
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
-
-  encoder_pool_out_ =
-      mmal_port_pool_create(encoder_port_out, encoder_port_out->buffer_num,
-                            encoder_port_out->buffer_size);
-
-  EncoderFillBuffer();
-
-  configured_width_ = width_;
-  configured_height_ = height_;
-  stride_width_ = VCOS_ALIGN_UP(width_, 32);
-  stride_height_ = VCOS_ALIGN_UP(height_, 16);
+  started_ = true;
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
-void MMALH264Encoder::MMALRelease() {
+void MMALH264Encoder::MMALStop() {
+  // ポートを止める間にコールバックから出力のバッファを送り直さないようにする
+  started_ = false;
   if (encoder_) {
-    mmal_component_disable(encoder_);
-    mmal_port_disable(encoder_->input[0]);
-    mmal_port_pool_destroy(encoder_->input[0], encoder_pool_in_);
-    mmal_port_disable(encoder_->output[0]);
-    mmal_port_pool_destroy(encoder_->output[0], encoder_pool_out_);
+    if (encoder_->input[0]->is_enabled) {
+      mmal_port_disable(encoder_->input[0]);
+    }
+    if (encoder_->output[0]->is_enabled) {
+      mmal_port_disable(encoder_->output[0]);
+    }
   }
+  ClearFrameParams();
+  pending_buffer_ = nullptr;
+}
+
+void MMALH264Encoder::MMALRelease() {
+  MMALStop();
   if (encoder_) {
+    mmal_component_disable(encoder_);
+    if (encoder_pool_in_) {
+      mmal_port_pool_destroy(encoder_->input[0], encoder_pool_in_);
+      encoder_pool_in_ = nullptr;
+    }
+    if (encoder_pool_out_) {
+      mmal_port_pool_destroy(encoder_->output[0], encoder_pool_out_);
+      encoder_pool_out_ = nullptr;
+    }
+    MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder,
+                                     -pool_bytes_);
+    pool_bytes_ = 0;
     mmal_component_destroy(encoder_);
     encoder_ = nullptr;
   }
-  while (!frame_params_.empty())
-    frame_params_.pop();
-  encoded_image_buffer_.reset();
-  encoded_buffer_length_ = 0;
 }
 
 void MMALH264Encoder::EncoderInputCallbackFunction(
@@ -246,6 +385,8 @@ void MMALH264Encoder::EncoderInputCallbackFunction(
 void MMALH264Encoder::EncoderOutputCallbackFunction(
     MMAL_PORT_T* port,
     MMAL_BUFFER_HEADER_T* buffer) {
+  // MMAL が作ったスレッドから呼ばれるので、最初のコールバックで設定する
+  ThreadPlacement::Instance().ApplyOnce("encoder", "MMALEncoder");
   MMALH264Encoder* _this = (MMALH264Encoder*)port->userdata;
   _this->EncoderOutputCallback(port, buffer);
   mmal_buffer_header_release(buffer);
@@ -258,60 +399,56 @@ void MMALH264Encoder::EncoderOutputCallback(MMAL_PORT_T* port,
     return;
 
   if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG) {
-    memcpy(encoded_image_buffer_.get(), buffer->data, buffer->length);
-    encoded_buffer_length_ = buffer->length;
-    RTC_LOG(LS_INFO) << "MMAL_BUFFER_HEADER_FLAG_CONFIG";
-    return;
+    RTC_LOG(LS_VERBOSE) << "MMAL_BUFFER_HEADER_FLAG_CONFIG";
   }
 
-  RTC_LOG(LS_INFO) << "pts:" << buffer->pts << " flags:" << buffer->flags
-                   << " planes:" << buffer->type->video.planes
-                   << " length:" << buffer->length;
+  RTC_LOG(LS_VERBOSE) << "pts:" << buffer->pts << " flags:" << buffer->flags
+                      << " planes:" << buffer->type->video.planes
+                      << " length:" << buffer->length;
 
-  std::unique_ptr<FrameParams> params;
-  {
-    rtc::CritScope lock(&frame_params_lock_);
-    do {
-      if (frame_params_.empty()) {
-        RTC_LOG(LS_WARNING)
-            << __FUNCTION__
-            << "Frame parameter is empty. SkipFrame pts:" << buffer->pts;
-        return;
-      }
-      params = std::move(frame_params_.front());
-      frame_params_.pop();
-    } while (params->timestamp_us < buffer->pts);
-    if (params->timestamp_us != buffer->pts) {
-      RTC_LOG(LS_WARNING) << __FUNCTION__
-                          << "Frame parameter is not found. SkipFrame pts:"
-                          << buffer->pts;
-      return;
+  // SPS/PPS や、複数の MMAL バッファに分かれたフレームの途中は溜めておく。
+  // MMAL バッファはすぐにエンコーダに返すので、ここで 1 回だけコピーする
+  if (!(buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END) ||
+      (buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)) {
+    if (!pending_buffer_) {
+      pending_buffer_ = GetEncodedBuffer();
     }
+    pending_buffer_->Append(buffer->data, buffer->length);
+    return;
   }
 
-  encoded_image_._encodedWidth = params->width;
-  encoded_image_._encodedHeight = params->height;
-  encoded_image_.capture_time_ms_ = params->render_time_ms;
-  encoded_image_.ntp_time_ms_ = params->ntp_time_ms;
-  encoded_image_.SetTimestamp(params->timestamp_rtp);
-  encoded_image_.rotation_ = params->rotation;
-  encoded_image_.SetColorSpace(params->color_space);
+  std::unique_ptr<FrameParams> params = PopFrameParams(buffer->pts);
+  if (!params) {
+    pending_buffer_ = nullptr;
+    return;
+  }
+  SetEncodedImageParams(*params);
 
-  if (encoded_buffer_length_ == 0) {
-    SendFrame(buffer->data, buffer->length);
+  if (!pending_buffer_) {
+    // 1 つの MMAL バッファに収まったフレームはコピーせずに参照する。
+    // OnEncodedImage から戻った後も保持する場合は、下流で Retain() してコピーされる
+    encoded_image_.set_buffer(buffer->data, buffer->length);
+    SendH264Frame(buffer->data, buffer->length);
   } else {
-    memcpy(encoded_image_buffer_.get() + encoded_buffer_length_, buffer->data,
-           buffer->length);
-    encoded_buffer_length_ += buffer->length;
-    SendFrame(encoded_image_buffer_.get(), encoded_buffer_length_);
-    encoded_buffer_length_ = 0;
+    rtc::scoped_refptr<PooledEncodedBuffer> encoded_buffer =
+        std::move(pending_buffer_);
+    encoded_buffer->Append(buffer->data, buffer->length);
+    encoded_image_.SetEncodedData(encoded_buffer);
+    SendH264Frame(encoded_buffer->data(), encoded_buffer->size());
   }
 }
 
 void MMALH264Encoder::EncoderFillBuffer() {
+  if (!started_) {
+    return;
+  }
   MMAL_BUFFER_HEADER_T* buffer;
   while ((buffer = mmal_queue_get(encoder_pool_out_->queue)) != nullptr) {
-    mmal_port_send_buffer(encoder_->output[0], buffer);
+    if (mmal_port_send_buffer(encoder_->output[0], buffer) != MMAL_SUCCESS) {
+      // 止めている途中のポートには送れないので、プールに戻して次に使う
+      mmal_buffer_header_release(buffer);
+      break;
+    }
   }
 }
 
@@ -331,8 +468,7 @@ void MMALH264Encoder::SetRates(const RateControlParameters& parameters) {
   RTC_LOG(LS_INFO) << __FUNCTION__
                    << " bitrate:" << parameters.bitrate.get_sum_bps()
                    << " fps:" << parameters.framerate_fps;
-  target_bitrate_bps_ = parameters.bitrate.get_sum_bps();
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
+  SetTargetBitrateBps(parameters.bitrate.get_sum_bps());
   target_framerate_fps_ = parameters.framerate_fps;
   return;
 }
@@ -341,6 +477,11 @@ void MMALH264Encoder::SetBitrateBps(uint32_t bitrate_bps) {
   if (bitrate_bps < 300000 || configured_bitrate_bps_ == bitrate_bps) {
     return;
   }
+  if (low_latency_rate_control_ &&
+      !LowLatencyRateControl::ShouldUpdateBitrate(configured_bitrate_bps_,
+                                                  bitrate_bps)) {
+    return;
+  }
   RTC_LOG(LS_INFO) << __FUNCTION__ << " " << bitrate_bps << " bit/sec";
   if (mmal_port_parameter_set_uint32(encoder_->output[0],
                                      MMAL_PARAMETER_VIDEO_BIT_RATE,
@@ -349,6 +490,23 @@ void MMALH264Encoder::SetBitrateBps(uint32_t bitrate_bps) {
     return;
   }
   configured_bitrate_bps_ = bitrate_bps;
+  if (low_latency_rate_control_) {
+    SetFrameLimitBits(bitrate_bps);
+  }
+}
+
+void MMALH264Encoder::SetFrameLimitBits(uint32_t bitrate_bps) {
+  if (mmal_port_parameter_set_uint32(
+          encoder_->output[0], MMAL_PARAMETER_VIDEO_ENCODE_PEAK_RATE,
+          bitrate_bps) != MMAL_SUCCESS) {
+    RTC_LOG(LS_WARNING) << "Failed to set peak rate";
+  }
+  if (mmal_port_parameter_set_uint32(
+          encoder_->output[0], MMAL_PARAMETER_VIDEO_ENCODE_FRAME_LIMIT_BITS,
+          LowLatencyRateControl::MaxFrameBits(
+              bitrate_bps, configured_framerate_fps_)) != MMAL_SUCCESS) {
+    RTC_LOG(LS_WARNING) << "Failed to set frame limit bits";
+  }
 }
 
 void MMALH264Encoder::SetFramerateFps(double framerate_fps) {
@@ -392,31 +550,66 @@ int32_t MMALH264Encoder::Encode(
   }
 
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer =
-      input_frame.video_frame_buffer();
+      SimulcastFrameBuffer::SelectLayer(input_frame.video_frame_buffer(),
+                                        width_, height_);
 
-  if (frame_buffer->width() != configured_width_ ||
-      frame_buffer->height() != configured_height_) {
-    RTC_LOG(LS_INFO) << "Encoder reinitialized from " << configured_width_
-                     << "x" << configured_height_ << " to "
-                     << frame_buffer->width() << "x" << frame_buffer->height();
+  // 出力が止まっている場合も、PeerConnection はそのままでエンコーダだけを作り直す
+  const bool stalled = metrics_.IsStalled();
+  if (stalled) {
+    metrics_.OnStallReset();
+  }
+  if (stalled) {
     MMALRelease();
+  }
+  if (!encoder_) {
+    RTC_LOG(LS_INFO) << "Encoder initialized to " << frame_buffer->width()
+                     << "x" << frame_buffer->height();
     if (MMALConfigure() != WEBRTC_VIDEO_CODEC_OK) {
       RTC_LOG(LS_ERROR) << "Failed to MMALConfigure";
+      MMALRelease();
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    // 作り直したエンコーダは最初に I フレームを出す
+    key_frame_throttle_.OnKeyFrame(rtc::TimeMillis());
+  } else if (!started_ || frame_buffer->width() != configured_width_ ||
+             frame_buffer->height() != configured_height_) {
+    // コンポーネントとプールはそのままで、ポートの形式だけを設定し直す
+    RTC_LOG(LS_INFO) << "Encoder reconfigured from " << configured_width_
+                     << "x" << configured_height_ << " to "
+                     << frame_buffer->width() << "x" << frame_buffer->height();
+    if (MMALReconfigure() != WEBRTC_VIDEO_CODEC_OK) {
+      RTC_LOG(LS_ERROR) << "Failed to MMALReconfigure";
+      MMALRelease();
       return WEBRTC_VIDEO_CODEC_ERROR;
     }
+    // ポートを止めると参照するフレームが無くなるので、最初に I フレームを出す
+    if (mmal_port_parameter_set_boolean(encoder_->output[0],
+                                        MMAL_PARAMETER_VIDEO_REQUEST_I_FRAME,
+                                        MMAL_TRUE) != MMAL_SUCCESS) {
+      RTC_LOG(LS_ERROR) << "Failed to request I frame";
+    }
+    key_frame_throttle_.OnKeyFrame(rtc::TimeMillis());
   }
 
-  bool force_key_frame = false;
+  bool key_frame_requested = false;
   if (frame_types != nullptr) {
     RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
     if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+      metrics_.OnSkipped();
       return WEBRTC_VIDEO_CODEC_OK;
     }
-    force_key_frame =
+    key_frame_requested =
         (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
   }
 
-  if (force_key_frame) {
+  // イントラリフレッシュは常に行っているので、その場合は何もしなくても復旧する
+  const KeyFrameThrottle::Action key_frame_action = key_frame_throttle_.Update(
+      key_frame_requested, intra_refresh_, rtc::TimeMillis());
+  if (key_frame_action != KeyFrameThrottle::Action::kKeyFrame &&
+      key_frame_requested) {
+    metrics_.OnKeyFrameRequestCoalesced();
+  }
+  if (key_frame_action == KeyFrameThrottle::Action::kKeyFrame) {
     if (mmal_port_parameter_set_boolean(encoder_->output[0],
                                         MMAL_PARAMETER_VIDEO_REQUEST_I_FRAME,
                                         MMAL_TRUE) != MMAL_SUCCESS) {
@@ -426,14 +619,9 @@ int32_t MMALH264Encoder::Encode(
 
   SetBitrateBps(bitrate_adjuster_.GetAdjustedBitrateBps());
   SetFramerateFps(target_framerate_fps_);
-  {
-    rtc::CritScope lock(&frame_params_lock_);
-    frame_params_.push(absl::make_unique<FrameParams>(
-        frame_buffer->width(), frame_buffer->height(),
-        input_frame.render_time_ms(), input_frame.ntp_time_ms(),
-        input_frame.timestamp_us(), input_frame.timestamp(),
-        input_frame.rotation(), input_frame.color_space()));
-  }
+  PushFrameParams(FrameParams(input_frame, frame_buffer->width(),
+                              frame_buffer->height()));
+  metrics_.OnSubmit(input_frame.timestamp());
 
   MMAL_BUFFER_HEADER_T* buffer;
   if ((buffer = mmal_queue_get(encoder_pool_in_->queue)) != nullptr) {
@@ -448,6 +636,21 @@ int32_t MMALH264Encoder::Encode(
         RTC_LOG(LS_ERROR) << "Failed to send input native buffer";
         return WEBRTC_VIDEO_CODEC_ERROR;
       }
+    } else if (DeferredI420Buffer* deferred_buffer =
+                   dynamic_cast<DeferredI420Buffer*>(frame_buffer.get())) {
+      // 変換を遅らせているバッファは、エンコーダの入力バッファに直接変換する
+      size_t offset_y = stride_width_ * stride_height_;
+      size_t width_uv = stride_width_ / 2;
+      size_t offset_v = (stride_height_ / 2) * width_uv;
+      deferred_buffer->ConvertTo(buffer->data, stride_width_,
+                                 buffer->data + offset_y, width_uv,
+                                 buffer->data + offset_y + offset_v, width_uv);
+      buffer->length = buffer->alloc_size = webrtc::CalcBufferSize(
+          webrtc::VideoType::kI420, stride_width_, stride_height_);
+      if (mmal_port_send_buffer(encoder_->input[0], buffer) != MMAL_SUCCESS) {
+        RTC_LOG(LS_ERROR) << "Failed to send input i420 buffer";
+        return WEBRTC_VIDEO_CODEC_ERROR;
+      }
     } else {
       rtc::scoped_refptr<const webrtc::I420BufferInterface> i420_buffer =
           frame_buffer->ToI420();
@@ -482,62 +685,3 @@ int32_t MMALH264Encoder::Encode(
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
-
-int32_t MMALH264Encoder::SendFrame(unsigned char* buffer, size_t size) {
-  encoded_image_.set_buffer(buffer, size);
-  encoded_image_.set_size(size);
-  encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameDelta;
-
-  uint8_t zero_count = 0;
-  size_t nal_start_idx = 0;
-  std::vector<nal_entry> nals;
-  for (size_t i = 0; i < size; i++) {
-    uint8_t data = buffer[i];
-    if ((i != 0) && (i == nal_start_idx)) {
-      if ((data & 0x1F) == 0x05) {
-        encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameKey;
-      }
-    }
-    if (data == 0x01 && zero_count >= 2) {
-      if (nal_start_idx != 0) {
-        nals.push_back(
-            {nal_start_idx, i - nal_start_idx + 1 - (zero_count == 2 ? 3 : 4)});
-      }
-      nal_start_idx = i + 1;
-    }
-    if (data == 0x00) {
-      zero_count++;
-    } else {
-      zero_count = 0;
-    }
-  }
-  if (nal_start_idx != 0) {
-    nals.push_back({nal_start_idx, size - nal_start_idx});
-  }
-
-  webrtc::RTPFragmentationHeader frag_header;
-  frag_header.VerifyAndAllocateFragmentationHeader(nals.size());
-  for (size_t i = 0; i < nals.size(); i++) {
-    frag_header.fragmentationOffset[i] = nals[i].offset;
-    frag_header.fragmentationLength[i] = nals[i].size;
-  }
-
-  webrtc::CodecSpecificInfo codec_specific;
-  codec_specific.codecType = webrtc::kVideoCodecH264;
-  codec_specific.codecSpecific.H264.packetization_mode =
-      webrtc::H264PacketizationMode::NonInterleaved;
-
-  h264_bitstream_parser_.ParseBitstream(buffer, size);
-  h264_bitstream_parser_.GetLastSliceQp(&encoded_image_.qp_);
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " last slice qp:" << encoded_image_.qp_;
-
-  webrtc::EncodedImageCallback::Result result =
-      callback_->OnEncodedImage(encoded_image_, &codec_specific, &frag_header);
-  if (result.error != webrtc::EncodedImageCallback::Result::OK) {
-    RTC_LOG(LS_ERROR) << __FUNCTION__
-                      << " OnEncodedImage failed error:" << result.error;
-    return WEBRTC_VIDEO_CODEC_ERROR;
-  }
-  bitrate_adjuster_.Update(size);
-  return WEBRTC_VIDEO_CODEC_OK;
-}
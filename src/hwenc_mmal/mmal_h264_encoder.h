@@ -23,23 +23,33 @@ extern "C" {
 #include "interface/vcos/vcos.h"
 }
 
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <vector>
 
 #include "api/video_codecs/video_encoder.h"
-#include "common_video/h264/h264_bitstream_parser.h"
-#include "common_video/include/bitrate_adjuster.h"
 #include "common_video/libyuv/include/webrtc_libyuv.h"
 #include "modules/video_coding/codecs/h264/include/h264.h"
-#include "rtc_base/critical_section.h"
+#include "rtc/hw_video_encoder.h"
+#include "rtc/key_frame_throttle.h"
 
 class ProcessThread;
 
-class MMALH264Encoder : public webrtc::VideoEncoder {
+class MMALH264Encoder : public HWVideoEncoder {
  public:
-  explicit MMALH264Encoder(const cricket::VideoCodec& codec);
+  // low_latency が true の場合、1 フレームを複数のスライスに分けてエンコードし、
+  // エンコーダがフレーム全体を出力し終わるのを待たずにスライス毎に受け取る。
+  // low_latency_rate_control が true の場合、CBR で 1 フレームの大きさを制限して、
+  // 定期的な I フレームの代わりにイントラリフレッシュを使う。LowLatencyRateControl を参照。
+  // key_frame_throttle でキーフレームの要求をまとめる。MMAL は要求された時だけ
+  // イントラリフレッシュすることができないので、intra_refresh の場合は常にイントラリフレッシュする
+  MMALH264Encoder(const cricket::VideoCodec& codec,
+                  bool low_latency = false,
+                  bool low_latency_rate_control = false,
+                  KeyFrameThrottle::Settings key_frame_throttle =
+                      KeyFrameThrottle::Settings());
   ~MMALH264Encoder() override;
 
   int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
@@ -55,35 +65,15 @@ class MMALH264Encoder : public webrtc::VideoEncoder {
   webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
 
  private:
-  struct FrameParams {
-    FrameParams(int32_t w,
-                int32_t h,
-                int64_t rtms,
-                int64_t ntpms,
-                int64_t tsus,
-                int64_t rtpts,
-                webrtc::VideoRotation r,
-                absl::optional<webrtc::ColorSpace> c)
-        : width(w),
-          height(h),
-          render_time_ms(rtms),
-          ntp_time_ms(ntpms),
-          timestamp_us(tsus),
-          timestamp_rtp(rtpts),
-          rotation(r),
-          color_space(c) {}
-
-    int32_t width;
-    int32_t height;
-    int64_t render_time_ms;
-    int64_t ntp_time_ms;
-    int64_t timestamp_us;
-    int64_t timestamp_rtp;
-    webrtc::VideoRotation rotation;
-    absl::optional<webrtc::ColorSpace> color_space;
-  };
-
+  // コンポーネントを作ってポートとプールを用意する
   int32_t MMALConfigure();
+  // コンポーネントとプールは残したまま、ポートを止めて今の解像度で設定し直す
+  int32_t MMALReconfigure();
+  // ポートの形式と、解像度に合わせたパラメータを設定する。ポートは止まっている必要がある
+  int32_t MMALSetFormat();
+  int32_t MMALStart();
+  void MMALStop();
+  // コンポーネントとプールを破棄する
   void MMALRelease();
   static void EncoderInputCallbackFunction(MMAL_PORT_T* port,
                                            MMAL_BUFFER_HEADER_T* buffer);
@@ -92,16 +82,24 @@ class MMALH264Encoder : public webrtc::VideoEncoder {
   void EncoderOutputCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
   void EncoderFillBuffer();
   void SetBitrateBps(uint32_t bitrate_bps);
+  // 低遅延のレート制御の場合に、1 フレームの大きさの上限を設定する
+  void SetFrameLimitBits(uint32_t bitrate_bps);
   void SetFramerateFps(double framerate_fps);
-  int32_t SendFrame(unsigned char* buffer, size_t size);
 
+  const bool low_latency_;
+  const bool low_latency_rate_control_;
   std::mutex mtx_;
-  webrtc::EncodedImageCallback* callback_;
   MMAL_COMPONENT_T* encoder_;
   MMAL_POOL_T* encoder_pool_in_;
+  // encoder_pool_in_ のバッファの大きさ
+  uint32_t encoder_pool_in_size_ = 0;
+  // MemoryAccounting に計上している入出力のプールの大きさ
+  int64_t pool_bytes_ = 0;
   MMAL_POOL_T* encoder_pool_out_;
-  webrtc::BitrateAdjuster bitrate_adjuster_;
-  uint32_t target_bitrate_bps_;
+  // ポートが有効で、出力のバッファを送って良い
+  std::atomic<bool> started_{false};
+  // 常にイントラリフレッシュを行う
+  const bool intra_refresh_;
   uint32_t configured_bitrate_bps_;
   double target_framerate_fps_;
   int32_t configured_framerate_fps_;
@@ -112,13 +110,8 @@ class MMALH264Encoder : public webrtc::VideoEncoder {
   int32_t stride_width_;
   int32_t stride_height_;
 
-  webrtc::H264BitstreamParser h264_bitstream_parser_;
-
-  rtc::CriticalSection frame_params_lock_;
-  std::queue<std::unique_ptr<FrameParams>> frame_params_;
-  webrtc::EncodedImage encoded_image_;
-  std::unique_ptr<uint8_t[]> encoded_image_buffer_;
-  size_t encoded_buffer_length_;
+  // FRAME_END が来るまでに受け取った SPS/PPS やスライス
+  rtc::scoped_refptr<PooledEncodedBuffer> pending_buffer_;
 };
 
 #endif  // MMAL_H264_ENCODER_H_
@@ -12,6 +12,18 @@
 rtc::scoped_refptr<V4L2VideoCapture> MMALV4L2Capture::Create(
     ConnectionSettings cs) {
   rtc::scoped_refptr<V4L2VideoCapture> capturer;
+  if (!cs.video_device_cache.empty()) {
+    // デバイスの列挙には時間がかかるので、前回使ったデバイスを先に試す
+    capturer = new rtc::RefCountedObject<MMALV4L2Capture>();
+    if (capturer->InitFromCache(cs) && capturer->StartCapture(cs) == 0) {
+      RTC_LOG(LS_INFO) << "Get Capture from cache";
+      if (cs.on_demand_capture || cs.low_power_idle) {
+        capturer->EnableOnDemand(cs.on_demand_linger_ms, cs.low_power_idle);
+      }
+      return capturer;
+    }
+    capturer = nullptr;
+  }
   std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> device_info(
       webrtc::VideoCaptureFactory::CreateDeviceInfo());
   if (!device_info) {
@@ -25,6 +37,9 @@ rtc::scoped_refptr<V4L2VideoCapture> MMALV4L2Capture::Create(
     capturer = Create(device_info.get(), cs, i);
     if (capturer) {
       RTC_LOG(LS_INFO) << "Get Capture";
+      if (cs.on_demand_capture || cs.low_power_idle) {
+        capturer->EnableOnDemand(cs.on_demand_linger_ms, cs.low_power_idle);
+      }
       return capturer;
     }
   }
@@ -67,20 +82,23 @@ MMALV4L2Capture::MMALV4L2Capture()
       resizer_(nullptr),
       connection_(nullptr),
       configured_width_(0),
-      configured_height_(0) {
+      configured_height_(0),
+      input_width_(0),
+      input_height_(0),
+      crop_x_(0),
+      crop_y_(0),
+      crop_width_(0),
+      crop_height_(0),
+      crop_supported_(true),
+      decoded_buffer_num_(4),
+      decoded_buffer_size_(0) {
   bcm_host_init();
-  decoded_buffer_num_ = 4;
-  decoded_buffer_size_ =
-      webrtc::CalcBufferSize(webrtc::VideoType::kI420, VCOS_ALIGN_UP(1920, 32),
-                             VCOS_ALIGN_UP(1080, 16));
-  // 出力のプールはまとめないと、リサイズ時にエンコーダに送ったフレームが破棄される場合がある
-  resizer_pool_out_ = mmal_pool_create(decoded_buffer_num_, decoded_buffer_size_);
 }
 
 MMALV4L2Capture::~MMALV4L2Capture() {
   std::lock_guard<std::mutex> lock(mtx_);
   MMALRelease();
-  mmal_pool_destroy(resizer_pool_out_);
+  resizer_pool_out_ = nullptr;
 }
 
 int32_t MMALV4L2Capture::StartCapture(ConnectionSettings cs) {
@@ -91,11 +109,22 @@ int32_t MMALV4L2Capture::StopCapture() {
   return V4L2VideoCapture::StopCapture();
 }
 
+void MMALV4L2Capture::ReleaseIdleResources() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  MMALRelease();
+  resizer_pool_out_ = nullptr;
+}
+
 bool MMALV4L2Capture::useNativeBuffer() {
   return true;
 }
 
 bool MMALV4L2Capture::OnCaptured(struct v4l2_buffer& buf) {
+  // どうせ捨てられるフレームはデコードやリサイズをせずにドライバへ返す
+  if (ShouldSkipFrame()) {
+    return false;
+  }
+
   const int64_t timestamp_us = rtc::TimeMicros();
 
   int adapted_width;
@@ -111,17 +140,32 @@ bool MMALV4L2Capture::OnCaptured(struct v4l2_buffer& buf) {
   }
   std::lock_guard<std::mutex> lock(mtx_);
 
-  if (configured_width_ != adapted_width ||
-      configured_height_ != adapted_height) {
-    RTC_LOG(LS_INFO) << "Resizer reinitialized from " << configured_width_
-                     << "x" << configured_height_ << " to " << adapted_width
-                     << "x" << adapted_height;
+  if (resizer_ == nullptr || input_width_ != _currentWidth ||
+      input_height_ != _currentHeight) {
+    // キャプチャの解像度が変わった場合は入力ポートから設定し直す
     MMALRelease();
     if (MMALConfigure(adapted_width, adapted_height) == -1) {
       RTC_LOG(LS_ERROR) << "Failed to MMALConfigure";
       return false;
     }
+  } else if (configured_width_ != adapted_width ||
+             configured_height_ != adapted_height) {
+    // コンポーネントを作り直すとしばらくフレームが止まるので、出力ポートだけを設定し直す
+    RTC_LOG(LS_INFO) << "Resizer output changed from " << configured_width_
+                     << "x" << configured_height_ << " to " << adapted_width
+                     << "x" << adapted_height;
+    if (MMALConfigureOutput(adapted_width, adapted_height) == -1) {
+      RTC_LOG(LS_INFO) << "Resizer reinitialized from " << configured_width_
+                       << "x" << configured_height_ << " to " << adapted_width
+                       << "x" << adapted_height;
+      MMALRelease();
+      if (MMALConfigure(adapted_width, adapted_height) == -1) {
+        RTC_LOG(LS_ERROR) << "Failed to MMALConfigure";
+        return false;
+      }
+    }
   }
+  MMALSetCrop(crop_x, crop_y, crop_width, crop_height);
 
   ResizerFillBuffer();
 
@@ -147,7 +191,7 @@ bool MMALV4L2Capture::OnCaptured(struct v4l2_buffer& buf) {
 
   // enqueue the buffer again
   if (ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
-    RTC_LOG(LS_INFO) << "Failed to enqueue capture buffer";
+    RTC_LOG(LS_ERROR) << "Failed to enqueue capture buffer";
   }
   return true;
 }
@@ -164,7 +208,8 @@ void MMALV4L2Capture::MMALInputCallback(MMAL_PORT_T* port,
 
 void MMALV4L2Capture::ResizerFillBuffer() {
   MMAL_BUFFER_HEADER_T* resizer_out;
-  while ((resizer_out = mmal_queue_get(resizer_pool_out_->queue)) != NULL) {
+  while ((resizer_out = mmal_queue_get(resizer_pool_out_->get()->queue)) !=
+         NULL) {
     mmal_port_send_buffer(resizer_->output[0], resizer_out);
   }
 }
@@ -177,6 +222,12 @@ void MMALV4L2Capture::ResizerOutputCallbackFunction(
 
 void MMALV4L2Capture::ResizerOutputCallback(MMAL_PORT_T* port,
                                             MMAL_BUFFER_HEADER_T* buffer) {
+  // 出力ポートを無効にした時に返ってくるバッファ
+  if (buffer->length == 0) {
+    mmal_buffer_header_release(buffer);
+    return;
+  }
+
   std::unique_ptr<FrameParams> params;
   {
     rtc::CritScope lock(&frame_params_lock_);
@@ -201,7 +252,8 @@ void MMALV4L2Capture::ResizerOutputCallback(MMAL_PORT_T* port,
   }
 
   rtc::scoped_refptr<MMALBuffer> mmal_buffer(
-      MMALBuffer::Create(buffer, params->width, params->height));
+      MMALBuffer::Create(buffer, params->width, params->height,
+                         resizer_pool_out_));
   OnFrame(webrtc::VideoFrame::Builder()
               .set_video_frame_buffer(mmal_buffer)
               .set_timestamp_rtp(0)
@@ -241,6 +293,9 @@ int32_t MMALV4L2Capture::MMALConfigure(int32_t width, int32_t height) {
       case webrtc::VideoType::kYUY2:
         input_format = MMAL_ENCODING_YUYV;
         break;
+      case webrtc::VideoType::kNV12:
+        input_format = MMAL_ENCODING_NV12;
+        break;
       default:
         RTC_LOG(LS_ERROR) << "This video type is not supported in native "
                              "frame.  video type : "
@@ -296,29 +351,24 @@ int32_t MMALV4L2Capture::MMALConfigure(int32_t width, int32_t height) {
     }
   }
 
-  MMAL_PORT_T* resizer_port_out = resizer_->output[0];
-  mmal_format_copy(resizer_port_out->format, resizer_->input[0]->format);
-  resizer_port_out->format->encoding = MMAL_ENCODING_I420;
-  resizer_port_out->format->es->video.width = VCOS_ALIGN_UP(width, 32);
-  resizer_port_out->format->es->video.height = VCOS_ALIGN_UP(height, 16);
-  resizer_port_out->format->es->video.crop.x = 0;
-  resizer_port_out->format->es->video.crop.y = 0;
-  resizer_port_out->format->es->video.crop.width = width;
-  resizer_port_out->format->es->video.crop.height = height;
-
-  resizer_port_out->buffer_size = decoded_buffer_size_;
-  resizer_port_out->buffer_num = decoded_buffer_num_;
-  resizer_port_out->userdata = (MMAL_PORT_USERDATA_T*)this;
-
-  if (mmal_port_format_commit(resizer_port_out) != MMAL_SUCCESS) {
-    RTC_LOG(LS_ERROR) << "Failed to commit output port format";
-    return -1;
+  // リサイズ後の解像度はキャプチャの解像度を超えないので、
+  // キャプチャの解像度に合わせたプールを全ての出力サイズで使い回す
+  uint32_t buffer_size = webrtc::CalcBufferSize(
+      webrtc::VideoType::kI420, VCOS_ALIGN_UP(_currentWidth, 32),
+      VCOS_ALIGN_UP(_currentHeight, 16));
+  if (!resizer_pool_out_ || decoded_buffer_size_ < buffer_size) {
+    resizer_pool_out_ = MMALPool::Create(decoded_buffer_num_, buffer_size);
+    if (resizer_pool_out_->get() == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to create resizer output pool";
+      resizer_pool_out_ = nullptr;
+      return -1;
+    }
+    decoded_buffer_size_ = buffer_size;
   }
 
-  // mmal_pool_create で作った場合 mmal_component_enable 前に mmal_port_enable
-  if (mmal_port_enable(resizer_port_out, ResizerOutputCallbackFunction) !=
-      MMAL_SUCCESS) {
-    RTC_LOG(LS_ERROR) << "Failed to enable resizer output port";
+  MMAL_PORT_T* resizer_port_out = resizer_->output[0];
+  resizer_port_out->userdata = (MMAL_PORT_USERDATA_T*)this;
+  if (MMALConfigureOutput(width, height) == -1) {
     return -1;
   }
 
@@ -369,11 +419,90 @@ int32_t MMALV4L2Capture::MMALConfigure(int32_t width, int32_t height) {
     }
   }
 
+  input_width_ = _currentWidth;
+  input_height_ = _currentHeight;
+  crop_x_ = 0;
+  crop_y_ = 0;
+  crop_width_ = _currentWidth;
+  crop_height_ = _currentHeight;
+  return 0;
+}
+
+int32_t MMALV4L2Capture::MMALConfigureOutput(int32_t width, int32_t height) {
+  MMAL_PORT_T* resizer_port_out = resizer_->output[0];
+  uint32_t buffer_size =
+      webrtc::CalcBufferSize(webrtc::VideoType::kI420,
+                             VCOS_ALIGN_UP(width, 32), VCOS_ALIGN_UP(height, 16));
+  if (buffer_size > decoded_buffer_size_) {
+    return -1;
+  }
+
+  if (resizer_port_out->is_enabled &&
+      mmal_port_disable(resizer_port_out) != MMAL_SUCCESS) {
+    RTC_LOG(LS_ERROR) << "Failed to disable resizer output port";
+    return -1;
+  }
+
+  mmal_format_copy(resizer_port_out->format, resizer_->input[0]->format);
+  resizer_port_out->format->encoding = MMAL_ENCODING_I420;
+  resizer_port_out->format->es->video.width = VCOS_ALIGN_UP(width, 32);
+  resizer_port_out->format->es->video.height = VCOS_ALIGN_UP(height, 16);
+  resizer_port_out->format->es->video.crop.x = 0;
+  resizer_port_out->format->es->video.crop.y = 0;
+  resizer_port_out->format->es->video.crop.width = width;
+  resizer_port_out->format->es->video.crop.height = height;
+
+  resizer_port_out->buffer_size = decoded_buffer_size_;
+  resizer_port_out->buffer_num = decoded_buffer_num_;
+
+  if (mmal_port_format_commit(resizer_port_out) != MMAL_SUCCESS) {
+    RTC_LOG(LS_ERROR) << "Failed to commit output port format";
+    return -1;
+  }
+
+  // mmal_pool_create で作った場合 mmal_component_enable 前に mmal_port_enable
+  if (mmal_port_enable(resizer_port_out, ResizerOutputCallbackFunction) !=
+      MMAL_SUCCESS) {
+    RTC_LOG(LS_ERROR) << "Failed to enable resizer output port";
+    return -1;
+  }
+
+  // 設定し直す前のサイズのフレームパラメータは使わない
+  {
+    rtc::CritScope lock(&frame_params_lock_);
+    while (!frame_params_.empty())
+      frame_params_.pop();
+  }
+
   configured_width_ = width;
   configured_height_ = height;
   return 0;
 }
 
+void MMALV4L2Capture::MMALSetCrop(int32_t x,
+                                  int32_t y,
+                                  int32_t width,
+                                  int32_t height) {
+  if (!crop_supported_ || (x == crop_x_ && y == crop_y_ &&
+                           width == crop_width_ && height == crop_height_)) {
+    return;
+  }
+  // 切り出しは ISP の入力で行うので、CPU でのコピーは発生しない
+  MMAL_PARAMETER_CROP_T crop = {{MMAL_PARAMETER_CROP, sizeof(crop)},
+                                {x, y, width, height}};
+  if (mmal_port_parameter_set(resizer_->input[0], &crop.hdr) !=
+      MMAL_SUCCESS) {
+    RTC_LOG(LS_WARNING) << "Failed to set resizer input crop. "
+                           "Resize the whole frame";
+    crop_supported_ = false;
+    return;
+  }
+  crop_x_ = x;
+  crop_y_ = y;
+  crop_width_ = width;
+  crop_height_ = height;
+}
+
 void MMALV4L2Capture::MMALRelease() {
   if (resizer_) {
     mmal_component_disable(resizer_);
@@ -399,6 +528,11 @@ void MMALV4L2Capture::MMALRelease() {
     mmal_component_destroy(decoder_);
     decoder_ = nullptr;
   }
-  while (!frame_params_.empty())
-    frame_params_.pop();
+  {
+    rtc::CritScope lock(&frame_params_lock_);
+    while (!frame_params_.empty())
+      frame_params_.pop();
+  }
+  configured_width_ = 0;
+  configured_height_ = 0;
 }
\ No newline at end of file
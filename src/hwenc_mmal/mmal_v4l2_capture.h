@@ -19,8 +19,10 @@ extern "C" {
 #include <mutex>
 #include <queue>
 
+#include "api/scoped_refptr.h"
 #include "rtc_base/critical_section.h"
 
+#include "mmal_buffer.h"
 #include "v4l2_video_capturer/v4l2_video_capturer.h"
 
 class MMALV4L2Capture : public V4L2VideoCapture {
@@ -47,6 +49,8 @@ class MMALV4L2Capture : public V4L2VideoCapture {
   int32_t StopCapture() override;
   bool useNativeBuffer() override;
   bool OnCaptured(struct v4l2_buffer& buf) override;
+  // ISP のコンポーネントと出力のプールを解放する。次のフレームで作り直す
+  void ReleaseIdleResources() override;
   static void MMALInputCallbackFunction(MMAL_PORT_T* port,
                                         MMAL_BUFFER_HEADER_T* buffer);
   void MMALInputCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
@@ -55,6 +59,9 @@ class MMALV4L2Capture : public V4L2VideoCapture {
                                             MMAL_BUFFER_HEADER_T* buffer);
   void ResizerOutputCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
   int32_t MMALConfigure(int32_t width, int32_t height);
+  // リサイザの出力ポートだけを設定し直す。失敗した場合は -1 を返す
+  int32_t MMALConfigureOutput(int32_t width, int32_t height);
+  void MMALSetCrop(int32_t x, int32_t y, int32_t width, int32_t height);
   void MMALRelease();
 
   std::mutex mtx_;
@@ -63,13 +70,24 @@ class MMALV4L2Capture : public V4L2VideoCapture {
   MMAL_COMPONENT_T* resizer_;
   MMAL_CONNECTION_T* connection_;
   MMAL_POOL_T* pool_in_;
-  MMAL_POOL_T* resizer_pool_out_;
+  // 出力のプールはリサイズ後も使い回すので、キャプチャの解像度に合わせて確保する。
+  // 作り直した場合も、エンコーダに送ったフレームが残っている間は破棄されない
+  rtc::scoped_refptr<MMALPool> resizer_pool_out_;
   int32_t configured_width_;
   int32_t configured_height_;
+  // 入力ポートを設定した時のキャプチャの解像度
+  int32_t input_width_;
+  int32_t input_height_;
+  // ISP で切り出している範囲
+  int32_t crop_x_;
+  int32_t crop_y_;
+  int32_t crop_width_;
+  int32_t crop_height_;
+  bool crop_supported_;
   rtc::CriticalSection frame_params_lock_;
   std::queue<std::unique_ptr<FrameParams>> frame_params_;
   unsigned int decoded_buffer_num_;
-  size_t decoded_buffer_size_;
+  uint32_t decoded_buffer_size_;
 };
 
 #endif  // V4L2_MMAL_CAPTURE_H_
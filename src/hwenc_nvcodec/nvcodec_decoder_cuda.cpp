@@ -0,0 +1,124 @@
+#include "nvcodec_decoder_cuda.h"
+
+#include <iostream>
+
+#include <NvDecoder/NvDecoder.h>
+
+#include "dyn/cuda.h"
+
+class NvCodecDecoderCudaImpl {
+ public:
+  ~NvCodecDecoderCudaImpl();
+
+  bool Init();
+  int Decode(const uint8_t* data, int size, int64_t timestamp);
+  const uint8_t* GetFrame(int index, int64_t* timestamp);
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+ private:
+  CUcontext cu_context_ = nullptr;
+  NvDecoder* nv_decoder_ = nullptr;
+  uint8_t** frames_ = nullptr;
+  int64_t* timestamps_ = nullptr;
+  int frame_count_ = 0;
+  int width_ = 0;
+  int height_ = 0;
+};
+
+NvCodecDecoderCudaImpl::~NvCodecDecoderCudaImpl() {
+  delete nv_decoder_;
+  if (cu_context_ != nullptr) {
+    dyn::cuCtxDestroy(cu_context_);
+  }
+}
+
+bool NvCodecDecoderCudaImpl::Init() {
+  CUresult r = dyn::cuInit(0);
+  if (r != CUDA_SUCCESS) {
+    std::cerr << "Failed to cuInit: r=" << r << std::endl;
+    return false;
+  }
+  CUdevice cu_device;
+  r = dyn::cuDeviceGet(&cu_device, 0);
+  if (r != CUDA_SUCCESS) {
+    std::cerr << "Failed to cuDeviceGet: r=" << r << std::endl;
+    return false;
+  }
+  r = dyn::cuCtxCreate(&cu_context_, 0, cu_device);
+  if (r != CUDA_SUCCESS) {
+    std::cerr << "Failed to cuCtxCreate: r=" << r << std::endl;
+    cu_context_ = nullptr;
+    return false;
+  }
+
+  try {
+    // WebRTC は B フレームを使わないので、デコードしたらすぐに出力させる
+    nv_decoder_ = new NvDecoder(cu_context_, false, cudaVideoCodec_H264,
+                                nullptr, true);
+  } catch (const NVDECException& e) {
+    std::cerr << "Failed to create NvDecoder: " << e.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int NvCodecDecoderCudaImpl::Decode(const uint8_t* data,
+                                   int size,
+                                   int64_t timestamp) {
+  frames_ = nullptr;
+  timestamps_ = nullptr;
+  frame_count_ = 0;
+  try {
+    nv_decoder_->Decode(data, size, &frames_, &frame_count_,
+                        CUVID_PKT_ENDOFPICTURE, &timestamps_, timestamp);
+  } catch (const NVDECException& e) {
+    std::cerr << "Failed to decode: " << e.what() << std::endl;
+    frame_count_ = 0;
+    return -1;
+  }
+  if (frame_count_ > 0) {
+    // 出力は 8bit の NV12 しか扱わない
+    if (nv_decoder_->GetOutputFormat() != cudaVideoSurfaceFormat_NV12) {
+      std::cerr << "Unsupported output format: "
+                << nv_decoder_->GetOutputFormat() << std::endl;
+      frame_count_ = 0;
+      return -1;
+    }
+    width_ = nv_decoder_->GetWidth();
+    height_ = nv_decoder_->GetHeight();
+  }
+  return frame_count_;
+}
+
+const uint8_t* NvCodecDecoderCudaImpl::GetFrame(int index, int64_t* timestamp) {
+  if (index < 0 || index >= frame_count_) {
+    return nullptr;
+  }
+  *timestamp = timestamps_[index];
+  return frames_[index];
+}
+
+NvCodecDecoderCuda::NvCodecDecoderCuda()
+    : impl_(new NvCodecDecoderCudaImpl()) {}
+NvCodecDecoderCuda::~NvCodecDecoderCuda() {
+  delete impl_;
+}
+
+bool NvCodecDecoderCuda::Init() {
+  return impl_->Init();
+}
+int NvCodecDecoderCuda::Decode(const uint8_t* data,
+                               int size,
+                               int64_t timestamp) {
+  return impl_->Decode(data, size, timestamp);
+}
+const uint8_t* NvCodecDecoderCuda::GetFrame(int index, int64_t* timestamp) {
+  return impl_->GetFrame(index, timestamp);
+}
+int NvCodecDecoderCuda::width() const {
+  return impl_->width();
+}
+int NvCodecDecoderCuda::height() const {
+  return impl_->height();
+}
@@ -0,0 +1,38 @@
+#ifndef NVCODEC_DECODER_CUDA_H_
+#define NVCODEC_DECODER_CUDA_H_
+
+// nvcodec_h264_encoder_cuda.h と同様に、CUDA の処理だけさせる単純な CUDA ファイルを用意する
+
+// このヘッダーファイルは、外から呼ばれるので #include <cuda.h> や NvDecoder.h をしてはいけない
+// また、CUDA 側に WebRTC のヘッダを混ぜることができないので WebRTC のヘッダも include してはいけない
+
+#include <stddef.h>
+#include <stdint.h>
+
+class NvCodecDecoderCudaImpl;
+
+// NVDEC で H264 をデコードして、ホストメモリ上の NV12 として取り出すためのクラス
+class NvCodecDecoderCuda {
+ public:
+  NvCodecDecoderCuda();
+  ~NvCodecDecoderCuda();
+
+  // CUDA の初期化とデコーダの作成を行う。失敗した場合は false を返す
+  bool Init();
+
+  // 1 フレーム分のデータを渡してデコードする。
+  // 表示可能になったフレームの数を返す。エラーの場合は -1 を返す。
+  // フレームは次に Decode() を呼ぶまで GetFrame() で取得できる。
+  int Decode(const uint8_t* data, int size, int64_t timestamp);
+
+  // Decode() で取得した index 番目のフレームを返す。
+  // Y プレーンの直後に UV プレーンが隙間なく並んでいて、stride は width() になる。
+  const uint8_t* GetFrame(int index, int64_t* timestamp);
+  int width() const;
+  int height() const;
+
+ private:
+  NvCodecDecoderCudaImpl* impl_;
+};
+
+#endif  // NVCODEC_DECODER_CUDA_H_
@@ -0,0 +1,102 @@
+#include "nvcodec_h264_decoder.h"
+
+#include <string.h>
+
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc_base/logging.h"
+
+#include "dyn/cuda.h"
+#include "dyn/nvcuvid.h"
+#include "rtc/frame_buffer_pool.h"
+#include "rtc/native_buffer.h"
+
+NvCodecH264Decoder::NvCodecH264Decoder() {}
+
+NvCodecH264Decoder::~NvCodecH264Decoder() {
+  Release();
+}
+
+bool NvCodecH264Decoder::IsSupported() {
+  if (!dyn::DynModule::Instance().IsLoadable(dyn::CUDA_SO)) {
+    return false;
+  }
+  if (!dyn::DynModule::Instance().IsLoadable(dyn::NVCUVID_SO)) {
+    return false;
+  }
+  return true;
+}
+
+int32_t NvCodecH264Decoder::InitDecode(const webrtc::VideoCodec* codec_settings,
+                                       int32_t number_of_cores) {
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  decoder_.reset(new NvCodecDecoderCuda());
+  if (!decoder_->Init()) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to initialize NvDecoder";
+    decoder_.reset();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t NvCodecH264Decoder::Decode(const webrtc::EncodedImage& input_image,
+                                   bool missing_frames,
+                                   int64_t render_time_ms) {
+  if (decoder_ == nullptr) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+  if (decode_complete_callback_ == nullptr) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+  if (input_image.data() == nullptr || input_image.size() == 0) {
+    return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+  }
+
+  int count = decoder_->Decode(input_image.data(), (int)input_image.size(),
+                               input_image.Timestamp());
+  if (count < 0) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  int width = decoder_->width();
+  int height = decoder_->height();
+  for (int i = 0; i < count; i++) {
+    int64_t timestamp;
+    const uint8_t* frame = decoder_->GetFrame(i, &timestamp);
+    if (frame == nullptr) {
+      continue;
+    }
+
+    // NvDecoder が出力するホストメモリ上のフレームは NativeBuffer の NV12 と同じ並びなので、そのままコピーする
+    rtc::scoped_refptr<NativeBuffer> buffer =
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            webrtc::VideoType::kNV12, width, height);
+    size_t size = webrtc::CalcBufferSize(webrtc::VideoType::kNV12, width,
+                                          height);
+    memcpy(buffer->MutableData(), frame, size);
+    buffer->SetLength(size);
+
+    webrtc::VideoFrame decoded_image =
+        webrtc::VideoFrame::Builder()
+            .set_video_frame_buffer(buffer)
+            .set_timestamp_rtp((uint32_t)timestamp)
+            .build();
+    decode_complete_callback_->Decoded(decoded_image, absl::nullopt,
+                                       absl::nullopt);
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t NvCodecH264Decoder::RegisterDecodeCompleteCallback(
+    webrtc::DecodedImageCallback* callback) {
+  decode_complete_callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t NvCodecH264Decoder::Release() {
+  decoder_.reset();
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+const char* NvCodecH264Decoder::ImplementationName() const {
+  return "NvCodec H264";
+}
@@ -0,0 +1,39 @@
+#ifndef NVCODEC_H264_DECODER_H_
+#define NVCODEC_H264_DECODER_H_
+
+#include <memory>
+
+#include "api/video_codecs/video_decoder.h"
+
+#include "nvcodec_decoder_cuda.h"
+
+// NVDEC を使った H264 デコーダ。
+// デコードしたフレームは NV12 の NativeBuffer として出力するので、
+// 描画する側で I420 が必要になるまで色変換は行わない。
+class NvCodecH264Decoder : public webrtc::VideoDecoder {
+ public:
+  NvCodecH264Decoder();
+  ~NvCodecH264Decoder() override;
+
+  static bool IsSupported();
+
+  int32_t InitDecode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores) override;
+
+  int32_t Decode(const webrtc::EncodedImage& input_image,
+                 bool missing_frames,
+                 int64_t render_time_ms) override;
+
+  int32_t RegisterDecodeCompleteCallback(
+      webrtc::DecodedImageCallback* callback) override;
+
+  int32_t Release() override;
+
+  const char* ImplementationName() const override;
+
+ private:
+  std::unique_ptr<NvCodecDecoderCuda> decoder_;
+  webrtc::DecodedImageCallback* decode_complete_callback_ = nullptr;
+};
+
+#endif  // NVCODEC_H264_DECODER_H_
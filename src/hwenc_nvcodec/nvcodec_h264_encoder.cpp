@@ -3,8 +3,12 @@
 #include "libyuv.h"
 #include "modules/video_coding/codecs/h264/include/h264.h"
 #include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
 
+#include "rtc/low_latency_rate_control.h"
 #include "rtc/native_buffer.h"
+#include "rtc/simulcast_frame_buffer.h"
+#include "rtc/thread_placement.h"
 
 #ifdef __linux__
 #include "dyn/cuda.h"
@@ -14,17 +18,117 @@
 const int kLowH264QpThreshold = 34;
 const int kHighH264QpThreshold = 40;
 
-struct nal_entry {
-  size_t offset;
-  size_t size;
-};
+// 非同期モードで GPU への投入を待てるフレームの最大数。
+// これを超えた場合は古いフレームから捨てる。
+const size_t kMaxPendingEncodeFrames = 3;
 
 #ifdef _WIN32
 using Microsoft::WRL::ComPtr;
 #endif
 
-NvCodecH264Encoder::NvCodecH264Encoder(const cricket::VideoCodec& codec)
-    : bitrate_adjuster_(0.5, 0.95) {
+#ifdef __linux__
+namespace {
+
+// 解放したエンコーダのセッションと入力バッファを、次に作るエンコーダで使い回すためのプール。
+//
+// エンコーダを作るとセッションを開いて入力バッファを確保するので時間がかかる。
+// 解像度の変更で Release() と InitEncode() が呼ばれた場合や、接続し直した場合は、
+// 入力の形式が同じで最大解像度が足りているセッションを nvEncReconfigureEncoder で設定し直して使う。
+// GeForce は同時に開けるセッションの数が限られているので、保持するのは 1 つだけにする。
+// 全てのエンコーダが同じ CUDA コンテキストを使うので、どのインスタンスからでも使い回せる。
+class NvEncSessionPool {
+ public:
+  struct Key {
+    bool use_native;
+    // enablePTD は設定し直せないので、時間方向のレイヤーの有無が同じものだけを使う
+    bool layered;
+  };
+
+  // エンコーダのデストラクタから呼ばれるので、終了時にも破棄しない
+  static NvEncSessionPool& Instance() {
+    static NvEncSessionPool* pool = new NvEncSessionPool();
+    return *pool;
+  }
+
+  // width x height 以上の最大解像度を持つセッションがあれば取り出す
+  std::unique_ptr<NvEncoder> Take(const Key& key,
+                                  uint32_t width,
+                                  uint32_t height) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->key.use_native == key.use_native &&
+          it->key.layered == key.layered &&
+          it->encoder->GetMaxEncodeWidth() >= width &&
+          it->encoder->GetMaxEncodeHeight() >= height) {
+        std::unique_ptr<NvEncoder> encoder = std::move(it->encoder);
+        entries_.erase(it);
+        return encoder;
+      }
+    }
+    return nullptr;
+  }
+
+  // EndEncode() 済みのエンコーダを預ける。溢れた古いものは破棄する
+  void Put(const Key& key, std::unique_ptr<NvEncoder> encoder) {
+    std::vector<std::unique_ptr<NvEncoder>> evicted;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries_.push_back(Entry{key, std::move(encoder)});
+      while (entries_.size() > kMaxEntries) {
+        evicted.push_back(std::move(entries_.front().encoder));
+        entries_.erase(entries_.begin());
+      }
+    }
+    for (auto& e : evicted) {
+      Destroy(std::move(e));
+    }
+  }
+
+  // 保持している全てのセッションを閉じる。閉じたものがあれば true を返す
+  bool Clear() {
+    std::vector<Entry> entries;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries.swap(entries_);
+    }
+    for (auto& e : entries) {
+      Destroy(std::move(e.encoder));
+    }
+    return !entries.empty();
+  }
+
+  static void Destroy(std::unique_ptr<NvEncoder> encoder) {
+    try {
+      encoder->DestroyEncoder();
+    } catch (const NVENCException& e) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
+    }
+  }
+
+ private:
+  struct Entry {
+    Key key;
+    std::unique_ptr<NvEncoder> encoder;
+  };
+  static const size_t kMaxEntries = 1;
+
+  std::mutex mutex_;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace
+#endif
+
+NvCodecH264Encoder::NvCodecH264Encoder(
+    const cricket::VideoCodec& codec,
+    bool async,
+    bool low_latency_rate_control,
+    KeyFrameThrottle::Settings key_frame_throttle,
+    int temporal_layers)
+    : HWVideoEncoder("NvCodec H264", key_frame_throttle),
+      async_(async),
+      low_latency_rate_control_(low_latency_rate_control),
+      temporal_layers_(temporal_layers) {
 #ifdef _WIN32
   ComPtr<IDXGIFactory1> idxgi_factory;
   RTC_CHECK(!FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1),
@@ -50,7 +154,9 @@ NvCodecH264Encoder::NvCodecH264Encoder(const cricket::VideoCodec& codec)
 #endif
 }
 
-NvCodecH264Encoder::~NvCodecH264Encoder() {}
+NvCodecH264Encoder::~NvCodecH264Encoder() {
+  Release();
+}
 
 bool NvCodecH264Encoder::IsSupported() {
   try {
@@ -78,6 +184,11 @@ int32_t NvCodecH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
   RTC_DCHECK(codec_settings);
   RTC_DCHECK_EQ(codec_settings->codecType, webrtc::kVideoCodecH264);
 
+  // サイマルキャストは SimulcastEncoderAdapter に任せる
+  if (codec_settings->numberOfSimulcastStreams > 1) {
+    return WEBRTC_VIDEO_CODEC_ERR_SIMULCAST_PARAMETERS_NOT_SUPPORTED;
+  }
+
   int32_t release_ret = Release();
   if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
     return release_ret;
@@ -85,27 +196,23 @@ int32_t NvCodecH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
 
   width_ = codec_settings->width;
   height_ = codec_settings->height;
-  target_bitrate_bps_ = codec_settings->startBitrate * 1000;
+  SetTargetBitrateBps(codec_settings->startBitrate * 1000);
   max_bitrate_bps_ = codec_settings->maxBitrate * 1000;
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
   framerate_ = codec_settings->maxFramerate;
   mode_ = codec_settings->mode;
 
   RTC_LOG(LS_INFO) << "InitEncode " << target_bitrate_bps_ << "bit/sec";
 
-  // Initialize encoded image. Default buffer size: size of unencoded data.
-  encoded_image_._completeFrame = true;
-  encoded_image_._encodedWidth = 0;
-  encoded_image_._encodedHeight = 0;
-  encoded_image_.set_size(0);
-  encoded_image_.timing_.flags =
-      webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
-  encoded_image_.content_type_ =
-      (codec_settings->mode == webrtc::VideoCodecMode::kScreensharing)
-          ? webrtc::VideoContentType::SCREENSHARE
-          : webrtc::VideoContentType::UNSPECIFIED;
-
-  return InitNvEnc();
+  InitEncodedImage(*codec_settings);
+
+  int32_t ret = InitNvEnc();
+  if (ret != WEBRTC_VIDEO_CODEC_OK) {
+    return ret;
+  }
+  if (async_) {
+    StartThreads();
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
 }
 
 int32_t NvCodecH264Encoder::RegisterEncodeCompleteCallback(
@@ -116,14 +223,16 @@ int32_t NvCodecH264Encoder::RegisterEncodeCompleteCallback(
 }
 
 int32_t NvCodecH264Encoder::Release() {
-  return ReleaseNvEnc();
+  StopThreads();
+  return ReleaseNvEnc(true);
 }
 
 int32_t NvCodecH264Encoder::Encode(
     const webrtc::VideoFrame& frame,
     const std::vector<webrtc::VideoFrameType>* frame_types) {
   //RTC_LOG(LS_ERROR) << __FUNCTION__ << " Start";
-  if (!nv_encoder_) {
+  // 非同期モードでは nv_encoder_ はエンコードスレッドが管理している
+  if (async_ ? !encode_thread_ : !nv_encoder_) {
     return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
   }
   if (!callback_) {
@@ -133,37 +242,132 @@ int32_t NvCodecH264Encoder::Encode(
     return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
   }
 
-  if (frame.video_frame_buffer()->type() ==
-      webrtc::VideoFrameBuffer::Type::kNative) {
+  // 出力が止まっている場合は、PeerConnection はそのままでエンコーダだけを作り直す。
+  // 作り直したエンコーダは最初に IDR を出す
+  if (metrics_.IsStalled()) {
+    metrics_.OnStallReset();
+    // 止まったセッションは使い回さずに閉じる
+    StopThreads();
+    ReleaseNvEnc(false);
+    int32_t ret = InitNvEnc();
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+      return ret;
+    }
+    if (async_) {
+      StartThreads();
+    }
+  }
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> video_frame_buffer =
+      SimulcastFrameBuffer::SelectLayer(frame.video_frame_buffer(), width_,
+                                        height_);
+
+  bool send_key_frame = false;
+  if (frame_types != nullptr) {
+    // We only support a single stream.
+    RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
+    // Skip frame?
+    if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+      metrics_.OnSkipped();
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    // Force key frame?
+    send_key_frame =
+        (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+  }
+
+  FrameParams params(frame, width_, height_);
+  metrics_.OnSubmit(params.timestamp_rtp);
+
+  if (async_) {
+    EncodeTask task;
+    task.params = params;
+    task.buffer = video_frame_buffer;
+    bool dropped = false;
+    webrtc::EncodedImageCallback* callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (encode_tasks_.size() >= kMaxPendingEncodeFrames) {
+        // GPU が追いついていないので一番古いフレームを捨てる
+        pending_key_frame_ |= encode_tasks_.front().send_key_frame;
+        encode_tasks_.pop_front();
+        dropped = true;
+      }
+      task.send_key_frame = send_key_frame || pending_key_frame_;
+      pending_key_frame_ = false;
+      encode_tasks_.push_back(std::move(task));
+      callback = callback_;
+    }
+    encode_cond_.notify_one();
+    if (dropped) {
+      metrics_.OnDropped();
+      callback->OnDroppedFrame(
+          webrtc::EncodedImageCallback::DropReason::kDroppedByEncoder);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  TemporalLayers::Frame layer;
+  int32_t ret = EncodeBuffer(video_frame_buffer, send_key_frame, v_packet_,
+                             v_qp_, layer);
+  if (ret != WEBRTC_VIDEO_CODEC_OK) {
+    return ret;
+  }
+  return SendPackets(params, layer, v_packet_, v_qp_);
+}
+
+int32_t NvCodecH264Encoder::EncodeBuffer(
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> video_frame_buffer,
+    bool send_key_frame,
+    std::vector<std::vector<uint8_t>>& packets,
+    std::vector<uint32_t>& qps,
+    TemporalLayers::Frame& layer) {
+  if (video_frame_buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
     if (!use_native_) {
-      ReleaseNvEnc();
+      ReleaseNvEnc(true);
       use_native_ = true;
       InitNvEnc();
     }
   } else {
     if (use_native_) {
-      ReleaseNvEnc();
+      ReleaseNvEnc(true);
       use_native_ = false;
       InitNvEnc();
     }
   }
 
-  bool send_key_frame = false;
-
-  if (reconfigure_needed_) {
+  // SetRates() は別スレッドから呼ばれることがあるので、値をコピーしてから使う
+  bool reconfigure_needed;
+  uint32_t framerate;
+  uint32_t max_bitrate_bps;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reconfigure_needed = reconfigure_needed_;
+    framerate = framerate_;
+    max_bitrate_bps = max_bitrate_bps_;
+    reconfigure_needed_ = false;
+  }
+  const uint32_t bitrate_bps = bitrate_adjuster_.GetAdjustedBitrateBps();
+  if (reconfigure_needed && framerate == configured_framerate_ &&
+      (bitrate_bps == configured_bitrate_bps_ ||
+       (low_latency_rate_control_ &&
+        !LowLatencyRateControl::ShouldUpdateBitrate(configured_bitrate_bps_,
+                                                    bitrate_bps)))) {
+    reconfigure_needed = false;
+  }
+  if (reconfigure_needed) {
     NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {
         NV_ENC_RECONFIGURE_PARAMS_VER};
     NV_ENC_CONFIG encode_config = {NV_ENC_CONFIG_VER};
     reconfigure_params.reInitEncodeParams.encodeConfig = &encode_config;
     nv_encoder_->GetInitializeParams(&reconfigure_params.reInitEncodeParams);
 
-    reconfigure_params.reInitEncodeParams.frameRateNum = framerate_;
+    reconfigure_params.reInitEncodeParams.frameRateNum = framerate;
 
-    encode_config.rcParams.averageBitRate =
-        bitrate_adjuster_.GetAdjustedBitrateBps();
-    encode_config.rcParams.maxBitRate = max_bitrate_bps_;
+    encode_config.rcParams.averageBitRate = bitrate_bps;
+    encode_config.rcParams.maxBitRate = max_bitrate_bps;
     encode_config.rcParams.vbvBufferSize =
-        encode_config.rcParams.averageBitRate * 1 / framerate_;
+        encode_config.rcParams.averageBitRate * 1 / framerate;
     encode_config.rcParams.vbvInitialDelay =
         encode_config.rcParams.vbvBufferSize;
     try {
@@ -173,173 +377,307 @@ int32_t NvCodecH264Encoder::Encode(
       RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
       return WEBRTC_VIDEO_CODEC_ERROR;
     }
-
-    reconfigure_needed_ = false;
-  }
-
-  if (frame_types != nullptr) {
-    // We only support a single stream.
-    RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
-    // Skip frame?
-    if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
-      return WEBRTC_VIDEO_CODEC_OK;
-    }
-    // Force key frame?
-    send_key_frame =
-        (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+    configured_bitrate_bps_ = bitrate_bps;
+    configured_framerate_ = framerate;
   }
 
   NV_ENC_PIC_PARAMS pic_params = {NV_ENC_PIC_PARAMS_VER};
   pic_params.encodePicFlags = 0;
-  if (send_key_frame) {
+  bool key_frame = idr_needed_;
+  idr_needed_ = false;
+  switch (key_frame_throttle_.Update(send_key_frame, intra_refresh_enabled_,
+                                     rtc::TimeMillis())) {
+    case KeyFrameThrottle::Action::kKeyFrame:
+      key_frame = true;
+      break;
+    case KeyFrameThrottle::Action::kIntraRefresh:
+      pic_params.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt =
+          LowLatencyRateControl::IntraRefreshFrames(framerate);
+      metrics_.OnKeyFrameRequestCoalesced();
+      break;
+    case KeyFrameThrottle::Action::kNone:
+      if (send_key_frame) {
+        metrics_.OnKeyFrameRequestCoalesced();
+      }
+      break;
+  }
+  if (key_frame) {
     pic_params.encodePicFlags =
         NV_ENC_PIC_FLAG_FORCEINTRA | NV_ENC_PIC_FLAG_FORCEIDR;
   }
+  layer = temporal_layers_.NextFrame(key_frame);
+  if (temporal_layers_.num_layers() > 1) {
+    // enablePTD = 0 なので、全てのフレームでピクチャタイプを指定する。
+    // 参照されないフレームは DPB に入らないので、TL0 は直前の TL0 を参照する
+    pic_params.pictureType =
+        key_frame ? NV_ENC_PIC_TYPE_IDR : NV_ENC_PIC_TYPE_P;
+    pic_params.codecPicParams.h264PicParams.refPicFlag =
+        layer.reference ? 1 : 0;
+  }
   pic_params.inputWidth = width_;
   pic_params.inputHeight = height_;
 
-  v_packet_.clear();
-
 #ifdef _WIN32
   const NvEncInputFrame* input_frame = nv_encoder_->GetNextInputFrame();
   D3D11_MAPPED_SUBRESOURCE map;
-  id3d11_context_->Map(id3d11_texture_.Get(), D3D11CalcSubresource(0, 0, 1),
-                       D3D11_MAP_WRITE, 0, &map);
-  if (use_native_) {
-    const NativeBuffer* frame_buffer =
-        dynamic_cast<NativeBuffer*>(frame.video_frame_buffer().get());
-    for (int y = 0; y < frame_buffer->height(); y++) {
-      memcpy((uint8_t*)map.pData + y * map.RowPitch,
-             frame_buffer->Data() + frame_buffer->raw_width() * y,
-             frame_buffer->raw_width());
-    }
+  ID3D11Texture2D* staging_texture = MapStagingTexture(&map);
+  if (staging_texture == nullptr) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  uint8_t* dst_y = static_cast<uint8_t*>(map.pData);
+  uint8_t* dst_uv = dst_y + height_ * map.RowPitch;
+  const NativeBuffer* native_buffer =
+      video_frame_buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(video_frame_buffer.get())
+          : nullptr;
+  if (native_buffer != nullptr &&
+      native_buffer->VideoType() == webrtc::VideoType::kNV12 &&
+      native_buffer->raw_width() == static_cast<int>(width_) &&
+      native_buffer->raw_height() == static_cast<int>(height_)) {
+    // NV12 は変換せずにプレーンをそのまま書く
+    libyuv::CopyPlane(native_buffer->DataY(), native_buffer->StrideY(), dst_y,
+                      map.RowPitch, width_, height_);
+    libyuv::CopyPlane(native_buffer->DataUV(), native_buffer->StrideUV(),
+                      dst_uv, map.RowPitch, width_, (height_ + 1) / 2);
+    SetQpDeltaMap(&pic_params, native_buffer->DataY(),
+                  native_buffer->StrideY(), native_buffer->raw_width(),
+                  native_buffer->raw_height());
   } else {
     rtc::scoped_refptr<const webrtc::I420BufferInterface> frame_buffer =
-        frame.video_frame_buffer()->ToI420();
+        video_frame_buffer->ToI420();
     libyuv::I420ToNV12(
         frame_buffer->DataY(), frame_buffer->StrideY(), frame_buffer->DataU(),
         frame_buffer->StrideU(), frame_buffer->DataV(), frame_buffer->StrideV(),
-        (uint8_t*)map.pData, map.RowPitch,
-        ((uint8_t*)map.pData + height_ * map.RowPitch), map.RowPitch,
-        frame_buffer->width(), frame_buffer->height());
+        dst_y, map.RowPitch, dst_uv, map.RowPitch, frame_buffer->width(),
+        frame_buffer->height());
+    SetQpDeltaMap(&pic_params, frame_buffer->DataY(), frame_buffer->StrideY(),
+                  frame_buffer->width(), frame_buffer->height());
   }
-  id3d11_context_->Unmap(id3d11_texture_.Get(), D3D11CalcSubresource(0, 0, 1));
-  ID3D11Texture2D* nv11_texture =
+  id3d11_context_->Unmap(staging_texture, D3D11CalcSubresource(0, 0, 1));
+  // コピーは GPU のキューに積むだけで待たない。
+  // このテクスチャを次に Map する時に、コピーが終わっていなければ別のテクスチャを使う
+  ID3D11Texture2D* nv12_texture =
       reinterpret_cast<ID3D11Texture2D*>(input_frame->inputPtr);
-  id3d11_context_->CopyResource(nv11_texture, id3d11_texture_.Get());
+  id3d11_context_->CopyResource(nv12_texture, staging_texture);
 #endif
 #ifdef __linux__
-  if (frame.video_frame_buffer()->type() ==
-      webrtc::VideoFrameBuffer::Type::kNative) {
+  if (video_frame_buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
     NativeBuffer* native_buffer =
-        dynamic_cast<NativeBuffer*>(frame.video_frame_buffer().get());
-    cuda_->CopyNative(nv_encoder_.get(), native_buffer->Data(),
-                      native_buffer->length(), native_buffer->width(),
-                      native_buffer->height());
+        dynamic_cast<NativeBuffer*>(video_frame_buffer.get());
+    // 縮小は SetScaledSize で指定されたエンコーダの解像度に合わせて GPU 上で行う
+    if (native_buffer->VideoType() == webrtc::VideoType::kNV12) {
+      cuda_->CopyNV12(nv_encoder_.get(), native_buffer->DataY(),
+                      native_buffer->raw_width(), native_buffer->raw_height());
+      SetQpDeltaMap(&pic_params, native_buffer->DataY(),
+                    native_buffer->StrideY(), native_buffer->raw_width(),
+                    native_buffer->raw_height());
+    } else {
+      // MJPEG などは GPU 上で変換するので、動きは検出しない
+      cuda_->CopyNative(nv_encoder_.get(), native_buffer->Data(),
+                        native_buffer->length());
+      SetQpDeltaMap(&pic_params, nullptr, 0, 0, 0);
+    }
   } else {
     rtc::scoped_refptr<const webrtc::I420BufferInterface> frame_buffer =
-        frame.video_frame_buffer()->ToI420();
+        video_frame_buffer->ToI420();
     cuda_->Copy(nv_encoder_.get(), frame_buffer->DataY(), frame_buffer->width(),
                 frame_buffer->height());
+    SetQpDeltaMap(&pic_params, frame_buffer->DataY(), frame_buffer->StrideY(),
+                  frame_buffer->width(), frame_buffer->height());
   }
 #endif
 
   try {
-    nv_encoder_->EncodeFrame(v_packet_, &pic_params);
+    nv_encoder_->EncodeFrame(packets, &pic_params);
+    // QP はビットストリームを読まずに、エンコーダが返す値を使う
+    qps = nv_encoder_->GetPacketAverageQP();
   } catch (const NVENCException& e) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
     return WEBRTC_VIDEO_CODEC_ERROR;
   }
 
-  for (std::vector<uint8_t>& packet : v_packet_) {
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+#ifdef _WIN32
+ID3D11Texture2D* NvCodecH264Encoder::MapStagingTexture(
+    D3D11_MAPPED_SUBRESOURCE* map) {
+  // GPU がまだコピーに使っているテクスチャは飛ばす
+  for (int i = 0; i < kNumStagingTextures; i++) {
+    const int index = (next_staging_texture_ + i) % kNumStagingTextures;
+    ID3D11Texture2D* texture = staging_textures_[index].Get();
+    HRESULT hr = id3d11_context_->Map(texture, D3D11CalcSubresource(0, 0, 1),
+                                      D3D11_MAP_WRITE,
+                                      D3D11_MAP_FLAG_DO_NOT_WAIT, map);
+    if (hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+      continue;
+    }
+    if (FAILED(hr)) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Map failed: hr=" << hr;
+      return nullptr;
+    }
+    next_staging_texture_ = (index + 1) % kNumStagingTextures;
+    return texture;
+  }
+  // 全て使われている場合は、一番古いものが空くのを待つ
+  const int index = next_staging_texture_;
+  ID3D11Texture2D* texture = staging_textures_[index].Get();
+  HRESULT hr = id3d11_context_->Map(texture, D3D11CalcSubresource(0, 0, 1),
+                                    D3D11_MAP_WRITE, 0, map);
+  if (FAILED(hr)) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Map failed: hr=" << hr;
+    return nullptr;
+  }
+  next_staging_texture_ = (index + 1) % kNumStagingTextures;
+  return texture;
+}
+#endif
+
+void NvCodecH264Encoder::SetQpDeltaMap(NV_ENC_PIC_PARAMS* pic_params,
+                                       const uint8_t* y,
+                                       int stride_y,
+                                       int y_width,
+                                       int y_height) {
+  if (!roi_enabled_ ||
+      !roi_map_.Update(width_, height_, y, stride_y, y_width, y_height)) {
+    return;
+  }
+  // マップは EncodeFrame() の間だけ参照され、書き換えられることはない
+  const std::vector<int8_t>& map = roi_map_.qp_delta_map();
+  pic_params->qpDeltaMap = const_cast<int8_t*>(map.data());
+  pic_params->qpDeltaMapSize = static_cast<uint32_t>(map.size());
+}
+
+int32_t NvCodecH264Encoder::SendPackets(
+    const FrameParams& params,
+    const TemporalLayers::Frame& layer,
+    std::vector<std::vector<uint8_t>>& packets,
+    const std::vector<uint32_t>& qps) {
+  for (size_t n = 0; n < packets.size(); n++) {
+    std::vector<uint8_t>& packet = packets[n];
     encoded_image_.set_buffer(packet.data(), packet.size());
-    encoded_image_.set_size(packet.size());
+    SetEncodedImageParams(params);
     encoded_image_._completeFrame = true;
-    encoded_image_._encodedWidth = width_;
-    encoded_image_._encodedHeight = height_;
     encoded_image_.content_type_ =
         (mode_ == webrtc::VideoCodecMode::kScreensharing)
             ? webrtc::VideoContentType::SCREENSHARE
             : webrtc::VideoContentType::UNSPECIFIED;
     encoded_image_.timing_.flags = webrtc::VideoSendTiming::kInvalid;
-    encoded_image_.SetTimestamp(frame.timestamp());
-    encoded_image_.ntp_time_ms_ = frame.ntp_time_ms();
-    encoded_image_.capture_time_ms_ = frame.render_time_ms();
-    encoded_image_.rotation_ = frame.rotation();
-    encoded_image_.SetColorSpace(frame.color_space());
-    encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameDelta;
-    //RTC_LOG(LS_ERROR) << __FUNCTION__ << " packet.size():" << packet.size();
-
-    //printf("###########");
-    uint8_t zero_count = 0;
-    size_t nal_start_idx = 0;
-    std::vector<nal_entry> nals;
-    for (size_t i = 0; i < packet.size(); i++) {
-      uint8_t data = packet.data()[i];
-      //if (i < 100) printf(" %02x", data);
-      if ((i != 0) && (i == nal_start_idx)) {
-        //printf("-header");
-        if ((data & 0x1F) == 0x05) {
-          //printf("-IDR(%02x)", (data & 0x1F));
-          encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameKey;
-        }
-      }
-      if (data == 0x01 && zero_count >= 2) {
-        if (nal_start_idx != 0) {
-          nals.push_back({nal_start_idx,
-                          i - nal_start_idx + 1 - (zero_count == 2 ? 3 : 4)});
-          //printf(" nal_size: %d ", i - nal_start_idx + 1 - (zero_count == 2 ? 3 : 4));
-        }
-        nal_start_idx = i + 1;
-        //printf(" nal_start_idx: %d\n", nal_start_idx);
-      }
-      if (data == 0x00) {
-        zero_count++;
-      } else {
-        zero_count = 0;
-      }
-    }
-    if (nal_start_idx != 0) {
-      nals.push_back({nal_start_idx, packet.size() - nal_start_idx});
-      //printf(" nal_size: %d packet.size(): %d \n", packet.size() - nal_start_idx , packet.size());
-    }
-    //printf("\n");
-    //nals.push_back({4, packet.size() - 4});
-
-    //RTC_LOG(LS_ERROR) << __FUNCTION__ << "  nals.size():" << nals.size();
 
+    // QP はエンコーダがパケット毎に返す平均の値を使う
     webrtc::RTPFragmentationHeader frag_header;
-    frag_header.VerifyAndAllocateFragmentationHeader(nals.size());
-    for (size_t i = 0; i < nals.size(); i++) {
-      frag_header.fragmentationOffset[i] = nals[i].offset;
-      frag_header.fragmentationLength[i] = nals[i].size;
-      //RTC_LOG(LS_ERROR) << __FUNCTION__ << " i:" << i << " offset:" << nals[i].offset << " size:" << nals[i].size;
-    }
-
-    webrtc::CodecSpecificInfo codec_specific;
-    codec_specific.codecType = webrtc::kVideoCodecH264;
-    codec_specific.codecSpecific.H264.packetization_mode =
-        webrtc::H264PacketizationMode::NonInterleaved;
-
-    h264_bitstream_parser_.ParseBitstream(packet.data(), packet.size());
-    h264_bitstream_parser_.GetLastSliceQp(&encoded_image_.qp_);
-
-    webrtc::EncodedImageCallback::Result result = callback_->OnEncodedImage(
-        encoded_image_, &codec_specific, &frag_header);
-    if (result.error != webrtc::EncodedImageCallback::Result::OK) {
-      RTC_LOG(LS_ERROR) << __FUNCTION__
-                        << " OnEncodedImage failed error:" << result.error;
-      return WEBRTC_VIDEO_CODEC_ERROR;
+    webrtc::CodecSpecificInfo codec_specific = PrepareH264Frame(
+        packet.data(), packet.size(),
+        n < qps.size() ? static_cast<int>(qps[n]) : -1, &frag_header);
+    temporal_layers_.SetCodecSpecific(
+        layer,
+        encoded_image_._frameType == webrtc::VideoFrameType::kVideoFrameKey,
+        &codec_specific.codecSpecific.H264);
+
+    int32_t ret = SendEncodedImage(codec_specific, &frag_header);
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+      return ret;
     }
-    bitrate_adjuster_.Update(packet.size());
   }
 
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
+void NvCodecH264Encoder::StartThreads() {
+  quit_ = false;
+  encode_thread_.reset(new rtc::PlatformThread(
+      NvCodecH264Encoder::EncodeThread, this, "NvCodecEncode",
+      rtc::kHighPriority));
+  output_thread_.reset(new rtc::PlatformThread(
+      NvCodecH264Encoder::OutputThread, this, "NvCodecOutput",
+      rtc::kHighPriority));
+  encode_thread_->Start();
+  output_thread_->Start();
+}
+
+void NvCodecH264Encoder::StopThreads() {
+  if (!encode_thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  encode_cond_.notify_all();
+  output_cond_.notify_all();
+  encode_thread_->Stop();
+  output_thread_->Stop();
+  encode_thread_.reset();
+  output_thread_.reset();
+  encode_tasks_.clear();
+  output_tasks_.clear();
+  pending_key_frame_ = false;
+}
+
+void NvCodecH264Encoder::EncodeThread(void* obj) {
+  ThreadPlacement::Instance().Apply("encoder");
+  static_cast<NvCodecH264Encoder*>(obj)->EncodeLoop();
+}
+
+void NvCodecH264Encoder::OutputThread(void* obj) {
+  ThreadPlacement::Instance().Apply("encoder");
+  static_cast<NvCodecH264Encoder*>(obj)->OutputLoop();
+}
+
+void NvCodecH264Encoder::EncodeLoop() {
+  while (true) {
+    EncodeTask task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      encode_cond_.wait(lock,
+                        [this]() { return quit_ || !encode_tasks_.empty(); });
+      if (quit_) {
+        return;
+      }
+      task = std::move(encode_tasks_.front());
+      encode_tasks_.pop_front();
+    }
+
+    // GPU の完了を待つのはこのスレッドだけなので、Encode() の呼び出し元はブロックされない
+    OutputTask output;
+    output.params = task.params;
+    if (EncodeBuffer(task.buffer, task.send_key_frame, output.packets,
+                     output.qps, output.layer) != WEBRTC_VIDEO_CODEC_OK) {
+      continue;
+    }
+    // キャプチャバッファはすぐに返す
+    task.buffer = nullptr;
+    if (output.packets.empty()) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      output_tasks_.push_back(std::move(output));
+    }
+    output_cond_.notify_one();
+  }
+}
+
+void NvCodecH264Encoder::OutputLoop() {
+  while (true) {
+    OutputTask task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      output_cond_.wait(lock,
+                        [this]() { return quit_ || !output_tasks_.empty(); });
+      if (quit_) {
+        return;
+      }
+      task = std::move(output_tasks_.front());
+      output_tasks_.pop_front();
+    }
+    SendPackets(task.params, task.layer, task.packets, task.qps);
+  }
+}
+
 void NvCodecH264Encoder::SetRates(
     const webrtc::VideoEncoder::RateControlParameters& parameters) {
-  if (!nv_encoder_) {
+  if (async_ ? !encode_thread_ : !nv_encoder_) {
     RTC_LOG(LS_WARNING) << "SetRates() while uninitialized.";
     return;
   }
@@ -351,14 +689,14 @@ void NvCodecH264Encoder::SetRates(
 
   uint32_t new_framerate = (uint32_t)parameters.framerate_fps;
   uint32_t new_bitrate = parameters.bitrate.get_sum_bps();
+  std::lock_guard<std::mutex> lock(mutex_);
   RTC_LOG(INFO) << __FUNCTION__ << " framerate_:" << framerate_
                 << " new_framerate: " << new_framerate
                 << " target_bitrate_bps_:" << target_bitrate_bps_
                 << " new_bitrate:" << new_bitrate
                 << " max_bitrate_bps_:" << max_bitrate_bps_;
   framerate_ = new_framerate;
-  target_bitrate_bps_ = new_bitrate;
-  bitrate_adjuster_.SetTargetBitrateBps(target_bitrate_bps_);
+  SetTargetBitrateBps(new_bitrate);
   reconfigure_needed_ = true;
 }
 
@@ -370,17 +708,16 @@ webrtc::VideoEncoder::EncoderInfo NvCodecH264Encoder::GetEncoderInfo() const {
       kLowH264QpThreshold, kHighH264QpThreshold);
   info.is_hardware_accelerated = true;
   info.has_internal_source = false;
+  temporal_layers_.SetFpsAllocation(&info);
   return info;
 }
 
 int32_t NvCodecH264Encoder::InitNvEnc() {
 #ifdef _WIN32
+  // NativeBuffer の NV12 はそのまま書き、それ以外は NV12 に変換して書くので、
+  // 入力は常に NV12 にする
   DXGI_FORMAT dxgi_format = DXGI_FORMAT_NV12;
   NV_ENC_BUFFER_FORMAT nvenc_format = NV_ENC_BUFFER_FORMAT_NV12;
-  if (use_native_) {
-    dxgi_format = DXGI_FORMAT_B8G8R8A8_UNORM;
-    nvenc_format = NV_ENC_BUFFER_FORMAT_ARGB;
-  }
   D3D11_TEXTURE2D_DESC desc;
   ZeroMemory(&desc, sizeof(D3D11_TEXTURE2D_DESC));
   desc.Width = width_;
@@ -392,7 +729,14 @@ int32_t NvCodecH264Encoder::InitNvEnc() {
   desc.Usage = D3D11_USAGE_STAGING;
   desc.BindFlags = 0;
   desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-  id3d11_device_->CreateTexture2D(&desc, NULL, id3d11_texture_.GetAddressOf());
+  for (int i = 0; i < kNumStagingTextures; i++) {
+    if (FAILED(id3d11_device_->CreateTexture2D(
+            &desc, NULL, staging_textures_[i].ReleaseAndGetAddressOf()))) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": CreateTexture2D failed";
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+  }
+  next_staging_texture_ = 0;
 
   // Driver が古いとかに気づくのはココ
   try {
@@ -405,14 +749,37 @@ int32_t NvCodecH264Encoder::InitNvEnc() {
 #endif
 
 #ifdef __linux__
+  const NvEncSessionPool::Key key = {use_native_,
+                                     temporal_layers_.num_layers() > 1};
+  nv_encoder_ = NvEncSessionPool::Instance().Take(key, width_, height_);
+  if (nv_encoder_) {
+    if (ConfigureNvEnc(true) == WEBRTC_VIDEO_CODEC_OK) {
+      RTC_LOG(LS_INFO) << __FUNCTION__ << " Reused the encoder session";
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    NvEncSessionPool::Destroy(std::move(nv_encoder_));
+  }
   try {
     nv_encoder_.reset(cuda_->CreateNvEncoder(width_, height_, use_native_));
   } catch (const NVENCException& e) {
-    RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
-    return WEBRTC_VIDEO_CODEC_ERROR;
+    // セッションの数の上限に達しているかもしれないので、プールのセッションを閉じてやり直す
+    if (!NvEncSessionPool::Instance().Clear()) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    try {
+      nv_encoder_.reset(cuda_->CreateNvEncoder(width_, height_, use_native_));
+    } catch (const NVENCException& e) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
   }
 #endif
 
+  return ConfigureNvEnc(false);
+}
+
+int32_t NvCodecH264Encoder::ConfigureNvEnc(bool reuse) {
   initialize_params_ = {NV_ENC_INITIALIZE_PARAMS_VER};
   NV_ENC_CONFIG encode_config = {NV_ENC_CONFIG_VER};
   initialize_params_.encodeConfig = &encode_config;
@@ -422,10 +789,22 @@ int32_t NvCodecH264Encoder::InitNvEnc() {
         NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID);
 
     //initialize_params_.enablePTD = 1;
+    // 時間方向のレイヤーを作る場合は、ピクチャタイプと参照するかどうかをフレーム毎に指定する
+    const bool layered = temporal_layers_.num_layers() > 1;
+    if (layered) {
+      initialize_params_.enablePTD = 0;
+    }
     initialize_params_.frameRateDen = 1;
     initialize_params_.frameRateNum = framerate_;
-    initialize_params_.maxEncodeWidth = width_;
-    initialize_params_.maxEncodeHeight = height_;
+    initialize_params_.encodeWidth = width_;
+    initialize_params_.encodeHeight = height_;
+    initialize_params_.darWidth = width_;
+    initialize_params_.darHeight = height_;
+    // 使い回す場合は、入力バッファを確保した時の最大解像度のまま設定し直す
+    initialize_params_.maxEncodeWidth =
+        reuse ? nv_encoder_->GetMaxEncodeWidth() : width_;
+    initialize_params_.maxEncodeHeight =
+        reuse ? nv_encoder_->GetMaxEncodeHeight() : height_;
 
     //encode_config.profileGUID = NV_ENC_H264_PROFILE_BASELINE_GUID;
     encode_config.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
@@ -441,6 +820,12 @@ int32_t NvCodecH264Encoder::InitNvEnc() {
     encode_config.gopLength = NVENC_INFINITE_GOPLENGTH;
     encode_config.frameIntervalP = 1;
     encode_config.rcParams.enableAQ = 1;
+    // ROI を使う場合は QP の差分をこちらで指定するので、AQ による調整は止める
+    roi_enabled_ = RoiHints::Instance().enabled();
+    if (roi_enabled_) {
+      encode_config.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+      encode_config.rcParams.enableAQ = 0;
+    }
 
     //encode_config.encodeCodecConfig.h264Config.outputAUD = 1;
     //encode_config.encodeCodecConfig.h264Config.level = NV_ENC_LEVEL_H264_31;
@@ -450,8 +835,48 @@ int32_t NvCodecH264Encoder::InitNvEnc() {
     encode_config.encodeCodecConfig.h264Config.repeatSPSPPS = 1;
     encode_config.encodeCodecConfig.h264Config.sliceMode = 0;
     encode_config.encodeCodecConfig.h264Config.sliceModeData = 0;
+    // 低遅延のレート制御では、パケットが失われた後も IDR を待たずにイントラリフレッシュで回復させる。
+    // キーフレームの要求にイントラリフレッシュで応えるだけの場合は、定期的には行わない
+    // 参照されないフレームでリフレッシュした部分は後に残らないので、レイヤーを作る場合は使わない
+    intra_refresh_enabled_ = false;
+    if (layered) {
+      if (low_latency_rate_control_ ||
+          key_frame_throttle_.settings().intra_refresh) {
+        RTC_LOG(LS_WARNING)
+            << __FUNCTION__ << " Intra refresh is off with temporal layers";
+      }
+    } else if (low_latency_rate_control_ ||
+               key_frame_throttle_.settings().intra_refresh) {
+      if (nv_encoder_->GetCapabilityValue(
+              NV_ENC_CODEC_H264_GUID, NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+        const uint32_t frames =
+            LowLatencyRateControl::IntraRefreshFrames(framerate_);
+        encode_config.encodeCodecConfig.h264Config.enableIntraRefresh = 1;
+        encode_config.encodeCodecConfig.h264Config.intraRefreshPeriod =
+            low_latency_rate_control_ ? frames * 2 : NVENC_INFINITE_GOPLENGTH;
+        encode_config.encodeCodecConfig.h264Config.intraRefreshCnt = frames;
+        intra_refresh_enabled_ = true;
+      } else {
+        RTC_LOG(LS_WARNING) << __FUNCTION__
+                            << " Intra refresh is not supported";
+      }
+    }
 
-    nv_encoder_->CreateEncoder(&initialize_params_);
+    if (reuse) {
+      NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {
+          NV_ENC_RECONFIGURE_PARAMS_VER};
+      reconfigure_params.reInitEncodeParams = initialize_params_;
+      reconfigure_params.resetEncoder = 1;
+      reconfigure_params.forceIDR = 1;
+      nv_encoder_->Reconfigure(&reconfigure_params);
+    } else {
+      nv_encoder_->CreateEncoder(&initialize_params_);
+    }
+    configured_bitrate_bps_ = target_bitrate_bps_;
+    configured_framerate_ = framerate_;
+    // 作り直したエンコーダは最初に IDR を出す
+    key_frame_throttle_.OnKeyFrame(rtc::TimeMillis());
+    idr_needed_ = layered;
 
     RTC_LOG(INFO) << __FUNCTION__ << " framerate_:" << framerate_
                   << " bitrate_bps_:" << target_bitrate_bps_
@@ -466,17 +891,33 @@ int32_t NvCodecH264Encoder::InitNvEnc() {
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
-int32_t NvCodecH264Encoder::ReleaseNvEnc() {
+int32_t NvCodecH264Encoder::ReleaseNvEnc(bool reuse) {
   if (nv_encoder_) {
     try {
       nv_encoder_->EndEncode(v_packet_);
-      nv_encoder_->DestroyEncoder();
     } catch (const NVENCException& e) {
       RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
+      reuse = false;
+    }
+#ifdef __linux__
+    if (reuse) {
+      const NvEncSessionPool::Key key = {use_native_,
+                                         temporal_layers_.num_layers() > 1};
+      NvEncSessionPool::Instance().Put(key, std::move(nv_encoder_));
+    }
+#endif
+    if (nv_encoder_) {
+      try {
+        nv_encoder_->DestroyEncoder();
+      } catch (const NVENCException& e) {
+        RTC_LOG(LS_ERROR) << __FUNCTION__ << e.what();
+      }
     }
     nv_encoder_ = nullptr;
 #ifdef _WIN32
-    id3d11_texture_.Reset();
+    for (int i = 0; i < kNumStagingTextures; i++) {
+      staging_textures_[i].Reset();
+    }
 #endif
   }
   return WEBRTC_VIDEO_CODEC_OK;
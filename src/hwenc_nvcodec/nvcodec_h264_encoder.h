@@ -7,15 +7,20 @@
 #endif
 
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <queue>
 
 #include "api/video_codecs/video_encoder.h"
-#include "common_video/h264/h264_bitstream_parser.h"
-#include "common_video/include/bitrate_adjuster.h"
 #include "modules/video_coding/codecs/h264/include/h264.h"
+#include "rtc/hw_video_encoder.h"
+#include "rtc/key_frame_throttle.h"
+#include "rtc/roi_map.h"
+#include "rtc/temporal_layers.h"
 #include "rtc_base/critical_section.h"
+#include "rtc_base/platform_thread.h"
 
 // NvCodec
 #ifdef _WIN32
@@ -25,9 +30,22 @@
 #include "nvcodec_h264_encoder_cuda.h"
 #endif
 
-class NvCodecH264Encoder : public webrtc::VideoEncoder {
+class NvCodecH264Encoder : public HWVideoEncoder {
  public:
-  explicit NvCodecH264Encoder(const cricket::VideoCodec& codec);
+  // async が true の場合、GPU へのフレームの投入とコールバックへの出力を
+  // それぞれ別スレッドで行い、Encode() は GPU の完了を待たずに戻る。
+  // low_latency_rate_control が true の場合、イントラリフレッシュを使い、
+  // ビットレートの小さな変化では設定し直さない。LowLatencyRateControl を参照。
+  // key_frame_throttle でキーフレームの要求をまとめる。intra_refresh の場合は、
+  // 間隔の中で来た要求に forceIntraRefreshWithFrameCnt で応える
+  // temporal_layers が 2 以上の場合、ピクチャタイプと参照するかどうかをフレーム毎に指定して
+  // 時間方向のレイヤーを作る。この場合はイントラリフレッシュを使わない
+  explicit NvCodecH264Encoder(const cricket::VideoCodec& codec,
+                              bool async = false,
+                              bool low_latency_rate_control = false,
+                              KeyFrameThrottle::Settings key_frame_throttle =
+                                  KeyFrameThrottle::Settings(),
+                              int temporal_layers = 1);
   ~NvCodecH264Encoder() override;
 
   static bool IsSupported();
@@ -46,21 +64,73 @@ class NvCodecH264Encoder : public webrtc::VideoEncoder {
   webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
 
  private:
+  struct EncodeTask {
+    FrameParams params;
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+    bool send_key_frame = false;
+  };
+  struct OutputTask {
+    FrameParams params;
+    TemporalLayers::Frame layer;
+    std::vector<std::vector<uint8_t>> packets;
+    std::vector<uint32_t> qps;
+  };
+
+  // フレームを GPU に転送してエンコードし、出来上がったパケットを packets に、
+  // それぞれのパケットの平均の QP を qps に、そのフレームの時間方向のレイヤーを layer に入れる
+  int32_t EncodeBuffer(
+      rtc::scoped_refptr<webrtc::VideoFrameBuffer> video_frame_buffer,
+      bool send_key_frame,
+      std::vector<std::vector<uint8_t>>& packets,
+      std::vector<uint32_t>& qps,
+      TemporalLayers::Frame& layer);
+  // ROI が有効なら、y から動きを検出して pic_params に QP の差分のマップを設定する。
+  // y が nullptr の場合は指定された領域だけを使う
+  void SetQpDeltaMap(NV_ENC_PIC_PARAMS* pic_params,
+                     const uint8_t* y,
+                     int stride_y,
+                     int y_width,
+                     int y_height);
+  // パケットを EncodedImage にしてコールバックに渡す
+  int32_t SendPackets(const FrameParams& params,
+                      const TemporalLayers::Frame& layer,
+                      std::vector<std::vector<uint8_t>>& packets,
+                      const std::vector<uint32_t>& qps);
+
+  void StartThreads();
+  void StopThreads();
+  static void EncodeThread(void* obj);
+  static void OutputThread(void* obj);
+  void EncodeLoop();
+  void OutputLoop();
+
+  const bool async_;
+  const bool low_latency_rate_control_;
+  // SetRates で設定する値と、非同期モードのキューを保護する
   std::mutex mutex_;
-  webrtc::EncodedImageCallback* callback_ = nullptr;
-  webrtc::BitrateAdjuster bitrate_adjuster_ =
-      webrtc::BitrateAdjuster(0.5, 0.95);
-  uint32_t target_bitrate_bps_ = 0;
   uint32_t max_bitrate_bps_ = 0;
 
+  // Linux では、プールに同じ形式のセッションがあれば作らずに設定し直して使う
   int32_t InitNvEnc();
-  int32_t ReleaseNvEnc();
-  webrtc::H264BitstreamParser h264_bitstream_parser_;
+  // 作成済みの nv_encoder_ に initialize_params_ を設定する。
+  // reuse が true の場合は nvEncReconfigureEncoder で設定し直す
+  int32_t ConfigureNvEnc(bool reuse);
+  // reuse が true の場合、Linux ではセッションを閉じずにプールに預ける
+  int32_t ReleaseNvEnc(bool reuse);
+#ifdef _WIN32
+  // GPU が使っていない staging テクスチャを選んで Map する
+  ID3D11Texture2D* MapStagingTexture(D3D11_MAPPED_SUBRESOURCE* map);
+#endif
 
 #ifdef _WIN32
   Microsoft::WRL::ComPtr<ID3D11Device> id3d11_device_;
   Microsoft::WRL::ComPtr<ID3D11DeviceContext> id3d11_context_;
-  Microsoft::WRL::ComPtr<ID3D11Texture2D> id3d11_texture_;
+  // CPU から書き込む staging テクスチャのリング。
+  // GPU が前のフレームをコピーしている間に、次のフレームを別のテクスチャに書ける
+  static const int kNumStagingTextures = 3;
+  Microsoft::WRL::ComPtr<ID3D11Texture2D>
+      staging_textures_[kNumStagingTextures];
+  int next_staging_texture_ = 0;
   std::unique_ptr<NvEncoderD3D11> nv_encoder_;
 #endif
 #ifdef __linux__
@@ -68,6 +138,14 @@ class NvCodecH264Encoder : public webrtc::VideoEncoder {
   std::unique_ptr<NvEncoder> nv_encoder_;
 #endif
   bool reconfigure_needed_ = false;
+  // エンコーダに設定している値。エンコードするスレッドだけが触る
+  uint32_t configured_bitrate_bps_ = 0;
+  uint32_t configured_framerate_ = 0;
+  // イントラリフレッシュを有効にしてエンコーダを作った
+  bool intra_refresh_enabled_ = false;
+  TemporalLayers temporal_layers_;
+  // ピクチャタイプを自分で指定する場合、作り直したエンコーダの最初のフレームを IDR にする
+  bool idr_needed_ = false;
   bool use_native_ = false;
   uint32_t width_ = 0;
   uint32_t height_ = 0;
@@ -75,7 +153,20 @@ class NvCodecH264Encoder : public webrtc::VideoEncoder {
   webrtc::VideoCodecMode mode_ = webrtc::VideoCodecMode::kRealtimeVideo;
   NV_ENC_INITIALIZE_PARAMS initialize_params_;
   std::vector<std::vector<uint8_t>> v_packet_;
-  webrtc::EncodedImage encoded_image_;
+  std::vector<uint32_t> v_qp_;
+  bool roi_enabled_ = false;
+  RoiMap roi_map_;
+
+  // 以下は非同期モードでのみ利用する
+  std::condition_variable encode_cond_;
+  std::condition_variable output_cond_;
+  std::deque<EncodeTask> encode_tasks_;
+  std::deque<OutputTask> output_tasks_;
+  bool quit_ = false;
+  // キューが溢れて捨てたフレームがキーフレーム要求だった場合、次のフレームに引き継ぐ
+  bool pending_key_frame_ = false;
+  std::unique_ptr<rtc::PlatformThread> encode_thread_;
+  std::unique_ptr<rtc::PlatformThread> output_thread_;
 };
 
 #endif  // NVCODEC_H264_ENCODER_H_
@@ -112,19 +112,92 @@ class NvCodecH264EncoderCudaImpl {
             const void* ptr,
             int width,
             int height);
-  void CopyNative(NvEncoder* nv_encoder,
-                  const void* ptr,
-                  int size,
-                  int width,
-                  int height);
+  void CopyNV12(NvEncoder* nv_encoder,
+                const void* ptr,
+                int width,
+                int height);
+  void CopyNative(NvEncoder* nv_encoder, const void* ptr, int size);
   NvEncoder* CreateNvEncoder(int width, int height, bool use_native);
 
  private:
+  // デバイスメモリ上の NV12 をエンコーダの入力フレームに縮小しながらコピーする
+  void ScaleToInputFrame(NvEncoder* nv_encoder,
+                         CUdeviceptr src,
+                         int src_pitch,
+                         int src_width,
+                         int src_height);
+
   NvDecoder* nv_decoder_ = nullptr;
-  CUdevice cu_device_;
+  // SharedCudaContext() のコンテキスト。このクラスでは破棄しない
   CUcontext cu_context_;
+  // ホストから転送した NV12 を縮小前に置いておくためのバッファ
+  CUdeviceptr upload_ptr_ = 0;
+  size_t upload_pitch_ = 0;
+  int upload_width_ = 0;
+  int upload_height_ = 0;
 };
 
+namespace {
+
+// バイリニア補間で 1 プレーンを縮小する。
+// channels は 1 画素あたりのバイト数で、Y プレーンは 1、UV プレーンは 2 になる。
+__global__ void ScalePlaneKernel(const uint8_t* src,
+                                 int src_pitch,
+                                 int src_width,
+                                 int src_height,
+                                 uint8_t* dst,
+                                 int dst_pitch,
+                                 int dst_width,
+                                 int dst_height,
+                                 int channels) {
+  int x = blockIdx.x * blockDim.x + threadIdx.x;
+  int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x >= dst_width || y >= dst_height) {
+    return;
+  }
+
+  float fx = (x + 0.5f) * src_width / dst_width - 0.5f;
+  float fy = (y + 0.5f) * src_height / dst_height - 0.5f;
+  fx = fminf(fmaxf(fx, 0.0f), src_width - 1.0f);
+  fy = fminf(fmaxf(fy, 0.0f), src_height - 1.0f);
+  int x0 = (int)fx;
+  int y0 = (int)fy;
+  int x1 = min(x0 + 1, src_width - 1);
+  int y1 = min(y0 + 1, src_height - 1);
+  float ax = fx - x0;
+  float ay = fy - y0;
+
+  const uint8_t* row0 = src + y0 * src_pitch;
+  const uint8_t* row1 = src + y1 * src_pitch;
+  for (int c = 0; c < channels; c++) {
+    float top = row0[x0 * channels + c] * (1.0f - ax) +
+                row0[x1 * channels + c] * ax;
+    float bottom = row1[x0 * channels + c] * (1.0f - ax) +
+                   row1[x1 * channels + c] * ax;
+    dst[y * dst_pitch + x * channels + c] =
+        (uint8_t)(top * (1.0f - ay) + bottom * ay + 0.5f);
+  }
+}
+
+void ScalePlane(CUdeviceptr src,
+                int src_pitch,
+                int src_width,
+                int src_height,
+                CUdeviceptr dst,
+                int dst_pitch,
+                int dst_width,
+                int dst_height,
+                int channels) {
+  dim3 block(32, 8);
+  dim3 grid((dst_width + block.x - 1) / block.x,
+            (dst_height + block.y - 1) / block.y);
+  ScalePlaneKernel<<<grid, block>>>((const uint8_t*)src, src_pitch, src_width,
+                                    src_height, (uint8_t*)dst, dst_pitch,
+                                    dst_width, dst_height, channels);
+}
+
+}  // namespace
+
 NvCodecH264EncoderCuda::NvCodecH264EncoderCuda()
     : impl_(new NvCodecH264EncoderCudaImpl()) {}
 NvCodecH264EncoderCuda::~NvCodecH264EncoderCuda() {
@@ -137,12 +210,16 @@ void NvCodecH264EncoderCuda::Copy(NvEncoder* nv_encoder,
                                   int height) {
   impl_->Copy(nv_encoder, ptr, width, height);
 }
+void NvCodecH264EncoderCuda::CopyNV12(NvEncoder* nv_encoder,
+                                      const void* ptr,
+                                      int width,
+                                      int height) {
+  impl_->CopyNV12(nv_encoder, ptr, width, height);
+}
 void NvCodecH264EncoderCuda::CopyNative(NvEncoder* nv_encoder,
                                         const void* ptr,
-                                        int size,
-                                        int width,
-                                        int height) {
-  impl_->CopyNative(nv_encoder, ptr, size, width, height);
+                                        int size) {
+  impl_->CopyNative(nv_encoder, ptr, size);
 }
 NvEncoder* NvCodecH264EncoderCuda::CreateNvEncoder(int width,
                                                    int height,
@@ -258,21 +335,39 @@ void ShowEncoderCapability() {
   }
 }
 
-NvCodecH264EncoderCudaImpl::NvCodecH264EncoderCudaImpl() {
-  ShowEncoderCapability();
+namespace {
 
-  ck(dyn::cuInit(0));
-  ck(dyn::cuDeviceGet(&cu_device_, 0));
-  char device_name[80];
-  ck(dyn::cuDeviceGetName(device_name, sizeof(device_name), cu_device_));
-  std::cout << "GPU in use: " << device_name << std::endl;
-  ck(dyn::cuCtxCreate(&cu_context_, 0, cu_device_));
+// 全てのエンコーダで共有する CUDA コンテキスト。
+// cuInit() とデバイスの列挙、コンテキストの作成はエンコーダを作る度に行うと重く、
+// コンテキスト毎に GPU のメモリも使うので、最初に使う時に 1 回だけ作ってプロセスが終わるまで破棄しない
+CUcontext SharedCudaContext() {
+  static CUcontext cu_context = []() {
+    ShowEncoderCapability();
+
+    ck(dyn::cuInit(0));
+    CUdevice cu_device;
+    ck(dyn::cuDeviceGet(&cu_device, 0));
+    char device_name[80];
+    ck(dyn::cuDeviceGetName(device_name, sizeof(device_name), cu_device));
+    std::cout << "GPU in use: " << device_name << std::endl;
+    CUcontext context = NULL;
+    ck(dyn::cuCtxCreate(&context, 0, cu_device));
+    return context;
+  }();
+  return cu_context;
 }
+
+}  // namespace
+
+NvCodecH264EncoderCudaImpl::NvCodecH264EncoderCudaImpl()
+    : cu_context_(SharedCudaContext()) {}
 NvCodecH264EncoderCudaImpl::~NvCodecH264EncoderCudaImpl() {
   if (nv_decoder_ != nullptr) {
     delete nv_decoder_;
   }
-  dyn::cuCtxDestroy(cu_context_);
+  if (upload_ptr_ != 0) {
+    dyn::cuMemFree(upload_ptr_);
+  }
 }
 void NvCodecH264EncoderCudaImpl::Copy(NvEncoder* nv_encoder,
                                       const void* ptr,
@@ -285,11 +380,48 @@ void NvCodecH264EncoderCudaImpl::Copy(NvEncoder* nv_encoder,
       input_frame->bufferFormat, input_frame->chromaOffsets,
       input_frame->numChromaPlanes);
 }
+void NvCodecH264EncoderCudaImpl::CopyNV12(NvEncoder* nv_encoder,
+                                          const void* ptr,
+                                          int width,
+                                          int height) {
+  if (width == nv_encoder->GetEncodeWidth() &&
+      height == nv_encoder->GetEncodeHeight()) {
+    Copy(nv_encoder, ptr, width, height);
+    return;
+  }
+
+  if (upload_ptr_ == 0 || upload_width_ != width ||
+      upload_height_ != height) {
+    if (upload_ptr_ != 0) {
+      ck(dyn::cuMemFree(upload_ptr_));
+      upload_ptr_ = 0;
+    }
+    // Y プレーンと UV プレーンをまとめて確保する
+    ck(dyn::cuMemAllocPitch(&upload_ptr_, &upload_pitch_, width,
+                            height + (height + 1) / 2, 16));
+    upload_width_ = width;
+    upload_height_ = height;
+  }
+
+  ck(dyn::cuCtxPushCurrent(cu_context_));
+  CUDA_MEMCPY2D m = {0};
+  m.srcMemoryType = CU_MEMORYTYPE_HOST;
+  m.srcHost = ptr;
+  m.srcPitch = width;
+  m.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+  m.dstDevice = upload_ptr_;
+  m.dstPitch = upload_pitch_;
+  m.WidthInBytes = width;
+  m.Height = height + (height + 1) / 2;
+  ck(dyn::cuMemcpy2D(&m));
+  ck(dyn::cuCtxPopCurrent(NULL));
+
+  ScaleToInputFrame(nv_encoder, upload_ptr_, (int)upload_pitch_, width,
+                    height);
+}
 void NvCodecH264EncoderCudaImpl::CopyNative(NvEncoder* nv_encoder,
                                             const void* ptr,
-                                            int size,
-                                            int width,
-                                            int height) {
+                                            int size) {
   if (nv_decoder_ == nullptr) {
     std::cout << "Use JPEG Decoder" << std::endl;
     nv_decoder_ = new NvDecoder(cu_context_, true, cudaVideoCodec_JPEG, nullptr,
@@ -300,14 +432,45 @@ void NvCodecH264EncoderCudaImpl::CopyNative(NvEncoder* nv_encoder,
   nv_decoder_->Decode((const uint8_t*)ptr, size, &frames, &frame_count);
 
   for (int i = 0; i < frame_count; i++) {
-    const NvEncInputFrame* input_frame = nv_encoder->GetNextInputFrame();
-    NvEncoderCuda::CopyToDeviceFrame(
-        cu_context_, (void*)frames[i], nv_decoder_->GetDeviceFramePitch(),
-        (CUdeviceptr)input_frame->inputPtr, (int)input_frame->pitch, width,
-        height, CU_MEMORYTYPE_DEVICE, input_frame->bufferFormat,
-        input_frame->chromaOffsets, input_frame->numChromaPlanes);
+    int width = nv_decoder_->GetWidth();
+    int height = nv_decoder_->GetHeight();
+    if (width == nv_encoder->GetEncodeWidth() &&
+        height == nv_encoder->GetEncodeHeight()) {
+      const NvEncInputFrame* input_frame = nv_encoder->GetNextInputFrame();
+      NvEncoderCuda::CopyToDeviceFrame(
+          cu_context_, (void*)frames[i], nv_decoder_->GetDeviceFramePitch(),
+          (CUdeviceptr)input_frame->inputPtr, (int)input_frame->pitch, width,
+          height, CU_MEMORYTYPE_DEVICE, input_frame->bufferFormat,
+          input_frame->chromaOffsets, input_frame->numChromaPlanes);
+    } else {
+      ScaleToInputFrame(nv_encoder, (CUdeviceptr)frames[i],
+                        nv_decoder_->GetDeviceFramePitch(), width, height);
+    }
   }
 }
+void NvCodecH264EncoderCudaImpl::ScaleToInputFrame(NvEncoder* nv_encoder,
+                                                   CUdeviceptr src,
+                                                   int src_pitch,
+                                                   int src_width,
+                                                   int src_height) {
+  const NvEncInputFrame* input_frame = nv_encoder->GetNextInputFrame();
+  int dst_width = nv_encoder->GetEncodeWidth();
+  int dst_height = nv_encoder->GetEncodeHeight();
+  CUdeviceptr dst = (CUdeviceptr)input_frame->inputPtr;
+  int dst_pitch = (int)input_frame->pitch;
+
+  ck(dyn::cuCtxPushCurrent(cu_context_));
+  // Y プレーン
+  ScalePlane(src, src_pitch, src_width, src_height, dst, dst_pitch, dst_width,
+             dst_height, 1);
+  // UV プレーン
+  ScalePlane(src + src_pitch * src_height, src_pitch, (src_width + 1) / 2,
+             (src_height + 1) / 2, dst + input_frame->chromaOffsets[0],
+             dst_pitch, (dst_width + 1) / 2, (dst_height + 1) / 2, 2);
+  ck(cudaGetLastError());
+  ck(dyn::cuStreamSynchronize(0));
+  ck(dyn::cuCtxPopCurrent(NULL));
+}
 NvEncoder* NvCodecH264EncoderCudaImpl::CreateNvEncoder(int width,
                                                        int height,
                                                        bool use_native) {
@@ -20,11 +20,13 @@ class NvCodecH264EncoderCuda {
             const void* ptr,
             int width,
             int height);
-  void CopyNative(NvEncoder* nv_encoder,
-                  const void* ptr,
-                  int size,
-                  int width,
-                  int height);
+  // ホストメモリ上の NV12 を GPU に転送し、エンコーダの解像度と異なる場合は GPU 上で縮小する
+  void CopyNV12(NvEncoder* nv_encoder,
+                const void* ptr,
+                int width,
+                int height);
+  // JPEG を GPU でデコードし、エンコーダの解像度と異なる場合は GPU 上で縮小する
+  void CopyNative(NvEncoder* nv_encoder, const void* ptr, int size);
   // 念のため <memory> も include せずポインタを利用する
   NvEncoder* CreateNvEncoder(int width, int height, bool use_native);
 
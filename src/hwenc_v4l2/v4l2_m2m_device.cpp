@@ -0,0 +1,104 @@
+#include "v4l2_m2m_device.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+const int kMaxVideoDevices = 64;
+
+// codec_format を OUTPUT (デコーダ) か CAPTURE (エンコーダ) に持つ M2M デバイスを探す
+std::string FindDevice(v4l2_buf_type codec_type, uint32_t codec_format) {
+  static std::mutex mutex;
+  static std::map<std::pair<int, uint32_t>, std::string> cache;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto key = std::make_pair((int)codec_type, codec_format);
+  auto it = cache.find(key);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  const v4l2_buf_type raw_type =
+      codec_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+          ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
+          : V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  std::string found;
+  for (int i = 0; i < kMaxVideoDevices && found.empty(); i++) {
+    std::string path = "/dev/video" + std::to_string(i);
+    int fd = open(path.c_str(), O_RDWR | O_NONBLOCK, 0);
+    if (fd < 0) {
+      continue;
+    }
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+      uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS)
+                          ? cap.device_caps
+                          : cap.capabilities;
+      // 反対側のキューが圧縮されていない形式であることも確かめて、
+      // 同じ形式を入出力する ISP などのデバイスを除く
+      if ((caps & V4L2_CAP_VIDEO_M2M_MPLANE) &&
+          V4L2M2MDevice::HasFormat(fd, codec_type, codec_format) &&
+          !V4L2M2MDevice::HasFormat(fd, raw_type, codec_format)) {
+        RTC_LOG(LS_INFO) << "Found V4L2 M2M "
+                         << (codec_type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+                                 ? "encoder"
+                                 : "decoder")
+                         << ": " << path << " (" << (const char*)cap.card
+                         << ")";
+        found = path;
+      }
+    }
+    close(fd);
+  }
+  cache[key] = found;
+  return found;
+}
+
+}  // namespace
+
+std::string V4L2M2MDevice::FindEncoder(uint32_t codec_format) {
+  return FindDevice(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, codec_format);
+}
+
+std::string V4L2M2MDevice::FindDecoder(uint32_t codec_format) {
+  return FindDevice(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, codec_format);
+}
+
+bool V4L2M2MDevice::HasFormat(int fd,
+                              v4l2_buf_type type,
+                              uint32_t pixel_format) {
+  struct v4l2_fmtdesc fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = type;
+  while (ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0) {
+    if (fmt.pixelformat == pixel_format) {
+      return true;
+    }
+    fmt.index++;
+  }
+  return false;
+}
+
+bool V4L2M2MDevice::SetControl(int fd, uint32_t id, int32_t value) {
+  struct v4l2_control control;
+  memset(&control, 0, sizeof(control));
+  control.id = id;
+  control.value = value;
+  if (ioctl(fd, VIDIOC_S_CTRL, &control) < 0) {
+    RTC_LOG(LS_WARNING) << "Failed to set control id=" << id
+                        << " value=" << value << " errno=" << errno;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,27 @@
+#ifndef V4L2_M2M_DEVICE_H_
+#define V4L2_M2M_DEVICE_H_
+
+#include <linux/videodev2.h>
+#include <stdint.h>
+
+#include <string>
+
+// V4L2 の mem2mem (stateful) なハードウェアコーデックを探すためのヘルパ。
+//
+// Raspberry Pi の bcm2835-codec や Rockchip、Amlogic などのボードはデバイスの番号が
+// 決まっていないので、/dev/video* の中から、OUTPUT と CAPTURE の形式で
+// エンコーダかデコーダかを判別する。結果はプロセスの中でキャッシュする。
+class V4L2M2MDevice {
+ public:
+  // CAPTURE キューに codec_format を出力できるエンコーダのデバイスのパス。無い場合は空文字
+  static std::string FindEncoder(uint32_t codec_format);
+  // OUTPUT キューに codec_format を入力できるデコーダのデバイスのパス。無い場合は空文字
+  static std::string FindDecoder(uint32_t codec_format);
+
+  // fd のデバイスの type のキューが pixel_format に対応しているか
+  static bool HasFormat(int fd, v4l2_buf_type type, uint32_t pixel_format);
+  // 失敗した場合はログを出して false を返す
+  static bool SetControl(int fd, uint32_t id, int32_t value);
+};
+
+#endif  // V4L2_M2M_DEVICE_H_
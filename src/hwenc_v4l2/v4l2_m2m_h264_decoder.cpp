@@ -0,0 +1,476 @@
+#include "v4l2_m2m_h264_decoder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc/frame_buffer_pool.h"
+#include "rtc/thread_placement.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv/convert.h"
+#include "third_party/libyuv/include/libyuv/planar_functions.h"
+#include "v4l2_m2m_device.h"
+
+namespace {
+
+// 受信した H.264 を溜めておける数
+const int kOutputBuffers = 4;
+const uint32_t kOutputBufferSize = 1024 << 10;
+// V4L2_CID_MIN_BUFFERS_FOR_CAPTURE に加えて確保する CAPTURE キューのバッファの数
+const int kExtraCaptureBuffers = 2;
+// OUTPUT キューが空くのを待つ時間
+const int kOutputWaitMs = 100;
+
+}  // namespace
+
+V4L2M2MH264Decoder::V4L2M2MH264Decoder() {}
+
+V4L2M2MH264Decoder::~V4L2M2MH264Decoder() {
+  Release();
+}
+
+bool V4L2M2MH264Decoder::IsSupported() {
+  return !V4L2M2MDevice::FindDecoder(V4L2_PIX_FMT_H264).empty();
+}
+
+int32_t V4L2M2MH264Decoder::InitDecode(
+    const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores) {
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  Release();
+  if (V4L2Configure() != WEBRTC_VIDEO_CODEC_OK) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to V4L2Configure";
+    V4L2Release();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t V4L2M2MH264Decoder::V4L2Configure() {
+  const std::string device = V4L2M2MDevice::FindDecoder(V4L2_PIX_FMT_H264);
+  fd_ = open(device.c_str(), O_RDWR | O_NONBLOCK, 0);
+  if (fd_ < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to open V4L2 M2M decoder " << device
+                      << " errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  struct v4l2_event_subscription sub;
+  memset(&sub, 0, sizeof(sub));
+  sub.type = V4L2_EVENT_SOURCE_CHANGE;
+  if (ioctl(fd_, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to subscribe source change errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  struct v4l2_format fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+  fmt.fmt.pix_mp.num_planes = 1;
+  fmt.fmt.pix_mp.plane_fmt[0].sizeimage = kOutputBufferSize;
+  if (ioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to set output format errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  struct v4l2_requestbuffers reqbufs;
+  memset(&reqbufs, 0, sizeof(reqbufs));
+  reqbufs.count = kOutputBuffers;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to request output buffers errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  for (uint32_t i = 0; i < reqbufs.count; i++) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_QUERYBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to query output buffer errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    void* start = mmap(nullptr, planes[0].length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd_, planes[0].m.mem_offset);
+    if (start == MAP_FAILED) {
+      RTC_LOG(LS_ERROR) << "Failed to mmap output buffer errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    output_buffers_.push_back(MappedBuffer{start, planes[0].length});
+  }
+  {
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    free_output_buffers_.clear();
+    for (uint32_t i = 0; i < reqbufs.count; i++) {
+      free_output_buffers_.push_back(i);
+    }
+  }
+
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  if (ioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to VIDIOC_STREAMON errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  quit_ = false;
+  poll_thread_.reset(new rtc::PlatformThread(V4L2M2MH264Decoder::PollThread,
+                                             this, "V4L2M2MDecoder",
+                                             rtc::kHighPriority));
+  poll_thread_->Start();
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void V4L2M2MH264Decoder::V4L2Release() {
+  if (poll_thread_) {
+    quit_ = true;
+    poll_thread_->Stop();
+    poll_thread_.reset();
+  }
+  if (fd_ >= 0) {
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    ioctl(fd_, VIDIOC_STREAMOFF, &type);
+  }
+  ReleaseCaptureBuffers();
+  for (const MappedBuffer& buffer : output_buffers_) {
+    munmap(buffer.start, buffer.length);
+  }
+  output_buffers_.clear();
+  {
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    free_output_buffers_.clear();
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool V4L2M2MH264Decoder::SetupCaptureBuffers() {
+  ReleaseCaptureBuffers();
+
+  struct v4l2_format fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  if (ioctl(fd_, VIDIOC_G_FMT, &fmt) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to get capture format errno=" << errno;
+    return false;
+  }
+  // ドライバが選んだ形式を読めない場合は、I420 か NV12 にしてもらう
+  for (uint32_t format : {V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12}) {
+    if (fmt.fmt.pix_mp.pixelformat == V4L2_PIX_FMT_YUV420 ||
+        fmt.fmt.pix_mp.pixelformat == V4L2_PIX_FMT_NV12) {
+      break;
+    }
+    fmt.fmt.pix_mp.pixelformat = format;
+    fmt.fmt.pix_mp.num_planes = 1;
+    if (ioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+      ioctl(fd_, VIDIOC_G_FMT, &fmt);
+    }
+  }
+  if ((fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_YUV420 &&
+       fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_NV12) ||
+      fmt.fmt.pix_mp.num_planes != 1) {
+    RTC_LOG(LS_ERROR) << "Decoder does not output the single plane I420 or "
+                         "NV12";
+    return false;
+  }
+  capture_format_ = fmt.fmt.pix_mp.pixelformat;
+  stride_ = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+  plane_height_ = fmt.fmt.pix_mp.plane_fmt[0].sizeimage * 2 / (stride_ * 3);
+  width_ = fmt.fmt.pix_mp.width;
+  height_ = fmt.fmt.pix_mp.height;
+
+  // 16 の倍数に揃えた大きさで出力されるので、表示する範囲を取得する
+  struct v4l2_selection selection;
+  memset(&selection, 0, sizeof(selection));
+  selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  selection.target = V4L2_SEL_TGT_COMPOSE;
+  if (ioctl(fd_, VIDIOC_G_SELECTION, &selection) == 0) {
+    width_ = selection.r.width;
+    height_ = selection.r.height;
+  }
+  RTC_LOG(LS_INFO) << "V4L2 M2M decoder output " << width_ << "x" << height_
+                   << " stride=" << stride_ << " format="
+                   << (capture_format_ == V4L2_PIX_FMT_NV12 ? "NV12" : "I420");
+
+  int num_buffers = kExtraCaptureBuffers;
+  struct v4l2_control control;
+  memset(&control, 0, sizeof(control));
+  control.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
+  if (ioctl(fd_, VIDIOC_G_CTRL, &control) == 0) {
+    num_buffers += control.value;
+  }
+
+  struct v4l2_requestbuffers reqbufs;
+  memset(&reqbufs, 0, sizeof(reqbufs));
+  reqbufs.count = num_buffers;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to request capture buffers errno=" << errno;
+    return false;
+  }
+  for (uint32_t i = 0; i < reqbufs.count; i++) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_QUERYBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to query capture buffer errno=" << errno;
+      return false;
+    }
+    void* start = mmap(nullptr, planes[0].length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd_, planes[0].m.mem_offset);
+    if (start == MAP_FAILED) {
+      RTC_LOG(LS_ERROR) << "Failed to mmap capture buffer errno=" << errno;
+      return false;
+    }
+    capture_buffers_.push_back(MappedBuffer{start, planes[0].length});
+    if (ioctl(fd_, VIDIOC_QBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to queue capture buffer errno=" << errno;
+      return false;
+    }
+  }
+
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  if (ioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to VIDIOC_STREAMON errno=" << errno;
+    return false;
+  }
+  return true;
+}
+
+void V4L2M2MH264Decoder::ReleaseCaptureBuffers() {
+  if (fd_ < 0 || capture_buffers_.empty()) {
+    return;
+  }
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  ioctl(fd_, VIDIOC_STREAMOFF, &type);
+  for (const MappedBuffer& buffer : capture_buffers_) {
+    munmap(buffer.start, buffer.length);
+  }
+  capture_buffers_.clear();
+
+  struct v4l2_requestbuffers reqbufs;
+  memset(&reqbufs, 0, sizeof(reqbufs));
+  reqbufs.count = 0;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  ioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+}
+
+int32_t V4L2M2MH264Decoder::Decode(const webrtc::EncodedImage& input_image,
+                                   bool missing_frames,
+                                   int64_t render_time_ms) {
+  if (fd_ < 0) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+  if (decode_complete_callback_ == nullptr) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+  if (input_image.data() == nullptr || input_image.size() == 0) {
+    return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+  }
+
+  int index;
+  {
+    std::unique_lock<std::mutex> lock(output_mtx_);
+    if (!output_cond_.wait_for(
+            lock, std::chrono::milliseconds(kOutputWaitMs),
+            [this]() { return !free_output_buffers_.empty(); })) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << " Decoder input is full";
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    index = free_output_buffers_.back();
+    free_output_buffers_.pop_back();
+  }
+  if (input_image.size() > output_buffers_[index].length) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << " Too large frame "
+                      << input_image.size();
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    free_output_buffers_.push_back(index);
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  memcpy(output_buffers_[index].start, input_image.data(),
+         input_image.size());
+
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  memset(planes, 0, sizeof(planes));
+  buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.index = index;
+  buffer.length = 1;
+  buffer.m.planes = planes;
+  planes[0].bytesused = input_image.size();
+  // RTP のタイムスタンプはデコードしたフレームの timestamp にそのままコピーされる
+  buffer.timestamp.tv_sec = input_image.Timestamp() / rtc::kNumMicrosecsPerSec;
+  buffer.timestamp.tv_usec =
+      input_image.Timestamp() % rtc::kNumMicrosecsPerSec;
+  if (ioctl(fd_, VIDIOC_QBUF, &buffer) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to queue output buffer errno=" << errno;
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    free_output_buffers_.push_back(index);
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void V4L2M2MH264Decoder::PollThread(void* obj) {
+  ThreadPlacement::Instance().Apply("decoder");
+  static_cast<V4L2M2MH264Decoder*>(obj)->PollLoop();
+}
+
+void V4L2M2MH264Decoder::PollLoop() {
+  while (!quit_) {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN | POLLOUT | POLLPRI;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, 200);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RTC_LOG(LS_ERROR) << "Failed to poll errno=" << errno;
+      return;
+    }
+    if (pfd.revents & POLLPRI) {
+      DequeueEvents();
+    }
+    if (pfd.revents & POLLOUT) {
+      DequeueOutputBuffers();
+    }
+    if (pfd.revents & POLLIN) {
+      DequeueCaptureBuffers();
+    }
+    // どちらのキューにもバッファが無い間は POLLERR がすぐに返るので、少し待つ
+    if ((pfd.revents & POLLERR) && !(pfd.revents & (POLLPRI | POLLIN))) {
+      usleep(10 * 1000);
+    }
+  }
+}
+
+void V4L2M2MH264Decoder::DequeueEvents() {
+  struct v4l2_event event;
+  memset(&event, 0, sizeof(event));
+  while (ioctl(fd_, VIDIOC_DQEVENT, &event) == 0) {
+    if (event.type == V4L2_EVENT_SOURCE_CHANGE &&
+        (event.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)) {
+      if (!SetupCaptureBuffers()) {
+        RTC_LOG(LS_ERROR) << "Failed to setup capture buffers";
+      }
+    }
+  }
+}
+
+void V4L2M2MH264Decoder::DequeueOutputBuffers() {
+  while (true) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_DQBUF, &buffer) < 0) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(output_mtx_);
+      free_output_buffers_.push_back(buffer.index);
+    }
+    output_cond_.notify_one();
+  }
+}
+
+void V4L2M2MH264Decoder::DequeueCaptureBuffers() {
+  while (!capture_buffers_.empty()) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_DQBUF, &buffer) < 0) {
+      return;
+    }
+
+    if (planes[0].bytesused > 0 && !(buffer.flags & V4L2_BUF_FLAG_ERROR)) {
+      const uint8_t* src = (const uint8_t*)capture_buffers_[buffer.index].start;
+      const uint8_t* src_u = src + stride_ * plane_height_;
+      rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+          FrameBufferPool::Instance().CreateI420Buffer(width_, height_);
+      if (capture_format_ == V4L2_PIX_FMT_NV12) {
+        libyuv::NV12ToI420(src, stride_, src_u, stride_,
+                           i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+                           i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+                           i420_buffer->MutableDataV(), i420_buffer->StrideV(),
+                           width_, height_);
+      } else {
+        const uint8_t* src_v = src_u + (stride_ / 2) * (plane_height_ / 2);
+        libyuv::I420Copy(src, stride_, src_u, stride_ / 2, src_v, stride_ / 2,
+                         i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+                         i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+                         i420_buffer->MutableDataV(), i420_buffer->StrideV(),
+                         width_, height_);
+      }
+
+      const uint32_t timestamp =
+          buffer.timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
+          buffer.timestamp.tv_usec;
+      webrtc::VideoFrame decoded_image =
+          webrtc::VideoFrame::Builder()
+              .set_video_frame_buffer(i420_buffer)
+              .set_timestamp_rtp(timestamp)
+              .build();
+      decode_complete_callback_->Decoded(decoded_image, absl::nullopt,
+                                         absl::nullopt);
+    }
+
+    if (ioctl(fd_, VIDIOC_QBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to queue capture buffer errno=" << errno;
+    }
+  }
+}
+
+int32_t V4L2M2MH264Decoder::RegisterDecodeCompleteCallback(
+    webrtc::DecodedImageCallback* callback) {
+  decode_complete_callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t V4L2M2MH264Decoder::Release() {
+  V4L2Release();
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+const char* V4L2M2MH264Decoder::ImplementationName() const {
+  return "V4L2 M2M H264";
+}
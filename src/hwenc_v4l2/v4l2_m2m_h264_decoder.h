@@ -0,0 +1,86 @@
+#ifndef V4L2_M2M_H264_DECODER_H_
+#define V4L2_M2M_H264_DECODER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "api/video_codecs/video_decoder.h"
+#include "rtc_base/platform_thread.h"
+
+// V4L2 の mem2mem (stateful) なハードウェアデコーダを使う H.264 デコーダ。
+//
+// 受信した H.264 は OUTPUT キューの複数のバッファに入れておき、デコードを待たずに Decode() から戻る。
+// 解像度はデコーダが SPS から判断して V4L2_EVENT_SOURCE_CHANGE で知らせてくるので、
+// その時点で CAPTURE キューを作り直す。
+// デコードしたフレームは I420 か NV12 で受け取り、I420Buffer に変換してポーリングのスレッドから渡す。
+class V4L2M2MH264Decoder : public webrtc::VideoDecoder {
+ public:
+  V4L2M2MH264Decoder();
+  ~V4L2M2MH264Decoder() override;
+
+  // H.264 をデコードできる V4L2 M2M のデバイスがあるか
+  static bool IsSupported();
+
+  int32_t InitDecode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores) override;
+
+  int32_t Decode(const webrtc::EncodedImage& input_image,
+                 bool missing_frames,
+                 int64_t render_time_ms) override;
+
+  int32_t RegisterDecodeCompleteCallback(
+      webrtc::DecodedImageCallback* callback) override;
+
+  int32_t Release() override;
+
+  const char* ImplementationName() const override;
+
+ private:
+  // mmap したバッファ
+  struct MappedBuffer {
+    void* start;
+    size_t length;
+  };
+
+  int32_t V4L2Configure();
+  void V4L2Release();
+  // 解像度が決まった時に CAPTURE キューを今の形式で作り直す
+  bool SetupCaptureBuffers();
+  void ReleaseCaptureBuffers();
+
+  static void PollThread(void* obj);
+  void PollLoop();
+  void DequeueEvents();
+  void DequeueOutputBuffers();
+  void DequeueCaptureBuffers();
+
+  int fd_ = -1;
+  webrtc::DecodedImageCallback* decode_complete_callback_ = nullptr;
+
+  std::vector<MappedBuffer> output_buffers_;
+  std::mutex output_mtx_;
+  std::condition_variable output_cond_;
+  // デコーダが読み終わった OUTPUT キューのバッファ
+  std::vector<int> free_output_buffers_;
+
+  // 以下の CAPTURE キューの状態はポーリングのスレッドだけが触る
+  std::vector<MappedBuffer> capture_buffers_;
+  // V4L2_PIX_FMT_YUV420 か V4L2_PIX_FMT_NV12
+  uint32_t capture_format_ = 0;
+  // 表示する範囲の大きさ
+  int width_ = 0;
+  int height_ = 0;
+  // Y プレーンのピッチと、U, V (UV) プレーンの配置に使う高さ
+  uint32_t stride_ = 0;
+  uint32_t plane_height_ = 0;
+
+  std::atomic<bool> quit_{false};
+  std::unique_ptr<rtc::PlatformThread> poll_thread_;
+};
+
+#endif  // V4L2_M2M_H264_DECODER_H_
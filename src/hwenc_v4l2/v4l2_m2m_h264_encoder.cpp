@@ -0,0 +1,695 @@
+#include "v4l2_m2m_h264_encoder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rtc/deferred_i420_buffer.h"
+#include "rtc/memory_accounting.h"
+#include "rtc/native_buffer.h"
+#include "rtc/simulcast_frame_buffer.h"
+#include "rtc/thread_placement.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv/convert_from.h"
+#include "third_party/libyuv/include/libyuv/planar_functions.h"
+#include "v4l2_m2m_device.h"
+
+namespace {
+const int kLowH264QpThreshold = 34;
+const int kHighH264QpThreshold = 40;
+
+// エンコード中のフレームを溜めておける数
+const int kOutputBuffers = 4;
+const int kCaptureBuffers = 4;
+const uint32_t kCaptureBufferSize = 512 << 10;
+
+// I420 か NV12 の dmabuf を持っていて、縮小の指定も無ければ、そのままエンコーダに渡せる。
+// 渡せる場合は V4L2 の形式を返す。渡せない場合は 0
+uint32_t GetDmabufFormat(webrtc::VideoFrameBuffer* buffer) {
+  if (buffer->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+    return 0;
+  }
+  NativeBuffer* native_buffer = dynamic_cast<NativeBuffer*>(buffer);
+  if (native_buffer == nullptr || native_buffer->dmabuf_fd() < 0 ||
+      native_buffer->width() != native_buffer->raw_width() ||
+      native_buffer->height() != native_buffer->raw_height()) {
+    return 0;
+  }
+  switch (native_buffer->VideoType()) {
+    case webrtc::VideoType::kI420:
+      return V4L2_PIX_FMT_YUV420;
+    case webrtc::VideoType::kNV12:
+      return V4L2_PIX_FMT_NV12;
+    default:
+      return 0;
+  }
+}
+
+}  // namespace
+
+V4L2M2MH264Encoder::V4L2M2MH264Encoder(
+    const cricket::VideoCodec& codec,
+    KeyFrameThrottle::Settings key_frame_throttle)
+    : HWVideoEncoder("V4L2 M2M H264", key_frame_throttle),
+      fd_(-1),
+      dmabuf_input_(false),
+      raw_format_(V4L2_PIX_FMT_YUV420),
+      stride_(0),
+      plane_height_(0),
+      target_framerate_fps_(30),
+      configured_framerate_fps_(30),
+      configured_width_(0),
+      configured_height_(0) {}
+
+V4L2M2MH264Encoder::~V4L2M2MH264Encoder() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  V4L2Release();
+}
+
+bool V4L2M2MH264Encoder::IsSupported() {
+  return !V4L2M2MDevice::FindEncoder(V4L2_PIX_FMT_H264).empty();
+}
+
+int32_t V4L2M2MH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
+                                    int32_t number_of_cores,
+                                    size_t max_payload_size) {
+  RTC_DCHECK(codec_settings);
+  RTC_DCHECK_EQ(codec_settings->codecType, webrtc::kVideoCodecH264);
+
+  // サイマルキャストは SimulcastEncoderAdapter に任せる
+  if (codec_settings->numberOfSimulcastStreams > 1) {
+    return WEBRTC_VIDEO_CODEC_ERR_SIMULCAST_PARAMETERS_NOT_SUPPORTED;
+  }
+
+  int32_t release_ret = Release();
+  if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
+    return release_ret;
+  }
+
+  width_ = codec_settings->width;
+  height_ = codec_settings->height;
+  SetTargetBitrateBps(codec_settings->startBitrate * 1000);
+
+  RTC_LOG(LS_INFO) << "InitEncode " << target_bitrate_bps_ << "bit/sec";
+
+  InitEncodedImage(*codec_settings);
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t V4L2M2MH264Encoder::Release() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  V4L2Release();
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t V4L2M2MH264Encoder::V4L2Configure(uint32_t dmabuf_format,
+                                          uint32_t stride) {
+  const std::string device = V4L2M2MDevice::FindEncoder(V4L2_PIX_FMT_H264);
+  fd_ = open(device.c_str(), O_RDWR | O_NONBLOCK, 0);
+  if (fd_ < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to open V4L2 M2M encoder " << device
+                      << " errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  const bool dmabuf_input = dmabuf_format != 0;
+  if (dmabuf_input) {
+    raw_format_ = dmabuf_format;
+  } else {
+    // コピーする場合は I420 を優先し、対応していない場合は NV12 に変換する
+    raw_format_ = V4L2M2MDevice::HasFormat(fd_,
+                                           V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+                                           V4L2_PIX_FMT_YUV420)
+                      ? V4L2_PIX_FMT_YUV420
+                      : V4L2_PIX_FMT_NV12;
+  }
+  if (!V4L2M2MDevice::HasFormat(fd_, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+                                raw_format_)) {
+    RTC_LOG(LS_ERROR) << "Encoder does not accept "
+                      << (raw_format_ == V4L2_PIX_FMT_NV12 ? "NV12" : "I420");
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  // 設定に失敗してもエンコードはできるので、プロファイルなどは失敗しても続ける
+  SetControl(V4L2_CID_MPEG_VIDEO_H264_PROFILE,
+             V4L2_MPEG_VIDEO_H264_PROFILE_HIGH);
+  SetControl(V4L2_CID_MPEG_VIDEO_H264_LEVEL, V4L2_MPEG_VIDEO_H264_LEVEL_4_2);
+  SetControl(V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, 500);
+  if (!SetControl(V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1)) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  configured_bitrate_bps_ = 0;
+  SetBitrateBps(bitrate_adjuster_.GetAdjustedBitrateBps());
+
+  if (SetFormat(dmabuf_input, stride) != WEBRTC_VIDEO_CODEC_OK) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  configured_framerate_fps_ = 0;
+  SetFramerateFps(target_framerate_fps_);
+
+  if (SetupBuffers(dmabuf_input) != WEBRTC_VIDEO_CODEC_OK) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  for (v4l2_buf_type type : {V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+                             V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE}) {
+    if (ioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to VIDIOC_STREAMON errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+  }
+
+  quit_ = false;
+  poll_thread_.reset(new rtc::PlatformThread(
+      V4L2M2MH264Encoder::PollThread, this, "V4L2M2MEncoder",
+      rtc::kHighPriority));
+  poll_thread_->Start();
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t V4L2M2MH264Encoder::SetFormat(bool dmabuf_input, uint32_t stride) {
+  struct v4l2_format fmt;
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  fmt.fmt.pix_mp.width = width_;
+  fmt.fmt.pix_mp.height = height_;
+  fmt.fmt.pix_mp.pixelformat = raw_format_;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+  fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_SMPTE170M;
+  fmt.fmt.pix_mp.num_planes = 1;
+  // dmabuf の場合はキャプチャしたバッファのピッチに合わせる
+  fmt.fmt.pix_mp.plane_fmt[0].bytesperline = dmabuf_input ? stride : 0;
+  if (ioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to set output format errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  if (fmt.fmt.pix_mp.pixelformat != raw_format_ ||
+      fmt.fmt.pix_mp.num_planes != 1) {
+    RTC_LOG(LS_ERROR) << "Encoder does not accept the single plane format";
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  stride_ = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+  // ドライバは高さを揃えて U, V (UV) プレーンを配置するので、その高さを sizeimage から求める
+  plane_height_ = fmt.fmt.pix_mp.plane_fmt[0].sizeimage * 2 / (stride_ * 3);
+  if (dmabuf_input && stride_ != stride) {
+    RTC_LOG(LS_ERROR) << "Encoder does not accept stride " << stride;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  memset(&fmt, 0, sizeof(fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  fmt.fmt.pix_mp.width = width_;
+  fmt.fmt.pix_mp.height = height_;
+  fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+  fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_DEFAULT;
+  fmt.fmt.pix_mp.num_planes = 1;
+  fmt.fmt.pix_mp.plane_fmt[0].sizeimage = kCaptureBufferSize;
+  if (ioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to set capture format errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  dmabuf_input_ = dmabuf_input;
+  configured_width_ = width_;
+  configured_height_ = height_;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t V4L2M2MH264Encoder::SetupBuffers(bool dmabuf_input) {
+  struct v4l2_requestbuffers reqbufs;
+  memset(&reqbufs, 0, sizeof(reqbufs));
+  reqbufs.count = kOutputBuffers;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  reqbufs.memory = dmabuf_input ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+  if (ioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to request output buffers errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  {
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    free_output_buffers_.clear();
+    queued_frames_.clear();
+    queued_frames_.resize(reqbufs.count);
+    for (uint32_t i = 0; i < reqbufs.count; i++) {
+      free_output_buffers_.push_back(i);
+    }
+  }
+  // dmabuf の場合はキャプチャしたバッファを使うので、エンコーダ側では確保しない
+  for (uint32_t i = 0; i < reqbufs.count && !dmabuf_input; i++) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_QUERYBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to query output buffer errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    void* start = mmap(nullptr, planes[0].length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd_, planes[0].m.mem_offset);
+    if (start == MAP_FAILED) {
+      RTC_LOG(LS_ERROR) << "Failed to mmap output buffer errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    output_buffers_.push_back(MappedBuffer{start, planes[0].length});
+    buffer_bytes_ += planes[0].length;
+  }
+
+  memset(&reqbufs, 0, sizeof(reqbufs));
+  reqbufs.count = kCaptureBuffers;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to request capture buffers errno=" << errno;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  for (uint32_t i = 0; i < reqbufs.count; i++) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_QUERYBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to query capture buffer errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    void* start = mmap(nullptr, planes[0].length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd_, planes[0].m.mem_offset);
+    if (start == MAP_FAILED) {
+      RTC_LOG(LS_ERROR) << "Failed to mmap capture buffer errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    capture_buffers_.push_back(MappedBuffer{start, planes[0].length});
+    buffer_bytes_ += planes[0].length;
+    if (ioctl(fd_, VIDIOC_QBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to queue capture buffer errno=" << errno;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+  }
+  MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder, buffer_bytes_);
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void V4L2M2MH264Encoder::V4L2Release() {
+  if (poll_thread_) {
+    quit_ = true;
+    poll_thread_->Stop();
+    poll_thread_.reset();
+  }
+  if (fd_ >= 0) {
+    for (v4l2_buf_type type : {V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE,
+                               V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE}) {
+      ioctl(fd_, VIDIOC_STREAMOFF, &type);
+    }
+  }
+  for (const MappedBuffer& buffer : output_buffers_) {
+    munmap(buffer.start, buffer.length);
+  }
+  output_buffers_.clear();
+  for (const MappedBuffer& buffer : capture_buffers_) {
+    munmap(buffer.start, buffer.length);
+  }
+  capture_buffers_.clear();
+  MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder,
+                                   -buffer_bytes_);
+  buffer_bytes_ = 0;
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    free_output_buffers_.clear();
+    // STREAMOFF したので、キャプチャしたバッファはもう参照されていない
+    queued_frames_.clear();
+  }
+  ClearFrameParams();
+}
+
+bool V4L2M2MH264Encoder::SetControl(uint32_t id, int32_t value) {
+  return V4L2M2MDevice::SetControl(fd_, id, value);
+}
+
+bool V4L2M2MH264Encoder::MatchesLayout(const uint32_t offsets[3],
+                                       const uint32_t pitches[3]) const {
+  if (offsets[0] != 0 || pitches[0] != stride_ ||
+      offsets[1] != stride_ * plane_height_) {
+    return false;
+  }
+  if (raw_format_ == V4L2_PIX_FMT_NV12) {
+    return pitches[1] == stride_;
+  }
+  return pitches[1] == stride_ / 2 && pitches[2] == stride_ / 2 &&
+         offsets[2] == offsets[1] + (stride_ / 2) * (plane_height_ / 2);
+}
+
+void V4L2M2MH264Encoder::PollThread(void* obj) {
+  ThreadPlacement::Instance().Apply("encoder");
+  static_cast<V4L2M2MH264Encoder*>(obj)->PollLoop();
+}
+
+void V4L2M2MH264Encoder::PollLoop() {
+  while (!quit_) {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN | POLLOUT;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, 200);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RTC_LOG(LS_ERROR) << "Failed to poll errno=" << errno;
+      return;
+    }
+    if (pfd.revents & POLLOUT) {
+      DequeueOutputBuffers();
+    }
+    if (pfd.revents & POLLIN) {
+      DequeueCaptureBuffers();
+    }
+  }
+}
+
+void V4L2M2MH264Encoder::DequeueOutputBuffers() {
+  while (true) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buffer.memory = dmabuf_input_ ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_DQBUF, &buffer) < 0) {
+      return;
+    }
+    // エンコーダが読み終わったので、キャプチャしたバッファを返せる
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    queued_frames_[buffer.index] = nullptr;
+    free_output_buffers_.push_back(buffer.index);
+  }
+}
+
+void V4L2M2MH264Encoder::DequeueCaptureBuffers() {
+  while (true) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.length = 1;
+    buffer.m.planes = planes;
+    if (ioctl(fd_, VIDIOC_DQBUF, &buffer) < 0) {
+      return;
+    }
+
+    const int64_t timestamp_us =
+        buffer.timestamp.tv_sec * rtc::kNumMicrosecsPerSec +
+        buffer.timestamp.tv_usec;
+    std::unique_ptr<FrameParams> params = PopFrameParams(timestamp_us);
+    if (params && planes[0].bytesused > 0) {
+      SetEncodedImageParams(*params);
+
+      // キャプチャのバッファはすぐにエンコーダに返すので、
+      // OnEncodedImage から戻った後も保持する場合は、下流で Retain() してコピーされる
+      uint8_t* data = (uint8_t*)capture_buffers_[buffer.index].start +
+                      planes[0].data_offset;
+      size_t size = planes[0].bytesused - planes[0].data_offset;
+      encoded_image_.set_buffer(data, size);
+      SendH264Frame(data, size);
+    }
+
+    if (ioctl(fd_, VIDIOC_QBUF, &buffer) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to queue capture buffer errno=" << errno;
+    }
+  }
+}
+
+int V4L2M2MH264Encoder::PopFreeOutputBuffer() {
+  std::lock_guard<std::mutex> lock(output_mtx_);
+  if (free_output_buffers_.empty()) {
+    return -1;
+  }
+  int index = free_output_buffers_.back();
+  free_output_buffers_.pop_back();
+  return index;
+}
+
+bool V4L2M2MH264Encoder::QueueOutputBuffer(
+    int index,
+    const webrtc::VideoFrame& frame,
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer) {
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  memset(planes, 0, sizeof(planes));
+  buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buffer.index = index;
+  buffer.field = V4L2_FIELD_NONE;
+  buffer.length = 1;
+  buffer.m.planes = planes;
+  buffer.timestamp.tv_sec = frame.timestamp_us() / rtc::kNumMicrosecsPerSec;
+  buffer.timestamp.tv_usec = frame.timestamp_us() % rtc::kNumMicrosecsPerSec;
+
+  const uint32_t offset_u = stride_ * plane_height_;
+  const uint32_t offset_v = offset_u + (stride_ / 2) * (plane_height_ / 2);
+  const uint32_t size = offset_v + (stride_ / 2) * (plane_height_ / 2);
+  if (dmabuf_input_) {
+    NativeBuffer* native_buffer =
+        static_cast<NativeBuffer*>(frame_buffer.get());
+    buffer.memory = V4L2_MEMORY_DMABUF;
+    planes[0].m.fd = native_buffer->dmabuf_fd();
+    planes[0].bytesused = size;
+    planes[0].length = native_buffer->length();
+  } else {
+    uint8_t* dst = (uint8_t*)output_buffers_[index].start;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    DeferredI420Buffer* deferred_buffer =
+        dynamic_cast<DeferredI420Buffer*>(frame_buffer.get());
+    if (deferred_buffer && raw_format_ == V4L2_PIX_FMT_YUV420) {
+      // 変換を遅らせているバッファは、エンコーダの入力バッファに直接変換する
+      deferred_buffer->ConvertTo(dst, stride_, dst + offset_u, stride_ / 2,
+                                 dst + offset_v, stride_ / 2);
+    } else if (raw_format_ == V4L2_PIX_FMT_NV12) {
+      rtc::scoped_refptr<const webrtc::I420BufferInterface> i420_buffer =
+          frame_buffer->ToI420();
+      libyuv::I420ToNV12(i420_buffer->DataY(), i420_buffer->StrideY(),
+                         i420_buffer->DataU(), i420_buffer->StrideU(),
+                         i420_buffer->DataV(), i420_buffer->StrideV(), dst,
+                         stride_, dst + offset_u, stride_,
+                         i420_buffer->width(), i420_buffer->height());
+    } else {
+      rtc::scoped_refptr<const webrtc::I420BufferInterface> i420_buffer =
+          frame_buffer->ToI420();
+      libyuv::I420Copy(i420_buffer->DataY(), i420_buffer->StrideY(),
+                       i420_buffer->DataU(), i420_buffer->StrideU(),
+                       i420_buffer->DataV(), i420_buffer->StrideV(), dst,
+                       stride_, dst + offset_u, stride_ / 2, dst + offset_v,
+                       stride_ / 2, i420_buffer->width(),
+                       i420_buffer->height());
+    }
+    planes[0].bytesused = size;
+    planes[0].length = output_buffers_[index].length;
+    // コピーしたので入力のフレームを保持する必要は無い
+    frame_buffer = nullptr;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    queued_frames_[index] = frame_buffer;
+  }
+  if (ioctl(fd_, VIDIOC_QBUF, &buffer) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to queue output buffer errno=" << errno;
+    std::lock_guard<std::mutex> lock(output_mtx_);
+    queued_frames_[index] = nullptr;
+    free_output_buffers_.push_back(index);
+    return false;
+  }
+  return true;
+}
+
+int32_t V4L2M2MH264Encoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void V4L2M2MH264Encoder::SetRates(const RateControlParameters& parameters) {
+  if (parameters.bitrate.get_sum_bps() <= 0 || parameters.framerate_fps <= 0)
+    return;
+
+  RTC_LOG(LS_INFO) << __FUNCTION__
+                   << " bitrate:" << parameters.bitrate.get_sum_bps()
+                   << " fps:" << parameters.framerate_fps;
+  SetTargetBitrateBps(parameters.bitrate.get_sum_bps());
+  target_framerate_fps_ = parameters.framerate_fps;
+}
+
+void V4L2M2MH264Encoder::SetBitrateBps(uint32_t bitrate_bps) {
+  if (bitrate_bps < 300000 || configured_bitrate_bps_ == bitrate_bps) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << " " << bitrate_bps << " bit/sec";
+  if (!SetControl(V4L2_CID_MPEG_VIDEO_BITRATE, bitrate_bps)) {
+    return;
+  }
+  configured_bitrate_bps_ = bitrate_bps;
+}
+
+void V4L2M2MH264Encoder::SetFramerateFps(double framerate_fps) {
+  if (configured_framerate_fps_ == (int32_t)framerate_fps) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << " " << framerate_fps << " fps";
+  struct v4l2_streamparm parm;
+  memset(&parm, 0, sizeof(parm));
+  parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  parm.parm.output.timeperframe.numerator = 1;
+  parm.parm.output.timeperframe.denominator = (uint32_t)framerate_fps;
+  if (ioctl(fd_, VIDIOC_S_PARM, &parm) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to set H264 framerate errno=" << errno;
+    return;
+  }
+  configured_framerate_fps_ = (int32_t)framerate_fps;
+}
+
+webrtc::VideoEncoder::EncoderInfo V4L2M2MH264Encoder::GetEncoderInfo() const {
+  EncoderInfo info;
+  info.supports_native_handle = true;
+  info.implementation_name = "V4L2 M2M H264";
+  info.scaling_settings =
+      VideoEncoder::ScalingSettings(kLowH264QpThreshold, kHighH264QpThreshold);
+  info.is_hardware_accelerated = true;
+  info.has_internal_source = false;
+  return info;
+}
+
+int32_t V4L2M2MH264Encoder::Encode(
+    const webrtc::VideoFrame& input_frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (!callback_) {
+    RTC_LOG(LS_WARNING)
+        << "InitEncode() has been called, but a callback function "
+        << "has not been set with RegisterEncodeCompleteCallback()";
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer =
+      SimulcastFrameBuffer::SelectLayer(input_frame.video_frame_buffer(),
+                                        width_, height_);
+
+  // 出力が止まっている場合も、PeerConnection はそのままでエンコーダだけを作り直す
+  const bool stalled = metrics_.IsStalled();
+  if (stalled) {
+    metrics_.OnStallReset();
+    V4L2Release();
+  }
+
+  // dmabuf をそのまま渡せるのは、エンコーダの配置と同じ場合だけ。
+  // 受け付けなかった場合は、このフレームからコピーして渡すように設定し直す。
+  // フレームを捨てるとキーフレームの要求も一緒に失われるため
+  for (;;) {
+    uint32_t dmabuf_format =
+        dmabuf_rejected_ ? 0 : GetDmabufFormat(frame_buffer.get());
+    uint32_t offsets[3];
+    uint32_t pitches[3];
+    if (dmabuf_format != 0 &&
+        !static_cast<NativeBuffer*>(frame_buffer.get())
+             ->GetDmabufPlanes(offsets, pitches)) {
+      dmabuf_format = 0;
+    }
+    const bool dmabuf_input = dmabuf_format != 0;
+
+    if (fd_ < 0 || frame_buffer->width() != configured_width_ ||
+        frame_buffer->height() != configured_height_ ||
+        dmabuf_input != dmabuf_input_ ||
+        (dmabuf_input &&
+         (dmabuf_format != raw_format_ || pitches[0] != stride_))) {
+      V4L2Release();
+      width_ = frame_buffer->width();
+      height_ = frame_buffer->height();
+      RTC_LOG(LS_INFO) << "Encoder initialized to " << width_ << "x"
+                       << height_ << (dmabuf_input ? " (dmabuf)" : "");
+      if (V4L2Configure(dmabuf_format, dmabuf_input ? pitches[0] : 0) !=
+          WEBRTC_VIDEO_CODEC_OK) {
+        RTC_LOG(LS_ERROR) << "Failed to V4L2Configure";
+        V4L2Release();
+        if (!dmabuf_input) {
+          return WEBRTC_VIDEO_CODEC_ERROR;
+        }
+        // 形式やピッチを受け付けなかった
+        dmabuf_rejected_ = true;
+        continue;
+      }
+      // 作り直したエンコーダは最初に I フレームを出す
+      key_frame_throttle_.OnKeyFrame(rtc::TimeMillis());
+    }
+    if (dmabuf_input && !MatchesLayout(offsets, pitches)) {
+      RTC_LOG(LS_WARNING) << "dmabuf plane layout does not match the encoder."
+                          << " Copy frames from now on";
+      dmabuf_rejected_ = true;
+      V4L2Release();
+      continue;
+    }
+    break;
+  }
+
+  bool key_frame_requested = false;
+  if (frame_types != nullptr) {
+    RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
+    if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+      metrics_.OnSkipped();
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    key_frame_requested =
+        (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+  }
+
+  const KeyFrameThrottle::Action key_frame_action =
+      key_frame_throttle_.Update(key_frame_requested, false, rtc::TimeMillis());
+  if (key_frame_action != KeyFrameThrottle::Action::kKeyFrame &&
+      key_frame_requested) {
+    metrics_.OnKeyFrameRequestCoalesced();
+  }
+
+  const int index = PopFreeOutputBuffer();
+  if (index < 0) {
+    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " Drop frame";
+    metrics_.OnDropped();
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  if (key_frame_action == KeyFrameThrottle::Action::kKeyFrame) {
+    SetControl(V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1);
+  }
+  SetBitrateBps(bitrate_adjuster_.GetAdjustedBitrateBps());
+  SetFramerateFps(target_framerate_fps_);
+  PushFrameParams(FrameParams(input_frame, frame_buffer->width(),
+                              frame_buffer->height()));
+  metrics_.OnSubmit(input_frame.timestamp());
+
+  if (!QueueOutputBuffer(index, input_frame, frame_buffer)) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
@@ -0,0 +1,114 @@
+#ifndef V4L2_M2M_H264_ENCODER_H_
+#define V4L2_M2M_H264_ENCODER_H_
+
+#include <linux/videodev2.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "api/video_codecs/video_encoder.h"
+#include "modules/video_coding/codecs/h264/include/h264.h"
+#include "rtc/hw_video_encoder.h"
+#include "rtc/key_frame_throttle.h"
+#include "rtc_base/platform_thread.h"
+
+// V4L2 の mem2mem (stateful) なハードウェアエンコーダを使う H.264 エンコーダ。
+// Raspberry Pi の bcm2835-codec や Rockchip、Amlogic などのボードで、専用のバックエンド無しで動く。
+//
+// LibcameraBuffer や V4L2DmabufBuffer のように dmabuf を持つ I420 か NV12 のフレームは、
+// その fd を V4L2_MEMORY_DMABUF でそのまま OUTPUT キューに入れるので、
+// キャプチャからエンコードまで CPU はフレームに触らない。
+// それ以外のフレームは V4L2_MEMORY_MMAP のバッファに I420 (対応していなければ NV12) でコピーする。
+// どちらで入力するかは最初のフレームで決め、フレームの種類が変わった場合は設定し直す。
+// OUTPUT キューには複数のフレームを入れておけるので、エンコードを待たずに次のフレームを渡せる。
+//
+// Y と UV が別の dmabuf に分かれている形式 (NV12M など) には対応していない。
+class V4L2M2MH264Encoder : public HWVideoEncoder {
+ public:
+  V4L2M2MH264Encoder(const cricket::VideoCodec& codec,
+                     KeyFrameThrottle::Settings key_frame_throttle =
+                         KeyFrameThrottle::Settings());
+  ~V4L2M2MH264Encoder() override;
+
+  // H.264 を出力できる V4L2 M2M のデバイスがあるか
+  static bool IsSupported();
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores,
+                     size_t max_payload_size) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+ private:
+  // mmap したバッファ
+  struct MappedBuffer {
+    void* start;
+    size_t length;
+  };
+
+  // デバイスを開いて、今の解像度と入力の種類で設定してストリームを開始する。
+  // dmabuf_format が 0 の場合はコピーして入力する
+  int32_t V4L2Configure(uint32_t dmabuf_format, uint32_t stride);
+  // ストリームを止めてバッファとデバイスを閉じる
+  void V4L2Release();
+  int32_t SetFormat(bool dmabuf_input, uint32_t stride);
+  int32_t SetupBuffers(bool dmabuf_input);
+  bool SetControl(uint32_t id, int32_t value);
+  // dmabuf のプレーンの配置が、エンコーダの期待する配置と同じか
+  bool MatchesLayout(const uint32_t offsets[3], const uint32_t pitches[3]) const;
+  void SetBitrateBps(uint32_t bitrate_bps);
+  void SetFramerateFps(double framerate_fps);
+
+  // OUTPUT キューの空いているバッファの番号を取り出す。無い場合は -1
+  int PopFreeOutputBuffer();
+  bool QueueOutputBuffer(int index,
+                         const webrtc::VideoFrame& frame,
+                         rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer);
+
+  static void PollThread(void* obj);
+  void PollLoop();
+  void DequeueOutputBuffers();
+  void DequeueCaptureBuffers();
+
+  std::mutex mtx_;
+  int fd_;
+  // OUTPUT キューに dmabuf を直接入れている
+  bool dmabuf_input_;
+  // OUTPUT キューの形式。V4L2_PIX_FMT_YUV420 か V4L2_PIX_FMT_NV12
+  uint32_t raw_format_;
+  // OUTPUT キューの Y プレーンのピッチと、U, V プレーンの配置に使う高さ
+  uint32_t stride_;
+  uint32_t plane_height_;
+  // dmabuf の配置がエンコーダと合わなかったので、以降はコピーして渡す
+  bool dmabuf_rejected_ = false;
+  std::vector<MappedBuffer> output_buffers_;
+  std::vector<MappedBuffer> capture_buffers_;
+  // MemoryAccounting に計上しているバッファの大きさ
+  int64_t buffer_bytes_ = 0;
+
+  std::mutex output_mtx_;
+  std::vector<int> free_output_buffers_;
+  // エンコーダに入れている間、入力のフレームの参照を持っておく
+  std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> queued_frames_;
+
+  std::atomic<bool> quit_{false};
+  std::unique_ptr<rtc::PlatformThread> poll_thread_;
+
+  uint32_t configured_bitrate_bps_;
+  double target_framerate_fps_;
+  int32_t configured_framerate_fps_;
+  int32_t width_;
+  int32_t height_;
+  int32_t configured_width_;
+  int32_t configured_height_;
+};
+
+#endif  // V4L2_M2M_H264_ENCODER_H_
@@ -0,0 +1,799 @@
+#include "vaapi_h264_encoder.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "dyn/va.h"
+#include "rtc/memory_accounting.h"
+#include "rtc/native_buffer.h"
+#include "rtc/simulcast_frame_buffer.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv/convert_from.h"
+
+namespace {
+const int kLowH264QpThreshold = 34;
+const int kHighH264QpThreshold = 40;
+
+// 探すレンダーノードの数 (/dev/dri/renderD128 から)
+const int kMaxRenderNodes = 8;
+// コピーして入力する場合のサーフェスの数
+const int kInputSurfaces = 2;
+// 再構成画像のサーフェスの数。現在のフレームと参照するフレームの分
+const int kRefSurfaces = 2;
+// インポートしたサーフェスをこれ以上持たない。キャプチャのバッファの数より十分に大きくしておく
+const size_t kMaxImportedSurfaces = 16;
+// 要求が無くてもこのフレーム数毎に IDR を出す
+const uint32_t kIntraPeriod = 500;
+// frame_num は log2_max_frame_num_minus4 = 4 なので 256 で一周する
+const uint32_t kMaxFrameNum = 256;
+
+struct RenderNode {
+  std::string path;
+  VAEntrypoint entrypoint;
+};
+
+bool CheckStatus(VAStatus status, const char* name) {
+  if (status != VA_STATUS_SUCCESS) {
+    RTC_LOG(LS_ERROR) << name << " failed: " << dyn::vaErrorStr(status);
+    return false;
+  }
+  return true;
+}
+
+// H.264 のエンコードに使うエントリポイント。無い場合は false
+bool FindEncodeEntrypoint(VADisplay display, VAEntrypoint* entrypoint) {
+  std::vector<VAEntrypoint> entrypoints(dyn::vaMaxNumEntrypoints(display));
+  int num_entrypoints = 0;
+  if (dyn::vaQueryConfigEntrypoints(display, VAProfileH264ConstrainedBaseline,
+                                    entrypoints.data(),
+                                    &num_entrypoints) != VA_STATUS_SUCCESS) {
+    return false;
+  }
+  // 新しい Intel の GPU は低電力 (VDEnc) のエントリポイントしか持たない
+  for (VAEntrypoint candidate : {VAEntrypointEncSlice, VAEntrypointEncSliceLP}) {
+    for (int i = 0; i < num_entrypoints; i++) {
+      if (entrypoints[i] == candidate) {
+        *entrypoint = candidate;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// H.264 をエンコードできるレンダーノードを探す。結果はプロセスの中でキャッシュする
+const RenderNode& FindRenderNode() {
+  static std::mutex mutex;
+  static bool searched = false;
+  static RenderNode found;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (searched) {
+    return found;
+  }
+  searched = true;
+  for (int i = 0; i < kMaxRenderNodes && found.path.empty(); i++) {
+    std::string path = "/dev/dri/renderD" + std::to_string(128 + i);
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+      continue;
+    }
+    VADisplay display = dyn::vaGetDisplayDRM(fd);
+    int major, minor;
+    if (display != nullptr &&
+        dyn::vaInitialize(display, &major, &minor) == VA_STATUS_SUCCESS) {
+      VAEntrypoint entrypoint;
+      if (FindEncodeEntrypoint(display, &entrypoint)) {
+        RTC_LOG(LS_INFO) << "Found VA-API H264 encoder: " << path
+                         << " (VA-API " << major << "." << minor
+                         << (entrypoint == VAEntrypointEncSliceLP ? ", low power"
+                                                                  : "")
+                         << ")";
+        found.path = path;
+        found.entrypoint = entrypoint;
+      }
+      dyn::vaTerminate(display);
+    }
+    close(fd);
+  }
+  return found;
+}
+
+// 参照しないピクチャ
+VAPictureH264 InvalidPicture() {
+  VAPictureH264 picture;
+  memset(&picture, 0, sizeof(picture));
+  picture.picture_id = VA_INVALID_SURFACE;
+  picture.flags = VA_PICTURE_H264_INVALID;
+  return picture;
+}
+
+// VAEncMiscParameterBuffer の後ろに param を続けたバッファを作る
+template <class T>
+std::vector<uint8_t> MiscParam(VAEncMiscParameterType type, const T& param) {
+  std::vector<uint8_t> data(sizeof(VAEncMiscParameterBuffer) + sizeof(T));
+  VAEncMiscParameterBuffer* header =
+      reinterpret_cast<VAEncMiscParameterBuffer*>(data.data());
+  header->type = type;
+  memcpy(header->data, &param, sizeof(T));
+  return data;
+}
+
+}  // namespace
+
+VaapiH264Encoder::VaapiH264Encoder(
+    const cricket::VideoCodec& codec,
+    KeyFrameThrottle::Settings key_frame_throttle)
+    : HWVideoEncoder("VA-API H264", key_frame_throttle) {
+  upload_image_.image_id = VA_INVALID_ID;
+}
+
+VaapiH264Encoder::~VaapiH264Encoder() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  VaapiRelease();
+}
+
+bool VaapiH264Encoder::IsSupported() {
+  // 読み込めない状態で dyn の関数を呼ぶと終了してしまうので、先に確かめる
+  if (!dyn::DynModule::Instance().IsLoadable(dyn::VA_SO)) {
+    return false;
+  }
+  if (!dyn::DynModule::Instance().IsLoadable(dyn::VA_DRM_SO)) {
+    return false;
+  }
+  return !FindRenderNode().path.empty();
+}
+
+int32_t VaapiH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
+                                     int32_t number_of_cores,
+                                     size_t max_payload_size) {
+  RTC_DCHECK(codec_settings);
+  RTC_DCHECK_EQ(codec_settings->codecType, webrtc::kVideoCodecH264);
+
+  // サイマルキャストは SimulcastEncoderAdapter に任せる
+  if (codec_settings->numberOfSimulcastStreams > 1) {
+    return WEBRTC_VIDEO_CODEC_ERR_SIMULCAST_PARAMETERS_NOT_SUPPORTED;
+  }
+
+  int32_t release_ret = Release();
+  if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
+    return release_ret;
+  }
+
+  width_ = codec_settings->width;
+  height_ = codec_settings->height;
+  SetTargetBitrateBps(codec_settings->startBitrate * 1000);
+
+  RTC_LOG(LS_INFO) << "InitEncode " << target_bitrate_bps_ << "bit/sec";
+
+  InitEncodedImage(*codec_settings);
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t VaapiH264Encoder::Release() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  VaapiRelease();
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t VaapiH264Encoder::VaapiConfigure() {
+  const RenderNode& node = FindRenderNode();
+  drm_fd_ = open(node.path.c_str(), O_RDWR);
+  if (drm_fd_ < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << node.path;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  display_ = dyn::vaGetDisplayDRM(drm_fd_);
+  if (display_ == nullptr) {
+    RTC_LOG(LS_ERROR) << "Failed to vaGetDisplayDRM";
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  int major, minor;
+  if (!CheckStatus(dyn::vaInitialize(display_, &major, &minor),
+                   "vaInitialize")) {
+    dyn::vaTerminate(display_);
+    display_ = nullptr;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  VAConfigAttrib attribs[2];
+  attribs[0].type = VAConfigAttribRTFormat;
+  attribs[1].type = VAConfigAttribRateControl;
+  if (!CheckStatus(dyn::vaGetConfigAttributes(
+                       display_, VAProfileH264ConstrainedBaseline,
+                       node.entrypoint, attribs, 2),
+                   "vaGetConfigAttributes")) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  if (attribs[0].value == VA_ATTRIB_NOT_SUPPORTED ||
+      !(attribs[0].value & VA_RT_FORMAT_YUV420)) {
+    RTC_LOG(LS_ERROR) << "VA-API encoder does not accept YUV420";
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  // CBR が無いドライバでは VBR を使う
+  uint32_t rate_control = VA_RC_NONE;
+  if (attribs[1].value != VA_ATTRIB_NOT_SUPPORTED) {
+    if (attribs[1].value & VA_RC_CBR) {
+      rate_control = VA_RC_CBR;
+    } else if (attribs[1].value & VA_RC_VBR) {
+      rate_control = VA_RC_VBR;
+    }
+  }
+  if (rate_control == VA_RC_NONE) {
+    RTC_LOG(LS_ERROR) << "VA-API encoder does not support bitrate control";
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  attribs[0].value = VA_RT_FORMAT_YUV420;
+  attribs[1].value = rate_control;
+  if (!CheckStatus(dyn::vaCreateConfig(display_,
+                                       VAProfileH264ConstrainedBaseline,
+                                       node.entrypoint, attribs, 2,
+                                       &config_id_),
+                   "vaCreateConfig")) {
+    config_id_ = VA_INVALID_ID;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  aligned_width_ = (width_ + 15) & ~15;
+  aligned_height_ = (height_ + 15) & ~15;
+  ref_surfaces_.resize(kRefSurfaces);
+  if (!CheckStatus(dyn::vaCreateSurfaces(display_, VA_RT_FORMAT_YUV420,
+                                         aligned_width_, aligned_height_,
+                                         ref_surfaces_.data(), kRefSurfaces,
+                                         nullptr, 0),
+                   "vaCreateSurfaces")) {
+    ref_surfaces_.clear();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  input_surfaces_.resize(kInputSurfaces);
+  if (!CheckStatus(dyn::vaCreateSurfaces(display_, VA_RT_FORMAT_YUV420,
+                                         aligned_width_, aligned_height_,
+                                         input_surfaces_.data(), kInputSurfaces,
+                                         nullptr, 0),
+                   "vaCreateSurfaces")) {
+    input_surfaces_.clear();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  if (!CheckStatus(dyn::vaCreateContext(display_, config_id_, aligned_width_,
+                                        aligned_height_, VA_PROGRESSIVE,
+                                        ref_surfaces_.data(), kRefSurfaces,
+                                        &context_id_),
+                   "vaCreateContext")) {
+    context_id_ = VA_INVALID_ID;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  const size_t frame_size = aligned_width_ * aligned_height_ * 3 / 2;
+  if (!CheckStatus(dyn::vaCreateBuffer(display_, context_id_,
+                                       VAEncCodedBufferType, frame_size, 1,
+                                       nullptr, &coded_buffer_),
+                   "vaCreateBuffer")) {
+    coded_buffer_ = VA_INVALID_ID;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  // サーフェスを直接マップできないドライバでは、別の画像から転送する
+  VAImage image;
+  derive_image_ = dyn::vaDeriveImage(display_, input_surfaces_[0], &image) ==
+                  VA_STATUS_SUCCESS;
+  if (derive_image_) {
+    derive_image_ = image.format.fourcc == VA_FOURCC_NV12;
+    dyn::vaDestroyImage(display_, image.image_id);
+  }
+  if (!derive_image_) {
+    VAImageFormat format;
+    memset(&format, 0, sizeof(format));
+    format.fourcc = VA_FOURCC_NV12;
+    format.byte_order = VA_LSB_FIRST;
+    format.bits_per_pixel = 12;
+    if (!CheckStatus(dyn::vaCreateImage(display_, &format, aligned_width_,
+                                        aligned_height_, &upload_image_),
+                     "vaCreateImage")) {
+      upload_image_.image_id = VA_INVALID_ID;
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+  }
+
+  surface_bytes_ = frame_size * (kRefSurfaces + kInputSurfaces + 1);
+  MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder,
+                                   surface_bytes_);
+
+  next_input_surface_ = 0;
+  current_ref_surface_ = 0;
+  frame_num_ = 0;
+  rate_control_changed_ = true;
+  configured_width_ = width_;
+  configured_height_ = height_;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void VaapiH264Encoder::VaapiRelease() {
+  if (display_ != nullptr) {
+    for (auto& imported : imported_surfaces_) {
+      dyn::vaDestroySurfaces(display_, &imported.second, 1);
+    }
+    if (upload_image_.image_id != VA_INVALID_ID) {
+      dyn::vaDestroyImage(display_, upload_image_.image_id);
+    }
+    if (coded_buffer_ != VA_INVALID_ID) {
+      dyn::vaDestroyBuffer(display_, coded_buffer_);
+    }
+    if (context_id_ != VA_INVALID_ID) {
+      dyn::vaDestroyContext(display_, context_id_);
+    }
+    if (!input_surfaces_.empty()) {
+      dyn::vaDestroySurfaces(display_, input_surfaces_.data(),
+                             input_surfaces_.size());
+    }
+    if (!ref_surfaces_.empty()) {
+      dyn::vaDestroySurfaces(display_, ref_surfaces_.data(),
+                             ref_surfaces_.size());
+    }
+    if (config_id_ != VA_INVALID_ID) {
+      dyn::vaDestroyConfig(display_, config_id_);
+    }
+    dyn::vaTerminate(display_);
+    display_ = nullptr;
+  }
+  imported_surfaces_.clear();
+  upload_image_.image_id = VA_INVALID_ID;
+  coded_buffer_ = VA_INVALID_ID;
+  context_id_ = VA_INVALID_ID;
+  input_surfaces_.clear();
+  ref_surfaces_.clear();
+  config_id_ = VA_INVALID_ID;
+  if (drm_fd_ >= 0) {
+    close(drm_fd_);
+    drm_fd_ = -1;
+  }
+  MemoryAccounting::Instance().Add(MemoryAccounting::kHwEncoder,
+                                   -surface_bytes_);
+  surface_bytes_ = 0;
+  configured_width_ = 0;
+  configured_height_ = 0;
+}
+
+VASurfaceID VaapiH264Encoder::ImportDmabuf(
+    webrtc::VideoFrameBuffer* frame_buffer) {
+  if (frame_buffer->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+    return VA_INVALID_SURFACE;
+  }
+  NativeBuffer* native_buffer = dynamic_cast<NativeBuffer*>(frame_buffer);
+  // 縮小の指定がある場合は CPU で縮小する必要がある
+  if (native_buffer == nullptr || native_buffer->dmabuf_fd() < 0 ||
+      native_buffer->width() != native_buffer->raw_width() ||
+      native_buffer->height() != native_buffer->raw_height()) {
+    return VA_INVALID_SURFACE;
+  }
+  uint32_t fourcc;
+  uint32_t num_planes;
+  switch (native_buffer->VideoType()) {
+    case webrtc::VideoType::kNV12:
+      fourcc = VA_FOURCC_NV12;
+      num_planes = 2;
+      break;
+    case webrtc::VideoType::kI420:
+      fourcc = VA_FOURCC_I420;
+      num_planes = 3;
+      break;
+    default:
+      return VA_INVALID_SURFACE;
+  }
+  uint32_t offsets[3];
+  uint32_t pitches[3];
+  if (!native_buffer->GetDmabufPlanes(offsets, pitches)) {
+    return VA_INVALID_SURFACE;
+  }
+
+  const DmabufKey key(native_buffer->dmabuf_fd(), native_buffer->length(),
+                      pitches[0]);
+  auto it = imported_surfaces_.find(key);
+  if (it != imported_surfaces_.end()) {
+    return it->second;
+  }
+  // キャプチャを作り直して fd が変わった場合に増え続けないようにする
+  if (imported_surfaces_.size() >= kMaxImportedSurfaces) {
+    for (auto& imported : imported_surfaces_) {
+      dyn::vaDestroySurfaces(display_, &imported.second, 1);
+    }
+    imported_surfaces_.clear();
+  }
+
+  uintptr_t fd = native_buffer->dmabuf_fd();
+  VASurfaceAttribExternalBuffers external;
+  memset(&external, 0, sizeof(external));
+  external.pixel_format = fourcc;
+  external.width = native_buffer->raw_width();
+  external.height = native_buffer->raw_height();
+  external.data_size = native_buffer->length();
+  external.num_planes = num_planes;
+  for (uint32_t i = 0; i < num_planes; i++) {
+    external.pitches[i] = pitches[i];
+    external.offsets[i] = offsets[i];
+  }
+  external.buffers = &fd;
+  external.num_buffers = 1;
+
+  VASurfaceAttrib attribs[2];
+  memset(attribs, 0, sizeof(attribs));
+  attribs[0].type = VASurfaceAttribMemoryType;
+  attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+  attribs[0].value.type = VAGenericValueTypeInteger;
+  attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME;
+  attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
+  attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+  attribs[1].value.type = VAGenericValueTypePointer;
+  attribs[1].value.value.p = &external;
+
+  VASurfaceID surface;
+  if (!CheckStatus(dyn::vaCreateSurfaces(display_, VA_RT_FORMAT_YUV420,
+                                         external.width, external.height,
+                                         &surface, 1, attribs, 2),
+                   "vaCreateSurfaces")) {
+    return VA_INVALID_SURFACE;
+  }
+  imported_surfaces_[key] = surface;
+  return surface;
+}
+
+VASurfaceID VaapiH264Encoder::UploadFrame(
+    webrtc::VideoFrameBuffer* frame_buffer) {
+  rtc::scoped_refptr<const webrtc::I420BufferInterface> i420_buffer =
+      frame_buffer->ToI420();
+  VASurfaceID surface = input_surfaces_[next_input_surface_];
+  next_input_surface_ = (next_input_surface_ + 1) % input_surfaces_.size();
+
+  VAImage image = upload_image_;
+  if (derive_image_ &&
+      !CheckStatus(dyn::vaDeriveImage(display_, surface, &image),
+                   "vaDeriveImage")) {
+    return VA_INVALID_SURFACE;
+  }
+  void* data = nullptr;
+  bool ok = CheckStatus(dyn::vaMapBuffer(display_, image.buf, &data),
+                        "vaMapBuffer");
+  if (ok) {
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    libyuv::I420ToNV12(i420_buffer->DataY(), i420_buffer->StrideY(),
+                       i420_buffer->DataU(), i420_buffer->StrideU(),
+                       i420_buffer->DataV(), i420_buffer->StrideV(),
+                       dst + image.offsets[0], image.pitches[0],
+                       dst + image.offsets[1], image.pitches[1],
+                       i420_buffer->width(), i420_buffer->height());
+    dyn::vaUnmapBuffer(display_, image.buf);
+  }
+  if (derive_image_) {
+    dyn::vaDestroyImage(display_, image.image_id);
+  } else if (ok) {
+    ok = CheckStatus(
+        dyn::vaPutImage(display_, surface, image.image_id, 0, 0,
+                        i420_buffer->width(), i420_buffer->height(), 0, 0,
+                        i420_buffer->width(), i420_buffer->height()),
+        "vaPutImage");
+  }
+  return ok ? surface : VA_INVALID_SURFACE;
+}
+
+bool VaapiH264Encoder::AddParamBuffer(VABufferType type,
+                                      const void* data,
+                                      size_t size,
+                                      std::vector<VABufferID>& buffers) {
+  VABufferID buffer;
+  if (!CheckStatus(dyn::vaCreateBuffer(display_, context_id_, type, size, 1,
+                                       const_cast<void*>(data), &buffer),
+                   "vaCreateBuffer")) {
+    return false;
+  }
+  buffers.push_back(buffer);
+  return true;
+}
+
+bool VaapiH264Encoder::AddRateControlParams(std::vector<VABufferID>& buffers) {
+  VAEncMiscParameterRateControl rate_control;
+  memset(&rate_control, 0, sizeof(rate_control));
+  rate_control.bits_per_second = configured_bitrate_bps_;
+  rate_control.target_percentage = 100;
+  rate_control.window_size = 1000;
+  rate_control.initial_qp = 26;
+  rate_control.rc_flags.bits.reset = 1;
+  std::vector<uint8_t> rc_param =
+      MiscParam(VAEncMiscParameterTypeRateControl, rate_control);
+
+  // 1 秒分のバッファにして、フレーム毎の大きさのばらつきを抑える
+  VAEncMiscParameterHRD hrd;
+  memset(&hrd, 0, sizeof(hrd));
+  hrd.buffer_size = configured_bitrate_bps_;
+  hrd.initial_buffer_fullness = configured_bitrate_bps_ / 2;
+  std::vector<uint8_t> hrd_param = MiscParam(VAEncMiscParameterTypeHRD, hrd);
+
+  VAEncMiscParameterFrameRate framerate;
+  memset(&framerate, 0, sizeof(framerate));
+  framerate.framerate = configured_framerate_fps_;
+  std::vector<uint8_t> framerate_param =
+      MiscParam(VAEncMiscParameterTypeFrameRate, framerate);
+
+  return AddParamBuffer(VAEncMiscParameterBufferType, rc_param.data(),
+                        rc_param.size(), buffers) &&
+         AddParamBuffer(VAEncMiscParameterBufferType, hrd_param.data(),
+                        hrd_param.size(), buffers) &&
+         AddParamBuffer(VAEncMiscParameterBufferType, framerate_param.data(),
+                        framerate_param.size(), buffers);
+}
+
+int32_t VaapiH264Encoder::EncodeSurface(VASurfaceID input, bool idr) {
+  if (idr) {
+    frame_num_ = 0;
+  }
+  const VASurfaceID current = ref_surfaces_[current_ref_surface_];
+  const VASurfaceID previous =
+      ref_surfaces_[(current_ref_surface_ + 1) % ref_surfaces_.size()];
+
+  VAPictureH264 reference = InvalidPicture();
+  if (!idr) {
+    reference.picture_id = previous;
+    reference.frame_idx = (frame_num_ - 1) % kMaxFrameNum;
+    reference.flags = VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+    reference.TopFieldOrderCnt = (frame_num_ - 1) * 2;
+    reference.BottomFieldOrderCnt = reference.TopFieldOrderCnt;
+  }
+
+  std::vector<VABufferID> buffers;
+  bool ok = true;
+  if (idr) {
+    VAEncSequenceParameterBufferH264 seq;
+    memset(&seq, 0, sizeof(seq));
+    seq.seq_parameter_set_id = 0;
+    seq.level_idc = aligned_width_ * aligned_height_ > 1920 * 1088 ? 51 : 41;
+    seq.intra_period = kIntraPeriod;
+    seq.intra_idr_period = kIntraPeriod;
+    seq.ip_period = 1;
+    seq.bits_per_second = configured_bitrate_bps_;
+    seq.max_num_ref_frames = 1;
+    seq.picture_width_in_mbs = aligned_width_ / 16;
+    seq.picture_height_in_mbs = aligned_height_ / 16;
+    seq.seq_fields.bits.chroma_format_idc = 1;
+    seq.seq_fields.bits.frame_mbs_only_flag = 1;
+    seq.seq_fields.bits.direct_8x8_inference_flag = 1;
+    seq.seq_fields.bits.log2_max_frame_num_minus4 = 4;
+    // B フレームを使わないので、POC は frame_num から決まる
+    seq.seq_fields.bits.pic_order_cnt_type = 2;
+    if (aligned_width_ != width_ || aligned_height_ != height_) {
+      seq.frame_cropping_flag = 1;
+      seq.frame_crop_right_offset = (aligned_width_ - width_) / 2;
+      seq.frame_crop_bottom_offset = (aligned_height_ - height_) / 2;
+    }
+    seq.vui_parameters_present_flag = 1;
+    seq.vui_fields.bits.timing_info_present_flag = 1;
+    seq.num_units_in_tick = 1;
+    seq.time_scale = configured_framerate_fps_ * 2;
+    ok = AddParamBuffer(VAEncSequenceParameterBufferType, &seq, sizeof(seq),
+                        buffers);
+  }
+  if (ok && (idr || rate_control_changed_)) {
+    ok = AddRateControlParams(buffers);
+    rate_control_changed_ = false;
+  }
+
+  VAEncPictureParameterBufferH264 pic;
+  memset(&pic, 0, sizeof(pic));
+  pic.CurrPic.picture_id = current;
+  pic.CurrPic.frame_idx = frame_num_ % kMaxFrameNum;
+  pic.CurrPic.TopFieldOrderCnt = frame_num_ * 2;
+  pic.CurrPic.BottomFieldOrderCnt = pic.CurrPic.TopFieldOrderCnt;
+  for (int i = 0; i < 16; i++) {
+    pic.ReferenceFrames[i] = InvalidPicture();
+  }
+  pic.ReferenceFrames[0] = reference;
+  pic.coded_buf = coded_buffer_;
+  pic.pic_parameter_set_id = 0;
+  pic.seq_parameter_set_id = 0;
+  pic.frame_num = frame_num_ % kMaxFrameNum;
+  pic.pic_init_qp = 26;
+  pic.num_ref_idx_l0_active_minus1 = 0;
+  pic.pic_fields.bits.idr_pic_flag = idr ? 1 : 0;
+  pic.pic_fields.bits.reference_pic_flag = 1;
+  // Constrained Baseline なので CAVLC を使う
+  pic.pic_fields.bits.entropy_coding_mode_flag = 0;
+  pic.pic_fields.bits.deblocking_filter_control_present_flag = 1;
+  ok = ok && AddParamBuffer(VAEncPictureParameterBufferType, &pic,
+                            sizeof(pic), buffers);
+
+  VAEncSliceParameterBufferH264 slice;
+  memset(&slice, 0, sizeof(slice));
+  slice.macroblock_address = 0;
+  slice.num_macroblocks = (aligned_width_ / 16) * (aligned_height_ / 16);
+  slice.macroblock_info = VA_INVALID_ID;
+  // 2 が I スライス、0 が P スライス
+  slice.slice_type = idr ? 2 : 0;
+  slice.pic_parameter_set_id = 0;
+  slice.idr_pic_id = idr_pic_id_;
+  for (int i = 0; i < 32; i++) {
+    slice.RefPicList0[i] = InvalidPicture();
+    slice.RefPicList1[i] = InvalidPicture();
+  }
+  slice.RefPicList0[0] = reference;
+  ok = ok && AddParamBuffer(VAEncSliceParameterBufferType, &slice,
+                            sizeof(slice), buffers);
+
+  if (ok) {
+    ok = CheckStatus(dyn::vaBeginPicture(display_, context_id_, input),
+                     "vaBeginPicture") &&
+         CheckStatus(dyn::vaRenderPicture(display_, context_id_,
+                                          buffers.data(), buffers.size()),
+                     "vaRenderPicture") &&
+         CheckStatus(dyn::vaEndPicture(display_, context_id_), "vaEndPicture");
+  }
+  // libva 2 では vaRenderPicture に渡したバッファは自分で破棄する
+  for (VABufferID buffer : buffers) {
+    dyn::vaDestroyBuffer(display_, buffer);
+  }
+  if (!ok || !CheckStatus(dyn::vaSyncSurface(display_, input),
+                          "vaSyncSurface")) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  VACodedBufferSegment* segment = nullptr;
+  if (!CheckStatus(
+          dyn::vaMapBuffer(display_, coded_buffer_, (void**)&segment),
+          "vaMapBuffer")) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  encoded_.clear();
+  for (; segment != nullptr;
+       segment = static_cast<VACodedBufferSegment*>(segment->next)) {
+    const uint8_t* data = static_cast<const uint8_t*>(segment->buf);
+    encoded_.insert(encoded_.end(), data, data + segment->size);
+  }
+  dyn::vaUnmapBuffer(display_, coded_buffer_);
+
+  current_ref_surface_ = (current_ref_surface_ + 1) % ref_surfaces_.size();
+  frame_num_++;
+  if (idr) {
+    idr_pic_id_++;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t VaapiH264Encoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void VaapiH264Encoder::SetRates(const RateControlParameters& parameters) {
+  if (parameters.bitrate.get_sum_bps() <= 0 || parameters.framerate_fps <= 0)
+    return;
+
+  RTC_LOG(LS_INFO) << __FUNCTION__
+                   << " bitrate:" << parameters.bitrate.get_sum_bps()
+                   << " fps:" << parameters.framerate_fps;
+  std::lock_guard<std::mutex> lock(mtx_);
+  SetTargetBitrateBps(parameters.bitrate.get_sum_bps());
+  target_framerate_fps_ = parameters.framerate_fps;
+}
+
+webrtc::VideoEncoder::EncoderInfo VaapiH264Encoder::GetEncoderInfo() const {
+  EncoderInfo info;
+  info.supports_native_handle = true;
+  info.implementation_name = "VA-API H264";
+  info.scaling_settings =
+      VideoEncoder::ScalingSettings(kLowH264QpThreshold, kHighH264QpThreshold);
+  info.is_hardware_accelerated = true;
+  info.has_internal_source = false;
+  return info;
+}
+
+int32_t VaapiH264Encoder::Encode(
+    const webrtc::VideoFrame& input_frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (!callback_) {
+    RTC_LOG(LS_WARNING)
+        << "InitEncode() has been called, but a callback function "
+        << "has not been set with RegisterEncodeCompleteCallback()";
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer =
+      SimulcastFrameBuffer::SelectLayer(input_frame.video_frame_buffer(),
+                                        width_, height_);
+
+  // 出力が止まっている場合も、PeerConnection はそのままでエンコーダだけを作り直す
+  const bool stalled = metrics_.IsStalled();
+  if (stalled) {
+    metrics_.OnStallReset();
+  }
+  bool reconfigured = false;
+  if (stalled || display_ == nullptr ||
+      frame_buffer->width() != configured_width_ ||
+      frame_buffer->height() != configured_height_) {
+    VaapiRelease();
+    width_ = frame_buffer->width();
+    height_ = frame_buffer->height();
+    RTC_LOG(LS_INFO) << "Encoder initialized to " << width_ << "x" << height_;
+    if (VaapiConfigure() != WEBRTC_VIDEO_CODEC_OK) {
+      RTC_LOG(LS_ERROR) << "Failed to VaapiConfigure";
+      VaapiRelease();
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    reconfigured = true;
+  }
+
+  bool key_frame_requested = false;
+  if (frame_types != nullptr) {
+    RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
+    if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+      metrics_.OnSkipped();
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    key_frame_requested =
+        (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+  }
+
+  const int64_t now_ms = rtc::TimeMillis();
+  const KeyFrameThrottle::Action key_frame_action =
+      key_frame_throttle_.Update(key_frame_requested, false, now_ms);
+  if (key_frame_action != KeyFrameThrottle::Action::kKeyFrame &&
+      key_frame_requested) {
+    metrics_.OnKeyFrameRequestCoalesced();
+  }
+  bool idr = key_frame_action == KeyFrameThrottle::Action::kKeyFrame;
+  // 作り直したエンコーダの最初のフレームと、一定の間隔のフレームは要求が無くても IDR にする
+  if (!idr && (reconfigured || frame_num_ >= kIntraPeriod)) {
+    key_frame_throttle_.OnKeyFrame(now_ms);
+    idr = true;
+  }
+
+  const uint32_t bitrate_bps = bitrate_adjuster_.GetAdjustedBitrateBps();
+  if (bitrate_bps != configured_bitrate_bps_ ||
+      (int32_t)target_framerate_fps_ != configured_framerate_fps_) {
+    configured_bitrate_bps_ = bitrate_bps;
+    configured_framerate_fps_ = (int32_t)target_framerate_fps_;
+    rate_control_changed_ = true;
+  }
+
+  VASurfaceID input =
+      dmabuf_rejected_ ? VA_INVALID_SURFACE : ImportDmabuf(frame_buffer.get());
+  if (input == VA_INVALID_SURFACE) {
+    if (!dmabuf_rejected_ && frame_buffer->type() ==
+                                 webrtc::VideoFrameBuffer::Type::kNative &&
+        static_cast<NativeBuffer*>(frame_buffer.get())->dmabuf_fd() >= 0) {
+      // インポートできなかった場合はコピーして渡す
+      RTC_LOG(LS_WARNING) << "Failed to import dmabuf. Copy frames from now on";
+      dmabuf_rejected_ = true;
+    }
+    input = UploadFrame(frame_buffer.get());
+  }
+  if (input == VA_INVALID_SURFACE) {
+    metrics_.OnDropped();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  metrics_.OnSubmit(input_frame.timestamp());
+  if (EncodeSurface(input, idr) != WEBRTC_VIDEO_CODEC_OK) {
+    // 参照が壊れたので次のフレームは IDR にする
+    VaapiRelease();
+    metrics_.OnDropped();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  if (encoded_.empty()) {
+    metrics_.OnDropped();
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  return SendFrame(input_frame, encoded_.data(), encoded_.size());
+}
+
+int32_t VaapiH264Encoder::SendFrame(const webrtc::VideoFrame& frame,
+                                    unsigned char* buffer,
+                                    size_t size) {
+  encoded_image_.set_buffer(buffer, size);
+  SetEncodedImageParams(FrameParams(frame, width_, height_));
+  // ドライバのレート制御が決めた QP は取得できないので、スライスヘッダから読む
+  return SendH264Frame(buffer, size);
+}
@@ -0,0 +1,116 @@
+#ifndef VAAPI_H264_ENCODER_H_
+#define VAAPI_H264_ENCODER_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <va/va.h>
+
+#include "api/video_codecs/video_encoder.h"
+#include "modules/video_coding/codecs/h264/include/h264.h"
+#include "rtc/hw_video_encoder.h"
+#include "rtc/key_frame_throttle.h"
+
+// VA-API (Intel の iHD/i965、AMD の Mesa) のハードウェアエンコーダを使う H.264 エンコーダ。
+// libva は dyn/va.h で動的にロードするので、libva が無い環境でも起動できる。
+//
+// /dev/dri/renderD* の中から H.264 をエンコードできるデバイスを探して使う。
+// エンコードは Encode() の中で完了を待つ。SPS/PPS とスライスヘッダはドライバに作らせる。
+//
+// V4L2DmabufBuffer のように dmabuf を持つ NV12 か I420 のフレームは、
+// その fd を VA のサーフェスとしてインポートしてそのままエンコードする。
+// キャプチャのバッファは使い回されるので、インポートしたサーフェスは fd 毎に取っておく。
+// それ以外のフレームは、プールしておいた NV12 のサーフェスにコピーする。
+class VaapiH264Encoder : public HWVideoEncoder {
+ public:
+  VaapiH264Encoder(const cricket::VideoCodec& codec,
+                   KeyFrameThrottle::Settings key_frame_throttle =
+                       KeyFrameThrottle::Settings());
+  ~VaapiH264Encoder() override;
+
+  // libva をロードできて、H.264 をエンコードできるデバイスがあるか
+  static bool IsSupported();
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores,
+                     size_t max_payload_size) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+ private:
+  // dmabuf をインポートしたサーフェスを引くためのキー (fd, 大きさ, Y のピッチ)
+  typedef std::tuple<int, size_t, uint32_t> DmabufKey;
+
+  // デバイスを開いて、今の解像度でコンテキストとサーフェスを作る
+  int32_t VaapiConfigure();
+  // サーフェスとコンテキストを破棄してデバイスを閉じる
+  void VaapiRelease();
+  // frame_buffer をエンコーダに入力するサーフェスを返す。
+  // dmabuf をインポートできない場合は VA_INVALID_SURFACE
+  VASurfaceID ImportDmabuf(webrtc::VideoFrameBuffer* frame_buffer);
+  // frame_buffer を次のプールのサーフェスにコピーして、そのサーフェスを返す
+  VASurfaceID UploadFrame(webrtc::VideoFrameBuffer* frame_buffer);
+  // data をパラメータのバッファにして buffers に追加する
+  bool AddParamBuffer(VABufferType type,
+                      const void* data,
+                      size_t size,
+                      std::vector<VABufferID>& buffers);
+  // レート制御の設定を buffers に追加する
+  bool AddRateControlParams(std::vector<VABufferID>& buffers);
+  // input を 1 フレームエンコードして、出力を encoded_ に入れる
+  int32_t EncodeSurface(VASurfaceID input, bool idr);
+  int32_t SendFrame(const webrtc::VideoFrame& frame,
+                    unsigned char* buffer,
+                    size_t size);
+
+  std::mutex mtx_;
+
+  int drm_fd_ = -1;
+  VADisplay display_ = nullptr;
+  VAConfigID config_id_ = VA_INVALID_ID;
+  VAContextID context_id_ = VA_INVALID_ID;
+  VABufferID coded_buffer_ = VA_INVALID_ID;
+  // コピーして入力する場合のサーフェスのプール
+  std::vector<VASurfaceID> input_surfaces_;
+  size_t next_input_surface_ = 0;
+  // vaDeriveImage できないドライバでは、この画像に書いて vaPutImage でサーフェスに転送する
+  VAImage upload_image_;
+  bool derive_image_ = true;
+  // 再構成画像のサーフェス。P フレームは 1 つ前のフレームだけを参照する
+  std::vector<VASurfaceID> ref_surfaces_;
+  size_t current_ref_surface_ = 0;
+  std::map<DmabufKey, VASurfaceID> imported_surfaces_;
+  // dmabuf をインポートできなかったので、以降はコピーして渡す
+  bool dmabuf_rejected_ = false;
+  // MemoryAccounting に計上しているサーフェスの大きさ
+  int64_t surface_bytes_ = 0;
+
+  // マクロブロックの単位に揃えた大きさ
+  int32_t aligned_width_ = 0;
+  int32_t aligned_height_ = 0;
+  // IDR からのフレームの番号
+  uint32_t frame_num_ = 0;
+  uint16_t idr_pic_id_ = 0;
+  bool rate_control_changed_ = true;
+  std::vector<uint8_t> encoded_;
+
+  uint32_t configured_bitrate_bps_ = 0;
+  double target_framerate_fps_ = 30;
+  int32_t configured_framerate_fps_ = 0;
+  int32_t width_ = 0;
+  int32_t height_ = 0;
+  int32_t configured_width_ = 0;
+  int32_t configured_height_ = 0;
+};
+
+#endif  // VAAPI_H264_ENCODER_H_
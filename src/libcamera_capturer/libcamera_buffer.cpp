@@ -0,0 +1,81 @@
+#include "libcamera_buffer.h"
+
+#include "rtc/frame_buffer_pool.h"
+#include "rtc_base/ref_counted_object.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+rtc::scoped_refptr<LibcameraSession> LibcameraSession::Create(
+    libcamerac_Camera* camera) {
+  return new rtc::RefCountedObject<LibcameraSession>(camera);
+}
+
+LibcameraSession::LibcameraSession(libcamerac_Camera* camera)
+    : camera_(camera) {}
+
+LibcameraSession::~LibcameraSession() {
+  libcamerac_Close(camera_);
+}
+
+rtc::scoped_refptr<LibcameraRequest> LibcameraRequest::Create(
+    rtc::scoped_refptr<LibcameraSession> session,
+    uint64_t request_id) {
+  return new rtc::RefCountedObject<LibcameraRequest>(session, request_id);
+}
+
+LibcameraRequest::LibcameraRequest(
+    rtc::scoped_refptr<LibcameraSession> session,
+    uint64_t request_id)
+    : session_(session), request_id_(request_id) {}
+
+LibcameraRequest::~LibcameraRequest() {
+  libcamerac_Requeue(session_->camera(), request_id_);
+}
+
+rtc::scoped_refptr<LibcameraBuffer> LibcameraBuffer::Create(
+    rtc::scoped_refptr<LibcameraRequest> request,
+    const libcamerac_Plane& plane,
+    const libcamerac_StreamLayout& layout) {
+  return new rtc::RefCountedObject<LibcameraBuffer>(request, plane, layout);
+}
+
+LibcameraBuffer::LibcameraBuffer(rtc::scoped_refptr<LibcameraRequest> request,
+                                 const libcamerac_Plane& plane,
+                                 const libcamerac_StreamLayout& layout)
+    : NativeBuffer(webrtc::VideoType::kI420,
+                   layout.width,
+                   layout.height,
+                   plane.data + plane.offsets[0],
+                   plane.length - plane.offsets[0]),
+      request_(request),
+      plane_(plane),
+      stride_(layout.stride) {}
+
+LibcameraBuffer::~LibcameraBuffer() {}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> LibcameraBuffer::ToI420() {
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+      FrameBufferPool::Instance().CreateI420Buffer(width(), height());
+  // 同じ解像度の場合はコピーになる
+  libyuv::I420Scale(plane_.data + plane_.offsets[0], stride_,
+                    plane_.data + plane_.offsets[1], stride_ / 2,
+                    plane_.data + plane_.offsets[2], stride_ / 2, raw_width(),
+                    raw_height(), i420_buffer->MutableDataY(),
+                    i420_buffer->StrideY(), i420_buffer->MutableDataU(),
+                    i420_buffer->StrideU(), i420_buffer->MutableDataV(),
+                    i420_buffer->StrideV(), width(), height(),
+                    libyuv::kFilterBox);
+  return i420_buffer;
+}
+
+int LibcameraBuffer::dmabuf_fd() const {
+  return plane_.fd;
+}
+
+bool LibcameraBuffer::GetDmabufPlanes(uint32_t offsets[3],
+                                      uint32_t pitches[3]) const {
+  for (int i = 0; i < 3; i++) {
+    offsets[i] = plane_.offsets[i];
+    pitches[i] = i == 0 ? stride_ : stride_ / 2;
+  }
+  return true;
+}
@@ -0,0 +1,74 @@
+#ifndef LIBCAMERA_BUFFER_H_
+#define LIBCAMERA_BUFFER_H_
+
+#include <stdint.h>
+
+#include "api/scoped_refptr.h"
+#include "rtc/native_buffer.h"
+#include "rtc_base/ref_count.h"
+
+#include "libcamerac.h"
+
+// libcamerac_Camera を参照カウントで管理するクラス。
+//
+// LibcameraBuffer が残っている間はカメラを閉じないので、
+// エンコーダがバッファを保持している間にキャプチャを止めても安全に扱える。
+class LibcameraSession : public rtc::RefCountInterface {
+ public:
+  static rtc::scoped_refptr<LibcameraSession> Create(
+      libcamerac_Camera* camera);
+
+  libcamerac_Camera* camera() const { return camera_; }
+
+ protected:
+  explicit LibcameraSession(libcamerac_Camera* camera);
+  ~LibcameraSession() override;
+
+ private:
+  libcamerac_Camera* const camera_;
+};
+
+// 1 回のリクエストでキャプチャしたバッファ。
+// 全てのストリームのバッファの参照が無くなった時点でリクエストをカメラに戻す
+class LibcameraRequest : public rtc::RefCountInterface {
+ public:
+  static rtc::scoped_refptr<LibcameraRequest> Create(
+      rtc::scoped_refptr<LibcameraSession> session,
+      uint64_t request_id);
+
+ protected:
+  LibcameraRequest(rtc::scoped_refptr<LibcameraSession> session,
+                   uint64_t request_id);
+  ~LibcameraRequest() override;
+
+ private:
+  const rtc::scoped_refptr<LibcameraSession> session_;
+  const uint64_t request_id_;
+};
+
+// libcamera がキャプチャした I420 の dmabuf をコピーせずに参照する NativeBuffer。
+// Y プレーンのピッチが幅より大きい場合があるので、ToI420() はピッチを考慮して変換する
+class LibcameraBuffer : public NativeBuffer {
+ public:
+  static rtc::scoped_refptr<LibcameraBuffer> Create(
+      rtc::scoped_refptr<LibcameraRequest> request,
+      const libcamerac_Plane& plane,
+      const libcamerac_StreamLayout& layout);
+
+  rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override;
+  int dmabuf_fd() const override;
+  bool GetDmabufPlanes(uint32_t offsets[3], uint32_t pitches[3]) const override;
+
+ protected:
+  LibcameraBuffer(rtc::scoped_refptr<LibcameraRequest> request,
+                  const libcamerac_Plane& plane,
+                  const libcamerac_StreamLayout& layout);
+  ~LibcameraBuffer() override;
+
+ private:
+  const rtc::scoped_refptr<LibcameraRequest> request_;
+  const libcamerac_Plane plane_;
+  const uint32_t stride_;
+};
+
+#endif  // LIBCAMERA_BUFFER_H_
@@ -0,0 +1,171 @@
+#include "libcamera_capturer.h"
+
+#include <vector>
+
+#include "rtc/memory_accounting.h"
+#include "rtc/simulcast_frame_buffer.h"
+#include "rtc/thread_placement.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// センサーのタイムスタンプがこれより古い場合は使わない
+const int64_t kMaxSensorTimestampDelayUs = rtc::kNumMicrosecsPerSec;
+
+}  // namespace
+
+rtc::scoped_refptr<LibcameraCapturer> LibcameraCapturer::Create(
+    ConnectionSettings cs) {
+  const int num_cameras = libcamerac_CameraCount();
+  for (int i = 0; i < num_cameras; i++) {
+    rtc::scoped_refptr<LibcameraCapturer> capturer(
+        new rtc::RefCountedObject<LibcameraCapturer>());
+    if (capturer->Init(i) < 0) {
+      RTC_LOG(LS_WARNING) << "Failed to open libcamera camera " << i;
+      continue;
+    }
+    if (capturer->StartCapture(cs) < 0) {
+      auto size = cs.getSize();
+      RTC_LOG(LS_WARNING) << "Failed to start LibcameraCapturer(w = "
+                          << size.width << ", h = " << size.height
+                          << ", fps = " << cs.framerate << ")";
+      continue;
+    }
+    RTC_LOG(LS_INFO) << "Get Capture (libcamera " << i << ")";
+    return capturer;
+  }
+  RTC_LOG(LS_ERROR) << "Failed to create LibcameraCapturer";
+  return nullptr;
+}
+
+LibcameraCapturer::LibcameraCapturer() {}
+
+LibcameraCapturer::~LibcameraCapturer() {
+  StopCapture();
+}
+
+int32_t LibcameraCapturer::Init(int camera_index) {
+  libcamerac_Camera* camera = libcamerac_Open(camera_index);
+  if (camera == nullptr) {
+    return -1;
+  }
+  session_ = LibcameraSession::Create(camera);
+  return 0;
+}
+
+int32_t LibcameraCapturer::StartCapture(const ConnectionSettings& cs) {
+  auto size = cs.getSize();
+  std::vector<libcamerac_StreamSize> sizes;
+  sizes.push_back(libcamerac_StreamSize{size.width, size.height});
+  if (cs.sora_simulcast) {
+    // ISP の低解像度出力で 1 段下のレイヤーを作る。それより下は I420 で縮小する
+    sizes.push_back(
+        libcamerac_StreamSize{size.width / 2 & ~1, size.height / 2 & ~1});
+  }
+  if (libcamerac_Configure(session_->camera(), sizes.data(), (int)sizes.size(),
+                           cs.v4l2_buffers) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to libcamerac_Configure";
+    return -1;
+  }
+  num_streams_ = (int)sizes.size();
+  buffer_bytes_ = 0;
+  for (int i = 0; i < num_streams_; i++) {
+    if (libcamerac_GetStreamLayout(session_->camera(), i, &layouts_[i]) < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to libcamerac_GetStreamLayout";
+      return -1;
+    }
+    RTC_LOG(LS_INFO) << "libcamera stream " << i << ": " << layouts_[i].width
+                     << "x" << layouts_[i].height
+                     << " stride=" << layouts_[i].stride;
+    buffer_bytes_ += (int64_t)cs.v4l2_buffers * layouts_[i].stride *
+                     layouts_[i].height * 3 / 2;
+  }
+  MemoryAccounting::Instance().Add(MemoryAccounting::kCapture, buffer_bytes_);
+
+  if (libcamerac_Start(session_->camera(), cs.framerate,
+                       &LibcameraCapturer::OnFrameCallback, this) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to libcamerac_Start";
+    return -1;
+  }
+  return 0;
+}
+
+void LibcameraCapturer::StopCapture() {
+  rtc::scoped_refptr<LibcameraSession> session;
+  {
+    std::lock_guard<std::mutex> lock(session_mtx_);
+    session = std::move(session_);
+  }
+  if (!session) {
+    return;
+  }
+  // カメラを閉じるのは、下流に残っているバッファが全て解放された後
+  libcamerac_Stop(session->camera());
+  MemoryAccounting::Instance().Add(MemoryAccounting::kCapture, -buffer_bytes_);
+  buffer_bytes_ = 0;
+}
+
+void LibcameraCapturer::OnFrameCallback(void* user_data,
+                                        const libcamerac_Frame* frame) {
+  // libcamera が作ったスレッドから呼ばれるので、最初のコールバックで設定する
+  ThreadPlacement::Instance().ApplyOnce("capture", "Libcamera");
+  static_cast<LibcameraCapturer*>(user_data)->OnFrame(frame);
+}
+
+void LibcameraCapturer::OnFrame(const libcamerac_Frame* frame) {
+  rtc::scoped_refptr<LibcameraSession> session;
+  {
+    std::lock_guard<std::mutex> lock(session_mtx_);
+    session = session_;
+  }
+  // StopCapture() の途中
+  if (!session) {
+    return;
+  }
+  rtc::scoped_refptr<LibcameraRequest> request =
+      LibcameraRequest::Create(session, frame->request_id);
+  if (ShouldSkipFrame()) {
+    return;
+  }
+
+  std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> layers;
+  for (int i = 0; i < frame->num_streams && i < num_streams_; i++) {
+    layers.push_back(
+        LibcameraBuffer::Create(request, frame->streams[i], layouts_[i]));
+  }
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer = layers.front();
+  if (layers.size() > 1) {
+    buffer = SimulcastFrameBuffer::CreateFromLayers(std::move(layers));
+  }
+
+  OnCapturedFrame(webrtc::VideoFrame::Builder()
+                      .set_video_frame_buffer(buffer)
+                      .set_timestamp_us(CaptureTimestampUs(frame))
+                      .set_rotation(webrtc::kVideoRotation_0)
+                      .build());
+}
+
+int64_t LibcameraCapturer::CaptureTimestampUs(const libcamerac_Frame* frame) {
+  // rtc::TimeMicros() も CLOCK_MONOTONIC なので、そのまま比べられる。
+  // 未来の時刻や古すぎる時刻の場合は使わない
+  const int64_t now_us = rtc::TimeMicros();
+  const int64_t timestamp_us =
+      frame->timestamp_ns / rtc::kNumNanosecsPerMicrosec;
+  if (timestamp_us <= 0 || timestamp_us > now_us ||
+      now_us - timestamp_us > kMaxSensorTimestampDelayUs) {
+    if (sensor_timestamp_) {
+      RTC_LOG(LS_WARNING) << "Ignore invalid sensor timestamp: "
+                          << timestamp_us << " now: " << now_us;
+      sensor_timestamp_ = false;
+    }
+    return now_us;
+  }
+  if (!sensor_timestamp_) {
+    RTC_LOG(LS_INFO) << "Use sensor timestamps, " << (now_us - timestamp_us)
+                     << "us before delivery";
+    sensor_timestamp_ = true;
+  }
+  return timestamp_us;
+}
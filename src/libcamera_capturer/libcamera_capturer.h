@@ -0,0 +1,50 @@
+#ifndef LIBCAMERA_CAPTURER_H_
+#define LIBCAMERA_CAPTURER_H_
+
+#include <stdint.h>
+
+#include <mutex>
+
+#include "api/scoped_refptr.h"
+#include "connection_settings.h"
+#include "rtc/scalable_track_source.h"
+
+#include "libcamera_buffer.h"
+#include "libcamerac.h"
+
+// libcamera で Raspberry Pi のカメラからキャプチャするクラス。
+//
+// ISP が出力した I420 の dmabuf を LibcameraBuffer でそのまま下流に渡すので、
+// V4L2M2MH264Encoder までの間で CPU はフレームに触らない。
+// サイマルキャストの場合は ISP のメイン出力と低解像度出力 (縦横 1/2) の 2 つのストリームを設定し、
+// SimulcastFrameBuffer にまとめて渡す。
+class LibcameraCapturer : public ScalableVideoTrackSource {
+ public:
+  static rtc::scoped_refptr<LibcameraCapturer> Create(ConnectionSettings cs);
+  LibcameraCapturer();
+  ~LibcameraCapturer() override;
+
+ protected:
+  bool useNativeBuffer() override { return true; }
+
+ private:
+  int32_t Init(int camera_index);
+  int32_t StartCapture(const ConnectionSettings& cs);
+  void StopCapture();
+  static void OnFrameCallback(void* user_data, const libcamerac_Frame* frame);
+  void OnFrame(const libcamerac_Frame* frame);
+  // センサーのタイムスタンプ (CLOCK_MONOTONIC)。
+  // 使えない場合は今の時刻を返す。rtc の時計とのずれは timestamp_aligner_ が吸収する
+  int64_t CaptureTimestampUs(const libcamerac_Frame* frame);
+
+  // OnFrame() は libcamera のスレッドから呼ばれるので、StopCapture() との間をロックで守る
+  std::mutex session_mtx_;
+  rtc::scoped_refptr<LibcameraSession> session_;
+  int num_streams_ = 0;
+  libcamerac_StreamLayout layouts_[LIBCAMERAC_MAX_STREAMS];
+  // MemoryAccounting に計上しているバッファの大きさ
+  int64_t buffer_bytes_ = 0;
+  bool sensor_timestamp_ = false;
+};
+
+#endif  // LIBCAMERA_CAPTURER_H_
@@ -0,0 +1,309 @@
+// このファイルだけは C++17 でコンパイルする (libcamerac.h を参照)
+
+#include "libcamerac.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+namespace {
+
+// CameraManager はプロセスで 1 つしか作れない
+std::mutex g_manager_mutex;
+std::weak_ptr<libcamera::CameraManager> g_manager;
+
+std::shared_ptr<libcamera::CameraManager> GetCameraManager() {
+  std::lock_guard<std::mutex> lock(g_manager_mutex);
+  std::shared_ptr<libcamera::CameraManager> manager = g_manager.lock();
+  if (manager) {
+    return manager;
+  }
+  manager = std::make_shared<libcamera::CameraManager>();
+  if (manager->start() < 0) {
+    std::cerr << "libcamerac: Failed to start CameraManager" << std::endl;
+    return nullptr;
+  }
+  g_manager = manager;
+  return manager;
+}
+
+}  // namespace
+
+struct libcamerac_Camera {
+  struct Mapping {
+    void* data;
+    size_t length;
+  };
+
+  void OnRequestCompleted(libcamera::Request* request);
+
+  std::shared_ptr<libcamera::CameraManager> manager;
+  std::shared_ptr<libcamera::Camera> camera;
+  std::unique_ptr<libcamera::CameraConfiguration> config;
+  std::unique_ptr<libcamera::FrameBufferAllocator> allocator;
+  std::vector<std::unique_ptr<libcamera::Request>> requests;
+  // fd 毎に mmap した領域
+  std::map<int, Mapping> mappings;
+
+  std::mutex mutex;
+  bool started = false;
+  libcamerac_FrameCallback callback = nullptr;
+  void* user_data = nullptr;
+};
+
+void libcamerac_Camera::OnRequestCompleted(libcamera::Request* request) {
+  if (request->status() == libcamera::Request::RequestCancelled) {
+    return;
+  }
+
+  libcamerac_Frame frame = {};
+  frame.request_id = request->cookie();
+  frame.num_streams = (int)config->size();
+  for (int i = 0; i < frame.num_streams; i++) {
+    libcamera::Stream* stream = config->at(i).stream();
+    libcamera::FrameBuffer* buffer = request->findBuffer(stream);
+    if (buffer == nullptr) {
+      libcamerac_Requeue(this, frame.request_id);
+      return;
+    }
+    if (i == 0) {
+      frame.timestamp_ns = buffer->metadata().timestamp;
+    }
+    // ISP の出力は全てのプレーンが同じ dmabuf に並んでいる
+    const std::vector<libcamera::FrameBuffer::Plane>& planes =
+        buffer->planes();
+    libcamerac_Plane& plane = frame.streams[i];
+    plane.fd = planes[0].fd.get();
+    for (size_t p = 0; p < planes.size() && p < 3; p++) {
+      plane.offsets[p] = planes[p].offset;
+    }
+    const Mapping& mapping = mappings[plane.fd];
+    plane.data = (uint8_t*)mapping.data;
+    plane.length = mapping.length;
+  }
+
+  libcamerac_FrameCallback cb;
+  void* user_data;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!started) {
+      return;
+    }
+    cb = callback;
+    user_data = this->user_data;
+  }
+  cb(user_data, &frame);
+}
+
+libcamerac_Camera* libcamerac_Open(int index) {
+  std::shared_ptr<libcamera::CameraManager> manager = GetCameraManager();
+  if (!manager) {
+    return nullptr;
+  }
+  std::vector<std::shared_ptr<libcamera::Camera>> cameras = manager->cameras();
+  if (index < 0 || index >= (int)cameras.size()) {
+    std::cerr << "libcamerac: Camera " << index << " is not found"
+              << std::endl;
+    return nullptr;
+  }
+  std::unique_ptr<libcamerac_Camera> camera(new libcamerac_Camera());
+  camera->manager = manager;
+  camera->camera = cameras[index];
+  if (camera->camera->acquire() < 0) {
+    std::cerr << "libcamerac: Failed to acquire camera" << std::endl;
+    return nullptr;
+  }
+  camera->camera->requestCompleted.connect(
+      camera.get(), &libcamerac_Camera::OnRequestCompleted);
+  return camera.release();
+}
+
+void libcamerac_Close(libcamerac_Camera* camera) {
+  if (camera == nullptr) {
+    return;
+  }
+  libcamerac_Stop(camera);
+  camera->camera->requestCompleted.disconnect(camera);
+  camera->requests.clear();
+  for (const auto& mapping : camera->mappings) {
+    munmap(mapping.second.data, mapping.second.length);
+  }
+  camera->mappings.clear();
+  camera->allocator.reset();
+  camera->camera->release();
+  camera->camera.reset();
+  delete camera;
+}
+
+int libcamerac_CameraCount(void) {
+  std::shared_ptr<libcamera::CameraManager> manager = GetCameraManager();
+  if (!manager) {
+    return 0;
+  }
+  return (int)manager->cameras().size();
+}
+
+int libcamerac_Configure(libcamerac_Camera* camera,
+                         const libcamerac_StreamSize* sizes,
+                         int num_streams,
+                         int buffer_count) {
+  if (num_streams < 1 || num_streams > LIBCAMERAC_MAX_STREAMS) {
+    return -1;
+  }
+  std::vector<libcamera::StreamRole> roles = {
+      libcamera::StreamRole::VideoRecording};
+  if (num_streams == 2) {
+    roles.push_back(libcamera::StreamRole::Viewfinder);
+  }
+  camera->config = camera->camera->generateConfiguration(roles);
+  if (!camera->config) {
+    std::cerr << "libcamerac: Failed to generateConfiguration" << std::endl;
+    return -1;
+  }
+  for (int i = 0; i < num_streams; i++) {
+    libcamera::StreamConfiguration& stream_config = camera->config->at(i);
+    stream_config.pixelFormat = libcamera::formats::YUV420;
+    stream_config.size.width = sizes[i].width;
+    stream_config.size.height = sizes[i].height;
+    stream_config.bufferCount = buffer_count;
+  }
+  if (camera->config->validate() ==
+      libcamera::CameraConfiguration::Invalid) {
+    std::cerr << "libcamerac: Invalid configuration" << std::endl;
+    return -1;
+  }
+  if (camera->camera->configure(camera->config.get()) < 0) {
+    std::cerr << "libcamerac: Failed to configure" << std::endl;
+    return -1;
+  }
+
+  camera->allocator.reset(new libcamera::FrameBufferAllocator(camera->camera));
+  for (libcamera::StreamConfiguration& stream_config : *camera->config) {
+    if (camera->allocator->allocate(stream_config.stream()) < 0) {
+      std::cerr << "libcamerac: Failed to allocate buffers" << std::endl;
+      return -1;
+    }
+  }
+
+  // リクエスト毎に、各ストリームの同じ番号のバッファを割り当てる
+  camera->requests.clear();
+  const size_t num_requests =
+      camera->allocator->buffers(camera->config->at(0).stream()).size();
+  for (size_t i = 0; i < num_requests; i++) {
+    std::unique_ptr<libcamera::Request> request =
+        camera->camera->createRequest(i);
+    if (!request) {
+      std::cerr << "libcamerac: Failed to createRequest" << std::endl;
+      return -1;
+    }
+    for (libcamera::StreamConfiguration& stream_config : *camera->config) {
+      libcamera::Stream* stream = stream_config.stream();
+      const auto& buffers = camera->allocator->buffers(stream);
+      if (i >= buffers.size()) {
+        return -1;
+      }
+      libcamera::FrameBuffer* buffer = buffers[i].get();
+      if (request->addBuffer(stream, buffer) < 0) {
+        std::cerr << "libcamerac: Failed to addBuffer" << std::endl;
+        return -1;
+      }
+      // プレーンは同じ fd を共有しているので、fd 毎に全体を 1 回だけ mmap する
+      const int fd = buffer->planes()[0].fd.get();
+      if (camera->mappings.count(fd) == 0) {
+        size_t length = 0;
+        for (const libcamera::FrameBuffer::Plane& plane : buffer->planes()) {
+          length = std::max<size_t>(length, plane.offset + plane.length);
+        }
+        void* data =
+            mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+          std::cerr << "libcamerac: Failed to mmap" << std::endl;
+          return -1;
+        }
+        camera->mappings[fd] = libcamerac_Camera::Mapping{data, length};
+      }
+    }
+    camera->requests.push_back(std::move(request));
+  }
+  return 0;
+}
+
+int libcamerac_GetStreamLayout(libcamerac_Camera* camera,
+                               int stream,
+                               libcamerac_StreamLayout* layout) {
+  if (!camera->config || stream < 0 ||
+      stream >= (int)camera->config->size()) {
+    return -1;
+  }
+  const libcamera::StreamConfiguration& stream_config =
+      camera->config->at(stream);
+  layout->width = stream_config.size.width;
+  layout->height = stream_config.size.height;
+  layout->stride = stream_config.stride;
+  return 0;
+}
+
+int libcamerac_Start(libcamerac_Camera* camera,
+                     int framerate,
+                     libcamerac_FrameCallback callback,
+                     void* user_data) {
+  {
+    std::lock_guard<std::mutex> lock(camera->mutex);
+    camera->callback = callback;
+    camera->user_data = user_data;
+    camera->started = true;
+  }
+
+  libcamera::ControlList controls(libcamera::controls::controls);
+  if (framerate > 0) {
+    const int64_t frame_duration_us = 1000000 / framerate;
+    const int64_t limits[2] = {frame_duration_us, frame_duration_us};
+    controls.set(libcamera::controls::FrameDurationLimits,
+                 libcamera::Span<const int64_t, 2>(limits));
+  }
+  if (camera->camera->start(&controls) < 0) {
+    std::cerr << "libcamerac: Failed to start camera" << std::endl;
+    std::lock_guard<std::mutex> lock(camera->mutex);
+    camera->started = false;
+    return -1;
+  }
+  for (std::unique_ptr<libcamera::Request>& request : camera->requests) {
+    if (camera->camera->queueRequest(request.get()) < 0) {
+      std::cerr << "libcamerac: Failed to queueRequest" << std::endl;
+      libcamerac_Stop(camera);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void libcamerac_Requeue(libcamerac_Camera* camera, uint64_t request_id) {
+  {
+    std::lock_guard<std::mutex> lock(camera->mutex);
+    if (!camera->started || request_id >= camera->requests.size()) {
+      return;
+    }
+  }
+  libcamera::Request* request = camera->requests[request_id].get();
+  request->reuse(libcamera::Request::ReuseBuffers);
+  camera->camera->queueRequest(request);
+}
+
+void libcamerac_Stop(libcamerac_Camera* camera) {
+  {
+    std::lock_guard<std::mutex> lock(camera->mutex);
+    if (!camera->started) {
+      return;
+    }
+    camera->started = false;
+  }
+  // 止めるとキューに残っているリクエストは RequestCancelled で返ってくる
+  camera->camera->stop();
+}
@@ -0,0 +1,93 @@
+#ifndef LIBCAMERAC_H_
+#define LIBCAMERAC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libcamera を C の関数で呼び出すためのラッパー。
+//
+// libcamera のヘッダは C++17 が必要で、WebRTC のヘッダと同じ翻訳単位ではコンパイルできない。
+// そのため libcamera を使う部分は libcamerac.cpp に閉じ込めて C++17 でコンパイルし、
+// それ以外からはこのヘッダの C の型と関数だけを使う。
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct libcamerac_Camera libcamerac_Camera;
+
+// 1 つのストリームで要求する解像度
+typedef struct libcamerac_StreamSize {
+  int width;
+  int height;
+} libcamerac_StreamSize;
+
+// 設定した後のストリームの実際の形式。形式は常に YUV420 (I420)
+typedef struct libcamerac_StreamLayout {
+  int width;
+  int height;
+  // Y プレーンのピッチ。U, V プレーンはその半分
+  uint32_t stride;
+} libcamerac_StreamLayout;
+
+// キャプチャした 1 ストリーム分のバッファ
+typedef struct libcamerac_Plane {
+  // dmabuf の fd
+  int fd;
+  // fd の先頭から、各プレーンまでのオフセット
+  uint32_t offsets[3];
+  // mmap した fd の先頭
+  uint8_t* data;
+  size_t length;
+} libcamerac_Plane;
+
+#define LIBCAMERAC_MAX_STREAMS 2
+
+// 1 回のリクエストでキャプチャしたフレーム
+typedef struct libcamerac_Frame {
+  // libcamerac_Requeue() に渡す ID
+  uint64_t request_id;
+  // センサーのタイムスタンプ (CLOCK_MONOTONIC のナノ秒)
+  int64_t timestamp_ns;
+  int num_streams;
+  libcamerac_Plane streams[LIBCAMERAC_MAX_STREAMS];
+} libcamerac_Frame;
+
+// libcamera のスレッドから呼ばれる。
+// frame のバッファは libcamerac_Requeue() を呼ぶまで使って良い
+typedef void (*libcamerac_FrameCallback)(void* user_data,
+                                         const libcamerac_Frame* frame);
+
+// index 番目のカメラを開く。失敗した場合は NULL を返す
+libcamerac_Camera* libcamerac_Open(int index);
+// 停止してから閉じる
+void libcamerac_Close(libcamerac_Camera* camera);
+// 接続されているカメラの数
+int libcamerac_CameraCount(void);
+
+// sizes[0] をメインのストリーム、sizes[1] を ISP の低解像度のストリームとして設定する。
+// num_streams は 1 か 2。ストリーム毎に buffer_count 個のバッファを確保する。
+// 成功した場合は 0 を返す
+int libcamerac_Configure(libcamerac_Camera* camera,
+                         const libcamerac_StreamSize* sizes,
+                         int num_streams,
+                         int buffer_count);
+// libcamerac_Configure() で ISP が調整した後の形式を取得する
+int libcamerac_GetStreamLayout(libcamerac_Camera* camera,
+                               int stream,
+                               libcamerac_StreamLayout* layout);
+
+// framerate でキャプチャを開始する。成功した場合は 0 を返す
+int libcamerac_Start(libcamerac_Camera* camera,
+                     int framerate,
+                     libcamerac_FrameCallback callback,
+                     void* user_data);
+// 使い終わったリクエストをカメラに戻す。任意のスレッドから呼んで良い
+void libcamerac_Requeue(libcamerac_Camera* camera, uint64_t request_id);
+void libcamerac_Stop(libcamerac_Camera* camera);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LIBCAMERAC_H_
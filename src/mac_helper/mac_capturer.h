@@ -11,9 +11,13 @@
 #define MAC_CAPTURER_H_
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include <CoreVideo/CoreVideo.h>
+#include <VideoToolbox/VideoToolbox.h>
+
 #include "api/media_stream_interface.h"
 #include "api/scoped_refptr.h"
 #include "base/RTCMacros.h"
@@ -41,6 +45,14 @@ class MacCapturer : public ScalableVideoTrackSource,
 
   void OnFrame(const webrtc::VideoFrame& frame) override;
 
+ protected:
+  // CVPixelBuffer のまま VTPixelTransferSession で縮小する。
+  // 縮小したバッファも IOSurface なので、VideoToolbox のエンコーダにそのまま渡せる
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> ScaleNativeFrameBuffer(
+      const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+      int width,
+      int height) override;
+
  private:
   void Destroy();
 
@@ -49,6 +61,14 @@ class MacCapturer : public ScalableVideoTrackSource,
 
   RTCCameraVideoCapturer* capturer_;
   RTCVideoSourceAdapter* adapter_;
+
+  // 縮小に使うセッションと、縮小先のバッファのプール
+  std::mutex scale_mutex_;
+  VTPixelTransferSessionRef transfer_session_ = nullptr;
+  CVPixelBufferPoolRef pixel_buffer_pool_ = nullptr;
+  int pool_width_ = 0;
+  int pool_height_ = 0;
+  OSType pool_format_ = 0;
 };
 
 #endif  // TEST_MAC_CAPTURER_H_
\ No newline at end of file
@@ -14,6 +14,7 @@
 
 #import "sdk/objc/base/RTCVideoCapturer.h"
 #import "sdk/objc/components/capturer/RTCCameraVideoCapturer.h"
+#import "sdk/objc/components/video_frame_buffer/RTCCVPixelBuffer.h"
 #import "sdk/objc/native/api/video_capturer.h"
 #import "sdk/objc/native/src/objc_frame_buffer.h"
 
@@ -150,8 +151,86 @@ void MacCapturer::Destroy() {
 
 MacCapturer::~MacCapturer() {
   Destroy();
+  std::lock_guard<std::mutex> lock(scale_mutex_);
+  if (transfer_session_ != nullptr) {
+    VTPixelTransferSessionInvalidate(transfer_session_);
+    CFRelease(transfer_session_);
+    transfer_session_ = nullptr;
+  }
+  if (pixel_buffer_pool_ != nullptr) {
+    CVPixelBufferPoolRelease(pixel_buffer_pool_);
+    pixel_buffer_pool_ = nullptr;
+  }
 }
 
 void MacCapturer::OnFrame(const webrtc::VideoFrame& frame) {
   OnCapturedFrame(frame);
 }
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer>
+MacCapturer::ScaleNativeFrameBuffer(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+    int width,
+    int height) {
+  webrtc::ObjCFrameBuffer* objc_buffer =
+      dynamic_cast<webrtc::ObjCFrameBuffer*>(buffer.get());
+  if (objc_buffer == nullptr ||
+      ![objc_buffer->wrapped_frame_buffer()
+          isKindOfClass:[RTCCVPixelBuffer class]]) {
+    return nullptr;
+  }
+  RTCCVPixelBuffer* src_buffer =
+      (RTCCVPixelBuffer*)objc_buffer->wrapped_frame_buffer();
+  CVPixelBufferRef src_pixel_buffer = src_buffer.pixelBuffer;
+  const OSType format = CVPixelBufferGetPixelFormatType(src_pixel_buffer);
+
+  std::lock_guard<std::mutex> lock(scale_mutex_);
+  if (transfer_session_ == nullptr &&
+      VTPixelTransferSessionCreate(kCFAllocatorDefault, &transfer_session_) !=
+          noErr) {
+    RTC_LOG(LS_ERROR) << "Failed to VTPixelTransferSessionCreate";
+    transfer_session_ = nullptr;
+    return nullptr;
+  }
+  // 解像度が変わったらプールを作り直す
+  if (pixel_buffer_pool_ == nullptr || pool_width_ != width ||
+      pool_height_ != height || pool_format_ != format) {
+    if (pixel_buffer_pool_ != nullptr) {
+      CVPixelBufferPoolRelease(pixel_buffer_pool_);
+      pixel_buffer_pool_ = nullptr;
+    }
+    NSDictionary* attributes = @{
+      (id)kCVPixelBufferPixelFormatTypeKey : @(format),
+      (id)kCVPixelBufferWidthKey : @(width),
+      (id)kCVPixelBufferHeightKey : @(height),
+      (id)kCVPixelBufferIOSurfacePropertiesKey : @{},
+    };
+    if (CVPixelBufferPoolCreate(kCFAllocatorDefault, nullptr,
+                                (__bridge CFDictionaryRef)attributes,
+                                &pixel_buffer_pool_) != kCVReturnSuccess) {
+      RTC_LOG(LS_ERROR) << "Failed to CVPixelBufferPoolCreate";
+      pixel_buffer_pool_ = nullptr;
+      return nullptr;
+    }
+    pool_width_ = width;
+    pool_height_ = height;
+    pool_format_ = format;
+  }
+
+  CVPixelBufferRef dst_pixel_buffer = nullptr;
+  if (CVPixelBufferPoolCreatePixelBuffer(kCFAllocatorDefault,
+                                         pixel_buffer_pool_,
+                                         &dst_pixel_buffer) !=
+      kCVReturnSuccess) {
+    return nullptr;
+  }
+  if (VTPixelTransferSessionTransferImage(transfer_session_, src_pixel_buffer,
+                                          dst_pixel_buffer) != noErr) {
+    CVBufferRelease(dst_pixel_buffer);
+    return nullptr;
+  }
+  RTCCVPixelBuffer* dst_buffer =
+      [[RTCCVPixelBuffer alloc] initWithPixelBuffer:dst_pixel_buffer];
+  CVBufferRelease(dst_pixel_buffer);
+  return new rtc::RefCountedObject<webrtc::ObjCFrameBuffer>(dst_buffer);
+}
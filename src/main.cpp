@@ -1,46 +1,38 @@
-#include <atomic>
-#include <condition_variable>
-#include <csignal>
 #include <iostream>
+#include <memory>
 #include <string>
-#include <thread>
 #include <vector>
 
 #include "rtc_base/log_sinks.h"
 
 #if USE_ROS
 #include "ros/ros_log_sink.h"
-#include "ros/ros_video_capture.h"
 #include "signal_listener.h"
-#else
-#if defined(__APPLE__)
-#include "mac_helper/mac_capturer.h"
-#elif defined(__linux__)
-#if USE_MMAL_ENCODER
-#include "hwenc_mmal/mmal_v4l2_capture.h"
-#endif
-#include "v4l2_video_capturer/v4l2_video_capturer.h"
-#else
-#include "rtc/device_video_capturer.h"
-#endif
-#endif
-
-#include "serial_data_channel/serial_data_manager.h"
-
-#if USE_SDL2
-#include "sdl_renderer/sdl_renderer.h"
 #endif
 
-#include "ayame/ayame_server.h"
 #include "connection_settings.h"
-#include "p2p/p2p_server.h"
+#include "momo_app.h"
+#include "momo_gateway.h"
+#include "rtc/async_log_sink.h"
+#include "rtc/audio_processing_profile.h"
+#include "rtc/encoder_metrics.h"
+#include "rtc/frame_tracer.h"
 #include "rtc/manager.h"
-#include "sora/sora_server.h"
+#include "rtc/memory_budget.h"
+#include "rtc/parallel_scaler.h"
+#include "rtc/roi_map.h"
+#include "rtc/startup_timer.h"
+#include "rtc/thread_placement.h"
+#include "ssl_verifier.h"
 #include "util.h"
+#include "ws/dns_cache.h"
 
 const size_t kDefaultMaxLogFileSize = 10 * 1024 * 1024;
 
 int main(int argc, char* argv[]) {
+  // 起動時間の計測はここから始める
+  StartupTimer::Instance();
+
   ConnectionSettings cs;
 
   bool use_test = false;
@@ -54,138 +46,84 @@ int main(int argc, char* argv[]) {
   rtc::LogMessage::LogTimestamps();
   rtc::LogMessage::LogThreads();
 
+  // ログのキューの大きさも変えるので、ログファイルを開く前に行う。
+  // 変更した内容はログファイルを開いてから出力する
+  std::vector<std::string> memory_budget_messages;
+  if (!MemoryBudget::Apply(&cs, &memory_budget_messages)) {
+    std::cerr << "--memory-budget is too small, continuing with the smallest "
+                 "settings"
+              << std::endl;
+  }
+
 #if USE_ROS
   std::unique_ptr<rtc::LogSink> log_sink(new ROSLogSink());
   rtc::LogMessage::AddLogToStream(log_sink.get(), rtc::LS_INFO);
 #else
-  std::unique_ptr<rtc::FileRotatingLogSink> log_sink(
+  std::unique_ptr<rtc::FileRotatingLogSink> file_log_sink(
       new rtc::FileRotatingLogSink("./", "webrtc_logs", kDefaultMaxLogFileSize,
                                    10));
-  if (!log_sink->Init()) {
+  if (!file_log_sink->Init()) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << "Failed to open log file";
-    log_sink.reset();
+    file_log_sink.reset();
     return 1;
   }
+  // SD カードへの書き込みが詰まってもキャプチャやネットワークのスレッドを止めない
+  std::unique_ptr<rtc::LogSink> log_sink;
+  if (cs.log_queue_size > 0) {
+    log_sink.reset(
+        new AsyncLogSink(std::move(file_log_sink), cs.log_queue_size));
+  } else {
+    log_sink = std::move(file_log_sink);
+  }
   rtc::LogMessage::AddLogToStream(log_sink.get(), rtc::LS_INFO);
 #endif
-
-  auto capturer = ([&]() -> rtc::scoped_refptr<ScalableVideoTrackSource> {
-    if (cs.no_video_device) {
-      return nullptr;
-    }
-
-#if USE_ROS
-    rtc::scoped_refptr<ROSVideoCapture> capturer(
-        new rtc::RefCountedObject<ROSVideoCapture>(cs));
-    return capturer;
-#else  // USE_ROS
-    auto size = cs.getSize();
-#if defined(__APPLE__)
-    return MacCapturer::Create(size.width, size.height, cs.framerate,
-                               cs.video_device);
-#elif defined(__linux__)
-#if USE_MMAL_ENCODER
-    if (cs.use_native) {
-      return MMALV4L2Capture::Create(cs);
-    } else {
-      return V4L2VideoCapture::Create(cs);
-    }
-#else
-    return V4L2VideoCapture::Create(cs);
-#endif
-#else
-    return DeviceVideoCapturer::Create(size.width, size.height, cs.framerate,
-                                       cs.video_device);
-#endif
-#endif  // USE_ROS
-  })();
-
-  if (!capturer && !cs.no_video_device) {
-    std::cerr << "failed to create capturer" << std::endl;
-    return 1;
+  for (const auto& message : memory_budget_messages) {
+    RTC_LOG(LS_WARNING) << message;
   }
 
-#if USE_SDL2
-  std::unique_ptr<SDLRenderer> sdl_renderer = nullptr;
-  if (cs.use_sdl) {
-    sdl_renderer.reset(
-        new SDLRenderer(cs.window_width, cs.window_height, cs.fullscreen));
+  if (cs.audio_processing_benchmark) {
+    AudioProcessingProfile::RunBenchmark(std::cout);
+    return 0;
   }
 
-  std::unique_ptr<RTCManager> rtc_manager(
-      new RTCManager(cs, std::move(capturer), sdl_renderer.get()));
-#else
-  std::unique_ptr<RTCManager> rtc_manager(
-      new RTCManager(cs, std::move(capturer), nullptr));
-#endif
-
-  {
-    boost::asio::io_context ioc{1};
-
-    std::unique_ptr<RTCDataManager> data_manager = nullptr;
-    if (!cs.serial_device.empty()) {
-      data_manager =
-          SerialDataManager::Create(ioc, cs.serial_device, cs.serial_rate);
-      if (!data_manager) {
-        return 1;
-      }
-      rtc_manager->SetDataManager(data_manager.get());
-    }
-
-    boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
-    signals.async_wait(
-        [&](const boost::system::error_code&, int) { ioc.stop(); });
-
-    if (use_sora) {
-      if (cs.sora_port >= 0) {
-        const boost::asio::ip::tcp::endpoint endpoint{
-            boost::asio::ip::make_address("127.0.0.1"),
-            static_cast<unsigned short>(cs.sora_port)};
-        std::make_shared<SoraServer>(ioc, endpoint, rtc_manager.get(), cs)
-            ->run();
-      } else {
-        std::make_shared<SoraServer>(ioc, rtc_manager.get(), cs)->run();
-      }
-    }
-
-    if (use_test) {
-      const boost::asio::ip::tcp::endpoint endpoint{
-          boost::asio::ip::make_address("0.0.0.0"),
-          static_cast<unsigned short>(cs.test_port)};
-      std::make_shared<P2PServer>(
-          ioc, endpoint, std::make_shared<std::string>(cs.test_document_root),
-          rtc_manager.get(), cs)
-          ->run();
-    }
-
-    if (use_ayame) {
-      std::make_shared<AyameServer>(ioc, rtc_manager.get(), cs)->run();
-    }
-
-#if USE_SDL2
-    if (sdl_renderer) {
-      sdl_renderer->SetDispatchFunction([&ioc](std::function<void()> f) {
-        if (ioc.stopped())
-          return;
-        boost::asio::dispatch(ioc.get_executor(), f);
-      });
-
-      ioc.run();
+  // スレッドを作る前に設定しておく
+  if (!ThreadPlacement::Instance().Configure(cs.thread_placements)) {
+    std::cerr << "invalid --thread-placement" << std::endl;
+    return 1;
+  }
 
-      sdl_renderer->SetDispatchFunction(nullptr);
-    } else {
-      ioc.run();
+  ParallelScaler::Instance().SetNumThreads(cs.scaler_threads);
+  FrameTracer::Instance().Configure(cs.trace_events);
+  EncoderMetricsRegistry::Instance().SetStallFrames(cs.encoder_stall_frames);
+  SSLVerifier::Settings ssl_settings;
+  ssl_settings.system_roots = !cs.disable_system_ssl_roots;
+  ssl_settings.root_file = cs.ssl_root_file;
+  SSLVerifier::Configure(ssl_settings);
+  RoiHints::Settings roi_settings;
+  roi_settings.motion = cs.roi_motion;
+  roi_settings.motion_threshold = cs.roi_motion_threshold;
+  roi_settings.motion_qp_delta = cs.roi_motion_qp_delta;
+  roi_settings.background_qp_delta = cs.roi_background_qp_delta;
+  roi_settings.hints = !cs.roi_label.empty();
+  RoiHints::Instance().Configure(roi_settings);
+  DnsCache::Instance().SetTtl(cs.dns_cache_ttl);
+
+  // プロセス全体の設定はこのコマンドラインのものを、それ以外はセッション毎の設定を使う
+  if (!cs.gateway_config.empty()) {
+    // 各セッションの PeerConnectionFactory を作る前に、プロセスで 1 回だけ設定する
+    const std::string field_trials = RTCManager::FieldTrials(cs);
+    std::vector<MomoGateway::Session> sessions;
+    std::string error;
+    if (!MomoGateway::LoadSessions(cs.gateway_config, field_trials, &sessions,
+                                   &error)) {
+      std::cerr << "invalid --gateway-config: " << error << std::endl;
+      return 1;
     }
-#else
-    ioc.run();
-#endif
+    RTCManager::InitFieldTrials(field_trials);
+    MomoGateway gateway(std::move(sessions));
+    return gateway.Run();
   }
 
-  //この順番は綺麗に落ちるけど、あまり安全ではない
-#if USE_SDL2
-  sdl_renderer = nullptr;
-#endif
-  rtc_manager = nullptr;
-
-  return 0;
+  MomoApp app(cs, use_test, use_ayame, use_sora);
+  return app.Run(true);
 }
@@ -0,0 +1,517 @@
+#include "metrics_collector.h"
+
+#include <iomanip>
+#include <sstream>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <unistd.h>
+
+#include <fstream>
+#endif
+
+#include "api/stats/rtcstats_objects.h"
+#include "rtc/encoder_metrics.h"
+#include "rtc/memory_accounting.h"
+#include "rtc/scalable_track_source.h"
+#include "rtc/stats_sampler.h"
+#include "rtc_base/logging.h"
+
+namespace {
+
+std::string EscapeLabelValue(const std::string& value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+const double kMicrosecsPerSec = 1000000.0;
+
+// 未定義のメンバーはラベルを空にする
+std::string LabelValue(const webrtc::RTCStatsMemberInterface& member) {
+  return member.is_defined() ? member.ValueToString() : std::string();
+}
+
+}  // namespace
+
+void PrometheusText::Declare(const std::string& name,
+                             const std::string& type,
+                             const std::string& help) {
+  if (families_.find(name) != families_.end()) {
+    return;
+  }
+  names_.push_back(name);
+  Family& family = families_[name];
+  family.type = type;
+  family.help = help;
+}
+
+void PrometheusText::Add(const std::string& name,
+                         const std::string& sample_name,
+                         const Labels& labels,
+                         double value) {
+  auto it = families_.find(name);
+  if (it == families_.end()) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << " Undeclared metric: " << name;
+    return;
+  }
+
+  std::stringstream ss;
+  ss << sample_name;
+  if (!labels.empty()) {
+    ss << "{";
+    for (size_t i = 0; i < labels.size(); i++) {
+      if (i != 0) {
+        ss << ",";
+      }
+      ss << labels[i].first << "=\"" << EscapeLabelValue(labels[i].second)
+         << "\"";
+    }
+    ss << "}";
+  }
+  ss << " " << std::setprecision(15) << value;
+  it->second.samples.push_back(ss.str());
+}
+
+std::string PrometheusText::ToString() const {
+  std::stringstream ss;
+  for (const auto& name : names_) {
+    const Family& family = families_.at(name);
+    if (family.samples.empty()) {
+      continue;
+    }
+    ss << "# HELP " << name << " " << family.help << "\n";
+    ss << "# TYPE " << name << " " << family.type << "\n";
+    for (const auto& sample : family.samples) {
+      ss << sample << "\n";
+    }
+  }
+  return ss.str();
+}
+
+void MetricsCollector::Collect(RTCManager* rtc_manager, Callback callback) {
+  std::shared_ptr<MetricsCollector> collector(
+      new MetricsCollector(std::move(callback)));
+  collector->CollectCapture(rtc_manager);
+  collector->CollectEncoders();
+  collector->CollectSampler(rtc_manager);
+  collector->CollectThreads();
+  collector->CollectMemory();
+
+  std::vector<std::shared_ptr<RTCConnection>> connections =
+      rtc_manager->getConnections();
+  collector->text_.Declare("momo_rtc_connections", "gauge",
+                           "Number of peer connections");
+  collector->text_.Add("momo_rtc_connections", {}, connections.size());
+  if (connections.empty()) {
+    collector->Finish();
+    return;
+  }
+
+  collector->remaining_ = connections.size();
+  for (size_t i = 0; i < connections.size(); i++) {
+    connections[i]->getStats(
+        [collector,
+         i](const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+          collector->OnStats(i, report);
+        });
+  }
+}
+
+MetricsCollector::MetricsCollector(Callback callback)
+    : callback_(std::move(callback)) {}
+
+void MetricsCollector::CollectCapture(RTCManager* rtc_manager) {
+  rtc::scoped_refptr<ScalableVideoTrackSource> source =
+      rtc_manager->getVideoTrackSource();
+  if (!source) {
+    return;
+  }
+
+  ScalableVideoTrackSource::CaptureStats stats = source->GetCaptureStats();
+  text_.Declare("momo_capture_frames_total", "counter",
+                "Number of captured frames");
+  text_.Add("momo_capture_frames_total", {}, stats.captured_frames);
+  text_.Declare("momo_capture_adapted_out_frames_total", "counter",
+                "Number of captured frames dropped by the video adapter");
+  text_.Add("momo_capture_adapted_out_frames_total", {},
+            stats.adapted_out_frames);
+  text_.Declare("momo_capture_backpressure_skipped_frames_total", "counter",
+                "Number of captured frames skipped because the encoder was "
+                "falling behind");
+  text_.Add("momo_capture_backpressure_skipped_frames_total", {},
+            stats.backpressure_skipped_frames);
+  text_.Declare("momo_capture_static_skipped_frames_total", "counter",
+                "Number of captured frames skipped because the scene was "
+                "not changing");
+  text_.Add("momo_capture_static_skipped_frames_total", {},
+            stats.static_skipped_frames);
+  text_.Declare("momo_capture_fps", "gauge",
+                "Capture frame rate in the last second");
+  text_.Add("momo_capture_fps", {}, stats.capture_fps);
+
+  CapturePipeline::StageStats convert;
+  CapturePipeline::StageStats deliver;
+  if (!source->GetPipelineStats(&convert, &deliver)) {
+    return;
+  }
+  text_.Declare("momo_capture_stage_frames_total", "counter",
+                "Number of frames processed by each capture pipeline stage");
+  text_.Declare("momo_capture_stage_dropped_frames_total", "counter",
+                "Number of frames dropped before each capture pipeline stage");
+  text_.Declare("momo_capture_stage_wait_seconds_total", "counter",
+                "Total time frames waited in the queue of each stage");
+  text_.Declare("momo_capture_stage_work_seconds_total", "counter",
+                "Total time spent processing frames in each stage");
+  text_.Declare("momo_capture_stage_wait_max_seconds", "gauge",
+                "Longest time a frame waited in the queue of each stage");
+  text_.Declare("momo_capture_stage_work_max_seconds", "gauge",
+                "Longest time spent processing a frame in each stage");
+  for (const auto& stage :
+       std::vector<std::pair<std::string, CapturePipeline::StageStats>>{
+           {"convert", convert}, {"deliver", deliver}}) {
+    const PrometheusText::Labels labels = {{"stage", stage.first}};
+    const CapturePipeline::StageStats& s = stage.second;
+    text_.Add("momo_capture_stage_frames_total", labels, s.count);
+    text_.Add("momo_capture_stage_dropped_frames_total", labels, s.dropped);
+    text_.Add("momo_capture_stage_wait_seconds_total", labels,
+              s.wait_total_us / kMicrosecsPerSec);
+    text_.Add("momo_capture_stage_work_seconds_total", labels,
+              s.work_total_us / kMicrosecsPerSec);
+    text_.Add("momo_capture_stage_wait_max_seconds", labels,
+              s.wait_max_us / kMicrosecsPerSec);
+    text_.Add("momo_capture_stage_work_max_seconds", labels,
+              s.work_max_us / kMicrosecsPerSec);
+  }
+}
+
+void MetricsCollector::CollectEncoders() {
+  std::vector<EncoderMetrics::Snapshot> snapshots =
+      EncoderMetricsRegistry::Instance().GetSnapshots();
+  if (snapshots.empty()) {
+    return;
+  }
+
+  text_.Declare("momo_encoder_frames_total", "counter",
+                "Number of frames output by the encoder");
+  text_.Declare("momo_encoder_key_frames_total", "counter",
+                "Number of key frames output by the encoder");
+  text_.Declare("momo_encoder_dropped_frames_total", "counter",
+                "Number of frames dropped by the encoder");
+  text_.Declare("momo_encoder_skipped_frames_total", "counter",
+                "Number of frames WebRTC asked the encoder to skip");
+  text_.Declare("momo_encoder_coalesced_key_frame_requests_total", "counter",
+                "Number of key frame requests answered without a new IDR");
+  text_.Declare("momo_encoder_stall_resets_total", "counter",
+                "Number of times the encoder was reinitialized after a stall");
+  text_.Declare("momo_encoder_bytes_total", "counter",
+                "Number of bytes output by the encoder");
+  text_.Declare("momo_encoder_in_flight_frames", "gauge",
+                "Number of frames being encoded");
+  text_.Declare("momo_encoder_latency_seconds", "histogram",
+                "Time from Encode() to the encoded image callback");
+  text_.Declare("momo_encoder_latency_max_seconds", "gauge",
+                "Longest encode latency");
+  text_.Declare("momo_encoder_bitrate_bps", "gauge",
+                "Actual output bitrate of the encoder");
+  text_.Declare("momo_encoder_target_bitrate_bps", "gauge",
+                "Target bitrate requested by WebRTC");
+  text_.Declare("momo_encoder_stage_seconds", "summary",
+                "Time spent in each stage inside the encoder");
+  text_.Declare("momo_encoder_stage_max_seconds", "gauge",
+                "Longest time spent in each stage inside the encoder");
+
+  const std::vector<int>& buckets_ms = EncoderMetrics::LatencyBucketsMs();
+  for (const auto& snapshot : snapshots) {
+    const PrometheusText::Labels labels = {{"encoder", snapshot.name}};
+    text_.Add("momo_encoder_frames_total", labels, snapshot.frames);
+    text_.Add("momo_encoder_key_frames_total", labels, snapshot.key_frames);
+    text_.Add("momo_encoder_dropped_frames_total", labels, snapshot.dropped);
+    text_.Add("momo_encoder_skipped_frames_total", labels, snapshot.skipped);
+    text_.Add("momo_encoder_coalesced_key_frame_requests_total", labels,
+              snapshot.coalesced_key_frame_requests);
+    text_.Add("momo_encoder_stall_resets_total", labels,
+              snapshot.stall_resets);
+    text_.Add("momo_encoder_bytes_total", labels, snapshot.bytes);
+    text_.Add("momo_encoder_in_flight_frames", labels, snapshot.in_flight);
+
+    // Prometheus のヒストグラムは累積なので足し合わせていく
+    int64_t cumulative = 0;
+    for (size_t i = 0; i < snapshot.latency_buckets.size(); i++) {
+      cumulative += snapshot.latency_buckets[i];
+      std::string le = "+Inf";
+      if (i < buckets_ms.size()) {
+        std::stringstream ss;
+        ss << buckets_ms[i] / 1000.0;
+        le = ss.str();
+      }
+      PrometheusText::Labels bucket_labels = labels;
+      bucket_labels.push_back({"le", le});
+      text_.Add("momo_encoder_latency_seconds",
+                "momo_encoder_latency_seconds_bucket", bucket_labels,
+                cumulative);
+    }
+    text_.Add("momo_encoder_latency_seconds",
+              "momo_encoder_latency_seconds_sum", labels,
+              snapshot.latency_sum_us / kMicrosecsPerSec);
+    text_.Add("momo_encoder_latency_seconds",
+              "momo_encoder_latency_seconds_count", labels, cumulative);
+    text_.Add("momo_encoder_latency_max_seconds", labels,
+              snapshot.latency_max_us / kMicrosecsPerSec);
+    text_.Add("momo_encoder_bitrate_bps", labels, snapshot.actual_bitrate_bps);
+    text_.Add("momo_encoder_target_bitrate_bps", labels,
+              snapshot.target_bitrate_bps);
+    for (const auto& stage : snapshot.stages) {
+      PrometheusText::Labels stage_labels = labels;
+      stage_labels.push_back({"stage", stage.first});
+      text_.Add("momo_encoder_stage_seconds", "momo_encoder_stage_seconds_sum",
+                stage_labels, stage.second.sum_us / kMicrosecsPerSec);
+      text_.Add("momo_encoder_stage_seconds",
+                "momo_encoder_stage_seconds_count", stage_labels,
+                stage.second.count);
+      text_.Add("momo_encoder_stage_max_seconds", stage_labels,
+                stage.second.max_us / kMicrosecsPerSec);
+    }
+  }
+}
+
+void MetricsCollector::CollectSampler(RTCManager* rtc_manager) {
+  std::shared_ptr<StatsSampler> sampler = rtc_manager->getStatsSampler();
+  if (!sampler) {
+    return;
+  }
+  std::vector<StatsSampler::Series> latest = sampler->GetLatest();
+  if (latest.empty()) {
+    return;
+  }
+
+  text_.Declare("momo_stats_video_bitrate_bps", "gauge",
+                "Sent video bitrate over the last sampling interval");
+  text_.Declare("momo_stats_video_fps", "gauge",
+                "Encoded video framerate over the last sampling interval");
+  text_.Declare("momo_stats_encode_seconds_per_frame", "gauge",
+                "Average encode time per frame over the last interval");
+  text_.Declare("momo_stats_loss_rate", "gauge",
+                "Fraction of sent video packets reported lost");
+  text_.Declare("momo_stats_received_video_bitrate_bps", "gauge",
+                "Received video bitrate over the last sampling interval");
+  text_.Declare("momo_stats_received_loss_rate", "gauge",
+                "Fraction of received video packets lost");
+  text_.Declare("momo_stats_retransmitted_bitrate_bps", "gauge",
+                "Retransmitted video bitrate over the last sampling interval");
+  text_.Declare("momo_stats_nacks_received_per_second", "gauge",
+                "NACKs received for sent video per second");
+  text_.Declare("momo_stats_received_fec_packets_per_second", "gauge",
+                "FEC packets received for received video per second");
+  text_.Declare("momo_stats_estimated_mouth_to_ear_seconds", "gauge",
+                "Half RTT plus audio jitter buffer and playout delay");
+  for (const auto& series : latest) {
+    const StatsSampler::Sample& sample = series.samples.back();
+    const PrometheusText::Labels labels = {
+        {"connection", std::to_string(series.id)}};
+    text_.Add("momo_stats_video_bitrate_bps", labels, sample.video_bitrate_bps);
+    text_.Add("momo_stats_video_fps", labels, sample.video_fps);
+    text_.Add("momo_stats_encode_seconds_per_frame", labels,
+              sample.encode_ms_per_frame / 1000);
+    text_.Add("momo_stats_loss_rate", labels, sample.loss_rate);
+    text_.Add("momo_stats_received_video_bitrate_bps", labels,
+              sample.received_video_bitrate_bps);
+    text_.Add("momo_stats_received_loss_rate", labels,
+              sample.received_loss_rate);
+    text_.Add("momo_stats_retransmitted_bitrate_bps", labels,
+              sample.retransmitted_bitrate_bps);
+    text_.Add("momo_stats_nacks_received_per_second", labels,
+              sample.nacks_received_per_sec);
+    text_.Add("momo_stats_received_fec_packets_per_second", labels,
+              sample.received_fec_packets_per_sec);
+    text_.Add("momo_stats_estimated_mouth_to_ear_seconds", labels,
+              sample.estimated_mouth_to_ear_ms / 1000);
+  }
+}
+
+void MetricsCollector::CollectThreads() {
+#if defined(__linux__)
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    return;
+  }
+  const double ticks_per_sec = sysconf(_SC_CLK_TCK);
+  text_.Declare("momo_thread_cpu_seconds_total", "counter",
+                "CPU time (user + system) consumed by each thread");
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    std::ifstream ifs(std::string("/proc/self/task/") + entry->d_name +
+                      "/stat");
+    std::string stat;
+    if (!std::getline(ifs, stat)) {
+      continue;
+    }
+    // "tid (スレッド名) state ..." の形式で、スレッド名には空白や括弧が含まれることがある
+    size_t begin = stat.find('(');
+    size_t end = stat.rfind(')');
+    if (begin == std::string::npos || end == std::string::npos ||
+        end < begin) {
+      continue;
+    }
+    std::string name = stat.substr(begin + 1, end - begin - 1);
+    std::stringstream ss(stat.substr(end + 1));
+    // state から数えて 12 番目と 13 番目が utime と stime
+    std::string field;
+    int skipped = 0;
+    while (skipped < 11 && ss >> field) {
+      skipped++;
+    }
+    long long utime = 0;
+    long long stime = 0;
+    if (!(ss >> utime >> stime)) {
+      continue;
+    }
+    text_.Add("momo_thread_cpu_seconds_total",
+              {{"thread", name}, {"tid", entry->d_name}},
+              (utime + stime) / ticks_per_sec);
+  }
+  closedir(dir);
+#endif
+}
+
+void MetricsCollector::CollectMemory() {
+  MemoryAccounting& accounting = MemoryAccounting::Instance();
+  text_.Declare("momo_memory_bytes", "gauge",
+                "Memory allocated for large buffers by each area");
+  for (int i = 0; i < MemoryAccounting::kNumAreas; i++) {
+    auto area = static_cast<MemoryAccounting::Area>(i);
+    text_.Add("momo_memory_bytes", {{"area", MemoryAccounting::Name(area)}},
+              accounting.Get(area));
+  }
+  int64_t resident = MemoryAccounting::GetResidentBytes();
+  if (resident > 0) {
+    text_.Declare("momo_process_resident_bytes", "gauge",
+                  "Resident set size of the process");
+    text_.Add("momo_process_resident_bytes", {}, resident);
+  }
+  if (accounting.budget() > 0) {
+    text_.Declare("momo_memory_budget_bytes", "gauge",
+                  "Memory budget specified by --memory-budget");
+    text_.Add("momo_memory_budget_bytes", {}, accounting.budget());
+  }
+}
+
+void MetricsCollector::OnStats(
+    int connection_index,
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::string connection = std::to_string(connection_index);
+
+  text_.Declare("momo_rtc_round_trip_time_seconds", "gauge",
+                "Current round trip time of the selected candidate pair");
+  text_.Declare("momo_rtc_available_outgoing_bitrate_bps", "gauge",
+                "Available outgoing bitrate estimated by the congestion "
+                "controller");
+  for (const auto* transport :
+       report->GetStatsOfType<webrtc::RTCTransportStats>()) {
+    if (!transport->selected_candidate_pair_id.is_defined()) {
+      continue;
+    }
+    const webrtc::RTCStats* stats =
+        report->Get(*transport->selected_candidate_pair_id);
+    if (stats == nullptr ||
+        stats->type() != webrtc::RTCIceCandidatePairStats::kType) {
+      continue;
+    }
+    const auto& pair = stats->cast_to<webrtc::RTCIceCandidatePairStats>();
+    const PrometheusText::Labels labels = {{"connection", connection}};
+    if (pair.current_round_trip_time.is_defined()) {
+      text_.Add("momo_rtc_round_trip_time_seconds", labels,
+                *pair.current_round_trip_time);
+    }
+    if (pair.available_outgoing_bitrate.is_defined()) {
+      text_.Add("momo_rtc_available_outgoing_bitrate_bps", labels,
+                *pair.available_outgoing_bitrate);
+    }
+  }
+
+  text_.Declare("momo_rtc_outbound_packets_sent_total", "counter",
+                "Number of RTP packets sent");
+  text_.Declare("momo_rtc_outbound_bytes_sent_total", "counter",
+                "Number of RTP payload bytes sent");
+  for (const auto* outbound :
+       report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+    const PrometheusText::Labels labels = {
+        {"connection", connection},
+        {"kind", LabelValue(outbound->kind)},
+        {"ssrc", LabelValue(outbound->ssrc)}};
+    if (outbound->packets_sent.is_defined()) {
+      text_.Add("momo_rtc_outbound_packets_sent_total", labels,
+                *outbound->packets_sent);
+    }
+    if (outbound->bytes_sent.is_defined()) {
+      text_.Add("momo_rtc_outbound_bytes_sent_total", labels,
+                *outbound->bytes_sent);
+    }
+  }
+
+  // 送信したストリームについて、受信側から RTCP で報告された値
+  text_.Declare("momo_rtc_remote_packets_lost", "gauge",
+                "Packets lost reported by the remote receiver");
+  text_.Declare("momo_rtc_remote_jitter_seconds", "gauge",
+                "Jitter reported by the remote receiver");
+  text_.Declare("momo_rtc_remote_round_trip_time_seconds", "gauge",
+                "Round trip time calculated from RTCP receiver reports");
+  for (const auto* remote :
+       report->GetStatsOfType<webrtc::RTCRemoteInboundRtpStreamStats>()) {
+    const PrometheusText::Labels labels = {
+        {"connection", connection},
+        {"kind", LabelValue(remote->kind)},
+        {"ssrc", LabelValue(remote->ssrc)}};
+    if (remote->packets_lost.is_defined()) {
+      text_.Add("momo_rtc_remote_packets_lost", labels, *remote->packets_lost);
+    }
+    if (remote->jitter.is_defined()) {
+      text_.Add("momo_rtc_remote_jitter_seconds", labels, *remote->jitter);
+    }
+    if (remote->round_trip_time.is_defined()) {
+      text_.Add("momo_rtc_remote_round_trip_time_seconds", labels,
+                *remote->round_trip_time);
+    }
+  }
+
+  text_.Declare("momo_rtc_inbound_packets_lost", "gauge",
+                "Packets lost in received streams");
+  text_.Declare("momo_rtc_inbound_jitter_seconds", "gauge",
+                "Jitter of received streams");
+  for (const auto* inbound :
+       report->GetStatsOfType<webrtc::RTCInboundRTPStreamStats>()) {
+    const PrometheusText::Labels labels = {
+        {"connection", connection},
+        {"kind", LabelValue(inbound->kind)},
+        {"ssrc", LabelValue(inbound->ssrc)}};
+    if (inbound->packets_lost.is_defined()) {
+      text_.Add("momo_rtc_inbound_packets_lost", labels,
+                *inbound->packets_lost);
+    }
+    if (inbound->jitter.is_defined()) {
+      text_.Add("momo_rtc_inbound_jitter_seconds", labels, *inbound->jitter);
+    }
+  }
+
+  remaining_--;
+  if (remaining_ == 0) {
+    // 最後の統計情報が揃ったので返す
+    callback_(text_.ToString());
+  }
+}
+
+void MetricsCollector::Finish() {
+  callback_(text_.ToString());
+}
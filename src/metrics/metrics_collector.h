@@ -0,0 +1,80 @@
+#ifndef METRICS_COLLECTOR_H_
+#define METRICS_COLLECTOR_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "api/stats/rtc_stats_report.h"
+#include "rtc/manager.h"
+
+// Prometheus のテキスト形式 (text/plain; version=0.0.4) を組み立てるクラス。
+//
+// 同じ名前のメトリクスはまとめて出力する必要があるので、
+// 追加された順番を保ったまま名前毎にサンプルを溜めておく。
+class PrometheusText {
+ public:
+  typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+  // HELP と TYPE を設定する。既に設定されている場合は何もしない
+  void Declare(const std::string& name,
+               const std::string& type,
+               const std::string& help);
+  // sample_name は histogram の場合に name + "_bucket" のような名前になる
+  void Add(const std::string& name,
+           const std::string& sample_name,
+           const Labels& labels,
+           double value);
+  void Add(const std::string& name, const Labels& labels, double value) {
+    Add(name, name, labels, value);
+  }
+
+  std::string ToString() const;
+
+ private:
+  struct Family {
+    std::string type;
+    std::string help;
+    std::vector<std::string> samples;
+  };
+  std::vector<std::string> names_;
+  std::map<std::string, Family> families_;
+};
+
+// キャプチャ、エンコーダ、RTCStats、スレッド毎の CPU 時間を集めて
+// Prometheus のテキスト形式にするクラス。
+//
+// RTCStats は非同期でしか取得できないので、全ての接続の統計情報が揃ったら
+// callback を呼ぶ。callback は WebRTC のシグナリングスレッドから呼ばれることがある。
+class MetricsCollector
+    : public std::enable_shared_from_this<MetricsCollector> {
+ public:
+  typedef std::function<void(std::string)> Callback;
+
+  static void Collect(RTCManager* rtc_manager, Callback callback);
+
+ private:
+  explicit MetricsCollector(Callback callback);
+
+  void CollectCapture(RTCManager* rtc_manager);
+  void CollectEncoders();
+  void CollectSampler(RTCManager* rtc_manager);
+  void CollectThreads();
+  void CollectMemory();
+  void OnStats(int connection_index,
+               const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+  void Finish();
+
+  Callback callback_;
+  std::mutex mutex_;
+  PrometheusText text_;
+  size_t remaining_ = 0;
+};
+
+#endif  // METRICS_COLLECTOR_H_
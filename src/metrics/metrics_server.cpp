@@ -0,0 +1,61 @@
+#include "metrics_server.h"
+
+#include "metrics_session.h"
+#include "util.h"
+
+MetricsServer::MetricsServer(boost::asio::io_context& ioc,
+                             boost::asio::ip::tcp::endpoint endpoint,
+                             RTCManager* rtc_manager)
+    : acceptor_(ioc), socket_(ioc), rtc_manager_(rtc_manager) {
+  boost::system::error_code ec;
+
+  // Open the acceptor
+  acceptor_.open(endpoint.protocol(), ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "open");
+    return;
+  }
+
+  // Allow address reuse
+  acceptor_.set_option(boost::asio::socket_base::reuse_address(true), ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "set_option");
+    return;
+  }
+
+  // Bind to the server address
+  acceptor_.bind(endpoint, ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "bind");
+    return;
+  }
+
+  // Start listening for connections
+  acceptor_.listen(boost::asio::socket_base::max_listen_connections, ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "listen");
+    return;
+  }
+}
+
+void MetricsServer::run() {
+  if (!acceptor_.is_open())
+    return;
+  doAccept();
+}
+
+void MetricsServer::doAccept() {
+  acceptor_.async_accept(socket_,
+                         std::bind(&MetricsServer::onAccept, shared_from_this(),
+                                   std::placeholders::_1));
+}
+
+void MetricsServer::onAccept(boost::system::error_code ec) {
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "accept");
+  } else {
+    std::make_shared<MetricsSession>(std::move(socket_), rtc_manager_)->run();
+  }
+
+  doAccept();
+}
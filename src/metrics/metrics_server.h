@@ -0,0 +1,31 @@
+#ifndef METRICS_SERVER_H_
+#define METRICS_SERVER_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/system/error_code.hpp>
+#include <memory>
+
+#include "rtc/manager.h"
+
+// GET /metrics で Prometheus 形式のメトリクスを返す HTTP サーバ。
+// シグナリングのモードに関係なく、--metrics-port を指定した場合に起動する。
+class MetricsServer : public std::enable_shared_from_this<MetricsServer> {
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::ip::tcp::socket socket_;
+
+  RTCManager* rtc_manager_;
+
+ public:
+  MetricsServer(boost::asio::io_context& ioc,
+                boost::asio::ip::tcp::endpoint endpoint,
+                RTCManager* rtc_manager);
+
+  void run();
+
+ private:
+  void doAccept();
+  void onAccept(boost::system::error_code ec);
+};
+
+#endif  // METRICS_SERVER_H_
@@ -0,0 +1,127 @@
+#include "metrics_session.h"
+
+#include <boost/asio/post.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/version.hpp>
+
+#include "metrics_collector.h"
+#include "rtc/frame_tracer.h"
+#include "util.h"
+
+MetricsSession::MetricsSession(boost::asio::ip::tcp::socket socket,
+                               RTCManager* rtc_manager)
+    : socket_(std::move(socket)),
+      strand_(socket_.get_executor()),
+      rtc_manager_(rtc_manager) {}
+
+void MetricsSession::run() {
+  doRead();
+}
+
+boost::beast::http::response<boost::beast::http::string_body>
+MetricsSession::createResponse(
+    const boost::beast::http::request<boost::beast::http::string_body>& req,
+    std::string body) {
+  boost::beast::http::response<boost::beast::http::string_body> res{
+      boost::beast::http::status::ok, req.version()};
+  res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+  res.set(boost::beast::http::field::content_type,
+          "text/plain; version=0.0.4");
+  res.keep_alive(req.keep_alive());
+  res.body() = std::move(body);
+  res.prepare_payload();
+  return res;
+}
+
+void MetricsSession::doRead() {
+  // Make the request empty before reading,
+  // otherwise the operation behavior is undefined.
+  req_ = {};
+
+  // Read a request
+  boost::beast::http::async_read(
+      socket_, buffer_, req_,
+      boost::asio::bind_executor(
+          strand_, std::bind(&MetricsSession::onRead, shared_from_this(),
+                             std::placeholders::_1, std::placeholders::_2)));
+}
+
+void MetricsSession::onRead(boost::system::error_code ec,
+                            std::size_t bytes_transferred) {
+  boost::ignore_unused(bytes_transferred);
+
+  // 接続が切られた
+  if (ec == boost::beast::http::error::end_of_stream)
+    return doClose();
+
+  if (ec)
+    return MOMO_BOOST_ERROR(ec, "read");
+
+  // --record-preroll-sec で保持している映像と音声を書き出す
+  if (req_.method() == boost::beast::http::verb::post &&
+      req_.target() == "/clip") {
+    std::string path = rtc_manager_->saveClip();
+    if (path.empty())
+      return sendResponse(Util::serverError(req_, "No preroll to save"));
+    return sendResponse(createResponse(req_, path + "\n"));
+  }
+
+  if (req_.method() != boost::beast::http::verb::get)
+    return sendResponse(Util::badRequest(req_, "Unknown HTTP-method"));
+
+  // --trace-events で記録したフレームの処理を Chrome のトレース形式で返す
+  if (req_.target() == "/trace") {
+    if (!FrameTracer::Instance().enabled())
+      return sendResponse(Util::notFound(req_, req_.target()));
+    auto res = createResponse(req_, FrameTracer::Instance().ToJson());
+    res.set(boost::beast::http::field::content_type, "application/json");
+    return sendResponse(std::move(res));
+  }
+
+  // --snapshot で保持している最新のフレームを JPEG で返す
+  if (req_.target() == "/snapshot.jpg") {
+    std::string jpeg;
+    if (!rtc_manager_->getSnapshot(&jpeg))
+      return sendResponse(Util::notFound(req_, req_.target()));
+    auto res = createResponse(req_, std::move(jpeg));
+    res.set(boost::beast::http::field::content_type, "image/jpeg");
+    res.set(boost::beast::http::field::cache_control, "no-store");
+    return sendResponse(std::move(res));
+  }
+
+  if (req_.target() != "/metrics")
+    return sendResponse(Util::notFound(req_, req_.target()));
+
+  // RTCStats はシグナリングスレッドから返ってくるので、strand に戻してから書き込む
+  auto self = shared_from_this();
+  MetricsCollector::Collect(rtc_manager_, [self](std::string body) {
+    boost::asio::post(self->strand_, std::bind(&MetricsSession::onMetrics,
+                                               self, std::move(body)));
+  });
+}
+
+void MetricsSession::onMetrics(std::string body) {
+  sendResponse(createResponse(req_, std::move(body)));
+}
+
+void MetricsSession::onWrite(boost::system::error_code ec,
+                             std::size_t bytes_transferred,
+                             bool close) {
+  boost::ignore_unused(bytes_transferred);
+
+  if (ec)
+    return MOMO_BOOST_ERROR(ec, "write");
+
+  if (close)
+    return doClose();
+
+  res_ = nullptr;
+
+  doRead();
+}
+
+void MetricsSession::doClose() {
+  boost::system::error_code ec;
+  socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec);
+}
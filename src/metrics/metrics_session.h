@@ -0,0 +1,67 @@
+#ifndef METRICS_SESSION_H_
+#define METRICS_SESSION_H_
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/write.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "rtc/manager.h"
+
+// MetricsServer の 1 つの HTTP 接続を処理するためのクラス
+class MetricsSession : public std::enable_shared_from_this<MetricsSession> {
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::strand<boost::asio::ip::tcp::socket::executor_type> strand_;
+  boost::beast::flat_buffer buffer_;
+  boost::beast::http::request<boost::beast::http::string_body> req_;
+  std::shared_ptr<void> res_;
+
+  RTCManager* rtc_manager_;
+
+ public:
+  MetricsSession(boost::asio::ip::tcp::socket socket, RTCManager* rtc_manager);
+
+  void run();
+
+  // Prometheus のテキスト形式のレスポンスを作る
+  static boost::beast::http::response<boost::beast::http::string_body>
+  createResponse(
+      const boost::beast::http::request<boost::beast::http::string_body>& req,
+      std::string body);
+
+ private:
+  void doRead();
+  void onRead(boost::system::error_code ec, std::size_t bytes_transferred);
+  void onMetrics(std::string body);
+
+  template <class Body, class Fields>
+  void sendResponse(boost::beast::http::response<Body, Fields> msg) {
+    auto sp = std::make_shared<boost::beast::http::response<Body, Fields>>(
+        std::move(msg));
+
+    // msg オブジェクトは書き込みが完了するまで生きている必要があるので、
+    // メンバに入れてライフタイムを延ばしてやる
+    res_ = sp;
+
+    // Write the response
+    boost::beast::http::async_write(
+        socket_, *sp,
+        boost::asio::bind_executor(
+            strand_, std::bind(&MetricsSession::onWrite, shared_from_this(),
+                               std::placeholders::_1, std::placeholders::_2,
+                               sp->need_eof())));
+  }
+
+  void onWrite(boost::system::error_code ec,
+               std::size_t bytes_transferred,
+               bool close);
+  void doClose();
+};
+
+#endif  // METRICS_SESSION_H_
@@ -0,0 +1,405 @@
+#include "mf_video_capturer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cctype>
+#include <vector>
+
+// Windows
+#include <mfapi.h>
+#include <mferror.h>
+
+#include "api/video/i420_buffer.h"
+#include "rtc/frame_buffer_pool.h"
+#include "rtc/native_buffer.h"
+#include "rtc/thread_placement.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+using Microsoft::WRL::ComPtr;
+
+namespace {
+
+const DWORD kStreamIndex =
+    static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM);
+
+std::string ToUtf8(const wchar_t* str) {
+  int size = WideCharToMultiByte(CP_UTF8, 0, str, -1, nullptr, 0, nullptr,
+                                 nullptr);
+  if (size <= 1) {
+    return std::string();
+  }
+  std::string result(size - 1, '\0');
+  WideCharToMultiByte(CP_UTF8, 0, str, -1, &result[0], size, nullptr,
+                      nullptr);
+  return result;
+}
+
+std::string GetString(IMFActivate* device, const GUID& key) {
+  wchar_t* value = nullptr;
+  UINT32 length = 0;
+  if (FAILED(device->GetAllocatedString(key, &value, &length))) {
+    return std::string();
+  }
+  std::string result = ToUtf8(value);
+  CoTaskMemFree(value);
+  return result;
+}
+
+bool StartsWith(const std::string& str, const std::string& prefix) {
+  return str.size() >= prefix.size() &&
+         std::equal(prefix.begin(), prefix.end(), str.begin());
+}
+
+webrtc::VideoType ToVideoType(const GUID& subtype) {
+  if (subtype == MFVideoFormat_NV12) {
+    return webrtc::VideoType::kNV12;
+  } else if (subtype == MFVideoFormat_MJPG) {
+    return webrtc::VideoType::kMJPEG;
+  } else if (subtype == MFVideoFormat_YUY2) {
+    return webrtc::VideoType::kYUY2;
+  } else if (subtype == MFVideoFormat_I420) {
+    return webrtc::VideoType::kI420;
+  }
+  return webrtc::VideoType::kUnknown;
+}
+
+// 解像度とフレームレートが同じ場合に、どの形式を優先するか。小さい方を優先する
+int FormatRank(webrtc::VideoType type) {
+  switch (type) {
+    case webrtc::VideoType::kNV12:
+      return 0;
+    case webrtc::VideoType::kMJPEG:
+      return 1;
+    case webrtc::VideoType::kYUY2:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+// COM を使うスレッドで初期化する。既に別のモードで初期化されていても使える
+class ScopedCOM {
+ public:
+  ScopedCOM() {
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    initialized_ = SUCCEEDED(hr);
+  }
+  ~ScopedCOM() {
+    if (initialized_) {
+      CoUninitialize();
+    }
+  }
+
+ private:
+  bool initialized_;
+};
+
+}  // namespace
+
+rtc::scoped_refptr<MFVideoCapturer> MFVideoCapturer::Create(
+    const ConnectionSettings& cs) {
+  ScopedCOM com;
+  rtc::scoped_refptr<MFVideoCapturer> capturer(
+      new rtc::RefCountedObject<MFVideoCapturer>());
+  if (!capturer->Init(cs)) {
+    return nullptr;
+  }
+  capturer->capture_thread_.reset(new rtc::PlatformThread(
+      MFVideoCapturer::CaptureThread, capturer.get(), "MFCapture",
+      rtc::kHighPriority));
+  capturer->capture_thread_->Start();
+  return capturer;
+}
+
+MFVideoCapturer::MFVideoCapturer() : quit_(false) {}
+
+MFVideoCapturer::~MFVideoCapturer() {
+  if (capture_thread_) {
+    quit_ = true;
+    // ReadSample() は次のフレームが届けば戻るので、それを待つ
+    capture_thread_->Stop();
+    capture_thread_.reset();
+  }
+  reader_.Reset();
+  if (source_) {
+    source_->Shutdown();
+    source_.Reset();
+  }
+  if (mf_started_) {
+    MFShutdown();
+  }
+}
+
+bool MFVideoCapturer::Init(const ConnectionSettings& cs) {
+  use_native_ = cs.use_native;
+  if (FAILED(MFStartup(MF_VERSION))) {
+    RTC_LOG(LS_ERROR) << "Failed to MFStartup";
+    return false;
+  }
+  mf_started_ = true;
+
+  ComPtr<IMFAttributes> attributes;
+  if (FAILED(MFCreateAttributes(&attributes, 1)) ||
+      FAILED(attributes->SetGUID(
+          MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
+          MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID))) {
+    return false;
+  }
+  IMFActivate** devices = nullptr;
+  UINT32 num_devices = 0;
+  if (FAILED(MFEnumDeviceSources(attributes.Get(), &devices, &num_devices))) {
+    RTC_LOG(LS_ERROR) << "Failed to MFEnumDeviceSources";
+    return false;
+  }
+
+  // DeviceVideoCapturer と同じく、番号、シンボリックリンク、デバイス名の順に探す
+  const std::string& device = cs.video_device;
+  int index = -1;
+  if (!device.empty() &&
+      std::all_of(device.cbegin(), device.cend(),
+                  [](char ch) { return std::isdigit(ch); })) {
+    index = atoi(device.c_str());
+  }
+  int selected = -1;
+  for (UINT32 i = 0; i < num_devices; i++) {
+    const std::string name =
+        GetString(devices[i], MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME);
+    const std::string link = GetString(
+        devices[i], MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_SYMBOLIC_LINK);
+    RTC_LOG(LS_INFO) << "video device " << i << ": " << name << " (" << link
+                     << ")";
+    if (selected >= 0) {
+      continue;
+    }
+    if (device.empty() || static_cast<int>(i) == index ||
+        StartsWith(link, device) || StartsWith(name, device)) {
+      selected = i;
+    }
+  }
+  bool result = false;
+  if (selected < 0) {
+    RTC_LOG(LS_ERROR) << "Video device not found: " << device;
+  } else if (FAILED(devices[selected]->ActivateObject(
+                 IID_PPV_ARGS(&source_)))) {
+    RTC_LOG(LS_ERROR) << "Failed to activate video device " << selected;
+  } else {
+    result = true;
+  }
+  for (UINT32 i = 0; i < num_devices; i++) {
+    devices[i]->Release();
+  }
+  CoTaskMemFree(devices);
+  if (!result) {
+    return false;
+  }
+
+  const bool hardware_decode = cs.use_native && cs.mf_hardware_decode;
+  ComPtr<IMFAttributes> reader_attributes;
+  if (FAILED(MFCreateAttributes(&reader_attributes, 2))) {
+    return false;
+  }
+  if (hardware_decode) {
+    // MJPEG のデコーダにハードウェアの MFT を使わせる
+    reader_attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS,
+                                 TRUE);
+    reader_attributes->SetUINT32(
+        MF_SOURCE_READER_ENABLE_ADVANCED_VIDEO_PROCESSING, TRUE);
+  }
+  if (FAILED(MFCreateSourceReaderFromMediaSource(
+          source_.Get(), reader_attributes.Get(), &reader_))) {
+    RTC_LOG(LS_ERROR) << "Failed to MFCreateSourceReaderFromMediaSource";
+    return false;
+  }
+  auto size = cs.getSize();
+  return SetMediaType(size.width, size.height, cs.framerate, hardware_decode);
+}
+
+bool MFVideoCapturer::SetMediaType(int width,
+                                   int height,
+                                   int framerate,
+                                   bool hardware_decode) {
+  ComPtr<IMFMediaType> best;
+  webrtc::VideoType best_type = webrtc::VideoType::kUnknown;
+  int64_t best_score = -1;
+  for (DWORD i = 0;; i++) {
+    ComPtr<IMFMediaType> type;
+    if (FAILED(reader_->GetNativeMediaType(kStreamIndex, i, &type))) {
+      break;
+    }
+    GUID subtype;
+    if (FAILED(type->GetGUID(MF_MT_SUBTYPE, &subtype))) {
+      continue;
+    }
+    const webrtc::VideoType video_type = ToVideoType(subtype);
+    if (video_type == webrtc::VideoType::kUnknown) {
+      continue;
+    }
+    UINT32 w = 0;
+    UINT32 h = 0;
+    UINT32 num = 0;
+    UINT32 den = 1;
+    MFGetAttributeSize(type.Get(), MF_MT_FRAME_SIZE, &w, &h);
+    MFGetAttributeRatio(type.Get(), MF_MT_FRAME_RATE, &num, &den);
+    const int fps = den > 0 ? static_cast<int>(num / den) : 0;
+    // 解像度の差、足りないフレームレート、形式の順で比べる
+    const int64_t size_diff = std::abs(static_cast<int>(w) - width) +
+                              std::abs(static_cast<int>(h) - height);
+    const int64_t fps_diff = std::max(framerate - fps, 0);
+    const int64_t score =
+        size_diff * 1000 * 10 + fps_diff * 10 + FormatRank(video_type);
+    if (best_score < 0 || score < best_score) {
+      best = type;
+      best_type = video_type;
+      best_score = score;
+    }
+  }
+  if (!best) {
+    RTC_LOG(LS_ERROR) << "No supported video format";
+    return false;
+  }
+  if (FAILED(reader_->SetCurrentMediaType(kStreamIndex, nullptr,
+                                          best.Get()))) {
+    RTC_LOG(LS_ERROR) << "Failed to SetCurrentMediaType";
+    return false;
+  }
+  UINT32 w = 0;
+  UINT32 h = 0;
+  MFGetAttributeSize(best.Get(), MF_MT_FRAME_SIZE, &w, &h);
+  width_ = w;
+  height_ = h;
+  video_type_ = best_type;
+
+  if (hardware_decode && best_type == webrtc::VideoType::kMJPEG) {
+    // カメラの形式はそのままで、出力だけを NV12 にするとデコーダが挟まる
+    ComPtr<IMFMediaType> output;
+    if (SUCCEEDED(MFCreateMediaType(&output)) &&
+        SUCCEEDED(best->CopyAllItems(output.Get())) &&
+        SUCCEEDED(output->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12)) &&
+        SUCCEEDED(reader_->SetCurrentMediaType(kStreamIndex, nullptr,
+                                               output.Get()))) {
+      video_type_ = webrtc::VideoType::kNV12;
+    } else {
+      RTC_LOG(LS_WARNING) << "Failed to decode MJPEG by Media Foundation";
+    }
+  }
+  RTC_LOG(LS_INFO) << "MFVideoCapturer: " << width_ << "x" << height_
+                   << " type=" << static_cast<int>(best_type)
+                   << (video_type_ != best_type ? " (decode to NV12)" : "");
+  i420_converter_ = I420Converter(video_type_);
+  return true;
+}
+
+void MFVideoCapturer::CaptureThread(void* obj) {
+  ThreadPlacement::Instance().Apply("capture");
+  ScopedCOM com;
+  static_cast<MFVideoCapturer*>(obj)->CaptureLoop();
+}
+
+void MFVideoCapturer::CaptureLoop() {
+  while (!quit_) {
+    DWORD stream_index = 0;
+    DWORD flags = 0;
+    LONGLONG timestamp = 0;
+    ComPtr<IMFSample> sample;
+    HRESULT hr = reader_->ReadSample(kStreamIndex, 0, &stream_index, &flags,
+                                     &timestamp, &sample);
+    if (FAILED(hr) || (flags & MF_SOURCE_READERF_ERROR) ||
+        (flags & MF_SOURCE_READERF_ENDOFSTREAM)) {
+      RTC_LOG(LS_ERROR) << "Failed to ReadSample: hr=" << hr
+                        << " flags=" << flags;
+      return;
+    }
+    // どうせ捨てられるフレームは変換しない
+    if (!sample || quit_ || ShouldSkipFrame()) {
+      continue;
+    }
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+        ConvertSample(sample.Get());
+    if (!buffer) {
+      continue;
+    }
+    const int64_t timestamp_us = rtc::TimeMicros();
+    webrtc::VideoFrame video_frame =
+        webrtc::VideoFrame::Builder()
+            .set_video_frame_buffer(buffer)
+            .set_timestamp_rtp(0)
+            .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+            .set_timestamp_us(timestamp_us)
+            .set_rotation(webrtc::kVideoRotation_0)
+            .build();
+    OnCapturedFrame(video_frame);
+  }
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> MFVideoCapturer::ConvertSample(
+    IMFSample* sample) {
+  ComPtr<IMFMediaBuffer> media_buffer;
+  if (FAILED(sample->ConvertToContiguousBuffer(&media_buffer))) {
+    return nullptr;
+  }
+  BYTE* data = nullptr;
+  DWORD length = 0;
+  if (FAILED(media_buffer->Lock(&data, nullptr, &length))) {
+    return nullptr;
+  }
+  // 非圧縮の形式は、行の間に詰め物があることがある
+  int stride = video_type_ == webrtc::VideoType::kYUY2 ? width_ * 2 : width_;
+  ComPtr<IMF2DBuffer> buffer_2d;
+  BYTE* scanline0 = nullptr;
+  LONG pitch = 0;
+  if (video_type_ != webrtc::VideoType::kMJPEG &&
+      SUCCEEDED(media_buffer.As(&buffer_2d)) &&
+      SUCCEEDED(buffer_2d->Lock2D(&scanline0, &pitch)) && pitch > 0) {
+    buffer_2d->Unlock2D();
+    stride = pitch;
+  }
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> result;
+  if (use_native_ && video_type_ == webrtc::VideoType::kNV12 &&
+      static_cast<int64_t>(length) >= static_cast<int64_t>(stride) * height_) {
+    // ハードウェアのデコーダは高さを揃えて出力することがあるので、UV の位置は長さから求める
+    const int rows = std::max<int>(length * 2 / 3 / stride, height_);
+    rtc::scoped_refptr<NativeBuffer> native_buffer(
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            webrtc::VideoType::kNV12, width_, height_));
+    libyuv::CopyPlane(data, stride, native_buffer->MutableDataY(),
+                      native_buffer->StrideY(), width_, height_);
+    libyuv::CopyPlane(data + stride * rows, stride,
+                      native_buffer->MutableDataUV(), native_buffer->StrideUV(),
+                      width_, (height_ + 1) / 2);
+    native_buffer->SetLength(width_ * height_ * 3 / 2);
+    result = native_buffer;
+  } else if (use_native_ && video_type_ == webrtc::VideoType::kYUY2) {
+    rtc::scoped_refptr<NativeBuffer> native_buffer(
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            webrtc::VideoType::kNV12, width_, height_));
+    libyuv::YUY2ToNV12(data, stride, native_buffer->MutableDataY(),
+                       native_buffer->StrideY(), native_buffer->MutableDataUV(),
+                       native_buffer->StrideUV(), width_, height_);
+    native_buffer->SetLength(width_ * height_ * 3 / 2);
+    result = native_buffer;
+  } else if (use_native_ && video_type_ == webrtc::VideoType::kMJPEG) {
+    rtc::scoped_refptr<NativeBuffer> native_buffer(
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            webrtc::VideoType::kMJPEG, width_, height_));
+    memcpy(native_buffer->MutableData(), data, length);
+    native_buffer->SetLength(length);
+    result = native_buffer;
+  } else {
+    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
+        FrameBufferPool::Instance().CreateI420Buffer(width_, height_));
+    if (!i420_converter_.Convert(data, length, width_, height_,
+                                 i420_buffer.get())) {
+      RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
+    } else {
+      result = i420_buffer;
+    }
+  }
+  media_buffer->Unlock();
+  return result;
+}
@@ -0,0 +1,68 @@
+#ifndef MF_VIDEO_CAPTURER_H_
+#define MF_VIDEO_CAPTURER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+// Windows
+#include <mfidl.h>
+#include <mfreadwrite.h>
+#include <wrl/client.h>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame_buffer.h"
+#include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "connection_settings.h"
+#include "rtc/i420_converter.h"
+#include "rtc/scalable_track_source.h"
+#include "rtc_base/platform_thread.h"
+
+// Media Foundation の IMFSourceReader でカメラからキャプチャする (Windows のみ)。
+//
+// DeviceVideoCapturer は VideoCaptureModule が全てのフレームを I420 に変換してしまうので、
+// --use-native の場合はこちらを使い、V4L2VideoCapture と同じように MJPEG と NV12 は
+// そのまま NativeBuffer に入れて渡す。YUY2 は NV12 に変換して渡す。
+// cs.mf_hardware_decode が true で MJPEG しか選べない場合、Media Foundation の
+// ハードウェアデコーダで NV12 にデコードさせるので、NvCodec のエンコーダは変換せずに
+// GPU に書き込める。
+class MFVideoCapturer : public ScalableVideoTrackSource {
+ public:
+  // デバイスを開けなかった場合は nullptr を返す
+  static rtc::scoped_refptr<MFVideoCapturer> Create(
+      const ConnectionSettings& cs);
+  ~MFVideoCapturer() override;
+
+ protected:
+  MFVideoCapturer();
+
+  bool useNativeBuffer() override { return use_native_; }
+
+ private:
+  bool Init(const ConnectionSettings& cs);
+  // 要求された解像度とフレームレートに一番近いカメラの形式を選んで設定する
+  bool SetMediaType(int width, int height, int framerate, bool hardware_decode);
+
+  static void CaptureThread(void* obj);
+  void CaptureLoop();
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> ConvertSample(
+      IMFSample* sample);
+
+  bool use_native_ = false;
+  bool mf_started_ = false;
+  Microsoft::WRL::ComPtr<IMFMediaSource> source_;
+  Microsoft::WRL::ComPtr<IMFSourceReader> reader_;
+  // ReadSample() で受け取るフレームの形式
+  webrtc::VideoType video_type_ = webrtc::VideoType::kUnknown;
+  // video_type_ から I420 への変換
+  I420Converter i420_converter_;
+  int width_ = 0;
+  int height_ = 0;
+
+  std::atomic<bool> quit_;
+  std::unique_ptr<rtc::PlatformThread> capture_thread_;
+};
+
+#endif  // MF_VIDEO_CAPTURER_H_
@@ -0,0 +1,557 @@
+#include "momo_app.h"
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <csignal>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if USE_ROS
+#include "ros/ros_video_capture.h"
+#else
+#if defined(__APPLE__)
+#include "mac_helper/mac_capturer.h"
+#elif defined(__linux__)
+#if USE_MMAL_ENCODER
+#include "hwenc_mmal/mmal_v4l2_capture.h"
+#endif
+#if USE_JETSON_ENCODER
+#include "hwenc_jetson/jetson_v4l2_capture.h"
+#endif
+#if USE_LIBCAMERA
+#include "libcamera_capturer/libcamera_capturer.h"
+#endif
+#include "v4l2_video_capturer/v4l2_video_capturer.h"
+#else
+#include "mf_video_capturer/mf_video_capturer.h"
+#include "rtc/device_video_capturer.h"
+#endif
+#endif
+
+#include "clip_data_channel/clip_data_manager.h"
+#include "file_data_channel/file_transfer_data_manager.h"
+#include "snapshot_data_channel/snapshot_data_manager.h"
+#include "roi_data_channel/roi_data_manager.h"
+#include "serial_data_channel/serial_data_manager.h"
+#include "socket_data_channel/socket_data_manager.h"
+#include "stats_data_channel/stats_data_manager.h"
+
+#if USE_SDL2
+#include "sdl_renderer/sdl_renderer.h"
+#endif
+
+#if USE_DRM
+#include "drm_renderer/drm_renderer.h"
+#endif
+
+#include "ayame/ayame_server.h"
+#include "metrics/metrics_server.h"
+#include "p2p/p2p_server.h"
+#include "rtc/bitrate_cache.h"
+#include "rtc/compositor_track_source.h"
+#include "rtc/data_manager_dispatcher.h"
+#include "rtc/file_video_capturer.h"
+#include "rtc/frame_tracer.h"
+#include "rtc/latency_controller.h"
+#include "rtc/manager.h"
+#include "rtc/media_watchdog.h"
+#if defined(__linux__)
+#include "rtc/shm_video_capturer.h"
+#include "rtc/x11_screen_capturer.h"
+#endif
+#include "rtc/startup_timer.h"
+#include "rtc/stats_sampler.h"
+#include "rtc/thread_placement.h"
+#include "rtsp/rtsp_server.h"
+#include "sora/sora_server.h"
+#include "ssl_verifier.h"
+#include "util.h"
+
+MomoApp::MomoApp(ConnectionSettings cs,
+                 bool use_test,
+                 bool use_ayame,
+                 bool use_sora,
+                 std::shared_ptr<RTCThreads> rtc_threads)
+    : cs_(std::move(cs)),
+      use_test_(use_test),
+      use_ayame_(use_ayame),
+      use_sora_(use_sora),
+      rtc_threads_(std::move(rtc_threads)) {}
+
+void MomoApp::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopped_ = true;
+  if (ioc_ != nullptr) {
+    ioc_->stop();
+  }
+}
+
+int MomoApp::Run(bool handle_signals) {
+  const ConnectionSettings& cs = cs_;
+
+  auto create_capturer = [](const ConnectionSettings& cs)
+      -> rtc::scoped_refptr<ScalableVideoTrackSource> {
+    if (cs.no_video_device || cs.recv_only) {
+      return nullptr;
+    }
+    if (!cs.video_file.empty() || !cs.video_pattern.empty()) {
+      return FileVideoCapturer::Create(cs);
+    }
+#if defined(__linux__)
+    if (!cs.video_shm.empty()) {
+      return ShmVideoCapturer::Create(cs);
+    }
+    if (cs.screen_capture) {
+      return X11ScreenCapturer::Create(cs);
+    }
+#endif
+
+#if USE_ROS
+    rtc::scoped_refptr<ROSVideoCapture> capturer(
+        new rtc::RefCountedObject<ROSVideoCapture>(cs));
+    return capturer;
+#else  // USE_ROS
+    auto size = cs.getSize();
+#if defined(__APPLE__)
+    return MacCapturer::Create(size.width, size.height, cs.framerate,
+                               cs.video_device);
+#elif defined(__linux__)
+#if USE_LIBCAMERA
+    if (cs.use_libcamera) {
+      return LibcameraCapturer::Create(cs);
+    }
+#endif
+#if USE_MMAL_ENCODER
+    if (cs.use_native) {
+      return MMALV4L2Capture::Create(cs);
+    } else {
+      return V4L2VideoCapture::Create(cs);
+    }
+#elif USE_JETSON_ENCODER
+    if (cs.use_native && cs.use_dmabuf) {
+      return JetsonV4L2Capture::Create(cs);
+    } else {
+      return V4L2VideoCapture::Create(cs);
+    }
+#else
+    return V4L2VideoCapture::Create(cs);
+#endif
+#else
+    if (cs.use_native) {
+      return MFVideoCapturer::Create(cs);
+    }
+    return DeviceVideoCapturer::Create(size.width, size.height, cs.framerate,
+                                       cs.video_device);
+#endif
+#endif  // USE_ROS
+  };
+
+  VideoTrackReceiver* receiver = nullptr;
+#if USE_SDL2
+  std::unique_ptr<SDLRenderer> sdl_renderer = nullptr;
+  if (cs.use_sdl) {
+    sdl_renderer.reset(
+        new SDLRenderer(cs.window_width, cs.window_height, cs.fullscreen,
+                        cs.latency_marker, cs.sdl_render_budget_fps));
+    receiver = sdl_renderer.get();
+  }
+#endif
+#if USE_DRM
+  std::unique_ptr<DRMRenderer> drm_renderer = nullptr;
+  if (cs.use_drm) {
+    drm_renderer = DRMRenderer::Create(cs.drm_device, cs.latency_marker);
+    if (!drm_renderer) {
+      std::cerr << "failed to create DRM renderer" << std::endl;
+      return 1;
+    }
+    receiver = drm_renderer.get();
+  }
+#endif
+
+  std::unique_ptr<RTCManager> rtc_manager;
+  if (cs.fast_startup) {
+    // カメラを開いている間に PeerConnectionFactory を作る
+    rtc_manager.reset(new RTCManager(cs, receiver, rtc_threads_));
+  }
+
+  // 追加のカメラは別のトラックとして送信する
+  std::vector<std::string> video_devices = {cs.video_device};
+  video_devices.insert(video_devices.end(), cs.additional_video_devices.begin(),
+                       cs.additional_video_devices.end());
+  // --fast-startup の場合は全てのカメラを並行して開く
+  std::vector<std::future<rtc::scoped_refptr<ScalableVideoTrackSource>>>
+      capturer_futures;
+  for (size_t i = 0; i < video_devices.size(); i++) {
+    ConnectionSettings camera_cs = cs;
+    camera_cs.video_device = video_devices[i];
+    // ファイルやパターン、共有メモリ、画面は最初のトラックだけに使う
+    if (i > 0) {
+      camera_cs.video_file.clear();
+      camera_cs.video_pattern.clear();
+      camera_cs.video_shm.clear();
+      camera_cs.screen_capture = false;
+    }
+    camera_cs.capture_cpu = i < cs.capture_cpus.size() ? cs.capture_cpus[i] : -1;
+    capturer_futures.push_back(std::async(
+        cs.fast_startup ? std::launch::async : std::launch::deferred,
+        create_capturer, camera_cs));
+  }
+  std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> capturers;
+  for (size_t i = 0; i < video_devices.size(); i++) {
+    auto capturer = capturer_futures[i].get();
+    if (!capturer && !cs.no_video_device && !cs.recv_only) {
+      std::cerr << "failed to create capturer";
+      if (i > 0) {
+        std::cerr << ": " << video_devices[i];
+      }
+      std::cerr << std::endl;
+      return 1;
+    }
+    capturers.push_back(capturer);
+  }
+  // 合成する場合は 1 つのトラックにまとめて、エンコーダを 1 つで済ませる
+  CompositorVideoTrackSource::Layout layout;
+  if (capturers.size() > 1 && capturers[0] &&
+      CompositorVideoTrackSource::ParseLayout(cs.compositor, &layout)) {
+    auto size = cs.getSize();
+    auto compositor = CompositorVideoTrackSource::Create(
+        capturers, layout, size.width, size.height);
+    if (!compositor) {
+      std::cerr << "failed to create compositor" << std::endl;
+      return 1;
+    }
+    capturers = {compositor};
+  }
+  StartupTimer::Instance().Mark("capturers_opened");
+
+  if (rtc_manager) {
+    rtc_manager->setVideoTrackSources(std::move(capturers));
+  } else {
+    rtc_manager.reset(
+        new RTCManager(cs, std::move(capturers), receiver, rtc_threads_));
+  }
+
+  {
+    boost::asio::io_context ioc{1};
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ioc_ = &ioc;
+      if (stopped_) {
+        ioc.stop();
+      }
+    }
+    // --io-threads が 2 以上の場合は、シリアルやソケットの入出力を data_ioc で、
+    // HTTP のサーバーを server_ioc で回して、大量のデータや遅いクライアントで
+    // シグナリングや SDL のイベントが待たされないようにする。
+    // シグナリングのクライアントやタイマーは 1 スレッドで動く前提で書かれているので、
+    // ioc 自体は 1 スレッドのままにする。server_ioc の各接続は strand で処理される
+    std::unique_ptr<boost::asio::io_context> data_ioc;
+    std::unique_ptr<boost::asio::io_context> server_ioc;
+    if (cs.io_threads >= 2) {
+      data_ioc.reset(new boost::asio::io_context(1));
+      server_ioc.reset(new boost::asio::io_context(cs.io_threads - 1));
+    }
+    boost::asio::io_context& dioc = data_ioc ? *data_ioc : ioc;
+    boost::asio::io_context& sioc = server_ioc ? *server_ioc : ioc;
+
+    // LatencyController と BitrateCache も StatsSampler が取得した値を使う
+    StatsSampler::Settings stats_settings;
+    stats_settings.interval_ms = cs.stats_interval_ms;
+    if (stats_settings.interval_ms <= 0 &&
+        (cs.latency_target_ms > 0 || !cs.bitrate_cache.empty())) {
+      stats_settings.interval_ms = 1000;
+    }
+    stats_settings.max_samples = cs.stats_history;
+    stats_settings.log = cs.stats_log;
+    std::shared_ptr<StatsSampler> stats_sampler =
+        StatsSampler::Create(ioc, rtc_manager.get(), stats_settings);
+    if (stats_sampler) {
+      stats_sampler->Start();
+      rtc_manager->setStatsSampler(stats_sampler);
+    }
+
+    BitrateCache::Settings bitrate_cache_settings;
+    bitrate_cache_settings.path = cs.bitrate_cache;
+    std::shared_ptr<BitrateCache> bitrate_cache =
+        BitrateCache::Create(ioc, bitrate_cache_settings);
+    if (bitrate_cache) {
+      bitrate_cache->Start(stats_sampler.get());
+      rtc_manager->setBitrateCache(bitrate_cache);
+    }
+
+    // DataChannel のラベル毎に振り分ける。ラベルを指定していないものはシリアルに繋ぐ
+    RTCDataManagerDispatcher data_manager_dispatcher;
+    std::unique_ptr<RTCDataManager> data_manager = nullptr;
+    if (!cs.serial_device.empty()) {
+      SerialFraming serial_framing = SerialFraming::kLine;
+      ParseSerialFraming(cs.serial_framing, &serial_framing);
+      data_manager = SerialDataManager::Create(dioc, cs.serial_device,
+                                               cs.serial_rate, serial_framing);
+      if (!data_manager) {
+        return 1;
+      }
+      data_manager_dispatcher.SetDefault(data_manager.get());
+    }
+    std::vector<std::unique_ptr<SocketDataManager>> socket_data_managers;
+    for (const auto& spec : cs.data_channel_sources) {
+      SocketDataManager::Source source;
+      std::string error;
+      SocketDataManager::ParseSource(spec, &source, &error);
+      SocketDataManager::Options options;
+      options.max_retransmits = cs.data_channel_max_retransmits;
+      options.ordered = cs.data_channel_ordered;
+      options.coalesce = cs.data_channel_coalesce;
+      if (!cs.data_channel_priority.empty()) {
+        options.priority =
+            ConnectionSettings::getNetworkPriority(cs.data_channel_priority);
+      }
+      auto socket_data_manager =
+          SocketDataManager::Create(dioc, std::move(source), options);
+      if (!socket_data_manager) {
+        return 1;
+      }
+      data_manager_dispatcher.Add(socket_data_manager->label(),
+                                  socket_data_manager.get());
+      socket_data_managers.push_back(std::move(socket_data_manager));
+    }
+    std::unique_ptr<ClipDataManager> clip_data_manager;
+    if (!cs.record_dir.empty() && cs.record_preroll_sec > 0) {
+      RTCManager* manager = rtc_manager.get();
+      clip_data_manager.reset(
+          new ClipDataManager([manager]() { return manager->saveClip(); }));
+      data_manager_dispatcher.Add(cs.record_clip_label,
+                                  clip_data_manager.get());
+    }
+    std::unique_ptr<RoiDataManager> roi_data_manager;
+    if (!cs.roi_label.empty()) {
+      roi_data_manager.reset(new RoiDataManager());
+      data_manager_dispatcher.Add(cs.roi_label, roi_data_manager.get());
+    }
+    std::unique_ptr<StatsDataManager> stats_data_manager;
+    if (stats_sampler && !cs.stats_label.empty()) {
+      stats_data_manager.reset(new StatsDataManager(stats_sampler));
+      data_manager_dispatcher.Add(cs.stats_label, stats_data_manager.get());
+    }
+    std::unique_ptr<SnapshotDataManager> snapshot_data_manager;
+    if (cs.snapshot && !cs.snapshot_label.empty()) {
+      RTCManager* manager = rtc_manager.get();
+      snapshot_data_manager.reset(new SnapshotDataManager(
+          [manager](std::string* jpeg) { return manager->getSnapshot(jpeg); }));
+      data_manager_dispatcher.Add(cs.snapshot_label,
+                                  snapshot_data_manager.get());
+    }
+    std::unique_ptr<FileTransferDataManager> file_transfer_data_manager;
+    if (!cs.file_transfer_root.empty()) {
+      FileTransferDataManager::Settings settings;
+      settings.root = cs.file_transfer_root;
+      settings.max_kbps = cs.file_transfer_max_kbps;
+      file_transfer_data_manager =
+          FileTransferDataManager::Create(dioc, stats_sampler, settings);
+      if (!file_transfer_data_manager) {
+        return 1;
+      }
+      data_manager_dispatcher.Add(cs.file_transfer_label,
+                                  file_transfer_data_manager.get());
+    }
+    if (!data_manager_dispatcher.empty()) {
+      rtc_manager->SetDataManager(&data_manager_dispatcher);
+    }
+
+    // nodelet として動かす場合、シグナルはホストのプロセスが扱う
+    std::unique_ptr<boost::asio::signal_set> signals;
+    if (handle_signals) {
+      signals.reset(new boost::asio::signal_set(ioc, SIGINT, SIGTERM));
+      signals->async_wait(
+          [&](const boost::system::error_code&, int) { ioc.stop(); });
+    }
+#if defined(SIGUSR1)
+    // SIGUSR1 を受け取る度にフレームの処理の記録を書き出す
+    std::unique_ptr<boost::asio::signal_set> trace_signals;
+    std::function<void()> wait_trace_signal;
+    if (handle_signals && FrameTracer::Instance().enabled()) {
+      trace_signals.reset(new boost::asio::signal_set(ioc, SIGUSR1));
+      wait_trace_signal = [&]() {
+        trace_signals->async_wait(
+            [&](const boost::system::error_code& ec, int) {
+              if (ec) {
+                return;
+              }
+              FrameTracer::Instance().WriteFile(cs.trace_file);
+              wait_trace_signal();
+            });
+      };
+      wait_trace_signal();
+    }
+#endif
+#if defined(SIGHUP)
+    // SIGHUP を受け取ったら、次の接続からルート証明書を読み込み直す
+    std::unique_ptr<boost::asio::signal_set> reload_signals;
+    std::function<void()> wait_reload_signal;
+    if (handle_signals) {
+      reload_signals.reset(new boost::asio::signal_set(ioc, SIGHUP));
+      wait_reload_signal = [&]() {
+        reload_signals->async_wait(
+            [&](const boost::system::error_code& ec, int) {
+              if (ec) {
+                return;
+              }
+              SSLVerifier::Reload();
+              wait_reload_signal();
+            });
+      };
+      wait_reload_signal();
+    }
+#endif
+
+    if (use_sora_) {
+      if (cs.sora_port >= 0) {
+        const boost::asio::ip::tcp::endpoint endpoint{
+            boost::asio::ip::make_address("127.0.0.1"),
+            static_cast<unsigned short>(cs.sora_port)};
+        std::make_shared<SoraServer>(ioc, endpoint, rtc_manager.get(), cs)
+            ->run();
+      } else {
+        std::make_shared<SoraServer>(ioc, rtc_manager.get(), cs)->run();
+      }
+    }
+
+    if (use_test_) {
+      const boost::asio::ip::tcp::endpoint endpoint{
+          boost::asio::ip::make_address("0.0.0.0"),
+          static_cast<unsigned short>(cs.test_port)};
+      std::make_shared<P2PServer>(
+          sioc, endpoint, std::make_shared<std::string>(cs.test_document_root),
+          rtc_manager.get(), cs)
+          ->run();
+    }
+
+    if (use_ayame_) {
+      std::make_shared<AyameServer>(ioc, rtc_manager.get(), cs)->run();
+    }
+
+    if (cs.metrics_port >= 0) {
+      const boost::asio::ip::tcp::endpoint endpoint{
+          boost::asio::ip::make_address("0.0.0.0"),
+          static_cast<unsigned short>(cs.metrics_port)};
+      std::make_shared<MetricsServer>(sioc, endpoint, rtc_manager.get())->run();
+    }
+
+    if (cs.rtsp_port >= 0) {
+      const boost::asio::ip::tcp::endpoint endpoint{
+          boost::asio::ip::make_address("0.0.0.0"),
+          static_cast<unsigned short>(cs.rtsp_port)};
+      std::make_shared<RtspServer>(sioc, endpoint, rtc_manager->getRtspStream())
+          ->run();
+    }
+
+    LatencyController::Settings latency_settings;
+    latency_settings.target_ms = cs.latency_target_ms;
+    latency_settings.min_bitrate_bps = cs.latency_min_bitrate * 1000;
+    latency_settings.max_bitrate_bps =
+        use_sora_ ? cs.sora_video_bitrate * 1000 : 0;
+    latency_settings.framerate = cs.framerate;
+    latency_settings.min_framerate = cs.latency_min_framerate;
+    latency_settings.degradation_preference = cs.getPriority();
+    std::shared_ptr<LatencyController> latency_controller =
+        LatencyController::Create(ioc, latency_settings);
+    if (latency_controller) {
+      latency_controller->Start(stats_sampler.get());
+    }
+
+    MediaWatchdog::Settings watchdog_settings;
+    watchdog_settings.capture_stall_ms = cs.capture_stall_ms;
+    watchdog_settings.renderer_stall_ms = cs.renderer_stall_ms;
+    std::shared_ptr<MediaWatchdog> watchdog = MediaWatchdog::Create(
+        ioc, watchdog_settings, rtc_manager->getVideoTrackSources(), receiver);
+    if (watchdog) {
+      watchdog->Start();
+    }
+
+    // このスレッドで io_context を回す。ここで設定したスレッドの CPU と優先度は、
+    // 以降にこのスレッドから作られるスレッドにも引き継がれる
+    ThreadPlacement::Instance().Apply("io");
+
+    // 接続や入出力が無い間も止まらないように、ioc が止まるまで仕事を持たせておく
+    std::vector<boost::asio::executor_work_guard<
+        boost::asio::io_context::executor_type>>
+        work_guards;
+    std::vector<std::thread> io_threads;
+    if (data_ioc) {
+      work_guards.push_back(boost::asio::make_work_guard(*data_ioc));
+      io_threads.emplace_back([&data_ioc]() {
+        ThreadPlacement::Instance().Apply("data", "MomoData");
+        data_ioc->run();
+      });
+    }
+    if (server_ioc) {
+      work_guards.push_back(boost::asio::make_work_guard(*server_ioc));
+      for (int i = 0; i < cs.io_threads - 1; i++) {
+        io_threads.emplace_back([&server_ioc]() {
+          ThreadPlacement::Instance().Apply("io", "MomoServer");
+          server_ioc->run();
+        });
+      }
+    }
+
+#if USE_SDL2
+    if (sdl_renderer) {
+      sdl_renderer->SetDispatchFunction([&ioc](std::function<void()> f) {
+        if (ioc.stopped())
+          return;
+        boost::asio::dispatch(ioc.get_executor(), f);
+      });
+
+      ioc.run();
+
+      sdl_renderer->SetDispatchFunction(nullptr);
+    } else {
+      ioc.run();
+    }
+#else
+    ioc.run();
+#endif
+
+    // DataChannel のマネージャやサーバーを破棄する前に、他の io_context のスレッドを止める
+    if (data_ioc) {
+      data_ioc->stop();
+    }
+    if (server_ioc) {
+      server_ioc->stop();
+    }
+    for (auto& thread : io_threads) {
+      thread.join();
+    }
+    work_guards.clear();
+
+    if (watchdog) {
+      watchdog->Stop();
+    }
+    // StatsSampler のタイマーは io_context を使っているので、先に手放す
+    if (stats_sampler) {
+      stats_sampler->Stop();
+      rtc_manager->setStatsSampler(nullptr);
+    }
+    if (bitrate_cache) {
+      bitrate_cache->Save();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ioc_ = nullptr;
+  }
+
+  //この順番は綺麗に落ちるけど、あまり安全ではない
+#if USE_SDL2
+  sdl_renderer = nullptr;
+#endif
+#if USE_DRM
+  drm_renderer = nullptr;
+#endif
+  rtc_manager = nullptr;
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef MOMO_APP_H_
+#define MOMO_APP_H_
+
+#include <boost/asio/io_context.hpp>
+#include <memory>
+#include <mutex>
+
+#include "connection_settings.h"
+
+class RTCThreads;
+
+// キャプチャ、RTCManager、各シグナリングを作って io_context を回す、Momo の本体。
+//
+// 実行ファイルでは main() から、ROS の nodelet ではホストのプロセスが作ったスレッドから使う。
+// ログの出力先やスレッドの配置などのプロセス全体の設定は、呼び出し側で済ませておくこと。
+class MomoApp {
+ public:
+  // rtc_threads を渡した場合は、WebRTC のスレッドを他の MomoApp と共有する
+  MomoApp(ConnectionSettings cs,
+          bool use_test,
+          bool use_ayame,
+          bool use_sora,
+          std::shared_ptr<RTCThreads> rtc_threads = nullptr);
+
+  // Stop() が呼ばれるまで処理を続ける。
+  // handle_signals が true の場合は SIGINT と SIGTERM でも終了する
+  int Run(bool handle_signals);
+  // 任意のスレッドから呼んで良い。Run() より先に呼んだ場合、Run() はすぐに戻る
+  void Stop();
+
+ private:
+  const ConnectionSettings cs_;
+  const bool use_test_;
+  const bool use_ayame_;
+  const bool use_sora_;
+  const std::shared_ptr<RTCThreads> rtc_threads_;
+
+  std::mutex mutex_;
+  // Run() 中の io_context
+  boost::asio::io_context* ioc_ = nullptr;
+  bool stopped_ = false;
+};
+
+#endif  // MOMO_APP_H_
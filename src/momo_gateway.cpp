@@ -0,0 +1,185 @@
+#include "momo_gateway.h"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <csignal>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+// WebRTC
+#include "rtc_base/logging.h"
+
+#include "momo_app.h"
+#include "rtc/manager.h"
+#include "rtc/memory_budget.h"
+#include "util.h"
+
+namespace {
+
+// シェルと同じように空白で区切る。' の中はそのまま、" の中は \ でのエスケープだけを扱う
+bool SplitArgs(const std::string& line,
+               std::vector<std::string>* args,
+               std::string* error) {
+  std::string arg;
+  bool in_arg = false;
+  char quote = 0;
+  for (size_t i = 0; i < line.size(); i++) {
+    const char c = line[i];
+    if (quote != 0) {
+      if (c == quote) {
+        quote = 0;
+      } else if (quote == '"' && c == '\\' && i + 1 < line.size()) {
+        arg += line[++i];
+      } else {
+        arg += c;
+      }
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+      in_arg = true;
+    } else if (c == '\\' && i + 1 < line.size()) {
+      arg += line[++i];
+      in_arg = true;
+    } else if (c == ' ' || c == '\t' || c == '\r') {
+      if (in_arg) {
+        args->push_back(std::move(arg));
+        arg.clear();
+        in_arg = false;
+      }
+    } else {
+      arg += c;
+      in_arg = true;
+    }
+  }
+  if (quote != 0) {
+    *error = "unterminated quote";
+    return false;
+  }
+  if (in_arg) {
+    args->push_back(std::move(arg));
+  }
+  return true;
+}
+
+}  // namespace
+
+bool MomoGateway::LoadSessions(const std::string& path,
+                               const std::string& field_trials,
+                               std::vector<Session>* sessions,
+                               std::string* error) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    *error = "failed to open " + path;
+    return false;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(ifs, line)) {
+    line_number++;
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') {
+      continue;
+    }
+    std::vector<std::string> args = {"momo"};
+    std::string split_error;
+    if (!SplitArgs(line, &args, &split_error)) {
+      *error = path + ":" + std::to_string(line_number) + ": " + split_error;
+      return false;
+    }
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    Session session;
+    int log_level = 0;
+    Util::parseArgs(static_cast<int>(args.size()), argv.data(),
+                    session.use_test, session.use_ayame, session.use_sora,
+                    log_level, session.cs);
+    if (!session.cs.gateway_config.empty()) {
+      *error = path + ":" + std::to_string(line_number) +
+               ": --gateway-config cannot be nested";
+      return false;
+    }
+    // SDL のウィンドウはメインスレッドのイベントループが要るので、セッションのスレッドでは扱えない
+    if (session.cs.use_sdl) {
+      *error = path + ":" + std::to_string(line_number) +
+               ": --use-sdl is not supported in gateway mode";
+      return false;
+    }
+    if (RTCManager::FieldTrials(session.cs) != field_trials) {
+      *error = path + ":" + std::to_string(line_number) +
+               ": field trials from --video-protection and --rtc-config must "
+               "be the same as the gateway command line";
+      return false;
+    }
+    // --memory-budget はセッション毎に見積もる
+    std::vector<std::string> memory_budget_messages;
+    MemoryBudget::Apply(&session.cs, &memory_budget_messages);
+    for (const auto& message : memory_budget_messages) {
+      RTC_LOG(LS_WARNING) << path << ":" << line_number << ": " << message;
+    }
+    sessions->push_back(std::move(session));
+  }
+  if (sessions->empty()) {
+    *error = path + ": no sessions";
+    return false;
+  }
+  return true;
+}
+
+MomoGateway::MomoGateway(std::vector<Session> sessions)
+    : sessions_(std::move(sessions)) {}
+
+int MomoGateway::Run() {
+  RTC_LOG(LS_INFO) << "MomoGateway: starting " << sessions_.size()
+                   << " sessions";
+
+  std::shared_ptr<RTCThreads> rtc_threads = RTCThreads::Create();
+  std::vector<std::unique_ptr<MomoApp>> apps;
+  for (const auto& session : sessions_) {
+    apps.emplace_back(new MomoApp(session.cs, session.use_test,
+                                  session.use_ayame, session.use_sora,
+                                  rtc_threads));
+  }
+
+  // シグナルとセッションの終了はこのスレッドで待つ
+  boost::asio::io_context ioc{1};
+  boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
+  signals.async_wait(
+      [&ioc](const boost::system::error_code&, int) { ioc.stop(); });
+
+  size_t running = apps.size();
+  int result = 0;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < apps.size(); i++) {
+    threads.emplace_back([&, i]() {
+      int ret = apps[i]->Run(false);
+      boost::asio::post(ioc, [&, i, ret]() {
+        if (ret != 0) {
+          RTC_LOG(LS_ERROR) << "MomoGateway: session " << i
+                            << " exited with " << ret;
+          result = ret;
+        }
+        if (--running == 0) {
+          ioc.stop();
+        }
+      });
+    });
+  }
+
+  ioc.run();
+
+  for (auto& app : apps) {
+    app->Stop();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // 全てのセッションの RTCManager が破棄された後で WebRTC のスレッドを止める
+  apps.clear();
+  rtc_threads = nullptr;
+  return result;
+}
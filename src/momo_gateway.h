@@ -0,0 +1,42 @@
+#ifndef MOMO_GATEWAY_H_
+#define MOMO_GATEWAY_H_
+
+#include <string>
+#include <vector>
+
+#include "connection_settings.h"
+
+// 1 つのプロセスで複数のセッション (MomoApp) を動かすゲートウェイモード。
+//
+// カメラ毎にプロセスを分ける代わりに、PeerConnectionFactory の network, worker,
+// signaling スレッドと、ログやスレッドの配置などのプロセス全体の設定を全てのセッションで共有する。
+// NVENC のセッションや CUDA のコンテキストのように、元々プロセスで共有しているものもそのまま使い回す。
+// 各セッションの io_context はこれまで通り 1 スレッドで、セッション毎にスレッドを 1 つ使う。
+class MomoGateway {
+ public:
+  struct Session {
+    ConnectionSettings cs;
+    bool use_test = false;
+    bool use_ayame = false;
+    bool use_sora = false;
+  };
+
+  // path の空行と # で始まる行以外を、1 行 1 セッションのコマンドライン引数として読む。
+  // 引数はシェルと同じように空白で区切り、' と " で囲んだ部分は 1 つの引数にする。
+  // 引数が不正な場合は、通常の起動と同じくエラーを表示して終了する。
+  // フィールドトライアルはプロセスで 1 つなので、field_trials と異なるセッションはエラーにする
+  static bool LoadSessions(const std::string& path,
+                           const std::string& field_trials,
+                           std::vector<Session>* sessions,
+                           std::string* error);
+
+  explicit MomoGateway(std::vector<Session> sessions);
+
+  // 全てのセッションが終わるか、SIGINT か SIGTERM を受け取るまで処理を続ける
+  int Run();
+
+ private:
+  const std::vector<Session> sessions_;
+};
+
+#endif  // MOMO_GATEWAY_H_
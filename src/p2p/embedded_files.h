@@ -0,0 +1,24 @@
+#ifndef P2P_EMBEDDED_FILES_H_
+#define P2P_EMBEDDED_FILES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// USE_EMBEDDED_HTML が有効な場合に、ビルド時に実行ファイルへ埋め込んだ test モードのファイル。
+// 定義は cmake/EmbedFiles.cmake が生成する。
+struct EmbeddedFile {
+  // "/html/test.html" のようなリクエストのパス
+  const char* path;
+  // 中身の MD5。ETag に使う
+  const char* md5;
+  const uint8_t* data;
+  size_t size;
+  // gzip で圧縮したもの。ビルド時に gzip が無かった場合は nullptr
+  const uint8_t* gzip_data;
+  size_t gzip_size;
+};
+
+extern const EmbeddedFile kEmbeddedFiles[];
+extern const size_t kNumEmbeddedFiles;
+
+#endif  // P2P_EMBEDDED_FILES_H_
@@ -0,0 +1,231 @@
+#include "mjpeg_stream.h"
+
+#include <algorithm>
+#include <array>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/version.hpp>
+
+// WebRTC
+#include "rtc_base/logging.h"
+
+#include "rtc/native_buffer.h"
+#include "util.h"
+
+namespace {
+
+const char kBoundary[] = "momoframe";
+
+}  // namespace
+
+std::shared_ptr<MjpegBroadcaster> MjpegBroadcaster::Create(
+    rtc::scoped_refptr<ScalableVideoTrackSource> source) {
+  if (!source) {
+    return nullptr;
+  }
+  return std::shared_ptr<MjpegBroadcaster>(new MjpegBroadcaster(source));
+}
+
+MjpegBroadcaster::MjpegBroadcaster(
+    rtc::scoped_refptr<ScalableVideoTrackSource> source)
+    : source_(source) {}
+
+MjpegBroadcaster::~MjpegBroadcaster() {
+  std::lock_guard<std::mutex> lock(sink_mutex_);
+  if (sink_added_) {
+    source_->RemoveSink(this);
+  }
+}
+
+void MjpegBroadcaster::AddSession(std::shared_ptr<MjpegStreamSession> session) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.push_back(session);
+  }
+  UpdateSink();
+}
+
+void MjpegBroadcaster::RemoveSession(MjpegStreamSession* session) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.erase(
+        std::remove_if(sessions_.begin(), sessions_.end(),
+                       [session](const std::weak_ptr<MjpegStreamSession>& s) {
+                         auto p = s.lock();
+                         return !p || p.get() == session;
+                       }),
+        sessions_.end());
+  }
+  UpdateSink();
+}
+
+void MjpegBroadcaster::UpdateSink() {
+  std::lock_guard<std::mutex> sink_lock(sink_mutex_);
+  bool has_sessions;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    has_sessions = !sessions_.empty();
+  }
+  if (has_sessions && !sink_added_) {
+    source_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+    sink_added_ = true;
+  } else if (!has_sessions && sink_added_) {
+    source_->RemoveSink(this);
+    sink_added_ = false;
+  }
+}
+
+void MjpegBroadcaster::OnFrame(const webrtc::VideoFrame& frame) {
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  NativeBuffer* native_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(buffer.get())
+          : nullptr;
+  if (native_buffer == nullptr ||
+      native_buffer->VideoType() != webrtc::VideoType::kMJPEG ||
+      native_buffer->Data() == nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!warned_not_mjpeg_) {
+      warned_not_mjpeg_ = true;
+      RTC_LOG(LS_WARNING) << "MjpegBroadcaster: the camera is not producing "
+                             "MJPEG frames (use --use-native with an MJPEG "
+                             "camera)";
+    }
+    return;
+  }
+
+  std::shared_ptr<Frame> jpeg = std::make_shared<Frame>();
+  jpeg->buffer = buffer;
+  jpeg->data = native_buffer->Data();
+  jpeg->size = native_buffer->length();
+
+  std::vector<std::shared_ptr<MjpegStreamSession>> sessions;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& s : sessions_) {
+      if (auto session = s.lock()) {
+        sessions.push_back(std::move(session));
+      }
+    }
+  }
+  for (const auto& session : sessions) {
+    session->PostFrame(jpeg);
+  }
+}
+
+MjpegStreamSession::MjpegStreamSession(
+    boost::asio::ip::tcp::socket socket,
+    std::shared_ptr<MjpegBroadcaster> broadcaster)
+    : socket_(std::move(socket)),
+      strand_(socket_.get_executor()),
+      broadcaster_(std::move(broadcaster)) {}
+
+MjpegStreamSession::~MjpegStreamSession() {
+  RTC_LOG(LS_INFO) << "MjpegStreamSession: sent " << sent_frames_
+                   << " frames, dropped " << dropped_frames_ << " frames";
+}
+
+void MjpegStreamSession::Run(unsigned int http_version) {
+  header_ = std::string(http_version == 10 ? "HTTP/1.0" : "HTTP/1.1") +
+            " 200 OK\r\n"
+            "Server: " BOOST_BEAST_VERSION_STRING
+            "\r\n"
+            "Content-Type: multipart/x-mixed-replace; boundary=" +
+            std::string(kBoundary) +
+            "\r\n"
+            "Cache-Control: no-store\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+  auto self = shared_from_this();
+  boost::asio::async_write(
+      socket_, boost::asio::buffer(header_),
+      boost::asio::bind_executor(
+          strand_, [self](boost::system::error_code ec, std::size_t) {
+            if (ec) {
+              MOMO_BOOST_ERROR(ec, "write_header");
+              return self->Close();
+            }
+            self->started_ = true;
+            self->broadcaster_->AddSession(self);
+            // クライアントが切断したことに気付けるように、読み込みを待っておく
+            auto buffer = std::make_shared<std::array<char, 256>>();
+            self->socket_.async_read_some(
+                boost::asio::buffer(*buffer),
+                boost::asio::bind_executor(
+                    self->strand_,
+                    [self, buffer](boost::system::error_code ec, std::size_t) {
+                      if (ec) {
+                        self->Close();
+                      }
+                    }));
+          }));
+}
+
+void MjpegStreamSession::PostFrame(
+    std::shared_ptr<const MjpegBroadcaster::Frame> frame) {
+  boost::asio::post(strand_,
+                    std::bind(&MjpegStreamSession::OnFrame, shared_from_this(),
+                              std::move(frame)));
+}
+
+void MjpegStreamSession::OnFrame(
+    std::shared_ptr<const MjpegBroadcaster::Frame> frame) {
+  if (!started_ || closed_) {
+    return;
+  }
+  if (writing_) {
+    if (pending_) {
+      dropped_frames_++;
+    }
+    pending_ = std::move(frame);
+    return;
+  }
+  DoWrite(std::move(frame));
+}
+
+void MjpegStreamSession::DoWrite(
+    std::shared_ptr<const MjpegBroadcaster::Frame> frame) {
+  writing_ = std::move(frame);
+  part_header_ = std::string("--") + kBoundary +
+                 "\r\n"
+                 "Content-Type: image/jpeg\r\n"
+                 "Content-Length: " +
+                 std::to_string(writing_->size) + "\r\n\r\n";
+  static const char kCrlf[] = "\r\n";
+  std::array<boost::asio::const_buffer, 3> buffers = {
+      boost::asio::buffer(part_header_),
+      boost::asio::buffer(writing_->data, writing_->size),
+      boost::asio::buffer(kCrlf, 2)};
+  boost::asio::async_write(
+      socket_, buffers,
+      boost::asio::bind_executor(
+          strand_, std::bind(&MjpegStreamSession::OnWrite, shared_from_this(),
+                             std::placeholders::_1)));
+}
+
+void MjpegStreamSession::OnWrite(boost::system::error_code ec) {
+  writing_ = nullptr;
+  if (ec) {
+    return Close();
+  }
+  sent_frames_++;
+  if (pending_ && !closed_) {
+    DoWrite(std::move(pending_));
+  }
+}
+
+void MjpegStreamSession::Close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  pending_ = nullptr;
+  broadcaster_->RemoveSession(this);
+  boost::system::error_code ec;
+  socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  socket_.close(ec);
+}
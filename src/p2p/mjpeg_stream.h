@@ -0,0 +1,106 @@
+#ifndef MJPEG_STREAM_H_
+#define MJPEG_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/system/error_code.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// WebRTC
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+
+#include "rtc/scalable_track_source.h"
+
+class MjpegStreamSession;
+
+// カメラが出した MJPEG のフレームを、デコードも再エンコードもせずに
+// 複数の HTTP クライアント (multipart/x-mixed-replace) に配るクラス。
+//
+// --use-native で MJPEG のカメラを使っている場合に、キャプチャした NativeBuffer の
+// JPEG をそのまま送る。バッファは参照を持つだけでコピーしない。
+// クライアントがいる間だけソースのシンクとして登録するので、誰も見ていなければ何もしない。
+// MJPEG ではないフレームは送らない。
+class MjpegBroadcaster : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  // 1 フレーム分の JPEG。送り終わるまでキャプチャしたバッファを保持する
+  struct Frame {
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+  };
+
+  // source が nullptr の場合は nullptr を返す
+  static std::shared_ptr<MjpegBroadcaster> Create(
+      rtc::scoped_refptr<ScalableVideoTrackSource> source);
+  ~MjpegBroadcaster() override;
+
+  void AddSession(std::shared_ptr<MjpegStreamSession> session);
+  void RemoveSession(MjpegStreamSession* session);
+
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+
+ private:
+  explicit MjpegBroadcaster(
+      rtc::scoped_refptr<ScalableVideoTrackSource> source);
+  // セッションの有無に合わせてシンクを登録、解除する
+  void UpdateSink();
+
+  rtc::scoped_refptr<ScalableVideoTrackSource> source_;
+
+  // OnFrame() は source の中のロックを持ったまま呼ばれるので、
+  // シンクの登録と解除は mutex_ を持たずに sink_mutex_ で行う
+  std::mutex sink_mutex_;
+  bool sink_added_ = false;
+
+  std::mutex mutex_;
+  std::vector<std::weak_ptr<MjpegStreamSession>> sessions_;
+  bool warned_not_mjpeg_ = false;
+};
+
+// GET /stream.mjpg を受けた HTTP の接続。
+//
+// 書き込み中に届いたフレームは最新の 1 つだけを残して捨てるので、
+// 遅いクライアントは他のクライアントやキャプチャを待たせずにフレームレートが下がる。
+class MjpegStreamSession
+    : public std::enable_shared_from_this<MjpegStreamSession> {
+ public:
+  MjpegStreamSession(boost::asio::ip::tcp::socket socket,
+                     std::shared_ptr<MjpegBroadcaster> broadcaster);
+  ~MjpegStreamSession();
+
+  // レスポンスのヘッダを書いて、フレームが届く度に送る
+  void Run(unsigned int http_version);
+  // 任意のスレッドから呼んで良い
+  void PostFrame(std::shared_ptr<const MjpegBroadcaster::Frame> frame);
+
+ private:
+  void OnFrame(std::shared_ptr<const MjpegBroadcaster::Frame> frame);
+  void DoWrite(std::shared_ptr<const MjpegBroadcaster::Frame> frame);
+  void OnWrite(boost::system::error_code ec);
+  void Close();
+
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::strand<boost::asio::ip::tcp::socket::executor_type> strand_;
+  std::shared_ptr<MjpegBroadcaster> broadcaster_;
+
+  // 以下は strand_ からのみ触る
+  bool started_ = false;
+  bool closed_ = false;
+  std::string header_;
+  std::string part_header_;
+  std::shared_ptr<const MjpegBroadcaster::Frame> writing_;
+  std::shared_ptr<const MjpegBroadcaster::Frame> pending_;
+  uint64_t sent_frames_ = 0;
+  uint64_t dropped_frames_ = 0;
+};
+
+#endif  // MJPEG_STREAM_H_
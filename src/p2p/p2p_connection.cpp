@@ -1,17 +1,21 @@
 #include "p2p_connection.h"
 
 #include <iostream>
-#include <nlohmann/json.hpp>
 
 #include "util.h"
+#include "ws/signaling_message.h"
 
-using json = nlohmann::json;
 using IceConnectionState = webrtc::PeerConnectionInterface::IceConnectionState;
 
-P2PConnection::P2PConnection(RTCManager* rtc_manager,
+P2PConnection::P2PConnection(boost::asio::io_context& ioc,
+                             RTCManager* rtc_manager,
                              ConnectionSettings conn_settings,
                              std::function<void(std::string)> send)
     : _send(send) {
+  _candidate_batcher = IceCandidateBatcher::Create(
+      ioc, conn_settings.ice_candidate_batch_ms,
+      conn_settings.ice_candidate_batch_size,
+      std::bind(&P2PConnection::sendCandidates, this, std::placeholders::_1));
   webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
   webrtc::PeerConnectionInterface::IceServers servers;
   if (!conn_settings.no_google_stun) {
@@ -20,7 +24,13 @@ P2PConnection::P2PConnection(RTCManager* rtc_manager,
     servers.push_back(ice_server);
   }
   rtc_config.servers = servers;
-  _connection = rtc_manager->createConnection(rtc_config, this);
+  _connection = rtc_manager->createConnection(rtc_config, this, "test");
+}
+
+P2PConnection::~P2PConnection() {
+  if (_candidate_batcher) {
+    _candidate_batcher->Stop();
+  }
 }
 
 void P2PConnection::onIceConnectionStateChange(IceConnectionState new_state) {
@@ -36,21 +46,45 @@ void P2PConnection::onIceCandidate(const std::string sdp_mid,
                                    const std::string sdp) {
   RTC_LOG(LS_INFO) << __FUNCTION__;
 
-  json json_cand = {{"type", "candidate"}};
-  json_cand["ice"] = {{"candidate", sdp},
-                      {"sdpMLineIndex", sdp_mlineindex},
-                      {"sdpMid", sdp_mid}};
-  std::string str_cand = json_cand.dump();
-  _send(std::move(str_cand));
+  if (_candidate_batcher) {
+    _candidate_batcher->Add(sdp_mid, sdp_mlineindex, sdp);
+    return;
+  }
+
+  _send(SignalingWriter("candidate", sdp.size() + sdp_mid.size() + 64)
+            .BeginObject("ice")
+            .Add("candidate", sdp)
+            .Add("sdpMLineIndex", sdp_mlineindex)
+            .Add("sdpMid", sdp_mid)
+            .Finish());
+}
+
+void P2PConnection::sendCandidates(
+    std::vector<IceCandidateBatcher::Candidate> candidates) {
+  // テストモードのページは candidates をまとめて受け取れるので、1 つのメッセージにする
+  size_t size = 0;
+  for (const auto& c : candidates) {
+    size += c.sdp.size() + c.sdp_mid.size() + 64;
+  }
+  SignalingWriter writer("candidates", size);
+  writer.BeginArray("candidates");
+  for (const auto& c : candidates) {
+    writer.BeginObject()
+        .Add("candidate", c.sdp)
+        .Add("sdpMLineIndex", c.sdp_mlineindex)
+        .Add("sdpMid", c.sdp_mid)
+        .End();
+  }
+  _send(writer.Finish());
 }
 
 void P2PConnection::onCreateDescription(webrtc::SdpType type,
                                         const std::string sdp) {
   RTC_LOG(LS_INFO) << __FUNCTION__;
 
-  json json_desc = {{"type", webrtc::SdpTypeToString(type)}, {"sdp", sdp}};
-  std::string str_desc = json_desc.dump();
-  _send(std::move(str_desc));
+  _send(SignalingWriter(webrtc::SdpTypeToString(type), sdp.size())
+            .Add("sdp", sdp)
+            .Finish());
 }
 
 void P2PConnection::onSetDescription(webrtc::SdpType type) {
@@ -1,20 +1,24 @@
 #ifndef P2P_CONNECTION_H_
 #define P2P_CONNECTION_H_
 
+#include <boost/asio/io_context.hpp>
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "rtc/connection.h"
 #include "rtc/manager.h"
 #include "rtc/messagesender.h"
+#include "ws/ice_candidate_batcher.h"
 
 class P2PConnection : public RTCMessageSender {
  public:
-  P2PConnection(RTCManager* rtc_manager,
+  P2PConnection(boost::asio::io_context& ioc,
+                RTCManager* rtc_manager,
                 ConnectionSettings conn_settings,
                 std::function<void(std::string)> send);
-  ~P2PConnection() {}
+  ~P2PConnection();
 
   webrtc::PeerConnectionInterface::IceConnectionState getRTCConnectionState() {
     return _rtc_state;
@@ -33,8 +37,11 @@ class P2PConnection : public RTCMessageSender {
   void onSetDescription(webrtc::SdpType type) override;
 
  private:
+  void sendCandidates(std::vector<IceCandidateBatcher::Candidate> candidates);
+
   std::shared_ptr<RTCConnection> _connection;
   std::function<void(std::string)> _send;
   webrtc::PeerConnectionInterface::IceConnectionState _rtc_state;
+  std::shared_ptr<IceCandidateBatcher> _candidate_batcher;
 };
 #endif
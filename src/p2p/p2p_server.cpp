@@ -11,7 +11,11 @@ P2PServer::P2PServer(boost::asio::io_context& ioc,
     : ioc_(ioc),
       acceptor_(ioc),
       socket_(ioc),
-      doc_root_(doc_root),
+      file_cache_(std::make_shared<StaticFileCache>(*doc_root)),
+      mjpeg_broadcaster_(
+          conn_settings.no_video_device
+              ? nullptr
+              : MjpegBroadcaster::Create(rtc_manager->getVideoTrackSource())),
       rtc_manager_(rtc_manager),
       conn_settings_(conn_settings) {
   boost::system::error_code ec;
@@ -61,7 +65,8 @@ void P2PServer::onAccept(boost::system::error_code ec) {
   if (ec) {
     MOMO_BOOST_ERROR(ec, "accept");
   } else {
-    std::make_shared<P2PSession>(ioc_, std::move(socket_), doc_root_, rtc_manager_,
+    std::make_shared<P2PSession>(ioc_, std::move(socket_), file_cache_,
+                                 mjpeg_broadcaster_, rtc_manager_,
                                  conn_settings_)
         ->run();
   }
@@ -8,14 +8,18 @@
 #include <string>
 
 #include "connection_settings.h"
+#include "mjpeg_stream.h"
 #include "rtc/manager.h"
+#include "static_file_cache.h"
 #include "util.h"
 
 class P2PServer : public std::enable_shared_from_this<P2PServer> {
   boost::asio::io_context& ioc_;
   boost::asio::ip::tcp::acceptor acceptor_;
   boost::asio::ip::tcp::socket socket_;
-  std::shared_ptr<std::string const> doc_root_;
+  std::shared_ptr<StaticFileCache> file_cache_;
+  // GET /stream.mjpg のクライアントにカメラの MJPEG を配る
+  std::shared_ptr<MjpegBroadcaster> mjpeg_broadcaster_;
 
   RTCManager* rtc_manager_;
   ConnectionSettings conn_settings_;
@@ -1,32 +1,53 @@
 #include "p2p_session.h"
 
+#include <boost/asio/post.hpp>
 #include <boost/beast/core/error.hpp>
 #include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/error.hpp>
 #include <boost/beast/http/file_body.hpp>
 #include <boost/beast/http/read.hpp>
+#include <boost/beast/http/span_body.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/beast/websocket/rfc6455.hpp>
-#include <boost/filesystem/path.hpp>
 
-#ifdef _WIN32
-#include <codecvt>
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include <algorithm>
 #endif
 
+#include "metrics/metrics_collector.h"
+#include "metrics/metrics_session.h"
+#include "rtc/encoder_metrics.h"
+#include "rtc_base/logging.h"
 #include "util.h"
 
 P2PSession::P2PSession(boost::asio::io_context& ioc,
                        boost::asio::ip::tcp::socket socket,
-                       std::shared_ptr<std::string const> const& doc_root,
+                       std::shared_ptr<StaticFileCache> file_cache,
+                       std::shared_ptr<MjpegBroadcaster> mjpeg_broadcaster,
                        RTCManager* rtc_manager,
                        ConnectionSettings conn_settings)
     : ioc_(ioc),
       socket_(std::move(socket)),
       strand_(socket_.get_executor()),
-      doc_root_(doc_root),
+      file_cache_(std::move(file_cache)),
+      mjpeg_broadcaster_(std::move(mjpeg_broadcaster)),
       rtc_manager_(rtc_manager),
       conn_settings_(conn_settings) {}
 
+P2PSession::~P2PSession() {
+#if defined(__linux__)
+  if (sendfile_fd_ >= 0) {
+    ::close(sendfile_fd_);
+  }
+#endif
+}
+
 // Start the asynchronous operation
 void P2PSession::run() {
   doRead();
@@ -69,6 +90,17 @@ void P2PSession::onRead(boost::system::error_code ec,
     }
   }
 
+  // カメラの MJPEG をそのまま流し続ける。以降この接続は MjpegStreamSession が扱う
+  if (req_.target() == "/stream.mjpg" &&
+      req_.method() == boost::beast::http::verb::get) {
+    if (!mjpeg_broadcaster_)
+      return sendResponse(Util::notFound(req_, req_.target()));
+    std::make_shared<MjpegStreamSession>(std::move(socket_),
+                                         mjpeg_broadcaster_)
+        ->Run(req_.version());
+    return;
+  }
+
   handleRequest();
 }
 
@@ -87,57 +119,187 @@ void P2PSession::handleRequest() {
       req.target().find("..") != boost::beast::string_view::npos)
     return sendResponse(Util::badRequest(req, "Illegal request-target"));
 
-  // Build the path to the requested file
-  boost::filesystem::path path =
-      boost::filesystem::path(*doc_root_) / std::string(req.target());
-
-  if (req.target().back() == '/')
-    path.append("index.html");
-
-#ifdef _WIN32
-  path.imbue(
-      std::locale(std::locale(), new std::codecvt_utf8_utf16<wchar_t>()));
-#endif
-  // Attempt to open the file
-  boost::beast::error_code ec;
-  boost::beast::http::file_body::value_type body;
-  body.open(path.string().c_str(), boost::beast::file_mode::scan, ec);
+  // エンコーダの統計情報を JSON で返す
+  if (req.target() == "/stats/encoder") {
+    boost::beast::http::response<boost::beast::http::string_body> res{
+        boost::beast::http::status::ok, req.version()};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "application/json");
+    res.keep_alive(req.keep_alive());
+    res.body() = EncoderMetricsRegistry::Instance().ToJson().dump();
+    res.prepare_payload();
+    return sendResponse(std::move(res));
+  }
 
-  // Handle the case where the file doesn't exist
-  if (ec == boost::system::errc::no_such_file_or_directory)
-    return sendResponse(Util::notFound(req, req.target()));
+  // Prometheus 形式のメトリクスを返す
+  if (req.target() == "/metrics") {
+    auto self = shared_from_this();
+    auto sp = std::make_shared<
+        boost::beast::http::request<boost::beast::http::string_body>>(
+        std::move(req));
+    MetricsCollector::Collect(rtc_manager_, [self, sp](std::string body) {
+      boost::asio::post(self->strand_, [self, sp, body]() {
+        self->sendResponse(MetricsSession::createResponse(*sp, body));
+      });
+    });
+    return;
+  }
 
-  // Handle an unknown error
-  if (ec)
+  // 静的ファイル
+  StaticFileCache::File file;
+  boost::system::error_code ec;
+  if (!file_cache_->Lookup(req.target(),
+                           req[boost::beast::http::field::accept_encoding],
+                           &file, ec)) {
+    // Handle the case where the file doesn't exist
+    if (ec == boost::system::errc::no_such_file_or_directory)
+      return sendResponse(Util::notFound(req, req.target()));
+    // Handle an unknown error
     return sendResponse(Util::serverError(req, ec.message()));
+  }
 
-  // Cache the size since we need it after the move
-  auto const size = body.size();
+  // 条件付き GET で変更が無い場合
+  if (StaticFileCache::NotModified(
+          file, req[boost::beast::http::field::if_none_match],
+          req[boost::beast::http::field::if_modified_since])) {
+    boost::beast::http::response<boost::beast::http::empty_body> res{
+        boost::beast::http::status::not_modified, req.version()};
+    setFileHeaders(res, file, req.keep_alive());
+    return sendResponse(std::move(res));
+  }
 
   // HEAD リクエスト
   if (req.method() == boost::beast::http::verb::head) {
     boost::beast::http::response<boost::beast::http::empty_body> res{
         boost::beast::http::status::ok, req.version()};
-    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(boost::beast::http::field::content_type,
-            Util::mimeType(path.string()));
-    res.content_length(size);
-    res.keep_alive(req.keep_alive());
+    setFileHeaders(res, file, req.keep_alive());
+    res.content_length(file.size);
+    return sendResponse(std::move(res));
+  }
+
+  // GET リクエストで、キャッシュしている場合はコピーせずにそのまま書き込む
+  if (file.body) {
+    boost::beast::http::response<boost::beast::http::span_body<char const>>
+        res{boost::beast::http::status::ok, req.version()};
+    setFileHeaders(res, file, req.keep_alive());
+    res.body() = boost::beast::span<char const>(file.body->data(),
+                                                file.body->size());
+    res.content_length(file.size);
+    // 書き込みが終わるまで中身を保持しておく
+    body_ = file.body;
     return sendResponse(std::move(res));
   }
 
-  // GET リクエスト
+#if defined(__linux__)
+  // 大きいファイルは sendfile で書き込む
+  {
+    boost::beast::http::response<boost::beast::http::empty_body> res{
+        boost::beast::http::status::ok, req.version()};
+    setFileHeaders(res, file, req.keep_alive());
+    res.content_length(file.size);
+    return sendFile(std::move(res), file.path, file.size);
+  }
+#else
+  boost::beast::http::file_body::value_type body;
+  body.open(file.path.c_str(), boost::beast::file_mode::scan, ec);
+  if (ec)
+    return sendResponse(Util::serverError(req, ec.message()));
+
   boost::beast::http::response<boost::beast::http::file_body> res{
       std::piecewise_construct, std::make_tuple(std::move(body)),
       std::make_tuple(boost::beast::http::status::ok, req.version())};
-  res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
-  res.set(boost::beast::http::field::content_type,
-          Util::mimeType(path.string()));
-  res.content_length(size);
-  res.keep_alive(req.keep_alive());
+  setFileHeaders(res, file, req.keep_alive());
+  res.content_length(file.size);
   return sendResponse(std::move(res));
+#endif
+}
+
+#if defined(__linux__)
+void P2PSession::sendFile(
+    boost::beast::http::response<boost::beast::http::empty_body> res,
+    const std::string& path,
+    uint64_t size) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << path << ": " << strerror(errno);
+    return doClose();
+  }
+  sendfile_fd_ = fd;
+  sendfile_offset_ = 0;
+  sendfile_size_ = size;
+
+  auto sp = std::make_shared<
+      boost::beast::http::response<boost::beast::http::empty_body>>(
+      std::move(res));
+  auto sr = std::make_shared<
+      boost::beast::http::response_serializer<boost::beast::http::empty_body>>(
+      *sp);
+  res_ = sp;
+  const bool close = sp->need_eof();
+  auto self = shared_from_this();
+  // ヘッダだけ Beast で書いて、本体はカーネルにソケットへ直接コピーさせる
+  boost::beast::http::async_write_header(
+      socket_, *sr,
+      boost::asio::bind_executor(
+          strand_, [self, sp, sr, close](boost::system::error_code ec,
+                                         std::size_t) {
+            if (ec) {
+              self->closeSendFile();
+              return MOMO_BOOST_ERROR(ec, "write_header");
+            }
+            self->doSendFile(close);
+          }));
 }
 
+void P2PSession::doSendFile(bool close) {
+  socket_.native_non_blocking(true);
+  while (sendfile_offset_ < sendfile_size_) {
+    const size_t count = static_cast<size_t>(
+        std::min<uint64_t>(sendfile_size_ - sendfile_offset_, 1 << 30));
+    ssize_t n = ::sendfile(socket_.native_handle(), sendfile_fd_,
+                           &sendfile_offset_, count);
+    if (n > 0) {
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // 送信バッファが空くまで待つ
+      auto self = shared_from_this();
+      socket_.async_wait(
+          boost::asio::ip::tcp::socket::wait_write,
+          boost::asio::bind_executor(
+              strand_, [self, close](boost::system::error_code ec) {
+                if (ec) {
+                  self->closeSendFile();
+                  return MOMO_BOOST_ERROR(ec, "wait_write");
+                }
+                self->doSendFile(close);
+              }));
+      return;
+    }
+    // 途中でファイルが短くなった場合も、Content-Length を満たせないので切断する
+    RTC_LOG(LS_ERROR) << "sendfile failed: "
+                      << (n < 0 ? strerror(errno) : "unexpected end of file");
+    closeSendFile();
+    return doClose();
+  }
+  const std::size_t bytes_transferred = sendfile_offset_;
+  closeSendFile();
+  onWrite(boost::system::error_code(), bytes_transferred, close);
+}
+
+void P2PSession::closeSendFile() {
+  if (sendfile_fd_ >= 0) {
+    ::close(sendfile_fd_);
+    sendfile_fd_ = -1;
+  }
+  boost::system::error_code ec;
+  socket_.native_non_blocking(false, ec);
+}
+#endif
+
 void P2PSession::onWrite(boost::system::error_code ec,
                          std::size_t bytes_transferred,
                          bool close) {
@@ -150,6 +312,7 @@ void P2PSession::onWrite(boost::system::error_code ec,
     return doClose();
 
   res_ = nullptr;
+  body_ = nullptr;
 
   doRead();
 }
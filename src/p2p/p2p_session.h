@@ -1,21 +1,30 @@
 #ifndef P2P_SESSION_H_
 #define P2P_SESSION_H_
 
+#if defined(__linux__)
+#include <sys/types.h>
+#endif
+
 #include <boost/asio/bind_executor.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/message.hpp>
 #include <boost/beast/http/string_body.hpp>
 #include <boost/beast/http/write.hpp>
+#include <boost/beast/version.hpp>
+#include <cstdint>
 #include <cstdlib>
 #include <functional>
 #include <memory>
 #include <string>
 
 #include "connection_settings.h"
+#include "mjpeg_stream.h"
 #include "p2p_websocket_session.h"
 #include "rtc/manager.h"
+#include "static_file_cache.h"
 #include "util.h"
 
 // 1つの HTTP リクエストを処理するためのクラス
@@ -24,9 +33,18 @@ class P2PSession : public std::enable_shared_from_this<P2PSession> {
   boost::asio::ip::tcp::socket socket_;
   boost::asio::strand<boost::asio::ip::tcp::socket::executor_type> strand_;
   boost::beast::flat_buffer buffer_;
-  std::shared_ptr<std::string const> doc_root_;
+  std::shared_ptr<StaticFileCache> file_cache_;
+  std::shared_ptr<MjpegBroadcaster> mjpeg_broadcaster_;
   boost::beast::http::request<boost::beast::http::string_body> req_;
   std::shared_ptr<void> res_;
+  // キャッシュしているファイルを書き込んでいる間、その中身を保持しておく
+  std::shared_ptr<const std::string> body_;
+#if defined(__linux__)
+  // sendfile で書き込んでいるファイル
+  int sendfile_fd_ = -1;
+  off_t sendfile_offset_ = 0;
+  uint64_t sendfile_size_ = 0;
+#endif
 
   RTCManager* rtc_manager_;
   ConnectionSettings conn_settings_;
@@ -34,9 +52,11 @@ class P2PSession : public std::enable_shared_from_this<P2PSession> {
  public:
   P2PSession(boost::asio::io_context& ioc,
              boost::asio::ip::tcp::socket socket,
-             std::shared_ptr<std::string const> const& doc_root,
+             std::shared_ptr<StaticFileCache> file_cache,
+             std::shared_ptr<MjpegBroadcaster> mjpeg_broadcaster,
              RTCManager* rtc_manager,
              ConnectionSettings conn_settings);
+  ~P2PSession();
 
   void run();
 
@@ -46,6 +66,28 @@ class P2PSession : public std::enable_shared_from_this<P2PSession> {
 
   void handleRequest();
 
+  // 静的ファイルのレスポンスに共通のヘッダを設定する
+  template <class Body>
+  void setFileHeaders(boost::beast::http::response<Body>& res,
+                      const StaticFileCache::File& file,
+                      bool keep_alive) {
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, file.content_type);
+    res.set(boost::beast::http::field::etag, file.etag);
+    // 埋め込んだファイルには更新日時が無い
+    if (!file.last_modified.empty()) {
+      res.set(boost::beast::http::field::last_modified, file.last_modified);
+    }
+    // 毎回 ETag で再検証させて、変わっていなければ 304 を返す
+    res.set(boost::beast::http::field::cache_control, "no-cache");
+    res.set(boost::beast::http::field::vary, "Accept-Encoding");
+    if (file.encoding != StaticFileCache::Encoding::kIdentity) {
+      res.set(boost::beast::http::field::content_encoding,
+              StaticFileCache::EncodingName(file.encoding));
+    }
+    res.keep_alive(keep_alive);
+  }
+
   template <class Body, class Fields>
   void sendResponse(boost::beast::http::response<Body, Fields> msg) {
     auto sp = std::make_shared<boost::beast::http::response<Body, Fields>>(
@@ -68,6 +110,16 @@ class P2PSession : public std::enable_shared_from_this<P2PSession> {
                std::size_t bytes_transferred,
                bool close);
   void doClose();
+
+#if defined(__linux__)
+  // ヘッダを書き込んだ後、path の中身を sendfile でソケットに書き込む
+  void sendFile(
+      boost::beast::http::response<boost::beast::http::empty_body> res,
+      const std::string& path,
+      uint64_t size);
+  void doSendFile(bool close);
+  void closeSendFile();
+#endif
 };
 
 #endif  // P2P_SESSION_H_
@@ -6,13 +6,16 @@
 #include <nlohmann/json.hpp>
 
 #include "util.h"
+#include "ws/signaling_message.h"
 
 using json = nlohmann::json;
 
 P2PWebsocketSession::P2PWebsocketSession(boost::asio::io_context& ioc,
                                          RTCManager* rtc_manager,
                                          ConnectionSettings conn_settings)
-    : rtc_manager_(rtc_manager), conn_settings_(conn_settings),
+    : ioc_(ioc),
+      rtc_manager_(rtc_manager),
+      conn_settings_(conn_settings),
       watchdog_(ioc,
                 std::bind(&P2PWebsocketSession::onWatchdogExpired, this)) {
   RTC_LOG(LS_INFO) << __FUNCTION__;
@@ -39,10 +42,7 @@ void P2PWebsocketSession::run(
 }
 
 void P2PWebsocketSession::onWatchdogExpired() {
-    json ping_message = {
-        {"type", "ping"},
-    };
-    ws_->sendText(std::move(ping_message.dump()));
+    ws_->sendText(R"({"type":"ping"})");
     watchdog_.reset();
 }
 
@@ -82,22 +82,15 @@ void P2PWebsocketSession::onRead(boost::system::error_code ec,
   if (ec)
     return MOMO_BOOST_ERROR(ec, "Read");
 
-  json recv_message;
-
   RTC_LOG(LS_INFO) << __FUNCTION__ << ": recv_string=" << recv_string;
 
-  try {
-    recv_message = json::parse(recv_string);
-  } catch (json::parse_error& e) {
-    return;
-  }
-
-  std::string type;
-  try {
-    type = recv_message["type"].get<std::string>();
-  } catch (json::type_error& e) {
+  // candidate と pong は DOM を作らずに必要な値だけを取り出す
+  SignalingMessage message;
+  if (!message.Parse(recv_string, {"candidate", "pong"})) {
     return;
   }
+  const std::string& type = message.type();
+  json& recv_message = message.json();
 
   if (type == "offer") {
     std::string sdp;
@@ -110,7 +103,8 @@ void P2PWebsocketSession::onRead(boost::system::error_code ec,
     auto send = std::bind([](P2PWebsocketSession* session,
                              std::string str) { session->ws_->sendText(str); },
                           this, std::placeholders::_1);
-    connection_ = std::make_shared<P2PConnection>(rtc_manager_, conn_settings_, send);
+    connection_ = std::make_shared<P2PConnection>(ioc_, rtc_manager_,
+                                                  conn_settings_, send);
     std::shared_ptr<RTCConnection> rtc_conn = connection_->getRTCConnection();
     rtc_conn->setOffer(sdp);
   } else if (type == "answer") {
@@ -133,24 +127,32 @@ void P2PWebsocketSession::onRead(boost::system::error_code ec,
     }
     int sdp_mlineindex = 0;
     std::string sdp_mid, candidate;
-    try {
-      json ice = recv_message["ice"];
-      sdp_mid = ice["sdpMid"].get<std::string>();
-      sdp_mlineindex = ice["sdpMLineIndex"].get<int>();
-      candidate = ice["candidate"].get<std::string>();
-    } catch (json::type_error& e) {
+    if (!message.GetString("ice.sdpMid", &sdp_mid) ||
+        !message.GetInt("ice.sdpMLineIndex", &sdp_mlineindex) ||
+        !message.GetString("ice.candidate", &candidate)) {
       return;
     }
     std::shared_ptr<RTCConnection> rtc_conn = p2p_conn->getRTCConnection();
     rtc_conn->addIceCandidate(sdp_mid, sdp_mlineindex, candidate);
+  } else if (type == "candidates") {
+    std::shared_ptr<P2PConnection> p2p_conn = connection_;
+    if (!p2p_conn) {
+      return;
+    }
+    std::shared_ptr<RTCConnection> rtc_conn = p2p_conn->getRTCConnection();
+    try {
+      for (const auto& ice : recv_message["candidates"]) {
+        rtc_conn->addIceCandidate(ice["sdpMid"].get<std::string>(),
+                                  ice["sdpMLineIndex"].get<int>(),
+                                  ice["candidate"].get<std::string>());
+      }
+    } catch (json::type_error& e) {
+      return;
+    }
   } else if (type == "close" || type == "bye") {
     connection_ = nullptr;
   } else if (type == "register") {
-    json accept_message = {
-        {"type", "accept"},
-        {"isExistUser", true},
-    };
-    ws_->sendText(std::move(accept_message.dump()));
+    ws_->sendText(R"({"type":"accept","isExistUser":true})");
     watchdog_.enable(30);
   } else {
     return;
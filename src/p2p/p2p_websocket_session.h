@@ -19,6 +19,7 @@
 
 class P2PWebsocketSession
     : public std::enable_shared_from_this<P2PWebsocketSession> {
+  boost::asio::io_context& ioc_;
   std::unique_ptr<Websocket> ws_;
   boost::beast::multi_buffer sending_buffer_;
 
@@ -0,0 +1,275 @@
+#include "static_file_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <iterator>
+
+#ifdef _WIN32
+#include <codecvt>
+#include <locale>
+#endif
+
+#include "util.h"
+
+#if USE_EMBEDDED_HTML
+#include "embedded_files.h"
+#endif
+
+namespace {
+
+// "gzip;q=0.5, br" のようなヘッダの各要素を、前後の空白を除いて返す
+template <class F>
+void ForEachToken(boost::beast::string_view header, F f) {
+  while (!header.empty()) {
+    auto pos = header.find(',');
+    std::string token(header.substr(0, pos));
+    boost::algorithm::trim(token);
+    if (!token.empty()) {
+      f(token);
+    }
+    if (pos == boost::beast::string_view::npos) {
+      break;
+    }
+    header.remove_prefix(pos + 1);
+  }
+}
+
+bool AcceptsEncoding(boost::beast::string_view accept_encoding,
+                     boost::beast::string_view name) {
+  bool accepted = false;
+  ForEachToken(accept_encoding, [&](const std::string& token) {
+    auto pos = token.find(';');
+    std::string coding = token.substr(0, pos);
+    boost::algorithm::trim(coding);
+    if (!boost::beast::iequals(coding, name)) {
+      return;
+    }
+    // q=0 は明示的に拒否している
+    if (pos != std::string::npos) {
+      std::string param = token.substr(pos + 1);
+      boost::algorithm::trim(param);
+      if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') &&
+          param[1] == '=' && atof(param.c_str() + 2) <= 0.0) {
+        return;
+      }
+    }
+    accepted = true;
+  });
+  return accepted;
+}
+
+std::string HttpDate(time_t t) {
+  struct tm tm;
+#ifdef _WIN32
+  gmtime_s(&tm, &t);
+#else
+  gmtime_r(&t, &tm);
+#endif
+  char buf[64];
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buf;
+}
+
+}  // namespace
+
+StaticFileCache::StaticFileCache(std::string doc_root,
+                                 uint64_t max_file_size,
+                                 uint64_t max_total_size)
+    : doc_root_(std::move(doc_root)),
+      max_file_size_(max_file_size),
+      max_total_size_(max_total_size) {
+#ifdef _WIN32
+  boost::filesystem::path::imbue(
+      std::locale(std::locale(), new std::codecvt_utf8_utf16<wchar_t>()));
+#endif
+
+#if USE_EMBEDDED_HTML
+  // 埋め込んだデータは変わらないので、ここで 1 回だけ File を作っておく
+  for (size_t i = 0; i < kNumEmbeddedFiles; i++) {
+    const EmbeddedFile& f = kEmbeddedFiles[i];
+    EmbeddedEntry& entry = embedded_[f.path];
+    entry.identity.path = f.path;
+    entry.identity.content_type = std::string(Util::mimeType(f.path));
+    entry.identity.size = f.size;
+    entry.identity.etag = "\"" + std::string(f.md5) + "\"";
+    entry.identity.body = std::make_shared<const std::string>(
+        reinterpret_cast<const char*>(f.data), f.size);
+    if (f.gzip_data != nullptr) {
+      entry.gzip = entry.identity;
+      entry.gzip.encoding = Encoding::kGzip;
+      entry.gzip.size = f.gzip_size;
+      entry.gzip.etag = "\"" + std::string(f.md5) + "-gzip\"";
+      entry.gzip.body = std::make_shared<const std::string>(
+          reinterpret_cast<const char*>(f.gzip_data), f.gzip_size);
+    }
+  }
+#endif
+}
+
+bool StaticFileCache::Lookup(boost::beast::string_view target,
+                             boost::beast::string_view accept_encoding,
+                             File* file,
+                             boost::system::error_code& ec) {
+  auto it = embedded_.find(std::string(target));
+  if (it != embedded_.end()) {
+    const EmbeddedEntry& entry = it->second;
+    *file = entry.gzip.body && AcceptsEncoding(accept_encoding, "gzip")
+                ? entry.gzip
+                : entry.identity;
+    return true;
+  }
+
+  boost::filesystem::path path =
+      boost::filesystem::path(doc_root_) / std::string(target);
+  if (!target.empty() && target.back() == '/') {
+    path.append("index.html");
+  }
+  const std::string original = path.string();
+
+  uint64_t size = 0;
+  time_t mtime = 0;
+  if (!Stat(original, &size, &mtime, ec)) {
+    return false;
+  }
+  file->path = original;
+  file->content_type = std::string(Util::mimeType(original));
+  file->encoding = Encoding::kIdentity;
+
+  // 圧縮済みのファイルがあればそちらを使う。元のファイルより古いものは使わない
+  const std::pair<Encoding, const char*> variants[] = {
+      {Encoding::kBrotli, ".br"}, {Encoding::kGzip, ".gz"}};
+  for (const auto& variant : variants) {
+    if (!AcceptsEncoding(accept_encoding, EncodingName(variant.first))) {
+      continue;
+    }
+    const std::string compressed = original + variant.second;
+    uint64_t compressed_size = 0;
+    time_t compressed_mtime = 0;
+    boost::system::error_code compressed_ec;
+    if (Stat(compressed, &compressed_size, &compressed_mtime, compressed_ec) &&
+        compressed_mtime >= mtime) {
+      file->path = compressed;
+      file->encoding = variant.first;
+      size = compressed_size;
+      mtime = compressed_mtime;
+      break;
+    }
+  }
+
+  char etag[48];
+  snprintf(etag, sizeof(etag), "%llx-%llx",
+           static_cast<unsigned long long>(size),
+           static_cast<unsigned long long>(mtime));
+  file->etag = "\"" + std::string(etag);
+  if (file->encoding != Encoding::kIdentity) {
+    file->etag += "-" + std::string(EncodingName(file->encoding));
+  }
+  file->etag += "\"";
+  file->last_modified = HttpDate(mtime);
+  file->body = Load(file->path, size, mtime);
+  file->size = file->body ? file->body->size() : size;
+  return true;
+}
+
+bool StaticFileCache::NotModified(const File& file,
+                                  boost::beast::string_view if_none_match,
+                                  boost::beast::string_view if_modified_since) {
+  // If-None-Match がある場合は If-Modified-Since を見ない
+  if (!if_none_match.empty()) {
+    bool matched = false;
+    ForEachToken(if_none_match, [&](const std::string& token) {
+      // 弱い比較で良いので W/ は無視する
+      boost::beast::string_view tag = token;
+      if (tag.starts_with("W/")) {
+        tag.remove_prefix(2);
+      }
+      if (tag == "*" || tag == file.etag) {
+        matched = true;
+      }
+    });
+    return matched;
+  }
+  return !if_modified_since.empty() && if_modified_since == file.last_modified;
+}
+
+boost::beast::string_view StaticFileCache::EncodingName(Encoding encoding) {
+  switch (encoding) {
+    case Encoding::kGzip:
+      return "gzip";
+    case Encoding::kBrotli:
+      return "br";
+    default:
+      return "identity";
+  }
+}
+
+bool StaticFileCache::Stat(const std::string& path,
+                           uint64_t* size,
+                           time_t* mtime,
+                           boost::system::error_code& ec) {
+  boost::filesystem::path p(path);
+  boost::filesystem::file_status status = boost::filesystem::status(p, ec);
+  // ディレクトリなども無いものとして扱う
+  if (status.type() == boost::filesystem::file_not_found ||
+      (!ec && !boost::filesystem::is_regular_file(status))) {
+    ec = boost::system::errc::make_error_code(
+        boost::system::errc::no_such_file_or_directory);
+  }
+  if (ec) {
+    return false;
+  }
+  *size = boost::filesystem::file_size(p, ec);
+  if (ec) {
+    return false;
+  }
+  *mtime = boost::filesystem::last_write_time(p, ec);
+  return !ec;
+}
+
+std::shared_ptr<const std::string> StaticFileCache::Load(
+    const std::string& path,
+    uint64_t size,
+    time_t mtime) {
+  if (size > max_file_size_) {
+    return nullptr;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+      if (it->second.size == size && it->second.mtime == mtime) {
+        return it->second.body;
+      }
+      // 更新されているので読み直す
+      total_size_ -= it->second.body->size();
+      entries_.erase(it);
+    }
+  }
+
+  boost::filesystem::ifstream ifs(boost::filesystem::path(path),
+                                  std::ios::binary);
+  if (!ifs) {
+    return nullptr;
+  }
+  std::shared_ptr<std::string> body = std::make_shared<std::string>(
+      std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  // 読んでいる間に書き換えられた場合は、キャッシュせずに次のリクエストで読み直す
+  if (body->size() != size) {
+    return body;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.count(path) == 0 && total_size_ + size <= max_total_size_) {
+    Entry& entry = entries_[path];
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.body = body;
+    total_size_ += size;
+  }
+  return body;
+}
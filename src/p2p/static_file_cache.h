@@ -0,0 +1,99 @@
+#ifndef P2P_STATIC_FILE_CACHE_H_
+#define P2P_STATIC_FILE_CACHE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <boost/beast/core/string.hpp>
+#include <boost/system/error_code.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// P2P のテストモードで配信する静的ファイルのキャッシュ。
+//
+// 小さいファイルは中身をメモリに持っておき、リクエスト毎には stat だけ行って
+// 更新されていなければそのまま返す。大きいファイルは中身を持たず、パスだけを返す。
+// クライアントが対応していれば、隣に置かれた圧縮済みのファイル
+// (webrtc.js に対する webrtc.js.br や webrtc.js.gz) を代わりに返す。
+// 圧縮済みのファイルは元のファイルより新しい場合のみ使う。
+//
+// USE_EMBEDDED_HTML でビルドした場合は、実行ファイルに埋め込んだファイルを優先して返し、
+// 埋め込まれていないファイルのみディスクから読む。
+//
+// 条件付き GET のために ETag と Last-Modified も作る。
+// If-Modified-Since は nginx と同じく Last-Modified と完全に一致する場合のみ扱う。
+// 任意のスレッドから呼び出して良い。
+class StaticFileCache {
+ public:
+  enum class Encoding { kIdentity, kGzip, kBrotli };
+
+  struct File {
+    // 実際に読むファイルのパス。圧縮済みのファイルを返す場合はそのパス
+    std::string path;
+    std::string content_type;
+    Encoding encoding = Encoding::kIdentity;
+    uint64_t size = 0;
+    std::string etag;
+    std::string last_modified;
+    // キャッシュしている場合のみ中身を持つ。nullptr の場合は path から読むこと
+    std::shared_ptr<const std::string> body;
+  };
+
+  // max_file_size より大きいファイルはキャッシュしない。
+  // キャッシュの合計が max_total_size を超える場合もキャッシュしない
+  StaticFileCache(std::string doc_root,
+                  uint64_t max_file_size = 1024 * 1024,
+                  uint64_t max_total_size = 16 * 1024 * 1024);
+
+  // target は "/" から始まる、".." を含まないリクエストのパス。
+  // accept_encoding はリクエストの Accept-Encoding ヘッダ。
+  // ファイルが無い場合は ec に no_such_file_or_directory を設定して false を返す
+  bool Lookup(boost::beast::string_view target,
+              boost::beast::string_view accept_encoding,
+              File* file,
+              boost::system::error_code& ec);
+
+  // If-None-Match と If-Modified-Since から、304 を返して良いかを判定する
+  static bool NotModified(const File& file,
+                          boost::beast::string_view if_none_match,
+                          boost::beast::string_view if_modified_since);
+
+  static boost::beast::string_view EncodingName(Encoding encoding);
+
+ private:
+  // 実行ファイルに埋め込んだファイル。USE_EMBEDDED_HTML でない場合は空
+  struct EmbeddedEntry {
+    File identity;
+    // gzip で圧縮したものが無い場合は body が nullptr
+    File gzip;
+  };
+
+  struct Entry {
+    uint64_t size = 0;
+    time_t mtime = 0;
+    std::shared_ptr<const std::string> body;
+  };
+
+  // path が普通のファイルであればサイズと更新日時を返す
+  static bool Stat(const std::string& path,
+                   uint64_t* size,
+                   time_t* mtime,
+                   boost::system::error_code& ec);
+  std::shared_ptr<const std::string> Load(const std::string& path,
+                                          uint64_t size,
+                                          time_t mtime);
+
+  const std::string doc_root_;
+  const uint64_t max_file_size_;
+  const uint64_t max_total_size_;
+
+  std::map<std::string, EmbeddedEntry> embedded_;
+
+  std::mutex mutex_;
+  uint64_t total_size_ = 0;
+  std::map<std::string, Entry> entries_;
+};
+
+#endif  // P2P_STATIC_FILE_CACHE_H_
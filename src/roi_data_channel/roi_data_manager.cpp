@@ -0,0 +1,94 @@
+#include "roi_data_manager.h"
+
+#include <algorithm>
+#include <nlohmann/json.hpp>
+
+#include "rtc_base/logging.h"
+
+class RoiDataManager::Channel : public webrtc::DataChannelObserver {
+ public:
+  Channel(RoiDataManager* manager,
+          rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+      : manager_(manager), data_channel_(data_channel) {
+    data_channel_->RegisterObserver(this);
+  }
+  ~Channel() { data_channel_->UnregisterObserver(); }
+
+  void OnStateChange() override {
+    if (data_channel_->state() == webrtc::DataChannelInterface::kClosed) {
+      RoiHints::Instance().SetRegions(std::vector<RoiRegion>(), 0);
+      manager_->OnClosed(this);
+    }
+  }
+  void OnMessage(const webrtc::DataBuffer& buffer) override {
+    std::vector<RoiRegion> regions;
+    int ttl_ms = 0;
+    std::string error;
+    if (!RoiDataManager::ParseMessage(
+            std::string(buffer.data.data<char>(), buffer.data.size()),
+            &regions, &ttl_ms, &error)) {
+      RTC_LOG(LS_WARNING) << "RoiDataManager: invalid message from "
+                          << data_channel_->label() << ": " << error;
+      return;
+    }
+    RTC_LOG(LS_VERBOSE) << "RoiDataManager: " << regions.size()
+                        << " regions, ttl_ms=" << ttl_ms;
+    RoiHints::Instance().SetRegions(std::move(regions), ttl_ms);
+  }
+  void OnBufferedAmountChange(uint64_t previous_amount) override {}
+
+ private:
+  RoiDataManager* manager_;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+};
+
+RoiDataManager::RoiDataManager() = default;
+
+RoiDataManager::~RoiDataManager() = default;
+
+void RoiDataManager::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  channels_.emplace_back(new Channel(this, data_channel));
+}
+
+bool RoiDataManager::ParseMessage(const std::string& message,
+                                  std::vector<RoiRegion>* regions,
+                                  int* ttl_ms,
+                                  std::string* error) {
+  nlohmann::json json = nlohmann::json::parse(message, nullptr, false);
+  if (json.is_discarded() || !json.is_object()) {
+    *error = "not a JSON object";
+    return false;
+  }
+  try {
+    regions->clear();
+    for (const nlohmann::json& r : json.at("regions")) {
+      RoiRegion region;
+      region.x = r.at("x").get<double>();
+      region.y = r.at("y").get<double>();
+      region.width = r.at("width").get<double>();
+      region.height = r.at("height").get<double>();
+      region.qp_delta = r.at("qp_delta").get<int>();
+      regions->push_back(region);
+    }
+    *ttl_ms = json.value("ttl_ms", 0);
+  } catch (const nlohmann::json::exception& e) {
+    *error = e.what();
+    return false;
+  }
+  return true;
+}
+
+void RoiDataManager::OnClosed(Channel* channel) {
+  // ロックを外してから Channel を破棄する
+  std::unique_ptr<Channel> closed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(
+      channels_.begin(), channels_.end(),
+      [channel](const std::unique_ptr<Channel>& c) { return c.get() == channel; });
+  if (it != channels_.end()) {
+    closed = std::move(*it);
+    channels_.erase(it);
+  }
+}
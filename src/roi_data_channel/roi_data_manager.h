@@ -0,0 +1,40 @@
+#ifndef ROI_DATA_MANAGER_H_
+#define ROI_DATA_MANAGER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rtc/data_manager.h"
+#include "rtc/roi_map.h"
+
+// 相手が作った DataChannel で画質を変えたい領域を受け取り、RoiHints に設定するクラス。
+//
+// メッセージは次の形式の JSON で、届く度に今の領域を置き換える。座標はフレームの幅と高さを 1 とした値。
+// {"regions": [{"x": 0.25, "y": 0.25, "width": 0.5, "height": 0.5, "qp_delta": -8}],
+//  "ttl_ms": 3000}
+// ttl_ms を省略した場合は次のメッセージが来るまで有効で、DataChannel が閉じると消す。
+class RoiDataManager : public RTCDataManager {
+ public:
+  RoiDataManager();
+  ~RoiDataManager();
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+
+  // 解釈できないメッセージの場合は false を返す
+  static bool ParseMessage(const std::string& message,
+                           std::vector<RoiRegion>* regions,
+                           int* ttl_ms,
+                           std::string* error);
+
+ private:
+  class Channel;
+  void OnClosed(Channel* channel);
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Channel>> channels_;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "audio_jitter_buffer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 目標値の範囲。届く間隔の最大値にこれだけの余裕を足す
+const int kMinTargetMs = 20;
+const int kMaxTargetMs = 200;
+const int kTargetMarginMs = 10;
+// 届く間隔の最大値を Push() 毎に減衰させる割合
+const double kPeakGapDecay = 0.999;
+// 取り出す速さを変える割合の上限。これくらいなら音程の変化は聞き取れない
+const double kMaxCorrection = 0.005;
+// 目標値からのずれが 100% の時に取り出す速さを変える割合
+const double kCorrectionGain = 0.01;
+// 溜まっている量を平滑化する係数
+const double kLevelSmoothing = 0.01;
+// 目標値のこの倍数を超えて溜まっている場合は、目標値まで捨てて遅延を戻す
+const size_t kMaxLevelFactor = 4;
+
+}  // namespace
+
+AudioJitterBuffer::AudioJitterBuffer(int input_rate,
+                                     int output_rate,
+                                     int channels)
+    : input_rate_(input_rate),
+      channels_(channels),
+      nominal_step_(static_cast<double>(input_rate) / output_rate),
+      capacity_(static_cast<size_t>(input_rate)),
+      samples_(new int16_t[capacity_ * channels]),
+      write_index_(0),
+      read_index_(0),
+      target_frames_(static_cast<size_t>(input_rate) * kMinTargetMs / 1000),
+      dropped_frames_(0),
+      current_(channels, 0),
+      next_(channels, 0) {}
+
+void AudioJitterBuffer::Push(const uint8_t* data, size_t size) {
+  int64_t now_us = rtc::TimeMicros();
+  if (last_push_us_ != 0) {
+    double gap_us = static_cast<double>(now_us - last_push_us_);
+    peak_gap_us_ = std::max(gap_us, peak_gap_us_ * kPeakGapDecay);
+  }
+  last_push_us_ = now_us;
+  int target_ms = static_cast<int>(peak_gap_us_ / 1000) + kTargetMarginMs;
+  target_ms = std::max(kMinTargetMs, std::min(kMaxTargetMs, target_ms));
+  target_frames_.store(static_cast<size_t>(input_rate_) * target_ms / 1000,
+                       std::memory_order_relaxed);
+
+  const size_t frame_bytes = channels_ * sizeof(int16_t);
+  std::vector<uint8_t> joined;
+  if (!partial_.empty()) {
+    // 前回の残りと繋げてからフレームに分ける
+    joined.reserve(partial_.size() + size);
+    joined.insert(joined.end(), partial_.begin(), partial_.end());
+    joined.insert(joined.end(), data, data + size);
+    partial_.clear();
+    data = joined.data();
+    size = joined.size();
+  }
+  size_t frames = size / frame_bytes;
+  partial_.assign(data + frames * frame_bytes, data + size);
+
+  size_t write_index = write_index_.load(std::memory_order_relaxed);
+  size_t read_index = read_index_.load(std::memory_order_acquire);
+  size_t space = capacity_ - (write_index - read_index);
+  if (frames > space) {
+    // 溢れた分は新しい方を捨てる。読み出し位置は Consumer 側しか動かせない
+    dropped_frames_.fetch_add(frames - space, std::memory_order_relaxed);
+    frames = space;
+  }
+  size_t offset = write_index % capacity_;
+  size_t first = std::min(frames, capacity_ - offset);
+  memcpy(samples_.get() + offset * channels_, data, first * frame_bytes);
+  memcpy(samples_.get(), data + first * frame_bytes,
+         (frames - first) * frame_bytes);
+  write_index_.store(write_index + frames, std::memory_order_release);
+}
+
+bool AudioJitterBuffer::Pop(int16_t* data, size_t frames) {
+  size_t available = Available();
+  const size_t target = target_frames_.load(std::memory_order_relaxed);
+
+  if (available > target * kMaxLevelFactor) {
+    size_t read_index = read_index_.load(std::memory_order_relaxed);
+    read_index_.store(read_index + available - target,
+                      std::memory_order_release);
+    available = target;
+    level_ = target;
+  }
+
+  if (buffering_) {
+    // 途切れた後は目標値まで溜まるのを待ってから取り出し始める
+    if (available < target) {
+      std::fill(data, data + frames * channels_, 0);
+      return false;
+    }
+    buffering_ = false;
+    level_ = available;
+  }
+
+  level_ += (available - level_) * kLevelSmoothing;
+  double error = (level_ - target) / std::max<size_t>(target, 1);
+  double correction = std::max(
+      -kMaxCorrection, std::min(kMaxCorrection, error * kCorrectionGain));
+  const double step = nominal_step_ * (1.0 + correction);
+
+  for (size_t i = 0; i < frames; i++) {
+    while (position_ >= 1.0) {
+      current_.swap(next_);
+      if (!ReadFrame(next_.data())) {
+        std::fill(data + i * channels_, data + frames * channels_, 0);
+        next_ = current_;
+        buffering_ = true;
+        underruns_++;
+        return false;
+      }
+      position_ -= 1.0;
+    }
+    for (int ch = 0; ch < channels_; ch++) {
+      double sample =
+          current_[ch] + (next_[ch] - current_[ch]) * position_;
+      data[i * channels_ + ch] = static_cast<int16_t>(std::lround(sample));
+    }
+    position_ += step;
+  }
+  return true;
+}
+
+AudioJitterBuffer::Stats AudioJitterBuffer::GetStats() const {
+  Stats stats;
+  stats.underruns = underruns_;
+  stats.dropped_frames = dropped_frames_.load(std::memory_order_relaxed);
+  stats.target_ms = static_cast<int>(
+      target_frames_.load(std::memory_order_relaxed) * 1000 / input_rate_);
+  return stats;
+}
+
+size_t AudioJitterBuffer::Available() const {
+  return write_index_.load(std::memory_order_acquire) -
+         read_index_.load(std::memory_order_relaxed);
+}
+
+bool AudioJitterBuffer::ReadFrame(int16_t* frame) {
+  size_t read_index = read_index_.load(std::memory_order_relaxed);
+  if (read_index == write_index_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  memcpy(frame, samples_.get() + (read_index % capacity_) * channels_,
+         channels_ * sizeof(int16_t));
+  read_index_.store(read_index + 1, std::memory_order_release);
+  return true;
+}
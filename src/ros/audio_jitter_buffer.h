@@ -0,0 +1,73 @@
+#ifndef ROS_AUDIO_JITTER_BUFFER_H_
+#define ROS_AUDIO_JITTER_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// ROS のトピックから届く PCM (signed 16bit little endian) を溜めておき、
+// 録音スレッドから 10 ミリ秒ずつ一定の間隔で取り出すためのバッファ。
+//
+// Push() は ROS のコールバックのスレッドから、Pop() は録音スレッドからだけ呼ぶこと
+// (Single Producer Single Consumer)。ロックは使わない。
+//
+// トピックの届く間隔のばらつきから溜めておく量 (目標値) を決め、溜まっている量が
+// 目標値から外れた場合は取り出す速さをわずかに変えて目標値に近づける。
+// 入力と出力のサンプリングレートが違う場合は線形補間でリサンプリングする。
+class AudioJitterBuffer {
+ public:
+  struct Stats {
+    // 足りなくて無音で埋めた回数
+    uint64_t underruns = 0;
+    // 溢れて捨てたフレーム数
+    uint64_t dropped_frames = 0;
+    // 現在の目標値 (ミリ秒)
+    int target_ms = 0;
+  };
+
+  AudioJitterBuffer(int input_rate, int output_rate, int channels);
+
+  // Producer 側。フレームの途中で切れている場合は次の Push() に持ち越す
+  void Push(const uint8_t* data, size_t size);
+
+  // Consumer 側。frames フレームを data に書き込む。
+  // 足りない場合は無音で埋めて false を返す
+  bool Pop(int16_t* data, size_t frames);
+
+  // Consumer 側から呼ぶこと
+  Stats GetStats() const;
+
+ private:
+  size_t Available() const;
+  bool ReadFrame(int16_t* frame);
+
+  const int input_rate_;
+  const int channels_;
+  const double nominal_step_;
+
+  // リングバッファ。インデックスはフレーム単位で増え続け、capacity_ で割った余りの位置を使う
+  const size_t capacity_;
+  std::unique_ptr<int16_t[]> samples_;
+  std::atomic<size_t> write_index_;
+  std::atomic<size_t> read_index_;
+  std::atomic<size_t> target_frames_;
+  std::atomic<uint64_t> dropped_frames_;
+
+  // Producer 側だけが触る
+  std::vector<uint8_t> partial_;
+  int64_t last_push_us_ = 0;
+  double peak_gap_us_ = 0;
+
+  // Consumer 側だけが触る
+  bool buffering_ = true;
+  double position_ = 1.0;
+  double level_ = 0;
+  std::vector<int16_t> current_;
+  std::vector<int16_t> next_;
+  uint64_t underruns_ = 0;
+};
+
+#endif  // ROS_AUDIO_JITTER_BUFFER_H_
@@ -0,0 +1,83 @@
+#include <memory>
+#include <thread>
+
+#include "connection_settings.h"
+#include "momo_app.h"
+#include "nodelet/nodelet.h"
+#include "pluginlib/class_list_macros.h"
+#include "ros/ros_log_sink.h"
+#include "rtc/parallel_scaler.h"
+#include "rtc/roi_map.h"
+#include "rtc/thread_placement.h"
+#include "rtc_base/log_sinks.h"
+#include "util.h"
+#include "ws/dns_cache.h"
+
+// Momo を nodelet として動かすためのクラス。
+//
+// 同じ nodelet manager に読み込んだカメラドライバなどが publish したメッセージは、
+// シリアライズされずに共有ポインタのまま届く。
+// パラメータやトピックのリマップは実行ファイルの場合と同じものが使える。
+class MomoNodelet : public nodelet::Nodelet {
+ public:
+  ~MomoNodelet() override {
+    if (app_) {
+      app_->Stop();
+    }
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    if (log_sink_) {
+      rtc::LogMessage::RemoveLogToStream(log_sink_.get());
+    }
+  }
+
+ private:
+  void onInit() override {
+    ConnectionSettings cs;
+    bool use_test = false;
+    bool use_ayame = false;
+    bool use_sora = false;
+    int log_level = rtc::LS_NONE;
+    if (!Util::parseROSParams(getNodeHandle(), getPrivateNodeHandle(),
+                              use_test, use_ayame, use_sora, log_level, cs)) {
+      NODELET_ERROR("invalid parameters");
+      return;
+    }
+
+    rtc::LogMessage::LogToDebug((rtc::LoggingSeverity)log_level);
+    rtc::LogMessage::LogTimestamps();
+    rtc::LogMessage::LogThreads();
+    log_sink_.reset(new ROSLogSink());
+    rtc::LogMessage::AddLogToStream(log_sink_.get(), rtc::LS_INFO);
+
+    if (!ThreadPlacement::Instance().Configure(cs.thread_placements)) {
+      NODELET_ERROR("invalid thread_placement");
+      return;
+    }
+
+    ParallelScaler::Instance().SetNumThreads(cs.scaler_threads);
+    RoiHints::Settings roi_settings;
+    roi_settings.motion = cs.roi_motion;
+    roi_settings.motion_threshold = cs.roi_motion_threshold;
+    roi_settings.motion_qp_delta = cs.roi_motion_qp_delta;
+    roi_settings.background_qp_delta = cs.roi_background_qp_delta;
+    roi_settings.hints = !cs.roi_label.empty();
+    RoiHints::Instance().Configure(roi_settings);
+    DnsCache::Instance().SetTtl(cs.dns_cache_ttl);
+
+    // onInit() はすぐに戻らないといけないので、Momo は別スレッドで動かす
+    app_.reset(new MomoApp(cs, use_test, use_ayame, use_sora));
+    thread_ = std::thread([this]() {
+      if (app_->Run(false) != 0) {
+        NODELET_ERROR("momo exited with an error");
+      }
+    });
+  }
+
+  std::unique_ptr<rtc::LogSink> log_sink_;
+  std::unique_ptr<MomoApp> app_;
+  std::thread thread_;
+};
+
+PLUGINLIB_EXPORT_CLASS(MomoNodelet, nodelet::Nodelet)
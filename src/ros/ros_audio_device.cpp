@@ -18,17 +18,17 @@ const int kPlayoutFixedSampleRate = 8000;
 const size_t kPlayoutNumChannels = 1;
 const size_t kPlayoutBufferSize =
     kPlayoutFixedSampleRate / 100 * kPlayoutNumChannels * 2;
+// audio_topic_rate が 100 で割り切れない場合に使うサンプリングレート
+const int kRecordingFallbackSampleRate = 48000;
 
 ROSAudioDevice::ROSAudioDevice(ConnectionSettings conn_settings)
     : _conn_settings(conn_settings),
       _ptrAudioBuffer(NULL),
-      _recordingBuffer(NULL),
       _playoutBuffer(NULL),
       _recordingFramesLeft(0),
       _playoutFramesLeft(0),
-      _recordingBufferSizeIn10MS(0),
+      _recordingSampleRate(0),
       _recordingFramesIn10MS(0),
-      _writtenBufferSize(0),
       _playoutFramesIn10MS(0),
       _playing(false),
       _recording(false),
@@ -168,11 +168,13 @@ int32_t ROSAudioDevice::InitRecording() {
     return -1;
   }
 
-  _recordingFramesIn10MS =
-      static_cast<size_t>(_conn_settings.audio_topic_rate / 100);
+  _recordingSampleRate = _conn_settings.audio_topic_rate % 100 == 0
+                             ? _conn_settings.audio_topic_rate
+                             : kRecordingFallbackSampleRate;
+  _recordingFramesIn10MS = static_cast<size_t>(_recordingSampleRate / 100);
 
   if (_ptrAudioBuffer) {
-    _ptrAudioBuffer->SetRecordingSampleRate(_conn_settings.audio_topic_rate);
+    _ptrAudioBuffer->SetRecordingSampleRate(_recordingSampleRate);
     _ptrAudioBuffer->SetRecordingChannels(_conn_settings.audio_topic_ch);
   }
   return 0;
@@ -238,22 +240,24 @@ int32_t ROSAudioDevice::StartRecording() {
   }
   _recording = true;
 
-  // Make sure we only create the buffer once.
-  _recordingBufferSizeIn10MS =
-      _recordingFramesIn10MS * _conn_settings.audio_topic_ch * 2;
-  if (!_recordingBuffer) {
-    _recordingBuffer = new int8_t[_recordingBufferSizeIn10MS];
-  }
+  _jitterBuffer.reset(new AudioJitterBuffer(_conn_settings.audio_topic_rate,
+                                            _recordingSampleRate,
+                                            _conn_settings.audio_topic_ch));
 
   ros::NodeHandle nh;
+  nh.setCallbackQueue(&_queue);
   _sub = nh.subscribe<audio_common_msgs::AudioData>(
       _conn_settings.audio_topic_name, 1,
       boost::bind(&ROSAudioDevice::RecROSCallback, this, _1));
 
-  _writtenBufferSize = 0;
-  _spinner = new ros::AsyncSpinner(1);
+  _spinner = new ros::AsyncSpinner(1, &_queue);
   _spinner->start();
 
+  _ptrThreadRec.reset(new rtc::PlatformThread(
+      RecThreadFunc, this, "webrtc_audio_module_capture_thread",
+      rtc::kRealtimePriority));
+  _ptrThreadRec->Start();
+
   RTC_LOG(LS_INFO) << __FUNCTION__ << " Started recording";
 
   return 0;
@@ -271,15 +275,20 @@ int32_t ROSAudioDevice::StopRecording() {
   if (_spinner) {
     _spinner->stop();
   }
+  if (_ptrThreadRec) {
+    _ptrThreadRec->Stop();
+    _ptrThreadRec.reset();
+  }
 
   rtc::CritScope lock(&_critSect);
   _recordingFramesLeft = 0;
-  if (_recordingBuffer) {
-    delete[] _recordingBuffer;
-    _recordingBuffer = NULL;
-  }
+  AudioJitterBuffer::Stats stats = _jitterBuffer->GetStats();
+  _jitterBuffer.reset();
 
-  RTC_LOG(LS_INFO) << __FUNCTION__ << " Stopped recording";
+  RTC_LOG(LS_INFO) << __FUNCTION__ << " Stopped recording: underruns="
+                   << stats.underruns
+                   << " dropped_frames=" << stats.dropped_frames
+                   << " target_ms=" << stats.target_ms;
   return 0;
 }
 
@@ -456,36 +465,39 @@ void ROSAudioDevice::PlayThreadProcess() {
   }
 }
 
-bool ROSAudioDevice::RecROSCallback(
-    const audio_common_msgs::AudioDataConstPtr& msg) {
-  size_t copyedDataSize = 0;
-  _critSect.Enter();
-  while (_recording && copyedDataSize != msg->data.size()) {
-    RTC_LOG(LS_VERBOSE) << "RecROSCallback _recordingBufferSizeIn10MS:"
-                        << _recordingBufferSizeIn10MS << " _writtenBufferSize"
-                        << _writtenBufferSize << " msg->data.size()"
-                        << msg->data.size() << " copyedDataSize"
-                        << copyedDataSize;
-    if (_recordingBufferSizeIn10MS - _writtenBufferSize <=
-        msg->data.size() - copyedDataSize) {
-      memcpy(_recordingBuffer + _writtenBufferSize, &msg->data[copyedDataSize],
-             _recordingBufferSizeIn10MS - _writtenBufferSize);
-      copyedDataSize += _recordingBufferSizeIn10MS - _writtenBufferSize;
-      _writtenBufferSize = 0;
-      _ptrAudioBuffer->SetRecordedBuffer(_recordingBuffer,
-                                         _recordingFramesIn10MS);
-      _critSect.Leave();
-      _ptrAudioBuffer->DeliverRecordedData();
-      webrtc::SleepMs(10);
-      _critSect.Enter();
-    } else {
-      memcpy(_recordingBuffer + _writtenBufferSize, &msg->data[copyedDataSize],
-             msg->data.size() - copyedDataSize);
-      _writtenBufferSize += msg->data.size() - copyedDataSize;
-      copyedDataSize += msg->data.size() - copyedDataSize;
+void ROSAudioDevice::RecThreadFunc(void* pThis) {
+  (static_cast<ROSAudioDevice*>(pThis)->RecThreadProcess());
+}
+
+void ROSAudioDevice::RecThreadProcess() {
+  std::vector<int16_t> buffer(_recordingFramesIn10MS *
+                              _conn_settings.audio_topic_ch);
+  // トピックの届くタイミングに関係なく、10 ミリ秒毎に一定の間隔で渡す
+  int64_t nextTime = rtc::TimeMillis();
+  while (IsRecording()) {
+    _jitterBuffer->Pop(buffer.data(), _recordingFramesIn10MS);
+    _ptrAudioBuffer->SetRecordedBuffer(buffer.data(), _recordingFramesIn10MS);
+    _ptrAudioBuffer->DeliverRecordedData();
+
+    nextTime += 10;
+    int64_t waitMillis = nextTime - rtc::TimeMillis();
+    if (waitMillis > 0) {
+      webrtc::SleepMs(static_cast<int>(waitMillis));
+    } else if (waitMillis < -100) {
+      // 大きく遅れた場合は取り戻さずに、ここから数え直す
+      nextTime = rtc::TimeMillis();
     }
   }
-  _critSect.Leave();
+}
 
+bool ROSAudioDevice::IsRecording() {
+  rtc::CritScope lock(&_critSect);
+  return _recording;
+}
+
+bool ROSAudioDevice::RecROSCallback(
+    const audio_common_msgs::AudioDataConstPtr& msg) {
+  // 録音スレッドとはロックせずに受け渡す
+  _jitterBuffer->Push(msg->data.data(), msg->data.size());
   return true;
 }
@@ -12,10 +12,13 @@
 #define ROS_AUDIO_DEVICE_H_
 
 #include <memory>
+#include <vector>
 
 #include "audio_common_msgs/AudioData.h"
+#include "audio_jitter_buffer.h"
 #include "connection_settings.h"
 #include "modules/audio_device/audio_device_generic.h"
+#include "ros/callback_queue.h"
 #include "ros/ros.h"
 #include "rtc_base/critical_section.h"
 #include "rtc_base/platform_thread.h"
@@ -120,30 +123,39 @@ class ROSAudioDevice : public webrtc::AudioDeviceGeneric {
 
  private:
   static void PlayThreadFunc(void*);
+  static void RecThreadFunc(void*);
   bool RecROSCallback(const audio_common_msgs::AudioDataConstPtr& msg);
   void PlayThreadProcess();
+  void RecThreadProcess();
+  bool IsRecording();
 
   ConnectionSettings _conn_settings;
 
   int32_t _playout_index;
   int32_t _record_index;
   webrtc::AudioDeviceBuffer* _ptrAudioBuffer;
-  int8_t* _recordingBuffer;  // In bytes.
-  int8_t* _playoutBuffer;    // In bytes.
+  int8_t* _playoutBuffer;  // In bytes.
   uint32_t _recordingFramesLeft;
   uint32_t _playoutFramesLeft;
   rtc::CriticalSection _critSect;
 
-  size_t _recordingBufferSizeIn10MS;
+  // WebRTC に渡すサンプリングレート。audio_topic_rate が 100 で割り切れない場合は
+  // 10 ミリ秒毎に渡せないのでリサンプリングする
+  int _recordingSampleRate;
   size_t _recordingFramesIn10MS;
-  size_t _writtenBufferSize;
   size_t _playoutFramesIn10MS;
 
+  // ROS のコールバックのスレッドで書き込み、録音スレッドで 10 ミリ秒ずつ取り出す
+  std::unique_ptr<AudioJitterBuffer> _jitterBuffer;
+
+  // nodelet のホストのプロセスが回している global queue とは別のキューで受け取る
+  ros::CallbackQueue _queue;
   ros::AsyncSpinner* _spinner;
   ros::Subscriber _sub;
 
   // TODO(pbos): Make plain members instead of pointers and stop resetting them.
   std::unique_ptr<rtc::PlatformThread> _ptrThreadPlay;
+  std::unique_ptr<rtc::PlatformThread> _ptrThreadRec;
 
   bool _playing;
   bool _recording;
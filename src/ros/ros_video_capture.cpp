@@ -4,12 +4,106 @@
 #include <unistd.h>
 
 #include "api/video/i420_buffer.h"
+#include "rtc/deferred_i420_buffer.h"
+#include "rtc/frame_buffer_pool.h"
+#include "rtc/latency_marker.h"
+#include "rtc/parallel_scaler.h"
 #include "rtc_base/log_sinks.h"
+#include "rtc_base/time_utils.h"
 #include "sensor_msgs/image_encodings.h"
 #include "third_party/libyuv/include/libyuv.h"
 
+namespace {
+
+// sensor_msgs::Image をコピーせずに保持し、エンコーダのスレッドで I420 に変換するバッファ
+class ROSImageBuffer : public DeferredI420Buffer {
+ public:
+  static rtc::scoped_refptr<ROSImageBuffer> Create(
+      sensor_msgs::ImageConstPtr image,
+      uint32_t fourcc,
+      int width,
+      int height) {
+    return new rtc::RefCountedObject<ROSImageBuffer>(std::move(image), fourcc,
+                                                     width, height);
+  }
+
+  rtc::scoped_refptr<DeferredI420Buffer> Scale(int width,
+                                               int height) const override {
+    return Create(image_, fourcc_, width, height);
+  }
+
+ protected:
+  ROSImageBuffer(sensor_msgs::ImageConstPtr image,
+                 uint32_t fourcc,
+                 int width,
+                 int height)
+      : DeferredI420Buffer(width, height),
+        image_(std::move(image)),
+        fourcc_(fourcc) {}
+
+  bool Convert(uint8_t* dst_y,
+               int dst_stride_y,
+               uint8_t* dst_u,
+               int dst_stride_u,
+               uint8_t* dst_v,
+               int dst_stride_v) const override {
+    const int src_width = image_->width;
+    const int src_height = image_->height;
+    if (width() == src_width && height() == src_height) {
+      // 縮小しない場合は出力先に直接変換する
+      return ConvertRaw(dst_y, dst_stride_y, dst_u, dst_stride_u, dst_v,
+                        dst_stride_v);
+    }
+    rtc::scoped_refptr<webrtc::I420Buffer> raw_buffer(
+        FrameBufferPool::Instance().CreateI420Buffer(src_width, src_height));
+    if (!ConvertRaw(raw_buffer->MutableDataY(), raw_buffer->StrideY(),
+                    raw_buffer->MutableDataU(), raw_buffer->StrideU(),
+                    raw_buffer->MutableDataV(), raw_buffer->StrideV())) {
+      return false;
+    }
+    return ParallelScaler::Instance().I420Scale(
+               raw_buffer->DataY(), raw_buffer->StrideY(), raw_buffer->DataU(),
+               raw_buffer->StrideU(), raw_buffer->DataV(),
+               raw_buffer->StrideV(), src_width, src_height, dst_y,
+               dst_stride_y, dst_u, dst_stride_u, dst_v, dst_stride_v, width(),
+               height(), libyuv::kFilterBox) == 0;
+  }
+
+ private:
+  bool ConvertRaw(uint8_t* dst_y,
+                  int dst_stride_y,
+                  uint8_t* dst_u,
+                  int dst_stride_u,
+                  uint8_t* dst_v,
+                  int dst_stride_v) const {
+    const int src_width = image_->width;
+    const int src_height = image_->height;
+    if (libyuv::ConvertToI420(image_->data.data(), image_->data.size(), dst_y,
+                              dst_stride_y, dst_u, dst_stride_u, dst_v,
+                              dst_stride_v, 0, 0, src_width, src_height,
+                              src_width, src_height, libyuv::kRotate0,
+                              fourcc_) < 0) {
+      RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
+      return false;
+    }
+    return true;
+  }
+
+  const sensor_msgs::ImageConstPtr image_;
+  const uint32_t fourcc_;
+};
+
+}  // namespace
+
 ROSVideoCapture::ROSVideoCapture(ConnectionSettings cs) {
   ros::NodeHandle nh;
+  nh.setCallbackQueue(&queue_);
+  if (cs.image_compressed && cs.mjpeg_decoder_threads > 1) {
+    mjpeg_decoder_.reset(new ParallelMJPEGDecoder(
+        cs.mjpeg_decoder_threads,
+        std::bind(&ROSVideoCapture::OnDecoded, this, std::placeholders::_1,
+                  std::placeholders::_2)));
+  }
   if (cs.image_compressed) {
     sub_ = nh.subscribe<sensor_msgs::CompressedImage>(
         cs.camera_name, 1,
@@ -20,7 +114,7 @@ ROSVideoCapture::ROSVideoCapture(ConnectionSettings cs) {
         boost::bind(&ROSVideoCapture::ROSCallbackRaw, this, _1));
   }
 
-  spinner_ = new ros::AsyncSpinner(1);
+  spinner_ = new ros::AsyncSpinner(1, &queue_);
   spinner_->start();
 }
 
@@ -30,12 +124,26 @@ ROSVideoCapture::~ROSVideoCapture() {
 
 void ROSVideoCapture::Destroy() {
   spinner_->stop();
+  mjpeg_decoder_.reset();
 }
 
 void ROSVideoCapture::ROSCallbackRaw(const sensor_msgs::ImageConstPtr& image) {
-  ROSCallback(image->header.stamp, image->data.data(), image->data.size(),
-              image->width, image->height,
-              ConvertEncodingType(image->encoding));
+  const uint32_t fourcc = ConvertEncodingType(image->encoding);
+  if (fourcc == libyuv::FOURCC_ANY) {
+    RTC_LOG(LS_ERROR) << "Unsupported encoding: " << image->encoding;
+    return;
+  }
+  // ROS のコールバックでは変換せず、メッセージを保持したまま渡す。
+  // 変換はエンコーダのスレッドで行うので、コールバックのキューが詰まらない
+  rtc::scoped_refptr<ROSImageBuffer> buffer =
+      ROSImageBuffer::Create(image, fourcc, image->width, image->height);
+  webrtc::VideoFrame captureFrame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(buffer)
+          .set_rotation(webrtc::kVideoRotation_0)
+          .set_timestamp_us((int64_t)(image->header.stamp.toNSec() / 1000))
+          .build();
+  OnCapturedFrame(captureFrame);
 }
 
 void ROSVideoCapture::ROSCallbackCompressed(
@@ -46,10 +154,25 @@ void ROSVideoCapture::ROSCallbackCompressed(
     RTC_LOG(LS_ERROR) << "MJPGSize Failed";
     return;
   }
+  if (mjpeg_decoder_) {
+    mjpeg_decoder_->Decode(image->data.data(), image->data.size(), width,
+                           height,
+                           (int64_t)(image->header.stamp.toNSec() / 1000));
+    return;
+  }
   ROSCallback(image->header.stamp, image->data.data(), image->data.size(),
               width, height, libyuv::FOURCC_MJPG);
 }
 
+uint32_t ROSVideoCapture::CaptureTimeUTCMs(int64_t timestamp_us) {
+  // シミュレーション時刻を使っている場合は受信側で遅延を計算できないので、
+  // 受け取った時刻に置き換える
+  if (ros::Time::isSimTime()) {
+    return LatencyMarker::NowMs();
+  }
+  return static_cast<uint32_t>(timestamp_us / rtc::kNumMicrosecsPerMillisec);
+}
+
 uint32_t ROSVideoCapture::ConvertEncodingType(const std::string encoding) {
   if (encoding == sensor_msgs::image_encodings::RGB8) {
     return libyuv::FOURCC_RAW;
@@ -70,8 +193,7 @@ void ROSVideoCapture::ROSCallback(ros::Time ros_time,
                                   int src_height,
                                   uint32_t fourcc) {
   rtc::scoped_refptr<webrtc::I420Buffer> dst_buffer(
-      webrtc::I420Buffer::Create(src_width, src_height));
-  dst_buffer->InitializeData();
+      FrameBufferPool::Instance().CreateI420Buffer(src_width, src_height));
 
   if (libyuv::ConvertToI420(
           sample, sample_size, dst_buffer.get()->MutableDataY(),
@@ -90,4 +212,16 @@ void ROSVideoCapture::ROSCallback(ros::Time ros_time,
           .set_timestamp_us((int64_t)(ros_time.toNSec() / 1000))
           .build();
   OnCapturedFrame(captureFrame);
-}
\ No newline at end of file
+}
+
+void ROSVideoCapture::OnDecoded(
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+    int64_t timestamp_us) {
+  webrtc::VideoFrame captureFrame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(buffer)
+          .set_rotation(webrtc::kVideoRotation_0)
+          .set_timestamp_us(timestamp_us)
+          .build();
+  OnCapturedFrame(captureFrame);
+}
@@ -1,8 +1,12 @@
 #ifndef ROS_VIDEO_CAPTURE_H_
 #define ROS_VIDEO_CAPTURE_H_
 
+#include <memory>
+
 #include "connection_settings.h"
+#include "ros/callback_queue.h"
 #include "ros/ros.h"
+#include "rtc/parallel_mjpeg_decoder.h"
 #include "rtc/scalable_track_source.h"
 #include "sensor_msgs/CompressedImage.h"
 #include "sensor_msgs/Image.h"
@@ -18,6 +22,10 @@ class ROSVideoCapture : public ScalableVideoTrackSource {
   void ROSCallbackRaw(const sensor_msgs::ImageConstPtr& image);
   void ROSCallbackCompressed(const sensor_msgs::CompressedImageConstPtr& image);
 
+ protected:
+  // ROS のタイムスタンプは rtc::TimeMicros() 基準ではなく ROS の時刻
+  uint32_t CaptureTimeUTCMs(int64_t timestamp_us) override;
+
  private:
   static uint32_t ConvertEncodingType(const std::string encoding);
   void ROSCallback(ros::Time ros_time,
@@ -26,9 +34,15 @@ class ROSVideoCapture : public ScalableVideoTrackSource {
                    int src_width,
                    int src_height,
                    uint32_t fourcc);
+  void OnDecoded(rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+                 int64_t timestamp_us);
 
+  // nodelet のホストのプロセスが回している global queue とは別のキューで受け取る
+  ros::CallbackQueue queue_;
   ros::AsyncSpinner* spinner_;
   ros::Subscriber sub_;
+  // mjpeg_decoder_threads が 2 以上の場合に、圧縮画像を並列でデコードする
+  std::unique_ptr<ParallelMJPEGDecoder> mjpeg_decoder_;
 };
 
 #endif
\ No newline at end of file
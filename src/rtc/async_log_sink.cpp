@@ -0,0 +1,103 @@
+#include "async_log_sink.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// 空の時に次に見に行くまでの時間
+const int kPollIntervalMs = 20;
+// スロットの文字列にあらかじめ確保しておく大きさ。SDP などの長いメッセージの時だけ確保し直す
+const size_t kReservedMessageSize = 256;
+
+size_t RoundUpToPowerOfTwo(size_t n) {
+  size_t size = 1;
+  while (size < n) {
+    size <<= 1;
+  }
+  return size;
+}
+
+}  // namespace
+
+AsyncLogSink::AsyncLogSink(std::unique_ptr<rtc::LogSink> sink, size_t capacity)
+    : sink_(std::move(sink)),
+      mask_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 2)) - 1),
+      slots_(new Slot[mask_ + 1]),
+      enqueue_pos_(0),
+      dropped_(0),
+      stopped_(false) {
+  for (size_t i = 0; i <= mask_; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+    slots_[i].message.reserve(kReservedMessageSize);
+  }
+  thread_ = std::thread([this]() { Run(); });
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  stopped_.store(true, std::memory_order_release);
+  thread_.join();
+}
+
+void AsyncLogSink::OnLogMessage(const std::string& message) {
+  // 複数の書き込み側が enqueue_pos_ を取り合う。読み出し側が使っているスロットに
+  // 追いついた場合は一杯なので捨てる
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots_[pos & mask_];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->message.assign(message);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void AsyncLogSink::Run() {
+  while (true) {
+    // stopped_ を見てから Flush() するので、止める前に入ったメッセージは全て書き込まれる
+    const bool stopped = stopped_.load(std::memory_order_acquire);
+    if (!Flush()) {
+      if (stopped) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(kPollIntervalMs));
+    }
+  }
+}
+
+bool AsyncLogSink::Flush() {
+  bool written = false;
+  while (true) {
+    Slot* slot = &slots_[dequeue_pos_ & mask_];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence != dequeue_pos_ + 1) {
+      break;
+    }
+    sink_->OnLogMessage(slot->message);
+    slot->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    dequeue_pos_++;
+    written = true;
+  }
+
+  const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reported_dropped_) {
+    sink_->OnLogMessage("AsyncLogSink: dropped " +
+                        std::to_string(dropped - reported_dropped_) +
+                        " messages\n");
+    reported_dropped_ = dropped;
+    written = true;
+  }
+  return written;
+}
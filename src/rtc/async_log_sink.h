@@ -0,0 +1,55 @@
+#ifndef ASYNC_LOG_SINK_H_
+#define ASYNC_LOG_SINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+// WebRTC
+#include "rtc_base/logging.h"
+
+// ログを呼び出したスレッドで書き込まず、専用のスレッドから sink に書き込む LogSink。
+//
+// メッセージは固定長のリングバッファに入れる。入れる時はロックを取らず、
+// 各スロットの文字列は使い回すので、普段の長さのメッセージでは確保も発生しない。
+// 書き込みが追いつかずリングバッファが一杯になった場合は、呼び出したスレッドを
+// 待たせずにメッセージを捨て、捨てた数を次に書き込む時にログに出力する。
+// 破棄する時は残っているメッセージを全て書き込んでからスレッドを止める。
+class AsyncLogSink : public rtc::LogSink {
+ public:
+  // capacity は 2 のべき乗に切り上げる
+  AsyncLogSink(std::unique_ptr<rtc::LogSink> sink, size_t capacity);
+  ~AsyncLogSink() override;
+
+  void OnLogMessage(const std::string& message) override;
+
+  // これまでに捨てたメッセージの数
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Slot {
+    // 書き込み側と読み出し側のどちらがこのスロットを使えるかを表す通し番号
+    std::atomic<size_t> sequence;
+    std::string message;
+  };
+
+  void Run();
+  // 溜まっているメッセージを全て書き込む。書き込んだ場合は true を返す
+  bool Flush();
+
+  std::unique_ptr<rtc::LogSink> sink_;
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<size_t> enqueue_pos_;
+  size_t dequeue_pos_ = 0;
+  std::atomic<uint64_t> dropped_;
+  uint64_t reported_dropped_ = 0;
+  std::atomic<bool> stopped_;
+  std::thread thread_;
+};
+
+#endif  // ASYNC_LOG_SINK_H_
@@ -0,0 +1,165 @@
+#include "audio_processing_profile.h"
+
+#include <cmath>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <vector>
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+// light の場合の内部のサンプリングレートの上限
+const int kLightMaxInternalRate = 32000;
+
+// ベンチマークで処理する音声
+const int kBenchmarkSampleRate = 48000;
+const int kBenchmarkSeconds = 10;
+
+struct BenchmarkCase {
+  const char* name;
+  std::function<void(webrtc::AudioProcessing::Config*)> configure;
+};
+
+// 何も有効にしない状態。AudioProcessing::Config の初期値は residual_echo_detector が有効
+void DisableAll(webrtc::AudioProcessing::Config* config) {
+  *config = webrtc::AudioProcessing::Config();
+  config->residual_echo_detector.enabled = false;
+}
+
+// WebRtcVoiceEngine が AudioOptions の初期値で設定する構成
+void ConfigureDefault(webrtc::AudioProcessing::Config* config) {
+  config->echo_canceller.enabled = true;
+  config->noise_suppression.enabled = true;
+  config->gain_controller1.enabled = true;
+  config->gain_controller1.mode =
+      webrtc::AudioProcessing::Config::GainController1::kAdaptiveDigital;
+  config->high_pass_filter.enabled = true;
+  config->residual_echo_detector.enabled = true;
+}
+
+void ConfigureLight(webrtc::AudioProcessing::Config* config) {
+  config->noise_suppression.enabled = true;
+  config->gain_controller1.enabled = true;
+  config->gain_controller1.mode =
+      webrtc::AudioProcessing::Config::GainController1::kAdaptiveDigital;
+  config->high_pass_filter.enabled = true;
+  config->pipeline.maximum_internal_processing_rate = kLightMaxInternalRate;
+}
+
+// 指定した構成で kBenchmarkSeconds 秒分の音声を処理し、CPU 時間 (秒) を返す
+double RunCase(const BenchmarkCase& c) {
+  rtc::scoped_refptr<webrtc::AudioProcessing> apm =
+      webrtc::AudioProcessingBuilder().Create();
+  webrtc::AudioProcessing::Config config;
+  DisableAll(&config);
+  c.configure(&config);
+  apm->ApplyConfig(config);
+
+  const size_t frames = kBenchmarkSampleRate / 100;
+  const webrtc::StreamConfig stream_config(kBenchmarkSampleRate, 1);
+  std::vector<float> capture(frames);
+  std::vector<float> render(frames);
+  float* capture_channels[] = {capture.data()};
+  float* render_channels[] = {render.data()};
+
+  // 擬似乱数のノイズに正弦波を足した音声を、録音側と再生側の両方に流す
+  uint32_t seed = 1;
+  std::clock_t total = 0;
+  for (int i = 0; i < kBenchmarkSeconds * 100; i++) {
+    for (size_t j = 0; j < frames; j++) {
+      seed = seed * 1664525 + 1013904223;
+      float noise = static_cast<float>(seed >> 16) / 65536.0f - 0.5f;
+      float tone = std::sin(2.0f * 3.14159265f * 440.0f *
+                            (i * frames + j) / kBenchmarkSampleRate);
+      render[j] = (tone * 0.3f + noise * 0.05f) * 32767.0f;
+      capture[j] = render[j] * 0.5f + noise * 0.1f * 32767.0f;
+    }
+    std::clock_t start = std::clock();
+    apm->ProcessReverseStream(render_channels, stream_config, stream_config,
+                              render_channels);
+    apm->set_stream_delay_ms(0);
+    apm->ProcessStream(capture_channels, stream_config, stream_config,
+                       capture_channels);
+    total += std::clock() - start;
+  }
+  return static_cast<double>(total) / CLOCKS_PER_SEC;
+}
+
+}  // namespace
+
+rtc::scoped_refptr<webrtc::AudioProcessing> AudioProcessingProfile::Create(
+    const std::string& mode) {
+  if (mode == "bypass") {
+    // APM が無い場合、WebRtcVoiceEngine は音声処理を全て行わない
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": audio processing is bypassed";
+    return nullptr;
+  }
+  rtc::scoped_refptr<webrtc::AudioProcessing> apm =
+      webrtc::AudioProcessingBuilder().Create();
+  if (mode == "light") {
+    // 各処理の有効無効は AudioOptions で上書きされるので、ここではそれ以外を設定する
+    webrtc::AudioProcessing::Config config = apm->GetConfig();
+    config.pipeline.maximum_internal_processing_rate = kLightMaxInternalRate;
+    apm->ApplyConfig(config);
+  }
+  return apm;
+}
+
+void AudioProcessingProfile::ApplyOptions(const std::string& mode,
+                                          cricket::AudioOptions* ao) {
+  if (mode == "light") {
+    ao->echo_cancellation = false;
+    ao->typing_detection = false;
+    ao->residual_echo_detector = false;
+  }
+}
+
+void AudioProcessingProfile::RunBenchmark(std::ostream& out) {
+  typedef webrtc::AudioProcessing::Config Config;
+  const std::vector<BenchmarkCase> cases = {
+      {"none", [](Config*) {}},
+      {"high_pass_filter",
+       [](Config* c) { c->high_pass_filter.enabled = true; }},
+      {"echo_canceller (AEC3)",
+       [](Config* c) { c->echo_canceller.enabled = true; }},
+      {"echo_canceller (mobile)",
+       [](Config* c) {
+         c->echo_canceller.enabled = true;
+         c->echo_canceller.mobile_mode = true;
+       }},
+      {"noise_suppression",
+       [](Config* c) { c->noise_suppression.enabled = true; }},
+      {"gain_controller1",
+       [](Config* c) {
+         c->gain_controller1.enabled = true;
+         c->gain_controller1.mode = Config::GainController1::kAdaptiveDigital;
+       }},
+      {"gain_controller2",
+       [](Config* c) { c->gain_controller2.enabled = true; }},
+      {"residual_echo_detector",
+       [](Config* c) { c->residual_echo_detector.enabled = true; }},
+      {"voice_detection",
+       [](Config* c) { c->voice_detection.enabled = true; }},
+      {"--audio-processing=default", ConfigureDefault},
+      {"--audio-processing=light", ConfigureLight},
+  };
+
+  out << "audio processing CPU time per second of " << kBenchmarkSampleRate
+      << "Hz mono audio" << std::endl;
+  out << std::left << std::setw(30) << "module" << std::right << std::setw(10)
+      << "ms/s" << std::setw(10) << "core%" << std::endl;
+  double baseline = 0;
+  for (size_t i = 0; i < cases.size(); i++) {
+    double seconds = RunCase(cases[i]) / kBenchmarkSeconds;
+    if (i == 0) {
+      baseline = seconds;
+    }
+    out << std::left << std::setw(30) << cases[i].name << std::right
+        << std::fixed << std::setprecision(2) << std::setw(10)
+        << seconds * 1000 << std::setw(10) << seconds * 100 << std::endl;
+  }
+  out << "(\"none\" is the cost of the APM framework itself: "
+      << std::setprecision(2) << baseline * 1000 << " ms/s)" << std::endl;
+}
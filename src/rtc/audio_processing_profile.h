@@ -0,0 +1,30 @@
+#ifndef AUDIO_PROCESSING_PROFILE_H_
+#define AUDIO_PROCESSING_PROFILE_H_
+
+#include <ostream>
+#include <string>
+
+#include "api/audio_options.h"
+#include "api/scoped_refptr.h"
+#include "modules/audio_processing/include/audio_processing.h"
+
+// --audio-processing で指定する音声処理 (APM) の構成。
+//
+// - default: WebRTC の標準の構成
+// - light: 負荷の大きいエコーキャンセラ (AEC3) を止め、内部の処理を 32kHz までに抑える。
+//          ノイズ抑制、固定小数点の AGC、ハイパスフィルタは残す
+// - bypass: APM を作らず、録音した音声をそのまま送る
+class AudioProcessingProfile {
+ public:
+  // bypass の場合は nullptr を返す
+  static rtc::scoped_refptr<webrtc::AudioProcessing> Create(
+      const std::string& mode);
+  // --disable-* で指定したものに加えて、構成に合わせて無効にする
+  static void ApplyOptions(const std::string& mode, cricket::AudioOptions* ao);
+
+  // APM の処理を 1 つずつ有効にしてダミーの音声を処理させ、
+  // 音声 1 秒あたりの CPU 時間を out に表形式で書き出す
+  static void RunBenchmark(std::ostream& out);
+};
+
+#endif  // AUDIO_PROCESSING_PROFILE_H_
@@ -0,0 +1,184 @@
+#include "bitrate_cache.h"
+
+#include <stdio.h>
+
+#include <boost/asio/post.hpp>
+#include <fstream>
+
+#include <nlohmann/json.hpp>
+
+#include "rtc_base/helpers.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 同じプロセスの中でのファイルの読み書きを順番に行う
+std::mutex g_file_mutex;
+
+}  // namespace
+
+std::shared_ptr<BitrateCache> BitrateCache::Create(
+    boost::asio::io_context& ioc,
+    Settings settings) {
+  if (settings.path.empty()) {
+    return nullptr;
+  }
+  auto cache = std::make_shared<BitrateCache>(ioc, settings);
+  cache->Load();
+  return cache;
+}
+
+BitrateCache::BitrateCache(boost::asio::io_context& ioc, Settings settings)
+    : ioc_(ioc), settings_(settings) {}
+
+int BitrateCache::Get(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return 0;
+  }
+  const int64_t age_ms = rtc::TimeUTCMillis() - it->second.updated_at;
+  if (age_ms > static_cast<int64_t>(settings_.max_age_sec) * 1000) {
+    return 0;
+  }
+  return it->second.bitrate_bps;
+}
+
+void BitrateCache::Start(StatsSampler* sampler) {
+  std::weak_ptr<BitrateCache> weak_self = shared_from_this();
+  sampler->AddListener([weak_self](int id,
+                                   const std::shared_ptr<RTCConnection>& c,
+                                   const StatsSampler::Sample& sample) {
+    auto self = weak_self.lock();
+    if (!self || c->bitrateCacheKey().empty()) {
+      return;
+    }
+    // シグナリングスレッドから呼ばれるので、io_context のスレッドで処理する
+    std::string key = c->bitrateCacheKey();
+    boost::asio::post(self->ioc_, [self, key, sample]() {
+      self->OnSample(key, sample);
+    });
+  });
+}
+
+void BitrateCache::OnSample(const std::string& key,
+                            const StatsSampler::Sample& sample) {
+  // 最初の値は差分が無いので損失率が分からない。
+  // 損失が多い間は推定値が下がっている途中なので、次の接続の開始には使わない
+  if (sample.interval_ms <= 0 || sample.available_outgoing_bitrate_bps <= 0 ||
+      sample.loss_rate > settings_.max_loss_rate) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& entry = entries_[key];
+    entry.bitrate_bps = static_cast<int>(sample.available_outgoing_bitrate_bps);
+    entry.updated_at = sample.timestamp_ms;
+    dirty_ = true;
+  }
+  if (rtc::TimeMillis() - last_save_ms_ >= settings_.save_interval_ms) {
+    Save();
+  }
+}
+
+void BitrateCache::Load() {
+  Entries entries;
+  {
+    std::lock_guard<std::mutex> file_lock(g_file_mutex);
+    if (!Read(settings_.path, &entries)) {
+      return;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_ = std::move(entries);
+  RTC_LOG(LS_INFO) << "Loaded bitrate cache: " << settings_.path
+                   << " remotes=" << entries_.size();
+}
+
+bool BitrateCache::Read(const std::string& path, Entries* entries) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    return false;
+  }
+  nlohmann::json cache = nlohmann::json::parse(ifs, nullptr, false);
+  if (cache.is_discarded() || !cache.is_object() ||
+      !cache["remotes"].is_object()) {
+    RTC_LOG(LS_WARNING) << "Ignore invalid bitrate cache: " << path;
+    return false;
+  }
+  for (const auto& remote : cache["remotes"].items()) {
+    if (!remote.value().is_object()) {
+      continue;
+    }
+    Entry entry;
+    entry.bitrate_bps = remote.value().value("bitrate_bps", 0);
+    entry.updated_at = remote.value().value("updated_at", (int64_t)0);
+    if (entry.bitrate_bps > 0) {
+      (*entries)[remote.key()] = entry;
+    }
+  }
+  return true;
+}
+
+void BitrateCache::Merge(const Entries& from, Entries* to) {
+  for (const auto& entry : from) {
+    auto it = to->find(entry.first);
+    if (it == to->end() || it->second.updated_at < entry.second.updated_at) {
+      (*to)[entry.first] = entry.second;
+    }
+  }
+}
+
+void BitrateCache::Save() {
+  Entries entries;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_save_ms_ = rtc::TimeMillis();
+    if (!dirty_) {
+      return;
+    }
+    dirty_ = false;
+    entries = entries_;
+  }
+
+  {
+    std::lock_guard<std::mutex> file_lock(g_file_mutex);
+    // 同じファイルを使う他のセッションやプロセスが書いた値を消さないように、
+    // ファイルにある値と合わせてから書き込む
+    Entries on_disk;
+    Read(settings_.path, &on_disk);
+    Merge(on_disk, &entries);
+
+    nlohmann::json remotes = nlohmann::json::object();
+    for (const auto& entry : entries) {
+      remotes[entry.first] = {{"bitrate_bps", entry.second.bitrate_bps},
+                              {"updated_at", entry.second.updated_at}};
+    }
+    nlohmann::json cache = {{"remotes", remotes}};
+
+    // 書き込み途中で落ちても壊れたファイルが残らないように、別のファイルに書いてから置き換える。
+    // 他のプロセスと一時ファイルが被らないように、名前は毎回変える
+    std::string tmp_path =
+        settings_.path + ".tmp." + rtc::CreateRandomString(8);
+    {
+      std::ofstream ofs(tmp_path);
+      if (!ofs) {
+        RTC_LOG(LS_WARNING) << "Failed to write bitrate cache: "
+                            << settings_.path;
+        return;
+      }
+      ofs << cache.dump(2);
+    }
+    if (rename(tmp_path.c_str(), settings_.path.c_str()) != 0) {
+      RTC_LOG(LS_WARNING) << "Failed to rename bitrate cache: "
+                          << settings_.path;
+      remove(tmp_path.c_str());
+      return;
+    }
+  }
+
+  // 他のセッションが記録した値も Get() で使う
+  std::lock_guard<std::mutex> lock(mutex_);
+  Merge(entries, &entries_);
+}
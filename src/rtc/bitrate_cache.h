@@ -0,0 +1,76 @@
+#ifndef BITRATE_CACHE_H_
+#define BITRATE_CACHE_H_
+
+#include <stdint.h>
+
+#include <boost/asio/io_context.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "connection.h"
+#include "stats_sampler.h"
+
+// 接続先毎に、最後に推定できた送信の帯域を JSON ファイルに覚えておくクラス。
+//
+// 新しい接続は libwebrtc の既定の開始ビットレートから少しずつ帯域を探るので、
+// 広い回線でも最初の数秒は映像が粗くなる。前回の推定値から始めれば、再接続した直後から
+// 近いビットレートで送れる。
+// StatsSampler が取得した available_outgoing_bitrate を、損失が少ない間だけ記録する。
+//
+// {"remotes": {"sora:channel": {"bitrate_bps": 2500000, "updated_at": 1600000000000}}}
+//
+// Get() は任意のスレッドから呼んで良い。記録とファイルへの書き込みは io_context のスレッドで行う。
+// ゲートウェイモードでは同じファイルを複数のセッションで使うので、書き込む時はファイルにある
+// 値と合わせて、接続先毎に新しい方を残す。
+class BitrateCache : public std::enable_shared_from_this<BitrateCache> {
+ public:
+  struct Settings {
+    // 空の場合は Create() が nullptr を返す
+    std::string path;
+    // これより古い値は使わない
+    int max_age_sec = 7 * 24 * 60 * 60;
+    // 損失率がこれを超えている間の推定値は記録しない
+    double max_loss_rate = 0.02;
+    // 変わった値をファイルに書き込む間隔
+    int save_interval_ms = 10 * 1000;
+  };
+
+  static std::shared_ptr<BitrateCache> Create(boost::asio::io_context& ioc,
+                                              Settings settings);
+
+  BitrateCache(boost::asio::io_context& ioc, Settings settings);
+
+  // key の接続先で前回推定できた帯域。覚えていない場合は 0 を返す
+  int Get(const std::string& key);
+  // sampler が値を取得する度に、その接続の BitrateCacheKey の値を更新する
+  void Start(StatsSampler* sampler);
+  // まだ書き込んでいない値があれば書き込む。終了する前に呼ぶ
+  void Save();
+
+ private:
+  struct Entry {
+    int bitrate_bps = 0;
+    // 記録した時刻 (UTC のミリ秒)
+    int64_t updated_at = 0;
+  };
+
+  typedef std::map<std::string, Entry> Entries;
+
+  void Load();
+  // path のファイルを読む。無いか壊れている場合は false を返す
+  static bool Read(const std::string& path, Entries* entries);
+  // from の値のうち、to より新しいものを to に入れる
+  static void Merge(const Entries& from, Entries* to);
+  void OnSample(const std::string& key, const StatsSampler::Sample& sample);
+
+  boost::asio::io_context& ioc_;
+  const Settings settings_;
+  std::mutex mutex_;
+  Entries entries_;
+  bool dirty_ = false;
+  int64_t last_save_ms_ = 0;
+};
+
+#endif  // BITRATE_CACHE_H_
@@ -0,0 +1,75 @@
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// 上限付きのキュー。
+//
+// 上限を超えて Push した場合は一番古い要素を捨てる。
+// 捨てた要素に後始末が必要な場合があるので、Push は捨てた要素を返す。
+// Close() を呼ぶと、待っている Pop は全て false を返す。
+template <class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t max_size) : max_size_(max_size) {}
+
+  // 要素を捨てた場合は true を返して dropped に捨てた要素を入れる
+  bool Push(T item, T* dropped) {
+    bool is_dropped = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (queue_.size() >= max_size_) {
+        *dropped = std::move(queue_.front());
+        queue_.pop_front();
+        is_dropped = true;
+      }
+      queue_.push_back(std::move(item));
+    }
+    cond_.notify_one();
+    return is_dropped;
+  }
+
+  // 要素が来るまで待つ。Close() された場合は false を返す
+  bool Pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+    if (closed_) {
+      return false;
+    }
+    *item = std::move(queue_.front());
+    queue_.pop_front();
+    return true;
+  }
+
+  // 残っている要素を全て取り出す
+  std::deque<T> Drain() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::deque<T> items;
+    items.swap(queue_);
+    return items;
+  }
+
+  void Open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = false;
+  }
+
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    cond_.notify_all();
+  }
+
+ private:
+  const size_t max_size_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<T> queue_;
+  bool closed_ = false;
+};
+
+#endif  // BOUNDED_QUEUE_H_
@@ -0,0 +1,171 @@
+#include "capture_pipeline.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "thread_placement.h"
+
+namespace {
+
+// 統計情報をログに出力する間隔
+const int64_t kStatsIntervalUs = 10 * rtc::kNumMicrosecsPerSec;
+
+}  // namespace
+
+void CapturePipeline::StageStats::Add(int64_t wait_us, int64_t work_us) {
+  count++;
+  wait_total_us += wait_us;
+  wait_max_us = std::max(wait_max_us, wait_us);
+  work_total_us += work_us;
+  work_max_us = std::max(work_max_us, work_us);
+}
+
+std::string CapturePipeline::StageStats::ToString() const {
+  std::stringstream ss;
+  ss << "frames=" << count << " dropped=" << dropped;
+  if (count > 0) {
+    ss << " wait_avg_us=" << wait_total_us / count
+       << " wait_max_us=" << wait_max_us
+       << " work_avg_us=" << work_total_us / count
+       << " work_max_us=" << work_max_us;
+  }
+  return ss.str();
+}
+
+CapturePipeline::CapturePipeline(size_t queue_size,
+                                 ConvertCallback convert,
+                                 ReleaseCallback release,
+                                 DeliverCallback deliver)
+    : convert_(std::move(convert)),
+      release_(std::move(release)),
+      deliver_(std::move(deliver)),
+      convert_queue_(queue_size),
+      deliver_queue_(queue_size) {}
+
+CapturePipeline::~CapturePipeline() {
+  Stop();
+}
+
+void CapturePipeline::Start() {
+  if (convert_thread_) {
+    return;
+  }
+  convert_queue_.Open();
+  deliver_queue_.Open();
+  last_stats_us_ = rtc::TimeMicros();
+  convert_thread_.reset(new rtc::PlatformThread(
+      CapturePipeline::ConvertThread, this, "CaptureConvert",
+      rtc::kHighPriority));
+  deliver_thread_.reset(new rtc::PlatformThread(
+      CapturePipeline::DeliverThread, this, "CaptureDeliver",
+      rtc::kHighPriority));
+  convert_thread_->Start();
+  deliver_thread_->Start();
+}
+
+void CapturePipeline::Stop() {
+  if (!convert_thread_) {
+    return;
+  }
+  convert_queue_.Close();
+  deliver_queue_.Close();
+  convert_thread_->Stop();
+  deliver_thread_->Stop();
+  convert_thread_.reset();
+  deliver_thread_.reset();
+
+  // 変換待ちのキャプチャバッファを返却する
+  for (const Item& item : convert_queue_.Drain()) {
+    release_(item);
+  }
+  deliver_queue_.Drain();
+}
+
+void CapturePipeline::Push(Item item) {
+  item.enqueued_us = rtc::TimeMicros();
+  Item dropped;
+  if (convert_queue_.Push(std::move(item), &dropped)) {
+    release_(dropped);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    convert_stats_.dropped++;
+    convert_total_stats_.dropped++;
+  }
+}
+
+void CapturePipeline::GetTotalStats(StageStats* convert,
+                                    StageStats* deliver) {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  *convert = convert_total_stats_;
+  *deliver = deliver_total_stats_;
+}
+
+void CapturePipeline::ConvertThread(void* obj) {
+  ThreadPlacement::Instance().Apply("capture");
+  static_cast<CapturePipeline*>(obj)->ConvertLoop();
+}
+
+void CapturePipeline::DeliverThread(void* obj) {
+  ThreadPlacement::Instance().Apply("capture");
+  static_cast<CapturePipeline*>(obj)->DeliverLoop();
+}
+
+void CapturePipeline::ConvertLoop() {
+  Item item;
+  while (convert_queue_.Pop(&item)) {
+    int64_t start_us = rtc::TimeMicros();
+    item.buffer = convert_(item);
+    // 変換が終わればキャプチャバッファは不要になる
+    release_(item);
+    int64_t end_us = rtc::TimeMicros();
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      convert_stats_.Add(start_us - item.enqueued_us, end_us - start_us);
+      convert_total_stats_.Add(start_us - item.enqueued_us,
+                               end_us - start_us);
+    }
+
+    if (!item.buffer) {
+      continue;
+    }
+    item.data = nullptr;
+    item.enqueued_us = end_us;
+    Item dropped;
+    if (deliver_queue_.Push(std::move(item), &dropped)) {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      deliver_stats_.dropped++;
+      deliver_total_stats_.dropped++;
+    }
+    item = Item();
+  }
+}
+
+void CapturePipeline::DeliverLoop() {
+  Item item;
+  while (deliver_queue_.Pop(&item)) {
+    int64_t start_us = rtc::TimeMicros();
+    deliver_(item);
+    int64_t end_us = rtc::TimeMicros();
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      deliver_stats_.Add(start_us - item.enqueued_us, end_us - start_us);
+      deliver_total_stats_.Add(start_us - item.enqueued_us,
+                               end_us - start_us);
+    }
+    MaybeLogStats(end_us);
+    item = Item();
+  }
+}
+
+void CapturePipeline::MaybeLogStats(int64_t now_us) {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  if (now_us - last_stats_us_ < kStatsIntervalUs) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << "CapturePipeline convert: " << convert_stats_.ToString();
+  RTC_LOG(LS_INFO) << "CapturePipeline deliver: " << deliver_stats_.ToString();
+  convert_stats_ = StageStats();
+  deliver_stats_ = StageStats();
+  last_stats_us_ = now_us;
+}
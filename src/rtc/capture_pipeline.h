@@ -0,0 +1,100 @@
+#ifndef CAPTURE_PIPELINE_H_
+#define CAPTURE_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame_buffer.h"
+#include "bounded_queue.h"
+#include "rtc_base/platform_thread.h"
+
+// キャプチャ → 変換 → 配信 をそれぞれ別のスレッドで行うためのパイプライン。
+//
+// キャプチャスレッドは Push() するだけなので、変換が重くても次のフレームの取得が遅れない。
+// 各ステージの間のキューは上限付きで、溢れた場合は古いフレームから捨てる。
+// 捨てたフレームや変換が終わったフレームのキャプチャバッファは release コールバックで返却する。
+//
+// 各ステージの待ち時間と処理時間は一定間隔でログに出力する。
+// 累積の統計情報は GetTotalStats() で取得できる。
+class CapturePipeline {
+ public:
+  struct Item {
+    // キャプチャバッファの識別子 (V4L2 ならバッファのインデックス)
+    int index = -1;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    int64_t timestamp_us = 0;
+    // 前のステージからキューに積まれた時刻
+    int64_t enqueued_us = 0;
+    // 変換後のバッファ
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+  };
+
+  // 変換に失敗した場合は nullptr を返す
+  typedef std::function<rtc::scoped_refptr<webrtc::VideoFrameBuffer>(
+      const Item&)>
+      ConvertCallback;
+  typedef std::function<void(const Item&)> ReleaseCallback;
+  typedef std::function<void(const Item&)> DeliverCallback;
+
+  CapturePipeline(size_t queue_size,
+                  ConvertCallback convert,
+                  ReleaseCallback release,
+                  DeliverCallback deliver);
+  ~CapturePipeline();
+
+  void Start();
+  // 残っているフレームのキャプチャバッファは全て返却される
+  void Stop();
+
+  // キャプチャしたフレームを積む。キャプチャスレッドから呼ぶこと
+  void Push(Item item);
+
+  struct StageStats {
+    int64_t count = 0;
+    int64_t dropped = 0;
+    int64_t wait_total_us = 0;
+    int64_t wait_max_us = 0;
+    int64_t work_total_us = 0;
+    int64_t work_max_us = 0;
+
+    void Add(int64_t wait_us, int64_t work_us);
+    std::string ToString() const;
+  };
+
+  // 生成してからの各ステージの累積の統計情報を取得する
+  void GetTotalStats(StageStats* convert, StageStats* deliver);
+
+ private:
+
+  static void ConvertThread(void* obj);
+  static void DeliverThread(void* obj);
+  void ConvertLoop();
+  void DeliverLoop();
+  void MaybeLogStats(int64_t now_us);
+
+  ConvertCallback convert_;
+  ReleaseCallback release_;
+  DeliverCallback deliver_;
+
+  BoundedQueue<Item> convert_queue_;
+  BoundedQueue<Item> deliver_queue_;
+  std::unique_ptr<rtc::PlatformThread> convert_thread_;
+  std::unique_ptr<rtc::PlatformThread> deliver_thread_;
+
+  std::mutex stats_mutex_;
+  StageStats convert_stats_;
+  StageStats deliver_stats_;
+  // ログに出力してもリセットしない累積の統計情報
+  StageStats convert_total_stats_;
+  StageStats deliver_total_stats_;
+  int64_t last_stats_us_ = 0;
+};
+
+#endif  // CAPTURE_PIPELINE_H_
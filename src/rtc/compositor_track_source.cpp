@@ -0,0 +1,177 @@
+#include "compositor_track_source.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "api/video/i420_buffer.h"
+#include "frame_buffer_pool.h"
+#include "parallel_scaler.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+bool CompositorVideoTrackSource::ParseLayout(const std::string& name,
+                                             Layout* layout) {
+  if (name == "grid") {
+    *layout = Layout::kGrid;
+    return true;
+  }
+  if (name == "pip") {
+    *layout = Layout::kPictureInPicture;
+    return true;
+  }
+  return false;
+}
+
+rtc::scoped_refptr<CompositorVideoTrackSource>
+CompositorVideoTrackSource::Create(
+    std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+    Layout layout,
+    int width,
+    int height) {
+  if (sources.empty() || width <= 0 || height <= 0) {
+    return nullptr;
+  }
+  return new rtc::RefCountedObject<CompositorVideoTrackSource>(
+      std::move(sources), layout, width, height);
+}
+
+CompositorVideoTrackSource::CompositorVideoTrackSource(
+    std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+    Layout layout,
+    int width,
+    int height)
+    : layout_(layout),
+      // I420 なので偶数に揃える
+      width_(width & ~1),
+      height_(height & ~1),
+      sources_(std::move(sources)),
+      latest_buffers_(sources_.size()) {
+  ComputeTiles();
+  for (size_t i = 0; i < sources_.size(); i++) {
+    inputs_.emplace_back(new Input(this, i));
+    sources_[i]->AddOrUpdateSink(inputs_[i].get(), rtc::VideoSinkWants());
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": sources=" << sources_.size()
+                   << " size=" << width_ << "x" << height_;
+}
+
+CompositorVideoTrackSource::~CompositorVideoTrackSource() {
+  for (size_t i = 0; i < sources_.size(); i++) {
+    sources_[i]->RemoveSink(inputs_[i].get());
+  }
+}
+
+void CompositorVideoTrackSource::ComputeTiles() {
+  const int n = static_cast<int>(sources_.size());
+  tiles_.clear();
+  if (layout_ == Layout::kGrid) {
+    const int cols = static_cast<int>(ceil(sqrt(static_cast<double>(n))));
+    const int rows = (n + cols - 1) / cols;
+    const int tile_width = (width_ / cols) & ~1;
+    const int tile_height = (height_ / rows) & ~1;
+    for (int i = 0; i < n; i++) {
+      tiles_.push_back(Rect{(i % cols) * tile_width, (i / cols) * tile_height,
+                            tile_width, tile_height});
+    }
+    needs_clear_ = cols * rows != n || tile_width * cols != width_ ||
+                   tile_height * rows != height_;
+  } else {
+    tiles_.push_back(Rect{0, 0, width_, height_});
+    // 右下から左に向かって 1/4 の大きさで並べる
+    const int margin = (std::min(width_, height_) / 32) & ~1;
+    const int tile_width = (width_ / 4) & ~1;
+    const int tile_height = (height_ / 4) & ~1;
+    for (int i = 1; i < n; i++) {
+      const int x = width_ - (tile_width + margin) * i;
+      tiles_.push_back(Rect{std::max(x, 0), height_ - tile_height - margin,
+                            tile_width, tile_height});
+    }
+    // 先頭のソースがキャンバス全体を覆うので塗りつぶしは不要
+    needs_clear_ = false;
+  }
+}
+
+void CompositorVideoTrackSource::OnInputFrame(size_t index,
+                                              const webrtc::VideoFrame& frame) {
+  if (index != 0) {
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    latest_buffers_[index] = frame.video_frame_buffer();
+    return;
+  }
+  Compose(frame);
+}
+
+void CompositorVideoTrackSource::Compose(const webrtc::VideoFrame& primary) {
+  std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    buffers = latest_buffers_;
+  }
+  buffers[0] = primary.video_frame_buffer();
+
+  rtc::scoped_refptr<webrtc::I420Buffer> canvas =
+      FrameBufferPool::Instance().CreateI420Buffer(width_, height_);
+  if (needs_clear_) {
+    libyuv::I420Rect(canvas->MutableDataY(), canvas->StrideY(),
+                     canvas->MutableDataU(), canvas->StrideU(),
+                     canvas->MutableDataV(), canvas->StrideV(), 0, 0, width_,
+                     height_, 16, 128, 128);
+  }
+
+  for (size_t i = 0; i < buffers.size(); i++) {
+    const Rect& tile = tiles_[i];
+    if (!buffers[i]) {
+      // まだフレームが来ていないソースは黒にしておく
+      if (!needs_clear_) {
+        libyuv::I420Rect(canvas->MutableDataY(), canvas->StrideY(),
+                         canvas->MutableDataU(), canvas->StrideU(),
+                         canvas->MutableDataV(), canvas->StrideV(), tile.x,
+                         tile.y, tile.width, tile.height, 16, 128, 128);
+      }
+      continue;
+    }
+    // NativeBuffer も ToI420() で変換する。
+    // 縮小は libyuv の SIMD 実装に任せる
+    rtc::scoped_refptr<webrtc::I420BufferInterface> src =
+        buffers[i]->ToI420();
+    if (!src) {
+      continue;
+    }
+    // アスペクト比を保ったままタイルに収める
+    int dst_width = tile.width;
+    int dst_height = tile.height;
+    if (src->width() * tile.height > src->height() * tile.width) {
+      dst_height = (tile.width * src->height() / src->width()) & ~1;
+    } else {
+      dst_width = (tile.height * src->width() / src->height()) & ~1;
+    }
+    if (dst_width <= 0 || dst_height <= 0) {
+      continue;
+    }
+    if (!needs_clear_ &&
+        (dst_width != tile.width || dst_height != tile.height)) {
+      libyuv::I420Rect(canvas->MutableDataY(), canvas->StrideY(),
+                       canvas->MutableDataU(), canvas->StrideU(),
+                       canvas->MutableDataV(), canvas->StrideV(), tile.x,
+                       tile.y, tile.width, tile.height, 16, 128, 128);
+    }
+    const int x = tile.x + ((tile.width - dst_width) / 2 & ~1);
+    const int y = tile.y + ((tile.height - dst_height) / 2 & ~1);
+    ParallelScaler::Instance().I420Scale(
+        src->DataY(), src->StrideY(), src->DataU(), src->StrideU(),
+        src->DataV(), src->StrideV(), src->width(), src->height(),
+        canvas->MutableDataY() + y * canvas->StrideY() + x, canvas->StrideY(),
+        canvas->MutableDataU() + y / 2 * canvas->StrideU() + x / 2,
+        canvas->StrideU(),
+        canvas->MutableDataV() + y / 2 * canvas->StrideV() + x / 2,
+        canvas->StrideV(), dst_width, dst_height, libyuv::kFilterBox);
+  }
+
+  OnCapturedFrame(webrtc::VideoFrame::Builder()
+                      .set_video_frame_buffer(canvas)
+                      .set_rotation(webrtc::kVideoRotation_0)
+                      .set_timestamp_us(primary.timestamp_us())
+                      .build());
+}
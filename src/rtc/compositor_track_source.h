@@ -0,0 +1,83 @@
+#ifndef COMPOSITOR_TRACK_SOURCE_H_
+#define COMPOSITOR_TRACK_SOURCE_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "scalable_track_source.h"
+
+// 複数のキャプチャラーの映像を 1 枚のキャンバスに並べて、1 つのトラックとして送信するソース。
+//
+// カメラの数だけトラックを送る代わりに 1 つのエンコーダで全てのカメラを送れるので、
+// エンコーダのセッション数に制限がある場合や、SFU での配信数を減らしたい場合に使う。
+// 先頭のソースにフレームが来た時に、他のソースの最新のフレームと合成して出力する。
+class CompositorVideoTrackSource : public ScalableVideoTrackSource {
+ public:
+  enum class Layout {
+    // 全てのソースを同じ大きさで格子状に並べる
+    kGrid,
+    // 先頭のソースをキャンバス全体に表示し、他のソースを右下に小さく重ねる
+    kPictureInPicture,
+  };
+  // "grid" または "pip"。それ以外の場合は false を返す
+  static bool ParseLayout(const std::string& name, Layout* layout);
+
+  static rtc::scoped_refptr<CompositorVideoTrackSource> Create(
+      std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+      Layout layout,
+      int width,
+      int height);
+  ~CompositorVideoTrackSource() override;
+
+ protected:
+  CompositorVideoTrackSource(
+      std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+      Layout layout,
+      int width,
+      int height);
+
+ private:
+  class Input : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+   public:
+    Input(CompositorVideoTrackSource* compositor, size_t index)
+        : compositor_(compositor), index_(index) {}
+    void OnFrame(const webrtc::VideoFrame& frame) override {
+      compositor_->OnInputFrame(index_, frame);
+    }
+
+   private:
+    CompositorVideoTrackSource* compositor_;
+    size_t index_;
+  };
+  // キャンバス上の矩形。I420 の色差が揃うように全て偶数にする
+  struct Rect {
+    int x;
+    int y;
+    int width;
+    int height;
+  };
+
+  void OnInputFrame(size_t index, const webrtc::VideoFrame& frame);
+  void ComputeTiles();
+  void Compose(const webrtc::VideoFrame& primary);
+
+  const Layout layout_;
+  const int width_;
+  const int height_;
+  std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources_;
+  std::vector<std::unique_ptr<Input>> inputs_;
+  std::vector<Rect> tiles_;
+  // タイルで覆われない部分があるので、毎回キャンバスを塗りつぶす必要がある
+  bool needs_clear_ = false;
+
+  std::mutex frames_mutex_;
+  // 先頭以外のソースの最新のフレーム
+  std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> latest_buffers_;
+};
+
+#endif  // COMPOSITOR_TRACK_SOURCE_H_
@@ -1,5 +1,7 @@
 #include "connection.h"
 
+#include <algorithm>
+
 #include "rtc_base/logging.h"
 
 // stats のコールバックを受け取るためのクラス
@@ -32,7 +34,7 @@ RTCConnection::~RTCConnection() {
   _connection->Close();
 }
 
-void RTCConnection::createOffer() {
+void RTCConnection::createOffer(bool ice_restart) {
   using RTCOfferAnswerOptions =
       webrtc::PeerConnectionInterface::RTCOfferAnswerOptions;
   RTCOfferAnswerOptions options = RTCOfferAnswerOptions();
@@ -40,8 +42,27 @@ void RTCConnection::createOffer() {
       RTCOfferAnswerOptions::kOfferToReceiveMediaTrue;
   options.offer_to_receive_audio =
       RTCOfferAnswerOptions::kOfferToReceiveMediaTrue;
-  _connection->CreateOffer(
-      CreateSessionDescriptionObserver::Create(_sender, _connection), options);
+  options.ice_restart = ice_restart;
+  _connection->CreateOffer(CreateSessionDescriptionObserver::Create(
+                               _sender, _connection, sdpRewriter()),
+                           options);
+}
+
+CreateSessionDescriptionObserver::SdpRewriter RTCConnection::sdpRewriter()
+    const {
+  if (_opus_profile.empty() && !_video_protection.disable_ulpfec &&
+      !_rtc_config.rewrites_sdp()) {
+    return nullptr;
+  }
+  // 相手が送信する音声や映像にも同じ設定を使ってもらう
+  OpusProfile opus_profile = _opus_profile;
+  VideoProtectionProfile video_protection = _video_protection;
+  RtcConfig rtc_config = _rtc_config;
+  return [opus_profile, video_protection,
+          rtc_config](const std::string& sdp) -> std::string {
+    return rtc_config.ApplyToSdp(
+        video_protection.ApplyToSdp(opus_profile.ApplyToSdp(sdp)));
+  };
 }
 
 void RTCConnection::setOffer(const std::string sdp) {
@@ -63,7 +84,8 @@ void RTCConnection::setOffer(const std::string sdp) {
 
 void RTCConnection::createAnswer() {
   _connection->CreateAnswer(
-      CreateSessionDescriptionObserver::Create(_sender, _connection),
+      CreateSessionDescriptionObserver::Create(_sender, _connection,
+                                               sdpRewriter()),
       webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
 }
 
@@ -182,3 +204,116 @@ void RTCConnection::getStats(
         callback) {
   _connection->GetStats(RTCStatsCallback::Create(std::move(callback)));
 }
+
+void RTCConnection::setVideoEncodingLimits(int max_bitrate_bps,
+                                           double max_framerate,
+                                           double scale_resolution_down_by) {
+  std::lock_guard<std::mutex> lock(_limits_mtx);
+  _encoding_limits.max_bitrate_bps = max_bitrate_bps;
+  _encoding_limits.max_framerate = max_framerate;
+  _encoding_limits.scale_resolution_down_by = scale_resolution_down_by;
+  applyVideoEncodingLimits();
+}
+
+void RTCConnection::setVideoThumbnail(bool enabled,
+                                      int max_bitrate_bps,
+                                      double max_framerate,
+                                      double scale_resolution_down_by) {
+  std::lock_guard<std::mutex> lock(_limits_mtx);
+  _thumbnail = enabled;
+  _thumbnail_limits.max_bitrate_bps = max_bitrate_bps;
+  _thumbnail_limits.max_framerate = max_framerate;
+  _thumbnail_limits.scale_resolution_down_by = scale_resolution_down_by;
+  applyVideoEncodingLimits();
+}
+
+void RTCConnection::applyVideoEncodingLimits() {
+  // 0 以下は上限が無いことを表すので、両方に上限がある場合だけ小さい方を使う
+  auto stricter = [](double a, double b) {
+    if (a <= 0) {
+      return b;
+    }
+    if (b <= 0) {
+      return a;
+    }
+    return std::min(a, b);
+  };
+  EncodingLimits limits = _encoding_limits;
+  if (_thumbnail) {
+    limits.max_bitrate_bps = static_cast<int>(stricter(
+        limits.max_bitrate_bps, _thumbnail_limits.max_bitrate_bps));
+    limits.max_framerate =
+        stricter(limits.max_framerate, _thumbnail_limits.max_framerate);
+    limits.scale_resolution_down_by =
+        std::max(limits.scale_resolution_down_by,
+                 _thumbnail_limits.scale_resolution_down_by);
+  }
+
+  for (const auto& sender : _connection->GetSenders()) {
+    if (sender->media_type() != cricket::MEDIA_TYPE_VIDEO) {
+      continue;
+    }
+    webrtc::RtpParameters parameters = sender->GetParameters();
+    if (parameters.encodings.empty()) {
+      continue;
+    }
+    if (parameters.encodings.size() > 1) {
+      // サイマルキャストの場合は、レイヤー毎の設定を変えずに、一番小さいレイヤーだけを送るかどうかを切り替える。
+      // フォーカスされていない間は SFU も一番小さいレイヤーしか転送しない
+      size_t smallest = 0;
+      for (size_t i = 1; i < parameters.encodings.size(); i++) {
+        if (parameters.encodings[i].scale_resolution_down_by.value_or(1.0) >
+            parameters.encodings[smallest].scale_resolution_down_by.value_or(
+                1.0)) {
+          smallest = i;
+        }
+      }
+      // 止めていたレイヤーまで送り始めないように、サムネイルにする前の状態を覚えておいて戻す
+      auto saved = _active_before_thumbnail.find(sender->id());
+      if (_thumbnail && saved == _active_before_thumbnail.end()) {
+        std::vector<bool> actives;
+        for (const auto& encoding : parameters.encodings) {
+          actives.push_back(encoding.active);
+        }
+        _active_before_thumbnail[sender->id()] = actives;
+      }
+      bool changed = false;
+      for (size_t i = 0; i < parameters.encodings.size(); i++) {
+        // サムネイルでなく、覚えている状態も無い場合は今のままにする
+        bool active = parameters.encodings[i].active;
+        if (_thumbnail) {
+          active = i == smallest;
+        } else if (saved != _active_before_thumbnail.end()) {
+          active = i >= saved->second.size() || saved->second[i];
+        }
+        changed |= parameters.encodings[i].active != active;
+        parameters.encodings[i].active = active;
+      }
+      if (!_thumbnail && saved != _active_before_thumbnail.end()) {
+        _active_before_thumbnail.erase(saved);
+      }
+      if (!changed) {
+        continue;
+      }
+    } else {
+      webrtc::RtpEncodingParameters& encoding = parameters.encodings[0];
+      encoding.max_bitrate_bps =
+          limits.max_bitrate_bps > 0
+              ? absl::optional<int>(limits.max_bitrate_bps)
+              : absl::nullopt;
+      encoding.max_framerate =
+          limits.max_framerate > 0
+              ? absl::optional<double>(limits.max_framerate)
+              : absl::nullopt;
+      encoding.scale_resolution_down_by =
+          limits.scale_resolution_down_by > 1.0
+              ? absl::optional<double>(limits.scale_resolution_down_by)
+              : absl::nullopt;
+    }
+    webrtc::RTCError error = sender->SetParameters(parameters);
+    if (!error.ok()) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__
+                          << ": SetParameters failed: " << error.message();
+    }
+  }
+}
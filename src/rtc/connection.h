@@ -1,7 +1,15 @@
 #ifndef CONNECTION_H_
 #define CONNECTION_H_
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "api/peer_connection_interface.h"
 #include "observer.h"
+#include "opus_profile.h"
+#include "rtc_config.h"
+#include "video_protection_profile.h"
 
 class RTCConnection {
  public:
@@ -12,7 +20,8 @@ class RTCConnection {
         _observer(std::move(observer)),
         _connection(connection){};
   ~RTCConnection();
-  void createOffer();
+  // ice_restart が true の場合は ICE の認証情報を作り直した offer を生成する
+  void createOffer(bool ice_restart = false);
   void setOffer(const std::string sdp);
   void createAnswer();
   void setAnswer(const std::string sdp);
@@ -24,11 +33,40 @@ class RTCConnection {
   bool isAudioEnabled();
   bool isVideoEnabled();
 
+  // 以降に生成する offer と answer に反映する
+  void setOpusProfile(OpusProfile opus_profile) {
+    _opus_profile = std::move(opus_profile);
+  }
+  void setVideoProtectionProfile(VideoProtectionProfile video_protection) {
+    _video_protection = std::move(video_protection);
+  }
+  void setRtcConfig(RtcConfig rtc_config) {
+    _rtc_config = std::move(rtc_config);
+  }
+  // BitrateCache に帯域を覚えておく接続先の名前。空の場合は覚えない
+  void setBitrateCacheKey(std::string key) {
+    _bitrate_cache_key = std::move(key);
+  }
+  const std::string& bitrateCacheKey() const { return _bitrate_cache_key; }
+
   void getStats(
       std::function<void(
           const rtc::scoped_refptr<const webrtc::RTCStatsReport>&)> callback);
+  // 送信している映像のエンコードの上限を変える。0 以下を指定した上限は外す。
+  // サイマルキャストでレイヤーが複数ある場合は、レイヤー毎の設定を変えないように何もしない
+  void setVideoEncodingLimits(int max_bitrate_bps,
+                              double max_framerate,
+                              double scale_resolution_down_by);
+  // スポットライトでフォーカスされていない間のエンコードの上限。
+  // setVideoEncodingLimits() の上限とは厳しい方を使う。
+  // サイマルキャストの場合は、一番小さいレイヤー以外を止める
+  void setVideoThumbnail(bool enabled,
+                         int max_bitrate_bps,
+                         double max_framerate,
+                         double scale_resolution_down_by);
 
  private:
+  CreateSessionDescriptionObserver::SdpRewriter sdpRewriter() const;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> getLocalStream();
   rtc::scoped_refptr<webrtc::AudioTrackInterface> getLocalAudioTrack();
   rtc::scoped_refptr<webrtc::VideoTrackInterface> getLocalVideoTrack();
@@ -41,5 +79,25 @@ class RTCConnection {
   RTCMessageSender* _sender;
   std::unique_ptr<PeerConnectionObserver> _observer;
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> _connection;
+  OpusProfile _opus_profile;
+  VideoProtectionProfile _video_protection;
+  RtcConfig _rtc_config;
+  std::string _bitrate_cache_key;
+
+  struct EncodingLimits {
+    int max_bitrate_bps = 0;
+    double max_framerate = 0;
+    double scale_resolution_down_by = 1.0;
+  };
+  // _encoding_limits と、_thumbnail が true の場合は _thumbnail_limits を合わせて設定する
+  void applyVideoEncodingLimits();
+
+  std::mutex _limits_mtx;
+  EncodingLimits _encoding_limits;
+  bool _thumbnail = false;
+  EncodingLimits _thumbnail_limits;
+  // サイマルキャストの送信者毎に、サムネイルにする前の各レイヤーの active。
+  // サムネイルをやめた時に元に戻す
+  std::map<std::string, std::vector<bool>> _active_before_thumbnail;
 };
 #endif
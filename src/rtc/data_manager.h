@@ -2,6 +2,7 @@
 #define DATA_MANAGER_H_
 
 #include "api/data_channel_interface.h"
+#include "api/peer_connection_interface.h"
 
 class RTCDataManager {
  public:
@@ -9,6 +10,10 @@ class RTCDataManager {
   // DataChannel は 必ず kClosed にステートが遷移するので OnRemove は不要
   virtual void OnDataChannel(
       rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) = 0;
+  // PeerConnection を生成した直後、offer/answer の前に呼ばれる。
+  // Momo 側から DataChannel を作る場合はここで CreateDataChannel すること
+  virtual void OnCreateConnection(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) {}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,39 @@
+#include "data_manager_dispatcher.h"
+
+#include "rtc_base/logging.h"
+
+void RTCDataManagerDispatcher::SetDefault(RTCDataManager* data_manager) {
+  default_ = data_manager;
+}
+
+void RTCDataManagerDispatcher::Add(const std::string& label,
+                                   RTCDataManager* data_manager) {
+  data_managers_[label] = data_manager;
+}
+
+bool RTCDataManagerDispatcher::empty() const {
+  return default_ == nullptr && data_managers_.empty();
+}
+
+void RTCDataManagerDispatcher::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  auto it = data_managers_.find(data_channel->label());
+  if (it != data_managers_.end()) {
+    it->second->OnDataChannel(data_channel);
+  } else if (default_ != nullptr) {
+    default_->OnDataChannel(data_channel);
+  } else {
+    RTC_LOG(LS_INFO) << __FUNCTION__
+                     << ": ignore data channel: " << data_channel->label();
+  }
+}
+
+void RTCDataManagerDispatcher::OnCreateConnection(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) {
+  if (default_ != nullptr) {
+    default_->OnCreateConnection(connection);
+  }
+  for (auto& kv : data_managers_) {
+    kv.second->OnCreateConnection(connection);
+  }
+}
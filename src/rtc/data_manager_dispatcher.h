@@ -0,0 +1,28 @@
+#ifndef DATA_MANAGER_DISPATCHER_H_
+#define DATA_MANAGER_DISPATCHER_H_
+
+#include <map>
+#include <string>
+
+#include "data_manager.h"
+
+// DataChannel のラベル毎に RTCDataManager を振り分けるクラス。
+// ラベルが登録されていない DataChannel はデフォルトの RTCDataManager に渡す。
+// 登録は接続を始める前に済ませておくこと。
+class RTCDataManagerDispatcher : public RTCDataManager {
+ public:
+  void SetDefault(RTCDataManager* data_manager);
+  void Add(const std::string& label, RTCDataManager* data_manager);
+  bool empty() const;
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+  void OnCreateConnection(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) override;
+
+ private:
+  RTCDataManager* default_ = nullptr;
+  std::map<std::string, RTCDataManager*> data_managers_;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "deferred_i420_buffer.h"
+
+#include "frame_buffer_pool.h"
+#include "rtc_base/logging.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+DeferredI420Buffer::DeferredI420Buffer(int width, int height)
+    : width_(width), height_(height) {}
+
+DeferredI420Buffer::~DeferredI420Buffer() {}
+
+int DeferredI420Buffer::width() const {
+  return width_;
+}
+
+int DeferredI420Buffer::height() const {
+  return height_;
+}
+
+const uint8_t* DeferredI420Buffer::DataY() const {
+  return Get()->DataY();
+}
+
+const uint8_t* DeferredI420Buffer::DataU() const {
+  return Get()->DataU();
+}
+
+const uint8_t* DeferredI420Buffer::DataV() const {
+  return Get()->DataV();
+}
+
+int DeferredI420Buffer::StrideY() const {
+  return Get()->StrideY();
+}
+
+int DeferredI420Buffer::StrideU() const {
+  return Get()->StrideU();
+}
+
+int DeferredI420Buffer::StrideV() const {
+  return Get()->StrideV();
+}
+
+bool DeferredI420Buffer::ConvertTo(uint8_t* dst_y,
+                                   int dst_stride_y,
+                                   uint8_t* dst_u,
+                                   int dst_stride_u,
+                                   uint8_t* dst_v,
+                                   int dst_stride_v) const {
+  {
+    // 既に変換済みならそれをコピーする
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (converted_) {
+      libyuv::I420Copy(converted_->DataY(), converted_->StrideY(),
+                       converted_->DataU(), converted_->StrideU(),
+                       converted_->DataV(), converted_->StrideV(), dst_y,
+                       dst_stride_y, dst_u, dst_stride_u, dst_v, dst_stride_v,
+                       width_, height_);
+      return true;
+    }
+  }
+  return Convert(dst_y, dst_stride_y, dst_u, dst_stride_u, dst_v,
+                 dst_stride_v);
+}
+
+const webrtc::I420Buffer* DeferredI420Buffer::Get() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!converted_) {
+    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+        FrameBufferPool::Instance().CreateI420Buffer(width_, height_);
+    if (!Convert(buffer->MutableDataY(), buffer->StrideY(),
+                 buffer->MutableDataU(), buffer->StrideU(),
+                 buffer->MutableDataV(), buffer->StrideV())) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Convert failed";
+      webrtc::I420Buffer::SetBlack(buffer.get());
+    }
+    converted_ = buffer;
+  }
+  return converted_.get();
+}
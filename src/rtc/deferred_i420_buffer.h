@@ -0,0 +1,59 @@
+#ifndef DEFERRED_I420_BUFFER_H_
+#define DEFERRED_I420_BUFFER_H_
+
+#include <mutex>
+
+#include "api/scoped_refptr.h"
+#include "api/video/i420_buffer.h"
+#include "api/video/video_frame_buffer.h"
+
+// I420 への変換を、最初にプレーンにアクセスされるまで遅らせるバッファ。
+//
+// キャプチャしたスレッドでは変換せず、エンコーダのスレッドで変換させるために使う。
+// type() は kI420 なので、全てのエンコーダでそのまま I420 として扱える。
+// エンコーダの入力バッファに直接書き込める場合は ConvertTo() を使うとコピーが 1 回減る。
+class DeferredI420Buffer : public webrtc::I420BufferInterface {
+ public:
+  int width() const override;
+  int height() const override;
+  const uint8_t* DataY() const override;
+  const uint8_t* DataU() const override;
+  const uint8_t* DataV() const override;
+  int StrideY() const override;
+  int StrideU() const override;
+  int StrideV() const override;
+
+  // width() x height() の I420 として、指定したプレーンに直接変換する
+  bool ConvertTo(uint8_t* dst_y,
+                 int dst_stride_y,
+                 uint8_t* dst_u,
+                 int dst_stride_u,
+                 uint8_t* dst_v,
+                 int dst_stride_v) const;
+
+  // 変換前の画像を共有したまま、解像度だけを変えたバッファを返す
+  virtual rtc::scoped_refptr<DeferredI420Buffer> Scale(int width,
+                                                       int height) const = 0;
+
+ protected:
+  DeferredI420Buffer(int width, int height);
+  ~DeferredI420Buffer() override;
+
+  // 派生クラスで、元の画像を width() x height() の I420 に変換する
+  virtual bool Convert(uint8_t* dst_y,
+                       int dst_stride_y,
+                       uint8_t* dst_u,
+                       int dst_stride_u,
+                       uint8_t* dst_v,
+                       int dst_stride_v) const = 0;
+
+ private:
+  const webrtc::I420Buffer* Get() const;
+
+  const int width_;
+  const int height_;
+  mutable std::mutex mutex_;
+  mutable rtc::scoped_refptr<webrtc::I420Buffer> converted_;
+};
+
+#endif  // DEFERRED_I420_BUFFER_H_
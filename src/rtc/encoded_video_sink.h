@@ -0,0 +1,30 @@
+#ifndef ENCODED_VIDEO_SINK_H_
+#define ENCODED_VIDEO_SINK_H_
+
+#include <stdint.h>
+
+#include "api/video/encoded_image.h"
+
+// RecordingVideoEncoderFactory が作るエンコーダから、送信している H.264 を受け取るインターフェース。
+// どのメソッドもエンコーダのスレッドから呼ばれるので、待たせないこと。
+//
+// source はエンコーダを識別するためだけに使う。
+// 受け取るのは 1 つのエンコーダだけにして、AttachVideo() で他のエンコーダを断る。
+class EncodedVideoSink {
+ public:
+  virtual ~EncodedVideoSink() {}
+
+  // 受け取れるエンコーダが他に無ければ true を返す
+  virtual bool AttachVideo(const void* source) = 0;
+  virtual void DetachVideo(const void* source) = 0;
+
+  // source が次のフレームをキーフレームにするべき場合は true を返す
+  virtual bool NeedsKeyFrame(const void* source) = 0;
+
+  // capture_time_us は rtc::TimeMicros() の時刻
+  virtual void OnVideo(const void* source,
+                       const webrtc::EncodedImage& encoded_image,
+                       int64_t capture_time_us) = 0;
+};
+
+#endif  // ENCODED_VIDEO_SINK_H_
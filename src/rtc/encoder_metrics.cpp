@@ -0,0 +1,290 @@
+#include "encoder_metrics.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "frame_tracer.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 統計情報をログに出力する間隔
+const int64_t kStatsIntervalUs = 10 * rtc::kNumMicrosecsPerSec;
+// 出力されずに残っているフレームがこれを超えたら古いものから捨てる
+const size_t kMaxPendingFrames = 64;
+// 実際のビットレートを計算する期間
+const int64_t kBitrateWindowMs = 1000;
+// 出力待ちのフレームがこれを超えたら詰まっているとみなす
+const size_t kCongestedInFlightFrames = 4;
+// フレームを捨ててからこの期間は詰まっているとみなす
+const int64_t kCongestionHoldUs = 500 * rtc::kNumMicrosecsPerMillisec;
+
+// 同じ実装のエンコーダが複数ある場合に区別するための ID
+std::atomic<int> g_next_id(0);
+
+}  // namespace
+
+const std::vector<int>& EncoderMetrics::LatencyBucketsMs() {
+  static const std::vector<int> buckets = {1,  2,   5,   10,  20,  33,
+                                           50, 100, 200, 500, 1000};
+  return buckets;
+}
+
+nlohmann::json EncoderMetrics::Snapshot::ToJson() const {
+  nlohmann::json buckets = nlohmann::json::array();
+  for (size_t i = 0; i < latency_buckets.size(); i++) {
+    nlohmann::json bucket = {{"count", latency_buckets[i]}};
+    if (i < LatencyBucketsMs().size()) {
+      bucket["le_ms"] = LatencyBucketsMs()[i];
+    }
+    buckets.push_back(bucket);
+  }
+  nlohmann::json stage_timings = nlohmann::json::object();
+  for (const auto& stage : stages) {
+    const StageTiming& t = stage.second;
+    stage_timings[stage.first] = {
+        {"count", t.count},
+        {"avg_us", t.count > 0 ? t.sum_us / t.count : 0},
+        {"max_us", t.max_us},
+    };
+  }
+  return {
+      {"name", name},
+      {"frames", frames},
+      {"key_frames", key_frames},
+      {"dropped", dropped},
+      {"skipped", skipped},
+      {"coalesced_key_frame_requests", coalesced_key_frame_requests},
+      {"stall_resets", stall_resets},
+      {"bytes", bytes},
+      {"in_flight", in_flight},
+      {"latency_avg_us", frames > 0 ? latency_sum_us / frames : 0},
+      {"latency_max_us", latency_max_us},
+      {"latency_buckets", buckets},
+      {"actual_bitrate_bps", actual_bitrate_bps},
+      {"target_bitrate_bps", target_bitrate_bps},
+      {"stages", stage_timings},
+  };
+}
+
+EncoderMetrics::EncoderMetrics(std::string implementation_name)
+    : last_log_us_(rtc::TimeMicros()), bitrate_(kBitrateWindowMs, 8000) {
+  total_.name = implementation_name + "#" + std::to_string(g_next_id++);
+  total_.latency_buckets.resize(LatencyBucketsMs().size() + 1);
+  interval_ = total_;
+  EncoderMetricsRegistry::Instance().Register(this);
+}
+
+EncoderMetrics::~EncoderMetrics() {
+  EncoderMetricsRegistry::Instance().Unregister(this);
+}
+
+void EncoderMetrics::OnSubmit(uint32_t rtp_timestamp) {
+  FrameTracer::Instance().Instant("encoder.submit", rtp_timestamp);
+  std::lock_guard<std::mutex> lock(mutex_);
+  submitted_since_output_++;
+  if (pending_.size() >= kMaxPendingFrames) {
+    pending_.pop_front();
+  }
+  pending_.push_back(std::make_pair(rtp_timestamp, rtc::TimeMicros()));
+}
+
+void EncoderMetrics::OnEncoded(uint32_t rtp_timestamp,
+                               size_t size,
+                               bool key_frame) {
+  int64_t now_us = rtc::TimeMicros();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    submitted_since_output_ = 0;
+    // 出力されたフレームより前に Encode() されたフレームはエンコーダの中で捨てられている
+    int64_t submit_us = -1;
+    while (!pending_.empty()) {
+      auto front = pending_.front();
+      pending_.pop_front();
+      if (front.first == rtp_timestamp) {
+        submit_us = front.second;
+        break;
+      }
+    }
+
+    for (Snapshot* s : {&total_, &interval_}) {
+      s->frames++;
+      s->bytes += size;
+      if (key_frame) {
+        s->key_frames++;
+      }
+      if (submit_us >= 0) {
+        int64_t latency_us = now_us - submit_us;
+        s->latency_sum_us += latency_us;
+        s->latency_max_us = std::max(s->latency_max_us, latency_us);
+        const std::vector<int>& buckets = LatencyBucketsMs();
+        size_t i = std::lower_bound(buckets.begin(), buckets.end(),
+                                    (latency_us + 999) / 1000) -
+                   buckets.begin();
+        s->latency_buckets[i]++;
+      }
+    }
+    bitrate_.Update(size, now_us / rtc::kNumMicrosecsPerMillisec);
+    if (submit_us >= 0) {
+      FrameTracer::Instance().Async("encode", rtp_timestamp, submit_us, now_us);
+    }
+  }
+  MaybeLogStats(now_us);
+}
+
+void EncoderMetrics::OnDropped() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  total_.dropped++;
+  interval_.dropped++;
+  last_dropped_us_ = rtc::TimeMicros();
+}
+
+void EncoderMetrics::OnSkipped() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  total_.skipped++;
+  interval_.skipped++;
+}
+
+void EncoderMetrics::OnKeyFrameRequestCoalesced() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  total_.coalesced_key_frame_requests++;
+  interval_.coalesced_key_frame_requests++;
+}
+
+void EncoderMetrics::OnStage(const std::string& stage, int64_t elapsed_us) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (Snapshot* s : {&total_, &interval_}) {
+    StageTiming& t = s->stages[stage];
+    t.count++;
+    t.sum_us += elapsed_us;
+    t.max_us = std::max(t.max_us, elapsed_us);
+  }
+}
+
+bool EncoderMetrics::IsStalled() {
+  const int stall_frames = EncoderMetricsRegistry::Instance().stall_frames();
+  if (stall_frames <= 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return submitted_since_output_ >= stall_frames;
+}
+
+void EncoderMetrics::OnStallReset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RTC_LOG(LS_WARNING) << "EncoderMetrics " << total_.name << ": no output for "
+                      << submitted_since_output_
+                      << " frames, reinitializing the encoder";
+  total_.stall_resets++;
+  interval_.stall_resets++;
+  submitted_since_output_ = 0;
+  pending_.clear();
+}
+
+void EncoderMetrics::SetTargetBitrate(uint32_t bitrate_bps) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  total_.target_bitrate_bps = bitrate_bps;
+  interval_.target_bitrate_bps = bitrate_bps;
+}
+
+EncoderMetrics::Snapshot EncoderMetrics::GetSnapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetSnapshotLocked(rtc::TimeMillis());
+}
+
+bool EncoderMetrics::IsCongested() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_.size() > kCongestedInFlightFrames) {
+    return true;
+  }
+  return last_dropped_us_ >= 0 &&
+         rtc::TimeMicros() - last_dropped_us_ < kCongestionHoldUs;
+}
+
+EncoderMetrics::Snapshot EncoderMetrics::GetSnapshotLocked(int64_t now_ms) {
+  Snapshot snapshot = total_;
+  snapshot.in_flight = pending_.size();
+  snapshot.actual_bitrate_bps = bitrate_.Rate(now_ms).value_or(0);
+  return snapshot;
+}
+
+void EncoderMetrics::MaybeLogStats(int64_t now_us) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (now_us - last_log_us_ < kStatsIntervalUs) {
+    return;
+  }
+  Snapshot snapshot =
+      GetSnapshotLocked(now_us / rtc::kNumMicrosecsPerMillisec);
+  RTC_LOG(LS_INFO) << "EncoderMetrics " << interval_.name
+                   << ": frames=" << interval_.frames
+                   << " key_frames=" << interval_.key_frames
+                   << " dropped=" << interval_.dropped
+                   << " skipped=" << interval_.skipped
+                   << " in_flight=" << snapshot.in_flight
+                   << " latency_avg_us="
+                   << (interval_.frames > 0
+                           ? interval_.latency_sum_us / interval_.frames
+                           : 0)
+                   << " latency_max_us=" << interval_.latency_max_us
+                   << " bitrate_bps=" << snapshot.actual_bitrate_bps << "/"
+                   << snapshot.target_bitrate_bps;
+  for (const auto& stage : interval_.stages) {
+    const StageTiming& t = stage.second;
+    RTC_LOG(LS_INFO) << "EncoderMetrics " << interval_.name
+                     << ": stage=" << stage.first << " count=" << t.count
+                     << " avg_us=" << (t.count > 0 ? t.sum_us / t.count : 0)
+                     << " max_us=" << t.max_us;
+  }
+
+  std::string name = interval_.name;
+  uint32_t target_bitrate_bps = interval_.target_bitrate_bps;
+  interval_ = Snapshot();
+  interval_.name = name;
+  interval_.target_bitrate_bps = target_bitrate_bps;
+  interval_.latency_buckets.resize(LatencyBucketsMs().size() + 1);
+  last_log_us_ = now_us;
+}
+
+EncoderMetricsRegistry& EncoderMetricsRegistry::Instance() {
+  static EncoderMetricsRegistry instance;
+  return instance;
+}
+
+void EncoderMetricsRegistry::Register(EncoderMetrics* metrics) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metrics_.push_back(metrics);
+}
+
+void EncoderMetricsRegistry::Unregister(EncoderMetrics* metrics) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  metrics_.erase(std::remove(metrics_.begin(), metrics_.end(), metrics),
+                 metrics_.end());
+}
+
+std::vector<EncoderMetrics::Snapshot> EncoderMetricsRegistry::GetSnapshots() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<EncoderMetrics::Snapshot> snapshots;
+  for (EncoderMetrics* metrics : metrics_) {
+    snapshots.push_back(metrics->GetSnapshot());
+  }
+  return snapshots;
+}
+
+bool EncoderMetricsRegistry::IsCongested() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (EncoderMetrics* metrics : metrics_) {
+    if (metrics->IsCongested()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+nlohmann::json EncoderMetricsRegistry::ToJson() {
+  nlohmann::json encoders = nlohmann::json::array();
+  for (const EncoderMetrics::Snapshot& snapshot : GetSnapshots()) {
+    encoders.push_back(snapshot.ToJson());
+  }
+  return {{"encoders", encoders}};
+}
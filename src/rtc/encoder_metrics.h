@@ -0,0 +1,132 @@
+#ifndef ENCODER_METRICS_H_
+#define ENCODER_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "rtc_base/rate_statistics.h"
+
+// エンコーダ毎の統計情報。
+//
+// Encode() に渡されたフレームが EncodedImageCallback に出力されるまでの時間をヒストグラムで集計し、
+// エンコード中のフレーム数、捨てたフレーム数、キーフレーム数、実際のビットレートと目標ビットレートを記録する。
+// 生成すると EncoderMetricsRegistry に登録され、破棄すると登録が解除される。
+//
+// 各メソッドは任意のスレッドから呼び出して良い。
+class EncoderMetrics {
+ public:
+  // レイテンシのヒストグラムのバケットの上限 (ミリ秒)。最後のバケットはそれ以上になる。
+  static const std::vector<int>& LatencyBucketsMs();
+
+  // エンコーダの中の 1 段の処理にかかった時間
+  struct StageTiming {
+    int64_t count = 0;
+    int64_t sum_us = 0;
+    int64_t max_us = 0;
+  };
+
+  struct Snapshot {
+    std::string name;
+    int64_t frames = 0;
+    int64_t key_frames = 0;
+    // エンコーダ側の都合で捨てたフレーム数
+    int64_t dropped = 0;
+    // WebRTC からエンコード不要と指示されたフレーム数
+    int64_t skipped = 0;
+    // KeyFrameThrottle によって IDR を送らなかったキーフレームの要求の数
+    int64_t coalesced_key_frame_requests = 0;
+    // 出力が止まったのでエンコーダを作り直した回数
+    int64_t stall_resets = 0;
+    int64_t bytes = 0;
+    // Encode() されたが、まだ出力されていないフレーム数
+    size_t in_flight = 0;
+    int64_t latency_sum_us = 0;
+    int64_t latency_max_us = 0;
+    // LatencyBucketsMs() の各バケットに入ったフレーム数 (累積ではない)
+    std::vector<int64_t> latency_buckets;
+    int64_t actual_bitrate_bps = 0;
+    uint32_t target_bitrate_bps = 0;
+    // OnStage() で記録した段毎の時間。キーは段の名前
+    std::map<std::string, StageTiming> stages;
+
+    nlohmann::json ToJson() const;
+  };
+
+  explicit EncoderMetrics(std::string implementation_name);
+  ~EncoderMetrics();
+
+  // Encode() でエンコーダにフレームを渡した
+  void OnSubmit(uint32_t rtp_timestamp);
+  // エンコードしたフレームを EncodedImageCallback に渡した
+  void OnEncoded(uint32_t rtp_timestamp, size_t size, bool key_frame);
+  void OnDropped();
+  void OnSkipped();
+  void OnKeyFrameRequestCoalesced();
+  // デコードや色変換など、エンコーダの中の段の処理に elapsed_us かかった
+  void OnStage(const std::string& stage, int64_t elapsed_us);
+  // 最後に出力してから、EncoderMetricsRegistry::SetStallFrames() で指定した数以上の
+  // フレームを Encode() したのに何も出力されていない場合に true を返す
+  bool IsStalled();
+  // IsStalled() だったのでエンコーダを作り直した。出力待ちのフレームは忘れる
+  void OnStallReset();
+  void SetTargetBitrate(uint32_t bitrate_bps);
+
+  Snapshot GetSnapshot();
+  // 最近フレームを捨てたか、出力待ちのフレームが溜まっていてエンコードが追いついていない
+  bool IsCongested();
+
+ private:
+  Snapshot GetSnapshotLocked(int64_t now_ms);
+  void MaybeLogStats(int64_t now_us);
+
+  std::mutex mutex_;
+  Snapshot total_;
+  // ログに出力するための、前回出力してからの集計
+  Snapshot interval_;
+  int64_t last_log_us_;
+  // OnSubmit() された時刻。Encode() された順番に並んでいる
+  std::deque<std::pair<uint32_t, int64_t>> pending_;
+  webrtc::RateStatistics bitrate_;
+  // 最後に OnDropped() された時刻
+  int64_t last_dropped_us_ = -1;
+  // 最後に OnEncoded() されてから OnSubmit() された数
+  int submitted_since_output_ = 0;
+};
+
+// 生成されている全てのエンコーダの統計情報を取得するためのクラス
+class EncoderMetricsRegistry {
+ public:
+  static EncoderMetricsRegistry& Instance();
+
+  void Register(EncoderMetrics* metrics);
+  void Unregister(EncoderMetrics* metrics);
+
+  std::vector<EncoderMetrics::Snapshot> GetSnapshots();
+  nlohmann::json ToJson();
+  // どれか 1 つでもエンコーダが詰まっている場合に true を返す
+  bool IsCongested();
+
+  // 0 より大きい場合、出力が無いままこの数のフレームを Encode() したエンコーダは作り直す
+  void SetStallFrames(int frames) { stall_frames_ = frames; }
+  int stall_frames() const { return stall_frames_; }
+
+ private:
+  EncoderMetricsRegistry() = default;
+
+  std::atomic<int> stall_frames_{0};
+
+  std::mutex mutex_;
+  std::vector<EncoderMetrics*> metrics_;
+};
+
+#endif  // ENCODER_METRICS_H_
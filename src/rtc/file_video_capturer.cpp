@@ -0,0 +1,457 @@
+#include "file_video_capturer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem/path.hpp>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "api/video/i420_buffer.h"
+#include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "frame_buffer_pool.h"
+#include "native_buffer.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+#include "thread_placement.h"
+
+// ファイル全体を読み取り専用でメモリにマップする。
+// mmap が無い環境では全体を読み込んでおく
+class FileVideoCapturer::MappedFile {
+ public:
+  static std::unique_ptr<MappedFile> Open(const std::string& path) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+#if defined(_WIN32)
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+      RTC_LOG(LS_ERROR) << "Failed to open " << path;
+      return nullptr;
+    }
+    file->buffer_.assign(std::istreambuf_iterator<char>(ifs),
+                         std::istreambuf_iterator<char>());
+    file->data_ = reinterpret_cast<const uint8_t*>(file->buffer_.data());
+    file->size_ = file->buffer_.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to open " << path << ": " << strerror(errno);
+      return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+      RTC_LOG(LS_ERROR) << "Failed to get the size of " << path;
+      close(fd);
+      return nullptr;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      RTC_LOG(LS_ERROR) << "Failed to mmap " << path << ": " << strerror(errno);
+      return nullptr;
+    }
+    // 先頭から順に読んでいくので、先読みさせておく
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    file->data_ = static_cast<const uint8_t*>(p);
+    file->size_ = st.st_size;
+#endif
+    return file;
+  }
+
+  ~MappedFile() {
+#if !defined(_WIN32)
+    if (data_ != nullptr) {
+      munmap(const_cast<uint8_t*>(data_), size_);
+    }
+#endif
+  }
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile() = default;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+#if defined(_WIN32)
+  std::string buffer_;
+#endif
+};
+
+rtc::scoped_refptr<FileVideoCapturer> FileVideoCapturer::Create(
+    const ConnectionSettings& cs) {
+  rtc::scoped_refptr<FileVideoCapturer> capturer(
+      new rtc::RefCountedObject<FileVideoCapturer>());
+  if (!capturer->Init(cs)) {
+    return nullptr;
+  }
+  return capturer;
+}
+
+FileVideoCapturer::FileVideoCapturer() {}
+
+FileVideoCapturer::~FileVideoCapturer() {
+  if (capture_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cond_.notify_all();
+    capture_thread_->Stop();
+    capture_thread_.reset();
+  }
+}
+
+bool FileVideoCapturer::Init(const ConnectionSettings& cs) {
+  ConnectionSettings settings = cs;
+  auto size = settings.getSize();
+  width_ = size.width;
+  height_ = size.height;
+  framerate_ = std::max(1, cs.framerate);
+  use_native_ = cs.use_native;
+
+  if (!cs.video_pattern.empty()) {
+    if (cs.video_pattern == "bars") {
+      format_ = Format::kBars;
+    } else if (cs.video_pattern == "noise") {
+      format_ = Format::kNoise;
+    } else {
+      RTC_LOG(LS_ERROR) << "Unknown video pattern: " << cs.video_pattern;
+      return false;
+    }
+  } else {
+    file_ = MappedFile::Open(cs.video_file);
+    if (!file_) {
+      return false;
+    }
+    std::string ext = boost::algorithm::to_lower_copy(
+        boost::filesystem::path(cs.video_file).extension().string());
+    bool result;
+    if (ext == ".y4m") {
+      result = IndexY4M();
+    } else if (ext == ".mjpeg" || ext == ".mjpg") {
+      result = IndexMJPEG();
+    } else {
+      result = IndexI420();
+    }
+    if (!result) {
+      RTC_LOG(LS_ERROR) << "Failed to read frames from " << cs.video_file;
+      return false;
+    }
+    RTC_LOG(LS_INFO) << "Loaded " << frames_.size() << " frames ("
+                     << width_ << "x" << height_ << ") from "
+                     << cs.video_file;
+  }
+
+  capture_thread_.reset(new rtc::PlatformThread(
+      FileVideoCapturer::CaptureThread, this, "FileCapture",
+      rtc::kHighPriority));
+  capture_thread_->Start();
+  return true;
+}
+
+// YUV4MPEG2 W640 H480 F30:1 Ip A1:1 C420jpeg\n の後に
+// FRAME\n とフレームのデータが続く
+bool FileVideoCapturer::IndexY4M() {
+  const char* data = reinterpret_cast<const char*>(file_->data());
+  const size_t size = file_->size();
+  const char* end = static_cast<const char*>(memchr(data, '\n', size));
+  if (end == nullptr || size < 10 || memcmp(data, "YUV4MPEG2 ", 10) != 0) {
+    return false;
+  }
+  std::string header(data, end);
+  size_t pos = 0;
+  while (pos < header.size()) {
+    size_t next = header.find(' ', pos);
+    if (next == std::string::npos) {
+      next = header.size();
+    }
+    std::string param = header.substr(pos, next - pos);
+    pos = next + 1;
+    if (param.empty()) {
+      continue;
+    }
+    if (param[0] == 'W') {
+      width_ = atoi(param.c_str() + 1);
+    } else if (param[0] == 'H') {
+      height_ = atoi(param.c_str() + 1);
+    } else if (param[0] == 'C' && param.compare(0, 4, "C420") != 0) {
+      RTC_LOG(LS_ERROR) << "Unsupported Y4M colorspace: " << param;
+      return false;
+    }
+  }
+  if (width_ <= 0 || height_ <= 0) {
+    return false;
+  }
+  format_ = Format::kI420;
+  const size_t frame_size =
+      webrtc::CalcBufferSize(webrtc::VideoType::kI420, width_, height_);
+  size_t offset = end - data + 1;
+  while (offset + 5 <= size && memcmp(data + offset, "FRAME", 5) == 0) {
+    const char* frame_end = static_cast<const char*>(
+        memchr(data + offset, '\n', size - offset));
+    if (frame_end == nullptr) {
+      break;
+    }
+    offset = frame_end - data + 1;
+    if (offset + frame_size > size) {
+      break;
+    }
+    frames_.push_back({offset, frame_size});
+    offset += frame_size;
+  }
+  return !frames_.empty();
+}
+
+// 各フレームは SOI (FF D8 FF) から始まるので、そこで区切る
+bool FileVideoCapturer::IndexMJPEG() {
+  const uint8_t* data = file_->data();
+  const size_t size = file_->size();
+  std::vector<size_t> starts;
+  for (size_t i = 0; i + 3 <= size; i++) {
+    if (data[i] == 0xff && data[i + 1] == 0xd8 && data[i + 2] == 0xff) {
+      starts.push_back(i);
+    }
+  }
+  for (size_t i = 0; i < starts.size(); i++) {
+    const size_t next = i + 1 < starts.size() ? starts[i + 1] : size;
+    frames_.push_back({starts[i], next - starts[i]});
+  }
+  if (frames_.empty() ||
+      libyuv::MJPGSize(data + frames_[0].offset, frames_[0].size, &width_,
+                       &height_) != 0) {
+    return false;
+  }
+  format_ = Format::kMJPEG;
+  return true;
+}
+
+bool FileVideoCapturer::IndexI420() {
+  const size_t frame_size =
+      webrtc::CalcBufferSize(webrtc::VideoType::kI420, width_, height_);
+  for (size_t offset = 0; offset + frame_size <= file_->size();
+       offset += frame_size) {
+    frames_.push_back({offset, frame_size});
+  }
+  format_ = Format::kI420;
+  return !frames_.empty();
+}
+
+void FileVideoCapturer::CaptureThread(void* obj) {
+  ThreadPlacement::Instance().Apply("capture");
+  static_cast<FileVideoCapturer*>(obj)->CaptureLoop();
+}
+
+void FileVideoCapturer::CaptureLoop() {
+  const int64_t interval_us = rtc::kNumMicrosecsPerSec / framerate_;
+  int64_t next_us = rtc::TimeMicros();
+  for (int64_t number = 0;; number++) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::microseconds(next_us - rtc::TimeMicros());
+      if (cond_.wait_until(lock, deadline, [this] { return quit_; })) {
+        return;
+      }
+    }
+    const int64_t now_us = rtc::TimeMicros();
+    next_us += interval_us;
+    // 変換が間に合わなかった場合に、まとめて流して取り戻そうとしない
+    if (now_us - next_us > interval_us) {
+      next_us = now_us;
+    }
+
+    if (ShouldSkipFrame()) {
+      continue;
+    }
+    auto buffer = CreateFrame(number);
+    if (!buffer) {
+      continue;
+    }
+    webrtc::VideoFrame video_frame =
+        webrtc::VideoFrame::Builder()
+            .set_video_frame_buffer(buffer)
+            .set_timestamp_rtp(0)
+            .set_timestamp_ms(now_us / rtc::kNumMicrosecsPerMillisec)
+            .set_timestamp_us(now_us)
+            .set_rotation(webrtc::kVideoRotation_0)
+            .build();
+    OnCapturedFrame(video_frame);
+  }
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> FileVideoCapturer::CreateFrame(
+    int64_t number) {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  if (file_) {
+    const FrameRange& range = frames_[number % frames_.size()];
+    data = file_->data() + range.offset;
+    size = range.size;
+  }
+
+  if (format_ == Format::kMJPEG && use_native_) {
+    rtc::scoped_refptr<NativeBuffer> native_buffer =
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            webrtc::VideoType::kMJPEG, width_, height_);
+    size = std::min<size_t>(size, width_ * height_ * 4);
+    memcpy(native_buffer->MutableData(), data, size);
+    native_buffer->SetLength(size);
+    return native_buffer;
+  }
+
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+      FrameBufferPool::Instance().CreateI420Buffer(width_, height_);
+  if (format_ == Format::kMJPEG) {
+    if (libyuv::ConvertToI420(
+            data, size, i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+            i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+            i420_buffer->MutableDataV(), i420_buffer->StrideV(), 0, 0, width_,
+            height_, width_, height_, libyuv::kRotate0,
+            libyuv::FOURCC_MJPG) < 0) {
+      RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
+      return nullptr;
+    }
+    return i420_buffer;
+  }
+
+  const uint8_t* src_y = data;
+  const uint8_t* src_u = data + width_ * height_;
+  const uint8_t* src_v = src_u + ((width_ + 1) / 2) * ((height_ + 1) / 2);
+  const int src_stride_y = width_;
+  const int src_stride_uv = (width_ + 1) / 2;
+  if (!file_) {
+    // パターンはプールのバッファに直接書き、use_native の場合はそこから NV12 に変換する
+    DrawPattern(number, i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+                i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+                i420_buffer->MutableDataV(), i420_buffer->StrideV());
+    if (!use_native_) {
+      return i420_buffer;
+    }
+    src_y = i420_buffer->DataY();
+    src_u = i420_buffer->DataU();
+    src_v = i420_buffer->DataV();
+  }
+
+  if (use_native_) {
+    rtc::scoped_refptr<NativeBuffer> native_buffer =
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            webrtc::VideoType::kNV12, width_, height_);
+    libyuv::I420ToNV12(
+        src_y, file_ ? src_stride_y : i420_buffer->StrideY(), src_u,
+        file_ ? src_stride_uv : i420_buffer->StrideU(), src_v,
+        file_ ? src_stride_uv : i420_buffer->StrideV(),
+        native_buffer->MutableDataY(), native_buffer->StrideY(),
+        native_buffer->MutableDataUV(), native_buffer->StrideUV(), width_,
+        height_);
+    native_buffer->SetLength(
+        webrtc::CalcBufferSize(webrtc::VideoType::kNV12, width_, height_));
+    return native_buffer;
+  }
+
+  libyuv::I420Copy(src_y, src_stride_y, src_u, src_stride_uv, src_v,
+                   src_stride_uv, i420_buffer->MutableDataY(),
+                   i420_buffer->StrideY(), i420_buffer->MutableDataU(),
+                   i420_buffer->StrideU(), i420_buffer->MutableDataV(),
+                   i420_buffer->StrideV(), width_, height_);
+  return i420_buffer;
+}
+
+void FileVideoCapturer::DrawPattern(int64_t number,
+                                    uint8_t* y,
+                                    int stride_y,
+                                    uint8_t* u,
+                                    int stride_u,
+                                    uint8_t* v,
+                                    int stride_v) {
+  const int chroma_width = (width_ + 1) / 2;
+  const int chroma_height = (height_ + 1) / 2;
+
+  if (format_ == Format::kNoise) {
+    // エンコーダにとって一番重い入力。フレーム番号から決まるので毎回同じになる
+    uint64_t state = 0x9e3779b97f4a7c15ULL * (number + 1);
+    auto next = [&state]() {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      return state;
+    };
+    auto fill = [&next](uint8_t* plane, int stride, int w, int h) {
+      for (int row = 0; row < h; row++) {
+        uint8_t* p = plane + row * stride;
+        for (int x = 0; x < w; x += 8) {
+          uint64_t r = next();
+          memcpy(p + x, &r, std::min(8, w - x));
+        }
+      }
+    };
+    fill(y, stride_y, width_, height_);
+    fill(u, stride_u, chroma_width, chroma_height);
+    fill(v, stride_v, chroma_width, chroma_height);
+    return;
+  }
+
+  // 75% のカラーバー (白, 黄, シアン, 緑, マゼンタ, 赤, 青, 黒) の BT.601 の値
+  static const uint8_t kBars[8][3] = {
+      {180, 128, 128}, {162, 44, 142}, {131, 156, 44}, {112, 72, 58},
+      {84, 184, 198},  {65, 100, 212}, {35, 212, 114}, {16, 128, 128}};
+  // 1 行目だけ計算して、残りの行はそれをコピーする
+  for (int x = 0; x < width_; x++) {
+    y[x] = kBars[x * 8 / width_][0];
+  }
+  for (int x = 0; x < chroma_width; x++) {
+    const int bar = x * 8 / chroma_width;
+    u[x] = kBars[bar][1];
+    v[x] = kBars[bar][2];
+  }
+  for (int row = 1; row < height_; row++) {
+    memcpy(y + row * stride_y, y, width_);
+  }
+  for (int row = 1; row < chroma_height; row++) {
+    memcpy(u + row * stride_u, u, chroma_width);
+    memcpy(v + row * stride_v, v, chroma_width);
+  }
+
+  // 動きがあるように、白い四角をフレーム毎に横へ動かす
+  const int box = std::max(16, height_ / 8) & ~1;
+  const int box_x =
+      static_cast<int>((number * 8) % std::max(1, width_ - box)) & ~1;
+  const int box_y = (height_ - box) / 2 & ~1;
+  for (int row = box_y; row < box_y + box && row < height_; row++) {
+    memset(y + row * stride_y + box_x, 235, std::min(box, width_ - box_x));
+  }
+  for (int row = box_y / 2; row < (box_y + box) / 2 && row < chroma_height;
+       row++) {
+    const int w = std::min(box / 2, chroma_width - box_x / 2);
+    memset(u + row * stride_u + box_x / 2, 128, w);
+    memset(v + row * stride_v + box_x / 2, 128, w);
+  }
+
+  // 受信側でフレームを特定できるように、下端にフレーム番号を 32 ビットの白黒で描く
+  const int bit_width = std::max(2, width_ / 32) & ~1;
+  const int bit_height = std::min(height_, 16);
+  for (int bit = 0; bit < 32 && (bit + 1) * bit_width <= width_; bit++) {
+    const uint8_t value = (number >> (31 - bit)) & 1 ? 235 : 16;
+    for (int row = height_ - bit_height; row < height_; row++) {
+      memset(y + row * stride_y + bit * bit_width, value, bit_width);
+    }
+    for (int row = (height_ - bit_height) / 2; row < chroma_height; row++) {
+      memset(u + row * stride_u + bit * bit_width / 2, 128, bit_width / 2);
+      memset(v + row * stride_v + bit * bit_width / 2, 128, bit_width / 2);
+    }
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef FILE_VIDEO_CAPTURER_H_
+#define FILE_VIDEO_CAPTURER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame_buffer.h"
+#include "connection_settings.h"
+#include "rtc_base/platform_thread.h"
+#include "scalable_track_source.h"
+
+// カメラの代わりに、ファイルの映像や生成したパターンを決まったフレームレートで流す。
+// 同じ入力で何度でも計測できるようにするためのもので、ファイルは最後まで流すと先頭に戻る。
+//
+// ファイルはメモリにマップして、フレーム毎に読み込まずにそこから直接変換する。
+// 対応している形式は拡張子で決める。
+//   .y4m          : YUV4MPEG2 (4:2:0 のみ)
+//   .mjpeg, .mjpg : JPEG を連結したもの
+//   それ以外       : 解像度が --resolution の I420 を連結したもの
+//
+// use_native の場合は I420 の代わりに NativeBuffer を渡す。
+// MJPEG はデコードせずにそのまま、それ以外は NV12 にして渡すので、ハードウェアエンコーダの
+// ネイティブバッファの経路もカメラ無しで計測できる。
+class FileVideoCapturer : public ScalableVideoTrackSource {
+ public:
+  // cs.video_file か cs.video_pattern を流す。開けない場合は nullptr を返す
+  static rtc::scoped_refptr<FileVideoCapturer> Create(
+      const ConnectionSettings& cs);
+  ~FileVideoCapturer() override;
+
+ protected:
+  FileVideoCapturer();
+
+  bool useNativeBuffer() override { return use_native_; }
+
+ private:
+  class MappedFile;
+
+  enum class Format { kI420, kMJPEG, kBars, kNoise };
+  struct FrameRange {
+    size_t offset;
+    size_t size;
+  };
+
+  bool Init(const ConnectionSettings& cs);
+  bool IndexY4M();
+  bool IndexMJPEG();
+  bool IndexI420();
+
+  static void CaptureThread(void* obj);
+  void CaptureLoop();
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> CreateFrame(int64_t number);
+  // number 番目のパターンを I420 で書く
+  void DrawPattern(int64_t number,
+                   uint8_t* y,
+                   int stride_y,
+                   uint8_t* u,
+                   int stride_u,
+                   uint8_t* v,
+                   int stride_v);
+
+  Format format_ = Format::kI420;
+  bool use_native_ = false;
+  int width_ = 0;
+  int height_ = 0;
+  int framerate_ = 30;
+  std::unique_ptr<MappedFile> file_;
+  std::vector<FrameRange> frames_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool quit_ = false;
+  std::unique_ptr<rtc::PlatformThread> capture_thread_;
+};
+
+#endif  // FILE_VIDEO_CAPTURER_H_
@@ -0,0 +1,94 @@
+#ifndef FORWARDING_AUDIO_ENCODER_H_
+#define FORWARDING_AUDIO_ENCODER_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "api/audio_codecs/audio_encoder.h"
+
+// 全ての呼び出しを内側のエンコーダにそのまま渡すエンコーダ。
+// 一部の処理だけを変えたいラッパーはこれを継承して必要なものだけ上書きする
+class ForwardingAudioEncoder : public webrtc::AudioEncoder {
+ public:
+  explicit ForwardingAudioEncoder(std::unique_ptr<webrtc::AudioEncoder> encoder)
+      : encoder_(std::move(encoder)) {}
+
+  int SampleRateHz() const override { return encoder_->SampleRateHz(); }
+  size_t NumChannels() const override { return encoder_->NumChannels(); }
+  int RtpTimestampRateHz() const override {
+    return encoder_->RtpTimestampRateHz();
+  }
+  size_t Num10MsFramesInNextPacket() const override {
+    return encoder_->Num10MsFramesInNextPacket();
+  }
+  size_t Max10MsFramesInAPacket() const override {
+    return encoder_->Max10MsFramesInAPacket();
+  }
+  int GetTargetBitrate() const override {
+    return encoder_->GetTargetBitrate();
+  }
+  void Reset() override { encoder_->Reset(); }
+  bool SetFec(bool enable) override { return encoder_->SetFec(enable); }
+  bool SetDtx(bool enable) override { return encoder_->SetDtx(enable); }
+  bool GetDtx() const override { return encoder_->GetDtx(); }
+  bool SetApplication(Application application) override {
+    return encoder_->SetApplication(application);
+  }
+  void SetMaxPlaybackRate(int frequency_hz) override {
+    encoder_->SetMaxPlaybackRate(frequency_hz);
+  }
+  rtc::ArrayView<std::unique_ptr<webrtc::AudioEncoder>>
+  ReclaimContainedEncoders() override {
+    return rtc::ArrayView<std::unique_ptr<webrtc::AudioEncoder>>(&encoder_, 1);
+  }
+  bool EnableAudioNetworkAdaptor(const std::string& config_string,
+                                 webrtc::RtcEventLog* event_log) override {
+    return encoder_->EnableAudioNetworkAdaptor(config_string, event_log);
+  }
+  void DisableAudioNetworkAdaptor() override {
+    encoder_->DisableAudioNetworkAdaptor();
+  }
+  void OnReceivedUplinkPacketLossFraction(
+      float uplink_packet_loss_fraction) override {
+    encoder_->OnReceivedUplinkPacketLossFraction(uplink_packet_loss_fraction);
+  }
+  void OnReceivedTargetAudioBitrate(int target_bps) override {
+    encoder_->OnReceivedTargetAudioBitrate(target_bps);
+  }
+  void OnReceivedUplinkBandwidth(
+      int target_audio_bitrate_bps,
+      absl::optional<int64_t> bwe_period_ms) override {
+    encoder_->OnReceivedUplinkBandwidth(target_audio_bitrate_bps,
+                                        bwe_period_ms);
+  }
+  void OnReceivedUplinkAllocation(
+      webrtc::BitrateAllocationUpdate update) override {
+    encoder_->OnReceivedUplinkAllocation(update);
+  }
+  void OnReceivedRtt(int rtt_ms) override { encoder_->OnReceivedRtt(rtt_ms); }
+  void OnReceivedOverhead(size_t overhead_bytes_per_packet) override {
+    encoder_->OnReceivedOverhead(overhead_bytes_per_packet);
+  }
+  void SetReceiverFrameLengthRange(int min_frame_length_ms,
+                                   int max_frame_length_ms) override {
+    encoder_->SetReceiverFrameLengthRange(min_frame_length_ms,
+                                          max_frame_length_ms);
+  }
+  ANAStats GetANAStats() const override { return encoder_->GetANAStats(); }
+  absl::optional<std::pair<webrtc::TimeDelta, webrtc::TimeDelta>>
+  GetFrameLengthRange() const override {
+    return encoder_->GetFrameLengthRange();
+  }
+
+ protected:
+  EncodedInfo EncodeImpl(uint32_t rtp_timestamp,
+                         rtc::ArrayView<const int16_t> audio,
+                         rtc::Buffer* encoded) override {
+    return encoder_->Encode(rtp_timestamp, audio, encoded);
+  }
+
+  std::unique_ptr<webrtc::AudioEncoder> encoder_;
+};
+
+#endif  // FORWARDING_AUDIO_ENCODER_H_
@@ -0,0 +1,77 @@
+#include "frame_buffer_pool.h"
+
+#include <algorithm>
+
+FrameBufferPool& FrameBufferPool::Instance() {
+  static FrameBufferPool instance;
+  return instance;
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> FrameBufferPool::CreateI420Buffer(
+    int width,
+    int height) {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = i420_entries_[I420Key(width, height)];
+    entry.last_used = ++tick_;
+    if (!entry.pool) {
+      entry.pool.reset(
+          new webrtc::I420BufferPool(false, kMaxBuffersPerSize));
+      Evict(i420_entries_);
+    }
+    buffer = entry.pool->CreateBuffer(width, height);
+  }
+  if (!buffer) {
+    // プールの上限に達している
+    buffer = webrtc::I420Buffer::Create(width, height);
+  }
+  return buffer;
+}
+
+rtc::scoped_refptr<NativeBuffer> FrameBufferPool::CreateNativeBuffer(
+    webrtc::VideoType video_type,
+    int width,
+    int height) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = native_entries_[NativeKey(video_type, width, height)];
+  bool inserted = entry.last_used == 0;
+  entry.last_used = ++tick_;
+
+  for (const auto& buffer : entry.buffers) {
+    // プールからしか参照されていないバッファは再利用できる
+    if (buffer->HasOneRef()) {
+      buffer->SetScaledSize(width, height);
+      return buffer;
+    }
+  }
+
+  rtc::scoped_refptr<PooledNativeBuffer> buffer =
+      new PooledNativeBuffer(video_type, width, height);
+  if (entry.buffers.size() < kMaxBuffersPerSize) {
+    entry.buffers.push_back(buffer);
+  }
+  if (inserted) {
+    Evict(native_entries_);
+  }
+  return buffer;
+}
+
+void FrameBufferPool::Release() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  i420_entries_.clear();
+  native_entries_.clear();
+}
+
+template <class Map>
+void FrameBufferPool::Evict(Map& entries) {
+  while (entries.size() > kMaxSizes) {
+    auto it = std::min_element(entries.begin(), entries.end(),
+                               [](const typename Map::value_type& a,
+                                  const typename Map::value_type& b) {
+                                 return a.second.last_used <
+                                        b.second.last_used;
+                               });
+    entries.erase(it);
+  }
+}
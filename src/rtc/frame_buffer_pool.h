@@ -0,0 +1,68 @@
+#ifndef FRAME_BUFFER_POOL_H_
+#define FRAME_BUFFER_POOL_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#include "api/scoped_refptr.h"
+#include "api/video/i420_buffer.h"
+#include "common_video/include/i420_buffer_pool.h"
+#include "native_buffer.h"
+#include "rtc_base/ref_counted_object.h"
+
+// フレームバッファを解像度ごとに使い回すためのプール。
+//
+// 全てのキャプチャラーと ScalableVideoTrackSource から共有して利用する。
+// 下流で保持されているバッファは再利用されないので、返ってきたバッファはすぐに書き込んで良い。
+// プールの上限を超えた場合は新しく確保したバッファを返す。
+// 任意のスレッドから呼び出して良い。
+class FrameBufferPool {
+ public:
+  static FrameBufferPool& Instance();
+
+  rtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(int width,
+                                                          int height);
+  rtc::scoped_refptr<NativeBuffer> CreateNativeBuffer(
+      webrtc::VideoType video_type,
+      int width,
+      int height);
+
+  // 全てのプールを解放する。使用中のバッファは参照が無くなった時点で解放される。
+  void Release();
+
+ private:
+  FrameBufferPool() = default;
+
+  // 解像度を変更しながら動かしていると古いサイズのバッファが溜まっていくので、
+  // 最近使ったサイズだけを保持する
+  static const size_t kMaxSizes = 4;
+  static const size_t kMaxBuffersPerSize = 8;
+
+  typedef std::pair<int, int> I420Key;
+  typedef std::tuple<webrtc::VideoType, int, int> NativeKey;
+  typedef rtc::RefCountedObject<NativeBuffer> PooledNativeBuffer;
+
+  struct I420Entry {
+    uint64_t last_used;
+    std::unique_ptr<webrtc::I420BufferPool> pool;
+  };
+  struct NativeEntry {
+    uint64_t last_used;
+    std::list<rtc::scoped_refptr<PooledNativeBuffer>> buffers;
+  };
+
+  template <class Map>
+  void Evict(Map& entries);
+
+  std::mutex mutex_;
+  uint64_t tick_ = 0;
+  std::map<I420Key, I420Entry> i420_entries_;
+  std::map<NativeKey, NativeEntry> native_entries_;
+};
+
+#endif  // FRAME_BUFFER_POOL_H_
@@ -0,0 +1,198 @@
+#include "frame_tracer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+#include <nlohmann/json.hpp>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/platform_thread_types.h"
+#include "rtc_base/time_utils.h"
+
+// スレッドが終了した時にバッファを返す
+class FrameTracer::ThreadSlot {
+ public:
+  ~ThreadSlot() {
+    if (buffer != nullptr) {
+      buffer->in_use.store(false, std::memory_order_release);
+    }
+  }
+  Buffer* buffer = nullptr;
+};
+
+FrameTracer& FrameTracer::Instance() {
+  static FrameTracer instance;
+  return instance;
+}
+
+void FrameTracer::Configure(size_t events_per_thread) {
+  capacity_ = events_per_thread;
+}
+
+void FrameTracer::Instant(const char* name, int64_t frame) {
+  if (!enabled()) {
+    return;
+  }
+  const int64_t now_us = rtc::TimeMicros();
+  Add({name, Phase::kInstant, 0, frame, now_us, now_us});
+}
+
+void FrameTracer::Complete(const char* name,
+                           int64_t frame,
+                           int64_t start_us,
+                           int64_t end_us) {
+  if (!enabled()) {
+    return;
+  }
+  Add({name, Phase::kComplete, 0, frame, start_us, end_us});
+}
+
+void FrameTracer::Async(const char* name,
+                        int64_t frame,
+                        int64_t start_us,
+                        int64_t end_us) {
+  if (!enabled()) {
+    return;
+  }
+  Add({name, Phase::kAsync, 0, frame, start_us, end_us});
+}
+
+void FrameTracer::Add(const Event& event) {
+  static thread_local ThreadSlot slot;
+  static thread_local int tid = static_cast<int>(rtc::CurrentThreadId());
+  if (slot.buffer == nullptr) {
+    slot.buffer = AcquireBuffer(tid);
+  }
+  Buffer* buffer = slot.buffer;
+  // 書き込むのはこのスレッドだけなので、数を増やす前に書いておけば良い
+  const uint64_t count = buffer->count.load(std::memory_order_relaxed);
+  Event& e = buffer->events[count % capacity_];
+  e = event;
+  e.tid = tid;
+  buffer->count.store(count + 1, std::memory_order_release);
+}
+
+FrameTracer::Buffer* FrameTracer::AcquireBuffer(int tid) {
+  std::string name;
+#if defined(__linux__)
+  char buf[16] = {};
+  if (pthread_getname_np(pthread_self(), buf, sizeof(buf)) == 0) {
+    name = buf;
+  }
+#endif
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!name.empty()) {
+    thread_names_[tid] = name;
+  }
+  for (const auto& buffer : buffers_) {
+    bool in_use = false;
+    if (buffer->in_use.compare_exchange_strong(in_use, true,
+                                               std::memory_order_acquire)) {
+      return buffer.get();
+    }
+  }
+  std::unique_ptr<Buffer> buffer(new Buffer());
+  buffer->events.reset(new Event[capacity_]);
+  buffer->count.store(0, std::memory_order_relaxed);
+  buffer->in_use.store(true, std::memory_order_relaxed);
+  buffers_.push_back(std::move(buffer));
+  return buffers_.back().get();
+}
+
+std::string FrameTracer::ToJson() {
+  std::vector<Event> events;
+  std::map<int, std::string> thread_names;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    thread_names = thread_names_;
+    for (const auto& buffer : buffers_) {
+      const uint64_t end = buffer->count.load(std::memory_order_acquire);
+      const uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+      std::vector<Event> copied;
+      for (uint64_t i = begin; i < end; i++) {
+        copied.push_back(buffer->events[i % capacity_]);
+      }
+      // コピーしている間に上書きされた分は捨てる
+      const uint64_t now = buffer->count.load(std::memory_order_acquire);
+      const uint64_t valid = now > capacity_ ? now - capacity_ : 0;
+      for (uint64_t i = std::max(begin, valid); i < end; i++) {
+        events.push_back(copied[i - begin]);
+      }
+    }
+  }
+
+  std::ostringstream ss;
+  ss << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  auto separator = [&]() {
+    if (!first) {
+      ss << ",\n";
+    }
+    first = false;
+  };
+  for (const auto& pair : thread_names) {
+    separator();
+    ss << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+       << pair.first << ",\"args\":{\"name\":"
+       << nlohmann::json(pair.second).dump() << "}}";
+  }
+  for (const auto& e : events) {
+    const std::string common = std::string("\"name\":\"") + e.name +
+                               "\",\"pid\":1,\"tid\":" + std::to_string(e.tid);
+    const std::string args =
+        ",\"args\":{\"frame\":" + std::to_string(e.frame) + "}}";
+    separator();
+    switch (e.phase) {
+      case Phase::kInstant:
+        ss << "{" << common << ",\"ph\":\"i\",\"s\":\"t\",\"ts\":"
+           << e.start_us << args;
+        break;
+      case Phase::kComplete:
+        ss << "{" << common << ",\"ph\":\"X\",\"ts\":" << e.start_us
+           << ",\"dur\":" << e.end_us - e.start_us << args;
+        break;
+      case Phase::kAsync:
+        ss << "{" << common << ",\"ph\":\"b\",\"cat\":\"frame\",\"id\":"
+           << e.frame << ",\"ts\":" << e.start_us << args << ",\n";
+        ss << "{" << common << ",\"ph\":\"e\",\"cat\":\"frame\",\"id\":"
+           << e.frame << ",\"ts\":" << e.end_us << args;
+        break;
+    }
+  }
+  ss << "]}\n";
+  return ss.str();
+}
+
+bool FrameTracer::WriteFile(const std::string& path) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    RTC_LOG(LS_ERROR) << "FrameTracer: failed to open " << path;
+    return false;
+  }
+  ofs << ToJson();
+  ofs.close();
+  if (!ofs) {
+    RTC_LOG(LS_ERROR) << "FrameTracer: failed to write " << path;
+    return false;
+  }
+  RTC_LOG(LS_INFO) << "FrameTracer: wrote " << path;
+  return true;
+}
+
+TraceScope::TraceScope(const char* name, int64_t frame)
+    : name_(name),
+      frame_(frame),
+      start_us_(FrameTracer::Instance().enabled() ? rtc::TimeMicros() : 0) {}
+
+TraceScope::~TraceScope() {
+  FrameTracer& tracer = FrameTracer::Instance();
+  if (tracer.enabled()) {
+    tracer.Complete(name_, frame_, start_us_, rtc::TimeMicros());
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef FRAME_TRACER_H_
+#define FRAME_TRACER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// フレームがキャプチャされてから送信、表示されるまでの各段階を記録して、
+// Chrome のトレース形式 (chrome://tracing や Perfetto で開ける JSON) で出力するクラス。
+//
+// 記録はスレッド毎に確保したリングバッファに書き込むだけで、ロックは取らない。
+// バッファが一杯になったら古いものから上書きするので、直近の events_per_thread 個が残る。
+// Configure() で有効にしていない場合、記録するメソッドは何もしない。
+class FrameTracer {
+ public:
+  static FrameTracer& Instance();
+
+  // 0 の場合は記録しない。記録するスレッドを作る前に呼ぶこと
+  void Configure(size_t events_per_thread);
+  bool enabled() const { return capacity_ > 0; }
+
+  // name はずっと有効な文字列 (リテラルなど) を渡すこと。
+  // frame にはフレームを区別する値 (キャプチャ時刻や RTP タイムスタンプなど) を渡す
+  void Instant(const char* name, int64_t frame);
+  // このスレッドで start_us から end_us まで処理した
+  void Complete(const char* name,
+                int64_t frame,
+                int64_t start_us,
+                int64_t end_us);
+  // 別のスレッドにまたがる処理 (エンコーダに渡してから出力されるまでなど)
+  void Async(const char* name, int64_t frame, int64_t start_us, int64_t end_us);
+
+  // {"traceEvents": [...]}
+  std::string ToJson();
+  bool WriteFile(const std::string& path);
+
+ private:
+  enum class Phase : uint8_t { kInstant, kComplete, kAsync };
+  struct Event {
+    const char* name;
+    Phase phase;
+    int tid;
+    int64_t frame;
+    int64_t start_us;
+    int64_t end_us;
+  };
+  // 1 つのスレッドだけが書き込むリングバッファ。スレッドが終了したら別のスレッドが使い回す
+  struct Buffer {
+    std::unique_ptr<Event[]> events;
+    // これまでに書き込んだ数
+    std::atomic<uint64_t> count;
+    std::atomic<bool> in_use;
+  };
+  class ThreadSlot;
+
+  FrameTracer() = default;
+  void Add(const Event& event);
+  Buffer* AcquireBuffer(int tid);
+
+  size_t capacity_ = 0;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+  std::map<int, std::string> thread_names_;
+};
+
+// 生存している間を 1 つの処理として記録する
+class TraceScope {
+ public:
+  TraceScope(const char* name, int64_t frame);
+  ~TraceScope();
+
+ private:
+  const char* name_;
+  int64_t frame_;
+  int64_t start_us_;
+};
+
+#endif  // FRAME_TRACER_H_
@@ -0,0 +1,56 @@
+#include "h264_qp_sampler.h"
+
+#include <algorithm>
+
+// WebRTC
+#include "common_video/h264/h264_common.h"
+
+namespace {
+
+// 開始コードの最後の 3 バイト
+const size_t kStartCodeSize = 3;
+
+}  // namespace
+
+const int H264QpSampler::kSampleInterval;
+const size_t H264QpSampler::kMaxSliceHeaderBytes;
+
+void H264QpSampler::BeginFrame(bool key_frame) {
+  frames_since_sample_++;
+  sampling_ =
+      key_frame || qp_ < 0 || frames_since_sample_ >= kSampleInterval;
+  if (sampling_) {
+    frames_since_sample_ = 0;
+  }
+}
+
+void H264QpSampler::AddNal(const uint8_t* nal, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  switch (webrtc::H264::ParseNaluType(nal[0])) {
+    case webrtc::H264::NaluType::kSps:
+    case webrtc::H264::NaluType::kPps:
+      // 小さいので、読まないフレームでも後のスライスのために読んでおく
+      parser_.ParseBitstream(nal - kStartCodeSize, size + kStartCodeSize);
+      break;
+    case webrtc::H264::NaluType::kSlice:
+    case webrtc::H264::NaluType::kIdr: {
+      if (!sampling_) {
+        break;
+      }
+      // スライスヘッダが途中で切れていた場合は読めないので、直前の値を使う
+      parser_.ParseBitstream(
+          nal - kStartCodeSize,
+          std::min(size, kMaxSliceHeaderBytes) + kStartCodeSize);
+      int qp;
+      if (parser_.GetLastSliceQp(&qp)) {
+        qp_ = qp;
+      }
+      sampling_ = false;
+      break;
+    }
+    default:
+      break;
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef H264_QP_SAMPLER_H_
+#define H264_QP_SAMPLER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// WebRTC
+#include "common_video/h264/h264_bitstream_parser.h"
+
+// エンコーダが QP を教えてくれない場合に、出力した H.264 から QP を読むクラス。
+//
+// H264BitstreamParser に 1 フレームを丸ごと渡すと、スライスデータも含めて
+// エミュレーション防止バイトを取り除いたコピーを作るので、高いビットレートでは重い。
+// ここでは SPS/PPS と、最初のスライスの先頭 kMaxSliceHeaderBytes バイトだけを渡して
+// スライスヘッダの QP を読む。読むのはキーフレームと kSampleInterval フレームに 1 回で、
+// 間のフレームは直前に読めた値を使う。
+// エンコーダの出力を処理するスレッドから呼び出すこと。
+class H264QpSampler {
+ public:
+  static const int kSampleInterval = 4;
+  static const size_t kMaxSliceHeaderBytes = 64;
+
+  // フレーム毎に、NAL ユニットを渡す前に呼ぶ
+  void BeginFrame(bool key_frame);
+  // 開始コードを除いた NAL ユニットを先頭から順に渡す。
+  // nal の直前には開始コード (00 00 01) があること
+  void AddNal(const uint8_t* nal, size_t size);
+  // 直前に読めた QP。まだ読めていない場合は -1
+  int qp() const { return qp_; }
+
+ private:
+  webrtc::H264BitstreamParser parser_;
+  int frames_since_sample_ = 0;
+  bool sampling_ = false;
+  int qp_ = -1;
+};
+
+#endif  // H264_QP_SAMPLER_H_
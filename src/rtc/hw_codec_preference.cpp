@@ -0,0 +1,86 @@
+#include "hw_codec_preference.h"
+
+#include <algorithm>
+
+#include "absl/strings/match.h"
+#include "rtc_base/logging.h"
+
+namespace {
+
+// name が names の何番目かを返す。含まれない場合は names.size() を返す
+size_t IndexOf(const std::vector<std::string>& names, const std::string& name) {
+  for (size_t i = 0; i < names.size(); i++) {
+    if (absl::EqualsIgnoreCase(names[i], name)) {
+      return i;
+    }
+  }
+  return names.size();
+}
+
+}  // namespace
+
+HWCodecPreferenceVideoEncoderFactory::HWCodecPreferenceVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+    const Probe& probe)
+    : factory_(std::move(factory)) {
+  std::vector<std::string> probed;
+  for (const webrtc::SdpVideoFormat& format : factory_->GetSupportedFormats()) {
+    // 同じコーデックの形式が複数ある場合は最初のものだけを試す
+    if (IndexOf(probed, format.name) != probed.size()) {
+      continue;
+    }
+    if (!factory_->QueryVideoEncoder(format).is_hardware_accelerated) {
+      continue;
+    }
+    probed.push_back(format.name);
+    const bool ok = probe(factory_.get(), format);
+    RTC_LOG(LS_INFO) << "Hardware encoder for " << format.name << ": "
+                     << (ok ? "available" : "unavailable");
+    if (ok) {
+      hw_codecs_.push_back(format.name);
+    }
+  }
+}
+
+bool HWCodecPreferenceVideoEncoderFactory::IsHWCodec(
+    const std::string& name) const {
+  return IndexOf(hw_codecs_, name) != hw_codecs_.size();
+}
+
+std::vector<webrtc::SdpVideoFormat>
+HWCodecPreferenceVideoEncoderFactory::GetSupportedFormats() const {
+  std::vector<webrtc::SdpVideoFormat> formats = factory_->GetSupportedFormats();
+  std::stable_partition(formats.begin(), formats.end(),
+                        [this](const webrtc::SdpVideoFormat& format) {
+                          return IsHWCodec(format.name);
+                        });
+  return formats;
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+HWCodecPreferenceVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  CodecInfo info = factory_->QueryVideoEncoder(format);
+  if (!IsHWCodec(format.name)) {
+    info.is_hardware_accelerated = false;
+  }
+  return info;
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+HWCodecPreferenceVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  return factory_->CreateVideoEncoder(format);
+}
+
+std::vector<webrtc::RtpCodecCapability> SortCodecCapabilities(
+    std::vector<webrtc::RtpCodecCapability> codecs,
+    const std::vector<std::string>& preferred) {
+  std::stable_sort(codecs.begin(), codecs.end(),
+                   [&preferred](const webrtc::RtpCodecCapability& a,
+                                const webrtc::RtpCodecCapability& b) {
+                     return IndexOf(preferred, a.name) <
+                            IndexOf(preferred, b.name);
+                   });
+  return codecs;
+}
@@ -0,0 +1,56 @@
+#ifndef HW_CODEC_PREFERENCE_H_
+#define HW_CODEC_PREFERENCE_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/rtp_parameters.h"
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+
+// ハードウェアエンコーダを実際に初期化できたコーデックを、先頭に並べて広告するファクトリ。
+//
+// 作る時に、factory がハードウェアアクセラレーションありと答えたコーデック毎に probe を呼び、
+// エンコーダを作って初期化できたものだけをハードウェアのコーデックとして扱う。
+// GetSupportedFormats() はハードウェアのコーデックを元の順序のまま先頭に移して返し、
+// QueryVideoEncoder() は初期化できなかったコーデックを is_hardware_accelerated = false にする。
+class HWCodecPreferenceVideoEncoderFactory
+    : public webrtc::VideoEncoderFactory {
+ public:
+  // format のエンコーダを作って初期化し、成功したら true を返す
+  typedef std::function<bool(webrtc::VideoEncoderFactory* factory,
+                             const webrtc::SdpVideoFormat& format)>
+      Probe;
+
+  HWCodecPreferenceVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+      const Probe& probe);
+
+  // 初期化できたハードウェアのコーデック名。広告する順に並んでいる
+  const std::vector<std::string>& hw_codecs() const { return hw_codecs_; }
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  bool IsHWCodec(const std::string& name) const;
+
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  std::vector<std::string> hw_codecs_;
+};
+
+// codecs のうち、名前が preferred に含まれるものを preferred の順で先頭に移す。
+// それ以外は元の順序のまま後ろに並べる。RtpTransceiverInterface::SetCodecPreferences() に渡す
+std::vector<webrtc::RtpCodecCapability> SortCodecCapabilities(
+    std::vector<webrtc::RtpCodecCapability> codecs,
+    const std::vector<std::string>& preferred);
+
+#endif  // HW_CODEC_PREFERENCE_H_
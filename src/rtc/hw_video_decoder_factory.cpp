@@ -10,6 +10,7 @@
 
 #include "hw_video_decoder_factory.h"
 
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "api/video_codecs/sdp_video_format.h"
 #include "media/base/codec.h"
@@ -24,10 +25,15 @@
 #include "modules/video_coding/codecs/av1/libaom_av1_decoder.h"
 #endif
 
+#if USE_V4L2_M2M
+#include "hwenc_v4l2/v4l2_m2m_h264_decoder.h"
+#endif
 #if USE_JETSON_ENCODER
 #include "hwenc_jetson/jetson_video_decoder.h"
 #elif USE_MMAL_ENCODER
 #include "hwenc_mmal/mmal_h264_decoder.h"
+#elif USE_NVCODEC_ENCODER && defined(__linux__)
+#include "hwenc_nvcodec/nvcodec_h264_decoder.h"
 #endif
 
 #include "h264_format.h"
@@ -47,6 +53,43 @@ bool IsFormatSupported(
   return false;
 }
 
+// 生きているハードウェアデコーダの数を数えるためのラッパー
+class CountedVideoDecoder : public webrtc::VideoDecoder {
+ public:
+  CountedVideoDecoder(std::unique_ptr<webrtc::VideoDecoder> decoder,
+                      std::shared_ptr<std::atomic<int>> count)
+      : decoder_(std::move(decoder)), count_(std::move(count)) {}
+  ~CountedVideoDecoder() override {
+    decoder_.reset();
+    count_->fetch_sub(1);
+  }
+
+  int32_t InitDecode(const webrtc::VideoCodec* codec_settings,
+                     int32_t number_of_cores) override {
+    return decoder_->InitDecode(codec_settings, number_of_cores);
+  }
+  int32_t Decode(const webrtc::EncodedImage& input_image,
+                 bool missing_frames,
+                 int64_t render_time_ms) override {
+    return decoder_->Decode(input_image, missing_frames, render_time_ms);
+  }
+  int32_t RegisterDecodeCompleteCallback(
+      webrtc::DecodedImageCallback* callback) override {
+    return decoder_->RegisterDecodeCompleteCallback(callback);
+  }
+  int32_t Release() override { return decoder_->Release(); }
+  bool PrefersLateDecoding() const override {
+    return decoder_->PrefersLateDecoding();
+  }
+  const char* ImplementationName() const override {
+    return decoder_->ImplementationName();
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoDecoder> decoder_;
+  std::shared_ptr<std::atomic<int>> count_;
+};
+
 }  // namespace
 
 std::vector<webrtc::SdpVideoFormat> HWVideoDecoderFactory::GetSupportedFormats()
@@ -83,6 +126,54 @@ std::unique_ptr<webrtc::VideoDecoder> HWVideoDecoderFactory::CreateVideoDecoder(
     return nullptr;
   }
 
+  // 先に数を確保しておき、上限を超えていたら戻す
+  const int hw_decoders = hw_decoders_->fetch_add(1);
+  if (max_hw_decoders_ <= 0 || hw_decoders < max_hw_decoders_) {
+    std::unique_ptr<webrtc::VideoDecoder> decoder =
+        CreateHWVideoDecoder(format);
+    if (decoder) {
+      return std::unique_ptr<webrtc::VideoDecoder>(
+          absl::make_unique<CountedVideoDecoder>(std::move(decoder),
+                                                 hw_decoders_));
+    }
+    hw_decoders_->fetch_sub(1);
+    return CreateSoftwareVideoDecoder(format);
+  }
+  hw_decoders_->fetch_sub(1);
+
+  std::unique_ptr<webrtc::VideoDecoder> decoder =
+      CreateSoftwareVideoDecoder(format);
+  if (decoder) {
+    RTC_LOG(LS_INFO) << "Hardware decoders are limited to "
+                     << max_hw_decoders_ << ", using software decoder for "
+                     << format.name;
+    return decoder;
+  }
+  // ソフトウェアデコーダが無いコーデックは、上限を超えてもハードウェアデコーダを使う
+  RTC_LOG(LS_WARNING) << "No software decoder for " << format.name
+                      << ", exceeding the hardware decoder limit";
+  hw_decoders_->fetch_add(1);
+  decoder = CreateHWVideoDecoder(format);
+  if (!decoder) {
+    hw_decoders_->fetch_sub(1);
+    return nullptr;
+  }
+  return std::unique_ptr<webrtc::VideoDecoder>(
+      absl::make_unique<CountedVideoDecoder>(std::move(decoder),
+                                             hw_decoders_));
+}
+
+std::unique_ptr<webrtc::VideoDecoder>
+HWVideoDecoderFactory::CreateHWVideoDecoder(
+    const webrtc::SdpVideoFormat& format) {
+#if USE_V4L2_M2M
+  // M2M のデバイスが見つからない場合は、下の各ボード向けのデコーダを使う
+  if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName) &&
+      V4L2M2MH264Decoder::IsSupported()) {
+    return std::unique_ptr<webrtc::VideoDecoder>(
+        absl::make_unique<V4L2M2MH264Decoder>());
+  }
+#endif
 #if USE_JETSON_ENCODER
   uint32_t input_format = 0;
   if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName))
@@ -95,23 +186,35 @@ std::unique_ptr<webrtc::VideoDecoder> HWVideoDecoderFactory::CreateVideoDecoder(
     return std::unique_ptr<webrtc::VideoDecoder>(
         absl::make_unique<JetsonVideoDecoder>(input_format));
   }
-#else
-  if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName))
-    return webrtc::VP8Decoder::Create();
-  if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName))
-    return webrtc::VP9Decoder::Create();
-#if USE_MMAL_ENCODER
+#elif USE_MMAL_ENCODER
   if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName))
     return std::unique_ptr<webrtc::VideoDecoder>(
-        absl::make_unique<MMALH264Decoder>());
-#endif
+        absl::make_unique<MMALH264Decoder>(
+            mmal_zero_copy_, mmal_input_buffers_, mmal_output_buffers_));
+#elif USE_NVCODEC_ENCODER && defined(__linux__)
+  // GPU が使えない環境ではソフトウェアデコーダを使う
+  if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName) &&
+      NvCodecH264Decoder::IsSupported()) {
+    return std::unique_ptr<webrtc::VideoDecoder>(
+        absl::make_unique<NvCodecH264Decoder>());
+  }
 #endif
+  return nullptr;
+}
 
+std::unique_ptr<webrtc::VideoDecoder>
+HWVideoDecoderFactory::CreateSoftwareVideoDecoder(
+    const webrtc::SdpVideoFormat& format) {
+  if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName))
+    return webrtc::VP8Decoder::Create();
+  if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName))
+    return webrtc::VP9Decoder::Create();
+  if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName) &&
+      webrtc::H264Decoder::IsSupported())
+    return webrtc::H264Decoder::Create();
 #if !defined(__arm__) || defined(__aarch64__) || defined(__ARM_NEON__)
   if (absl::EqualsIgnoreCase(format.name, cricket::kAv1CodecName))
     return webrtc::CreateLibaomAv1Decoder();
 #endif
-
-  RTC_NOTREACHED();
   return nullptr;
 }
@@ -11,6 +11,7 @@
 #ifndef HW_VIDEO_DECODER_FACTORY_H_
 #define HW_VIDEO_DECODER_FACTORY_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -18,13 +19,39 @@
 
 class HWVideoDecoderFactory : public webrtc::VideoDecoderFactory {
  public:
-  HWVideoDecoderFactory() {}
+  // mmal_* は MMAL の H264 デコーダの設定で、それ以外の環境では無視する。
+  // max_hw_decoders が 0 より大きい場合、同時に使うハードウェアデコーダをこの数までにして、
+  // 超えた分はソフトウェアデコーダでデコードする
+  HWVideoDecoderFactory(bool mmal_zero_copy = false,
+                        int mmal_input_buffers = 3,
+                        int mmal_output_buffers = 3,
+                        int max_hw_decoders = 0)
+      : mmal_zero_copy_(mmal_zero_copy),
+        mmal_input_buffers_(mmal_input_buffers),
+        mmal_output_buffers_(mmal_output_buffers),
+        max_hw_decoders_(max_hw_decoders),
+        hw_decoders_(std::make_shared<std::atomic<int>>(0)) {}
   virtual ~HWVideoDecoderFactory() {}
 
   std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
 
   std::unique_ptr<webrtc::VideoDecoder> CreateVideoDecoder(
       const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  // この環境にハードウェアデコーダが無いコーデックの場合は nullptr を返す
+  std::unique_ptr<webrtc::VideoDecoder> CreateHWVideoDecoder(
+      const webrtc::SdpVideoFormat& format);
+  // ソフトウェアデコーダが無いコーデックの場合は nullptr を返す
+  std::unique_ptr<webrtc::VideoDecoder> CreateSoftwareVideoDecoder(
+      const webrtc::SdpVideoFormat& format);
+
+  const bool mmal_zero_copy_;
+  const int mmal_input_buffers_;
+  const int mmal_output_buffers_;
+  const int max_hw_decoders_;
+  // 生きているハードウェアデコーダの数。デコーダはファクトリより長生きすることがある
+  std::shared_ptr<std::atomic<int>> hw_decoders_;
 };
 
 #endif  // HW_VIDEO_DECODER_FACTORY_H_
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "hw_video_encoder.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "frame_tracer.h"
+#include "modules/video_coding/codecs/h264/include/h264.h"
+#include "rtc_base/logging.h"
+
+namespace {
+
+struct nal_entry {
+  size_t offset;
+  size_t size;
+};
+
+// 下流で保持されている分も含めて、フレームを繋げるためのバッファを使い回す数
+const size_t kMaxEncodedBuffers = 4;
+
+}  // namespace
+
+HWVideoEncoder::FrameParams::FrameParams(const webrtc::VideoFrame& frame,
+                                         int32_t width,
+                                         int32_t height)
+    : width(width),
+      height(height),
+      render_time_ms(frame.render_time_ms()),
+      ntp_time_ms(frame.ntp_time_ms()),
+      timestamp_us(frame.timestamp_us()),
+      timestamp_rtp(frame.timestamp()),
+      rotation(frame.rotation()),
+      color_space(frame.color_space()) {}
+
+void HWVideoEncoder::EncodedBuffer::Append(const uint8_t* data, size_t size) {
+  if (data_.size() < size_ + size) {
+    data_.resize(size_ + size);
+  }
+  memcpy(data_.data() + size_, data, size);
+  size_ += size;
+}
+
+HWVideoEncoder::HWVideoEncoder(std::string implementation_name,
+                               KeyFrameThrottle::Settings key_frame_throttle)
+    : bitrate_adjuster_(.5, .95),
+      metrics_(std::move(implementation_name)),
+      key_frame_throttle_(key_frame_throttle) {}
+
+void HWVideoEncoder::SetTargetBitrateBps(uint32_t bitrate_bps) {
+  target_bitrate_bps_ = bitrate_bps;
+  bitrate_adjuster_.SetTargetBitrateBps(bitrate_bps);
+  metrics_.SetTargetBitrate(bitrate_bps);
+}
+
+void HWVideoEncoder::InitEncodedImage(
+    const webrtc::VideoCodec& codec_settings) {
+  encoded_image_._completeFrame = true;
+  encoded_image_._encodedWidth = 0;
+  encoded_image_._encodedHeight = 0;
+  encoded_image_.set_size(0);
+  encoded_image_.timing_.flags =
+      webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
+  encoded_image_.content_type_ =
+      (codec_settings.mode == webrtc::VideoCodecMode::kScreensharing)
+          ? webrtc::VideoContentType::SCREENSHARE
+          : webrtc::VideoContentType::UNSPECIFIED;
+}
+
+void HWVideoEncoder::PushFrameParams(const FrameParams& params) {
+  rtc::CritScope lock(&frame_params_lock_);
+  frame_params_.push(absl::make_unique<FrameParams>(params));
+}
+
+std::unique_ptr<HWVideoEncoder::FrameParams> HWVideoEncoder::PopFrameParams(
+    int64_t timestamp_us) {
+  std::unique_ptr<FrameParams> params;
+  {
+    rtc::CritScope lock(&frame_params_lock_);
+    do {
+      if (frame_params_.empty()) {
+        RTC_LOG(LS_WARNING)
+            << __FUNCTION__
+            << " Frame parameter is empty. SkipFrame timestamp:"
+            << timestamp_us;
+        return nullptr;
+      }
+      params = std::move(frame_params_.front());
+      frame_params_.pop();
+    } while (params->timestamp_us < timestamp_us);
+  }
+  if (params->timestamp_us != timestamp_us) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__
+                        << " Frame parameter is not found. SkipFrame timestamp:"
+                        << timestamp_us;
+    metrics_.OnDropped();
+    return nullptr;
+  }
+  return params;
+}
+
+void HWVideoEncoder::ClearFrameParams() {
+  rtc::CritScope lock(&frame_params_lock_);
+  while (!frame_params_.empty()) {
+    frame_params_.pop();
+  }
+}
+
+void HWVideoEncoder::SetEncodedImageParams(const FrameParams& params) {
+  encoded_image_._encodedWidth = params.width;
+  encoded_image_._encodedHeight = params.height;
+  encoded_image_.capture_time_ms_ = params.render_time_ms;
+  encoded_image_.ntp_time_ms_ = params.ntp_time_ms;
+  encoded_image_.SetTimestamp(params.timestamp_rtp);
+  encoded_image_.rotation_ = params.rotation;
+  encoded_image_.SetColorSpace(params.color_space);
+}
+
+rtc::scoped_refptr<HWVideoEncoder::PooledEncodedBuffer>
+HWVideoEncoder::GetEncodedBuffer() {
+  for (const auto& buffer : encoded_buffers_) {
+    // プールからしか参照されていないバッファは再利用できる
+    if (buffer->HasOneRef()) {
+      buffer->Clear();
+      return buffer;
+    }
+  }
+  rtc::scoped_refptr<PooledEncodedBuffer> buffer = new PooledEncodedBuffer();
+  if (encoded_buffers_.size() < kMaxEncodedBuffers) {
+    encoded_buffers_.push_back(buffer);
+  }
+  return buffer;
+}
+
+webrtc::CodecSpecificInfo HWVideoEncoder::PrepareH264Frame(
+    const uint8_t* buffer,
+    size_t size,
+    int qp,
+    webrtc::RTPFragmentationHeader* frag_header) {
+  encoded_image_.set_size(size);
+  encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameDelta;
+
+  uint8_t zero_count = 0;
+  size_t nal_start_idx = 0;
+  std::vector<nal_entry> nals;
+  for (size_t i = 0; i < size; i++) {
+    uint8_t data = buffer[i];
+    if ((i != 0) && (i == nal_start_idx)) {
+      if ((data & 0x1F) == 0x05) {
+        encoded_image_._frameType = webrtc::VideoFrameType::kVideoFrameKey;
+      }
+    }
+    if (data == 0x01 && zero_count >= 2) {
+      if (nal_start_idx != 0) {
+        nals.push_back(
+            {nal_start_idx, i - nal_start_idx + 1 - (zero_count == 2 ? 3 : 4)});
+      }
+      nal_start_idx = i + 1;
+    }
+    if (data == 0x00) {
+      zero_count++;
+    } else {
+      zero_count = 0;
+    }
+  }
+  if (nal_start_idx != 0) {
+    nals.push_back({nal_start_idx, size - nal_start_idx});
+  }
+
+  frag_header->VerifyAndAllocateFragmentationHeader(nals.size());
+  for (size_t i = 0; i < nals.size(); i++) {
+    frag_header->fragmentationOffset[i] = nals[i].offset;
+    frag_header->fragmentationLength[i] = nals[i].size;
+  }
+
+  webrtc::CodecSpecificInfo codec_specific;
+  codec_specific.codecType = webrtc::kVideoCodecH264;
+  codec_specific.codecSpecific.H264.packetization_mode =
+      webrtc::H264PacketizationMode::NonInterleaved;
+
+  // QP を教えてくれないエンコーダは、スライスヘッダから読む
+  if (qp >= 0) {
+    encoded_image_.qp_ = qp;
+  } else {
+    qp_sampler_.BeginFrame(encoded_image_._frameType ==
+                           webrtc::VideoFrameType::kVideoFrameKey);
+    for (const nal_entry& nal : nals) {
+      qp_sampler_.AddNal(buffer + nal.offset, nal.size);
+    }
+    encoded_image_.qp_ = qp_sampler_.qp();
+  }
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " qp:" << encoded_image_.qp_;
+  return codec_specific;
+}
+
+int32_t HWVideoEncoder::SendH264Frame(const uint8_t* buffer,
+                                      size_t size,
+                                      int qp) {
+  webrtc::RTPFragmentationHeader frag_header;
+  webrtc::CodecSpecificInfo codec_specific =
+      PrepareH264Frame(buffer, size, qp, &frag_header);
+  return SendEncodedImage(codec_specific, &frag_header);
+}
+
+int32_t HWVideoEncoder::SendEncodedImage(
+    const webrtc::CodecSpecificInfo& codec_specific,
+    const webrtc::RTPFragmentationHeader* frag_header) {
+  webrtc::EncodedImageCallback* callback = callback_;
+  if (callback == nullptr) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+  const size_t size = encoded_image_.size();
+
+  // パケット化と送信キューへの追加は OnEncodedImage の中で行われる
+  TraceScope trace("send", encoded_image_.Timestamp());
+  webrtc::EncodedImageCallback::Result result =
+      callback->OnEncodedImage(encoded_image_, &codec_specific, frag_header);
+  if (result.error != webrtc::EncodedImageCallback::Result::OK) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__
+                      << " OnEncodedImage failed error:" << result.error;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  bitrate_adjuster_.Update(size);
+  metrics_.OnEncoded(encoded_image_.Timestamp(), size,
+                     encoded_image_._frameType ==
+                         webrtc::VideoFrameType::kVideoFrameKey);
+  return WEBRTC_VIDEO_CODEC_OK;
+}
@@ -0,0 +1,122 @@
+#ifndef HW_VIDEO_ENCODER_H_
+#define HW_VIDEO_ENCODER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "api/video/color_space.h"
+#include "api/video/encoded_image.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_rotation.h"
+#include "api/video_codecs/video_encoder.h"
+#include "common_video/include/bitrate_adjuster.h"
+#include "modules/include/module_common_types.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/ref_counted_object.h"
+
+#include "encoder_metrics.h"
+#include "h264_qp_sampler.h"
+#include "key_frame_throttle.h"
+
+// ハードウェアエンコーダに共通の処理をまとめた基底クラス。
+//
+// - 目標のビットレートと BitrateAdjuster、EncoderMetrics、KeyFrameThrottle を持つ
+// - Encode() に渡したフレームの情報を覚えておき、出力された時にタイムスタンプで引いて
+//   encoded_image_ に設定する
+// - エンコーダが出力した H.264 (Annex B) を NAL に分けて QP を読み、コールバックに渡す。
+//   出力した大きさを BitrateAdjuster と EncoderMetrics に記録する
+// - 複数の出力バッファに分かれたフレームを繋げるバッファを使い回す
+//
+// 出力をどのスレッドから送るかは、各バックエンドのエンコーダの出力の仕組みに合わせて派生クラスが決める。
+class HWVideoEncoder : public webrtc::VideoEncoder {
+ protected:
+  // EncodedImage を作るために必要な、Encode() に渡されたフレームの情報
+  struct FrameParams {
+    FrameParams() = default;
+    // width と height はエンコーダに入力する大きさ
+    FrameParams(const webrtc::VideoFrame& frame, int32_t width, int32_t height);
+
+    int32_t width = 0;
+    int32_t height = 0;
+    int64_t render_time_ms = 0;
+    int64_t ntp_time_ms = 0;
+    // エンコーダに渡して、出力から引くためのタイムスタンプ
+    int64_t timestamp_us = 0;
+    uint32_t timestamp_rtp = 0;
+    webrtc::VideoRotation rotation = webrtc::kVideoRotation_0;
+    absl::optional<webrtc::ColorSpace> color_space;
+  };
+
+  // 複数の出力バッファに分かれたフレームを繋げるためのバッファ。
+  // EncodedImage から参照させるので、下流で保持されている間は再利用しない
+  class EncodedBuffer : public webrtc::EncodedImageBufferInterface {
+   public:
+    const uint8_t* data() const override { return data_.data(); }
+    uint8_t* data() override { return data_.data(); }
+    size_t size() const override { return size_; }
+
+    void Clear() { size_ = 0; }
+    void Append(const uint8_t* data, size_t size);
+
+   private:
+    std::vector<uint8_t> data_;
+    size_t size_ = 0;
+  };
+  typedef rtc::RefCountedObject<EncodedBuffer> PooledEncodedBuffer;
+
+  HWVideoEncoder(std::string implementation_name,
+                 KeyFrameThrottle::Settings key_frame_throttle);
+
+  // 目標のビットレートを BitrateAdjuster と EncoderMetrics に設定する
+  void SetTargetBitrateBps(uint32_t bitrate_bps);
+  // InitEncode() で encoded_image_ を初期化する
+  void InitEncodedImage(const webrtc::VideoCodec& codec_settings);
+
+  // Encode() でエンコーダに渡すフレームの情報を覚えておく
+  void PushFrameParams(const FrameParams& params);
+  // timestamp_us のフレームの情報を取り出す。それより前のフレームの情報はエンコーダの中で
+  // 捨てられているので読み飛ばす。見つからない場合は nullptr を返す
+  std::unique_ptr<FrameParams> PopFrameParams(int64_t timestamp_us);
+  void ClearFrameParams();
+  // params の内容を encoded_image_ に設定する
+  void SetEncodedImageParams(const FrameParams& params);
+
+  // 下流から参照されていないバッファを空にして返す
+  rtc::scoped_refptr<PooledEncodedBuffer> GetEncodedBuffer();
+
+  // encoded_image_ が指している H.264 (Annex B) のフレームを NAL に分けて frag_header を作り、
+  // encoded_image_ の大きさ、フレームの種類、QP を設定して、H.264 の CodecSpecificInfo を返す。
+  // qp が負の場合はスライスヘッダから読む
+  webrtc::CodecSpecificInfo PrepareH264Frame(
+      const uint8_t* buffer,
+      size_t size,
+      int qp,
+      webrtc::RTPFragmentationHeader* frag_header);
+  // PrepareH264Frame() して送る
+  int32_t SendH264Frame(const uint8_t* buffer, size_t size, int qp = -1);
+  // encoded_image_ をコールバックに渡して、BitrateAdjuster と EncoderMetrics に記録する
+  int32_t SendEncodedImage(const webrtc::CodecSpecificInfo& codec_specific,
+                           const webrtc::RTPFragmentationHeader* frag_header);
+
+  std::atomic<webrtc::EncodedImageCallback*> callback_{nullptr};
+  webrtc::BitrateAdjuster bitrate_adjuster_;
+  EncoderMetrics metrics_;
+  KeyFrameThrottle key_frame_throttle_;
+  uint32_t target_bitrate_bps_ = 0;
+  H264QpSampler qp_sampler_;
+  webrtc::EncodedImage encoded_image_;
+
+ private:
+  rtc::CriticalSection frame_params_lock_;
+  std::queue<std::unique_ptr<FrameParams>> frame_params_;
+  std::vector<rtc::scoped_refptr<PooledEncodedBuffer>> encoded_buffers_;
+};
+
+#endif  // HW_VIDEO_ENCODER_H_
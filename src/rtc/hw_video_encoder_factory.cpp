@@ -5,15 +5,20 @@
 #include "api/video_codecs/sdp_video_format.h"
 #include "media/base/codec.h"
 #include "media/base/media_constants.h"
+#include "media/base/vp9_profile.h"
+#include "media/engine/encoder_simulcast_proxy.h"
 #include "modules/video_coding/codecs/h264/include/h264.h"
 #include "modules/video_coding/codecs/vp8/include/vp8.h"
 #include "modules/video_coding/codecs/vp9/include/vp9.h"
 #include "rtc_base/logging.h"
 
 #if !defined(__arm__) || defined(__aarch64__) || defined(__ARM_NEON__)
-#include "modules/video_coding/codecs/av1/libaom_av1_encoder.h"
+#include "realtime_av1_encoder.h"
 #endif
 
+#if USE_V4L2_M2M
+#include "hwenc_v4l2/v4l2_m2m_h264_encoder.h"
+#endif
 #if USE_MMAL_ENCODER
 #include "hwenc_mmal/mmal_h264_encoder.h"
 #endif
@@ -23,8 +28,48 @@
 #if USE_NVCODEC_ENCODER
 #include "hwenc_nvcodec/nvcodec_h264_encoder.h"
 #endif
+#if USE_VAAPI_ENCODER
+#include "hwenc_vaapi/vaapi_h264_encoder.h"
+#endif
 
 #include "h264_format.h"
+#include "software_video_encoder.h"
+
+namespace {
+
+#if USE_JETSON_ENCODER
+// ハードウェアでエンコードできるのは profile 0 のみ
+bool IsHardwareVP9Format(const webrtc::SdpVideoFormat& format) {
+  if (!JetsonH264Encoder::IsVP9Supported()) {
+    return false;
+  }
+  auto it = format.parameters.find(webrtc::kVP9FmtpProfileId);
+  return it == format.parameters.end() || it->second == "0";
+}
+#endif
+
+}  // namespace
+
+HWVideoEncoderFactory::HWVideoEncoderFactory(
+    bool simulcast,
+    bool nvcodec_async,
+    bool mmal_low_latency,
+    bool low_latency_rate_control,
+    KeyFrameThrottle::Settings key_frame_throttle,
+    int nvcodec_temporal_layers,
+    std::vector<webrtc::SdpVideoFormat> h264_formats)
+    : nvcodec_async_(nvcodec_async),
+      mmal_low_latency_(mmal_low_latency),
+      low_latency_rate_control_(low_latency_rate_control),
+      key_frame_throttle_(key_frame_throttle),
+      nvcodec_temporal_layers_(nvcodec_temporal_layers),
+      h264_formats_(std::move(h264_formats)) {
+  if (simulcast) {
+    internal_encoder_factory_.reset(new HWVideoEncoderFactory(
+        false, nvcodec_async, mmal_low_latency, low_latency_rate_control,
+        key_frame_throttle, nvcodec_temporal_layers, h264_formats_));
+  }
+}
 
 std::vector<webrtc::SdpVideoFormat> HWVideoEncoderFactory::GetSupportedFormats()
     const {
@@ -43,6 +88,9 @@ std::vector<webrtc::SdpVideoFormat> HWVideoEncoderFactory::GetSupportedFormats()
       CreateH264Format(webrtc::H264::kProfileConstrainedBaseline,
                        webrtc::H264::kLevel3_1, "0")};
 
+  if (!h264_formats_.empty())
+    h264_codecs = h264_formats_;
+
   for (const webrtc::SdpVideoFormat& format : h264_codecs)
     supported_codecs.push_back(format);
 
@@ -61,40 +109,96 @@ webrtc::VideoEncoderFactory::CodecInfo HWVideoEncoderFactory::QueryVideoEncoder(
     info.is_hardware_accelerated = true;
   else
     info.is_hardware_accelerated = false;
+#if USE_JETSON_ENCODER
+  if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName) &&
+      IsHardwareVP9Format(format))
+    info.is_hardware_accelerated = true;
+#endif
   return info;
 }
 
 std::unique_ptr<webrtc::VideoEncoder> HWVideoEncoderFactory::CreateVideoEncoder(
     const webrtc::SdpVideoFormat& format) {
+  // ソフトウェアエンコーダは解像度と負荷に合わせた設定で動かす
   if (absl::EqualsIgnoreCase(format.name, cricket::kVp8CodecName))
-    return webrtc::VP8Encoder::Create();
+    return std::unique_ptr<webrtc::VideoEncoder>(
+        absl::make_unique<SoftwareVideoEncoder>(webrtc::VP8Encoder::Create(),
+                                                "libvpx VP8"));
 
-  if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName))
-    return webrtc::VP9Encoder::Create(cricket::VideoCodec(format));
+  if (absl::EqualsIgnoreCase(format.name, cricket::kVp9CodecName)) {
+#if USE_JETSON_ENCODER
+    if (IsHardwareVP9Format(format)) {
+      return std::unique_ptr<webrtc::VideoEncoder>(
+          absl::make_unique<JetsonH264Encoder>(cricket::VideoCodec(format),
+                                               low_latency_rate_control_,
+                                               key_frame_throttle_));
+    }
+#endif
+    return std::unique_ptr<webrtc::VideoEncoder>(
+        absl::make_unique<SoftwareVideoEncoder>(
+            webrtc::VP9Encoder::Create(cricket::VideoCodec(format)),
+            "libvpx VP9"));
+  }
 
   if (absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName)) {
+    if (internal_encoder_factory_) {
+      // 各レイヤーのエンコーダは SimulcastEncoderAdapter が生成する
+      return std::unique_ptr<webrtc::VideoEncoder>(
+          absl::make_unique<webrtc::EncoderSimulcastProxy>(
+              internal_encoder_factory_.get(), format));
+    }
+#if USE_V4L2_M2M
+    // libcamera や V4L2 キャプチャの DMABUF をそのまま受け取れる。
+    // M2M のデバイスが見つからない場合は、他のハードウェアエンコーダがあればそちらを使う
+    if (V4L2M2MH264Encoder::IsSupported()) {
+      return std::unique_ptr<webrtc::VideoEncoder>(
+          absl::make_unique<V4L2M2MH264Encoder>(cricket::VideoCodec(format),
+                                                key_frame_throttle_));
+    }
+    RTC_LOG(LS_WARNING) << "V4L2 M2M H264 encoder is not found";
+#endif
 #if USE_MMAL_ENCODER
     return std::unique_ptr<webrtc::VideoEncoder>(
-        absl::make_unique<MMALH264Encoder>(cricket::VideoCodec(format)));
+        absl::make_unique<MMALH264Encoder>(cricket::VideoCodec(format),
+                                           mmal_low_latency_,
+                                           low_latency_rate_control_,
+                                           key_frame_throttle_));
 #endif
 #if USE_JETSON_ENCODER
     return std::unique_ptr<webrtc::VideoEncoder>(
-        absl::make_unique<JetsonH264Encoder>(cricket::VideoCodec(format)));
+        absl::make_unique<JetsonH264Encoder>(cricket::VideoCodec(format),
+                                             low_latency_rate_control_,
+                                             key_frame_throttle_));
 #endif
 #if USE_NVCODEC_ENCODER
     if (NvCodecH264Encoder::IsSupported()) {
       return std::unique_ptr<webrtc::VideoEncoder>(
-          absl::make_unique<NvCodecH264Encoder>(cricket::VideoCodec(format)));
-    } else {
-      RTC_LOG(LS_WARNING) << "NVIDIA VIDEO CODEC SDK is not supported";
-      return nullptr;
+          absl::make_unique<NvCodecH264Encoder>(cricket::VideoCodec(format),
+                                                nvcodec_async_,
+                                                low_latency_rate_control_,
+                                                key_frame_throttle_,
+                                                nvcodec_temporal_layers_));
+    }
+    RTC_LOG(LS_WARNING) << "NVIDIA VIDEO CODEC SDK is not supported";
+#endif
+#if USE_VAAPI_ENCODER
+    // NVIDIA の GPU が無い Intel や AMD のマシンでは VA-API を使う
+    if (VaapiH264Encoder::IsSupported()) {
+      return std::unique_ptr<webrtc::VideoEncoder>(
+          absl::make_unique<VaapiH264Encoder>(cricket::VideoCodec(format),
+                                              key_frame_throttle_));
     }
+    RTC_LOG(LS_WARNING) << "VA-API H264 encoder is not found";
+#endif
+#if USE_NVCODEC_ENCODER || USE_VAAPI_ENCODER
+    return nullptr;
 #endif
   }
 
 #if !defined(__arm__) || defined(__aarch64__) || defined(__ARM_NEON__)
   if (absl::EqualsIgnoreCase(format.name, cricket::kAv1CodecName))
-    return webrtc::CreateLibaomAv1Encoder();
+    return std::unique_ptr<webrtc::VideoEncoder>(
+        absl::make_unique<RealtimeAV1Encoder>());
 #endif
 
   RTC_LOG(LS_ERROR) << "Trying to created encoder of unsupported format "
@@ -7,10 +7,26 @@
 #include "api/video_codecs/sdp_video_format.h"
 #include "api/video_codecs/video_encoder.h"
 #include "api/video_codecs/video_encoder_factory.h"
+#include "key_frame_throttle.h"
 
 class HWVideoEncoderFactory : public webrtc::VideoEncoderFactory {
  public:
-  HWVideoEncoderFactory() {}
+  // simulcast が true の場合、H264 のエンコーダを EncoderSimulcastProxy でラップする
+  // nvcodec_async が true の場合、NvCodec の H264 エンコーダを非同期モードで動かす
+  // mmal_low_latency が true の場合、MMAL の H264 エンコーダをスライス毎に出力させる
+  // low_latency_rate_control が true の場合、ハードウェアエンコーダを低遅延のレート制御で動かす
+  // key_frame_throttle でハードウェアエンコーダへのキーフレームの要求をまとめる
+  // nvcodec_temporal_layers は NvCodec の H264 エンコーダの時間方向のレイヤーの数
+  // h264_formats は広告する H264 の形式。空の場合は Level 3.1 の Baseline と Constrained Baseline
+  explicit HWVideoEncoderFactory(
+      bool simulcast = false,
+      bool nvcodec_async = false,
+      bool mmal_low_latency = false,
+      bool low_latency_rate_control = false,
+      KeyFrameThrottle::Settings key_frame_throttle =
+          KeyFrameThrottle::Settings(),
+      int nvcodec_temporal_layers = 1,
+      std::vector<webrtc::SdpVideoFormat> h264_formats = {});
   virtual ~HWVideoEncoderFactory() {}
 
   std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
@@ -20,6 +36,16 @@ class HWVideoEncoderFactory : public webrtc::VideoEncoderFactory {
 
   std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
       const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  // サイマルキャスト時に、各レイヤーのエンコーダを生成するためのファクトリ
+  std::unique_ptr<HWVideoEncoderFactory> internal_encoder_factory_;
+  const bool nvcodec_async_;
+  const bool mmal_low_latency_;
+  const bool low_latency_rate_control_;
+  const KeyFrameThrottle::Settings key_frame_throttle_;
+  const int nvcodec_temporal_layers_;
+  const std::vector<webrtc::SdpVideoFormat> h264_formats_;
 };
 
 #endif  // HW_VIDEO_ENCODER_FACTORY_H_
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "i420_converter.h"
+
+#include "third_party/libyuv/include/libyuv.h"
+
+namespace {
+
+template <webrtc::VideoType kType>
+bool ConvertTo(const uint8_t* data,
+               size_t size,
+               int width,
+               int height,
+               uint32_t fourcc,
+               webrtc::I420Buffer* dst) {
+  return libyuv::ConvertToI420(
+             data, size, dst->MutableDataY(), dst->StrideY(),
+             dst->MutableDataU(), dst->StrideU(), dst->MutableDataV(),
+             dst->StrideV(), 0, 0, width, height, width, height,
+             libyuv::kRotate0, fourcc) >= 0;
+}
+
+template <>
+bool ConvertTo<webrtc::VideoType::kYUY2>(const uint8_t* data,
+                                         size_t size,
+                                         int width,
+                                         int height,
+                                         uint32_t fourcc,
+                                         webrtc::I420Buffer* dst) {
+  if (size < static_cast<size_t>(width) * height * 2) {
+    return false;
+  }
+  return libyuv::YUY2ToI420(data, width * 2, dst->MutableDataY(),
+                            dst->StrideY(), dst->MutableDataU(),
+                            dst->StrideU(), dst->MutableDataV(),
+                            dst->StrideV(), width, height) == 0;
+}
+
+template <>
+bool ConvertTo<webrtc::VideoType::kUYVY>(const uint8_t* data,
+                                         size_t size,
+                                         int width,
+                                         int height,
+                                         uint32_t fourcc,
+                                         webrtc::I420Buffer* dst) {
+  if (size < static_cast<size_t>(width) * height * 2) {
+    return false;
+  }
+  return libyuv::UYVYToI420(data, width * 2, dst->MutableDataY(),
+                            dst->StrideY(), dst->MutableDataU(),
+                            dst->StrideU(), dst->MutableDataV(),
+                            dst->StrideV(), width, height) == 0;
+}
+
+template <>
+bool ConvertTo<webrtc::VideoType::kNV12>(const uint8_t* data,
+                                         size_t size,
+                                         int width,
+                                         int height,
+                                         uint32_t fourcc,
+                                         webrtc::I420Buffer* dst) {
+  const int stride_uv = (width + 1) / 2 * 2;
+  const size_t size_y = static_cast<size_t>(width) * height;
+  if (size < size_y + static_cast<size_t>(stride_uv) * ((height + 1) / 2)) {
+    return false;
+  }
+  return libyuv::NV12ToI420(data, width, data + size_y, stride_uv,
+                            dst->MutableDataY(), dst->StrideY(),
+                            dst->MutableDataU(), dst->StrideU(),
+                            dst->MutableDataV(), dst->StrideV(), width,
+                            height) == 0;
+}
+
+template <>
+bool ConvertTo<webrtc::VideoType::kI420>(const uint8_t* data,
+                                         size_t size,
+                                         int width,
+                                         int height,
+                                         uint32_t fourcc,
+                                         webrtc::I420Buffer* dst) {
+  const int stride_uv = (width + 1) / 2;
+  const size_t size_y = static_cast<size_t>(width) * height;
+  const size_t size_uv = static_cast<size_t>(stride_uv) * ((height + 1) / 2);
+  if (size < size_y + size_uv * 2) {
+    return false;
+  }
+  return libyuv::I420Copy(data, width, data + size_y, stride_uv,
+                          data + size_y + size_uv, stride_uv,
+                          dst->MutableDataY(), dst->StrideY(),
+                          dst->MutableDataU(), dst->StrideU(),
+                          dst->MutableDataV(), dst->StrideV(), width,
+                          height) == 0;
+}
+
+template <>
+bool ConvertTo<webrtc::VideoType::kMJPEG>(const uint8_t* data,
+                                          size_t size,
+                                          int width,
+                                          int height,
+                                          uint32_t fourcc,
+                                          webrtc::I420Buffer* dst) {
+  return libyuv::MJPGToI420(data, size, dst->MutableDataY(), dst->StrideY(),
+                            dst->MutableDataU(), dst->StrideU(),
+                            dst->MutableDataV(), dst->StrideV(), width,
+                            height, width, height) == 0;
+}
+
+}  // namespace
+
+I420Converter::I420Converter(webrtc::VideoType video_type)
+    : fourcc_(webrtc::ConvertVideoType(video_type)) {
+  switch (video_type) {
+    case webrtc::VideoType::kYUY2:
+      func_ = &ConvertTo<webrtc::VideoType::kYUY2>;
+      break;
+    case webrtc::VideoType::kUYVY:
+      func_ = &ConvertTo<webrtc::VideoType::kUYVY>;
+      break;
+    case webrtc::VideoType::kNV12:
+      func_ = &ConvertTo<webrtc::VideoType::kNV12>;
+      break;
+    case webrtc::VideoType::kI420:
+      func_ = &ConvertTo<webrtc::VideoType::kI420>;
+      break;
+    case webrtc::VideoType::kMJPEG:
+      func_ = &ConvertTo<webrtc::VideoType::kMJPEG>;
+      break;
+    default:
+      func_ = &ConvertTo<webrtc::VideoType::kUnknown>;
+      break;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef I420_CONVERTER_H_
+#define I420_CONVERTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api/video/i420_buffer.h"
+#include "common_video/libyuv/include/webrtc_libyuv.h"
+
+// キャプチャした形式のフレームを、同じ大きさの I420 に変換するクラス。
+//
+// libyuv::ConvertToI420() はフレーム毎に FOURCC で分岐し、回転や切り出しの計算もする。
+// YUY2, UYVY, NV12, I420, MJPEG は形式毎に特殊化した関数を用意しておき、
+// キャプチャを開始する時に 1 度だけ選んで、フレーム毎には分岐しないようにする。
+// それ以外の形式は ConvertToI420() をそのまま使う。
+class I420Converter {
+ public:
+  I420Converter() : I420Converter(webrtc::VideoType::kUnknown) {}
+  explicit I420Converter(webrtc::VideoType video_type);
+
+  // dst は width x height で確保しておくこと。変換できなかった場合は false を返す
+  bool Convert(const uint8_t* data,
+               size_t size,
+               int width,
+               int height,
+               webrtc::I420Buffer* dst) const {
+    return func_(data, size, width, height, fourcc_, dst);
+  }
+
+ private:
+  typedef bool (*Func)(const uint8_t* data,
+                       size_t size,
+                       int width,
+                       int height,
+                       uint32_t fourcc,
+                       webrtc::I420Buffer* dst);
+  Func func_;
+  // 特殊化していない形式の場合に ConvertToI420() に渡す FOURCC
+  uint32_t fourcc_;
+};
+
+#endif  // I420_CONVERTER_H_
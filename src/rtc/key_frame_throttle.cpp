@@ -0,0 +1,33 @@
+#include "key_frame_throttle.h"
+
+KeyFrameThrottle::KeyFrameThrottle(Settings settings) : settings_(settings) {}
+
+KeyFrameThrottle::Action KeyFrameThrottle::Update(bool requested,
+                                                  bool can_intra_refresh,
+                                                  int64_t now_ms) {
+  if (settings_.min_interval_ms <= 0) {
+    return requested ? Action::kKeyFrame : Action::kNone;
+  }
+  if (requested) {
+    pending_ = true;
+  }
+  if (!pending_) {
+    return Action::kNone;
+  }
+  if (last_key_frame_ms_ < 0 ||
+      now_ms - last_key_frame_ms_ >= settings_.min_interval_ms) {
+    pending_ = false;
+    last_key_frame_ms_ = now_ms;
+    return Action::kKeyFrame;
+  }
+  if (settings_.intra_refresh && can_intra_refresh && requested) {
+    pending_ = false;
+    return Action::kIntraRefresh;
+  }
+  return Action::kNone;
+}
+
+void KeyFrameThrottle::OnKeyFrame(int64_t now_ms) {
+  last_key_frame_ms_ = now_ms;
+  pending_ = false;
+}
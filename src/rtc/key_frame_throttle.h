@@ -0,0 +1,45 @@
+#ifndef KEY_FRAME_THROTTLE_H_
+#define KEY_FRAME_THROTTLE_H_
+
+#include <stdint.h>
+
+// パケットロスで PLI/FIR が続けて来た時に、キーフレームを送る回数を抑えるクラス。
+//
+// キーフレームは min_interval_ms に 1 回までにして、その間に来た要求は覚えておき
+// 間隔が空いた時に 1 つの IDR にまとめて送る。
+// intra_refresh を指定した場合は、間隔の中で来た要求は IDR を待たせずに
+// イントラリフレッシュで応えて、復旧にかかる量を数フレームに分ける。
+// 受信側がそれでも復旧できなければ、もう一度要求が来て次の間隔で IDR を送ることになる。
+// エンコードするスレッドから呼び出すこと。
+class KeyFrameThrottle {
+ public:
+  struct Settings {
+    // 0 の場合はまとめずに、要求された時はいつもキーフレームを送る
+    int min_interval_ms = 0;
+    bool intra_refresh = false;
+  };
+
+  enum class Action {
+    kNone,
+    kKeyFrame,
+    kIntraRefresh,
+  };
+
+  explicit KeyFrameThrottle(Settings settings);
+
+  const Settings& settings() const { return settings_; }
+
+  // フレーム毎に呼び出して、このフレームをどうエンコードするかを返す。
+  // requested はこのフレームでキーフレームを要求されたかどうか。
+  // can_intra_refresh が false の場合はイントラリフレッシュを返さない
+  Action Update(bool requested, bool can_intra_refresh, int64_t now_ms);
+  // エンコーダを作り直した時など、要求とは関係なくキーフレームを出した時に呼ぶ
+  void OnKeyFrame(int64_t now_ms);
+
+ private:
+  const Settings settings_;
+  int64_t last_key_frame_ms_ = -1;
+  bool pending_ = false;
+};
+
+#endif  // KEY_FRAME_THROTTLE_H_
@@ -0,0 +1,212 @@
+#include "latency_controller.h"
+
+#include <algorithm>
+#include <boost/asio/post.hpp>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 受信側のジッターバッファの遅延は、報告されたジッターのこの倍数と見なす
+const double kJitterBufferFactor = 2.0;
+// 目標に対してこの割合より小さい状態が続いたら戻し始める
+const double kRestoreRatio = 0.7;
+const int kRestoreIntervals = 3;
+// 1 回で変える量
+const double kBitrateDecreaseFactor = 0.85;
+const double kBitrateIncreaseFactor = 1.1;
+const double kFramerateFactor = 2.0 / 3.0;
+const double kScaleFactor = 1.5;
+const double kMaxScale = 4.0;
+// この回数の間値が来なかった接続の状態は捨てる
+const int kExpireIntervals = 10;
+
+}  // namespace
+
+std::shared_ptr<LatencyController> LatencyController::Create(
+    boost::asio::io_context& ioc,
+    Settings settings) {
+  if (settings.target_ms <= 0) {
+    return nullptr;
+  }
+  return std::make_shared<LatencyController>(ioc, settings);
+}
+
+LatencyController::LatencyController(boost::asio::io_context& ioc,
+                                     Settings settings)
+    : ioc_(ioc), settings_(settings) {}
+
+void LatencyController::Start(StatsSampler* sampler) {
+  interval_ms_ = sampler->interval_ms();
+  std::weak_ptr<LatencyController> weak_self = shared_from_this();
+  sampler->AddListener([weak_self](int id,
+                                   const std::shared_ptr<RTCConnection>& c,
+                                   const StatsSampler::Sample& sample) {
+    auto self = weak_self.lock();
+    if (!self) {
+      return;
+    }
+    // シグナリングスレッドから呼ばれるので、io_context のスレッドで処理する
+    std::shared_ptr<RTCConnection> connection = c;
+    boost::asio::post(self->ioc_, [self, id, connection, sample]() {
+      self->OnSample(id, connection, sample);
+    });
+  });
+}
+
+void LatencyController::OnSample(int id,
+                                 std::shared_ptr<RTCConnection> connection,
+                                 const StatsSampler::Sample& sample) {
+  const int64_t now_ms = rtc::TimeMillis();
+  for (auto it = states_.begin(); it != states_.end();) {
+    if (now_ms - it->second.last_sample_ms > kExpireIntervals * interval_ms_) {
+      it = states_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  auto result = states_.insert(std::make_pair(id, State()));
+  State& state = result.first->second;
+  if (result.second) {
+    state.framerate = settings_.framerate;
+  }
+  state.last_sample_ms = now_ms;
+  // 最初の値は差分が無いので使わない
+  if (sample.interval_ms <= 0) {
+    return;
+  }
+
+  const double latency_ms = sample.encode_ms_per_frame +
+                            sample.pacer_delay_ms + sample.rtt_ms / 2 +
+                            sample.remote_jitter_ms * kJitterBufferFactor;
+  if (!Adjust(&state, latency_ms, sample.available_outgoing_bitrate_bps)) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << " connection=" << id
+                   << " latency_ms=" << latency_ms
+                   << " bitrate_bps=" << state.bitrate_bps
+                   << " framerate=" << state.framerate
+                   << " scale=" << state.scale;
+  connection->setVideoEncodingLimits(
+      state.bitrate_bps,
+      state.framerate < settings_.framerate ? state.framerate : 0,
+      state.scale);
+}
+
+bool LatencyController::Adjust(State* state,
+                               double latency_ms,
+                               double available_bps) {
+  if (latency_ms > settings_.target_ms) {
+    state->good_intervals = 0;
+    // 最初は輻輳制御が見積もった帯域から下げる
+    int bitrate_bps = state->bitrate_bps;
+    if (bitrate_bps <= 0) {
+      bitrate_bps = available_bps > 0 ? static_cast<int>(available_bps)
+                                      : settings_.max_bitrate_bps;
+    }
+    if (settings_.max_bitrate_bps > 0) {
+      bitrate_bps = std::min(bitrate_bps, settings_.max_bitrate_bps);
+    }
+    if (bitrate_bps > settings_.min_bitrate_bps) {
+      state->bitrate_bps =
+          std::max(static_cast<int>(bitrate_bps * kBitrateDecreaseFactor),
+                   settings_.min_bitrate_bps);
+      return true;
+    }
+    return Degrade(state);
+  }
+
+  if (latency_ms >= settings_.target_ms * kRestoreRatio) {
+    state->good_intervals = 0;
+    return false;
+  }
+  if (++state->good_intervals < kRestoreIntervals) {
+    return false;
+  }
+  state->good_intervals = 0;
+  // フレームレートと解像度を先に戻してから、ビットレートを上げる
+  if (Restore(state)) {
+    return true;
+  }
+  if (state->bitrate_bps <= 0) {
+    return false;
+  }
+  int bitrate_bps = static_cast<int>(state->bitrate_bps *
+                                     kBitrateIncreaseFactor);
+  if (settings_.max_bitrate_bps > 0) {
+    bitrate_bps = std::min(bitrate_bps, settings_.max_bitrate_bps);
+  }
+  // 輻輳制御の見積もりを超えたら、上限を外して輻輳制御に任せる
+  if (available_bps > 0 && bitrate_bps >= available_bps &&
+      settings_.max_bitrate_bps <= 0) {
+    bitrate_bps = 0;
+  }
+  if (bitrate_bps == state->bitrate_bps) {
+    return false;
+  }
+  state->bitrate_bps = bitrate_bps;
+  return true;
+}
+
+bool LatencyController::Degrade(State* state) {
+  const bool can_reduce_framerate =
+      state->framerate * kFramerateFactor >= settings_.min_framerate;
+  const bool can_reduce_resolution = state->scale * kScaleFactor <= kMaxScale;
+  bool reduce_framerate;
+  switch (settings_.degradation_preference) {
+    case webrtc::DegradationPreference::MAINTAIN_FRAMERATE:
+      reduce_framerate = !can_reduce_resolution;
+      break;
+    case webrtc::DegradationPreference::MAINTAIN_RESOLUTION:
+      reduce_framerate = can_reduce_framerate;
+      break;
+    default:
+      // フレームレートを下げた割合が解像度より小さい方を下げる
+      reduce_framerate =
+          can_reduce_framerate &&
+          (!can_reduce_resolution ||
+           settings_.framerate / state->framerate <= state->scale);
+      break;
+  }
+  if (reduce_framerate && can_reduce_framerate) {
+    state->framerate *= kFramerateFactor;
+    return true;
+  }
+  if (!reduce_framerate && can_reduce_resolution) {
+    state->scale *= kScaleFactor;
+    return true;
+  }
+  return false;
+}
+
+bool LatencyController::Restore(State* state) {
+  const bool framerate_reduced = state->framerate < settings_.framerate;
+  const bool resolution_reduced = state->scale > 1.0;
+  if (!framerate_reduced && !resolution_reduced) {
+    return false;
+  }
+  // Degrade() で後に下げた方から戻す
+  bool restore_framerate;
+  switch (settings_.degradation_preference) {
+    case webrtc::DegradationPreference::MAINTAIN_FRAMERATE:
+      restore_framerate = framerate_reduced;
+      break;
+    case webrtc::DegradationPreference::MAINTAIN_RESOLUTION:
+      restore_framerate = !resolution_reduced;
+      break;
+    default:
+      restore_framerate =
+          framerate_reduced &&
+          (!resolution_reduced ||
+           settings_.framerate / state->framerate >= state->scale);
+      break;
+  }
+  if (restore_framerate) {
+    state->framerate = std::min<double>(state->framerate / kFramerateFactor,
+                                        settings_.framerate);
+  } else {
+    state->scale = std::max(state->scale / kScaleFactor, 1.0);
+  }
+  return true;
+}
@@ -0,0 +1,79 @@
+#ifndef LATENCY_CONTROLLER_H_
+#define LATENCY_CONTROLLER_H_
+
+#include <stdint.h>
+
+#include <boost/asio/io_context.hpp>
+#include <map>
+#include <memory>
+
+// WebRTC
+#include "api/rtp_parameters.h"
+
+#include "connection.h"
+#include "stats_sampler.h"
+
+// 映像の遅延が目標を超えないように、接続毎に送信するビットレート、フレームレート、解像度を
+// 調整するクラス。
+//
+// StatsSampler が取得した値から、エンコード + ペーサーで待った時間 + RTT の半分 +
+// 受信側のジッターバッファ (受信側から報告されたジッターの 2 倍) を映像の遅延として見積もる。
+// 見積もりが目標を超えたらビットレートの上限を下げ、最低のビットレートまで下げても
+// 超えている場合は degradation_preference に従ってフレームレートか解像度を下げる。
+// 目標を十分に下回る状態が続いたら、逆の順番で戻していく。
+// --sora-video-bitrate などで決めたビットレートより上げることはない。
+// io_context は 1 スレッドで回していること。
+class LatencyController
+    : public std::enable_shared_from_this<LatencyController> {
+ public:
+  struct Settings {
+    // 0 以下の場合は調整しない
+    int target_ms = 0;
+    int min_bitrate_bps = 100 * 1000;
+    // 0 の場合はビットレートの上限を決めない
+    int max_bitrate_bps = 0;
+    // キャプチャのフレームレート。ここから min_framerate まで下げる
+    int framerate = 30;
+    int min_framerate = 5;
+    webrtc::DegradationPreference degradation_preference =
+        webrtc::DegradationPreference::BALANCED;
+  };
+
+  // settings.target_ms が 0 以下の場合は nullptr を返す
+  static std::shared_ptr<LatencyController> Create(boost::asio::io_context& ioc,
+                                                   Settings settings);
+
+  LatencyController(boost::asio::io_context& ioc, Settings settings);
+
+  // sampler が値を取得する度に調整する
+  void Start(StatsSampler* sampler);
+
+ private:
+  // 接続毎の調整の状態
+  struct State {
+    // 0 の場合はビットレートの上限を決めていない
+    int bitrate_bps = 0;
+    double framerate = 0;
+    double scale = 1.0;
+    // 目標を十分に下回った回数
+    int good_intervals = 0;
+    // 最後に値を受け取った時刻
+    int64_t last_sample_ms = 0;
+  };
+
+  void OnSample(int id,
+                std::shared_ptr<RTCConnection> connection,
+                const StatsSampler::Sample& sample);
+  // 見積もった遅延に従って state を変える。変えた場合は true を返す
+  bool Adjust(State* state, double latency_ms, double available_bps);
+  bool Degrade(State* state);
+  bool Restore(State* state);
+
+  boost::asio::io_context& ioc_;
+  const Settings settings_;
+  int interval_ms_ = 0;
+  // StatsSampler が振った接続の番号毎の状態
+  std::map<int, State> states_;
+};
+
+#endif  // LATENCY_CONTROLLER_H_
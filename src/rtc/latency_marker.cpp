@@ -0,0 +1,141 @@
+#include "latency_marker.h"
+
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 統計情報をログに出力する間隔
+const int64_t kStatsIntervalUs = 10 * rtc::kNumMicrosecsPerSec;
+
+// ブロックが小さすぎるとエンコードで潰れてしまう
+const int kMinBlockSize = 4;
+
+const uint8_t kWhite = 235;
+const uint8_t kBlack = 16;
+
+// 真っ黒や真っ白の映像を誤検出しないように、単純な和ではなく値を混ぜる
+uint8_t Checksum(uint32_t value) {
+  uint8_t sum = (value & 0xff) + ((value >> 8) & 0xff) +
+                ((value >> 16) & 0xff) + ((value >> 24) & 0xff);
+  return sum ^ 0xa5;
+}
+
+int BlockLeft(int width, int index) {
+  return index * width / LatencyMarker::kBlocks;
+}
+
+}  // namespace
+
+uint32_t LatencyMarker::NowMs() {
+  return static_cast<uint32_t>(rtc::TimeUTCMillis());
+}
+
+uint32_t LatencyMarker::CaptureTimeMs(int64_t timestamp_us) {
+  int64_t elapsed_us = rtc::TimeMicros() - timestamp_us;
+  return static_cast<uint32_t>(
+      (rtc::TimeUTCMicros() - elapsed_us) / rtc::kNumMicrosecsPerMillisec);
+}
+
+bool LatencyMarker::Stamp(uint8_t* data_y,
+                          int stride_y,
+                          int width,
+                          int height,
+                          uint32_t timestamp_ms) {
+  const int block_size = width / kBlocks;
+  if (block_size < kMinBlockSize || block_size > height) {
+    return false;
+  }
+
+  const uint64_t bits =
+      (static_cast<uint64_t>(timestamp_ms) << 8) | Checksum(timestamp_ms);
+  for (int i = 0; i < kBlocks; i++) {
+    const bool bit = (bits >> (kBlocks - 1 - i)) & 1;
+    const int left = BlockLeft(width, i);
+    const int right = BlockLeft(width, i + 1);
+    for (int y = 0; y < block_size; y++) {
+      std::fill(data_y + y * stride_y + left, data_y + y * stride_y + right,
+                bit ? kWhite : kBlack);
+    }
+  }
+  return true;
+}
+
+bool LatencyMarker::Read(const uint8_t* data_y,
+                         int stride_y,
+                         int width,
+                         int height,
+                         uint32_t* timestamp_ms) {
+  const double block_size = static_cast<double>(width) / kBlocks;
+  if (block_size < kMinBlockSize || block_size > height) {
+    return false;
+  }
+
+  // ブロックの境界はエンコードで滲むので、中央の半分だけを見る
+  const int half = std::max(1, static_cast<int>(block_size / 4));
+  const int center_y = static_cast<int>(block_size / 2);
+  uint64_t bits = 0;
+  for (int i = 0; i < kBlocks; i++) {
+    const int center_x = static_cast<int>((i + 0.5) * block_size);
+    int sum = 0;
+    int count = 0;
+    for (int y = center_y - half; y < center_y + half; y++) {
+      for (int x = center_x - half; x < center_x + half; x++) {
+        sum += data_y[y * stride_y + x];
+        count++;
+      }
+    }
+    bits = (bits << 1) | (sum / count >= 128 ? 1 : 0);
+  }
+
+  const uint32_t value = static_cast<uint32_t>(bits >> 8);
+  if (Checksum(value) != (bits & 0xff)) {
+    return false;
+  }
+  *timestamp_ms = value;
+  return true;
+}
+
+LatencyStats::LatencyStats(std::string name)
+    : name_(std::move(name)), last_log_us_(rtc::TimeMicros()) {}
+
+void LatencyStats::Add(int64_t latency_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  samples_.push_back(latency_ms);
+  MaybeLogStats(rtc::TimeMicros());
+}
+
+void LatencyStats::AddMissing() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  missing_++;
+  MaybeLogStats(rtc::TimeMicros());
+}
+
+void LatencyStats::MaybeLogStats(int64_t now_us) {
+  if (now_us - last_log_us_ < kStatsIntervalUs) {
+    return;
+  }
+  last_log_us_ = now_us;
+
+  if (samples_.empty()) {
+    RTC_LOG(LS_INFO) << "LatencyStats " << name_
+                     << ": no marker found in " << missing_ << " frames";
+    missing_ = 0;
+    return;
+  }
+
+  std::sort(samples_.begin(), samples_.end());
+  auto percentile = [this](int p) {
+    return samples_[(samples_.size() - 1) * p / 100];
+  };
+  RTC_LOG(LS_INFO) << "LatencyStats " << name_
+                   << ": frames=" << samples_.size() << " missing=" << missing_
+                   << " p50_ms=" << percentile(50)
+                   << " p90_ms=" << percentile(90)
+                   << " p99_ms=" << percentile(99)
+                   << " max_ms=" << samples_.back();
+  samples_.clear();
+  missing_ = 0;
+}
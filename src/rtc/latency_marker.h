@@ -0,0 +1,62 @@
+#ifndef LATENCY_MARKER_H_
+#define LATENCY_MARKER_H_
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 映像の遅延 (glass-to-glass) を計測するために、フレームの左上にキャプチャ時刻を書き込むクラス。
+//
+// フレームの上端に、幅を kBlocks 等分した正方形のブロックを並べて、
+// UTC のミリ秒の下位 32 ビットとチェックサム 8 ビットを白黒で書き込む。
+// ブロックの位置はフレームの幅に対する比率で決まるので、途中で縮小されても読み取れる。
+// 書き込むのは輝度だけなので、ブロックには元の映像の色が少し残る。
+//
+// 送信側と受信側が別のマシンの場合は、NTP などで時計を合わせておくこと。
+class LatencyMarker {
+ public:
+  static const int kBlocks = 40;
+
+  // 現在時刻 (UTC のミリ秒の下位 32 ビット)
+  static uint32_t NowMs();
+  // UTC に変換したキャプチャ時刻。timestamp_us は rtc::TimeMicros() 基準
+  static uint32_t CaptureTimeMs(int64_t timestamp_us);
+
+  // 幅が小さすぎる場合は何もせずに false を返す
+  static bool Stamp(uint8_t* data_y,
+                    int stride_y,
+                    int width,
+                    int height,
+                    uint32_t timestamp_ms);
+  // マーカーが見つからなかった場合は false を返す
+  static bool Read(const uint8_t* data_y,
+                   int stride_y,
+                   int width,
+                   int height,
+                   uint32_t* timestamp_ms);
+};
+
+// 受信側で計測した遅延を集計して、一定間隔でパーセンタイルをログに出力するクラス。
+// 各メソッドは任意のスレッドから呼び出して良い。
+class LatencyStats {
+ public:
+  explicit LatencyStats(std::string name);
+
+  // マーカーを読み取ったフレームの遅延
+  void Add(int64_t latency_ms);
+  // マーカーが読み取れなかったフレーム
+  void AddMissing();
+
+ private:
+  void MaybeLogStats(int64_t now_us);
+
+  const std::string name_;
+  std::mutex mutex_;
+  std::vector<int64_t> samples_;
+  int64_t missing_ = 0;
+  int64_t last_log_us_;
+};
+
+#endif  // LATENCY_MARKER_H_
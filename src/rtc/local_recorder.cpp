@@ -0,0 +1,562 @@
+#include "local_recorder.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "memory_accounting.h"
+#include "thread_placement.h"
+
+namespace {
+
+// O_DIRECT で書き込む単位と、その時に使うバッファの大きさ
+const size_t kDirectIoAlignment = 4096;
+const size_t kDirectIoBufferSize = 1024 * 1024;
+// ページキャッシュを使う場合、この量を書く毎に書き出しを始めさせて一度に溜まらないようにする
+const uint64_t kWritebackInterval = 8 * 1024 * 1024;
+// PTS が 0 を下回らないように、最初のフレームの PTS をこの値 (90kHz) にする
+const int64_t kPtsOffset = 90000;
+
+std::string SegmentPath(const std::string& dir,
+                        const char* prefix,
+                        int index) {
+  time_t now = time(nullptr);
+  struct tm tm;
+#if defined(_WIN32)
+  localtime_s(&tm, &now);
+#else
+  localtime_r(&now, &tm);
+#endif
+  char name[64];
+  strftime(name, sizeof(name), "_%Y%m%d_%H%M%S_", &tm);
+  return (boost::filesystem::path(dir) /
+          (prefix + std::string(name) + std::to_string(index) + ".ts"))
+      .string();
+}
+
+}  // namespace
+
+// 1 つのセグメントのファイル。書き込みスレッドからだけ使う
+class LocalRecorder::SegmentFile {
+ public:
+  static std::unique_ptr<SegmentFile> Open(const std::string& path,
+                                           uint64_t preallocate_bytes,
+                                           bool direct_io) {
+    std::unique_ptr<SegmentFile> file(new SegmentFile());
+#if defined(_WIN32)
+    file->fp_ = fopen(path.c_str(), "wb");
+    if (file->fp_ == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to open " << path;
+      return nullptr;
+    }
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#if defined(__linux__)
+    if (direct_io) {
+      file->fd_ = open(path.c_str(), flags | O_DIRECT, 0644);
+      if (file->fd_ < 0) {
+        // tmpfs など O_DIRECT を使えないファイルシステムもある
+        RTC_LOG(LS_WARNING) << "O_DIRECT is not available for " << path
+                            << ": " << strerror(errno);
+      } else {
+        void* buffer = nullptr;
+        if (posix_memalign(&buffer, kDirectIoAlignment,
+                           kDirectIoBufferSize) != 0) {
+          close(file->fd_);
+          file->fd_ = -1;
+        } else {
+          file->direct_buffer_.reset(static_cast<uint8_t*>(buffer));
+        }
+      }
+    }
+#endif
+    if (file->fd_ < 0) {
+      file->fd_ = open(path.c_str(), flags, 0644);
+    }
+    if (file->fd_ < 0) {
+      RTC_LOG(LS_ERROR) << "Failed to open " << path << ": "
+                        << strerror(errno);
+      return nullptr;
+    }
+#if defined(__linux__)
+    // FALLOC_FL_KEEP_SIZE なので、途中で落ちてもファイルの大きさは書いた分だけになる
+    if (preallocate_bytes > 0) {
+      if (fallocate(file->fd_, FALLOC_FL_KEEP_SIZE, 0, preallocate_bytes) ==
+          0) {
+        file->preallocated_ = true;
+      } else {
+        RTC_LOG(LS_WARNING) << "Failed to preallocate " << path << ": "
+                            << strerror(errno);
+      }
+    }
+#endif
+#endif
+    RTC_LOG(LS_INFO) << "Recording to " << path
+                     << (file->direct_buffer_ ? " (O_DIRECT)" : "");
+    return file;
+  }
+
+  ~SegmentFile() { Close(); }
+
+  bool Write(const uint8_t* data, size_t size) {
+#if defined(_WIN32)
+    return fwrite(data, 1, size, fp_) == size;
+#else
+    if (!direct_buffer_) {
+      if (!WriteAll(data, size)) {
+        return false;
+      }
+      written_ += size;
+#if defined(__linux__)
+      if (written_ - writeback_offset_ >= kWritebackInterval) {
+        sync_file_range(fd_, writeback_offset_, written_ - writeback_offset_,
+                        SYNC_FILE_RANGE_WRITE);
+        writeback_offset_ = written_;
+      }
+#endif
+      return true;
+    }
+    // O_DIRECT の場合は kDirectIoAlignment の倍数だけ書き、端数はバッファに残しておく
+    while (size > 0) {
+      size_t n = std::min(size, kDirectIoBufferSize - buffered_);
+      memcpy(direct_buffer_.get() + buffered_, data, n);
+      buffered_ += n;
+      data += n;
+      size -= n;
+      size_t aligned = buffered_ / kDirectIoAlignment * kDirectIoAlignment;
+      if (aligned == 0) {
+        continue;
+      }
+      if (!WriteAll(direct_buffer_.get(), aligned)) {
+        return false;
+      }
+      written_ += aligned;
+      memmove(direct_buffer_.get(), direct_buffer_.get() + aligned,
+              buffered_ - aligned);
+      buffered_ -= aligned;
+    }
+    return true;
+#endif
+  }
+
+  void Close() {
+#if defined(_WIN32)
+    if (fp_ != nullptr) {
+      fclose(fp_);
+      fp_ = nullptr;
+    }
+#else
+    if (fd_ < 0) {
+      return;
+    }
+    if (direct_buffer_ && buffered_ > 0) {
+      // 端数はブロックの大きさまで埋めて書き、余分な分は切り詰める
+      size_t padded = (buffered_ + kDirectIoAlignment - 1) /
+                      kDirectIoAlignment * kDirectIoAlignment;
+      memset(direct_buffer_.get() + buffered_, 0, padded - buffered_);
+      if (WriteAll(direct_buffer_.get(), padded)) {
+        if (ftruncate(fd_, written_ + buffered_) != 0) {
+          RTC_LOG(LS_WARNING) << "Failed to truncate: " << strerror(errno);
+        }
+      }
+      buffered_ = 0;
+    }
+    // 同じ大きさに切り詰めて、確保したまま使わなかった領域を返す
+    if (preallocated_ && ftruncate(fd_, lseek(fd_, 0, SEEK_END)) != 0) {
+      RTC_LOG(LS_WARNING) << "Failed to truncate: " << strerror(errno);
+    }
+    close(fd_);
+    fd_ = -1;
+#endif
+  }
+
+ private:
+  SegmentFile() = default;
+
+#if !defined(_WIN32)
+  bool WriteAll(const uint8_t* data, size_t size) {
+    while (size > 0) {
+      ssize_t n = write(fd_, data, size);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        RTC_LOG(LS_ERROR) << "Failed to write: " << strerror(errno);
+        return false;
+      }
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+#endif
+
+  struct FreeDeleter {
+    void operator()(uint8_t* p) const { free(p); }
+  };
+
+#if defined(_WIN32)
+  FILE* fp_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  std::unique_ptr<uint8_t, FreeDeleter> direct_buffer_;
+  bool preallocated_ = false;
+  size_t buffered_ = 0;
+  uint64_t written_ = 0;
+  uint64_t writeback_offset_ = 0;
+};
+
+LocalRecorder::LocalRecorder(Settings settings)
+    : settings_(std::move(settings)) {
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(settings_.dir, ec);
+  if (ec) {
+    RTC_LOG(LS_ERROR) << "Failed to create " << settings_.dir << ": "
+                      << ec.message();
+  }
+  writer_thread_.reset(new rtc::PlatformThread(
+      LocalRecorder::WriterThread, this, "LocalRecorder",
+      rtc::kNormalPriority));
+  writer_thread_->Start();
+}
+
+LocalRecorder::~LocalRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cond_.notify_all();
+  writer_thread_->Stop();
+  CloseSegment();
+  MemoryAccounting::Instance().Add(MemoryAccounting::kRecorder,
+                                   -(int64_t)preroll_bytes_);
+  if (dropped_frames_ > 0) {
+    RTC_LOG(LS_WARNING) << "LocalRecorder dropped " << dropped_frames_
+                        << " frames";
+  }
+}
+
+bool LocalRecorder::AttachVideo(const void* source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (video_source_ != nullptr && video_source_ != source) {
+    return false;
+  }
+  video_source_ = source;
+  waiting_key_frame_ = true;
+  return true;
+}
+
+void LocalRecorder::DetachVideo(const void* source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (video_source_ == source) {
+    video_source_ = nullptr;
+  }
+}
+
+bool LocalRecorder::AttachAudio(const void* source, int channels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (audio_source_ != nullptr && audio_source_ != source) {
+    return false;
+  }
+  audio_source_ = source;
+  audio_channels_ = channels;
+  return true;
+}
+
+void LocalRecorder::DetachAudio(const void* source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (audio_source_ == source) {
+    audio_source_ = nullptr;
+  }
+}
+
+bool LocalRecorder::NeedsKeyFrame(const void* source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (source != video_source_) {
+    return false;
+  }
+  return waiting_key_frame_ || !segment_video_ ||
+         (audio_source_ != nullptr && !segment_audio_) ||
+         rtc::TimeMicros() >= next_segment_us_;
+}
+
+void LocalRecorder::OnVideo(const void* source,
+                            const webrtc::EncodedImage& encoded_image,
+                            int64_t capture_time_us) {
+  const bool key_frame =
+      encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (source != video_source_ || (waiting_key_frame_ && !key_frame)) {
+    return;
+  }
+  if (settings_.preroll_sec <= 0 && !CanPushLocked(encoded_image.size())) {
+    waiting_key_frame_ = true;
+    return;
+  }
+  Frame frame;
+  frame.video = true;
+  frame.key_frame = key_frame;
+  frame.capture_time_us = capture_time_us;
+  if (key_frame &&
+      (!segment_video_ || (audio_source_ != nullptr && !segment_audio_) ||
+       capture_time_us >= next_segment_us_)) {
+    StartSegmentLocked(&frame, capture_time_us);
+  }
+  waiting_key_frame_ = false;
+  // エンコーダのバッファを参照するだけの場合はここでコピーし、
+  // 参照カウント付きのバッファの場合はそのまま参照する
+  webrtc::EncodedImage retained(encoded_image);
+  retained.Retain();
+  frame.data = retained.GetEncodedData();
+  if (settings_.preroll_sec > 0) {
+    AddToPrerollLocked(std::move(frame));
+  } else {
+    PushLocked(std::move(frame));
+  }
+}
+
+void LocalRecorder::OnAudio(const void* source,
+                            const uint8_t* data,
+                            size_t size,
+                            int64_t capture_time_us) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (source != audio_source_ ||
+      (settings_.preroll_sec <= 0 && !CanPushLocked(size))) {
+    return;
+  }
+  Frame frame;
+  frame.capture_time_us = capture_time_us;
+  if (video_source_ != nullptr) {
+    // 映像がある場合は、音声の入ったセグメントが映像のキーフレームで始まるまで待つ
+    if (!segment_audio_) {
+      return;
+    }
+  } else if (!segment_audio_ || segment_video_ ||
+             capture_time_us >= next_segment_us_) {
+    StartSegmentLocked(&frame, capture_time_us);
+  }
+  frame.data = webrtc::EncodedImageBuffer::Create(data, size);
+  if (settings_.preroll_sec > 0) {
+    AddToPrerollLocked(std::move(frame));
+  } else {
+    PushLocked(std::move(frame));
+  }
+}
+
+std::string LocalRecorder::SaveClip() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (settings_.preroll_sec <= 0 || preroll_.empty()) {
+    return "";
+  }
+  bool has_video = false;
+  bool has_audio = false;
+  for (const Frame& frame : preroll_) {
+    (frame.video ? has_video : has_audio) = true;
+  }
+  // バッファを参照するだけなので、書き込み待ちのキューの上限には数えない
+  std::string path = SegmentPath(settings_.dir, "momo_clip", clip_index_++);
+  bool first = true;
+  for (const Frame& frame : preroll_) {
+    // 映像がある場合は映像のキーフレームから始める
+    if (first && has_video && !(frame.video && frame.key_frame)) {
+      continue;
+    }
+    Frame copy = frame;
+    copy.new_segment = first;
+    copy.end_of_file = false;
+    if (first) {
+      copy.segment_video = has_video;
+      copy.segment_audio = has_audio;
+      copy.audio_channels = audio_channels_;
+      copy.path = path;
+      first = false;
+    }
+    queue_.push_back(std::move(copy));
+  }
+  if (first) {
+    return "";
+  }
+  queue_.back().end_of_file = true;
+  cond_.notify_one();
+  RTC_LOG(LS_INFO) << "Saving the last " << preroll_.size() << " frames ("
+                   << preroll_bytes_ << " bytes) to " << path;
+  return path;
+}
+
+bool LocalRecorder::CanPushLocked(size_t size) {
+  if (queue_bytes_ + size <= settings_.max_queue_bytes) {
+    return true;
+  }
+  if (dropped_frames_++ % 100 == 0) {
+    RTC_LOG(LS_WARNING) << "LocalRecorder queue is full, dropped "
+                        << dropped_frames_ << " frames";
+  }
+  return false;
+}
+
+void LocalRecorder::StartSegmentLocked(Frame* frame, int64_t now_us) {
+  frame->new_segment = true;
+  frame->segment_video = video_source_ != nullptr;
+  frame->segment_audio = audio_source_ != nullptr;
+  frame->audio_channels = audio_channels_;
+  segment_video_ = frame->segment_video;
+  segment_audio_ = frame->segment_audio;
+  next_segment_us_ = now_us + SegmentIntervalUs();
+}
+
+void LocalRecorder::PushLocked(Frame frame) {
+  queue_bytes_ += frame.data->size();
+  queue_.push_back(std::move(frame));
+  cond_.notify_one();
+}
+
+void LocalRecorder::AddToPrerollLocked(Frame frame) {
+  const int64_t bytes_before = preroll_bytes_;
+  preroll_bytes_ += frame.data->size();
+  preroll_.push_back(std::move(frame));
+
+  const size_t max_bytes =
+      static_cast<size_t>(settings_.preroll_mb) * 1024 * 1024;
+  const int64_t window_us =
+      static_cast<int64_t>(settings_.preroll_sec) * 1000 * 1000;
+  auto is_start = [this](const Frame& f) {
+    return !segment_video_ || (f.video && f.key_frame);
+  };
+  // 2 つ目の先頭 (映像のキーフレーム) 以降だけで足りる間は、先頭からそこまでをまとめて捨てる
+  while (true) {
+    auto next = std::find_if(preroll_.begin() + 1, preroll_.end(), is_start);
+    if (next == preroll_.end()) {
+      break;
+    }
+    if (preroll_bytes_ <= max_bytes &&
+        preroll_.back().capture_time_us - next->capture_time_us < window_us) {
+      break;
+    }
+    for (auto it = preroll_.begin(); it != next; ++it) {
+      preroll_bytes_ -= it->data->size();
+    }
+    preroll_.erase(preroll_.begin(), next);
+  }
+  // キーフレームの間隔だけで上限を超える場合は全て捨てて、次のキーフレームから保持し直す
+  if (preroll_bytes_ > max_bytes) {
+    if (dropped_frames_++ % 100 == 0) {
+      RTC_LOG(LS_WARNING) << "LocalRecorder preroll exceeds "
+                          << settings_.preroll_mb << " MB";
+    }
+    preroll_.clear();
+    preroll_bytes_ = 0;
+    waiting_key_frame_ = true;
+  }
+  MemoryAccounting::Instance().Add(MemoryAccounting::kRecorder,
+                                   (int64_t)preroll_bytes_ - bytes_before);
+}
+
+int64_t LocalRecorder::SegmentIntervalUs() const {
+  // 保持する間に必ずキーフレームが入るように、preroll_sec の半分毎にキーフレームを要求する
+  int sec = settings_.preroll_sec > 0 ? std::max(settings_.preroll_sec / 2, 1)
+                                      : settings_.segment_sec;
+  return static_cast<int64_t>(sec) * 1000 * 1000;
+}
+
+void LocalRecorder::WriterThread(void* obj) {
+  ThreadPlacement::Instance().Apply("recorder");
+  static_cast<LocalRecorder*>(obj)->WriterLoop();
+}
+
+void LocalRecorder::WriterLoop() {
+  std::vector<uint8_t> out;
+  while (true) {
+    std::deque<Frame> frames;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return stopped_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      frames.swap(queue_);
+      queue_bytes_ = 0;
+    }
+
+    // 溜まっているフレームをまとめて多重化し、セグメント毎に 1 回で書き込む
+    for (const Frame& frame : frames) {
+      if (frame.new_segment) {
+        if (file_ && !out.empty()) {
+          file_->Write(out.data(), out.size());
+        }
+        out.clear();
+        OpenSegment(frame);
+      }
+      WriteFrame(frame, &out);
+      if (frame.end_of_file) {
+        if (file_ && !out.empty()) {
+          file_->Write(out.data(), out.size());
+        }
+        out.clear();
+        CloseSegment();
+      }
+    }
+    if (file_ && !out.empty() && !file_->Write(out.data(), out.size())) {
+      // 書き込めなくなった場合は次のセグメントまで記録しない
+      CloseSegment();
+    }
+    out.clear();
+  }
+}
+
+void LocalRecorder::OpenSegment(const Frame& frame) {
+  CloseSegment();
+  file_ = SegmentFile::Open(
+      frame.path.empty() ? SegmentPath(settings_.dir, "momo", segment_index_++)
+                         : frame.path,
+      static_cast<uint64_t>(settings_.preallocate_mb) * 1024 * 1024,
+      settings_.direct_io);
+  if (!file_) {
+    return;
+  }
+  muxer_.reset(new TsMuxer(frame.segment_video, frame.segment_audio,
+                           frame.audio_channels));
+  std::vector<uint8_t> tables;
+  muxer_->WriteTables(&tables);
+  file_->Write(tables.data(), tables.size());
+}
+
+void LocalRecorder::CloseSegment() {
+  muxer_.reset();
+  file_.reset();
+}
+
+void LocalRecorder::WriteFrame(const Frame& frame, std::vector<uint8_t>* out) {
+  if (!muxer_) {
+    return;
+  }
+  if (base_time_us_ < 0) {
+    base_time_us_ = frame.capture_time_us;
+  }
+  int64_t pts = (frame.capture_time_us - base_time_us_) * 90 / 1000 + kPtsOffset;
+  if (pts < 0) {
+    return;
+  }
+  if (frame.video) {
+    muxer_->WriteVideo(frame.data->data(), frame.data->size(), pts,
+                       frame.key_frame, out);
+  } else {
+    muxer_->WriteAudio(frame.data->data(), frame.data->size(), pts, out);
+  }
+}
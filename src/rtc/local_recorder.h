@@ -0,0 +1,138 @@
+#ifndef LOCAL_RECORDER_H_
+#define LOCAL_RECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "api/video/encoded_image.h"
+#include "encoded_video_sink.h"
+#include "rtc_base/platform_thread.h"
+#include "ts_muxer.h"
+
+// エンコード済みの H.264 と Opus を、もう一度エンコードせずに MPEG-TS のファイルに記録する。
+//
+// エンコーダのコールバックからは Push するだけで、多重化とファイルへの書き込みは
+// 専用のスレッドで行う。書き込みが詰まってキューが上限を超えた場合は新しいフレームを捨てるので、
+// ディスクが遅くても送信中の映像や音声は待たされない。映像を捨てた後は次のキーフレームから記録する。
+//
+// 記録するのは最初に Attach した映像と音声のエンコーダだけで、
+// Detach されると次に Attach したエンコーダを記録する。
+// セグメントは segment_sec 毎に、映像がある場合は次のキーフレームで切り替える。
+//
+// preroll_sec を指定した場合は常に記録するのではなく、直近の preroll_sec 秒分のフレームを
+// キーフレームの単位でメモリに保持しておき、SaveClip() が呼ばれた時にそれを 1 つのファイルに書き出す。
+// 保持する量は preroll_mb で制限する。フレームは EncodedImage のバッファを参照するので、
+// エンコーダが参照カウント付きのバッファを渡してくる場合はコピーしない。
+class LocalRecorder : public EncodedVideoSink {
+ public:
+  struct Settings {
+    std::string dir;
+    int segment_sec = 60;
+    // 0 より大きい場合、セグメントを開いた時にこの大きさの領域を確保しておく
+    int preallocate_mb = 0;
+    // O_DIRECT でページキャッシュを通さずに書き込む (Linux のみ)
+    bool direct_io = false;
+    // 書き込み待ちのフレームの合計の上限
+    size_t max_queue_bytes = 32 * 1024 * 1024;
+    // 0 より大きい場合は常には記録せず、この秒数分を SaveClip() のために保持する
+    int preroll_sec = 0;
+    int preroll_mb = 32;
+  };
+
+  explicit LocalRecorder(Settings settings);
+  ~LocalRecorder();
+
+  bool AttachVideo(const void* source) override;
+  void DetachVideo(const void* source) override;
+  // 記録できるエンコーダが他に無ければ true を返す
+  bool AttachAudio(const void* source, int channels);
+  void DetachAudio(const void* source);
+
+  bool NeedsKeyFrame(const void* source) override;
+
+  void OnVideo(const void* source,
+               const webrtc::EncodedImage& encoded_image,
+               int64_t capture_time_us) override;
+  // capture_time_us は rtc::TimeMicros() の時刻
+  void OnAudio(const void* source,
+               const uint8_t* data,
+               size_t size,
+               int64_t capture_time_us);
+
+  // 保持しているフレームを書き出すファイルのパスを返す。書き込みは非同期に行う。
+  // preroll_sec を指定していない場合や、まだフレームが無い場合は空文字列を返す
+  std::string SaveClip();
+
+ private:
+  class SegmentFile;
+
+  struct Frame {
+    bool video = false;
+    bool key_frame = false;
+    // このフレームから新しいセグメントにする。その場合はセグメントに入れるストリームも指定する
+    bool new_segment = false;
+    bool segment_video = false;
+    bool segment_audio = false;
+    int audio_channels = 2;
+    // 空でなければ、新しいセグメントをこのパスで作る
+    std::string path;
+    // このフレームを書いたらファイルを閉じる
+    bool end_of_file = false;
+    int64_t capture_time_us = 0;
+    rtc::scoped_refptr<webrtc::EncodedImageBufferInterface> data;
+  };
+
+  // mutex_ を取った状態で呼ぶこと。キューが溢れる場合は false を返す
+  bool CanPushLocked(size_t size);
+  void StartSegmentLocked(Frame* frame, int64_t now_us);
+  void PushLocked(Frame frame);
+  void AddToPrerollLocked(Frame frame);
+  // セグメント (preroll_sec の場合はキーフレーム) の間隔
+  int64_t SegmentIntervalUs() const;
+
+  static void WriterThread(void* obj);
+  void WriterLoop();
+  void OpenSegment(const Frame& frame);
+  void CloseSegment();
+  void WriteFrame(const Frame& frame, std::vector<uint8_t>* out);
+
+  const Settings settings_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<Frame> queue_;
+  size_t queue_bytes_ = 0;
+  bool stopped_ = false;
+  const void* video_source_ = nullptr;
+  const void* audio_source_ = nullptr;
+  int audio_channels_ = 2;
+  // 映像を捨てた後や最初の映像は、キーフレームが来るまで記録しない
+  bool waiting_key_frame_ = true;
+  // 今のセグメントに入っているストリーム
+  bool segment_video_ = false;
+  bool segment_audio_ = false;
+  int64_t next_segment_us_ = 0;
+  uint64_t dropped_frames_ = 0;
+  // preroll_sec を指定した場合に保持しているフレーム。先頭は映像のキーフレームになる
+  std::deque<Frame> preroll_;
+  size_t preroll_bytes_ = 0;
+  int clip_index_ = 0;
+
+  // 書き込みスレッドだけが触る
+  std::unique_ptr<SegmentFile> file_;
+  std::unique_ptr<TsMuxer> muxer_;
+  int64_t base_time_us_ = -1;
+  int segment_index_ = 0;
+
+  std::unique_ptr<rtc::PlatformThread> writer_thread_;
+};
+
+#endif  // LOCAL_RECORDER_H_
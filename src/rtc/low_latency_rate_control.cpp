@@ -0,0 +1,40 @@
+#include "low_latency_rate_control.h"
+
+#include <algorithm>
+
+namespace {
+
+// 平均のフレームの大きさに対する、1 フレームの大きさの上限の比
+const uint32_t kMaxFrameSizeRatio = 2;
+// 画面全体を更新するのにかける時間
+const uint32_t kIntraRefreshMs = 500;
+// これより小さい割合の変化はエンコーダに設定しない
+const uint32_t kBitrateUpdateThresholdPercent = 5;
+
+}  // namespace
+
+uint32_t LowLatencyRateControl::VbvBufferBits(uint32_t bitrate_bps,
+                                              uint32_t framerate) {
+  return bitrate_bps / std::max<uint32_t>(framerate, 1);
+}
+
+uint32_t LowLatencyRateControl::MaxFrameBits(uint32_t bitrate_bps,
+                                             uint32_t framerate) {
+  return VbvBufferBits(bitrate_bps, framerate) * kMaxFrameSizeRatio;
+}
+
+uint32_t LowLatencyRateControl::IntraRefreshFrames(uint32_t framerate) {
+  return std::max<uint32_t>(framerate * kIntraRefreshMs / 1000, 2);
+}
+
+bool LowLatencyRateControl::ShouldUpdateBitrate(uint32_t configured_bps,
+                                                uint32_t bitrate_bps) {
+  if (configured_bps == 0) {
+    return true;
+  }
+  const uint64_t diff = configured_bps > bitrate_bps
+                            ? configured_bps - bitrate_bps
+                            : bitrate_bps - configured_bps;
+  return diff * 100 >= static_cast<uint64_t>(configured_bps) *
+                           kBitrateUpdateThresholdPercent;
+}
@@ -0,0 +1,28 @@
+#ifndef LOW_LATENCY_RATE_CONTROL_H_
+#define LOW_LATENCY_RATE_CONTROL_H_
+
+#include <stdint.h>
+
+// ハードウェアエンコーダの低遅延のレート制御で共通に使う値を求める。
+//
+// CBR で VBV (HRD) のバッファを 1 フレーム分にして、1 フレームの大きさが送信の予算を大きく
+// 超えないようにする。定期的な IDR を送る代わりにイントラリフレッシュで少しずつ画面を更新するので、
+// キーフレームの直後にフレームが大きくなって遅延が増えることが無い。
+// 要求されたキーフレームは今まで通り IDR で送る。
+//
+// ビットレートは BitrateAdjuster の値が少し揺れるだけで変わるので、
+// 今の設定との差が小さい間はエンコーダに設定し直さない。
+class LowLatencyRateControl {
+ public:
+  // VBV のバッファの大きさ (ビット)。1 フレーム分にする
+  static uint32_t VbvBufferBits(uint32_t bitrate_bps, uint32_t framerate);
+  // 1 フレームの大きさの上限 (ビット)
+  static uint32_t MaxFrameBits(uint32_t bitrate_bps, uint32_t framerate);
+  // イントラリフレッシュで画面全体を更新するのにかけるフレーム数
+  static uint32_t IntraRefreshFrames(uint32_t framerate);
+  // configured_bps から bitrate_bps に設定し直すべきなら true を返す
+  static bool ShouldUpdateBitrate(uint32_t configured_bps,
+                                  uint32_t bitrate_bps);
+};
+
+#endif  // LOW_LATENCY_RATE_CONTROL_H_
@@ -1,25 +1,52 @@
 
 #include "manager.h"
 
+#include <stdlib.h>
+
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 #include "absl/memory/memory.h"
+#include "absl/strings/match.h"
 #include "api/audio_codecs/builtin_audio_decoder_factory.h"
 #include "api/audio_codecs/builtin_audio_encoder_factory.h"
 #include "api/create_peerconnection_factory.h"
 #include "api/rtc_event_log/rtc_event_log_factory.h"
 #include "api/task_queue/default_task_queue_factory.h"
+#include "api/transport/bitrate_settings.h"
+#include "api/video_codecs/video_codec.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
 #include "api/video_track_source_proxy.h"
+#include "audio_processing_profile.h"
+#include "bitrate_cache.h"
+#include "hw_codec_preference.h"
 #include "media/engine/webrtc_media_engine.h"
 #include "modules/audio_device/include/audio_device.h"
 #include "modules/audio_processing/include/audio_processing.h"
 #include "modules/video_capture/video_capture.h"
 #include "modules/video_capture/video_capture_factory.h"
+#include "modules/video_coding/include/video_error_codes.h"
 #include "observer.h"
+#include "playout_delay_encoder.h"
+#include "recording_encoder.h"
 #include "rtc_base/logging.h"
+#include "rtc_base/network_constants.h"
 #include "rtc_base/openssl_certificate.h"
+#include "rtc_base/rtc_certificate_generator.h"
 #include "rtc_base/ssl_adapter.h"
+#include "rtc_base/time_utils.h"
 #include "scalable_track_source.h"
+#include "shared_video_encoder.h"
+#if defined(__linux__)
+#include "shm_frame_exporter.h"
+#endif
+#include "snapshot_sink.h"
+#include "startup_timer.h"
+#include "system_wrappers/include/field_trial.h"
+#include "thread_placement.h"
 #include "util.h"
 
 #ifdef __APPLE__
@@ -33,32 +60,291 @@
 #include "ros/ros_audio_device_module.h"
 #endif
 
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+    USE_V4L2_M2M || USE_VAAPI_ENCODER
 #include "api/video_codecs/video_encoder_factory.h"
 #include "hw_video_encoder_factory.h"
 #endif
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || \
+    (USE_NVCODEC_ENCODER && defined(__linux__)) || USE_V4L2_M2M
 #include "api/video_codecs/video_decoder_factory.h"
 #include "hw_video_decoder_factory.h"
 #endif
 
 #include "ssl_verifier.h"
 
+// サイマルキャスト時のレイヤー数 (1080p なら 1080p/540p/270p になる)
+static const int kSimulcastLayers = 3;
+// SimulcastFrameBuffer から各レイヤーを選べるのは HWVideoEncoderFactory のエンコーダだけ。
+// createVideoEncoderFactory() で HWVideoEncoderFactory を使う場合に true になる
+#if !defined(__APPLE__) &&                                            \
+    (USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+     USE_V4L2_M2M || USE_VAAPI_ENCODER)
+static const bool kUseHWVideoEncoderFactory = true;
+#else
+static const bool kUseHWVideoEncoderFactory = false;
+#endif
+// --ice-check-interval-ms の場合に、選んだ経路から受信できなくなったと見なすまでの時間の下限
+static const int kMinIceReceivingTimeoutMs = 500;
+
+// --network-preference と --network-ignore で指定したネットワークの種類
+static rtc::AdapterType AdapterTypeFromName(const std::string& name) {
+  if (name == "ethernet") {
+    return rtc::ADAPTER_TYPE_ETHERNET;
+  } else if (name == "wifi") {
+    return rtc::ADAPTER_TYPE_WIFI;
+  } else if (name == "cellular") {
+    return rtc::ADAPTER_TYPE_CELLULAR;
+  } else if (name == "vpn") {
+    return rtc::ADAPTER_TYPE_VPN;
+  } else if (name == "loopback") {
+    return rtc::ADAPTER_TYPE_LOOPBACK;
+  }
+  return rtc::ADAPTER_TYPE_UNKNOWN;
+}
+
+// format のエンコーダを 1 回作って InitEncode() してから解放する。
+// 初期化できた場合は true を返す
+static bool InitVideoEncoderOnce(webrtc::VideoEncoderFactory* factory,
+                                 const webrtc::SdpVideoFormat& format,
+                                 const ConnectionSettings& cs) {
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory->CreateVideoEncoder(format);
+  if (!encoder) {
+    return false;
+  }
+
+  const webrtc::VideoCodecType type =
+      webrtc::PayloadStringToCodecType(format.name);
+  const ConnectionSettings::Size size = cs.getSize();
+  const int bitrate_kbps = 1000;
+  webrtc::VideoCodec codec;
+  codec.codecType = type;
+  codec.width = size.width;
+  codec.height = size.height;
+  codec.startBitrate = bitrate_kbps;
+  codec.maxBitrate = bitrate_kbps;
+  codec.minBitrate = 30;
+  codec.maxFramerate = cs.framerate;
+  codec.qpMax = type == webrtc::kVideoCodecH264 ? 51 : 56;
+  codec.mode = webrtc::VideoCodecMode::kRealtimeVideo;
+  switch (type) {
+    case webrtc::kVideoCodecVP8:
+      *codec.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+      break;
+    case webrtc::kVideoCodecVP9:
+      *codec.VP9() = webrtc::VideoEncoder::GetDefaultVp9Settings();
+      break;
+    case webrtc::kVideoCodecH264:
+      *codec.H264() = webrtc::VideoEncoder::GetDefaultH264Settings();
+      break;
+    default:
+      break;
+  }
+  webrtc::VideoEncoder::Settings settings(
+      webrtc::VideoEncoder::Capabilities(false),
+      std::max(1u, std::thread::hardware_concurrency()), 1200);
+  const int64_t start_us = rtc::TimeMicros();
+  int32_t ret = encoder->InitEncode(&codec, settings);
+  encoder->Release();
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << format.name << " "
+                   << size.width << "x" << size.height << " ret=" << ret
+                   << " elapsed_ms="
+                   << (rtc::TimeMicros() - start_us) /
+                          rtc::kNumMicrosecsPerMillisec;
+  return ret == WEBRTC_VIDEO_CODEC_OK;
+}
+
+// エンコーダを 1 回初期化しておく。
+// ドライバやライブラリの読み込みと初期化が済むので、最初の接続でエンコーダを作る時間が短くなる。
+// ハードウェアエンコーダが使える H.264 を優先し、無ければ最初のコーデックを使う
+static bool PrewarmVideoEncoder(webrtc::VideoEncoderFactory* factory,
+                                ConnectionSettings cs) {
+  std::vector<webrtc::SdpVideoFormat> formats = factory->GetSupportedFormats();
+  if (formats.empty()) {
+    return false;
+  }
+  auto format = std::find_if(formats.begin(), formats.end(),
+                             [](const webrtc::SdpVideoFormat& f) {
+                               return absl::EqualsIgnoreCase(f.name, "H264");
+                             });
+  if (format == formats.end()) {
+    format = formats.begin();
+  }
+  return InitVideoEncoderOnce(factory, *format, cs);
+}
+
+std::shared_ptr<RTCThreads> RTCThreads::Create() {
+  std::shared_ptr<RTCThreads> threads(new RTCThreads());
+  threads->network_ = rtc::Thread::CreateWithSocketServer();
+  threads->network_->SetName("network_thread", nullptr);
+  threads->network_->Start();
+  threads->worker_ = rtc::Thread::Create();
+  threads->worker_->SetName("worker_thread", nullptr);
+  threads->worker_->Start();
+  threads->signaling_ = rtc::Thread::Create();
+  threads->signaling_->SetName("signaling_thread", nullptr);
+  threads->signaling_->Start();
+  threads->network_->Invoke<void>(
+      RTC_FROM_HERE, [] { ThreadPlacement::Instance().Apply("network"); });
+  threads->worker_->Invoke<void>(
+      RTC_FROM_HERE, [] { ThreadPlacement::Instance().Apply("worker"); });
+  threads->signaling_->Invoke<void>(
+      RTC_FROM_HERE, [] { ThreadPlacement::Instance().Apply("signaling"); });
+  return threads;
+}
+
+RTCThreads::~RTCThreads() {
+  network_->Stop();
+  worker_->Stop();
+  signaling_->Stop();
+}
+
 RTCManager::RTCManager(
     ConnectionSettings conn_settings,
-    rtc::scoped_refptr<ScalableVideoTrackSource> video_track_source,
-    VideoTrackReceiver* receiver)
-    : _conn_settings(conn_settings),
+    std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>>
+        video_track_sources,
+    VideoTrackReceiver* receiver,
+    std::shared_ptr<RTCThreads> threads)
+    : RTCManager(std::move(conn_settings), receiver, std::move(threads)) {
+  setVideoTrackSources(std::move(video_track_sources));
+}
+
+RTCManager::RTCManager(ConnectionSettings conn_settings,
+                       VideoTrackReceiver* receiver,
+                       std::shared_ptr<RTCThreads> threads)
+    : _threads(std::move(threads)),
+      _conn_settings(conn_settings),
       _receiver(receiver),
       _data_manager(nullptr) {
   rtc::InitializeSSL();
 
-  _networkThread = rtc::Thread::CreateWithSocketServer();
-  _networkThread->Start();
-  _workerThread = rtc::Thread::Create();
-  _workerThread->Start();
-  _signalingThread = rtc::Thread::Create();
-  _signalingThread->Start();
+  if (!_conn_settings.record_dir.empty()) {
+    LocalRecorder::Settings recorder_settings;
+    recorder_settings.dir = _conn_settings.record_dir;
+    recorder_settings.segment_sec = _conn_settings.record_segment_sec;
+    recorder_settings.preallocate_mb = _conn_settings.record_preallocate_mb;
+    recorder_settings.direct_io = _conn_settings.record_direct_io;
+    recorder_settings.preroll_sec = _conn_settings.record_preroll_sec;
+    recorder_settings.preroll_mb = _conn_settings.record_preroll_mb;
+    _recorder = std::make_shared<LocalRecorder>(recorder_settings);
+  }
+  if (_conn_settings.rtsp_port >= 0) {
+    _rtsp_stream = std::make_shared<RtspStream>();
+  }
+  OpusProfile::Parse(_conn_settings.audio_profile, &_opus_profile);
+  VideoProtectionProfile::Parse(_conn_settings.video_protection,
+                                &_video_protection);
+  // fast_startup の場合は別のスレッドで PeerConnectionFactory を作るので、その前に設定する
+  InitFieldTrials(FieldTrials(_conn_settings));
+
+  if (_conn_settings.fast_startup) {
+    // カメラを開いたりシグナリングサーバに繋いだりしている間に作っておく
+    _init_thread = std::thread([this]() {
+      createFactory();
+      {
+        std::unique_lock<std::mutex> lock(_init_mtx);
+        _init_cond.wait(lock, [this]() { return _sources_set; });
+      }
+      createTracks();
+      {
+        std::lock_guard<std::mutex> lock(_init_mtx);
+        _initialized = true;
+      }
+      _init_cond.notify_all();
+    });
+  } else {
+    createFactory();
+  }
+}
+
+void RTCManager::setVideoTrackSources(
+    std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>>
+        video_track_sources) {
+  for (const auto& source : video_track_sources) {
+    if (source) {
+      _video_track_sources.push_back(source);
+    }
+  }
+  for (const auto& video_track_source : _video_track_sources) {
+    if (_conn_settings.no_video_device) {
+      break;
+    }
+    // 他のエンコーダファクトリでは SimulcastFrameBuffer を作っても使われずに ToI420() されるだけ
+    if (_conn_settings.sora_simulcast && kUseHWVideoEncoderFactory) {
+      video_track_source->SetSimulcastLayers(kSimulcastLayers);
+    }
+    if (_conn_settings.latency_marker) {
+      video_track_source->SetLatencyMarker(true);
+    }
+    if (_conn_settings.encoder_backpressure) {
+      video_track_source->SetEncoderBackpressure(true);
+    }
+    if (_conn_settings.static_scene_fps > 0) {
+      video_track_source->SetStaticScene(_conn_settings.static_scene_fps,
+                                         _conn_settings.static_scene_delay_ms,
+                                         _conn_settings.static_scene_threshold);
+    }
+    if (_conn_settings.video_rotation != 0) {
+      video_track_source->SetRotation(
+          static_cast<webrtc::VideoRotation>(_conn_settings.video_rotation));
+    }
+  }
+
+#if defined(__linux__)
+  if (!_conn_settings.shm_export.empty() && !_video_track_sources.empty() &&
+      !_conn_settings.no_video_device) {
+    ShmFrameExporter::Settings shm_settings;
+    shm_settings.name = _conn_settings.shm_export;
+    shm_settings.num_slots = _conn_settings.shm_export_slots;
+    ConnectionSettings::Size size = _conn_settings.getSize();
+    shm_settings.max_width = size.width;
+    shm_settings.max_height = size.height;
+    _shm_exporter =
+        ShmFrameExporter::Create(shm_settings, _video_track_sources[0]);
+  }
+#endif
+  if (_conn_settings.snapshot && !_video_track_sources.empty() &&
+      !_conn_settings.no_video_device) {
+    _snapshot_sink = SnapshotSink::Create(_video_track_sources[0],
+                                          _conn_settings.snapshot_quality);
+  }
+
+  if (_init_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(_init_mtx);
+      _sources_set = true;
+    }
+    _init_cond.notify_all();
+  } else {
+    createTracks();
+    _initialized = true;
+  }
+}
+
+void RTCManager::waitInitialized() {
+  std::unique_lock<std::mutex> lock(_init_mtx);
+  _init_cond.wait(lock, [this]() { return _initialized; });
+}
+
+void RTCManager::createFactory() {
+  if (!_threads) {
+    _threads = RTCThreads::Create();
+  }
+
+  // PeerConnectionFactory を作っている間に、別のスレッドでエンコーダを 1 回初期化しておく。
+  // 最初の接続までに終わらせるため、このメソッドの最後で待つ
+  std::thread prewarm_thread;
+  if (_conn_settings.fast_startup && !_conn_settings.no_video_device &&
+      !_conn_settings.recv_only) {
+    prewarm_thread = std::thread([this]() {
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory =
+          createVideoEncoderFactory();
+      if (PrewarmVideoEncoder(factory.get(), _conn_settings)) {
+        StartupTimer::Instance().Mark("encoder_prewarmed");
+      }
+    });
+  }
 
 #if defined(__linux__)
 
@@ -77,11 +363,18 @@ RTCManager::RTCManager(
   if (_conn_settings.no_audio_device) {
     audio_layer = webrtc::AudioDeviceModule::kDummyAudio;
   }
+#if USE_LINUX_PULSE_AUDIO
+  if (_conn_settings.audio_profile == "low-latency") {
+    // WebRTC の PulseAudio の ADM はバッファの大きさを設定できないので、
+    // libpulse の環境変数で 10 ミリ秒のバッファを要求する。既に指定されている場合はそちらを使う
+    setenv("PULSE_LATENCY_MSEC", "10", 0);
+  }
+#endif
 
   webrtc::PeerConnectionFactoryDependencies dependencies;
-  dependencies.network_thread = _networkThread.get();
-  dependencies.worker_thread = _workerThread.get();
-  dependencies.signaling_thread = _signalingThread.get();
+  dependencies.network_thread = _threads->network();
+  dependencies.worker_thread = _threads->worker();
+  dependencies.signaling_thread = _threads->signaling();
   dependencies.task_queue_factory = webrtc::CreateDefaultTaskQueueFactory();
   dependencies.call_factory = webrtc::CreateCallFactory();
   dependencies.event_log_factory =
@@ -98,34 +391,88 @@ RTCManager::RTCManager(
   media_dependencies.adm = webrtc::AudioDeviceModule::Create(
       audio_layer, dependencies.task_queue_factory.get());
 #endif
+  _adm = media_dependencies.adm;
   media_dependencies.audio_encoder_factory =
-      webrtc::CreateBuiltinAudioEncoderFactory();
+      CreateOpusProfileAudioEncoderFactory(
+          webrtc::CreateBuiltinAudioEncoderFactory(), _opus_profile);
+  if (_recorder) {
+    media_dependencies.audio_encoder_factory =
+        CreateRecordingAudioEncoderFactory(
+            media_dependencies.audio_encoder_factory, _recorder);
+  }
   media_dependencies.audio_decoder_factory =
       webrtc::CreateBuiltinAudioDecoderFactory();
+  // 受信専用の場合もコーデックの交渉にエンコーダのファクトリが要るが、
+  // エンコーダは作らないので、ハードウェアの確認をしない組み込みのものにする
+  media_dependencies.video_encoder_factory =
+      _conn_settings.recv_only ? webrtc::CreateBuiltinVideoEncoderFactory()
+                               : createVideoEncoderFactory();
+  if (_conn_settings.prefer_hw_codec && !_conn_settings.recv_only) {
+    // 相手がコーデックを指定しない場合に、ソフトウェアの VP8 などが選ばれないようにする
+    const ConnectionSettings& cs = _conn_settings;
+    auto factory = absl::make_unique<HWCodecPreferenceVideoEncoderFactory>(
+        std::move(media_dependencies.video_encoder_factory),
+        [&cs](webrtc::VideoEncoderFactory* factory,
+              const webrtc::SdpVideoFormat& format) {
+          return InitVideoEncoderOnce(factory, format, cs);
+        });
+    _hw_codecs = factory->hw_codecs();
+    media_dependencies.video_encoder_factory = std::move(factory);
+    StartupTimer::Instance().Mark("hw_codecs_probed");
+  }
 #ifdef __APPLE__
-  media_dependencies.video_encoder_factory = CreateObjCEncoderFactory();
   media_dependencies.video_decoder_factory = CreateObjCDecoderFactory();
 #else
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER
-  media_dependencies.video_encoder_factory =
-      std::unique_ptr<webrtc::VideoEncoderFactory>(
-          absl::make_unique<HWVideoEncoderFactory>());
-#else
-  media_dependencies.video_encoder_factory =
-      webrtc::CreateBuiltinVideoEncoderFactory();
-#endif
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || \
+    (USE_NVCODEC_ENCODER && defined(__linux__)) || USE_V4L2_M2M
   media_dependencies.video_decoder_factory =
       std::unique_ptr<webrtc::VideoDecoderFactory>(
-          absl::make_unique<HWVideoDecoderFactory>());
+          absl::make_unique<HWVideoDecoderFactory>(
+              _conn_settings.mmal_decoder_zero_copy,
+              _conn_settings.mmal_decoder_input_buffers,
+              _conn_settings.mmal_decoder_output_buffers,
+              _conn_settings.max_hw_decoders));
 #else
   media_dependencies.video_decoder_factory =
       webrtc::CreateBuiltinVideoDecoderFactory();
 #endif
 #endif
+  if (_recorder && !_conn_settings.recv_only) {
+    // 共有する場合も 1 回だけ記録するように、共有するエンコーダの内側で記録する
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<RecordingVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory),
+                _recorder));
+  }
+  if (_rtsp_stream && !_conn_settings.recv_only) {
+    // 記録と同じく、WebRTC で送っているエンコーダの出力をそのまま RTSP でも配る
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<RecordingVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory),
+                _rtsp_stream));
+  }
+  if (_conn_settings.latency_profile == "ultra-low" &&
+      !_conn_settings.recv_only) {
+    // 相手にもジッターバッファで待たずに描画してもらう
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<PlayoutDelayVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory), 0, 0));
+  }
+  if (_conn_settings.shared_encoder && !_conn_settings.recv_only) {
+    media_dependencies.video_encoder_factory =
+        std::unique_ptr<webrtc::VideoEncoderFactory>(
+            absl::make_unique<SharedVideoEncoderFactory>(
+                std::move(media_dependencies.video_encoder_factory)));
+  }
   media_dependencies.audio_mixer = nullptr;
+  // 受信専用の場合は録音した音声を処理しないので APM を作らない
   media_dependencies.audio_processing =
-      webrtc::AudioProcessingBuilder().Create();
+      _conn_settings.recv_only
+          ? nullptr
+          : AudioProcessingProfile::Create(_conn_settings.audio_processing);
 
   dependencies.media_engine =
       cricket::CreateMediaEngine(std::move(media_dependencies));
@@ -142,9 +489,41 @@ RTCManager::RTCManager(
   factory_options.disable_sctp_data_channels = false;
   factory_options.disable_encryption = false;
   factory_options.ssl_max_version = rtc::SSL_PROTOCOL_DTLS_12;
+  for (const std::string& name : _conn_settings.network_ignores) {
+    factory_options.network_ignore_mask |= AdapterTypeFromName(name);
+  }
   _factory->SetOptions(factory_options);
 
-  if (!_conn_settings.no_audio_device) {
+  StartupTimer::Instance().Mark("factory_created");
+
+  if (prewarm_thread.joinable()) {
+    prewarm_thread.join();
+  }
+}
+
+std::unique_ptr<webrtc::VideoEncoderFactory>
+RTCManager::createVideoEncoderFactory() {
+#ifdef __APPLE__
+  return CreateObjCEncoderFactory();
+#elif USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+    USE_V4L2_M2M || USE_VAAPI_ENCODER
+  KeyFrameThrottle::Settings key_frame_throttle;
+  key_frame_throttle.min_interval_ms = _conn_settings.key_frame_min_interval_ms;
+  key_frame_throttle.intra_refresh = _conn_settings.key_frame_intra_refresh;
+  return std::unique_ptr<webrtc::VideoEncoderFactory>(
+      absl::make_unique<HWVideoEncoderFactory>(
+          _conn_settings.sora_simulcast, _conn_settings.nvcodec_async,
+          _conn_settings.mmal_encoder_low_latency,
+          _conn_settings.low_latency_rate_control, key_frame_throttle,
+          _conn_settings.nvcodec_temporal_layers,
+          _conn_settings.rtc_config.GetH264Formats()));
+#else
+  return webrtc::CreateBuiltinVideoEncoderFactory();
+#endif
+}
+
+void RTCManager::createTracks() {
+  if (!_conn_settings.no_audio_device && !_conn_settings.recv_only) {
     cricket::AudioOptions ao;
     if (_conn_settings.disable_echo_cancellation)
       ao.echo_cancellation = false;
@@ -158,6 +537,7 @@ RTCManager::RTCManager(
       ao.typing_detection = false;
     if (_conn_settings.disable_residual_echo_detector)
       ao.residual_echo_detector = false;
+    AudioProcessingProfile::ApplyOptions(_conn_settings.audio_processing, &ao);
     RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << ao.ToString();
     _audio_track = _factory->CreateAudioTrack(Util::generateRandomChars(),
                                               _factory->CreateAudioSource(ao));
@@ -166,33 +546,75 @@ RTCManager::RTCManager(
     }
   }
 
-  if (video_track_source && !_conn_settings.no_video_device) {
+  for (const auto& video_track_source : _video_track_sources) {
+    if (_conn_settings.no_video_device) {
+      break;
+    }
     rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> video_source =
         webrtc::VideoTrackSourceProxy::Create(
-            _signalingThread.get(), _workerThread.get(), video_track_source);
-    _video_track =
+            _threads->signaling(), _threads->worker(), video_track_source);
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track =
         _factory->CreateVideoTrack(Util::generateRandomChars(), video_source);
-    if (_video_track) {
+    if (video_track) {
       if (_conn_settings.fixed_resolution) {
-        _video_track->set_content_hint(
+        video_track->set_content_hint(
             webrtc::VideoTrackInterface::ContentHint::kText);
       }
       if (_receiver != nullptr && _conn_settings.show_me) {
-        _receiver->AddTrack(_video_track);
+        _receiver->AddTrack(video_track);
       }
+      _video_tracks.push_back(video_track);
     } else {
       RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot create video_track";
     }
   }
+
+  StartupTimer::Instance().Mark("tracks_created");
+}
+
+std::string RTCManager::FieldTrials(const ConnectionSettings& cs) {
+  VideoProtectionProfile video_protection;
+  VideoProtectionProfile::Parse(cs.video_protection, &video_protection);
+  // --rtc-config の設定を優先する
+  return RtcConfig::MergeFieldTrials(video_protection.FieldTrials(),
+                                     cs.rtc_config.field_trials);
+}
+
+void RTCManager::InitFieldTrials(const std::string& field_trials) {
+  // InitFieldTrialsFromString() は文字列をコピーしないので、プロセスが終わるまで残しておく。
+  // 設定した後で書き換えると、他のスレッドが古い文字列を参照してしまう
+  static std::once_flag once;
+  static std::string g_field_trials;
+  std::call_once(once, [&field_trials]() {
+    if (field_trials.empty()) {
+      return;
+    }
+    g_field_trials = field_trials;
+    RTC_LOG(LS_INFO) << "Field trials: " << g_field_trials;
+    webrtc::field_trial::InitFieldTrialsFromString(g_field_trials.c_str());
+  });
 }
 
 RTCManager::~RTCManager() {
+  if (_init_thread.joinable()) {
+    // 映像のソースを渡す前に終了した場合も、作り終わるのを待つ
+    {
+      std::lock_guard<std::mutex> lock(_init_mtx);
+      _sources_set = true;
+    }
+    _init_cond.notify_all();
+    _init_thread.join();
+  }
+#if defined(__linux__)
+  _shm_exporter.reset();
+#endif
+  _snapshot_sink.reset();
   _audio_track = nullptr;
-  _video_track = nullptr;
+  _video_tracks.clear();
+  _video_track_sources.clear();
   _factory = nullptr;
-  _networkThread->Stop();
-  _workerThread->Stop();
-  _signalingThread->Stop();
+  // 他の RTCManager と共有している場合は、最後の RTCManager が破棄された時に止まる
+  _threads = nullptr;
 
   rtc::CleanupSSL();
 }
@@ -218,11 +640,68 @@ class RTCSSLVerifier : public rtc::SSLCertificateVerifier {
 
 std::shared_ptr<RTCConnection> RTCManager::createConnection(
     webrtc::PeerConnectionInterface::RTCConfiguration rtc_config,
-    RTCMessageSender* sender) {
+    RTCMessageSender* sender,
+    const std::string& remote) {
+  waitInitialized();
+  StartupTimer::Instance().Mark("connection_created");
+
   rtc_config.enable_dtls_srtp = true;
   rtc_config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
-  std::unique_ptr<PeerConnectionObserver> observer(
-      new PeerConnectionObserver(sender, _receiver, _data_manager));
+  if (_conn_settings.fast_reconnect) {
+    // 再接続の度に証明書を生成すると時間がかかるので、最初に生成したものを使い回す
+    if (!_certificate) {
+      _certificate = rtc::RTCCertificateGenerator::GenerateCertificate(
+          rtc::KeyParams(rtc::KT_ECDSA), absl::nullopt);
+    }
+    if (_certificate) {
+      rtc_config.certificates.push_back(_certificate);
+    } else {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": GenerateCertificate failed";
+    }
+    // ネットワークが切り替わった時に、シグナリングを待たずに新しい経路の candidate を集める
+    rtc_config.continual_gathering_policy =
+        webrtc::PeerConnectionInterface::GATHER_CONTINUALLY;
+  }
+  if (!_conn_settings.network_preference.empty()) {
+    // 同じ条件の経路が複数ある場合に、このネットワークの経路を選ぶ
+    rtc_config.network_preference =
+        AdapterTypeFromName(_conn_settings.network_preference);
+  }
+  if (_conn_settings.ice_check_interval_ms > 0) {
+    // Wi-Fi と LTE のように経路が複数ある場合に、選んだ経路が切れても ICE が失敗するのを
+    // 待たずに切り替えられるように、予備の経路も既定の 25 秒毎ではなく同じ間隔で確認しておく。
+    // 不安定な経路の確認は既定の方が短いので変えない。
+    // 切れたネットワークが戻ってきた時のために candidate も集め続ける
+    const int interval_ms = _conn_settings.ice_check_interval_ms;
+    const int timeout_ms = std::max(kMinIceReceivingTimeoutMs, interval_ms * 4);
+    rtc_config.continual_gathering_policy =
+        webrtc::PeerConnectionInterface::GATHER_CONTINUALLY;
+    rtc_config.ice_check_interval_strong_connectivity = interval_ms;
+    rtc_config.ice_backup_candidate_pair_ping_interval = interval_ms;
+    rtc_config.ice_connection_receiving_timeout = timeout_ms;
+    rtc_config.ice_unwritable_timeout = timeout_ms;
+    // 送れなくなった経路を捨てるのは、不安定と判断してからさらに同じ時間待った後にする
+    rtc_config.ice_inactive_timeout = timeout_ms * 2;
+  }
+  if (_conn_settings.dscp) {
+    // 各トラックの network_priority に応じた DSCP をパケットに付ける
+    rtc_config.set_dscp(true);
+  }
+  const bool ultra_low_latency = _conn_settings.latency_profile == "ultra-low";
+  if (ultra_low_latency) {
+    // 受信した映像を描画のタイミングに合わせて溜めずに、デコードしたらすぐに描画する
+    rtc_config.set_prerenderer_smoothing(false);
+    rtc_config.audio_jitter_buffer_min_delay_ms = 0;
+    rtc_config.audio_jitter_buffer_fast_accelerate = true;
+  }
+  if (_conn_settings.audio_profile == "low-latency") {
+    // 10 ミリ秒のパケットで 500 ミリ秒分までしか溜めず、溜まった分は早めに縮める
+    rtc_config.audio_jitter_buffer_max_packets = 50;
+    rtc_config.audio_jitter_buffer_min_delay_ms = 0;
+    rtc_config.audio_jitter_buffer_fast_accelerate = true;
+  }
+  std::unique_ptr<PeerConnectionObserver> observer(new PeerConnectionObserver(
+      sender, _receiver, _data_manager, ultra_low_latency));
   webrtc::PeerConnectionDependencies dependencies(observer.get());
 
   // WebRTC の SSL 接続の検証は自前のルート証明書(rtc_base/ssl_roots.h)でやっていて、
@@ -239,6 +718,47 @@ std::shared_ptr<RTCConnection> RTCManager::createConnection(
     return nullptr;
   }
 
+  // 既定の開始ビットレートから少しずつ探ると最初の数秒の映像が粗くなるので、
+  // 前回同じ接続先で推定できた帯域か --start-bitrate から始める。
+  // 開始ビットレートを変えると、その数倍で帯域を探るプローブも送られる
+  webrtc::BitrateSettings bitrate_settings;
+  if (_conn_settings.min_bitrate > 0) {
+    bitrate_settings.min_bitrate_bps = _conn_settings.min_bitrate * 1000;
+  }
+  if (_conn_settings.max_bitrate > 0) {
+    bitrate_settings.max_bitrate_bps =
+        std::max(_conn_settings.max_bitrate, _conn_settings.min_bitrate) *
+        1000;
+  }
+  int start_bitrate_bps = _conn_settings.start_bitrate * 1000;
+  if (_bitrate_cache && !remote.empty()) {
+    int cached_bitrate_bps = _bitrate_cache->Get(remote);
+    if (cached_bitrate_bps > 0) {
+      RTC_LOG(LS_INFO) << __FUNCTION__ << ": Start from the cached bitrate "
+                       << cached_bitrate_bps << " bps for " << remote;
+      start_bitrate_bps = cached_bitrate_bps;
+    }
+  }
+  if (start_bitrate_bps > 0) {
+    if (bitrate_settings.min_bitrate_bps) {
+      start_bitrate_bps =
+          std::max(start_bitrate_bps, *bitrate_settings.min_bitrate_bps);
+    }
+    if (bitrate_settings.max_bitrate_bps) {
+      start_bitrate_bps =
+          std::min(start_bitrate_bps, *bitrate_settings.max_bitrate_bps);
+    }
+    bitrate_settings.start_bitrate_bps = start_bitrate_bps;
+  }
+  if (bitrate_settings.min_bitrate_bps || bitrate_settings.start_bitrate_bps ||
+      bitrate_settings.max_bitrate_bps) {
+    webrtc::RTCError error = connection->SetBitrate(bitrate_settings);
+    if (!error.ok()) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__
+                          << ": SetBitrate failed: " << error.message();
+    }
+  }
+
   std::string stream_id = Util::generateRandomChars();
 
   if (_audio_track) {
@@ -246,23 +766,123 @@ std::shared_ptr<RTCConnection> RTCManager::createConnection(
         audio_sender = connection->AddTrack(_audio_track, {stream_id});
     if (!audio_sender.ok()) {
       RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot add _audio_track";
+    } else if (!_conn_settings.audio_network_priority.empty()) {
+      setNetworkPriority(audio_sender.value(),
+                         _conn_settings.audio_network_priority);
     }
   }
 
-  if (_video_track) {
+  for (size_t i = 0; i < _video_tracks.size(); i++) {
+    // 追加のカメラは受信側で区別できるように別のストリームにする
+    std::vector<std::string> stream_ids = {
+        i == 0 ? stream_id : Util::generateRandomChars()};
     webrtc::RTCErrorOr<rtc::scoped_refptr<webrtc::RtpSenderInterface> >
-        video_add_result = connection->AddTrack(_video_track, {stream_id});
+        video_add_result = connection->AddTrack(_video_tracks[i], stream_ids);
     if (video_add_result.ok()) {
       rtc::scoped_refptr<webrtc::RtpSenderInterface> video_sender =
           video_add_result.value();
       webrtc::RtpParameters parameters = video_sender->GetParameters();
       parameters.degradation_preference = _conn_settings.getPriority();
       video_sender->SetParameters(parameters);
+      if (!_conn_settings.video_network_priority.empty()) {
+        setNetworkPriority(video_sender, _conn_settings.video_network_priority);
+      }
+      if (!_hw_codecs.empty()) {
+        setHWCodecPreferences(connection, video_sender);
+      }
     } else {
-      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot add _video_track";
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Cannot add video_track";
     }
   }
 
-  return std::make_shared<RTCConnection>(sender, std::move(observer),
-                                         connection);
+  if (_data_manager != nullptr) {
+    _data_manager->OnCreateConnection(connection);
+  }
+
+  auto rtc_connection = std::make_shared<RTCConnection>(
+      sender, std::move(observer), connection);
+  rtc_connection->setOpusProfile(_opus_profile);
+  rtc_connection->setVideoProtectionProfile(_video_protection);
+  rtc_connection->setRtcConfig(_conn_settings.rtc_config);
+  if (_bitrate_cache) {
+    rtc_connection->setBitrateCacheKey(remote);
+  }
+
+  std::lock_guard<std::mutex> lock(_connections_mtx);
+  _connections.push_back(rtc_connection);
+  return rtc_connection;
+}
+
+void RTCManager::setNetworkPriority(
+    rtc::scoped_refptr<webrtc::RtpSenderInterface> sender,
+    const std::string& name) {
+  // --dscp の場合に付ける DSCP の値が変わる。サイマルキャストの場合は全てのレイヤーに同じ優先度を付ける
+  webrtc::RtpParameters parameters = sender->GetParameters();
+  const webrtc::Priority priority = ConnectionSettings::getNetworkPriority(name);
+  for (auto& encoding : parameters.encodings) {
+    encoding.network_priority = priority;
+  }
+  webrtc::RTCError error = sender->SetParameters(parameters);
+  if (!error.ok()) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__
+                        << ": SetParameters failed: " << error.message();
+  }
+}
+
+void RTCManager::setHWCodecPreferences(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection,
+    rtc::scoped_refptr<webrtc::RtpSenderInterface> sender) {
+  // offer を作る場合も、相手の offer に answer を返す場合も、この順序でコーデックを並べる
+  std::vector<webrtc::RtpCodecCapability> codecs = SortCodecCapabilities(
+      _factory->GetRtpSenderCapabilities(cricket::MEDIA_TYPE_VIDEO).codecs,
+      _hw_codecs);
+  for (const auto& transceiver : connection->GetTransceivers()) {
+    if (transceiver->sender() != sender) {
+      continue;
+    }
+    webrtc::RTCError error = transceiver->SetCodecPreferences(codecs);
+    if (!error.ok()) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__
+                          << ": SetCodecPreferences failed: " << error.message();
+    }
+    return;
+  }
+}
+
+int RTCManager::getAudioPlayoutDelayMs() const {
+  uint16_t delay_ms = 0;
+  if (!_adm || _adm->PlayoutDelay(&delay_ms) != 0) {
+    return 0;
+  }
+  return delay_ms;
+}
+
+bool RTCManager::getSnapshot(std::string* jpeg) {
+  if (!_snapshot_sink) {
+    return false;
+  }
+  return _snapshot_sink->GetJpeg(jpeg);
+}
+
+std::string RTCManager::saveClip() {
+  if (!_recorder) {
+    return "";
+  }
+  return _recorder->SaveClip();
+}
+
+std::vector<std::shared_ptr<RTCConnection>> RTCManager::getConnections() {
+  std::lock_guard<std::mutex> lock(_connections_mtx);
+  std::vector<std::shared_ptr<RTCConnection>> connections;
+  auto it = _connections.begin();
+  while (it != _connections.end()) {
+    auto connection = it->lock();
+    if (connection) {
+      connections.push_back(std::move(connection));
+      ++it;
+    } else {
+      it = _connections.erase(it);
+    }
+  }
+  return connections;
 }
@@ -1,36 +1,168 @@
 #ifndef RTC_MANAGER_H_
 #define RTC_MANAGER_H_
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "api/peer_connection_interface.h"
+#include "api/video_codecs/video_encoder_factory.h"
+#include "modules/audio_device/include/audio_device.h"
 #include "connection.h"
 #include "connection_settings.h"
 #include "data_manager.h"
+#include "local_recorder.h"
 #include "messagesender.h"
+#include "opus_profile.h"
+#include "rtsp/rtsp_stream.h"
 #include "pc/video_track_source.h"
+#include "rtc_base/rtc_certificate.h"
 #include "scalable_track_source.h"
+#include "video_protection_profile.h"
 #include "video_track_receiver.h"
 
+class BitrateCache;
 class RTCConnection;
+class ShmFrameExporter;
+class SnapshotSink;
+class StatsSampler;
+
+// PeerConnectionFactory が使う network, worker, signaling のスレッド。
+// ゲートウェイモードでは全てのセッションの RTCManager で共有し、
+// セッションの数によらずスレッドを 3 つにする。最後の参照が無くなった時に止める
+class RTCThreads {
+ public:
+  static std::shared_ptr<RTCThreads> Create();
+  ~RTCThreads();
+
+  rtc::Thread* network() const { return network_.get(); }
+  rtc::Thread* worker() const { return worker_.get(); }
+  rtc::Thread* signaling() const { return signaling_.get(); }
+
+ private:
+  RTCThreads() = default;
+
+  std::unique_ptr<rtc::Thread> network_;
+  std::unique_ptr<rtc::Thread> worker_;
+  std::unique_ptr<rtc::Thread> signaling_;
+};
 
 class RTCManager {
  public:
+  // video_track_sources の先頭を主なトラックとし、残りは別のトラックとして送信する。
+  // threads が nullptr の場合は、この RTCManager 用のスレッドを作る
+  RTCManager(
+      ConnectionSettings conn_settings,
+      std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>>
+          video_track_sources,
+      VideoTrackReceiver* receiver,
+      std::shared_ptr<RTCThreads> threads = nullptr);
+  // 映像のソースは setVideoTrackSources() で後から渡す。
+  // conn_settings.fast_startup の場合は PeerConnectionFactory をバックグラウンドで作り始めるので、
+  // その間にカメラを開いたりシグナリングサーバに繋いだりできる
   RTCManager(ConnectionSettings conn_settings,
-             rtc::scoped_refptr<ScalableVideoTrackSource> video_track_source,
-             VideoTrackReceiver* receiver);
+             VideoTrackReceiver* receiver,
+             std::shared_ptr<RTCThreads> threads = nullptr);
   ~RTCManager();
+  // --video-protection と --rtc-config から決まるフィールドトライアルの文字列
+  static std::string FieldTrials(const ConnectionSettings& cs);
+  // フィールドトライアルは WebRTC のプロセス全体の設定なので、最初に呼んだ時だけ設定する。
+  // ゲートウェイモードでは、セッションを作る前に全体のコマンドラインの値で呼ぶこと
+  static void InitFieldTrials(const std::string& field_trials);
+  // 2 つ目のコンストラクタを使った場合に、1 回だけ呼ぶこと
+  void setVideoTrackSources(
+      std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>>
+          video_track_sources);
   void SetDataManager(RTCDataManager* data_manager);
+  // remote は --bitrate-cache で帯域を覚えておく接続先の名前。空の場合は覚えない
   std::shared_ptr<RTCConnection> createConnection(
       webrtc::PeerConnectionInterface::RTCConfiguration rtc_config,
-      RTCMessageSender* sender);
+      RTCMessageSender* sender,
+      const std::string& remote = "");
+  // 生成した RTCConnection のうち、まだ破棄されていないもの
+  std::vector<std::shared_ptr<RTCConnection>> getConnections();
+  rtc::scoped_refptr<ScalableVideoTrackSource> getVideoTrackSource() const {
+    return _video_track_sources.empty() ? nullptr : _video_track_sources[0];
+  }
+  std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>>
+  getVideoTrackSources() const {
+    return _video_track_sources;
+  }
+  // --record-preroll-sec で保持している映像と音声を書き出すファイルのパスを返す。
+  // 書き出せない場合は空文字列を返す
+  std::string saveClip();
+  // --snapshot を指定した場合に、最新のフレームを JPEG にして返す。
+  // 指定していない場合や、まだフレームが無い場合は false を返す
+  bool getSnapshot(std::string* jpeg);
+  // --rtsp-port を指定していない場合は nullptr を返す
+  std::shared_ptr<RtspStream> getRtspStream() const { return _rtsp_stream; }
+  // --stats-interval-ms などで作った StatsSampler。io_context を回す前に設定する
+  void setStatsSampler(std::shared_ptr<StatsSampler> stats_sampler) {
+    _stats_sampler = std::move(stats_sampler);
+  }
+  std::shared_ptr<StatsSampler> getStatsSampler() const {
+    return _stats_sampler;
+  }
+  // --bitrate-cache で作った BitrateCache。io_context を回す前に設定する
+  void setBitrateCache(std::shared_ptr<BitrateCache> bitrate_cache) {
+    _bitrate_cache = std::move(bitrate_cache);
+  }
+  // スピーカーに渡した音声が実際に再生されるまでの時間。分からない場合は 0 を返す
+  int getAudioPlayoutDelayMs() const;
 
  private:
+  void createFactory();
+  void createTracks();
+  std::unique_ptr<webrtc::VideoEncoderFactory> createVideoEncoderFactory();
+  // sender の全てのエンコーディングに name の優先度を設定する
+  void setNetworkPriority(rtc::scoped_refptr<webrtc::RtpSenderInterface> sender,
+                          const std::string& name);
+  // sender のトランシーバーで、_hw_codecs を先頭にしたコーデックの順序を使う
+  void setHWCodecPreferences(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection,
+      rtc::scoped_refptr<webrtc::RtpSenderInterface> sender);
+  // fast_startup の場合に、PeerConnectionFactory とトラックを作り終わるまで待つ
+  void waitInitialized();
+
   rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> _factory;
   rtc::scoped_refptr<webrtc::AudioTrackInterface> _audio_track;
-  rtc::scoped_refptr<webrtc::VideoTrackInterface> _video_track;
-  std::unique_ptr<rtc::Thread> _networkThread;
-  std::unique_ptr<rtc::Thread> _workerThread;
-  std::unique_ptr<rtc::Thread> _signalingThread;
+  rtc::scoped_refptr<webrtc::AudioDeviceModule> _adm;
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> _video_tracks;
+  std::shared_ptr<RTCThreads> _threads;
   ConnectionSettings _conn_settings;
   VideoTrackReceiver* _receiver;
   RTCDataManager* _data_manager;
+  std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>>
+      _video_track_sources;
+  std::mutex _connections_mtx;
+  std::vector<std::weak_ptr<RTCConnection>> _connections;
+  // --fast-reconnect の場合は全ての接続で同じ DTLS 証明書を使う
+  rtc::scoped_refptr<rtc::RTCCertificate> _certificate;
+  // --audio-profile で指定した Opus の設定
+  OpusProfile _opus_profile;
+  // --prefer-hw-codec で、ハードウェアエンコーダを初期化できたコーデック
+  std::vector<std::string> _hw_codecs;
+  // --video-protection で指定した映像の FEC と NACK の設定
+  VideoProtectionProfile _video_protection;
+  // --record-dir を指定した場合に、エンコード済みの映像と音声を記録する
+  std::shared_ptr<LocalRecorder> _recorder;
+  // --rtsp-port を指定した場合に、送信している H.264 を RTSP のクライアントに配る
+  std::shared_ptr<RtspStream> _rtsp_stream;
+  std::shared_ptr<StatsSampler> _stats_sampler;
+  std::shared_ptr<BitrateCache> _bitrate_cache;
+#if defined(__linux__)
+  // --shm-export を指定した場合に、最初のカメラのフレームを共有メモリに書き出す
+  std::unique_ptr<ShmFrameExporter> _shm_exporter;
+#endif
+  // --snapshot を指定した場合に、最初のカメラの最新のフレームを保持する
+  std::unique_ptr<SnapshotSink> _snapshot_sink;
+  // fast_startup の場合に PeerConnectionFactory とトラックを作るスレッド
+  std::thread _init_thread;
+  std::mutex _init_mtx;
+  std::condition_variable _init_cond;
+  bool _sources_set = false;
+  bool _initialized = false;
 };
 #endif
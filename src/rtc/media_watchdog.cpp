@@ -0,0 +1,125 @@
+#include "media_watchdog.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 確認する間隔の上限
+const int kMaxCheckIntervalMs = 500;
+
+}  // namespace
+
+std::shared_ptr<MediaWatchdog> MediaWatchdog::Create(
+    boost::asio::io_context& ioc,
+    Settings settings,
+    std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+    VideoTrackReceiver* receiver) {
+  if (sources.empty()) {
+    settings.capture_stall_ms = 0;
+  }
+  if (receiver == nullptr) {
+    settings.renderer_stall_ms = 0;
+  }
+  if (settings.capture_stall_ms <= 0 && settings.renderer_stall_ms <= 0) {
+    return nullptr;
+  }
+  return std::make_shared<MediaWatchdog>(ioc, settings, std::move(sources),
+                                         receiver);
+}
+
+MediaWatchdog::MediaWatchdog(
+    boost::asio::io_context& ioc,
+    Settings settings,
+    std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+    VideoTrackReceiver* receiver)
+    : timer_(ioc), settings_(settings), receiver_(receiver) {
+  for (const auto& source : sources) {
+    SourceState state;
+    state.source = source;
+    sources_.push_back(state);
+  }
+}
+
+void MediaWatchdog::Start() {
+  int interval_ms = kMaxCheckIntervalMs;
+  if (settings_.capture_stall_ms > 0) {
+    interval_ms = std::min(interval_ms, settings_.capture_stall_ms / 2);
+  }
+  if (settings_.renderer_stall_ms > 0) {
+    interval_ms = std::min(interval_ms, settings_.renderer_stall_ms / 2);
+  }
+  timer_.expires_after(std::chrono::milliseconds(std::max(interval_ms, 1)));
+  auto self = shared_from_this();
+  timer_.async_wait([self](const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+    self->OnTimer();
+  });
+}
+
+void MediaWatchdog::Stop() {
+  timer_.cancel();
+}
+
+void MediaWatchdog::OnTimer() {
+  const int64_t now_ms = rtc::TimeMillis();
+  if (settings_.capture_stall_ms > 0) {
+    CheckCapture(now_ms);
+  }
+  if (settings_.renderer_stall_ms > 0) {
+    CheckRenderer();
+  }
+  Start();
+}
+
+void MediaWatchdog::CheckCapture(int64_t now_ms) {
+  for (SourceState& state : sources_) {
+    if (state.source->IsCapturePaused()) {
+      // 止めている間はフレームが届かないので、再開してから capture_stall_ms 待つ
+      state.last_progress_ms = now_ms;
+      continue;
+    }
+    ScalableVideoTrackSource::CaptureStats stats =
+        state.source->GetCaptureStats();
+    // エンコーダが詰まっていて間引いたフレームも、デバイスからは届いている
+    const int64_t frames =
+        stats.captured_frames + stats.backpressure_skipped_frames;
+    if (frames != state.frames) {
+      if (state.restarts > 0) {
+        RTC_LOG(LS_INFO) << "Capture resumed after " << state.restarts
+                         << " restarts";
+        state.restarts = 0;
+      }
+      state.frames = frames;
+      state.last_progress_ms = now_ms;
+      continue;
+    }
+    if (now_ms - state.last_progress_ms < settings_.capture_stall_ms) {
+      continue;
+    }
+    RTC_LOG(LS_WARNING) << "Capture stalled for "
+                        << now_ms - state.last_progress_ms << " ms";
+    ++state.restarts;
+    if (!state.source->Restart()) {
+      RTC_LOG(LS_WARNING) << "Failed to restart capture";
+    }
+    // 開き直した後は、もう一度 capture_stall_ms の間待つ
+    state.last_progress_ms = rtc::TimeMillis();
+  }
+}
+
+void MediaWatchdog::CheckRenderer() {
+  const int64_t gap_ms = receiver_->GetLongestFrameGapMs();
+  const bool stalled = gap_ms >= settings_.renderer_stall_ms;
+  if (stalled && !renderer_stalled_) {
+    RTC_LOG(LS_WARNING) << "No video frame received for " << gap_ms << " ms";
+  } else if (!stalled && renderer_stalled_) {
+    RTC_LOG(LS_INFO) << "Received video resumed";
+  }
+  renderer_stalled_ = stalled;
+}
@@ -0,0 +1,71 @@
+#ifndef MEDIA_WATCHDOG_H_
+#define MEDIA_WATCHDOG_H_
+
+#include <stdint.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <memory>
+#include <vector>
+
+// WebRTC
+#include "api/scoped_refptr.h"
+
+#include "scalable_track_source.h"
+#include "video_track_receiver.h"
+
+// キャプチャと受信した映像の描画が止まっていないかを一定間隔で確認するクラス。
+//
+// キャプチャしたフレーム数が capture_stall_ms の間増えなかった場合は、
+// ScalableVideoTrackSource::Restart() でデバイスを開き直す。
+// 開き直してからもう一度 capture_stall_ms の間待って、まだ止まっていれば再度開き直す。
+// 受信した映像のフレームが renderer_stall_ms の間届かなかった場合は警告をログに出す。
+// エンコーダが止まった場合は、各エンコーダが EncoderMetrics::IsStalled() を見て作り直す。
+// どの場合も PeerConnection はそのまま使い続ける。
+// io_context は 1 スレッドで回していること。
+class MediaWatchdog : public std::enable_shared_from_this<MediaWatchdog> {
+ public:
+  struct Settings {
+    // 0 以下の場合は確認しない
+    int capture_stall_ms = 0;
+    int renderer_stall_ms = 0;
+  };
+
+  // どちらも確認しない場合は nullptr を返す
+  static std::shared_ptr<MediaWatchdog> Create(
+      boost::asio::io_context& ioc,
+      Settings settings,
+      std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+      VideoTrackReceiver* receiver);
+
+  MediaWatchdog(
+      boost::asio::io_context& ioc,
+      Settings settings,
+      std::vector<rtc::scoped_refptr<ScalableVideoTrackSource>> sources,
+      VideoTrackReceiver* receiver);
+
+  void Start();
+  void Stop();
+
+ private:
+  struct SourceState {
+    rtc::scoped_refptr<ScalableVideoTrackSource> source;
+    // 最後に確認した時のフレーム数と、最後に増えた時刻
+    int64_t frames = -1;
+    int64_t last_progress_ms = 0;
+    int restarts = 0;
+  };
+
+  void OnTimer();
+  void CheckCapture(int64_t now_ms);
+  void CheckRenderer();
+
+  boost::asio::steady_timer timer_;
+  const Settings settings_;
+  std::vector<SourceState> sources_;
+  VideoTrackReceiver* receiver_;
+  // 受信した映像が止まっていると警告済みかどうか
+  bool renderer_stalled_ = false;
+};
+
+#endif  // MEDIA_WATCHDOG_H_
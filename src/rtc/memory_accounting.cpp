@@ -0,0 +1,58 @@
+#include "memory_accounting.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+
+#include <fstream>
+#endif
+
+MemoryAccounting& MemoryAccounting::Instance() {
+  static MemoryAccounting instance;
+  return instance;
+}
+
+const char* MemoryAccounting::Name(Area area) {
+  switch (area) {
+    case kCapture:
+      return "capture";
+    case kNativeBuffer:
+      return "native_buffer";
+    case kHwEncoder:
+      return "hw_encoder";
+    case kWebsocket:
+      return "websocket";
+    case kRecorder:
+      return "recorder";
+    default:
+      return "unknown";
+  }
+}
+
+MemoryAccounting::MemoryAccounting() : budget_bytes_(0) {
+  for (auto& bytes : bytes_) {
+    bytes = 0;
+  }
+}
+
+void MemoryAccounting::Add(Area area, int64_t bytes) {
+  bytes_[area].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+int64_t MemoryAccounting::Get(Area area) const {
+  return bytes_[area].load(std::memory_order_relaxed);
+}
+
+int64_t MemoryAccounting::GetResidentBytes() {
+#if defined(__linux__)
+  // "size resident shared ..." の形式で、単位はページ
+  std::ifstream ifs("/proc/self/statm");
+  int64_t size = 0;
+  int64_t resident = 0;
+  if (!(ifs >> size >> resident)) {
+    return 0;
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+#else
+  return 0;
+#endif
+}
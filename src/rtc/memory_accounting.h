@@ -0,0 +1,51 @@
+#ifndef MEMORY_ACCOUNTING_H_
+#define MEMORY_ACCOUNTING_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+// サブシステム毎に確保しているメモリの量を数えるクラス。
+//
+// 大きなバッファを確保、解放する所で Add() を呼んで足し引きするだけなので、
+// 小さな確保や WebRTC の内部で確保するメモリは含まない。
+// メトリクスの momo_memory_bytes で出力する。
+//
+// 各メソッドは任意のスレッドから呼び出して良い。
+class MemoryAccounting {
+ public:
+  enum Area {
+    // V4L2 のキャプチャで mmap したバッファ
+    kCapture,
+    // NativeBuffer が確保したフレーム
+    kNativeBuffer,
+    // Jetson と Raspberry Pi のハードウェアエンコーダのバッファ
+    kHwEncoder,
+    // WebSocket の送信待ちのメッセージ
+    kWebsocket,
+    // --record-preroll-sec で保持しているフレーム
+    kRecorder,
+    kNumAreas,
+  };
+
+  static MemoryAccounting& Instance();
+  static const char* Name(Area area);
+
+  void Add(Area area, int64_t bytes);
+  int64_t Get(Area area) const;
+
+  // --memory-budget の値。指定していない場合は 0
+  void SetBudget(int64_t bytes) { budget_bytes_ = bytes; }
+  int64_t budget() const { return budget_bytes_; }
+
+  // プロセスの RSS。取得できない場合は 0 を返す
+  static int64_t GetResidentBytes();
+
+ private:
+  MemoryAccounting();
+
+  std::atomic<int64_t> bytes_[kNumAreas];
+  std::atomic<int64_t> budget_bytes_;
+};
+
+#endif  // MEMORY_ACCOUNTING_H_
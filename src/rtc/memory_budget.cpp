@@ -0,0 +1,170 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <string>
+
+#include "memory_accounting.h"
+
+namespace {
+
+const int64_t kMB = 1024 * 1024;
+// WebRTC やライブラリ、スレッドのスタックなど、設定によらない分
+const int64_t kBaseBytes = 48 * kMB;
+// キャプチャからエンコーダまでの間で同時に存在するフレームの数
+const int kInFlightFrames = 4;
+#if USE_JETSON_ENCODER
+// NvVideoEncoder の出力プレーンとキャプチャプレーンのバッファ
+const int kHwEncoderFrames = 20;
+#else
+const int kHwEncoderFrames = 2;
+#endif
+// ログのキューの 1 メッセージあたりの大きさ
+const int64_t kLogMessageBytes = 256;
+
+const int kMinLogQueueSize = 256;
+const int kMinShmExportSlots = 2;
+const int kMinV4L2Buffers = 2;
+const int kMinMmalDecoderBuffers = 2;
+const int kMinPrerollMB = 4;
+
+// 1 段階下の解像度。これ以上下げられない場合は空文字を返す
+std::string LowerResolution(const ConnectionSettings& cs) {
+  if (cs.resolution == "4K") {
+    return "FHD";
+  } else if (cs.resolution == "FHD") {
+    return "HD";
+  } else if (cs.resolution == "HD") {
+    return "VGA";
+  } else if (cs.resolution == "VGA") {
+    return "QVGA";
+  } else if (cs.resolution == "QVGA") {
+    return "";
+  }
+  // WIDTHxHEIGHT の場合は縦横を半分にする
+  auto size = cs.getSize();
+  if (size.width <= 320 || size.height <= 240) {
+    return "";
+  }
+  return std::to_string(size.width / 2 & ~1) + "x" +
+         std::to_string(size.height / 2 & ~1);
+}
+
+template <class T>
+void Reduce(const char* name,
+            T* value,
+            T min_value,
+            std::vector<std::string>* messages) {
+  if (*value <= min_value) {
+    return;
+  }
+  messages->push_back(std::string("MemoryBudget: ") + name + " " +
+                      std::to_string(*value) + " -> " +
+                      std::to_string(min_value));
+  *value = min_value;
+}
+
+}  // namespace
+
+int64_t MemoryBudget::Estimate(const ConnectionSettings& cs) {
+  int64_t bytes = kBaseBytes;
+  if (cs.log_queue_size > 0) {
+    bytes += cs.log_queue_size * kLogMessageBytes;
+  }
+  if (cs.record_preroll_sec > 0) {
+    bytes += cs.record_preroll_mb * kMB;
+  }
+#if USE_MMAL_ENCODER
+  // 受信した映像のデコード用。解像度は相手次第なので送信と同じとみなす
+  const int mmal_decoder_buffers =
+      cs.mmal_decoder_input_buffers + cs.mmal_decoder_output_buffers;
+#else
+  const int mmal_decoder_buffers = 0;
+#endif
+  auto size = cs.getSize();
+  const int64_t frame_bytes = (int64_t)size.width * size.height * 3 / 2;
+  bytes += mmal_decoder_buffers * frame_bytes;
+  if (cs.no_video_device || cs.recv_only) {
+    return bytes;
+  }
+  // V4L2 のバッファは YUYV の大きさで見積もる
+  bytes += cs.v4l2_buffers * (int64_t)size.width * size.height * 2;
+  bytes += (kInFlightFrames + kHwEncoderFrames) * frame_bytes;
+  if (!cs.shm_export.empty()) {
+    bytes += cs.shm_export_slots * frame_bytes;
+  }
+  return bytes;
+}
+
+bool MemoryBudget::Apply(ConnectionSettings* cs,
+                         std::vector<std::string>* messages) {
+  if (cs->memory_budget_mb <= 0) {
+    return true;
+  }
+  const int64_t budget = cs->memory_budget_mb * kMB;
+  MemoryAccounting::Instance().SetBudget(budget);
+
+  auto fits = [cs, budget]() { return Estimate(*cs) <= budget; };
+  if (fits()) {
+    return true;
+  }
+  messages->push_back("MemoryBudget: estimated " +
+                      std::to_string(Estimate(*cs) / kMB) + "MB exceeds " +
+                      std::to_string(cs->memory_budget_mb) + "MB");
+
+  // 1. 映像の品質に影響しないバッファの数
+  Reduce("--log-queue-size", &cs->log_queue_size,
+         std::min(cs->log_queue_size, kMinLogQueueSize), messages);
+  if (!cs->shm_export.empty()) {
+    Reduce("--shm-export-slots", &cs->shm_export_slots, kMinShmExportSlots,
+           messages);
+  }
+  if (!cs->no_video_device && !cs->recv_only) {
+    Reduce("--v4l2-buffers", &cs->v4l2_buffers, kMinV4L2Buffers, messages);
+  }
+#if USE_MMAL_ENCODER
+  Reduce("--mmal-decoder-input-buffers", &cs->mmal_decoder_input_buffers,
+         kMinMmalDecoderBuffers, messages);
+  Reduce("--mmal-decoder-output-buffers", &cs->mmal_decoder_output_buffers,
+         kMinMmalDecoderBuffers, messages);
+#endif
+  if (fits()) {
+    return true;
+  }
+
+  // 2. 足りない分だけプリロールを減らす
+  if (cs->record_preroll_sec > 0) {
+    const int over_mb = (int)((Estimate(*cs) - budget + kMB - 1) / kMB);
+    Reduce("--record-preroll-mb", &cs->record_preroll_mb,
+           std::max(cs->record_preroll_mb - over_mb,
+                    std::min(cs->record_preroll_mb, kMinPrerollMB)),
+           messages);
+    if (fits()) {
+      return true;
+    }
+  }
+
+  // 3. 解像度
+  if (cs->fixed_resolution) {
+    messages->push_back(
+        "MemoryBudget: resolution is not lowered with --fixed-resolution");
+  } else {
+    while (!fits()) {
+      std::string resolution = LowerResolution(*cs);
+      if (resolution.empty()) {
+        break;
+      }
+      messages->push_back("MemoryBudget: lowering resolution " +
+                          cs->resolution + " -> " + resolution +
+                          " to fit --memory-budget");
+      cs->resolution = resolution;
+    }
+  }
+  if (fits()) {
+    return true;
+  }
+  messages->push_back("MemoryBudget: estimated " +
+                      std::to_string(Estimate(*cs) / kMB) +
+                      "MB does not fit in " +
+                      std::to_string(cs->memory_budget_mb) + "MB");
+  return false;
+}
@@ -0,0 +1,28 @@
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "connection_settings.h"
+
+// --memory-budget に収まるように、バッファの数や解像度を決めるクラス。
+//
+// 必要なメモリは、解像度から求めたフレームの大きさとバッファの数からおおまかに見積もる。
+// WebRTC やライブラリの分は固定の値で見積もるので、実際の RSS とは一致しない。
+// 収まらない場合は次の順に減らし、変更した内容を messages に入れる。
+// 1. ログのキュー、--shm-export のスロット、V4L2 のバッファ、MMAL のデコーダのバッファの数
+// 2. --record-preroll-mb
+// 3. 解像度 (--fixed-resolution の場合は下げない)
+class MemoryBudget {
+ public:
+  // cs->memory_budget_mb が 0 の場合は何もしない。
+  // 最小の設定でも収まらない場合は、できるだけ減らした上で false を返す。
+  // ログファイルを開く前に呼ぶこともあるので、messages は呼び出し側でログに出力する
+  static bool Apply(ConnectionSettings* cs, std::vector<std::string>* messages);
+  // cs の設定で必要になるメモリの見積もり
+  static int64_t Estimate(const ConnectionSettings& cs);
+};
+
+#endif  // MEMORY_BUDGET_H_
@@ -1,7 +1,11 @@
 #include "native_buffer.h"
 
 #include "api/video/i420_buffer.h"
+#include "frame_buffer_pool.h"
+#include "memory_accounting.h"
+#include "parallel_scaler.h"
 #include "rtc_base/checks.h"
+#include "scaled_mjpeg_decoder.h"
 #include "third_party/libyuv/include/libyuv.h"
 
 static const int kBufferAlignment = 64;
@@ -24,7 +28,8 @@ webrtc::VideoFrameBuffer::Type NativeBuffer::type() const {
 }
 
 void NativeBuffer::InitializeData() {
-  memset(data_.get(), 0, ArgbDataSize(raw_height_, raw_width_));
+  memset(data_, 0, capacity_);
+  InvalidateConverted();
 }
 
 int NativeBuffer::width() const {
@@ -36,20 +41,83 @@ int NativeBuffer::height() const {
 }
 
 rtc::scoped_refptr<webrtc::I420BufferInterface> NativeBuffer::ToI420() {
-  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-      webrtc::I420Buffer::Create(raw_width_, raw_height_);
-  const int conversionResult = libyuv::ConvertToI420(
-      data_.get(), length_, i420_buffer.get()->MutableDataY(),
-      i420_buffer.get()->StrideY(), i420_buffer.get()->MutableDataU(),
-      i420_buffer.get()->StrideU(), i420_buffer.get()->MutableDataV(),
-      i420_buffer.get()->StrideV(), 0, 0, raw_width_, raw_height_, raw_width_,
-      raw_height_, libyuv::kRotate0, ConvertVideoType(video_type_));
+  // 変換中に他のスレッドから呼ばれた場合は、変換が終わるのを待ってその結果を返す
+  std::lock_guard<std::mutex> lock(converted_mutex_);
+  if (!converted_) {
+    converted_ = ConvertToI420();
+  }
+  return converted_;
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> NativeBuffer::ConvertToI420() {
+  const bool scaled =
+      scaled_width_ != raw_width_ || scaled_height_ != raw_height_;
+
+  if (video_type_ == webrtc::VideoType::kNV12) {
+    // NV12 はプレーンの位置が分かっているので直接変換する。
+    // 縮小する場合は NV12 のまま縮小してから変換した方が変換する画素が少ない
+    const uint8_t* src_y = DataY();
+    const uint8_t* src_uv = DataUV();
+    int src_stride_y = StrideY();
+    int src_stride_uv = StrideUV();
+    rtc::scoped_refptr<NativeBuffer> nv12_buffer;
+    if (scaled) {
+      nv12_buffer = FrameBufferPool::Instance().CreateNativeBuffer(
+          webrtc::VideoType::kNV12, scaled_width_, scaled_height_);
+      ParallelScaler::Instance().NV12Scale(
+          src_y, src_stride_y, src_uv, src_stride_uv, raw_width_, raw_height_,
+          nv12_buffer->MutableDataY(), nv12_buffer->StrideY(),
+          nv12_buffer->MutableDataUV(), nv12_buffer->StrideUV(),
+          scaled_width_, scaled_height_, libyuv::kFilterBox);
+      src_y = nv12_buffer->DataY();
+      src_uv = nv12_buffer->DataUV();
+      src_stride_y = nv12_buffer->StrideY();
+      src_stride_uv = nv12_buffer->StrideUV();
+    }
+    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+        FrameBufferPool::Instance().CreateI420Buffer(scaled_width_,
+                                                     scaled_height_);
+    libyuv::NV12ToI420(src_y, src_stride_y, src_uv, src_stride_uv,
+                       i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+                       i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+                       i420_buffer->MutableDataV(), i420_buffer->StrideV(),
+                       scaled_width_, scaled_height_);
+    return i420_buffer;
+  }
+
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer;
+  if (scaled && video_type_ == webrtc::VideoType::kMJPEG) {
+    // DCT の段階で縮小してデコードできれば、元の解像度でのデコードと縮小の大部分を省ける
+    i420_buffer =
+        DecodeScaledMJPEG(data_, length_, scaled_width_, scaled_height_);
+  }
+  if (!i420_buffer) {
+    i420_buffer =
+        FrameBufferPool::Instance().CreateI420Buffer(raw_width_, raw_height_);
+    const int conversionResult = libyuv::ConvertToI420(
+        data_, length_, i420_buffer.get()->MutableDataY(),
+        i420_buffer.get()->StrideY(), i420_buffer.get()->MutableDataU(),
+        i420_buffer.get()->StrideU(), i420_buffer.get()->MutableDataV(),
+        i420_buffer.get()->StrideV(), 0, 0, raw_width_, raw_height_,
+        raw_width_, raw_height_, libyuv::kRotate0,
+        ConvertVideoType(video_type_));
+  }
+  if (i420_buffer->width() == scaled_width_ &&
+      i420_buffer->height() == scaled_height_) {
+    return i420_buffer;
+  }
   rtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer =
-      webrtc::I420Buffer::Create(scaled_width_, scaled_height_);
-  scaled_buffer->ScaleFrom(*i420_buffer->ToI420());
+      FrameBufferPool::Instance().CreateI420Buffer(scaled_width_,
+                                                   scaled_height_);
+  ParallelScaler::Instance().ScaleFrom(*i420_buffer, scaled_buffer.get());
   return scaled_buffer;
 }
 
+void NativeBuffer::InvalidateConverted() {
+  std::lock_guard<std::mutex> lock(converted_mutex_);
+  converted_ = nullptr;
+}
+
 int NativeBuffer::raw_width() const {
   return raw_width_;
 }
@@ -59,12 +127,16 @@ int NativeBuffer::raw_height() const {
 }
 
 void NativeBuffer::SetScaledSize(int scaled_width, int scaled_height) {
+  std::lock_guard<std::mutex> lock(converted_mutex_);
   scaled_width_ = scaled_width;
   scaled_height_ = scaled_height;
+  converted_ = nullptr;
 }
 
 void NativeBuffer::SetLength(size_t length) {
+  std::lock_guard<std::mutex> lock(converted_mutex_);
   length_ = length;
+  converted_ = nullptr;
 }
 
 size_t NativeBuffer::length() {
@@ -76,13 +148,55 @@ webrtc::VideoType NativeBuffer::VideoType() const {
 }
 
 const uint8_t* NativeBuffer::Data() const {
-  return data_.get();
+  return data_;
 }
 
 uint8_t* NativeBuffer::MutableData() {
   return const_cast<uint8_t*>(Data());
 }
 
+int NativeBuffer::dmabuf_fd() const {
+  return -1;
+}
+
+bool NativeBuffer::GetDmabufPlanes(uint32_t offsets[3],
+                                   uint32_t pitches[3]) const {
+  if (video_type_ != webrtc::VideoType::kNV12) {
+    return false;
+  }
+  offsets[0] = 0;
+  offsets[1] = StrideY() * raw_height_;
+  offsets[2] = 0;
+  pitches[0] = StrideY();
+  pitches[1] = StrideUV();
+  pitches[2] = 0;
+  return true;
+}
+
+int NativeBuffer::StrideY() const {
+  return raw_width_;
+}
+
+int NativeBuffer::StrideUV() const {
+  return raw_width_;
+}
+
+const uint8_t* NativeBuffer::DataY() const {
+  return data_;
+}
+
+const uint8_t* NativeBuffer::DataUV() const {
+  return data_ + StrideY() * raw_height_;
+}
+
+uint8_t* NativeBuffer::MutableDataY() {
+  return const_cast<uint8_t*>(DataY());
+}
+
+uint8_t* NativeBuffer::MutableDataUV() {
+  return const_cast<uint8_t*>(DataUV());
+}
+
 NativeBuffer::NativeBuffer(webrtc::VideoType video_type, int width, int height)
     : raw_width_(width),
       raw_height_(height),
@@ -90,8 +204,33 @@ NativeBuffer::NativeBuffer(webrtc::VideoType video_type, int width, int height)
       scaled_height_(height),
       length_(ArgbDataSize(height, width)),
       video_type_(video_type),
-      data_(static_cast<uint8_t*>(
+      capacity_(ArgbDataSize(height, width)),
+      owned_data_(static_cast<uint8_t*>(
           webrtc::AlignedMalloc(ArgbDataSize(height, width),
-                                kBufferAlignment))) {}
+                                kBufferAlignment))),
+      data_(owned_data_.get()) {
+  MemoryAccounting::Instance().Add(MemoryAccounting::kNativeBuffer,
+                                   capacity_);
+}
 
-NativeBuffer::~NativeBuffer() {}
\ No newline at end of file
+NativeBuffer::NativeBuffer(webrtc::VideoType video_type,
+                           int width,
+                           int height,
+                           uint8_t* data,
+                           size_t capacity)
+    : raw_width_(width),
+      raw_height_(height),
+      scaled_width_(width),
+      scaled_height_(height),
+      length_(capacity),
+      video_type_(video_type),
+      capacity_(capacity),
+      data_(data) {}
+
+NativeBuffer::~NativeBuffer() {
+  // 外から渡された data は計上していない
+  if (owned_data_) {
+    MemoryAccounting::Instance().Add(MemoryAccounting::kNativeBuffer,
+                                     -(int64_t)capacity_);
+  }
+}
\ No newline at end of file
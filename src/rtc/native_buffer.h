@@ -1,11 +1,21 @@
 #ifndef NATIVE_BUFFER_H_
 #define NATIVE_BUFFER_H_
 
+#include <mutex>
+
+#include "api/video/i420_buffer.h"
 #include "api/video/video_frame.h"
 #include "common_video/include/video_frame_buffer.h"
 #include "common_video/libyuv/include/webrtc_libyuv.h"
 #include "rtc_base/memory/aligned_malloc.h"
 
+// キャプチャしたままの形式 (MJPEG や YUY2、NV12 など) のフレームを保持するバッファ。
+//
+// ToI420() の結果はバッファの中にキャッシュするので、レンダラとエンコーダのように
+// 複数の下流から呼ばれても変換は 1 回で済む。SetScaledSize() で縮小を指定されていれば
+// 最初からその解像度に変換し、MJPEG の場合は可能なら DCT の段階で縮小してデコードする。
+// キャッシュは SetScaledSize()、SetLength()、InitializeData() で捨てるので、
+// データを書き換えた後はいずれかを呼ぶこと。
 class NativeBuffer : public webrtc::VideoFrameBuffer {
  public:
   static rtc::scoped_refptr<NativeBuffer> Create(webrtc::VideoType video_type,
@@ -27,18 +37,48 @@ class NativeBuffer : public webrtc::VideoFrameBuffer {
   webrtc::VideoType VideoType() const;
   const uint8_t* Data() const;
   uint8_t* MutableData();
+  // DMABUF としてエクスポートされている場合はその fd を返す。それ以外は -1
+  virtual int dmabuf_fd() const;
+  // DMABUF の各プレーンのオフセットとピッチ。kNV12 なら 2 つ、kI420 なら 3 つ設定する。
+  // デフォルトは kNV12 の場合のみ、下の StrideY() などと同じ配置を返す
+  virtual bool GetDmabufPlanes(uint32_t offsets[3], uint32_t pitches[3]) const;
+
+  // VideoType が kNV12 の場合のプレーンへのアクセサ。
+  // Y プレーンの直後に UV プレーンが隙間なく並んでいる前提。
+  int StrideY() const;
+  int StrideUV() const;
+  const uint8_t* DataY() const;
+  const uint8_t* DataUV() const;
+  uint8_t* MutableDataY();
+  uint8_t* MutableDataUV();
 
  protected:
   NativeBuffer(webrtc::VideoType video_type, int width, int height);
+  // 外部で確保されたメモリをコピーせずに参照する場合に利用する。
+  // data の寿命は派生クラス側で管理すること。
+  NativeBuffer(webrtc::VideoType video_type,
+               int width,
+               int height,
+               uint8_t* data,
+               size_t capacity);
   ~NativeBuffer() override;
 
  private:
+  rtc::scoped_refptr<webrtc::I420Buffer> ConvertToI420();
+  void InvalidateConverted();
+
   const int raw_width_;
   const int raw_height_;
   int scaled_width_;
   int scaled_height_;
   size_t length_;
   const webrtc::VideoType video_type_;
-  const std::unique_ptr<uint8_t, webrtc::AlignedFreeDeleter> data_;
+  const size_t capacity_;
+  const std::unique_ptr<uint8_t, webrtc::AlignedFreeDeleter> owned_data_;
+  uint8_t* const data_;
+
+  // ToI420() の結果のキャッシュ
+  std::mutex converted_mutex_;
+  rtc::scoped_refptr<webrtc::I420Buffer> converted_;
 };
 #endif  // NATIVE_BUFFER_H_
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "observer.h"
 
 #include <iostream>
+#include <memory>
 
 #include "rtc_base/logging.h"
+#include "rtc_base/network_constants.h"
+#include "startup_timer.h"
 
 PeerConnectionObserver::~PeerConnectionObserver() {
   // Ayame 再接続時などには kIceConnectionDisconnected の前に破棄されているため
@@ -23,6 +26,11 @@ void PeerConnectionObserver::OnStandardizedIceConnectionChange(
                        kIceConnectionDisconnected) {
     ClearAllRegisteredTracks();
   }
+  if (new_state == webrtc::PeerConnectionInterface::IceConnectionState::
+                       kIceConnectionConnected) {
+    StartupTimer::Instance().Mark("ice_connected");
+    StartupTimer::Instance().Report();
+  }
   if (_sender != nullptr) {
     _sender->onIceConnectionStateChange(new_state);
   }
@@ -41,8 +49,28 @@ void PeerConnectionObserver::OnIceCandidate(
   }
 }
 
+void PeerConnectionObserver::OnIceSelectedCandidatePairChanged(
+    const cricket::CandidatePairChangeEvent& event) {
+  const cricket::Candidate& local =
+      event.selected_candidate_pair.local_candidate();
+  const cricket::Candidate& remote =
+      event.selected_candidate_pair.remote_candidate();
+  RTC_LOG(LS_INFO) << __FUNCTION__ << " reason:" << event.reason
+                   << " network:" << local.network_name() << "("
+                   << rtc::AdapterTypeToString(local.network_type()) << ")"
+                   << " local:" << local.type() << " "
+                   << local.address().ToSensitiveString()
+                   << " remote:" << remote.type() << " "
+                   << remote.address().ToSensitiveString()
+                   << " last_data_received_ms:" << event.last_data_received_ms;
+}
+
 void PeerConnectionObserver::OnTrack(
     rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) {
+  if (_ultra_low_latency) {
+    // 送信側が playout-delay を付けていなくても、ジッターバッファで余分に待たない
+    transceiver->receiver()->SetJitterBufferMinimumDelay(0.0);
+  }
   if (_receiver == nullptr)
     return;
   rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track =
@@ -87,6 +115,21 @@ void CreateSessionDescriptionObserver::OnSuccess(
     webrtc::SessionDescriptionInterface* desc) {
   std::string sdp;
   desc->ToString(&sdp);
+  std::string rewritten_sdp = _rewrite_sdp ? _rewrite_sdp(sdp) : sdp;
+  if (rewritten_sdp != sdp) {
+    webrtc::SdpParseError error;
+    std::unique_ptr<webrtc::SessionDescriptionInterface> rewritten_desc =
+        webrtc::CreateSessionDescription(desc->GetType(), rewritten_sdp,
+                                         &error);
+    if (rewritten_desc) {
+      delete desc;
+      desc = rewritten_desc.release();
+      sdp = std::move(rewritten_sdp);
+    } else {
+      RTC_LOG(LS_WARNING) << "Failed to rewrite session description: "
+                          << error.description;
+    }
+  }
   RTC_LOG(LS_INFO) << "Created session description : " << sdp;
   _connection->SetLocalDescription(
       SetSessionDescriptionObserver::Create(desc->GetType(), _sender), desc);
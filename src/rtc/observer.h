@@ -1,6 +1,9 @@
 #ifndef PEERCONNECTIONOBSERVER_H_
 #define PEERCONNECTIONOBSERVER_H_
 
+#include <functional>
+#include <string>
+
 #include "api/peer_connection_interface.h"
 #include "data_manager.h"
 #include "messagesender.h"
@@ -8,10 +11,15 @@
 
 class PeerConnectionObserver : public webrtc::PeerConnectionObserver {
  public:
+  // ultra_low_latency の場合は、受信したトラックのジッターバッファの遅延を最小にする
   PeerConnectionObserver(RTCMessageSender* sender,
                          VideoTrackReceiver* receiver,
-                         RTCDataManager* data_manager)
-      : _sender(sender), _receiver(receiver), _data_manager(data_manager){};
+                         RTCDataManager* data_manager,
+                         bool ultra_low_latency = false)
+      : _sender(sender),
+        _receiver(receiver),
+        _data_manager(data_manager),
+        _ultra_low_latency(ultra_low_latency){};
   ~PeerConnectionObserver();
 
  protected:
@@ -25,6 +33,9 @@ class PeerConnectionObserver : public webrtc::PeerConnectionObserver {
   void OnIceGatheringChange(
       webrtc::PeerConnectionInterface::IceGatheringState new_state) override{};
   void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override;
+  // 経路が切り替わったことと、その経路のネットワークの種類をログに出す
+  void OnIceSelectedCandidatePairChanged(
+      const cricket::CandidatePairChangeEvent& event) override;
   void OnTrack(
       rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) override;
   void OnRemoveTrack(
@@ -36,29 +47,39 @@ class PeerConnectionObserver : public webrtc::PeerConnectionObserver {
   RTCMessageSender* _sender;
   VideoTrackReceiver* _receiver;
   RTCDataManager* _data_manager;
+  const bool _ultra_low_latency;
   std::vector<webrtc::VideoTrackInterface*> _video_tracks;
 };
 
 class CreateSessionDescriptionObserver
     : public webrtc::CreateSessionDescriptionObserver {
  public:
+  // 生成した SDP を書き換える関数。書き換えない場合は引数をそのまま返す
+  typedef std::function<std::string(const std::string& sdp)> SdpRewriter;
+
+  // rewrite_sdp が指定されている場合は、SDP を書き換えてから使う
   static CreateSessionDescriptionObserver* Create(
       RTCMessageSender* sender,
-      webrtc::PeerConnectionInterface* connection) {
+      webrtc::PeerConnectionInterface* connection,
+      SdpRewriter rewrite_sdp = nullptr) {
     return new rtc::RefCountedObject<CreateSessionDescriptionObserver>(
-        sender, connection);
+        sender, connection, std::move(rewrite_sdp));
   }
 
  protected:
   CreateSessionDescriptionObserver(RTCMessageSender* sender,
-                                   webrtc::PeerConnectionInterface* connection)
-      : _sender(sender), _connection(connection){};
+                                   webrtc::PeerConnectionInterface* connection,
+                                   SdpRewriter rewrite_sdp)
+      : _sender(sender),
+        _connection(connection),
+        _rewrite_sdp(std::move(rewrite_sdp)){};
   void OnSuccess(webrtc::SessionDescriptionInterface* desc) override;
   void OnFailure(webrtc::RTCError error) override;
 
  private:
   RTCMessageSender* _sender;
   webrtc::PeerConnectionInterface* _connection;
+  SdpRewriter _rewrite_sdp;
 };
 
 class SetSessionDescriptionObserver
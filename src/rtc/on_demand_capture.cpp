@@ -0,0 +1,80 @@
+#include "on_demand_capture.h"
+
+#include <chrono>
+
+#include "rtc_base/logging.h"
+
+OnDemandCapture::OnDemandCapture(int linger_ms,
+                                 std::function<bool()> start,
+                                 std::function<void()> stop)
+    : linger_ms_(linger_ms),
+      start_(std::move(start)),
+      stop_(std::move(stop)),
+      paused_(false) {
+  thread_ = std::thread([this]() { Run(); });
+}
+
+OnDemandCapture::~OnDemandCapture() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+void OnDemandCapture::AddSink(const void* sink) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!sinks_.insert(sink).second) {
+      return;
+    }
+  }
+  cond_.notify_all();
+}
+
+void OnDemandCapture::RemoveSink(const void* sink) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sinks_.erase(sink) == 0) {
+      return;
+    }
+  }
+  cond_.notify_all();
+}
+
+void OnDemandCapture::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!quit_) {
+    if (!sinks_.empty()) {
+      if (paused_) {
+        RTC_LOG(LS_INFO) << "Starting on-demand capture for " << sinks_.size()
+                         << " sinks";
+        lock.unlock();
+        const bool started = start_();
+        lock.lock();
+        if (!started) {
+          RTC_LOG(LS_ERROR) << "Failed to start on-demand capture";
+          cond_.wait_for(lock, std::chrono::seconds(1),
+                         [this]() { return quit_ || sinks_.empty(); });
+          continue;
+        }
+        paused_ = false;
+      }
+      cond_.wait(lock, [this]() { return quit_ || sinks_.empty(); });
+    } else if (!paused_) {
+      // すぐに次の接続が来ることが多いので、しばらく待ってから止める
+      if (cond_.wait_for(lock, std::chrono::milliseconds(linger_ms_),
+                         [this]() { return quit_ || !sinks_.empty(); })) {
+        continue;
+      }
+      RTC_LOG(LS_INFO) << "Stopping on-demand capture";
+      paused_ = true;
+      lock.unlock();
+      stop_();
+      lock.lock();
+    } else {
+      cond_.wait(lock, [this]() { return quit_ || !sinks_.empty(); });
+    }
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef ON_DEMAND_CAPTURE_H_
+#define ON_DEMAND_CAPTURE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+// 映像のシンクが付いている間だけキャプチャを動かすクラス。
+//
+// 最初のシンクが付いたらキャプチャを始め、最後のシンクが外れてから linger_ms 経っても
+// 新しいシンクが付かなければキャプチャを止める。
+// start と stop は専用のスレッドから呼ぶので、AddSink() と RemoveSink() は
+// デバイスを操作する時間待たずに戻る。
+// 作った時点ではキャプチャが動いているものとして扱うので、シンクが付かなければ linger_ms 後に止める。
+// start が失敗した場合は、シンクが付いている間 1 秒毎にやり直す。
+class OnDemandCapture {
+ public:
+  // start はキャプチャを始めて、成功したら true を返すこと
+  OnDemandCapture(int linger_ms,
+                  std::function<bool()> start,
+                  std::function<void()> stop);
+  ~OnDemandCapture();
+
+  // AddOrUpdateSink() と RemoveSink() から呼ぶ。同じシンクを複数回追加しても良い
+  void AddSink(const void* sink);
+  void RemoveSink(const void* sink);
+  // キャプチャを止めている間は true を返す。
+  // MediaWatchdog が止まっているキャプチャを開き直さないようにするのに使う
+  bool IsPaused() const { return paused_; }
+
+ private:
+  void Run();
+
+  const int linger_ms_;
+  std::function<bool()> start_;
+  std::function<void()> stop_;
+  std::atomic<bool> paused_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::set<const void*> sinks_;
+  bool quit_ = false;
+  std::thread thread_;
+};
+
+#endif  // ON_DEMAND_CAPTURE_H_
@@ -0,0 +1,294 @@
+#include "opus_profile.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "api/audio_codecs/audio_encoder.h"
+#include "api/audio_codecs/opus/audio_encoder_opus.h"
+#include "forwarding_audio_encoder.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+
+namespace {
+
+// 受信側から届いたパケットロス率に下限を付けてエンコーダに渡すラッパー。
+// それ以外は全てそのまま内側のエンコーダに渡す
+class PacketLossHintAudioEncoder : public ForwardingAudioEncoder {
+ public:
+  PacketLossHintAudioEncoder(std::unique_ptr<webrtc::AudioEncoder> encoder,
+                             float min_packet_loss_fraction)
+      : ForwardingAudioEncoder(std::move(encoder)),
+        min_packet_loss_fraction_(min_packet_loss_fraction) {
+    encoder_->OnReceivedUplinkPacketLossFraction(min_packet_loss_fraction_);
+  }
+
+  void OnReceivedUplinkPacketLossFraction(
+      float uplink_packet_loss_fraction) override {
+    encoder_->OnReceivedUplinkPacketLossFraction(
+        std::max(uplink_packet_loss_fraction, min_packet_loss_fraction_));
+  }
+
+ private:
+  const float min_packet_loss_fraction_;
+};
+
+class OpusProfileAudioEncoderFactory : public webrtc::AudioEncoderFactory {
+ public:
+  OpusProfileAudioEncoderFactory(
+      rtc::scoped_refptr<webrtc::AudioEncoderFactory> base,
+      OpusProfile profile)
+      : base_(std::move(base)), profile_(std::move(profile)) {}
+
+  std::vector<webrtc::AudioCodecSpec> GetSupportedEncoders() override {
+    return base_->GetSupportedEncoders();
+  }
+  absl::optional<webrtc::AudioCodecInfo> QueryAudioEncoder(
+      const webrtc::SdpAudioFormat& format) override {
+    return base_->QueryAudioEncoder(format);
+  }
+  std::unique_ptr<webrtc::AudioEncoder> MakeAudioEncoder(
+      int payload_type,
+      const webrtc::SdpAudioFormat& format,
+      absl::optional<webrtc::AudioCodecPairId> codec_pair_id) override {
+    if (!absl::EqualsIgnoreCase(format.name, "opus")) {
+      return base_->MakeAudioEncoder(payload_type, format, codec_pair_id);
+    }
+    absl::optional<webrtc::AudioEncoderOpusConfig> config =
+        webrtc::AudioEncoderOpus::SdpToConfig(format);
+    if (!config) {
+      return base_->MakeAudioEncoder(payload_type, format, codec_pair_id);
+    }
+    profile_.ApplyToConfig(&*config);
+    if (!config->IsOk()) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": invalid opus config for "
+                          << profile_.name;
+      return base_->MakeAudioEncoder(payload_type, format, codec_pair_id);
+    }
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": profile=" << profile_.name
+                     << " complexity=" << config->complexity
+                     << " frame_size_ms=" << config->frame_size_ms
+                     << " dtx=" << config->dtx_enabled
+                     << " fec=" << config->fec_enabled;
+    std::unique_ptr<webrtc::AudioEncoder> encoder =
+        webrtc::AudioEncoderOpus::MakeAudioEncoder(*config, payload_type,
+                                                   codec_pair_id);
+    if (encoder && profile_.packet_loss_percent > 0) {
+      encoder.reset(new PacketLossHintAudioEncoder(
+          std::move(encoder), profile_.packet_loss_percent / 100.0f));
+    }
+    return encoder;
+  }
+
+ private:
+  rtc::scoped_refptr<webrtc::AudioEncoderFactory> base_;
+  const OpusProfile profile_;
+};
+
+const char kCrlf[] = "\r\n";
+
+// "a=rtpmap:111 opus/48000/2" から 111 を取り出す
+bool ParseOpusPayloadType(const std::string& line, std::string* pt) {
+  const std::string prefix = "a=rtpmap:";
+  if (line.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  size_t space = line.find(' ', prefix.size());
+  if (space == std::string::npos) {
+    return false;
+  }
+  if (!absl::StartsWithIgnoreCase(line.substr(space + 1), "opus/")) {
+    return false;
+  }
+  *pt = line.substr(prefix.size(), space - prefix.size());
+  return true;
+}
+
+}  // namespace
+
+bool OpusProfile::Parse(const std::string& name, OpusProfile* profile) {
+  OpusProfile p;
+  p.name = name;
+  if (name == "low-cpu") {
+    p.complexity = 0;
+    p.frame_size_ms = 20;
+  } else if (name == "low-bandwidth") {
+    p.dtx = true;
+    p.bitrate_bps = 12000;
+    p.max_playback_rate_hz = 16000;
+  } else if (name == "loss-resilient") {
+    p.fec = true;
+    p.packet_loss_percent = 10;
+  } else if (name == "low-latency") {
+    p.frame_size_ms = 10;
+  } else if (!name.empty()) {
+    return false;
+  }
+  *profile = p;
+  return true;
+}
+
+void OpusProfile::ApplyToConfig(webrtc::AudioEncoderOpusConfig* config) const {
+  if (complexity >= 0) {
+    config->complexity = complexity;
+    config->low_rate_complexity = complexity;
+  }
+  if (frame_size_ms > 0) {
+    config->frame_size_ms = frame_size_ms;
+  }
+  if (dtx) {
+    config->dtx_enabled = true;
+  }
+  if (fec) {
+    config->fec_enabled = true;
+  }
+  if (bitrate_bps > 0) {
+    config->bitrate_bps = bitrate_bps;
+  }
+  if (max_playback_rate_hz > 0) {
+    config->max_playback_rate_hz = max_playback_rate_hz;
+  }
+}
+
+std::string OpusProfile::ApplyToSdp(const std::string& sdp) const {
+  if (empty()) {
+    return sdp;
+  }
+
+  std::vector<std::string> lines;
+  for (size_t pos = 0; pos < sdp.size();) {
+    size_t end = sdp.find('\n', pos);
+    if (end == std::string::npos) {
+      end = sdp.size();
+    }
+    std::string line = sdp.substr(pos, end - pos);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    lines.push_back(std::move(line));
+    pos = end + 1;
+  }
+
+  std::vector<std::pair<std::string, std::string>> params;
+  if (dtx) {
+    params.push_back({"usedtx", "1"});
+  }
+  if (fec) {
+    params.push_back({"useinbandfec", "1"});
+  }
+  if (bitrate_bps > 0) {
+    params.push_back({"maxaveragebitrate", std::to_string(bitrate_bps)});
+  }
+  if (max_playback_rate_hz > 0) {
+    params.push_back({"maxplaybackrate", std::to_string(max_playback_rate_hz)});
+  }
+
+  std::vector<std::string> result;
+  std::string pt;
+  // Opus の rtpmap を見つけてから、その fmtp を書き換えるか追加するまで
+  bool pending_fmtp = false;
+  bool in_audio = false;
+  auto flush_fmtp = [&]() {
+    if (pending_fmtp && !params.empty()) {
+      std::string line = "a=fmtp:" + pt + " ";
+      for (size_t i = 0; i < params.size(); i++) {
+        line += (i == 0 ? "" : ";") + params[i].first + "=" + params[i].second;
+      }
+      result.push_back(line);
+    }
+    pending_fmtp = false;
+  };
+  for (const std::string& line : lines) {
+    if (line.compare(0, 2, "m=") == 0) {
+      flush_fmtp();
+      if (in_audio && frame_size_ms > 0) {
+        result.push_back("a=ptime:" + std::to_string(frame_size_ms));
+      }
+      in_audio = line.compare(0, 8, "m=audio ") == 0;
+    } else if (in_audio && frame_size_ms > 0 &&
+               line.compare(0, 8, "a=ptime:") == 0) {
+      // 後で追加し直す
+      continue;
+    }
+
+    std::string opus_pt;
+    if (in_audio && ParseOpusPayloadType(line, &opus_pt)) {
+      flush_fmtp();
+      pt = opus_pt;
+      pending_fmtp = true;
+      result.push_back(line);
+      continue;
+    }
+
+    const std::string fmtp_prefix = "a=fmtp:" + pt + " ";
+    if (pending_fmtp && line.compare(0, fmtp_prefix.size(), fmtp_prefix) == 0) {
+      // 既存のパラメータは残し、指定したものだけ上書きする
+      std::map<std::string, size_t> index;
+      std::vector<std::pair<std::string, std::string>> merged;
+      std::string rest = line.substr(fmtp_prefix.size());
+      for (size_t pos = 0; pos <= rest.size();) {
+        size_t end = rest.find(';', pos);
+        if (end == std::string::npos) {
+          end = rest.size();
+        }
+        std::string param = rest.substr(pos, end - pos);
+        size_t eq = param.find('=');
+        if (!param.empty()) {
+          std::string key = param.substr(0, eq);
+          std::string value =
+              eq == std::string::npos ? "" : param.substr(eq + 1);
+          index[key] = merged.size();
+          merged.push_back({key, value});
+        }
+        pos = end + 1;
+      }
+      for (const auto& p : params) {
+        auto it = index.find(p.first);
+        if (it == index.end()) {
+          merged.push_back(p);
+        } else {
+          merged[it->second].second = p.second;
+        }
+      }
+      std::string fmtp = fmtp_prefix;
+      for (size_t i = 0; i < merged.size(); i++) {
+        fmtp += (i == 0 ? "" : ";") + merged[i].first;
+        if (!merged[i].second.empty()) {
+          fmtp += "=" + merged[i].second;
+        }
+      }
+      result.push_back(fmtp);
+      pending_fmtp = false;
+      continue;
+    }
+    if (pending_fmtp && line.compare(0, 9, "a=rtpmap:") == 0) {
+      flush_fmtp();
+    }
+    result.push_back(line);
+  }
+  flush_fmtp();
+  if (in_audio && frame_size_ms > 0) {
+    result.push_back("a=ptime:" + std::to_string(frame_size_ms));
+  }
+
+  std::string out;
+  for (const std::string& line : result) {
+    out += line;
+    out += kCrlf;
+  }
+  return out;
+}
+
+rtc::scoped_refptr<webrtc::AudioEncoderFactory>
+CreateOpusProfileAudioEncoderFactory(
+    rtc::scoped_refptr<webrtc::AudioEncoderFactory> base,
+    OpusProfile profile) {
+  if (profile.empty()) {
+    return base;
+  }
+  return new rtc::RefCountedObject<OpusProfileAudioEncoderFactory>(
+      std::move(base), std::move(profile));
+}
@@ -0,0 +1,52 @@
+#ifndef OPUS_PROFILE_H_
+#define OPUS_PROFILE_H_
+
+#include <string>
+
+#include "api/audio_codecs/audio_encoder_factory.h"
+#include "api/audio_codecs/opus/audio_encoder_opus_config.h"
+#include "api/scoped_refptr.h"
+
+// --audio-profile で指定する Opus の設定。
+//
+// - low-cpu: complexity 0、20 ミリ秒のフレームにしてエンコードの負荷を下げる
+// - low-bandwidth: DTX を有効にし、12kbps の wideband にする
+// - loss-resilient: インバンド FEC を有効にし、受信側からのパケットロス率が届く前から
+//                   10% のロスを想定して FEC を付ける
+// - low-latency: 10 ミリ秒のフレームにしてパケット化の遅延を減らす。
+//                RTCManager はこの場合に音声のデバイスとジッターバッファも低遅延にする
+//
+// 自分が送信する音声にはエンコーダの設定として、相手が送信する音声には
+// ローカルの SDP の fmtp として同じ設定を反映する。
+struct OpusProfile {
+  // 空文字列の場合は何も変更しない
+  std::string name;
+  // 0 未満の場合は変更しない
+  int complexity = -1;
+  // 0 の場合は変更しない
+  int frame_size_ms = 0;
+  bool dtx = false;
+  bool fec = false;
+  // 0 の場合は変更しない
+  int bitrate_bps = 0;
+  int max_playback_rate_hz = 0;
+  // 受信側から届いたパケットロス率がこれより小さい場合は、この値をエンコーダに伝える
+  int packet_loss_percent = 0;
+
+  // name が不明な場合は false を返す
+  static bool Parse(const std::string& name, OpusProfile* profile);
+
+  bool empty() const { return name.empty(); }
+
+  void ApplyToConfig(webrtc::AudioEncoderOpusConfig* config) const;
+  // SDP の Opus の fmtp と ptime を書き換える
+  std::string ApplyToSdp(const std::string& sdp) const;
+};
+
+// Opus のエンコーダを作る時だけ profile を反映し、それ以外は base に任せるファクトリを作る
+rtc::scoped_refptr<webrtc::AudioEncoderFactory>
+CreateOpusProfileAudioEncoderFactory(
+    rtc::scoped_refptr<webrtc::AudioEncoderFactory> base,
+    OpusProfile profile);
+
+#endif  // OPUS_PROFILE_H_
@@ -0,0 +1,121 @@
+#include "parallel_mjpeg_decoder.h"
+
+#include <string>
+
+#include "frame_buffer_pool.h"
+#include "rtc_base/logging.h"
+#include "third_party/libyuv/include/libyuv.h"
+#include "thread_placement.h"
+
+ParallelMJPEGDecoder::ParallelMJPEGDecoder(int num_threads,
+                                           DecodedCallback callback)
+    : callback_(std::move(callback)), max_pending_(num_threads * 2) {
+  for (int i = 0; i < num_threads; i++) {
+    std::unique_ptr<rtc::PlatformThread> thread(new rtc::PlatformThread(
+        ParallelMJPEGDecoder::WorkerThread, this,
+        "MJPEGDecoder" + std::to_string(i), rtc::kHighPriority));
+    thread->Start();
+    threads_.push_back(std::move(thread));
+  }
+}
+
+ParallelMJPEGDecoder::~ParallelMJPEGDecoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread->Stop();
+  }
+}
+
+bool ParallelMJPEGDecoder::Decode(const uint8_t* data,
+                                  size_t size,
+                                  int width,
+                                  int height,
+                                  int64_t timestamp_us) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_flight_ >= max_pending_) {
+      RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " Drop frame";
+      return false;
+    }
+    in_flight_++;
+    Task task;
+    task.sequence = next_sequence_++;
+    task.data.assign(data, data + size);
+    task.width = width;
+    task.height = height;
+    task.timestamp_us = timestamp_us;
+    tasks_.push_back(std::move(task));
+  }
+  cond_.notify_one();
+  return true;
+}
+
+void ParallelMJPEGDecoder::WorkerThread(void* obj) {
+  ThreadPlacement::Instance().Apply("capture");
+  static_cast<ParallelMJPEGDecoder*>(obj)->WorkerLoop();
+}
+
+void ParallelMJPEGDecoder::WorkerLoop() {
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return quit_ || !tasks_.empty(); });
+      if (quit_) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    Result result;
+    result.timestamp_us = task.timestamp_us;
+    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+        FrameBufferPool::Instance().CreateI420Buffer(task.width, task.height);
+    if (libyuv::ConvertToI420(
+            task.data.data(), task.data.size(), i420_buffer->MutableDataY(),
+            i420_buffer->StrideY(), i420_buffer->MutableDataU(),
+            i420_buffer->StrideU(), i420_buffer->MutableDataV(),
+            i420_buffer->StrideV(), 0, 0, task.width, task.height,
+            task.width, task.height, libyuv::kRotate0,
+            libyuv::FOURCC_MJPG) < 0) {
+      RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
+    } else {
+      result.buffer = i420_buffer;
+    }
+    Complete(task.sequence, std::move(result));
+  }
+}
+
+void ParallelMJPEGDecoder::Complete(uint64_t sequence, Result result) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  results_[sequence] = std::move(result);
+  if (delivering_) {
+    // 他のスレッドが配信中なので、そちらに任せる
+    return;
+  }
+
+  // 順番が来たものから配信する
+  delivering_ = true;
+  while (true) {
+    auto it = results_.find(next_deliver_sequence_);
+    if (it == results_.end()) {
+      break;
+    }
+    Result ready = std::move(it->second);
+    results_.erase(it);
+    next_deliver_sequence_++;
+    in_flight_--;
+
+    lock.unlock();
+    if (ready.buffer) {
+      callback_(ready.buffer, ready.timestamp_us);
+    }
+    lock.lock();
+  }
+  delivering_ = false;
+}
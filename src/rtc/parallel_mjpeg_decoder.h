@@ -0,0 +1,77 @@
+#ifndef PARALLEL_MJPEG_DECODER_H_
+#define PARALLEL_MJPEG_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "api/video/i420_buffer.h"
+#include "rtc_base/platform_thread.h"
+
+// MJPEG のデコードを複数のスレッドで並列に行うクラス。
+//
+// フレーム単位で各ワーカースレッドに割り振ってデコードし、
+// デコードが終わったフレームは Decode() を呼んだ順番に callback に渡す。
+// デコード待ちのフレームが溢れた場合は新しいフレームを捨てる。
+//
+// Decode() に渡したデータはコピーするので、呼び出し後すぐに解放して良い。
+class ParallelMJPEGDecoder {
+ public:
+  typedef std::function<void(rtc::scoped_refptr<webrtc::I420BufferInterface>,
+                             int64_t timestamp_us)>
+      DecodedCallback;
+
+  ParallelMJPEGDecoder(int num_threads, DecodedCallback callback);
+  ~ParallelMJPEGDecoder();
+
+  // フレームを捨てた場合は false を返す
+  bool Decode(const uint8_t* data,
+              size_t size,
+              int width,
+              int height,
+              int64_t timestamp_us);
+
+ private:
+  struct Task {
+    uint64_t sequence;
+    std::vector<uint8_t> data;
+    int width;
+    int height;
+    int64_t timestamp_us;
+  };
+  struct Result {
+    // デコードに失敗した場合は nullptr
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer;
+    int64_t timestamp_us;
+  };
+
+  static void WorkerThread(void* obj);
+  void WorkerLoop();
+  void Complete(uint64_t sequence, Result result);
+
+  const DecodedCallback callback_;
+  const size_t max_pending_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool quit_ = false;
+  std::deque<Task> tasks_;
+  // デコードが終わったが、前のフレームがまだ終わっていないので待っているもの
+  std::map<uint64_t, Result> results_;
+  uint64_t next_sequence_ = 0;
+  uint64_t next_deliver_sequence_ = 0;
+  size_t in_flight_ = 0;
+  bool delivering_ = false;
+
+  std::vector<std::unique_ptr<rtc::PlatformThread>> threads_;
+};
+
+#endif  // PARALLEL_MJPEG_DECODER_H_
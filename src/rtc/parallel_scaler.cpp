@@ -0,0 +1,272 @@
+#include "parallel_scaler.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "rtc_base/logging.h"
+#include "third_party/libyuv/include/libyuv.h"
+#include "thread_placement.h"
+
+namespace {
+
+// これより小さいフレームは分けずに縮小する
+const int kMinParallelPixels = 1280 * 720;
+// 帯をこれより低くしない
+const int kMinBandRows = 16;
+// 0 を指定した時のスレッド数の上限
+const int kMaxAutoThreads = 4;
+
+int Gcd(int a, int b) {
+  while (b != 0) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+struct Band {
+  int src_y;
+  int src_rows;
+  int dst_y;
+  int dst_rows;
+};
+
+// 高さ src_height のプレーンを dst_height に縮小する時の、num_bands 個に分けた index 番目の帯
+Band GetBand(int src_height, int dst_height, int index, int num_bands) {
+  // 縮小後の step 行毎に、縮小前の行が整数になる
+  const int step = dst_height / Gcd(src_height, dst_height);
+  auto dst_row = [&](int i) {
+    if (i == num_bands) {
+      return dst_height;
+    }
+    int y = static_cast<int>(static_cast<int64_t>(dst_height) * i / num_bands);
+    if (step <= dst_height / num_bands / 2) {
+      y = y / step * step;
+    }
+    return y;
+  };
+  auto src_row = [&](int y) {
+    return static_cast<int>(
+        (static_cast<int64_t>(y) * src_height + dst_height / 2) / dst_height);
+  };
+  Band band;
+  band.dst_y = dst_row(index);
+  band.dst_rows = dst_row(index + 1) - band.dst_y;
+  band.src_y = src_row(band.dst_y);
+  band.src_rows = src_row(band.dst_y + band.dst_rows) - band.src_y;
+  return band;
+}
+
+void ScalePlaneBand(const uint8_t* src,
+                    int src_stride,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst,
+                    int dst_stride,
+                    int dst_width,
+                    int dst_height,
+                    libyuv::FilterMode filtering,
+                    int index,
+                    int num_bands) {
+  Band band = GetBand(src_height, dst_height, index, num_bands);
+  libyuv::ScalePlane(src + band.src_y * src_stride, src_stride, src_width,
+                     band.src_rows, dst + band.dst_y * dst_stride, dst_stride,
+                     dst_width, band.dst_rows, filtering);
+}
+
+}  // namespace
+
+ParallelScaler& ParallelScaler::Instance() {
+  static ParallelScaler instance;
+  return instance;
+}
+
+ParallelScaler::~ParallelScaler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread->Stop();
+  }
+}
+
+void ParallelScaler::SetNumThreads(int num_threads) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!threads_.empty()) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Already started";
+    return;
+  }
+  num_threads_ = num_threads;
+}
+
+int ParallelScaler::I420Scale(const uint8_t* src_y,
+                              int src_stride_y,
+                              const uint8_t* src_u,
+                              int src_stride_u,
+                              const uint8_t* src_v,
+                              int src_stride_v,
+                              int src_width,
+                              int src_height,
+                              uint8_t* dst_y,
+                              int dst_stride_y,
+                              uint8_t* dst_u,
+                              int dst_stride_u,
+                              uint8_t* dst_v,
+                              int dst_stride_v,
+                              int dst_width,
+                              int dst_height,
+                              libyuv::FilterMode filtering) {
+  const int src_chroma_width = (src_width + 1) / 2;
+  const int src_chroma_height = (src_height + 1) / 2;
+  const int dst_chroma_width = (dst_width + 1) / 2;
+  const int dst_chroma_height = (dst_height + 1) / 2;
+  const int num_bands = NumBands(src_width, src_height, dst_chroma_height);
+  if (num_bands <= 1 || src_y == nullptr || src_u == nullptr ||
+      src_v == nullptr || dst_y == nullptr || dst_u == nullptr ||
+      dst_v == nullptr || src_width <= 0 || src_height <= 0 ||
+      dst_width <= 0 || dst_height <= 0) {
+    return libyuv::I420Scale(src_y, src_stride_y, src_u, src_stride_u, src_v,
+                             src_stride_v, src_width, src_height, dst_y,
+                             dst_stride_y, dst_u, dst_stride_u, dst_v,
+                             dst_stride_v, dst_width, dst_height, filtering);
+  }
+  Run(num_bands, [&](int index, int num_bands) {
+    ScalePlaneBand(src_y, src_stride_y, src_width, src_height, dst_y,
+                   dst_stride_y, dst_width, dst_height, filtering, index,
+                   num_bands);
+    ScalePlaneBand(src_u, src_stride_u, src_chroma_width, src_chroma_height,
+                   dst_u, dst_stride_u, dst_chroma_width, dst_chroma_height,
+                   filtering, index, num_bands);
+    ScalePlaneBand(src_v, src_stride_v, src_chroma_width, src_chroma_height,
+                   dst_v, dst_stride_v, dst_chroma_width, dst_chroma_height,
+                   filtering, index, num_bands);
+  });
+  return 0;
+}
+
+int ParallelScaler::NV12Scale(const uint8_t* src_y,
+                              int src_stride_y,
+                              const uint8_t* src_uv,
+                              int src_stride_uv,
+                              int src_width,
+                              int src_height,
+                              uint8_t* dst_y,
+                              int dst_stride_y,
+                              uint8_t* dst_uv,
+                              int dst_stride_uv,
+                              int dst_width,
+                              int dst_height,
+                              libyuv::FilterMode filtering) {
+  const int src_chroma_width = (src_width + 1) / 2;
+  const int src_chroma_height = (src_height + 1) / 2;
+  const int dst_chroma_width = (dst_width + 1) / 2;
+  const int dst_chroma_height = (dst_height + 1) / 2;
+  const int num_bands = NumBands(src_width, src_height, dst_chroma_height);
+  if (num_bands <= 1 || src_y == nullptr || src_uv == nullptr ||
+      dst_y == nullptr || dst_uv == nullptr || src_width <= 0 ||
+      src_height <= 0 || dst_width <= 0 || dst_height <= 0) {
+    return libyuv::NV12Scale(src_y, src_stride_y, src_uv, src_stride_uv,
+                             src_width, src_height, dst_y, dst_stride_y,
+                             dst_uv, dst_stride_uv, dst_width, dst_height,
+                             filtering);
+  }
+  Run(num_bands, [&](int index, int num_bands) {
+    ScalePlaneBand(src_y, src_stride_y, src_width, src_height, dst_y,
+                   dst_stride_y, dst_width, dst_height, filtering, index,
+                   num_bands);
+    Band band =
+        GetBand(src_chroma_height, dst_chroma_height, index, num_bands);
+    libyuv::UVScale(src_uv + band.src_y * src_stride_uv, src_stride_uv,
+                    src_chroma_width, band.src_rows,
+                    dst_uv + band.dst_y * dst_stride_uv, dst_stride_uv,
+                    dst_chroma_width, band.dst_rows, filtering);
+  });
+  return 0;
+}
+
+void ParallelScaler::ScaleFrom(const webrtc::I420BufferInterface& src,
+                               webrtc::I420Buffer* dst) {
+  I420Scale(src.DataY(), src.StrideY(), src.DataU(), src.StrideU(),
+            src.DataV(), src.StrideV(), src.width(), src.height(),
+            dst->MutableDataY(), dst->StrideY(), dst->MutableDataU(),
+            dst->StrideU(), dst->MutableDataV(), dst->StrideV(), dst->width(),
+            dst->height(), libyuv::kFilterBox);
+}
+
+int ParallelScaler::NumBands(int src_width, int src_height, int dst_height) {
+  if (src_width * src_height < kMinParallelPixels) {
+    return 1;
+  }
+  int num_threads;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_threads = num_threads_;
+  }
+  if (num_threads <= 0) {
+    num_threads = std::min<int>(std::thread::hardware_concurrency(),
+                                kMaxAutoThreads);
+  }
+  // 色差のプレーンの帯も低くなりすぎないようにする
+  return std::max(1, std::min(num_threads, dst_height / kMinBandRows));
+}
+
+void ParallelScaler::Run(int num_bands,
+                         std::function<void(int band, int num_bands)> run) {
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->run = std::move(run);
+  job->num_bands = num_bands;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // 呼び出したスレッドも処理するので、ワーカーは 1 つ少なくて良い
+  while (static_cast<int>(threads_.size()) < num_bands - 1) {
+    std::unique_ptr<rtc::PlatformThread> thread(new rtc::PlatformThread(
+        ParallelScaler::WorkerThread, this,
+        "Scaler" + std::to_string(threads_.size()), rtc::kHighPriority));
+    thread->Start();
+    threads_.push_back(std::move(thread));
+  }
+  jobs_.push_back(job);
+  cond_.notify_all();
+
+  while (job->next_band < job->num_bands) {
+    RunBandLocked(job, lock);
+  }
+  done_cond_.wait(lock,
+                  [&job]() { return job->done_bands == job->num_bands; });
+}
+
+void ParallelScaler::RunBandLocked(const std::shared_ptr<Job>& job,
+                                   std::unique_lock<std::mutex>& lock) {
+  const int band = job->next_band++;
+  if (job->next_band == job->num_bands) {
+    jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+  }
+  lock.unlock();
+  job->run(band, job->num_bands);
+  lock.lock();
+  if (++job->done_bands == job->num_bands) {
+    done_cond_.notify_all();
+  }
+}
+
+void ParallelScaler::WorkerThread(void* obj) {
+  ThreadPlacement::Instance().Apply("scaler");
+  static_cast<ParallelScaler*>(obj)->WorkerLoop();
+}
+
+void ParallelScaler::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [this]() { return quit_ || !jobs_.empty(); });
+    if (quit_) {
+      return;
+    }
+    // front() は RunBandLocked の中で取り除かれることがあるので、参照を持っておく
+    std::shared_ptr<Job> job = jobs_.front();
+    RunBandLocked(job, lock);
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef PARALLEL_SCALER_H_
+#define PARALLEL_SCALER_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "api/video/i420_buffer.h"
+#include "rtc_base/platform_thread.h"
+#include "third_party/libyuv/include/libyuv/scale.h"
+
+// 大きなフレームの縮小を、各プレーンを横方向の帯に分けて複数のスレッドで行う。
+//
+// 帯毎の縮小は libyuv で行うので、NEON や AVX2 の行単位の処理はそのまま使われる。
+// 帯の境界は、できるだけ縮小前の行が整数になる位置にするので、1 回で縮小した場合と同じ結果になる。
+// 元のフレームが小さい場合や、スレッド数が 1 の場合は呼び出したスレッドで 1 回で縮小する。
+//
+// 呼び出したスレッドも帯を処理するので、ワーカースレッドが他の縮小で埋まっていても待たされ続けることはない。
+// 任意のスレッドから同時に呼び出して良い。
+class ParallelScaler {
+ public:
+  static ParallelScaler& Instance();
+
+  // 呼び出したスレッドも含めたスレッド数。0 の場合は CPU の数から決める。
+  // ワーカースレッドは最初に縮小する時に作るので、それより前に呼ぶこと
+  void SetNumThreads(int num_threads);
+
+  // libyuv::I420Scale と同じ
+  int I420Scale(const uint8_t* src_y,
+                int src_stride_y,
+                const uint8_t* src_u,
+                int src_stride_u,
+                const uint8_t* src_v,
+                int src_stride_v,
+                int src_width,
+                int src_height,
+                uint8_t* dst_y,
+                int dst_stride_y,
+                uint8_t* dst_u,
+                int dst_stride_u,
+                uint8_t* dst_v,
+                int dst_stride_v,
+                int dst_width,
+                int dst_height,
+                libyuv::FilterMode filtering);
+  // libyuv::NV12Scale と同じ
+  int NV12Scale(const uint8_t* src_y,
+                int src_stride_y,
+                const uint8_t* src_uv,
+                int src_stride_uv,
+                int src_width,
+                int src_height,
+                uint8_t* dst_y,
+                int dst_stride_y,
+                uint8_t* dst_uv,
+                int dst_stride_uv,
+                int dst_width,
+                int dst_height,
+                libyuv::FilterMode filtering);
+  // webrtc::I420Buffer::ScaleFrom と同じ
+  void ScaleFrom(const webrtc::I420BufferInterface& src,
+                 webrtc::I420Buffer* dst);
+
+ private:
+  ParallelScaler() = default;
+  ~ParallelScaler();
+
+  struct Job {
+    std::function<void(int band, int num_bands)> run;
+    int num_bands = 0;
+    int next_band = 0;
+    int done_bands = 0;
+  };
+
+  // src_width x src_height のフレームを分ける帯の数
+  int NumBands(int src_width, int src_height, int dst_height);
+  // run を num_bands 回、帯の番号を変えて並列に呼び、全て終わるまで待つ
+  void Run(int num_bands, std::function<void(int band, int num_bands)> run);
+  // job の次の帯を処理する。lock は処理中だけ外す
+  void RunBandLocked(const std::shared_ptr<Job>& job,
+                     std::unique_lock<std::mutex>& lock);
+
+  static void WorkerThread(void* obj);
+  void WorkerLoop();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  int num_threads_ = 0;
+  bool quit_ = false;
+  // 帯が残っているジョブ
+  std::deque<std::shared_ptr<Job>> jobs_;
+  std::vector<std::unique_ptr<rtc::PlatformThread>> threads_;
+};
+
+#endif  // PARALLEL_SCALER_H_
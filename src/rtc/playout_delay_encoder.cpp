@@ -0,0 +1,103 @@
+#include "playout_delay_encoder.h"
+
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+
+namespace {
+
+class PlayoutDelayVideoEncoder : public webrtc::VideoEncoder,
+                                 public webrtc::EncodedImageCallback {
+ public:
+  PlayoutDelayVideoEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder,
+                           int min_ms,
+                           int max_ms)
+      : encoder_(std::move(encoder)), min_ms_(min_ms), max_ms_(max_ms) {}
+
+  void SetFecControllerOverride(
+      webrtc::FecControllerOverride* fec_controller_override) override {
+    encoder_->SetFecControllerOverride(fec_controller_override);
+  }
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const webrtc::VideoEncoder::Settings& settings) override {
+    return encoder_->InitEncode(codec_settings, settings);
+  }
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    return encoder_->RegisterEncodeCompleteCallback(this);
+  }
+  int32_t Release() override { return encoder_->Release(); }
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    return encoder_->Encode(frame, frame_types);
+  }
+  void SetRates(const RateControlParameters& parameters) override {
+    encoder_->SetRates(parameters);
+  }
+  void OnPacketLossRateUpdate(float packet_loss_rate) override {
+    encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+  }
+  void OnRttUpdate(int64_t rtt_ms) override { encoder_->OnRttUpdate(rtt_ms); }
+  void OnLossNotification(const LossNotification& loss_notification) override {
+    encoder_->OnLossNotification(loss_notification);
+  }
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override {
+    return encoder_->GetEncoderInfo();
+  }
+
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override {
+    // EncodedImage のコピーはバッファの参照を増やすだけなので軽い
+    webrtc::EncodedImage image(encoded_image);
+    image.playout_delay_.min_ms = min_ms_;
+    image.playout_delay_.max_ms = max_ms_;
+    return callback_->OnEncodedImage(image, codec_specific_info,
+                                     fragmentation);
+  }
+  void OnDroppedFrame(DropReason reason) override {
+    callback_->OnDroppedFrame(reason);
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  const int min_ms_;
+  const int max_ms_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+};
+
+}  // namespace
+
+PlayoutDelayVideoEncoderFactory::PlayoutDelayVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+    int min_ms,
+    int max_ms)
+    : factory_(std::move(factory)), min_ms_(min_ms), max_ms_(max_ms) {}
+
+std::vector<webrtc::SdpVideoFormat>
+PlayoutDelayVideoEncoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+PlayoutDelayVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return factory_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+PlayoutDelayVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory_->CreateVideoEncoder(format);
+  if (!encoder) {
+    return encoder;
+  }
+  return std::unique_ptr<webrtc::VideoEncoder>(
+      absl::make_unique<PlayoutDelayVideoEncoder>(std::move(encoder), min_ms_,
+                                                  max_ms_));
+}
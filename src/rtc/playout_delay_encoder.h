@@ -0,0 +1,37 @@
+#ifndef PLAYOUT_DELAY_ENCODER_H_
+#define PLAYOUT_DELAY_ENCODER_H_
+
+#include <memory>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+
+// factory が作るエンコーダの出力に、playout-delay の RTP ヘッダ拡張で送る遅延を設定するファクトリ。
+//
+// 受信側は min_ms と max_ms の範囲でジッターバッファの遅延を決める。
+// 両方 0 にすると、受信側はフレームが揃ったらすぐにデコードして描画する。
+// 受信側がヘッダ拡張に対応していない場合は無視される。
+class PlayoutDelayVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  PlayoutDelayVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+      int min_ms,
+      int max_ms);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  const int min_ms_;
+  const int max_ms_;
+};
+
+#endif  // PLAYOUT_DELAY_ENCODER_H_
@@ -0,0 +1,349 @@
+#include "realtime_av1_encoder.h"
+
+#include <algorithm>
+
+#include "api/video/i420_buffer.h"
+#include "frame_tracer.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "simulcast_frame_buffer.h"
+#include "third_party/libaom/source/libaom/aom/aomcx.h"
+
+namespace {
+
+// g_usage のリアルタイムモード
+const unsigned int kUsageRealtime = 1;
+const int kRtpTicksPerSecond = 90000;
+const unsigned int kQpMin = 10;
+// QualityScaler に使う qindex (0-255) の閾値
+const int kLowQindexThreshold = 145;
+const int kHighQindexThreshold = 205;
+
+bool CheckStatus(aom_codec_err_t ret, const char* name) {
+  if (ret != AOM_CODEC_OK) {
+    RTC_LOG(LS_ERROR) << name << " failed: " << aom_codec_err_to_string(ret);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+RealtimeAV1Encoder::RealtimeAV1Encoder() : metrics_("libaom (realtime)") {}
+
+RealtimeAV1Encoder::~RealtimeAV1Encoder() {
+  Release();
+}
+
+int32_t RealtimeAV1Encoder::InitEncode(
+    const webrtc::VideoCodec* codec_settings,
+    const webrtc::VideoEncoder::Settings& settings) {
+  RTC_DCHECK(codec_settings);
+  RTC_DCHECK_EQ(codec_settings->codecType, webrtc::kVideoCodecAV1);
+
+  if (codec_settings->numberOfSimulcastStreams > 1) {
+    return WEBRTC_VIDEO_CODEC_ERR_SIMULCAST_PARAMETERS_NOT_SUPPORTED;
+  }
+
+  int32_t release_ret = Release();
+  if (release_ret != WEBRTC_VIDEO_CODEC_OK) {
+    return release_ret;
+  }
+
+  codec_ = *codec_settings;
+  number_of_cores_ = settings.number_of_cores;
+  preset_ = SoftwareEncoderPreset::Select(
+      webrtc::kVideoCodecAV1, codec_.width, codec_.height, number_of_cores_,
+      codec_.mode == webrtc::VideoCodecMode::kScreensharing, load_.level());
+
+  if (!CheckStatus(aom_codec_enc_config_default(aom_codec_av1_cx(), &cfg_,
+                                                kUsageRealtime),
+                   "aom_codec_enc_config_default")) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  cfg_.g_usage = kUsageRealtime;
+  cfg_.g_w = codec_.width;
+  cfg_.g_h = codec_.height;
+  cfg_.g_threads = preset_.threads;
+  cfg_.g_timebase.num = 1;
+  cfg_.g_timebase.den = kRtpTicksPerSecond;
+  cfg_.g_input_bit_depth = 8;
+  cfg_.g_error_resilient = 0;
+  // 先読みすると、その分だけ遅延が増える
+  cfg_.g_lag_in_frames = 0;
+  cfg_.g_pass = AOM_RC_ONE_PASS;
+  cfg_.rc_end_usage = AOM_CBR;
+  cfg_.rc_target_bitrate = codec_.startBitrate;
+  cfg_.rc_min_quantizer = kQpMin;
+  cfg_.rc_max_quantizer = codec_.qpMax;
+  cfg_.rc_dropframe_thresh = 0;
+  cfg_.rc_undershoot_pct = 50;
+  cfg_.rc_overshoot_pct = 50;
+  cfg_.rc_buf_initial_sz = 600;
+  cfg_.rc_buf_optimal_sz = 600;
+  cfg_.rc_buf_sz = 1000;
+  // キーフレームは最初のフレームと要求された時だけにする
+  cfg_.kf_mode = AOM_KF_DISABLED;
+
+  // planes は Encode() で入力のバッファを指すように書き換える
+  frame_for_encode_ = aom_img_wrap(nullptr, AOM_IMG_FMT_I420, cfg_.g_w,
+                                   cfg_.g_h, 1, nullptr);
+
+  if (!CheckStatus(aom_codec_enc_init(&ctx_, aom_codec_av1_cx(), &cfg_, 0),
+                   "aom_codec_enc_init")) {
+    Release();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  inited_ = true;
+  if (!ApplyPreset(true)) {
+    Release();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  RTC_LOG(LS_INFO) << "InitEncode " << codec_.width << "x" << codec_.height
+                   << " " << codec_.startBitrate << "kbit/sec"
+                   << " speed:" << preset_.speed
+                   << " threads:" << preset_.threads
+                   << " tile_columns_log2:" << preset_.tile_columns_log2
+                   << " row_mt:" << preset_.row_mt
+                   << " screen_content:" << preset_.screen_content;
+
+  framerate_fps_ = codec_.maxFramerate > 0 ? codec_.maxFramerate : 30;
+  pts_ = 0;
+  key_frame_pending_ = true;
+  metrics_.SetTargetBitrate(codec_.startBitrate * 1000);
+
+  encoded_image_._completeFrame = true;
+  encoded_image_._encodedWidth = 0;
+  encoded_image_._encodedHeight = 0;
+  encoded_image_.set_size(0);
+  encoded_image_.timing_.flags =
+      webrtc::VideoSendTiming::TimingFrameFlags::kInvalid;
+  encoded_image_.content_type_ =
+      (codec_.mode == webrtc::VideoCodecMode::kScreensharing)
+          ? webrtc::VideoContentType::SCREENSHARE
+          : webrtc::VideoContentType::UNSPECIFIED;
+
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+bool RealtimeAV1Encoder::ApplyPreset(bool init) {
+  if (!CheckStatus(aom_codec_control(&ctx_, AOME_SET_CPUUSED, preset_.speed),
+                   "AOME_SET_CPUUSED")) {
+    return false;
+  }
+  if (!init) {
+    return true;
+  }
+  return CheckStatus(
+             aom_codec_control(&ctx_, AV1E_SET_ROW_MT, preset_.row_mt ? 1 : 0),
+             "AV1E_SET_ROW_MT") &&
+         CheckStatus(aom_codec_control(&ctx_, AV1E_SET_TILE_COLUMNS,
+                                       preset_.tile_columns_log2),
+                     "AV1E_SET_TILE_COLUMNS") &&
+         CheckStatus(aom_codec_control(&ctx_, AV1E_SET_TUNE_CONTENT,
+                                       preset_.screen_content
+                                           ? AOM_CONTENT_SCREEN
+                                           : AOM_CONTENT_DEFAULT),
+                     "AV1E_SET_TUNE_CONTENT") &&
+         // cyclic refresh
+         CheckStatus(aom_codec_control(&ctx_, AV1E_SET_AQ_MODE, 3),
+                     "AV1E_SET_AQ_MODE") &&
+         CheckStatus(aom_codec_control(&ctx_, AV1E_SET_ENABLE_CDEF, 1),
+                     "AV1E_SET_ENABLE_CDEF") &&
+         // 先読みしないので、先読みを前提にしたツールは切っておく
+         CheckStatus(aom_codec_control(&ctx_, AV1E_SET_ENABLE_TPL_MODEL, 0),
+                     "AV1E_SET_ENABLE_TPL_MODEL") &&
+         CheckStatus(aom_codec_control(&ctx_, AV1E_SET_DELTAQ_MODE, 0),
+                     "AV1E_SET_DELTAQ_MODE") &&
+         CheckStatus(aom_codec_control(&ctx_, AV1E_SET_ENABLE_ORDER_HINT, 0),
+                     "AV1E_SET_ENABLE_ORDER_HINT") &&
+         CheckStatus(
+             aom_codec_control(&ctx_, AOME_SET_MAX_INTRA_BITRATE_PCT, 300),
+             "AOME_SET_MAX_INTRA_BITRATE_PCT");
+}
+
+int32_t RealtimeAV1Encoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RealtimeAV1Encoder::Release() {
+  if (frame_for_encode_ != nullptr) {
+    aom_img_free(frame_for_encode_);
+    frame_for_encode_ = nullptr;
+  }
+  if (inited_) {
+    inited_ = false;
+    if (!CheckStatus(aom_codec_destroy(&ctx_), "aom_codec_destroy")) {
+      return WEBRTC_VIDEO_CODEC_MEMORY;
+    }
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RealtimeAV1Encoder::Encode(
+    const webrtc::VideoFrame& frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  if (!inited_) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+  if (!callback_) {
+    RTC_LOG(LS_WARNING)
+        << "InitEncode() has been called, but a callback function "
+        << "has not been set with RegisterEncodeCompleteCallback()";
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+
+  bool key_frame_requested = false;
+  if (frame_types != nullptr) {
+    RTC_DCHECK_EQ(frame_types->size(), static_cast<size_t>(1));
+    if ((*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+      metrics_.OnSkipped();
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    key_frame_requested =
+        (*frame_types)[0] == webrtc::VideoFrameType::kVideoFrameKey;
+  }
+
+  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+      SimulcastFrameBuffer::SelectLayer(frame.video_frame_buffer(), cfg_.g_w,
+                                        cfg_.g_h)
+          ->ToI420();
+  if (!buffer) {
+    RTC_LOG(LS_ERROR) << "Failed to convert the frame to I420";
+    metrics_.OnDropped();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  if (buffer->width() != static_cast<int>(cfg_.g_w) ||
+      buffer->height() != static_cast<int>(cfg_.g_h)) {
+    rtc::scoped_refptr<webrtc::I420Buffer> scaled =
+        webrtc::I420Buffer::Create(cfg_.g_w, cfg_.g_h);
+    scaled->ScaleFrom(*buffer);
+    buffer = scaled;
+  }
+  frame_for_encode_->planes[AOM_PLANE_Y] =
+      const_cast<uint8_t*>(buffer->DataY());
+  frame_for_encode_->planes[AOM_PLANE_U] =
+      const_cast<uint8_t*>(buffer->DataU());
+  frame_for_encode_->planes[AOM_PLANE_V] =
+      const_cast<uint8_t*>(buffer->DataV());
+  frame_for_encode_->stride[AOM_PLANE_Y] = buffer->StrideY();
+  frame_for_encode_->stride[AOM_PLANE_U] = buffer->StrideU();
+  frame_for_encode_->stride[AOM_PLANE_V] = buffer->StrideV();
+
+  const bool key_frame = key_frame_pending_ || key_frame_requested;
+  const uint32_t duration = static_cast<uint32_t>(
+      kRtpTicksPerSecond / std::max(framerate_fps_, 1.0));
+
+  const int64_t start_us = rtc::TimeMicros();
+  metrics_.OnSubmit(frame.timestamp());
+  aom_codec_err_t ret =
+      aom_codec_encode(&ctx_, frame_for_encode_, pts_, duration,
+                       key_frame ? AOM_EFLAG_FORCE_KF : 0);
+  pts_ += duration;
+  if (!CheckStatus(ret, "aom_codec_encode")) {
+    metrics_.OnDropped();
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+
+  encoded_.clear();
+  bool is_key_frame = false;
+  aom_codec_iter_t iter = nullptr;
+  const aom_codec_cx_pkt_t* pkt;
+  while ((pkt = aom_codec_get_cx_data(&ctx_, &iter)) != nullptr) {
+    if (pkt->kind != AOM_CODEC_CX_FRAME_PKT) {
+      continue;
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(pkt->data.frame.buf);
+    encoded_.insert(encoded_.end(), data, data + pkt->data.frame.sz);
+    if (pkt->data.frame.flags & AOM_FRAME_IS_KEY) {
+      is_key_frame = true;
+    }
+  }
+
+  const int64_t elapsed_us = rtc::TimeMicros() - start_us;
+  metrics_.OnStage("encode", elapsed_us);
+  if (load_.OnEncoded(elapsed_us, framerate_fps_, rtc::TimeMillis())) {
+    // スレッド数とタイルは作り直さないと変えられないので、cpu-used だけをその場で変える
+    preset_.speed =
+        SoftwareEncoderPreset::Select(
+            webrtc::kVideoCodecAV1, codec_.width, codec_.height,
+            number_of_cores_, preset_.screen_content, load_.level())
+            .speed;
+    RTC_LOG(LS_INFO) << "Change AV1 speed to " << preset_.speed;
+    ApplyPreset(false);
+  }
+
+  if (encoded_.empty()) {
+    metrics_.OnDropped();
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  if (is_key_frame) {
+    key_frame_pending_ = false;
+  }
+  return SendFrame(frame, is_key_frame);
+}
+
+int32_t RealtimeAV1Encoder::SendFrame(const webrtc::VideoFrame& frame,
+                                      bool key_frame) {
+  encoded_image_.set_buffer(encoded_.data(), encoded_.size());
+  encoded_image_.set_size(encoded_.size());
+  encoded_image_._encodedWidth = cfg_.g_w;
+  encoded_image_._encodedHeight = cfg_.g_h;
+  encoded_image_.capture_time_ms_ = frame.render_time_ms();
+  encoded_image_.ntp_time_ms_ = frame.ntp_time_ms();
+  encoded_image_.SetTimestamp(frame.timestamp());
+  encoded_image_.rotation_ = frame.rotation();
+  encoded_image_.SetColorSpace(frame.color_space());
+  encoded_image_._frameType = key_frame
+                                  ? webrtc::VideoFrameType::kVideoFrameKey
+                                  : webrtc::VideoFrameType::kVideoFrameDelta;
+  int qindex = -1;
+  if (aom_codec_control(&ctx_, AOME_GET_LAST_QUANTIZER, &qindex) ==
+      AOM_CODEC_OK) {
+    encoded_image_.qp_ = qindex;
+  }
+
+  webrtc::CodecSpecificInfo codec_specific;
+  codec_specific.codecType = webrtc::kVideoCodecAV1;
+
+  TraceScope trace("send", encoded_image_.Timestamp());
+  webrtc::EncodedImageCallback::Result result =
+      callback_->OnEncodedImage(encoded_image_, &codec_specific, nullptr);
+  if (result.error != webrtc::EncodedImageCallback::Result::OK) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__
+                      << " OnEncodedImage failed error:" << result.error;
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  metrics_.OnEncoded(encoded_image_.Timestamp(), encoded_.size(), key_frame);
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void RealtimeAV1Encoder::SetRates(const RateControlParameters& parameters) {
+  if (!inited_) {
+    RTC_LOG(LS_WARNING) << "SetRates() while the encoder is not initialized";
+    return;
+  }
+  if (parameters.bitrate.get_sum_bps() <= 0 || parameters.framerate_fps <= 0)
+    return;
+
+  cfg_.rc_target_bitrate = parameters.bitrate.get_sum_kbps();
+  CheckStatus(aom_codec_enc_config_set(&ctx_, &cfg_),
+              "aom_codec_enc_config_set");
+  framerate_fps_ = parameters.framerate_fps;
+  metrics_.SetTargetBitrate(parameters.bitrate.get_sum_bps());
+}
+
+webrtc::VideoEncoder::EncoderInfo RealtimeAV1Encoder::GetEncoderInfo() const {
+  EncoderInfo info;
+  info.supports_native_handle = false;
+  info.implementation_name = "libaom (realtime)";
+  info.scaling_settings =
+      VideoEncoder::ScalingSettings(kLowQindexThreshold, kHighQindexThreshold);
+  info.is_hardware_accelerated = false;
+  info.has_internal_source = false;
+  return info;
+}
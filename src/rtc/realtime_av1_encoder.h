@@ -0,0 +1,65 @@
+#ifndef REALTIME_AV1_ENCODER_H_
+#define REALTIME_AV1_ENCODER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "api/video/encoded_image.h"
+#include "api/video_codecs/video_encoder.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "third_party/libaom/source/libaom/aom/aom_codec.h"
+#include "third_party/libaom/source/libaom/aom/aom_encoder.h"
+#include "encoder_metrics.h"
+#include "software_encoder_preset.h"
+
+// libaom をリアルタイム向けの設定で動かす AV1 エンコーダ。
+//
+// WebRTC の CreateLibaomAv1Encoder() は cpu-used やタイルを変えられず、
+// x86 でも 720p30 に追いつかないので、libaom を直接使う。
+// cpu-used、スレッド数、タイルの列の数、row-mt、画面共有用のツールは
+// 解像度とコア数から SoftwareEncoderPreset で決める。
+// エンコードが追いつかなくなったら SoftwareEncoderLoad の段階に合わせて cpu-used をその場で上げる。
+// 1 フレームのエンコードにかかった時間は EncoderMetrics に "encode" として記録する。
+class RealtimeAV1Encoder : public webrtc::VideoEncoder {
+ public:
+  RealtimeAV1Encoder();
+  ~RealtimeAV1Encoder() override;
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const webrtc::VideoEncoder::Settings& settings) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+ private:
+  // preset_ の内容を libaom に設定する。init が true の場合は生成直後にだけ設定できる項目も設定する
+  bool ApplyPreset(bool init);
+  int32_t SendFrame(const webrtc::VideoFrame& frame, bool key_frame);
+
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  bool inited_ = false;
+  aom_codec_ctx_t ctx_;
+  aom_codec_enc_cfg_t cfg_;
+  // 入力の I420 のバッファを指すだけで、中身は持たない
+  aom_image_t* frame_for_encode_ = nullptr;
+  webrtc::VideoCodec codec_;
+  int number_of_cores_ = 1;
+  SoftwareEncoderPreset preset_;
+  SoftwareEncoderLoad load_;
+  double framerate_fps_ = 30;
+  int64_t pts_ = 0;
+  // 次のフレームをキーフレームにする
+  bool key_frame_pending_ = true;
+  std::vector<uint8_t> encoded_;
+
+  EncoderMetrics metrics_;
+  webrtc::EncodedImage encoded_image_;
+};
+
+#endif  // REALTIME_AV1_ENCODER_H_
@@ -0,0 +1,219 @@
+#include "recording_encoder.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "forwarding_audio_encoder.h"
+#include "media/base/media_constants.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+class RecordingVideoEncoder : public webrtc::VideoEncoder,
+                              public webrtc::EncodedImageCallback {
+ public:
+  RecordingVideoEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder,
+                        std::shared_ptr<EncodedVideoSink> sink)
+      : encoder_(std::move(encoder)), sink_(std::move(sink)) {}
+  ~RecordingVideoEncoder() override { sink_->DetachVideo(this); }
+
+  void SetFecControllerOverride(
+      webrtc::FecControllerOverride* fec_controller_override) override {
+    encoder_->SetFecControllerOverride(fec_controller_override);
+  }
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const webrtc::VideoEncoder::Settings& settings) override {
+    // サイマルキャストのレイヤーは解像度の低い順に並んでいる
+    top_layer_ = std::max<int>(codec_settings->numberOfSimulcastStreams, 1) - 1;
+    attached_ = sink_->AttachVideo(this);
+    return encoder_->InitEncode(codec_settings, settings);
+  }
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    return encoder_->RegisterEncodeCompleteCallback(this);
+  }
+  int32_t Release() override {
+    sink_->DetachVideo(this);
+    attached_ = false;
+    return encoder_->Release();
+  }
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    if (!attached_ || !sink_->NeedsKeyFrame(this)) {
+      return encoder_->Encode(frame, frame_types);
+    }
+    std::vector<webrtc::VideoFrameType> types;
+    if (frame_types != nullptr) {
+      types = *frame_types;
+    }
+    types.resize(std::max<size_t>(types.size(), top_layer_ + 1),
+                 webrtc::VideoFrameType::kVideoFrameDelta);
+    types[top_layer_] = webrtc::VideoFrameType::kVideoFrameKey;
+    return encoder_->Encode(frame, &types);
+  }
+  void SetRates(const RateControlParameters& parameters) override {
+    encoder_->SetRates(parameters);
+  }
+  void OnPacketLossRateUpdate(float packet_loss_rate) override {
+    encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+  }
+  void OnRttUpdate(int64_t rtt_ms) override { encoder_->OnRttUpdate(rtt_ms); }
+  void OnLossNotification(const LossNotification& loss_notification) override {
+    encoder_->OnLossNotification(loss_notification);
+  }
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override {
+    return encoder_->GetEncoderInfo();
+  }
+
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override {
+    if (attached_ && encoded_image.SpatialIndex().value_or(0) == top_layer_) {
+      int64_t capture_time_us = encoded_image.capture_time_ms_ > 0
+                                    ? encoded_image.capture_time_ms_ * 1000
+                                    : rtc::TimeMicros();
+      sink_->OnVideo(this, encoded_image, capture_time_us);
+    }
+    return callback_->OnEncodedImage(encoded_image, codec_specific_info,
+                                     fragmentation);
+  }
+  void OnDroppedFrame(DropReason reason) override {
+    callback_->OnDroppedFrame(reason);
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  std::shared_ptr<EncodedVideoSink> sink_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  int top_layer_ = 0;
+  bool attached_ = false;
+};
+
+// Opus のエンコーダの出力を recorder にも渡すラッパー
+class RecordingAudioEncoder : public ForwardingAudioEncoder {
+ public:
+  RecordingAudioEncoder(std::unique_ptr<webrtc::AudioEncoder> encoder,
+                        std::shared_ptr<LocalRecorder> recorder)
+      : ForwardingAudioEncoder(std::move(encoder)),
+        recorder_(std::move(recorder)) {
+    attached_ = recorder_->AttachAudio(this, encoder_->NumChannels());
+  }
+  ~RecordingAudioEncoder() override { recorder_->DetachAudio(this); }
+
+ protected:
+  EncodedInfo EncodeImpl(uint32_t rtp_timestamp,
+                         rtc::ArrayView<const int16_t> audio,
+                         rtc::Buffer* encoded) override {
+    const size_t offset = encoded->size();
+    EncodedInfo info = encoder_->Encode(rtp_timestamp, audio, encoded);
+    if (attached_ && info.encoded_bytes > 0) {
+      recorder_->OnAudio(this, encoded->data() + offset, info.encoded_bytes,
+                         CaptureTimeUs(info.encoded_timestamp));
+    }
+    return info;
+  }
+
+ private:
+  // RTP のタイムスタンプから時刻を求めて、エンコードを呼ばれる間隔のばらつきを除く。
+  // 大きくずれた場合は今の時刻に合わせ直す
+  int64_t CaptureTimeUs(uint32_t rtp_timestamp) {
+    const int64_t now_us = rtc::TimeMicros();
+    const int rate = encoder_->RtpTimestampRateHz();
+    int64_t time_us =
+        base_time_us_ + static_cast<int64_t>(static_cast<uint32_t>(
+                            rtp_timestamp - base_rtp_timestamp_)) *
+                            1000 * 1000 / rate;
+    if (base_time_us_ < 0 || llabs(time_us - now_us) > 1000 * 1000) {
+      base_time_us_ = now_us;
+      base_rtp_timestamp_ = rtp_timestamp;
+      time_us = now_us;
+    }
+    return time_us;
+  }
+
+  std::shared_ptr<LocalRecorder> recorder_;
+  bool attached_ = false;
+  int64_t base_time_us_ = -1;
+  uint32_t base_rtp_timestamp_ = 0;
+};
+
+class RecordingAudioEncoderFactory : public webrtc::AudioEncoderFactory {
+ public:
+  RecordingAudioEncoderFactory(
+      rtc::scoped_refptr<webrtc::AudioEncoderFactory> base,
+      std::shared_ptr<LocalRecorder> recorder)
+      : base_(std::move(base)), recorder_(std::move(recorder)) {}
+
+  std::vector<webrtc::AudioCodecSpec> GetSupportedEncoders() override {
+    return base_->GetSupportedEncoders();
+  }
+  absl::optional<webrtc::AudioCodecInfo> QueryAudioEncoder(
+      const webrtc::SdpAudioFormat& format) override {
+    return base_->QueryAudioEncoder(format);
+  }
+  std::unique_ptr<webrtc::AudioEncoder> MakeAudioEncoder(
+      int payload_type,
+      const webrtc::SdpAudioFormat& format,
+      absl::optional<webrtc::AudioCodecPairId> codec_pair_id) override {
+    std::unique_ptr<webrtc::AudioEncoder> encoder =
+        base_->MakeAudioEncoder(payload_type, format, codec_pair_id);
+    if (!encoder || !absl::EqualsIgnoreCase(format.name, "opus")) {
+      return encoder;
+    }
+    return absl::make_unique<RecordingAudioEncoder>(std::move(encoder),
+                                                    recorder_);
+  }
+
+ private:
+  rtc::scoped_refptr<webrtc::AudioEncoderFactory> base_;
+  std::shared_ptr<LocalRecorder> recorder_;
+};
+
+}  // namespace
+
+RecordingVideoEncoderFactory::RecordingVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+    std::shared_ptr<EncodedVideoSink> sink)
+    : factory_(std::move(factory)), sink_(std::move(sink)) {}
+
+std::vector<webrtc::SdpVideoFormat>
+RecordingVideoEncoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+RecordingVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return factory_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+RecordingVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory_->CreateVideoEncoder(format);
+  if (!encoder || !absl::EqualsIgnoreCase(format.name, cricket::kH264CodecName)) {
+    return encoder;
+  }
+  return std::unique_ptr<webrtc::VideoEncoder>(
+      absl::make_unique<RecordingVideoEncoder>(std::move(encoder), sink_));
+}
+
+rtc::scoped_refptr<webrtc::AudioEncoderFactory>
+CreateRecordingAudioEncoderFactory(
+    rtc::scoped_refptr<webrtc::AudioEncoderFactory> base,
+    std::shared_ptr<LocalRecorder> recorder) {
+  return new rtc::RefCountedObject<RecordingAudioEncoderFactory>(
+      std::move(base), std::move(recorder));
+}
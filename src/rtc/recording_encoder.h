@@ -0,0 +1,44 @@
+#ifndef RECORDING_ENCODER_H_
+#define RECORDING_ENCODER_H_
+
+#include <memory>
+#include <vector>
+
+#include "api/audio_codecs/audio_encoder_factory.h"
+#include "api/scoped_refptr.h"
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+#include "encoded_video_sink.h"
+#include "local_recorder.h"
+
+// factory が作る H.264 のエンコーダの出力を、送信しつつ sink (LocalRecorder や RtspStream) にも渡すファクトリ。
+//
+// サイマルキャストの場合は一番解像度の高いレイヤーだけを渡す。
+// sink がキーフレームを必要とした時は、エンコーダにキーフレームを要求する。
+class RecordingVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  RecordingVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+      std::shared_ptr<EncodedVideoSink> sink);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  std::shared_ptr<EncodedVideoSink> sink_;
+};
+
+// base が作る Opus のエンコーダの出力を recorder にも渡すファクトリを作る
+rtc::scoped_refptr<webrtc::AudioEncoderFactory>
+CreateRecordingAudioEncoderFactory(
+    rtc::scoped_refptr<webrtc::AudioEncoderFactory> base,
+    std::shared_ptr<LocalRecorder> recorder);
+
+#endif  // RECORDING_ENCODER_H_
@@ -0,0 +1,222 @@
+#include "roi_map.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+namespace {
+
+const int kMacroblockSize = 16;
+// マクロブロックを比較する時の大きさ
+const int kSamplesPerMacroblock = 4;
+// 動きが止まってもしばらくは画質を上げたままにして、QP が頻繁に変わらないようにする
+const uint8_t kMotionHoldFrames = 15;
+const int kMaxQpDelta = 51;
+
+}  // namespace
+
+RoiHints& RoiHints::Instance() {
+  static RoiHints instance;
+  return instance;
+}
+
+void RoiHints::Configure(const Settings& settings) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  settings_ = settings;
+}
+
+RoiHints::Settings RoiHints::settings() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return settings_;
+}
+
+bool RoiHints::enabled() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return settings_.motion || settings_.hints;
+}
+
+void RoiHints::SetRegions(std::vector<RoiRegion> regions, int ttl_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  regions_ = std::move(regions);
+  expire_ms_ = ttl_ms > 0 ? rtc::TimeMillis() + ttl_ms : 0;
+}
+
+std::vector<RoiRegion> RoiHints::regions() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (expire_ms_ > 0 && rtc::TimeMillis() >= expire_ms_) {
+    regions_.clear();
+    expire_ms_ = 0;
+  }
+  return regions_;
+}
+
+bool RoiMap::Update(int width,
+                    int height,
+                    const uint8_t* y,
+                    int stride_y,
+                    int y_width,
+                    int y_height) {
+  settings_ = RoiHints::Instance().settings();
+  regions_.clear();
+  if (settings_.hints) {
+    regions_ = RoiHints::Instance().regions();
+  }
+
+  if (width != width_ || height != height_) {
+    width_ = width;
+    height_ = height;
+    mb_width_ = (width + kMacroblockSize - 1) / kMacroblockSize;
+    mb_height_ = (height + kMacroblockSize - 1) / kMacroblockSize;
+    previous_.clear();
+    motion_.assign(mb_width_ * mb_height_, 0);
+    qp_delta_map_.assign(mb_width_ * mb_height_, 0);
+  }
+
+  if (settings_.motion && y != nullptr) {
+    DetectMotion(y, stride_y, y_width, y_height);
+  } else {
+    previous_.clear();
+    std::fill(motion_.begin(), motion_.end(), 0);
+  }
+
+  for (size_t i = 0; i < motion_.size(); i++) {
+    qp_delta_map_[i] = static_cast<int8_t>(
+        motion_[i] > 0 ? settings_.motion_qp_delta
+                       : settings_.background_qp_delta);
+  }
+  // 指定された領域は動きよりも優先する
+  for (const auto& region : regions_) {
+    int x0 = static_cast<int>(std::floor(region.x * mb_width_));
+    int y0 = static_cast<int>(std::floor(region.y * mb_height_));
+    int x1 = static_cast<int>(std::ceil((region.x + region.width) * mb_width_));
+    int y1 =
+        static_cast<int>(std::ceil((region.y + region.height) * mb_height_));
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, mb_width_);
+    y1 = std::min(y1, mb_height_);
+    if (x0 >= x1) {
+      continue;
+    }
+    const int8_t qp_delta = static_cast<int8_t>(
+        std::max(-kMaxQpDelta, std::min(region.qp_delta, kMaxQpDelta)));
+    for (int my = y0; my < y1; my++) {
+      std::fill(qp_delta_map_.begin() + my * mb_width_ + x0,
+                qp_delta_map_.begin() + my * mb_width_ + x1, qp_delta);
+    }
+  }
+
+  return std::any_of(qp_delta_map_.begin(), qp_delta_map_.end(),
+                     [](int8_t delta) { return delta != 0; });
+}
+
+void RoiMap::DetectMotion(const uint8_t* y,
+                          int stride_y,
+                          int y_width,
+                          int y_height) {
+  const int width = mb_width_ * kSamplesPerMacroblock;
+  const int height = mb_height_ * kSamplesPerMacroblock;
+  current_.resize(width * height);
+  libyuv::ScalePlane(y, stride_y, y_width, y_height, current_.data(), width,
+                     width, height, libyuv::kFilterBox);
+
+  if (previous_.size() == current_.size()) {
+    const int threshold = settings_.motion_threshold * kSamplesPerMacroblock *
+                          kSamplesPerMacroblock;
+    for (int my = 0; my < mb_height_; my++) {
+      for (int mx = 0; mx < mb_width_; mx++) {
+        const size_t offset =
+            my * kSamplesPerMacroblock * width + mx * kSamplesPerMacroblock;
+        int sad = 0;
+        for (int j = 0; j < kSamplesPerMacroblock; j++) {
+          const uint8_t* a = current_.data() + offset + j * width;
+          const uint8_t* b = previous_.data() + offset + j * width;
+          for (int i = 0; i < kSamplesPerMacroblock; i++) {
+            sad += abs(a[i] - b[i]);
+          }
+        }
+        uint8_t& motion = motion_[my * mb_width_ + mx];
+        if (sad >= threshold) {
+          motion = kMotionHoldFrames;
+        } else if (motion > 0) {
+          motion--;
+        }
+      }
+    }
+  }
+  previous_.swap(current_);
+}
+
+std::vector<RoiMap::Rect> RoiMap::ToRects(size_t max_rects) const {
+  std::vector<Rect> rects;
+  for (const auto& region : regions_) {
+    if (rects.size() >= max_rects) {
+      return rects;
+    }
+    Rect rect = ToRect(region);
+    if (rect.width > 0 && rect.height > 0) {
+      rects.push_back(rect);
+    }
+  }
+  if (!settings_.motion || settings_.motion_qp_delta == 0 ||
+      rects.size() >= max_rects) {
+    return rects;
+  }
+
+  // 動きのある範囲は、残りの数で画面を区切ってその中で囲む
+  const int remaining = static_cast<int>(max_rects - rects.size());
+  const int rows = remaining >= 2 ? 2 : 1;
+  const int cols = remaining / rows;
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      const int y0 = mb_height_ * row / rows;
+      const int y1 = mb_height_ * (row + 1) / rows;
+      const int x0 = mb_width_ * col / cols;
+      const int x1 = mb_width_ * (col + 1) / cols;
+      int left = x1;
+      int top = y1;
+      int right = x0 - 1;
+      int bottom = y0 - 1;
+      for (int my = y0; my < y1; my++) {
+        for (int mx = x0; mx < x1; mx++) {
+          if (motion_[my * mb_width_ + mx] > 0) {
+            left = std::min(left, mx);
+            top = std::min(top, my);
+            right = std::max(right, mx);
+            bottom = std::max(bottom, my);
+          }
+        }
+      }
+      if (right < left) {
+        continue;
+      }
+      Rect rect;
+      rect.x = left * kMacroblockSize;
+      rect.y = top * kMacroblockSize;
+      rect.width = std::min((right + 1) * kMacroblockSize, width_) - rect.x;
+      rect.height = std::min((bottom + 1) * kMacroblockSize, height_) - rect.y;
+      rect.qp_delta = settings_.motion_qp_delta;
+      rects.push_back(rect);
+    }
+  }
+  return rects;
+}
+
+RoiMap::Rect RoiMap::ToRect(const RoiRegion& region) const {
+  auto clamp = [](double value, int max) {
+    return std::max(0, std::min(static_cast<int>(std::lround(value)), max));
+  };
+  Rect rect;
+  rect.x = clamp(region.x * width_, width_);
+  rect.y = clamp(region.y * height_, height_);
+  rect.width = clamp((region.x + region.width) * width_, width_) - rect.x;
+  rect.height = clamp((region.y + region.height) * height_, height_) - rect.y;
+  rect.qp_delta =
+      std::max(-kMaxQpDelta, std::min(region.qp_delta, kMaxQpDelta));
+  return rect;
+}
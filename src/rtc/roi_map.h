@@ -0,0 +1,109 @@
+#ifndef ROI_MAP_H_
+#define ROI_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+// 画質を変えたい領域。座標はフレームの幅と高さを 1 とした値で、解像度が変わっても同じ場所を指す
+struct RoiRegion {
+  double x = 0;
+  double y = 0;
+  double width = 0;
+  double height = 0;
+  // 領域内のマクロブロックの QP に加える値。負の値にすると画質が上がる
+  int qp_delta = 0;
+};
+
+// エンコーダが参照する ROI の設定と、DataChannel などから受け取った領域を保持するクラス。
+// 任意のスレッドから呼び出して良い。
+class RoiHints {
+ public:
+  struct Settings {
+    // 動きのあるマクロブロックの QP を motion_qp_delta だけ変える
+    bool motion = false;
+    // 動きとみなす輝度の差。1 画素あたりの平均で指定する
+    int motion_threshold = 6;
+    int motion_qp_delta = -6;
+    // 動きが無く、領域も指定されていないマクロブロックの QP に加える値
+    int background_qp_delta = 0;
+    // SetRegions() で領域を受け取る
+    bool hints = false;
+  };
+
+  static RoiHints& Instance();
+
+  void Configure(const Settings& settings);
+  Settings settings();
+  // 動き検出か領域の指定のどちらかが有効な場合に true を返す
+  bool enabled();
+
+  // 今の領域を置き換える。ttl_ms が 0 より大きい場合はその時間が経つと消える
+  void SetRegions(std::vector<RoiRegion> regions, int ttl_ms);
+  std::vector<RoiRegion> regions();
+
+ private:
+  RoiHints() = default;
+
+  std::mutex mutex_;
+  Settings settings_;
+  std::vector<RoiRegion> regions_;
+  int64_t expire_ms_ = 0;
+};
+
+// エンコーダ毎に持つ、16x16 のマクロブロック単位の QP の差分のマップ。
+//
+// Update() に Y プレーンを渡すと、前のフレームとの差から動きのあるマクロブロックを探す。
+// Y プレーンはマクロブロック毎に 4x4 画素まで libyuv で縮小してから比較するので、
+// 元の解像度に関わらず比較する画素数はマクロブロックあたり 16 で済む。
+// Y プレーンの解像度はエンコードする解像度と違っていても良い。
+// 呼び出しはエンコードするスレッドからに限ること。
+class RoiMap {
+ public:
+  // Jetson のように矩形で指定する場合の領域。座標はエンコードする解像度の画素数
+  struct Rect {
+    int x;
+    int y;
+    int width;
+    int height;
+    int qp_delta;
+  };
+
+  // width x height はエンコードする解像度。y が nullptr の場合は動きを検出しない。
+  // QP を変えるマクロブロックがあれば true を返す
+  bool Update(int width,
+              int height,
+              const uint8_t* y,
+              int stride_y,
+              int y_width,
+              int y_height);
+
+  int mb_width() const { return mb_width_; }
+  int mb_height() const { return mb_height_; }
+  // ラスタ順のマクロブロック毎の QP の差分。Update() が true を返した場合のみ有効
+  const std::vector<int8_t>& qp_delta_map() const { return qp_delta_map_; }
+
+  // 指定された領域を先に、残りは画面を分割した区画毎に動きのある範囲を囲んで、
+  // max_rects 個以下の矩形にする。background_qp_delta は含まない
+  std::vector<Rect> ToRects(size_t max_rects) const;
+
+ private:
+  void DetectMotion(const uint8_t* y, int stride_y, int y_width, int y_height);
+  Rect ToRect(const RoiRegion& region) const;
+
+  int width_ = 0;
+  int height_ = 0;
+  int mb_width_ = 0;
+  int mb_height_ = 0;
+  RoiHints::Settings settings_;
+  std::vector<RoiRegion> regions_;
+  std::vector<uint8_t> current_;
+  std::vector<uint8_t> previous_;
+  // マクロブロック毎の、動きを検出してから残りのフレーム数
+  std::vector<uint8_t> motion_;
+  std::vector<int8_t> qp_delta_map_;
+};
+
+#endif  // ROI_MAP_H_
@@ -0,0 +1,323 @@
+#include "rtc_config.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+// WebRTC
+#include "absl/strings/match.h"
+#include "absl/types/optional.h"
+#include "media/base/codec.h"
+#include "media/base/h264_profile_level_id.h"
+#include "media/base/media_constants.h"
+
+namespace {
+
+const char kCrlf[] = "\r\n";
+
+bool ParseProfile(const std::string& name, webrtc::H264::Profile* profile) {
+  static const std::map<std::string, webrtc::H264::Profile> kProfiles = {
+      {"constrained-baseline", webrtc::H264::kProfileConstrainedBaseline},
+      {"baseline", webrtc::H264::kProfileBaseline},
+      {"main", webrtc::H264::kProfileMain},
+      {"constrained-high", webrtc::H264::kProfileConstrainedHigh},
+      {"high", webrtc::H264::kProfileHigh},
+  };
+  auto it = kProfiles.find(name);
+  if (it == kProfiles.end()) {
+    return false;
+  }
+  *profile = it->second;
+  return true;
+}
+
+bool ParseLevel(const std::string& name, webrtc::H264::Level* level) {
+  static const std::map<std::string, webrtc::H264::Level> kLevels = {
+      {"1b", webrtc::H264::kLevel1_b}, {"1", webrtc::H264::kLevel1},
+      {"1.1", webrtc::H264::kLevel1_1}, {"1.2", webrtc::H264::kLevel1_2},
+      {"1.3", webrtc::H264::kLevel1_3}, {"2", webrtc::H264::kLevel2},
+      {"2.1", webrtc::H264::kLevel2_1}, {"2.2", webrtc::H264::kLevel2_2},
+      {"3", webrtc::H264::kLevel3},     {"3.1", webrtc::H264::kLevel3_1},
+      {"3.2", webrtc::H264::kLevel3_2}, {"4", webrtc::H264::kLevel4},
+      {"4.1", webrtc::H264::kLevel4_1}, {"4.2", webrtc::H264::kLevel4_2},
+      {"5", webrtc::H264::kLevel5},     {"5.1", webrtc::H264::kLevel5_1},
+      {"5.2", webrtc::H264::kLevel5_2},
+  };
+  auto it = kLevels.find(name);
+  if (it == kLevels.end()) {
+    return false;
+  }
+  *level = it->second;
+  return true;
+}
+
+bool ParseH264Format(const nlohmann::json& json,
+                     RtcConfig::H264Format* format,
+                     std::string* error) {
+  if (!json.is_object()) {
+    *error = "h264 must be an array of objects";
+    return false;
+  }
+  if (json.contains("profile_level_id")) {
+    format->profile_level_id = json["profile_level_id"].get<std::string>();
+    if (!webrtc::H264::ParseProfileLevelId(format->profile_level_id.c_str())) {
+      *error = "invalid profile_level_id: " + format->profile_level_id;
+      return false;
+    }
+  } else {
+    webrtc::H264::Profile profile = webrtc::H264::kProfileConstrainedBaseline;
+    webrtc::H264::Level level = webrtc::H264::kLevel3_1;
+    if (json.contains("profile") &&
+        !ParseProfile(json["profile"].get<std::string>(), &profile)) {
+      *error = "unknown h264 profile: " + json["profile"].get<std::string>();
+      return false;
+    }
+    if (json.contains("level") &&
+        !ParseLevel(json["level"].get<std::string>(), &level)) {
+      *error = "unknown h264 level: " + json["level"].get<std::string>();
+      return false;
+    }
+    const absl::optional<std::string> id = webrtc::H264::ProfileLevelIdToString(
+        webrtc::H264::ProfileLevelId(profile, level));
+    if (!id) {
+      *error = "unsupported combination of h264 profile and level";
+      return false;
+    }
+    format->profile_level_id = *id;
+  }
+  if (json.contains("packetization_mode")) {
+    format->packetization_mode = json["packetization_mode"].get<std::string>();
+    if (format->packetization_mode != "0" &&
+        format->packetization_mode != "1") {
+      *error = "packetization_mode must be \"0\" or \"1\"";
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<std::string> SplitLines(const std::string& sdp) {
+  std::vector<std::string> lines;
+  for (size_t pos = 0; pos < sdp.size();) {
+    size_t end = sdp.find('\n', pos);
+    if (end == std::string::npos) {
+      end = sdp.size();
+    }
+    std::string line = sdp.substr(pos, end - pos);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    lines.push_back(std::move(line));
+    pos = end + 1;
+  }
+  return lines;
+}
+
+std::vector<std::string> SplitFields(const std::string& line) {
+  std::vector<std::string> fields;
+  for (size_t pos = 0; pos <= line.size();) {
+    size_t end = line.find(' ', pos);
+    if (end == std::string::npos) {
+      end = line.size();
+    }
+    fields.push_back(line.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return fields;
+}
+
+// "a=extmap:3 urn:ietf:params:rtp-hdrext:toffset" や
+// "a=extmap:3/sendonly URI 属性" から URI を取り出す
+std::string ExtmapUri(const std::string& line) {
+  const std::string prefix = "a=extmap:";
+  if (line.compare(0, prefix.size(), prefix) != 0) {
+    return "";
+  }
+  std::vector<std::string> fields = SplitFields(line);
+  return fields.size() < 2 ? "" : fields[1];
+}
+
+}  // namespace
+
+bool RtcConfig::Load(const std::string& path,
+                     RtcConfig* config,
+                     std::string* error) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    *error = "failed to open " + path;
+    return false;
+  }
+  RtcConfig c;
+  try {
+    nlohmann::json json = nlohmann::json::parse(ifs);
+    if (json.contains("field_trials")) {
+      const nlohmann::json& trials = json["field_trials"];
+      if (trials.is_string()) {
+        c.field_trials = trials.get<std::string>();
+      } else {
+        for (const auto& item : trials.items()) {
+          c.field_trials +=
+              item.key() + "/" + item.value().get<std::string>() + "/";
+        }
+      }
+      if (!c.field_trials.empty() &&
+          std::count(c.field_trials.begin(), c.field_trials.end(), '/') % 2 !=
+              0) {
+        *error = "field_trials must be in the form of NAME/GROUP/";
+        return false;
+      }
+    }
+    if (json.contains("h264")) {
+      for (const auto& item : json["h264"]) {
+        H264Format format;
+        if (!ParseH264Format(item, &format, error)) {
+          return false;
+        }
+        c.h264_formats.push_back(format);
+      }
+    }
+    if (json.contains("codec_preference")) {
+      c.codec_preference =
+          json["codec_preference"].get<std::vector<std::string>>();
+    }
+    if (json.contains("disabled_rtp_header_extensions")) {
+      c.disabled_rtp_header_extensions =
+          json["disabled_rtp_header_extensions"]
+              .get<std::vector<std::string>>();
+    }
+  } catch (const nlohmann::json::exception& e) {
+    *error = path + ": " + e.what();
+    return false;
+  }
+  *config = std::move(c);
+  return true;
+}
+
+std::string RtcConfig::MergeFieldTrials(const std::string& base,
+                                        const std::string& overrides) {
+  // 名前の順序は base、overrides の順に最初に出てきた順にする
+  std::vector<std::pair<std::string, std::string>> trials;
+  auto add = [&trials](const std::string& s) {
+    for (size_t pos = 0; pos < s.size();) {
+      size_t name_end = s.find('/', pos);
+      if (name_end == std::string::npos) {
+        break;
+      }
+      size_t group_end = s.find('/', name_end + 1);
+      if (group_end == std::string::npos) {
+        break;
+      }
+      std::string name = s.substr(pos, name_end - pos);
+      std::string group = s.substr(name_end + 1, group_end - name_end - 1);
+      auto it = std::find_if(
+          trials.begin(), trials.end(),
+          [&name](const std::pair<std::string, std::string>& trial) {
+            return trial.first == name;
+          });
+      if (it == trials.end()) {
+        trials.push_back({name, group});
+      } else {
+        it->second = group;
+      }
+      pos = group_end + 1;
+    }
+  };
+  add(base);
+  add(overrides);
+  std::string merged;
+  for (const auto& trial : trials) {
+    merged += trial.first + "/" + trial.second + "/";
+  }
+  return merged;
+}
+
+std::vector<webrtc::SdpVideoFormat> RtcConfig::GetH264Formats() const {
+  std::vector<webrtc::SdpVideoFormat> formats;
+  for (const H264Format& format : h264_formats) {
+    formats.push_back(webrtc::SdpVideoFormat(
+        cricket::kH264CodecName,
+        {{cricket::kH264FmtpProfileLevelId, format.profile_level_id},
+         {cricket::kH264FmtpLevelAsymmetryAllowed, "1"},
+         {cricket::kH264FmtpPacketizationMode, format.packetization_mode}}));
+  }
+  return formats;
+}
+
+std::string RtcConfig::ApplyToSdp(const std::string& sdp) const {
+  if (!rewrites_sdp()) {
+    return sdp;
+  }
+
+  std::vector<std::string> lines = SplitLines(sdp);
+  std::vector<std::string> result;
+  // 並べ替える m=video の行の位置と、そのセクションの PT とコーデック名
+  size_t m_index = 0;
+  bool in_video = false;
+  std::map<std::string, std::string> codec_names;
+  auto reorder = [&]() {
+    if (!in_video || codec_preference.empty()) {
+      return;
+    }
+    std::vector<std::string> fields = SplitFields(result[m_index]);
+    if (fields.size() <= 3) {
+      return;
+    }
+    auto rank = [&](const std::string& pt) {
+      auto it = codec_names.find(pt);
+      if (it != codec_names.end()) {
+        for (size_t i = 0; i < codec_preference.size(); i++) {
+          if (absl::EqualsIgnoreCase(it->second, codec_preference[i])) {
+            return i;
+          }
+        }
+      }
+      return codec_preference.size();
+    };
+    std::stable_sort(fields.begin() + 3, fields.end(),
+                     [&](const std::string& a, const std::string& b) {
+                       return rank(a) < rank(b);
+                     });
+    std::string m;
+    for (const std::string& field : fields) {
+      m += (m.empty() ? "" : " ") + field;
+    }
+    result[m_index] = m;
+  };
+
+  for (const std::string& line : lines) {
+    if (line.compare(0, 2, "m=") == 0) {
+      reorder();
+      in_video = line.compare(0, 8, "m=video ") == 0;
+      m_index = result.size();
+      codec_names.clear();
+    }
+    const std::string uri = ExtmapUri(line);
+    if (!uri.empty() &&
+        std::find(disabled_rtp_header_extensions.begin(),
+                  disabled_rtp_header_extensions.end(),
+                  uri) != disabled_rtp_header_extensions.end()) {
+      continue;
+    }
+    const std::string rtpmap = "a=rtpmap:";
+    if (in_video && line.compare(0, rtpmap.size(), rtpmap) == 0) {
+      size_t space = line.find(' ', rtpmap.size());
+      if (space != std::string::npos) {
+        std::string name = line.substr(space + 1);
+        codec_names[line.substr(rtpmap.size(), space - rtpmap.size())] =
+            name.substr(0, name.find('/'));
+      }
+    }
+    result.push_back(line);
+  }
+  reorder();
+
+  std::string out;
+  for (const std::string& line : result) {
+    out += line;
+    out += kCrlf;
+  }
+  return out;
+}
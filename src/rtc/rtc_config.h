@@ -0,0 +1,62 @@
+#ifndef RTC_CONFIG_H_
+#define RTC_CONFIG_H_
+
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+
+// --rtc-config で指定する JSON ファイルの内容。
+// 再ビルドせずに WebRTC の内部の設定やコーデックの広告を変えるためのもの。
+//
+// {
+//   "field_trials": {"WebRTC-Pacer-BlockAudio": "Disabled"},
+//   "h264": [
+//     {"profile": "constrained-baseline", "level": "5.1",
+//      "packetization_mode": "1"},
+//     {"profile_level_id": "42e01f", "packetization_mode": "0"}
+//   ],
+//   "codec_preference": ["H264", "VP8"],
+//   "disabled_rtp_header_extensions": ["urn:3gpp:video-orientation"]
+// }
+//
+// field_trials は "WebRTC-Foo/Enabled/" の形式の文字列でも良い。
+// h264 はハードウェアエンコーダが広告する H.264 の形式で、省略した場合は
+// Constrained Baseline と Baseline の Level 3.1 を広告する。
+// codec_preference と disabled_rtp_header_extensions は、生成した offer と answer の
+// SDP を書き換えて反映する。
+struct RtcConfig {
+  struct H264Format {
+    std::string profile_level_id;
+    std::string packetization_mode = "1";
+  };
+
+  std::string field_trials;
+  std::vector<H264Format> h264_formats;
+  // 映像のコーデック名を優先する順に並べたもの。含まれないコーデックは元の順序で後ろに並ぶ
+  std::vector<std::string> codec_preference;
+  // a=extmap から取り除く RTP ヘッダ拡張の URI
+  std::vector<std::string> disabled_rtp_header_extensions;
+
+  // 読み込めない場合や形式が間違っている場合は false を返して error に理由を入れる
+  static bool Load(const std::string& path,
+                   RtcConfig* config,
+                   std::string* error);
+
+  // "A/Enabled/B/Disabled/" の形式のフィールドトライアルを合わせる。
+  // 同じ名前がある場合は overrides の方を使う
+  static std::string MergeFieldTrials(const std::string& base,
+                                      const std::string& overrides);
+
+  // h264_formats を SdpVideoFormat にする。空の場合は空を返す
+  std::vector<webrtc::SdpVideoFormat> GetH264Formats() const;
+
+  bool rewrites_sdp() const {
+    return !codec_preference.empty() ||
+           !disabled_rtp_header_extensions.empty();
+  }
+  // codec_preference と disabled_rtp_header_extensions を SDP に反映する
+  std::string ApplyToSdp(const std::string& sdp) const;
+};
+
+#endif  // RTC_CONFIG_H_
@@ -16,11 +16,28 @@
 #include "api/video/i420_buffer.h"
 #include "api/video/video_frame_buffer.h"
 #include "api/video/video_rotation.h"
+#include "deferred_i420_buffer.h"
+#include "encoder_metrics.h"
+#include "frame_buffer_pool.h"
+#include "frame_tracer.h"
+#include "latency_marker.h"
 #include "native_buffer.h"
+#include "parallel_scaler.h"
 #include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "simulcast_frame_buffer.h"
+#include "startup_timer.h"
+#include "third_party/libyuv/include/libyuv.h"
 
 ScalableVideoTrackSource::ScalableVideoTrackSource()
-    : AdaptedVideoTrackSource(4) {}
+    : AdaptedVideoTrackSource(4),
+      simulcast_layers_(1),
+      latency_marker_(false),
+      encoder_backpressure_(false),
+      static_scene_fps_(0),
+      static_scene_delay_ms_(0),
+      static_scene_threshold_(0),
+      capture_rate_(1000, 1000) {}
 ScalableVideoTrackSource::~ScalableVideoTrackSource() {}
 
 bool ScalableVideoTrackSource::is_screencast() const {
@@ -40,48 +57,273 @@ bool ScalableVideoTrackSource::remote() const {
   return false;
 }
 
+void ScalableVideoTrackSource::SetSimulcastLayers(int num_layers) {
+  simulcast_layers_ = num_layers;
+}
+
+void ScalableVideoTrackSource::SetLatencyMarker(bool enabled) {
+  latency_marker_ = enabled;
+}
+
+void ScalableVideoTrackSource::SetEncoderBackpressure(bool enabled) {
+  encoder_backpressure_ = enabled;
+}
+
+void ScalableVideoTrackSource::SetStaticScene(int fps,
+                                              int delay_ms,
+                                              int threshold) {
+  static_scene_delay_ms_ = delay_ms;
+  static_scene_threshold_ = threshold;
+  static_scene_fps_ = fps;
+}
+
+void ScalableVideoTrackSource::SetRotation(webrtc::VideoRotation rotation) {
+  webrtc::VideoRotation remaining = ApplyDeviceRotation(rotation);
+  RTC_LOG(LS_INFO) << "Video rotation: " << rotation
+                   << " (by the capture device: " << rotation - remaining
+                   << ")";
+  rotation_ = remaining;
+}
+
+bool ScalableVideoTrackSource::IsStaticFrame(const webrtc::VideoFrame& frame) {
+  StaticSceneDetector::Settings settings;
+  settings.fps = static_scene_fps_;
+  if (settings.fps <= 0) {
+    return false;
+  }
+  settings.delay_ms = static_scene_delay_ms_;
+  settings.threshold = static_scene_threshold_;
+
+  // 変換しないと輝度が分からないフレームは判定せずに通す。
+  // 変換を遅らせているバッファもプレーンに触ると変換してしまうので判定しない
+  const uint8_t* y = nullptr;
+  int stride_y = 0;
+  int width = 0;
+  int height = 0;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
+    NativeBuffer* native_buffer = dynamic_cast<NativeBuffer*>(buffer.get());
+    if (native_buffer != nullptr &&
+        native_buffer->VideoType() == webrtc::VideoType::kNV12) {
+      y = native_buffer->DataY();
+      stride_y = native_buffer->StrideY();
+      width = native_buffer->raw_width();
+      height = native_buffer->raw_height();
+    }
+  } else if (buffer->type() == webrtc::VideoFrameBuffer::Type::kI420 &&
+             dynamic_cast<DeferredI420Buffer*>(buffer.get()) == nullptr) {
+    const webrtc::I420BufferInterface* i420_buffer = buffer->GetI420();
+    y = i420_buffer->DataY();
+    stride_y = i420_buffer->StrideY();
+    width = i420_buffer->width();
+    height = i420_buffer->height();
+  }
+  if (static_scene_detector_.ShouldPass(settings, y, stride_y, width, height,
+                                        rtc::TimeMicros())) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_.static_skipped_frames++;
+  return true;
+}
+
+bool ScalableVideoTrackSource::ShouldSkipFrame() {
+  if (!encoder_backpressure_ ||
+      !EncoderMetricsRegistry::Instance().IsCongested()) {
+    skip_next_frame_ = false;
+    return false;
+  }
+  // 全て捨てると詰まりが解消したか分からなくなるので、交互に通す
+  skip_next_frame_ = !skip_next_frame_;
+  if (!skip_next_frame_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_.backpressure_skipped_frames++;
+  return true;
+}
+
+uint32_t ScalableVideoTrackSource::CaptureTimeUTCMs(int64_t timestamp_us) {
+  return LatencyMarker::CaptureTimeMs(timestamp_us);
+}
+
+void ScalableVideoTrackSource::StampLatencyMarker(
+    const webrtc::VideoFrame& frame) {
+  const uint32_t timestamp_ms = CaptureTimeUTCMs(frame.timestamp_us());
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  bool stamped = false;
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
+    NativeBuffer* native_buffer = dynamic_cast<NativeBuffer*>(buffer.get());
+    if (native_buffer != nullptr &&
+        native_buffer->VideoType() == webrtc::VideoType::kNV12) {
+      stamped = LatencyMarker::Stamp(
+          native_buffer->MutableDataY(), native_buffer->StrideY(),
+          native_buffer->raw_width(), native_buffer->raw_height(),
+          timestamp_ms);
+    }
+  } else if (buffer->type() == webrtc::VideoFrameBuffer::Type::kI420) {
+    // キャプチャしたバッファはこのフレームでしか使わないので、そのまま書き換える
+    webrtc::I420Buffer* i420_buffer =
+        dynamic_cast<webrtc::I420Buffer*>(buffer.get());
+    if (i420_buffer != nullptr) {
+      stamped = LatencyMarker::Stamp(
+          i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+          i420_buffer->width(), i420_buffer->height(), timestamp_ms);
+    }
+  }
+  if (!stamped && !latency_marker_warned_) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__
+                        << ": Cannot stamp latency marker on this frame. type="
+                        << static_cast<int>(buffer->type())
+                        << " width=" << buffer->width();
+    latency_marker_warned_ = true;
+  }
+}
+
+ScalableVideoTrackSource::CaptureStats
+ScalableVideoTrackSource::GetCaptureStats() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  CaptureStats stats = stats_;
+  stats.capture_fps = capture_rate_.Rate(rtc::TimeMillis()).value_or(0);
+  return stats;
+}
+
 void ScalableVideoTrackSource::OnCapturedFrame(
     const webrtc::VideoFrame& frame) {
   const int64_t timestamp_us = frame.timestamp_us();
+  TraceScope trace("OnCapturedFrame", timestamp_us);
+  if (!first_frame_captured_.exchange(true, std::memory_order_relaxed)) {
+    StartupTimer::Instance().Mark("first_frame");
+  }
   const int64_t translated_timestamp_us =
       timestamp_aligner_.TranslateTimestamp(timestamp_us, rtc::TimeMicros());
 
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.captured_frames++;
+    capture_rate_.Update(1, rtc::TimeMillis());
+  }
+
   int adapted_width;
   int adapted_height;
   int crop_width;
   int crop_height;
   int crop_x;
   int crop_y;
-  if (!AdaptFrame(frame.width(), frame.height(), timestamp_us, &adapted_width,
-                  &adapted_height, &crop_width, &crop_height, &crop_x,
-                  &crop_y)) {
+  const int64_t adapt_start_us =
+      FrameTracer::Instance().enabled() ? rtc::TimeMicros() : 0;
+  const bool adapted = AdaptFrame(frame.width(), frame.height(), timestamp_us,
+                                  &adapted_width, &adapted_height, &crop_width,
+                                  &crop_height, &crop_x, &crop_y);
+  FrameTracer::Instance().Complete("AdaptFrame", timestamp_us, adapt_start_us,
+                                   rtc::TimeMicros());
+  if (!adapted) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.adapted_out_frames++;
+    return;
+  }
+
+  // マーカーを書き込むと毎回変化してしまうので、その前に判定する
+  if (IsStaticFrame(frame)) {
     return;
   }
 
+  if (latency_marker_) {
+    StampLatencyMarker(frame);
+  }
+
+  const webrtc::VideoRotation rotation =
+      static_cast<webrtc::VideoRotation>((frame.rotation() + rotation_) % 360);
+
   if (useNativeBuffer() && frame.video_frame_buffer()->type() ==
                                webrtc::VideoFrameBuffer::Type::kNative) {
     NativeBuffer* frame_buffer =
         dynamic_cast<NativeBuffer*>(frame.video_frame_buffer().get());
+    if (frame_buffer == nullptr) {
+      // ISP が縮小したレイヤーをまとめた SimulcastFrameBuffer はそのまま渡して、
+      // 各エンコーダに SimulcastFrameBuffer::SelectLayer() で選ばせる
+      webrtc::VideoFrame layered_frame(frame);
+      layered_frame.set_rotation(rotation);
+      OnFrame(layered_frame);
+      return;
+    }
+#if !USE_NVCODEC_ENCODER
+    // NvCodec は GPU 上で縮小するが、それ以外のエンコーダは NV12 を縮小しないので、
+    // I420 を経由せずにここで縮小する
+    if (frame_buffer->VideoType() == webrtc::VideoType::kNV12 &&
+        (adapted_width != frame.width() || adapted_height != frame.height())) {
+      rtc::scoped_refptr<NativeBuffer> scaled_buffer =
+          FrameBufferPool::Instance().CreateNativeBuffer(
+              webrtc::VideoType::kNV12, adapted_width, adapted_height);
+      ParallelScaler::Instance().NV12Scale(
+          frame_buffer->DataY(), frame_buffer->StrideY(),
+          frame_buffer->DataUV(), frame_buffer->StrideUV(),
+          frame_buffer->raw_width(), frame_buffer->raw_height(),
+          scaled_buffer->MutableDataY(), scaled_buffer->StrideY(),
+          scaled_buffer->MutableDataUV(), scaled_buffer->StrideUV(),
+          adapted_width, adapted_height, libyuv::kFilterBox);
+      scaled_buffer->SetLength(adapted_width * adapted_height * 3 / 2);
+      OnFrame(webrtc::VideoFrame::Builder()
+                  .set_video_frame_buffer(scaled_buffer)
+                  .set_rotation(rotation)
+                  .set_timestamp_us(translated_timestamp_us)
+                  .build());
+      return;
+    }
+#endif
     frame_buffer->SetScaledSize(adapted_width, adapted_height);
-    OnFrame(frame);
+    if (rotation != frame.rotation()) {
+      webrtc::VideoFrame rotated_frame(frame);
+      rotated_frame.set_rotation(rotation);
+      OnFrame(rotated_frame);
+    } else {
+      OnFrame(frame);
+    }
     return;
   }
 
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
       frame.video_frame_buffer();
 
-  if (adapted_width != frame.width() || adapted_height != frame.height()) {
-    // Video adapter has requested a down-scale. Allocate a new buffer and
-    // return scaled version.
-    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-        webrtc::I420Buffer::Create(adapted_width, adapted_height);
-    i420_buffer->ScaleFrom(*buffer->ToI420());
-    buffer = i420_buffer;
+  DeferredI420Buffer* deferred_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kI420
+          ? dynamic_cast<DeferredI420Buffer*>(buffer.get())
+          : nullptr;
+  if (deferred_buffer != nullptr &&
+      (adapted_width != frame.width() || adapted_height != frame.height())) {
+    // 変換を遅らせているバッファは、縮小も変換と一緒にエンコーダのスレッドで行う
+    buffer = deferred_buffer->Scale(adapted_width, adapted_height);
+  } else if (adapted_width != frame.width() ||
+             adapted_height != frame.height()) {
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> scaled_buffer;
+    if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
+      scaled_buffer =
+          ScaleNativeFrameBuffer(buffer, adapted_width, adapted_height);
+    }
+    if (scaled_buffer) {
+      buffer = scaled_buffer;
+    } else {
+      // Video adapter has requested a down-scale. Allocate a new buffer and
+      // return scaled version.
+      rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+          FrameBufferPool::Instance().CreateI420Buffer(adapted_width,
+                                                       adapted_height);
+      ParallelScaler::Instance().ScaleFrom(*buffer->ToI420(),
+                                           i420_buffer.get());
+      buffer = i420_buffer;
+    }
+  }
+
+  const int simulcast_layers = simulcast_layers_;
+  if (simulcast_layers > 1) {
+    buffer = SimulcastFrameBuffer::Create(buffer->ToI420(), simulcast_layers);
   }
 
   OnFrame(webrtc::VideoFrame::Builder()
               .set_video_frame_buffer(buffer)
-              .set_rotation(frame.rotation())
+              .set_rotation(rotation)
               .set_timestamp_us(translated_timestamp_us)
               .build());
 }
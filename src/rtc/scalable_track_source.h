@@ -12,11 +12,17 @@
 
 #include <stddef.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 
+#include "api/video/video_rotation.h"
+#include "capture_pipeline.h"
 #include "media/base/adapted_video_track_source.h"
 #include "media/base/video_adapter.h"
+#include "rtc_base/rate_statistics.h"
 #include "rtc_base/timestamp_aligner.h"
+#include "static_scene_detector.h"
 
 class ScalableVideoTrackSource : public rtc::AdaptedVideoTrackSource {
  public:
@@ -28,12 +34,92 @@ class ScalableVideoTrackSource : public rtc::AdaptedVideoTrackSource {
   webrtc::MediaSourceInterface::SourceState state() const override;
   bool remote() const override;
   void OnCapturedFrame(const webrtc::VideoFrame& frame);
+  // 2 以上を指定すると、サイマルキャスト用の縮小レイヤーをまとめたフレームを出力する
+  void SetSimulcastLayers(int num_layers);
+  // true にすると、フレームの左上にキャプチャ時刻のマーカーを書き込む (LatencyMarker を参照)
+  void SetLatencyMarker(bool enabled);
+  // true にすると、エンコーダが詰まっている間はキャプチャしたフレームを変換する前に間引く
+  void SetEncoderBackpressure(bool enabled);
+  // fps が 0 より大きい場合、映像が delay_ms の間変化しなければ fps まで間引く。
+  // I420 と NV12 のフレームのみ判定する (StaticSceneDetector を参照)
+  void SetStaticScene(int fps, int delay_ms, int threshold);
+  // キャプチャしたフレームを回転させる。デバイスで回転できない分は、フレームの回転の情報として送る。
+  // 相手が RTP の video-orientation 拡張に対応していれば受信側で回転し、
+  // 対応していなければ WebRTC が送信前に回転する
+  void SetRotation(webrtc::VideoRotation rotation);
+
+  struct CaptureStats {
+    // OnCapturedFrame() に渡されたフレーム数
+    int64_t captured_frames = 0;
+    // VideoAdapter がフレームレートを落とすために捨てたフレーム数
+    int64_t adapted_out_frames = 0;
+    // エンコーダが詰まっていたので、変換する前に捨てたフレーム数
+    int64_t backpressure_skipped_frames = 0;
+    // 映像が止まっていたので捨てたフレーム数
+    int64_t static_skipped_frames = 0;
+    // 直近 1 秒間のキャプチャのフレームレート
+    int64_t capture_fps = 0;
+  };
+  CaptureStats GetCaptureStats();
+  // CapturePipeline を使っている場合に、各ステージの累積の統計情報を取得する。
+  // 使っていない場合は false を返す。
+  virtual bool GetPipelineStats(CapturePipeline::StageStats* convert,
+                                CapturePipeline::StageStats* deliver) {
+    return false;
+  }
+  // キャプチャが止まった時に、デバイスを開き直して再開する。
+  // トラックはそのままなので PeerConnection を作り直す必要は無い。
+  // 対応していない場合や、開き直せなかった場合は false を返す
+  virtual bool Restart() { return false; }
+  // --on-demand-capture でシンクが無いためにキャプチャを止めている間は true を返す
+  virtual bool IsCapturePaused() { return false; }
 
  protected:
   virtual bool useNativeBuffer() { return false; }
+  // デバイスの機能で回転や反転ができる場合はオーバーライドする。
+  // rotation のうち、デバイスで回転できなかった分を返す
+  virtual webrtc::VideoRotation ApplyDeviceRotation(
+      webrtc::VideoRotation rotation) {
+    return rotation;
+  }
+  // キャプチャしたフレームを変換する前に呼び出して、true が返ってきたら
+  // OnCapturedFrame() を呼ばずに捨てる。キャプチャスレッドから呼び出すこと
+  bool ShouldSkipFrame();
+  // フレームのタイムスタンプを UTC のミリ秒の下位 32 ビットに変換する。
+  // タイムスタンプが rtc::TimeMicros() 基準でない場合はオーバーライドすること。
+  virtual uint32_t CaptureTimeUTCMs(int64_t timestamp_us);
+  // NativeBuffer 以外のネイティブのバッファを、I420 に変換せずに縮小できる場合は
+  // オーバーライドする。nullptr を返した場合は I420 に変換して縮小する
+  virtual rtc::scoped_refptr<webrtc::VideoFrameBuffer> ScaleNativeFrameBuffer(
+      const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+      int width,
+      int height) {
+    return nullptr;
+  }
 
  private:
+  void StampLatencyMarker(const webrtc::VideoFrame& frame);
+  bool IsStaticFrame(const webrtc::VideoFrame& frame);
+
   rtc::TimestampAligner timestamp_aligner_;
+  std::atomic<int> simulcast_layers_;
+  std::atomic<bool> latency_marker_;
+  bool latency_marker_warned_ = false;
+  std::atomic<bool> encoder_backpressure_;
+  // キャプチャしたフレームの回転に足す角度
+  std::atomic<int> rotation_{0};
+  // 詰まっている間は 2 フレームに 1 フレームを捨てる
+  bool skip_next_frame_ = false;
+  std::atomic<int> static_scene_fps_;
+  std::atomic<int> static_scene_delay_ms_;
+  std::atomic<int> static_scene_threshold_;
+  StaticSceneDetector static_scene_detector_;
+  // 起動時間の計測用に、最初のフレームだけ StartupTimer に記録する
+  std::atomic<bool> first_frame_captured_{false};
+
+  std::mutex stats_mutex_;
+  CaptureStats stats_;
+  webrtc::RateStatistics capture_rate_;
 };
 
 #endif  // VIDEO_CAPTURER_H_
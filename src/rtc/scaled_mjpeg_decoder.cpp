@@ -0,0 +1,171 @@
+#include "scaled_mjpeg_decoder.h"
+
+#if USE_SCALED_MJPEG_DECODE
+
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "frame_buffer_pool.h"
+#include "rtc_base/logging.h"
+#include "third_party/libjpeg_turbo/jpeglib.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+namespace {
+
+struct ErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf jmp;
+};
+
+void OnError(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jmp, 1);
+}
+
+// 壊れたフレームの警告がフレーム毎に出ないようにする
+void OnMessage(j_common_ptr cinfo, int msg_level) {}
+
+#if JPEG_LIB_VERSION >= 70
+int DctScaledSize(const jpeg_component_info& comp) {
+  return comp.DCT_v_scaled_size;
+}
+#else
+int DctScaledSize(const jpeg_component_info& comp) {
+  return comp.DCT_scaled_size;
+}
+#endif
+
+// longjmp で戻った時にデストラクタを飛ばさないように、libjpeg を呼んでいる間の状態は全てここに置く
+struct DecodeState {
+  jpeg_decompress_struct cinfo;
+  ErrorManager error;
+  bool created = false;
+  // 各成分のデコード先。stride と高さは iMCU の単位に切り上げてある
+  std::vector<uint8_t> planes[3];
+  int strides[3] = {};
+  int heights[3] = {};
+  // 各成分の画像の大きさ。comp_info は jpeg_finish_decompress() で解放されるので取っておく
+  int widths[3] = {};
+  int rows[3] = {};
+  // jpeg_read_raw_data() に渡す各成分の行
+  std::vector<JSAMPROW> row_pointers[3];
+
+  ~DecodeState() {
+    if (created) {
+      jpeg_destroy_decompress(&cinfo);
+    }
+  }
+};
+
+int ScaleDenom(int src_width, int src_height, int min_width, int min_height) {
+  int denom = 1;
+  while (denom < 8 && (src_width + denom * 2 - 1) / (denom * 2) >= min_width &&
+         (src_height + denom * 2 - 1) / (denom * 2) >= min_height) {
+    denom *= 2;
+  }
+  return denom;
+}
+
+}  // namespace
+
+rtc::scoped_refptr<webrtc::I420Buffer> DecodeScaledMJPEG(const uint8_t* data,
+                                                         size_t size,
+                                                         int min_width,
+                                                         int min_height) {
+  std::unique_ptr<DecodeState> state(new DecodeState());
+  jpeg_decompress_struct& cinfo = state->cinfo;
+  cinfo.err = jpeg_std_error(&state->error.pub);
+  state->error.pub.error_exit = OnError;
+  state->error.pub.emit_message = OnMessage;
+  if (setjmp(state->error.jmp)) {
+    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": Failed to decode";
+    return nullptr;
+  }
+  jpeg_create_decompress(&cinfo);
+  state->created = true;
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data),
+               static_cast<unsigned long>(size));
+  jpeg_read_header(&cinfo, TRUE);
+  if (cinfo.num_components != 3 || cinfo.jpeg_color_space != JCS_YCbCr) {
+    return nullptr;
+  }
+  const int denom = ScaleDenom(cinfo.image_width, cinfo.image_height,
+                               min_width, min_height);
+  if (denom == 1) {
+    return nullptr;
+  }
+  // 色変換とアップサンプリングをせずに、各成分をそのまま取り出す
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = denom;
+  cinfo.raw_data_out = TRUE;
+  cinfo.do_fancy_upsampling = FALSE;
+  cinfo.dct_method = JDCT_IFAST;
+  jpeg_start_decompress(&cinfo);
+
+  const int width = cinfo.output_width;
+  const int height = cinfo.output_height;
+  int rows_per_imcu = 0;
+  for (int i = 0; i < 3; i++) {
+    rows_per_imcu = std::max(rows_per_imcu,
+                             cinfo.comp_info[i].v_samp_factor *
+                                 DctScaledSize(cinfo.comp_info[i]));
+  }
+  const int num_imcu = (height + rows_per_imcu - 1) / rows_per_imcu;
+  for (int i = 0; i < 3; i++) {
+    const jpeg_component_info& comp = cinfo.comp_info[i];
+    state->strides[i] = comp.width_in_blocks * DctScaledSize(comp);
+    state->heights[i] = num_imcu * comp.v_samp_factor * DctScaledSize(comp);
+    state->planes[i].resize(state->strides[i] * state->heights[i]);
+    state->widths[i] = comp.downsampled_width;
+    state->rows[i] = comp.downsampled_height;
+  }
+
+  auto& rows = state->row_pointers;
+  for (int i = 0; i < 3; i++) {
+    rows[i].resize(cinfo.comp_info[i].v_samp_factor *
+                   DctScaledSize(cinfo.comp_info[i]));
+  }
+  JSAMPARRAY image[3] = {rows[0].data(), rows[1].data(), rows[2].data()};
+  for (int imcu = 0; cinfo.output_scanline < cinfo.output_height; imcu++) {
+    for (int i = 0; i < 3; i++) {
+      for (size_t row = 0; row < rows[i].size(); row++) {
+        rows[i][row] = state->planes[i].data() +
+                       (imcu * rows[i].size() + row) * state->strides[i];
+      }
+    }
+    if (jpeg_read_raw_data(&cinfo, image, rows_per_imcu) == 0) {
+      return nullptr;
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+
+  // 4:2:2 などの場合も、色差を縮小して I420 に合わせる
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      FrameBufferPool::Instance().CreateI420Buffer(width, height);
+  libyuv::CopyPlane(state->planes[0].data(), state->strides[0],
+                    buffer->MutableDataY(), buffer->StrideY(), width, height);
+  uint8_t* dst_planes[] = {buffer->MutableDataU(), buffer->MutableDataV()};
+  const int dst_strides[] = {buffer->StrideU(), buffer->StrideV()};
+  for (int i = 1; i < 3; i++) {
+    libyuv::ScalePlane(state->planes[i].data(), state->strides[i],
+                       state->widths[i], state->rows[i], dst_planes[i - 1],
+                       dst_strides[i - 1],
+                       buffer->ChromaWidth(), buffer->ChromaHeight(),
+                       libyuv::kFilterBox);
+  }
+  return buffer;
+}
+
+#else
+
+rtc::scoped_refptr<webrtc::I420Buffer> DecodeScaledMJPEG(const uint8_t* data,
+                                                         size_t size,
+                                                         int min_width,
+                                                         int min_height) {
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SCALED_MJPEG_DECODER_H_
+#define SCALED_MJPEG_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "api/scoped_refptr.h"
+#include "api/video/i420_buffer.h"
+
+// MJPEG のフレームを、libjpeg の DCT スケーリングで 1/2、1/4、1/8 に縮小しながら I420 にデコードする。
+//
+// min_width x min_height 以上になる一番小さい大きさでデコードするので、
+// 全体をデコードしてから縮小するよりも少ない計算で済む。結果の大きさは min_width x min_height と一致するとは限らない。
+// 縮小できない大きさの場合や、デコードできない場合、libjpeg-turbo が使えないビルドの場合は nullptr を返す。
+rtc::scoped_refptr<webrtc::I420Buffer> DecodeScaledMJPEG(const uint8_t* data,
+                                                         size_t size,
+                                                         int min_width,
+                                                         int min_height);
+
+#endif  // SCALED_MJPEG_DECODER_H_
@@ -0,0 +1,349 @@
+#include "shared_video_encoder.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "api/video/video_bitrate_allocation.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// キーフレーム要求をまとめる間隔。
+// 複数の接続で同時にパケットロスが起きた時に、キーフレームを続けて出さないようにする
+const int64_t kMinKeyFrameIntervalMs = 300;
+
+bool IsSameCodecSettings(const webrtc::VideoCodec& a,
+                         const webrtc::VideoCodec& b) {
+  if (a.codecType != b.codecType || a.width != b.width ||
+      a.height != b.height || a.maxFramerate != b.maxFramerate ||
+      a.mode != b.mode ||
+      a.numberOfSimulcastStreams != b.numberOfSimulcastStreams) {
+    return false;
+  }
+  for (int i = 0; i < a.numberOfSimulcastStreams; i++) {
+    if (a.simulcastStream[i].width != b.simulcastStream[i].width ||
+        a.simulcastStream[i].height != b.simulcastStream[i].height) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+class SharedVideoEncoderFactory::Group : public webrtc::EncodedImageCallback {
+ public:
+  Group(const webrtc::SdpVideoFormat& format,
+        const webrtc::VideoCodec& codec_settings,
+        std::unique_ptr<webrtc::VideoEncoder> encoder)
+      : format_(format),
+        codec_settings_(codec_settings),
+        encoder_(std::move(encoder)) {
+    encoder_->RegisterEncodeCompleteCallback(this);
+  }
+  ~Group() override {
+    std::lock_guard<std::mutex> lock(encode_mutex_);
+    encoder_->Release();
+  }
+
+  bool Matches(const webrtc::SdpVideoFormat& format,
+               const webrtc::VideoCodec& codec_settings) const {
+    return format_ == format &&
+           IsSameCodecSettings(codec_settings_, codec_settings);
+  }
+
+  void Join(SharedVideoEncoder* encoder) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Member member;
+    member.encoder = encoder;
+    std::fill(std::begin(member.active), std::end(member.active), true);
+    std::fill(std::begin(member.need_key_frame),
+              std::end(member.need_key_frame), true);
+    members_.push_back(member);
+    // 途中から参加した接続はキーフレームが来るまで映像を復号できない
+    key_frame_requested_ = true;
+    RTC_LOG(LS_INFO) << "SharedVideoEncoder: members=" << members_.size();
+  }
+
+  void Leave(SharedVideoEncoder* encoder) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_.erase(
+        std::remove_if(members_.begin(), members_.end(),
+                       [encoder](const Member& m) {
+                         return m.encoder == encoder;
+                       }),
+        members_.end());
+    RTC_LOG(LS_INFO) << "SharedVideoEncoder: members=" << members_.size();
+  }
+
+  int32_t Encode(const webrtc::VideoFrame& frame,
+                 const std::vector<webrtc::VideoFrameType>* frame_types) {
+    std::vector<webrtc::VideoFrameType> types(
+        frame_types != nullptr ? frame_types->size() : 1,
+        webrtc::VideoFrameType::kVideoFrameDelta);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (frame_types != nullptr &&
+          std::find(frame_types->begin(), frame_types->end(),
+                    webrtc::VideoFrameType::kVideoFrameKey) !=
+              frame_types->end()) {
+        key_frame_requested_ = true;
+      }
+      // 全ての接続に同じフレームが渡されるので、最初に来た接続のものだけエンコードする。
+      // RTP タイムスタンプは接続毎に数ミリ秒ずれることがあるので、キャプチャ時刻で比べる
+      if (last_timestamp_us_ >= 0 &&
+          frame.timestamp_us() <= last_timestamp_us_) {
+        return WEBRTC_VIDEO_CODEC_OK;
+      }
+      last_timestamp_us_ = frame.timestamp_us();
+
+      const int64_t now_ms = rtc::TimeMillis();
+      if (key_frame_requested_ &&
+          (last_key_frame_ms_ < 0 ||
+           now_ms - last_key_frame_ms_ >= kMinKeyFrameIntervalMs)) {
+        key_frame_requested_ = false;
+        last_key_frame_ms_ = now_ms;
+        std::fill(types.begin(), types.end(),
+                  webrtc::VideoFrameType::kVideoFrameKey);
+      }
+    }
+    // エンコーダが同期的に OnEncodedImage を呼ぶことがあるので、mutex_ を持ったまま呼ばない
+    std::lock_guard<std::mutex> lock(encode_mutex_);
+    return encoder_->Encode(frame, &types);
+  }
+
+  void SetRates(SharedVideoEncoder* encoder,
+                const webrtc::VideoEncoder::RateControlParameters& parameters) {
+    webrtc::VideoEncoder::RateControlParameters merged;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto& member : members_) {
+        if (member.encoder != encoder) {
+          continue;
+        }
+        for (size_t si = 0; si < webrtc::kMaxSpatialLayers; si++) {
+          bool active = parameters.bitrate.GetSpatialLayerSum(si) > 0;
+          if (active && !member.active[si]) {
+            // 止めていたレイヤーを再開する時は、キーフレームから送る
+            member.need_key_frame[si] = true;
+            key_frame_requested_ = true;
+          }
+          member.active[si] = active;
+        }
+        member.rates = parameters;
+        member.has_rates = true;
+      }
+
+      // 一番速い接続に合わせる。遅い接続にはレイヤーの選択で対応する
+      for (const auto& member : members_) {
+        if (!member.has_rates) {
+          continue;
+        }
+        for (size_t si = 0; si < webrtc::kMaxSpatialLayers; si++) {
+          for (size_t ti = 0; ti < webrtc::kMaxTemporalStreams; ti++) {
+            if (!member.rates.bitrate.HasBitrate(si, ti)) {
+              continue;
+            }
+            uint32_t bitrate = member.rates.bitrate.GetBitrate(si, ti);
+            if (!merged.bitrate.HasBitrate(si, ti) ||
+                merged.bitrate.GetBitrate(si, ti) < bitrate) {
+              merged.bitrate.SetBitrate(si, ti, bitrate);
+            }
+          }
+        }
+        merged.framerate_fps =
+            std::max(merged.framerate_fps, member.rates.framerate_fps);
+        merged.bandwidth_allocation = std::max(
+            merged.bandwidth_allocation, member.rates.bandwidth_allocation);
+      }
+    }
+    std::lock_guard<std::mutex> lock(encode_mutex_);
+    encoder_->SetRates(merged);
+  }
+
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const {
+    return encoder_->GetEncoderInfo();
+  }
+
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override {
+    const size_t layer =
+        std::min<size_t>(encoded_image.SpatialIndex().value_or(0),
+                         webrtc::kMaxSpatialLayers - 1);
+    const bool key_frame =
+        encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& member : members_) {
+      if (!member.active[layer]) {
+        continue;
+      }
+      if (member.need_key_frame[layer]) {
+        if (!key_frame) {
+          continue;
+        }
+        member.need_key_frame[layer] = false;
+      }
+      member.encoder->Deliver(encoded_image, codec_specific_info,
+                              fragmentation);
+    }
+    return webrtc::EncodedImageCallback::Result(
+        webrtc::EncodedImageCallback::Result::OK);
+  }
+
+ private:
+  struct Member {
+    SharedVideoEncoder* encoder = nullptr;
+    webrtc::VideoEncoder::RateControlParameters rates;
+    bool has_rates = false;
+    // この接続のビットレート配分で有効になっているレイヤー。
+    // SetRates() が呼ばれるまでは全てのレイヤーを送る
+    bool active[webrtc::kMaxSpatialLayers];
+    bool need_key_frame[webrtc::kMaxSpatialLayers];
+  };
+
+  const webrtc::SdpVideoFormat format_;
+  const webrtc::VideoCodec codec_settings_;
+
+  std::mutex mutex_;
+  std::vector<Member> members_;
+  int64_t last_timestamp_us_ = -1;
+  bool key_frame_requested_ = false;
+  int64_t last_key_frame_ms_ = -1;
+
+  std::mutex encode_mutex_;
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+};
+
+SharedVideoEncoderFactory::SharedVideoEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> factory)
+    : factory_(std::move(factory)) {}
+
+SharedVideoEncoderFactory::~SharedVideoEncoderFactory() {}
+
+std::vector<webrtc::SdpVideoFormat>
+SharedVideoEncoderFactory::GetSupportedFormats() const {
+  return factory_->GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+SharedVideoEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return factory_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+SharedVideoEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  return std::unique_ptr<webrtc::VideoEncoder>(
+      new SharedVideoEncoder(this, format));
+}
+
+std::shared_ptr<SharedVideoEncoderFactory::Group>
+SharedVideoEncoderFactory::Join(const webrtc::SdpVideoFormat& format,
+                                const webrtc::VideoCodec& codec_settings,
+                                const webrtc::VideoEncoder::Settings& settings,
+                                SharedVideoEncoder* member) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  groups_.erase(std::remove_if(groups_.begin(), groups_.end(),
+                               [](const std::weak_ptr<Group>& group) {
+                                 return group.expired();
+                               }),
+                groups_.end());
+  for (const auto& weak_group : groups_) {
+    std::shared_ptr<Group> group = weak_group.lock();
+    if (group && group->Matches(format, codec_settings)) {
+      group->Join(member);
+      return group;
+    }
+  }
+
+  std::unique_ptr<webrtc::VideoEncoder> encoder =
+      factory_->CreateVideoEncoder(format);
+  if (!encoder) {
+    return nullptr;
+  }
+  int32_t ret = encoder->InitEncode(&codec_settings, settings);
+  if (ret != WEBRTC_VIDEO_CODEC_OK) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": InitEncode failed. error=" << ret;
+    return nullptr;
+  }
+  std::shared_ptr<Group> group =
+      std::make_shared<Group>(format, codec_settings, std::move(encoder));
+  group->Join(member);
+  groups_.push_back(group);
+  return group;
+}
+
+SharedVideoEncoder::SharedVideoEncoder(SharedVideoEncoderFactory* factory,
+                                       const webrtc::SdpVideoFormat& format)
+    : factory_(factory), format_(format) {}
+
+SharedVideoEncoder::~SharedVideoEncoder() {
+  Release();
+}
+
+int32_t SharedVideoEncoder::InitEncode(
+    const webrtc::VideoCodec* codec_settings,
+    const webrtc::VideoEncoder::Settings& settings) {
+  Release();
+  group_ = factory_->Join(format_, *codec_settings, settings, this);
+  if (!group_) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t SharedVideoEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  std::lock_guard<std::mutex> lock(callback_mutex_);
+  callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t SharedVideoEncoder::Release() {
+  if (group_) {
+    group_->Leave(this);
+    // 最後の接続が抜けたら、ここでエンコーダが破棄される
+    group_ = nullptr;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t SharedVideoEncoder::Encode(
+    const webrtc::VideoFrame& frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  if (!group_) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+  return group_->Encode(frame, frame_types);
+}
+
+void SharedVideoEncoder::SetRates(const RateControlParameters& parameters) {
+  if (group_) {
+    group_->SetRates(this, parameters);
+  }
+}
+
+webrtc::VideoEncoder::EncoderInfo SharedVideoEncoder::GetEncoderInfo() const {
+  if (group_) {
+    return group_->GetEncoderInfo();
+  }
+  return EncoderInfo();
+}
+
+webrtc::EncodedImageCallback::Result SharedVideoEncoder::Deliver(
+    const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const webrtc::RTPFragmentationHeader* fragmentation) {
+  std::lock_guard<std::mutex> lock(callback_mutex_);
+  if (callback_ == nullptr) {
+    return webrtc::EncodedImageCallback::Result(
+        webrtc::EncodedImageCallback::Result::ERROR_SEND_FAILED);
+  }
+  return callback_->OnEncodedImage(encoded_image, codec_specific_info,
+                                   fragmentation);
+}
@@ -0,0 +1,85 @@
+#ifndef SHARED_VIDEO_ENCODER_H_
+#define SHARED_VIDEO_ENCODER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+
+class SharedVideoEncoder;
+
+// 同じトラックを複数の接続に送信する時に、接続毎にエンコードせずに 1 つのエンコーダの出力を共有するファクトリ。
+//
+// 同じフォーマットと設定で InitEncode() されたエンコーダは 1 つのグループにまとめられ、
+// 最初に Encode() されたフレームだけを実際にエンコードして、グループの全ての接続に出力する。
+// キーフレーム要求はまとめて 1 回のキーフレームにし、ビットレートは接続毎の要求のうち最大のものを使う。
+// 回線が細い接続には、その接続のビットレート配分で止められているサイマルキャストのレイヤーを送らない。
+class SharedVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  explicit SharedVideoEncoderFactory(
+      std::unique_ptr<webrtc::VideoEncoderFactory> factory);
+  ~SharedVideoEncoderFactory() override;
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+ private:
+  friend class SharedVideoEncoder;
+  class Group;
+
+  // 設定が同じグループに参加する。無ければエンコーダを作ってグループを作る
+  std::shared_ptr<Group> Join(const webrtc::SdpVideoFormat& format,
+                              const webrtc::VideoCodec& codec_settings,
+                              const webrtc::VideoEncoder::Settings& settings,
+                              SharedVideoEncoder* member);
+
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  std::mutex mutex_;
+  std::vector<std::weak_ptr<Group>> groups_;
+};
+
+// 接続毎に作られるエンコーダ。実際のエンコードはグループに任せる
+class SharedVideoEncoder : public webrtc::VideoEncoder {
+ public:
+  SharedVideoEncoder(SharedVideoEncoderFactory* factory,
+                     const webrtc::SdpVideoFormat& format);
+  ~SharedVideoEncoder() override;
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const webrtc::VideoEncoder::Settings& settings) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+ private:
+  friend class SharedVideoEncoderFactory::Group;
+
+  webrtc::EncodedImageCallback::Result Deliver(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation);
+
+  SharedVideoEncoderFactory* factory_;
+  const webrtc::SdpVideoFormat format_;
+  std::shared_ptr<SharedVideoEncoderFactory::Group> group_;
+
+  std::mutex callback_mutex_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+};
+
+#endif  // SHARED_VIDEO_ENCODER_H_
@@ -0,0 +1,272 @@
+#include "shm_frame_exporter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <new>
+
+// WebRTC
+#include "api/video/i420_buffer.h"
+#include "rtc_base/logging.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+#include "native_buffer.h"
+#include "simulcast_frame_buffer.h"
+#include "thread_placement.h"
+
+namespace {
+
+const size_t kAlignment = 64;
+
+size_t Align(size_t size) {
+  return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+}  // namespace
+
+std::unique_ptr<ShmFrameExporter> ShmFrameExporter::Create(
+    Settings settings,
+    rtc::scoped_refptr<ScalableVideoTrackSource> source) {
+  if (settings.name.empty() || settings.num_slots <= 0 ||
+      settings.max_width <= 0 || settings.max_height <= 0 || !source) {
+    return nullptr;
+  }
+  std::string name = settings.name;
+  if (name[0] != '/') {
+    name = "/" + name;
+  }
+
+  const int chroma_width = (settings.max_width + 1) / 2;
+  const int chroma_height = (settings.max_height + 1) / 2;
+  const size_t capacity =
+      static_cast<size_t>(settings.max_width) * settings.max_height +
+      static_cast<size_t>(chroma_width) * chroma_height * 2;
+  const size_t header_bytes = Align(sizeof(momo_shm::ShmFrameHeader));
+  const size_t data_offset = Align(sizeof(momo_shm::ShmFrameSlot));
+  const size_t slot_stride = data_offset + Align(capacity);
+  const size_t size = header_bytes + slot_stride * settings.num_slots;
+
+  // 前回の Momo が残したものは、読んでいるプロセスがいても作り直す
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to create shared memory " << name << ": "
+                      << strerror(errno);
+    return nullptr;
+  }
+  if (ftruncate(fd, size) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to resize shared memory " << name << ": "
+                      << strerror(errno);
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    RTC_LOG(LS_ERROR) << "Failed to mmap shared memory " << name << ": "
+                      << strerror(errno);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  uint8_t* memory = static_cast<uint8_t*>(p);
+
+  // ftruncate() した領域は 0 で埋まっているので、各カウンタは 0 から始まる
+  momo_shm::ShmFrameHeader* header = new (memory) momo_shm::ShmFrameHeader();
+  header->magic = momo_shm::kMagic;
+  header->version = momo_shm::kVersion;
+  header->num_slots = settings.num_slots;
+  header->slot_capacity = static_cast<uint32_t>(capacity);
+  header->header_bytes = header_bytes;
+  header->slot_stride = slot_stride;
+  header->data_offset = data_offset;
+  header->latest_slot.store(momo_shm::kNoSlot);
+  header->frame_count.store(0);
+  header->oversized_frames.store(0);
+  header->busy_frames.store(0);
+  for (int i = 0; i < settings.num_slots; i++) {
+    momo_shm::ShmFrameSlot* slot = new (memory + header_bytes + slot_stride * i)
+        momo_shm::ShmFrameSlot();
+    slot->sequence.store(0);
+    slot->readers.store(0);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  RTC_LOG(LS_INFO) << "Exporting frames to shared memory " << name << " ("
+                   << settings.num_slots << " slots, " << size << " bytes)";
+  return std::unique_ptr<ShmFrameExporter>(
+      new ShmFrameExporter(name, memory, size, source));
+}
+
+ShmFrameExporter::ShmFrameExporter(
+    std::string name,
+    uint8_t* memory,
+    size_t size,
+    rtc::scoped_refptr<ScalableVideoTrackSource> source)
+    : name_(std::move(name)),
+      memory_(memory),
+      size_(size),
+      header_(reinterpret_cast<momo_shm::ShmFrameHeader*>(memory)),
+      source_(source) {
+  writer_thread_.reset(new rtc::PlatformThread(
+      ShmFrameExporter::WriterThread, this, "ShmFrameExporter",
+      rtc::kNormalPriority));
+  writer_thread_->Start();
+  source_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+}
+
+ShmFrameExporter::~ShmFrameExporter() {
+  source_->RemoveSink(this);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cond_.notify_all();
+  writer_thread_->Stop();
+  if (dropped_frames_ > 0) {
+    RTC_LOG(LS_INFO) << "ShmFrameExporter skipped " << dropped_frames_
+                     << " frames";
+  }
+  munmap(memory_, size_);
+  shm_unlink(name_.c_str());
+}
+
+void ShmFrameExporter::OnFrame(const webrtc::VideoFrame& frame) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_) {
+      dropped_frames_++;
+    }
+    pending_.reset(new webrtc::VideoFrame(frame));
+  }
+  cond_.notify_one();
+}
+
+void ShmFrameExporter::WriterThread(void* obj) {
+  ThreadPlacement::Instance().Apply("exporter");
+  static_cast<ShmFrameExporter*>(obj)->WriterLoop();
+}
+
+void ShmFrameExporter::WriterLoop() {
+  while (true) {
+    std::unique_ptr<webrtc::VideoFrame> frame;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return stopped_ || pending_; });
+      if (stopped_) {
+        return;
+      }
+      frame = std::move(pending_);
+    }
+    Write(*frame);
+  }
+}
+
+void ShmFrameExporter::Write(const webrtc::VideoFrame& frame) {
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      SimulcastFrameBuffer::SelectLayer(frame.video_frame_buffer(),
+                                        frame.width(), frame.height());
+  NativeBuffer* native_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(buffer.get())
+          : nullptr;
+  // 縮小を指定されている NV12 は、ToI420() で縮小してから書き出す
+  const bool nv12 = native_buffer != nullptr &&
+                    native_buffer->VideoType() == webrtc::VideoType::kNV12 &&
+                    native_buffer->raw_width() == native_buffer->width() &&
+                    native_buffer->raw_height() == native_buffer->height();
+  rtc::scoped_refptr<webrtc::I420BufferInterface> i420;
+  if (!nv12) {
+    i420 = buffer->ToI420();
+    if (!i420) {
+      return;
+    }
+  }
+
+  const int width = buffer->width();
+  const int height = buffer->height();
+  const int chroma_width = (width + 1) / 2;
+  const int chroma_height = (height + 1) / 2;
+  const size_t y_bytes = static_cast<size_t>(width) * height;
+  const size_t chroma_bytes = static_cast<size_t>(chroma_width) * chroma_height;
+  const size_t data_bytes = y_bytes + chroma_bytes * 2;
+  if (data_bytes > header_->slot_capacity) {
+    if (header_->oversized_frames.fetch_add(1) == 0) {
+      RTC_LOG(LS_WARNING) << "ShmFrameExporter: " << width << "x" << height
+                          << " does not fit in the shared memory slot";
+    }
+    return;
+  }
+
+  // 最後に書いたスロットの次から、読む側に固定されていないスロットを探す
+  uint8_t* slot_memory = nullptr;
+  uint32_t index = header_->latest_slot.load(std::memory_order_relaxed);
+  uint32_t sequence = 0;
+  for (uint32_t i = 0; i < header_->num_slots; i++) {
+    index = index == momo_shm::kNoSlot ? 0 : (index + 1) % header_->num_slots;
+    uint8_t* candidate =
+        memory_ + header_->header_bytes + header_->slot_stride * index;
+    momo_shm::ShmFrameSlot* slot =
+        reinterpret_cast<momo_shm::ShmFrameSlot*>(candidate);
+    if (slot->readers.load() != 0) {
+      continue;
+    }
+    sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1);
+    // 奇数にする前に固定されていた場合は、何も書かずに偶数に戻す
+    if (slot->readers.load() != 0) {
+      slot->sequence.store(sequence + 2);
+      continue;
+    }
+    slot_memory = candidate;
+    break;
+  }
+  if (slot_memory == nullptr) {
+    header_->busy_frames.fetch_add(1);
+    return;
+  }
+  momo_shm::ShmFrameSlot* slot =
+      reinterpret_cast<momo_shm::ShmFrameSlot*>(slot_memory);
+  uint8_t* data = slot_memory + header_->data_offset;
+
+  slot->width = width;
+  slot->height = height;
+  slot->data_bytes = static_cast<uint32_t>(data_bytes);
+  slot->rtp_timestamp = frame.timestamp();
+  slot->timestamp_us = frame.timestamp_us();
+  slot->frame_number = frame_number_++;
+  if (nv12) {
+    slot->format = momo_shm::kNV12;
+    slot->offsets[0] = 0;
+    slot->offsets[1] = static_cast<uint32_t>(y_bytes);
+    slot->offsets[2] = 0;
+    slot->strides[0] = width;
+    slot->strides[1] = chroma_width * 2;
+    slot->strides[2] = 0;
+    libyuv::CopyPlane(native_buffer->DataY(), native_buffer->StrideY(), data,
+                      width, width, height);
+    libyuv::CopyPlane(native_buffer->DataUV(), native_buffer->StrideUV(),
+                      data + y_bytes, chroma_width * 2, chroma_width * 2,
+                      chroma_height);
+  } else {
+    slot->format = momo_shm::kI420;
+    slot->offsets[0] = 0;
+    slot->offsets[1] = static_cast<uint32_t>(y_bytes);
+    slot->offsets[2] = static_cast<uint32_t>(y_bytes + chroma_bytes);
+    slot->strides[0] = width;
+    slot->strides[1] = chroma_width;
+    slot->strides[2] = chroma_width;
+    libyuv::I420Copy(i420->DataY(), i420->StrideY(), i420->DataU(),
+                     i420->StrideU(), i420->DataV(), i420->StrideV(), data,
+                     width, data + slot->offsets[1], chroma_width,
+                     data + slot->offsets[2], chroma_width, width, height);
+  }
+
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  header_->latest_slot.store(index, std::memory_order_release);
+  header_->frame_count.fetch_add(1);
+}
@@ -0,0 +1,76 @@
+#ifndef SHM_FRAME_EXPORTER_H_
+#define SHM_FRAME_EXPORTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "rtc_base/platform_thread.h"
+#include "scalable_track_source.h"
+#include "shm_frame_layout.h"
+
+// キャプチャしたフレームを POSIX 共有メモリのリングに書き出して、同じマシンの別のプロセスから
+// 読めるようにする (Linux のみ)。配置と読み方は shm_frame_layout.h を参照。
+//
+// カメラのデバイスは 1 つのプロセスからしか開けないので、解析などのプロセスは Momo から
+// フレームを受け取る。ソースのシンクとして登録し、OnFrame() ではバッファの参照を
+// 受け取るだけで、共有メモリへのコピーは専用のスレッドで行う。コピーが間に合わない場合は
+// 古いフレームを捨てて最新のフレームを書くので、送信している映像は待たされない。
+//
+// 書き出すのは VideoAdapter で縮小した後の、エンコーダに渡すものと同じフレーム。
+// NV12 の NativeBuffer はそのまま、それ以外は I420 にして書き出す。
+// 読む側に固定されているスロットには書かず、全て固定されていればフレームを捨てる。
+class ShmFrameExporter : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  struct Settings {
+    // shm_open() に渡す名前。'/' で始まっていなければ先頭に付ける
+    std::string name;
+    int num_slots = 3;
+    // この解像度の I420 が入る大きさのスロットを確保する
+    int max_width = 0;
+    int max_height = 0;
+  };
+
+  // 共有メモリを作れなかった場合は nullptr を返す
+  static std::unique_ptr<ShmFrameExporter> Create(
+      Settings settings,
+      rtc::scoped_refptr<ScalableVideoTrackSource> source);
+  ~ShmFrameExporter() override;
+
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+
+ private:
+  ShmFrameExporter(std::string name,
+                   uint8_t* memory,
+                   size_t size,
+                   rtc::scoped_refptr<ScalableVideoTrackSource> source);
+
+  static void WriterThread(void* obj);
+  void WriterLoop();
+  void Write(const webrtc::VideoFrame& frame);
+
+  const std::string name_;
+  uint8_t* const memory_;
+  const size_t size_;
+  momo_shm::ShmFrameHeader* const header_;
+  rtc::scoped_refptr<ScalableVideoTrackSource> source_;
+  std::unique_ptr<rtc::PlatformThread> writer_thread_;
+  // 書き込みスレッドからのみ触る
+  uint64_t frame_number_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopped_ = false;
+  // まだ書き出していない最新のフレーム
+  std::unique_ptr<webrtc::VideoFrame> pending_;
+  int64_t dropped_frames_ = 0;
+};
+
+#endif  // SHM_FRAME_EXPORTER_H_
@@ -0,0 +1,108 @@
+#ifndef SHM_FRAME_LAYOUT_H_
+#define SHM_FRAME_LAYOUT_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+// POSIX 共有メモリを使って、同じマシンのプロセスとの間でフレームを受け渡す時の配置。
+//
+// ShmFrameExporter は Momo がキャプチャしたフレームを書き、ShmVideoCapturer は
+// 他のプロセスが書いたフレームを読む。どちらも同じ配置と手順を使う。
+// libwebrtc には依存していないので、このヘッダだけをコピーして使って良い。
+//
+// 共有メモリの先頭に ShmFrameHeader があり、header_bytes の位置から slot_stride 毎に
+// num_slots 個のスロットが並ぶ。各スロットの先頭には ShmFrameSlot があり、
+// スロットの先頭から data_offset の位置にフレームのデータがある。
+// 共有メモリは書く側が作り、終わったら shm_unlink() する。
+//
+// 各スロットは seqlock で守られている。読む側はコピーせずにデータを直接参照できる。
+// 書く側は読む側を待たないので、参照している間に上書きされたくない場合は readers を増やして
+// スロットを固定する。書く側は readers が 0 でないスロットには書かない。
+//
+//   uint32_t index = header->latest_slot.load(std::memory_order_acquire);
+//   if (index == kNoSlot) retry;  // まだ 1 枚も書かれていない
+//   ShmFrameSlot* slot = <index 番目のスロット>;
+//   uint32_t seq = slot->sequence.load();
+//   if (seq & 1) retry;  // 書き込み中
+//   slot->readers.fetch_add(1);  // 固定しない場合は不要
+//   if (slot->sequence.load() != seq) { readers を戻して retry; }
+//   ... slot のフィールドとデータを読む ...
+//   slot->readers.fetch_sub(1);
+//
+// 固定しない場合は、読み終わった後に std::atomic_thread_fence(std::memory_order_acquire) を
+// 挟んでから sequence が seq のままであることを確認し、変わっていたら読んだものを捨てる。
+//
+// 書く側は readers が 0 のスロットを選んで以下のように書く。sequence と readers は
+// seq_cst で読み書きするので、固定と書き込みが同時に起きてもどちらかが気付く。
+//
+//   slot->sequence.store(seq + 1);
+//   if (slot->readers.load() != 0) { slot->sequence.store(seq + 2); 別のスロットを探す; }
+//   ... slot のフィールドとデータを書く ...
+//   slot->sequence.store(seq + 2, std::memory_order_release);
+//   header->latest_slot.store(index, std::memory_order_release);
+//   header->frame_count.fetch_add(1);
+
+namespace momo_shm {
+
+// "MOMO"
+const uint32_t kMagic = 0x4f4d4f4d;
+const uint32_t kVersion = 1;
+// latest_slot がまだ書かれていないことを表す
+const uint32_t kNoSlot = 0xffffffff;
+
+enum Format : uint32_t {
+  // Y, U, V の 3 プレーン
+  kI420 = 1,
+  // Y と、U と V が交互に並んだ 2 プレーン
+  kNV12 = 2,
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared memory requires lock-free atomics");
+
+struct ShmFrameHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_slots;
+  // 1 スロットに入るデータの最大の大きさ
+  uint32_t slot_capacity;
+  // 最初のスロットの位置と、スロットの間隔
+  uint64_t header_bytes;
+  uint64_t slot_stride;
+  // スロットの先頭からデータまでの位置
+  uint64_t data_offset;
+  // 最後に書いたスロットの番号
+  std::atomic<uint32_t> latest_slot;
+  uint32_t reserved;
+  // これまでに書いたフレーム数
+  std::atomic<uint64_t> frame_count;
+  // 大きすぎてスロットに入らなかったフレーム数
+  std::atomic<uint64_t> oversized_frames;
+  // 全てのスロットが固定されていたので書けなかったフレーム数
+  std::atomic<uint64_t> busy_frames;
+};
+
+struct ShmFrameSlot {
+  // 奇数の間は書き込み中
+  std::atomic<uint32_t> sequence;
+  // このスロットを固定している読む側の数
+  std::atomic<uint32_t> readers;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  // 各プレーンのデータの先頭からの位置と、1 行のバイト数。NV12 の場合は 2 つだけ使う
+  uint32_t offsets[3];
+  uint32_t strides[3];
+  uint32_t data_bytes;
+  // webrtc::VideoFrame の RTP タイムスタンプ。FrameTracer のフレームの番号と同じ
+  uint32_t rtp_timestamp;
+  // キャプチャした時刻。CLOCK_MONOTONIC のマイクロ秒 (Momo の rtc::TimeMicros() と同じ)
+  int64_t timestamp_us;
+  // 書いたフレームの通し番号。読む側は新しいフレームが来たかをこれで判断する
+  uint64_t frame_number;
+};
+
+}  // namespace momo_shm
+
+#endif  // SHM_FRAME_LAYOUT_H_
@@ -0,0 +1,318 @@
+#include "shm_video_capturer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "api/video/i420_buffer.h"
+#include "common_video/include/video_frame_buffer.h"
+#include "frame_buffer_pool.h"
+#include "native_buffer.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+#include "thread_placement.h"
+
+namespace {
+
+// 新しいフレームが書かれたかを確認する間隔
+const int kPollIntervalMs = 1;
+// 開けなかった場合に開き直す間隔
+const int kReopenIntervalMs = 500;
+// この間新しいフレームが書かれなければ、書く側が作り直したかもしれないので開き直す
+const int64_t kStaleUs = 2 * rtc::kNumMicrosecsPerSec;
+
+// プレーンがスロットの中に収まっているか
+bool PlaneFits(uint32_t offset,
+               uint32_t stride,
+               int min_stride,
+               int rows,
+               uint32_t capacity) {
+  return stride >= static_cast<uint32_t>(min_stride) &&
+         static_cast<uint64_t>(offset) +
+                 static_cast<uint64_t>(stride) * rows <=
+             capacity;
+}
+
+}  // namespace
+
+// マップした共有メモリ。固定したスロットのバッファが全て無くなるまでアンマップしない
+class ShmVideoCapturer::Region {
+ public:
+  static std::shared_ptr<Region> Open(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(momo_shm::ShmFrameHeader)) {
+      close(fd);
+      return nullptr;
+    }
+    const size_t size = st.st_size;
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      RTC_LOG(LS_ERROR) << "Failed to mmap shared memory " << name << ": "
+                        << strerror(errno);
+      return nullptr;
+    }
+    std::shared_ptr<Region> region(
+        new Region(static_cast<uint8_t*>(p), size));
+    // 書く側がまだヘッダを書いていない場合も、開けなかったことにして開き直す
+    if (!region->IsValid()) {
+      return nullptr;
+    }
+    return region;
+  }
+  ~Region() { munmap(memory_, size_); }
+
+  momo_shm::ShmFrameHeader* header() const { return header_; }
+  momo_shm::ShmFrameSlot* slot(uint32_t index) const {
+    return reinterpret_cast<momo_shm::ShmFrameSlot*>(
+        memory_ + header_->header_bytes + header_->slot_stride * index);
+  }
+  uint8_t* data(uint32_t index) const {
+    return reinterpret_cast<uint8_t*>(slot(index)) + header_->data_offset;
+  }
+
+ private:
+  Region(uint8_t* memory, size_t size)
+      : memory_(memory),
+        size_(size),
+        header_(reinterpret_cast<momo_shm::ShmFrameHeader*>(memory)) {}
+
+  bool IsValid() const {
+    if (header_->magic != momo_shm::kMagic ||
+        header_->version != momo_shm::kVersion || header_->num_slots == 0 ||
+        header_->data_offset < sizeof(momo_shm::ShmFrameSlot) ||
+        header_->slot_stride < header_->data_offset + header_->slot_capacity) {
+      return false;
+    }
+    return header_->header_bytes + header_->slot_stride * header_->num_slots <=
+           size_;
+  }
+
+  uint8_t* const memory_;
+  const size_t size_;
+  momo_shm::ShmFrameHeader* const header_;
+};
+
+// 固定したスロットの NV12 をコピーせずに参照する NativeBuffer。
+// 最後の参照が無くなった時点で固定を外す
+class ShmVideoCapturer::SlotBuffer : public NativeBuffer {
+ public:
+  static rtc::scoped_refptr<SlotBuffer> Create(std::shared_ptr<Region> region,
+                                               uint32_t index) {
+    return new rtc::RefCountedObject<SlotBuffer>(std::move(region), index);
+  }
+
+ protected:
+  SlotBuffer(std::shared_ptr<Region> region, uint32_t index)
+      : NativeBuffer(webrtc::VideoType::kNV12,
+                     region->slot(index)->width,
+                     region->slot(index)->height,
+                     region->data(index),
+                     region->header()->slot_capacity),
+        region_(std::move(region)),
+        index_(index) {
+    SetLength(region_->slot(index_)->data_bytes);
+  }
+  ~SlotBuffer() override { region_->slot(index_)->readers.fetch_sub(1); }
+
+ private:
+  std::shared_ptr<Region> region_;
+  const uint32_t index_;
+};
+
+rtc::scoped_refptr<ShmVideoCapturer> ShmVideoCapturer::Create(
+    const ConnectionSettings& cs) {
+  rtc::scoped_refptr<ShmVideoCapturer> capturer(
+      new rtc::RefCountedObject<ShmVideoCapturer>());
+  capturer->name_ = cs.video_shm;
+  if (capturer->name_.empty()) {
+    return nullptr;
+  }
+  if (capturer->name_[0] != '/') {
+    capturer->name_ = "/" + capturer->name_;
+  }
+  capturer->capture_thread_.reset(new rtc::PlatformThread(
+      ShmVideoCapturer::CaptureThread, capturer.get(), "ShmCapture",
+      rtc::kHighPriority));
+  capturer->capture_thread_->Start();
+  return capturer;
+}
+
+ShmVideoCapturer::ShmVideoCapturer() {}
+
+ShmVideoCapturer::~ShmVideoCapturer() {
+  if (capture_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cond_.notify_all();
+    capture_thread_->Stop();
+    capture_thread_.reset();
+  }
+}
+
+void ShmVideoCapturer::CaptureThread(void* obj) {
+  ThreadPlacement::Instance().Apply("capture");
+  static_cast<ShmVideoCapturer*>(obj)->CaptureLoop();
+}
+
+void ShmVideoCapturer::CaptureLoop() {
+  while (true) {
+    const int interval_ms = region_ || Open() ? kPollIntervalMs
+                                              : kReopenIntervalMs;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (cond_.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                         [this] { return quit_; })) {
+        return;
+      }
+    }
+    if (!region_) {
+      continue;
+    }
+
+    int64_t timestamp_us = 0;
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+        TakeFrame(&timestamp_us);
+    const int64_t now_us = rtc::TimeMicros();
+    if (!buffer) {
+      if (now_us - last_frame_us_ > kStaleUs) {
+        region_ = nullptr;
+      }
+      continue;
+    }
+    last_frame_us_ = now_us;
+    // 書く側の時刻がおかしい場合は、読んだ時刻を使う
+    if (timestamp_us <= 0 || timestamp_us > now_us ||
+        now_us - timestamp_us > rtc::kNumMicrosecsPerSec) {
+      timestamp_us = now_us;
+    }
+    webrtc::VideoFrame video_frame =
+        webrtc::VideoFrame::Builder()
+            .set_video_frame_buffer(buffer)
+            .set_timestamp_rtp(0)
+            .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+            .set_timestamp_us(timestamp_us)
+            .set_rotation(webrtc::kVideoRotation_0)
+            .build();
+    OnCapturedFrame(video_frame);
+  }
+}
+
+bool ShmVideoCapturer::Open() {
+  region_ = Region::Open(name_);
+  if (!region_) {
+    if (!open_warned_) {
+      RTC_LOG(LS_WARNING) << "Waiting for shared memory " << name_;
+      open_warned_ = true;
+    }
+    return false;
+  }
+  RTC_LOG(LS_INFO) << "Opened shared memory " << name_ << " ("
+                   << region_->header()->num_slots << " slots)";
+  open_warned_ = false;
+  // 書く側が作り直した場合も通し番号は変わるので、最後に渡したフレームは覚えておく
+  last_frame_us_ = rtc::TimeMicros();
+  return true;
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> ShmVideoCapturer::TakeFrame(
+    int64_t* timestamp_us) {
+  momo_shm::ShmFrameHeader* header = region_->header();
+  const uint32_t index = header->latest_slot.load(std::memory_order_acquire);
+  if (index >= header->num_slots) {
+    return nullptr;
+  }
+  momo_shm::ShmFrameSlot* slot = region_->slot(index);
+  const uint32_t sequence = slot->sequence.load();
+  if (sequence & 1) {
+    return nullptr;
+  }
+  slot->readers.fetch_add(1);
+  // 固定した後も書き換えられていなければ、これ以降は書く側に上書きされない
+  if (slot->sequence.load() != sequence ||
+      (has_frame_ && slot->frame_number == last_frame_number_)) {
+    slot->readers.fetch_sub(1);
+    return nullptr;
+  }
+  has_frame_ = true;
+  last_frame_number_ = slot->frame_number;
+  if (ShouldSkipFrame()) {
+    slot->readers.fetch_sub(1);
+    return nullptr;
+  }
+  *timestamp_us = slot->timestamp_us;
+
+  const int width = slot->width;
+  const int height = slot->height;
+  const uint8_t* data = region_->data(index);
+  const int chroma_width = (width + 1) / 2;
+  const int chroma_height = (height + 1) / 2;
+  const uint32_t capacity = header->slot_capacity;
+  bool valid = width > 0 && height > 0 && slot->data_bytes <= capacity &&
+               PlaneFits(slot->offsets[0], slot->strides[0], width, height,
+                         capacity);
+  if (slot->format == momo_shm::kNV12) {
+    valid = valid && PlaneFits(slot->offsets[1], slot->strides[1],
+                               chroma_width * 2, chroma_height, capacity);
+  } else if (slot->format == momo_shm::kI420) {
+    valid = valid &&
+            PlaneFits(slot->offsets[1], slot->strides[1], chroma_width,
+                      chroma_height, capacity) &&
+            PlaneFits(slot->offsets[2], slot->strides[2], chroma_width,
+                      chroma_height, capacity);
+  } else {
+    valid = false;
+  }
+  if (!valid) {
+    slot->readers.fetch_sub(1);
+    if (!invalid_warned_) {
+      RTC_LOG(LS_WARNING) << "Invalid frame in shared memory " << name_
+                          << ": format=" << slot->format << " width=" << width
+                          << " height=" << height;
+      invalid_warned_ = true;
+    }
+    return nullptr;
+  }
+
+  std::shared_ptr<Region> region = region_;
+  if (slot->format == momo_shm::kNV12) {
+    // NativeBuffer は UV プレーンが Y プレーンの直後に、同じ幅で並んでいる前提
+    if (slot->strides[0] == static_cast<uint32_t>(width) &&
+        slot->strides[1] == static_cast<uint32_t>(width) &&
+        slot->offsets[0] == 0 &&
+        slot->offsets[1] == static_cast<uint32_t>(width * height)) {
+      return SlotBuffer::Create(region, index);
+    }
+    rtc::scoped_refptr<NativeBuffer> native_buffer =
+        FrameBufferPool::Instance().CreateNativeBuffer(webrtc::VideoType::kNV12,
+                                                       width, height);
+    libyuv::CopyPlane(data + slot->offsets[0], slot->strides[0],
+                      native_buffer->MutableDataY(), native_buffer->StrideY(),
+                      width, height);
+    libyuv::CopyPlane(data + slot->offsets[1], slot->strides[1],
+                      native_buffer->MutableDataUV(),
+                      native_buffer->StrideUV(), chroma_width * 2,
+                      chroma_height);
+    slot->readers.fetch_sub(1);
+    return native_buffer;
+  }
+  return webrtc::WrapI420Buffer(
+      width, height, data + slot->offsets[0], slot->strides[0],
+      data + slot->offsets[1], slot->strides[1], data + slot->offsets[2],
+      slot->strides[2],
+      [region, index]() { region->slot(index)->readers.fetch_sub(1); });
+}
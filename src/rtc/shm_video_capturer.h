@@ -0,0 +1,64 @@
+#ifndef SHM_VIDEO_CAPTURER_H_
+#define SHM_VIDEO_CAPTURER_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame_buffer.h"
+#include "connection_settings.h"
+#include "rtc_base/platform_thread.h"
+#include "scalable_track_source.h"
+#include "shm_frame_layout.h"
+
+// カメラの代わりに、同じマシンの別のプロセスが POSIX 共有メモリに書いたフレームを流す (Linux のみ)。
+// 配置と書き方は shm_frame_layout.h を参照。ShmFrameExporter が書き出したものも読める。
+//
+// 共有メモリは書く側が作る。まだ無い場合や、書く側が作り直した場合は開き直す。
+// 新しいフレームが書かれたらスロットを固定して、コピーせずに NV12 の NativeBuffer か
+// I420 のバッファとして ScalableVideoTrackSource に渡す。固定はバッファの参照が
+// 全て無くなった時点で外すので、エンコーダが使い終わるまで書く側に上書きされない。
+// NV12 で Y と UV のプレーンが隙間なく並んでいない場合のみ、NativeBuffer にコピーする。
+class ShmVideoCapturer : public ScalableVideoTrackSource {
+ public:
+  // cs.video_shm を読む
+  static rtc::scoped_refptr<ShmVideoCapturer> Create(
+      const ConnectionSettings& cs);
+  ~ShmVideoCapturer() override;
+
+ protected:
+  ShmVideoCapturer();
+
+  bool useNativeBuffer() override { return true; }
+
+ private:
+  class Region;
+  class SlotBuffer;
+
+  static void CaptureThread(void* obj);
+  void CaptureLoop();
+  // 開いていなければ開く。開けなかった場合は false を返す
+  bool Open();
+  // 新しいフレームがあれば、スロットを固定してバッファを返す
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> TakeFrame(int64_t* timestamp_us);
+
+  std::string name_;
+  std::shared_ptr<Region> region_;
+  // 最後に渡したフレームの通し番号と、その時刻
+  uint64_t last_frame_number_ = 0;
+  bool has_frame_ = false;
+  int64_t last_frame_us_ = 0;
+  bool open_warned_ = false;
+  bool invalid_warned_ = false;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool quit_ = false;
+  std::unique_ptr<rtc::PlatformThread> capture_thread_;
+};
+
+#endif  // SHM_VIDEO_CAPTURER_H_
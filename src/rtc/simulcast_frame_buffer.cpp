@@ -0,0 +1,131 @@
+#include "simulcast_frame_buffer.h"
+
+#include "frame_buffer_pool.h"
+#include "parallel_scaler.h"
+#include "rtc_base/ref_counted_object.h"
+
+namespace {
+
+// これより小さいレイヤーは作らない
+const int kMinLayerSize = 16;
+
+}  // namespace
+
+rtc::scoped_refptr<SimulcastFrameBuffer> SimulcastFrameBuffer::Create(
+    rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+    int num_layers) {
+  std::vector<rtc::scoped_refptr<webrtc::I420BufferInterface>> layers;
+  layers.push_back(buffer);
+  for (int i = 1; i < num_layers; i++) {
+    // フル解像度からではなく、一つ上のレイヤーから縮小する
+    const webrtc::I420BufferInterface& src = *layers.back();
+    int width = src.width() / 2;
+    int height = src.height() / 2;
+    if (width < kMinLayerSize || height < kMinLayerSize) {
+      break;
+    }
+    rtc::scoped_refptr<webrtc::I420Buffer> layer =
+        FrameBufferPool::Instance().CreateI420Buffer(width, height);
+    ParallelScaler::Instance().ScaleFrom(src, layer.get());
+    layers.push_back(layer);
+  }
+  return new rtc::RefCountedObject<SimulcastFrameBuffer>(std::move(layers));
+}
+
+rtc::scoped_refptr<SimulcastFrameBuffer> SimulcastFrameBuffer::CreateFromLayers(
+    std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> layers) {
+  return new rtc::RefCountedObject<SimulcastFrameBuffer>(std::move(layers));
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> SimulcastFrameBuffer::SelectLayer(
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+    int width,
+    int height) {
+  if (buffer->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+    return buffer;
+  }
+  SimulcastFrameBuffer* simulcast_buffer =
+      dynamic_cast<SimulcastFrameBuffer*>(buffer.get());
+  if (simulcast_buffer == nullptr) {
+    return buffer;
+  }
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> layer =
+      simulcast_buffer->FindLayer(width, height);
+  if (layer->width() == width && layer->height() == height) {
+    return layer;
+  }
+  return simulcast_buffer->GetLayer(width, height);
+}
+
+webrtc::VideoFrameBuffer::Type SimulcastFrameBuffer::type() const {
+  return Type::kNative;
+}
+
+int SimulcastFrameBuffer::width() const {
+  return FindLayer(0, 0)->width();
+}
+
+int SimulcastFrameBuffer::height() const {
+  return FindLayer(0, 0)->height();
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface>
+SimulcastFrameBuffer::ToI420() {
+  if (!native_layers_.empty()) {
+    return native_layers_.front()->ToI420();
+  }
+  return layers_.front();
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> SimulcastFrameBuffer::GetLayer(
+    int width,
+    int height) {
+  // I420 のレイヤーは ToI420() で自分自身を返す
+  rtc::scoped_refptr<webrtc::I420BufferInterface> src =
+      FindLayer(width, height)->ToI420();
+  if (src->width() == width && src->height() == height) {
+    return src;
+  }
+  rtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer =
+      FrameBufferPool::Instance().CreateI420Buffer(width, height);
+  ParallelScaler::Instance().ScaleFrom(*src, scaled_buffer.get());
+  return scaled_buffer;
+}
+
+size_t SimulcastFrameBuffer::num_layers() const {
+  return native_layers_.empty() ? layers_.size() : native_layers_.size();
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> SimulcastFrameBuffer::FindLayer(
+    int width,
+    int height) const {
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> src;
+  if (native_layers_.empty()) {
+    src = layers_.front();
+    for (const auto& layer : layers_) {
+      if (layer->width() < width || layer->height() < height) {
+        break;
+      }
+      src = layer;
+    }
+  } else {
+    src = native_layers_.front();
+    for (const auto& layer : native_layers_) {
+      if (layer->width() < width || layer->height() < height) {
+        break;
+      }
+      src = layer;
+    }
+  }
+  return src;
+}
+
+SimulcastFrameBuffer::SimulcastFrameBuffer(
+    std::vector<rtc::scoped_refptr<webrtc::I420BufferInterface>> layers)
+    : layers_(std::move(layers)) {}
+
+SimulcastFrameBuffer::SimulcastFrameBuffer(
+    std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> native_layers)
+    : native_layers_(std::move(native_layers)) {}
+
+SimulcastFrameBuffer::~SimulcastFrameBuffer() {}
@@ -0,0 +1,68 @@
+#ifndef SIMULCAST_FRAME_BUFFER_H_
+#define SIMULCAST_FRAME_BUFFER_H_
+
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "api/video/i420_buffer.h"
+#include "api/video/video_frame_buffer.h"
+
+// サイマルキャスト用に、縦横 1/2 ずつ縮小したレイヤーをまとめて保持するバッファ。
+//
+// キャプチャしたフレームごとに一度だけ縮小ピラミッドを作っておき、
+// 各レイヤーのエンコーダは自分の解像度に一番近いレイヤーを使うことで
+// エンコーダごとにフル解像度から縮小し直さずに済むようにする。
+//
+// ISP などが既に縮小したレイヤーを出力する場合は、CreateFromLayers() でそれをまとめる。
+// その場合、解像度が一致するエンコーダにはレイヤーのバッファをそのまま渡す。
+//
+// SimulcastEncoderAdapter は supports_native_handle なエンコーダに対して
+// kNative なフレームをそのまま渡すので、このバッファは kNative として振る舞う。
+class SimulcastFrameBuffer : public webrtc::VideoFrameBuffer {
+ public:
+  // buffer を最上位のレイヤーとして、num_layers 個のレイヤーを作る
+  static rtc::scoped_refptr<SimulcastFrameBuffer> Create(
+      rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+      int num_layers);
+  // 縮小済みのレイヤーをまとめる。layers は解像度の大きい順に並べること
+  static rtc::scoped_refptr<SimulcastFrameBuffer> CreateFromLayers(
+      std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> layers);
+
+  // buffer が SimulcastFrameBuffer の場合は width x height のレイヤーを返す。
+  // CreateFromLayers() で作った場合、解像度が一致するレイヤーがあればそのまま返す。
+  // それ以外の場合は buffer をそのまま返す。
+  static rtc::scoped_refptr<webrtc::VideoFrameBuffer> SelectLayer(
+      rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+      int width,
+      int height);
+
+  Type type() const override;
+  int width() const override;
+  int height() const override;
+  rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override;
+
+  // width x height 以上で一番小さいレイヤーを使って、width x height のバッファを返す。
+  // レイヤーと解像度が一致する場合はコピーせずにそのまま返す。
+  rtc::scoped_refptr<webrtc::I420BufferInterface> GetLayer(int width,
+                                                           int height);
+  size_t num_layers() const;
+
+ protected:
+  explicit SimulcastFrameBuffer(
+      std::vector<rtc::scoped_refptr<webrtc::I420BufferInterface>> layers);
+  explicit SimulcastFrameBuffer(
+      std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> native_layers);
+  ~SimulcastFrameBuffer() override;
+
+ private:
+  // width x height 以上で一番小さいレイヤー
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> FindLayer(int width,
+                                                         int height) const;
+
+  // 解像度の大きい順に並んでいる。CreateFromLayers() で作った場合は native_layers_ を使う
+  const std::vector<rtc::scoped_refptr<webrtc::I420BufferInterface>> layers_;
+  const std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>>
+      native_layers_;
+};
+
+#endif  // SIMULCAST_FRAME_BUFFER_H_
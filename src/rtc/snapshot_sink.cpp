@@ -0,0 +1,214 @@
+#include "snapshot_sink.h"
+
+#include <algorithm>
+#include <vector>
+
+// WebRTC
+#include "rtc_base/logging.h"
+
+#include "native_buffer.h"
+#include "simulcast_frame_buffer.h"
+
+#if USE_JETSON_ENCODER
+#include "hwenc_jetson/jetson_jpeg_encoder.h"
+#elif USE_SCALED_MJPEG_DECODE
+// libjpeg-turbo のヘッダがあるかどうかは、縮小デコードと同じ条件で決まる
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "third_party/libjpeg_turbo/jpeglib.h"
+#endif
+
+namespace {
+
+#if !USE_JETSON_ENCODER && USE_SCALED_MJPEG_DECODE
+
+struct ErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf jmp;
+};
+
+void OnError(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jmp, 1);
+}
+
+// longjmp で戻った時にデストラクタを飛ばさないように、libjpeg を呼んでいる間の状態は全てここに置く
+struct EncodeState {
+  jpeg_compress_struct cinfo;
+  ErrorManager error;
+  bool created = false;
+  unsigned char* out = nullptr;
+  unsigned long out_size = 0;
+  // libjpeg は各行を iMCU の幅に切り上げて読むので、
+  // バッファの外を読まないように各プレーンの最後の行だけは余白を付けたコピーを渡す
+  std::vector<uint8_t> last_rows[3];
+
+  ~EncodeState() {
+    if (created) {
+      jpeg_destroy_compress(&cinfo);
+    }
+    free(out);
+  }
+};
+
+// 色変換をせずに、I420 の各プレーンをそのまま 4:2:0 の JPEG にする
+bool EncodeI420(const webrtc::I420BufferInterface& i420,
+                int quality,
+                std::string* jpeg) {
+  std::unique_ptr<EncodeState> state(new EncodeState());
+  jpeg_compress_struct& cinfo = state->cinfo;
+  cinfo.err = jpeg_std_error(&state->error.pub);
+  state->error.pub.error_exit = OnError;
+  if (setjmp(state->error.jmp)) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Failed to encode";
+    return false;
+  }
+  jpeg_create_compress(&cinfo);
+  state->created = true;
+  jpeg_mem_dest(&cinfo, &state->out, &state->out_size);
+  cinfo.image_width = i420.width();
+  cinfo.image_height = i420.height();
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.raw_data_in = TRUE;
+  cinfo.dct_method = JDCT_IFAST;
+  cinfo.comp_info[0].h_samp_factor = 2;
+  cinfo.comp_info[0].v_samp_factor = 2;
+  cinfo.comp_info[1].h_samp_factor = 1;
+  cinfo.comp_info[1].v_samp_factor = 1;
+  cinfo.comp_info[2].h_samp_factor = 1;
+  cinfo.comp_info[2].v_samp_factor = 1;
+  jpeg_start_compress(&cinfo, TRUE);
+
+  const uint8_t* data[3] = {i420.DataY(), i420.DataU(), i420.DataV()};
+  const int strides[3] = {i420.StrideY(), i420.StrideU(), i420.StrideV()};
+  const int widths[3] = {i420.width(), i420.ChromaWidth(), i420.ChromaWidth()};
+  const int heights[3] = {i420.height(), i420.ChromaHeight(),
+                          i420.ChromaHeight()};
+  for (int i = 0; i < 3; i++) {
+    const jpeg_component_info& comp = cinfo.comp_info[i];
+    state->last_rows[i].resize(comp.width_in_blocks * DCTSIZE);
+    const uint8_t* last = data[i] + (heights[i] - 1) * strides[i];
+    std::copy(last, last + widths[i], state->last_rows[i].begin());
+    std::fill(state->last_rows[i].begin() + widths[i],
+              state->last_rows[i].end(), last[widths[i] - 1]);
+  }
+
+  JSAMPROW y_rows[2 * DCTSIZE];
+  JSAMPROW u_rows[DCTSIZE];
+  JSAMPROW v_rows[DCTSIZE];
+  JSAMPARRAY planes[3] = {y_rows, u_rows, v_rows};
+  while (cinfo.next_scanline < cinfo.image_height) {
+    for (int i = 0; i < 3; i++) {
+      const int rows = i == 0 ? 2 * DCTSIZE : DCTSIZE;
+      const int first = i == 0 ? cinfo.next_scanline : cinfo.next_scanline / 2;
+      for (int j = 0; j < rows; j++) {
+        const int row = first + j;
+        planes[i][j] = row < heights[i] - 1
+                           ? const_cast<JSAMPROW>(data[i] + row * strides[i])
+                           : state->last_rows[i].data();
+      }
+    }
+    jpeg_write_raw_data(&cinfo, planes, 2 * DCTSIZE);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg->assign(reinterpret_cast<const char*>(state->out), state->out_size);
+  return true;
+}
+
+#endif
+
+}  // namespace
+
+std::unique_ptr<SnapshotSink> SnapshotSink::Create(
+    rtc::scoped_refptr<ScalableVideoTrackSource> source,
+    int quality) {
+  if (!source) {
+    return nullptr;
+  }
+  return std::unique_ptr<SnapshotSink>(new SnapshotSink(source, quality));
+}
+
+SnapshotSink::SnapshotSink(rtc::scoped_refptr<ScalableVideoTrackSource> source,
+                           int quality)
+    : source_(source), quality_(quality) {
+  source_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+}
+
+SnapshotSink::~SnapshotSink() {
+  source_->RemoveSink(this);
+}
+
+void SnapshotSink::OnFrame(const webrtc::VideoFrame& frame) {
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      SimulcastFrameBuffer::SelectLayer(frame.video_frame_buffer(),
+                                        frame.width(), frame.height());
+  // 古いバッファの解放はロックの外で行う
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> previous;
+  std::lock_guard<std::mutex> lock(frame_mutex_);
+  previous = std::move(latest_);
+  latest_ = std::move(buffer);
+  frame_number_++;
+}
+
+bool SnapshotSink::GetJpeg(std::string* jpeg) {
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+  uint64_t frame_number;
+  {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    buffer = latest_;
+    frame_number = frame_number_;
+  }
+  if (!buffer) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(encode_mutex_);
+  if (frame_number != cached_frame_number_) {
+    std::string encoded;
+    if (!Encode(buffer, &encoded)) {
+      return false;
+    }
+    cached_jpeg_ = std::move(encoded);
+    cached_frame_number_ = frame_number;
+  }
+  *jpeg = cached_jpeg_;
+  return true;
+}
+
+bool SnapshotSink::Encode(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+                          std::string* jpeg) {
+  NativeBuffer* native_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(buffer.get())
+          : nullptr;
+  if (native_buffer &&
+      native_buffer->VideoType() == webrtc::VideoType::kMJPEG &&
+      native_buffer->Data() != nullptr) {
+    jpeg->assign(reinterpret_cast<const char*>(native_buffer->Data()),
+                 native_buffer->length());
+    return true;
+  }
+
+#if USE_JETSON_ENCODER
+  if (!jetson_encoder_) {
+    jetson_encoder_ = JetsonJpegEncoder::Create();
+    if (!jetson_encoder_) {
+      return false;
+    }
+  }
+  return jetson_encoder_->Encode(buffer, quality_, jpeg);
+#elif USE_SCALED_MJPEG_DECODE
+  rtc::scoped_refptr<webrtc::I420BufferInterface> i420 = buffer->ToI420();
+  if (!i420) {
+    return false;
+  }
+  return EncodeI420(*i420, quality_, jpeg);
+#else
+  RTC_LOG(LS_WARNING) << "SnapshotSink: JPEG encoder is not available";
+  return false;
+#endif
+}
@@ -0,0 +1,63 @@
+#ifndef SNAPSHOT_SINK_H_
+#define SNAPSHOT_SINK_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "api/scoped_refptr.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "scalable_track_source.h"
+
+#if USE_JETSON_ENCODER
+class JetsonJpegEncoder;
+#endif
+
+// 送信している映像の最新のフレームを、要求された時だけ JPEG にして返すクラス。
+//
+// OnFrame() ではバッファの参照を入れ替えるだけで、変換もエンコードもしない。
+// GetJpeg() で次の順に JPEG を作り、同じフレームの間は結果をキャッシュして返す。
+// - カメラが MJPEG を出している場合は、キャプチャしたままの JPEG を返す (エンコードしない)
+// - Jetson では NvJPEGEncoder でエンコードする。DMABUF のフレームは CPU にコピーしない
+// - それ以外は I420 にしてから libjpeg-turbo でエンコードする
+// MJPEG の場合は縮小前のカメラの解像度になり、それ以外は VideoAdapter で縮小した後の解像度になる。
+// 最新のフレームを 1 つ保持するので、キャプチャのバッファが 1 つ余分に使われる。
+class SnapshotSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  static std::unique_ptr<SnapshotSink> Create(
+      rtc::scoped_refptr<ScalableVideoTrackSource> source,
+      int quality);
+  ~SnapshotSink() override;
+
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+
+  // フレームがまだ届いていない場合や、JPEG にできない場合は false を返す
+  bool GetJpeg(std::string* jpeg);
+
+ private:
+  SnapshotSink(rtc::scoped_refptr<ScalableVideoTrackSource> source,
+               int quality);
+  bool Encode(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+              std::string* jpeg);
+
+  rtc::scoped_refptr<ScalableVideoTrackSource> source_;
+  const int quality_;
+
+  std::mutex frame_mutex_;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> latest_;
+  // 届いたフレームの通し番号。0 はまだ届いていない
+  uint64_t frame_number_ = 0;
+
+  // エンコードとキャッシュは同時に 1 つだけ行う
+  std::mutex encode_mutex_;
+  uint64_t cached_frame_number_ = 0;
+  std::string cached_jpeg_;
+#if USE_JETSON_ENCODER
+  std::unique_ptr<JetsonJpegEncoder> jetson_encoder_;
+#endif
+};
+
+#endif  // SNAPSHOT_SINK_H_
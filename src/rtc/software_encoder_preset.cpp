@@ -0,0 +1,103 @@
+#include "software_encoder_preset.h"
+
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+// libaom のリアルタイムモードで使える cpu-used の範囲
+const int kMinAV1Speed = 6;
+const int kMaxAV1Speed = 8;
+// 負荷の指数移動平均の重み
+const double kUsageAlpha = 0.05;
+// フレームの間隔に対するエンコード時間の比がこれを超えたら段階を上げる
+const double kOveruseThreshold = 0.85;
+// これを下回ったら段階を下げる
+const double kUnderuseThreshold = 0.4;
+// 段階を上げてから次に上げるまでの時間。設定を変えた効果が平均に出るのを待つ
+const int64_t kRaiseIntervalMs = 3000;
+// 段階を下げるまでの時間。上げ下げを繰り返さないように長めにする
+const int64_t kLowerIntervalMs = 10000;
+
+}  // namespace
+
+SoftwareEncoderPreset SoftwareEncoderPreset::Select(
+    webrtc::VideoCodecType codec,
+    int width,
+    int height,
+    int number_of_cores,
+    bool screen_content,
+    int load_level) {
+  SoftwareEncoderPreset preset;
+  const int pixels = width * height;
+  number_of_cores = std::max(number_of_cores, 1);
+
+  int threads;
+  if (pixels >= 1920 * 1080) {
+    threads = 8;
+  } else if (pixels >= 1280 * 720) {
+    threads = 4;
+  } else if (pixels >= 640 * 360) {
+    threads = 2;
+  } else {
+    threads = 1;
+  }
+  // 負荷が高い場合は空いているコアも使う
+  threads <<= load_level;
+  preset.threads = std::min(threads, number_of_cores);
+
+  if (codec == webrtc::kVideoCodecAV1) {
+    int speed;
+    if (pixels >= 1920 * 1080) {
+      speed = kMaxAV1Speed;
+    } else if (pixels >= 640 * 360) {
+      speed = 7;
+    } else {
+      speed = kMinAV1Speed;
+    }
+    preset.speed = std::min(speed + load_level, kMaxAV1Speed);
+    // タイルの幅は 256 ピクセル以上にする
+    if (preset.threads >= 4 && width >= 1280) {
+      preset.tile_columns_log2 = 2;
+    } else if (preset.threads >= 2 && width >= 640) {
+      preset.tile_columns_log2 = 1;
+    }
+    preset.row_mt = preset.threads > 1;
+  }
+
+  preset.screen_content = screen_content;
+  preset.denoising =
+      !screen_content && pixels < 1280 * 720 && load_level == 0;
+  return preset;
+}
+
+bool SoftwareEncoderLoad::OnEncoded(int64_t elapsed_us,
+                                    double framerate_fps,
+                                    int64_t now_ms) {
+  if (framerate_fps <= 0) {
+    return false;
+  }
+  const double interval_us = 1000000.0 / framerate_fps;
+  usage_ += kUsageAlpha * (elapsed_us / interval_us - usage_);
+  if (last_change_ms_ < 0) {
+    last_change_ms_ = now_ms;
+  }
+
+  int level = level_;
+  if (usage_ > kOveruseThreshold && level_ < kMaxLevel &&
+      now_ms - last_change_ms_ >= kRaiseIntervalMs) {
+    level++;
+  } else if (usage_ < kUnderuseThreshold && level_ > 0 &&
+             now_ms - last_change_ms_ >= kLowerIntervalMs) {
+    level--;
+  }
+  if (level == level_) {
+    return false;
+  }
+  RTC_LOG(LS_INFO) << "Software encoder load level " << level_ << " -> "
+                   << level << " (usage " << usage_ << ")";
+  level_ = level;
+  last_change_ms_ = now_ms;
+  return true;
+}
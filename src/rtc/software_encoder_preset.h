@@ -0,0 +1,51 @@
+#ifndef SOFTWARE_ENCODER_PRESET_H_
+#define SOFTWARE_ENCODER_PRESET_H_
+
+#include <stdint.h>
+
+#include "api/video/video_codec_type.h"
+
+// ソフトウェアエンコーダ (libvpx の VP8/VP9、libaom の AV1) をリアルタイムで動かすための設定。
+// 解像度、使えるコア数、画面共有かどうか、SoftwareEncoderLoad の段階から Select() で決める。
+struct SoftwareEncoderPreset {
+  // AV1 の cpu-used。大きいほど速くて画質が落ちる。
+  // VP8/VP9 の cpu-used は WebRTC のラッパーが解像度から決めるので変えられない
+  int speed = 7;
+  int threads = 1;
+  // AV1 のタイルの列の数の log2
+  int tile_columns_log2 = 0;
+  // AV1 でタイルの中の行を並列にエンコードする
+  bool row_mt = false;
+  // 画面共有用のツール (パレットやイントラブロックコピー) を使う
+  bool screen_content = false;
+  // VP8/VP9 のノイズ除去。重いので解像度が大きい場合と負荷が高い場合は使わない
+  bool denoising = true;
+
+  static SoftwareEncoderPreset Select(webrtc::VideoCodecType codec,
+                                      int width,
+                                      int height,
+                                      int number_of_cores,
+                                      bool screen_content,
+                                      int load_level);
+};
+
+// 1 フレームのエンコードにかかった時間とフレームの間隔の比から、
+// エンコーダの負荷を 0 から kMaxLevel の段階で求める。
+// 段階が上がると SoftwareEncoderPreset::Select() はより速い設定を選ぶ。
+class SoftwareEncoderLoad {
+ public:
+  static const int kMaxLevel = 2;
+
+  // 1 フレームのエンコードに elapsed_us かかった。framerate_fps は目標のフレームレート。
+  // 段階が変わった場合は true を返す
+  bool OnEncoded(int64_t elapsed_us, double framerate_fps, int64_t now_ms);
+  int level() const { return level_; }
+
+ private:
+  // フレームの間隔に対するエンコード時間の比の指数移動平均
+  double usage_ = 0;
+  int level_ = 0;
+  int64_t last_change_ms_ = -1;
+};
+
+#endif  // SOFTWARE_ENCODER_PRESET_H_
@@ -0,0 +1,109 @@
+#include "software_video_encoder.h"
+
+#include <utility>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+SoftwareVideoEncoder::SoftwareVideoEncoder(
+    std::unique_ptr<webrtc::VideoEncoder> encoder,
+    std::string implementation_name)
+    : encoder_(std::move(encoder)), metrics_(std::move(implementation_name)) {}
+
+void SoftwareVideoEncoder::SetFecControllerOverride(
+    webrtc::FecControllerOverride* fec_controller_override) {
+  encoder_->SetFecControllerOverride(fec_controller_override);
+}
+
+int32_t SoftwareVideoEncoder::InitEncode(
+    const webrtc::VideoCodec* codec_settings,
+    const webrtc::VideoEncoder::Settings& settings) {
+  webrtc::VideoCodec codec = *codec_settings;
+  SoftwareEncoderPreset preset = SoftwareEncoderPreset::Select(
+      codec.codecType, codec.width, codec.height, settings.number_of_cores,
+      codec.mode == webrtc::VideoCodecMode::kScreensharing, load_.level());
+  if (codec.codecType == webrtc::kVideoCodecVP8) {
+    codec.VP8()->denoisingOn = codec.VP8()->denoisingOn && preset.denoising;
+  } else if (codec.codecType == webrtc::kVideoCodecVP9) {
+    codec.VP9()->denoisingOn = codec.VP9()->denoisingOn && preset.denoising;
+  }
+  RTC_LOG(LS_INFO) << "InitEncode " << codec.width << "x" << codec.height
+                   << " threads:" << preset.threads
+                   << " denoising:" << preset.denoising;
+  metrics_.SetTargetBitrate(codec.startBitrate * 1000);
+  return encoder_->InitEncode(
+      &codec, webrtc::VideoEncoder::Settings(settings.capabilities,
+                                             preset.threads,
+                                             settings.max_payload_size));
+}
+
+int32_t SoftwareVideoEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  callback_ = callback;
+  return encoder_->RegisterEncodeCompleteCallback(this);
+}
+
+int32_t SoftwareVideoEncoder::Release() {
+  return encoder_->Release();
+}
+
+int32_t SoftwareVideoEncoder::Encode(
+    const webrtc::VideoFrame& frame,
+    const std::vector<webrtc::VideoFrameType>* frame_types) {
+  if (frame_types != nullptr && !frame_types->empty() &&
+      (*frame_types)[0] == webrtc::VideoFrameType::kEmptyFrame) {
+    metrics_.OnSkipped();
+    return encoder_->Encode(frame, frame_types);
+  }
+
+  // libvpx は Encode() の中でエンコードを終えて OnEncodedImage() を呼ぶ
+  const int64_t start_us = rtc::TimeMicros();
+  metrics_.OnSubmit(frame.timestamp());
+  int32_t result = encoder_->Encode(frame, frame_types);
+  const int64_t elapsed_us = rtc::TimeMicros() - start_us;
+  metrics_.OnStage("encode", elapsed_us);
+  load_.OnEncoded(elapsed_us, framerate_fps_, rtc::TimeMillis());
+  return result;
+}
+
+void SoftwareVideoEncoder::SetRates(const RateControlParameters& parameters) {
+  if (parameters.framerate_fps > 0) {
+    framerate_fps_ = parameters.framerate_fps;
+  }
+  metrics_.SetTargetBitrate(parameters.bitrate.get_sum_bps());
+  encoder_->SetRates(parameters);
+}
+
+void SoftwareVideoEncoder::OnPacketLossRateUpdate(float packet_loss_rate) {
+  encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+}
+
+void SoftwareVideoEncoder::OnRttUpdate(int64_t rtt_ms) {
+  encoder_->OnRttUpdate(rtt_ms);
+}
+
+void SoftwareVideoEncoder::OnLossNotification(
+    const LossNotification& loss_notification) {
+  encoder_->OnLossNotification(loss_notification);
+}
+
+webrtc::VideoEncoder::EncoderInfo SoftwareVideoEncoder::GetEncoderInfo()
+    const {
+  return encoder_->GetEncoderInfo();
+}
+
+webrtc::EncodedImageCallback::Result SoftwareVideoEncoder::OnEncodedImage(
+    const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const webrtc::RTPFragmentationHeader* fragmentation) {
+  metrics_.OnEncoded(
+      encoded_image.Timestamp(), encoded_image.size(),
+      encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey);
+  return callback_->OnEncodedImage(encoded_image, codec_specific_info,
+                                   fragmentation);
+}
+
+void SoftwareVideoEncoder::OnDroppedFrame(DropReason reason) {
+  metrics_.OnDropped();
+  callback_->OnDroppedFrame(reason);
+}
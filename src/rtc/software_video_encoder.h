@@ -0,0 +1,55 @@
+#ifndef SOFTWARE_VIDEO_ENCODER_H_
+#define SOFTWARE_VIDEO_ENCODER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/video_codecs/video_encoder.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "encoder_metrics.h"
+#include "software_encoder_preset.h"
+
+// libvpx の VP8/VP9 エンコーダを、解像度と負荷に合わせた SoftwareEncoderPreset で動かすラッパー。
+//
+// InitEncode() のたびに、使うスレッド数 (number_of_cores) とノイズ除去を preset から決める。
+// 負荷は SoftwareEncoderLoad で追いかけていて、次の InitEncode() から反映される。
+// WebRTC は CPU の使用率が高いと解像度を下げて InitEncode() し直すので、その時に速い設定になる。
+// 1 フレームのエンコードにかかった時間は EncoderMetrics に "encode" として記録する。
+class SoftwareVideoEncoder : public webrtc::VideoEncoder,
+                             public webrtc::EncodedImageCallback {
+ public:
+  SoftwareVideoEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder,
+                       std::string implementation_name);
+
+  void SetFecControllerOverride(
+      webrtc::FecControllerOverride* fec_controller_override) override;
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const webrtc::VideoEncoder::Settings& settings) override;
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override;
+  void SetRates(const RateControlParameters& parameters) override;
+  void OnPacketLossRateUpdate(float packet_loss_rate) override;
+  void OnRttUpdate(int64_t rtt_ms) override;
+  void OnLossNotification(const LossNotification& loss_notification) override;
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const override;
+
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override;
+  void OnDroppedFrame(DropReason reason) override;
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  EncoderMetrics metrics_;
+  SoftwareEncoderLoad load_;
+  double framerate_fps_ = 30;
+};
+
+#endif  // SOFTWARE_VIDEO_ENCODER_H_
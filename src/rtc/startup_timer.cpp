@@ -0,0 +1,50 @@
+#include "startup_timer.h"
+
+#include <string.h>
+
+#include <sstream>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+StartupTimer& StartupTimer::Instance() {
+  static StartupTimer instance;
+  return instance;
+}
+
+StartupTimer::StartupTimer() : start_us_(rtc::TimeMicros()) {}
+
+void StartupTimer::Mark(const char* name) {
+  const int64_t elapsed_us = rtc::TimeMicros() - start_us_;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& mark : marks_) {
+    if (strcmp(mark.first, name) == 0) {
+      return;
+    }
+  }
+  marks_.push_back(std::make_pair(name, elapsed_us));
+}
+
+void StartupTimer::Report() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (reported_) {
+      return;
+    }
+    reported_ = true;
+  }
+  RTC_LOG(LS_INFO) << "Startup: " << ToString();
+}
+
+std::string StartupTimer::ToString() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream oss;
+  for (size_t i = 0; i < marks_.size(); i++) {
+    if (i > 0) {
+      oss << " ";
+    }
+    oss << marks_[i].first << "="
+        << marks_[i].second / rtc::kNumMicrosecsPerMillisec << "ms";
+  }
+  return oss.str();
+}
@@ -0,0 +1,36 @@
+#ifndef STARTUP_TIMER_H_
+#define STARTUP_TIMER_H_
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 起動してから最初の映像を送るまでの各段階の時刻を記録して、内訳をログに出力する。
+//
+// 時刻は最初に Instance() を呼んだ時点からの経過時間で、main() の最初で呼んでおくこと。
+// 同じ名前の Mark() は最初の 1 回だけ記録する。
+// Report() は最初の 1 回だけ、それまでに記録した内訳をログに出力する。
+// 任意のスレッドから呼び出して良い。
+class StartupTimer {
+ public:
+  static StartupTimer& Instance();
+
+  // name はずっと有効な文字列 (リテラルなど) を渡すこと
+  void Mark(const char* name);
+  void Report();
+  // "capturers_opened=120ms factory_created=310ms ..." の形式
+  std::string ToString();
+
+ private:
+  StartupTimer();
+
+  const int64_t start_us_;
+  std::mutex mutex_;
+  std::vector<std::pair<const char*, int64_t>> marks_;
+  bool reported_ = false;
+};
+
+#endif  // STARTUP_TIMER_H_
@@ -0,0 +1,50 @@
+#include "static_scene_detector.h"
+
+#include <stdlib.h>
+
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+
+namespace {
+
+// 1 サンプルが大きな領域の平均になるので、センサーのノイズではほとんど変化しない
+const int kThumbnailWidth = 64;
+const int kThumbnailHeight = 36;
+
+}  // namespace
+
+bool StaticSceneDetector::ShouldPass(const Settings& settings,
+                                     const uint8_t* y,
+                                     int stride_y,
+                                     int width,
+                                     int height,
+                                     int64_t now_us) {
+  if (settings.fps <= 0 || y == nullptr) {
+    reference_.clear();
+    return true;
+  }
+
+  thumbnail_.resize(kThumbnailWidth * kThumbnailHeight);
+  libyuv::ScalePlane(y, stride_y, width, height, thumbnail_.data(),
+                     kThumbnailWidth, kThumbnailWidth, kThumbnailHeight,
+                     libyuv::kFilterBox);
+
+  bool changed = reference_.size() != thumbnail_.size();
+  for (size_t i = 0; !changed && i < thumbnail_.size(); i++) {
+    changed = abs(thumbnail_[i] - reference_[i]) >= settings.threshold;
+  }
+  if (changed) {
+    last_change_us_ = now_us;
+  }
+
+  const bool is_static =
+      now_us - last_change_us_ >=
+      static_cast<int64_t>(settings.delay_ms) * rtc::kNumMicrosecsPerMillisec;
+  if (is_static &&
+      now_us - last_pass_us_ < rtc::kNumMicrosecsPerSec / settings.fps) {
+    return false;
+  }
+  last_pass_us_ = now_us;
+  reference_.swap(thumbnail_);
+  return true;
+}
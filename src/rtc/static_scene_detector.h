@@ -0,0 +1,39 @@
+#ifndef STATIC_SCENE_DETECTOR_H_
+#define STATIC_SCENE_DETECTOR_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+// 映像が止まっている間はフレームを間引くための判定をするクラス。
+//
+// Y プレーンを libyuv で 64x36 まで縮小して、最後に通したフレームと比べる。
+// どこかのサンプルの差が threshold 以上になったら変化があったとみなし、すぐにフレームを通す。
+// 変化が無いまま delay_ms が経つと、fps のフレームレートまで間引く。
+// 最後に通したフレームと比べるので、少しずつ変化する場合もいずれ通る。
+// キャプチャスレッドから呼び出すこと。
+class StaticSceneDetector {
+ public:
+  struct Settings {
+    // 0 の場合は間引かない
+    int fps = 0;
+    int delay_ms = 2000;
+    int threshold = 8;
+  };
+
+  // フレームを通す場合は true を返す。y が nullptr の場合は判定できないので常に通す
+  bool ShouldPass(const Settings& settings,
+                  const uint8_t* y,
+                  int stride_y,
+                  int width,
+                  int height,
+                  int64_t now_us);
+
+ private:
+  std::vector<uint8_t> thumbnail_;
+  std::vector<uint8_t> reference_;
+  int64_t last_change_us_ = 0;
+  int64_t last_pass_us_ = 0;
+};
+
+#endif  // STATIC_SCENE_DETECTOR_H_
@@ -0,0 +1,411 @@
+#include "stats_sampler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "api/stats/rtcstats_objects.h"
+#include "manager.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+namespace {
+
+// 累積値が減った場合 (ストリームが作り直された場合など) は差分を 0 にする
+template <class T>
+double Delta(T previous, T current) {
+  return current > previous ? static_cast<double>(current - previous) : 0.0;
+}
+
+double Ratio(double numerator, double denominator) {
+  return denominator > 0 ? numerator / denominator : 0.0;
+}
+
+}  // namespace
+
+nlohmann::json StatsSampler::Sample::ToJson() const {
+  return {
+      {"timestamp_ms", timestamp_ms},
+      {"interval_ms", interval_ms},
+      {"video_bitrate_bps", video_bitrate_bps},
+      {"audio_bitrate_bps", audio_bitrate_bps},
+      {"video_fps", video_fps},
+      {"encode_ms_per_frame", encode_ms_per_frame},
+      {"pacer_delay_ms", pacer_delay_ms},
+      {"loss_rate", loss_rate},
+      {"rtt_ms", rtt_ms},
+      {"available_outgoing_bitrate_bps", available_outgoing_bitrate_bps},
+      {"remote_jitter_ms", remote_jitter_ms},
+      {"retransmitted_bitrate_bps", retransmitted_bitrate_bps},
+      {"nacks_received_per_sec", nacks_received_per_sec},
+      {"received_video_bitrate_bps", received_video_bitrate_bps},
+      {"received_video_fps", received_video_fps},
+      {"received_loss_rate", received_loss_rate},
+      {"jitter_buffer_delay_ms", jitter_buffer_delay_ms},
+      {"nacks_sent_per_sec", nacks_sent_per_sec},
+      {"received_fec_packets_per_sec", received_fec_packets_per_sec},
+      {"audio_jitter_buffer_delay_ms", audio_jitter_buffer_delay_ms},
+      {"audio_playout_delay_ms", audio_playout_delay_ms},
+      {"estimated_mouth_to_ear_ms", estimated_mouth_to_ear_ms},
+  };
+}
+
+std::shared_ptr<StatsSampler> StatsSampler::Create(
+    boost::asio::io_context& ioc,
+    RTCManager* rtc_manager,
+    Settings settings) {
+  if (settings.interval_ms <= 0) {
+    return nullptr;
+  }
+  return std::make_shared<StatsSampler>(ioc, rtc_manager, settings);
+}
+
+StatsSampler::StatsSampler(boost::asio::io_context& ioc,
+                           RTCManager* rtc_manager,
+                           Settings settings)
+    : timer_(ioc), rtc_manager_(rtc_manager), settings_(settings) {}
+
+void StatsSampler::Start() {
+  timer_.expires_after(std::chrono::milliseconds(settings_.interval_ms));
+  auto self = shared_from_this();
+  timer_.async_wait([self](const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+    self->OnTimer();
+  });
+}
+
+void StatsSampler::Stop() {
+  timer_.cancel();
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopped_ = true;
+  listeners_.clear();
+}
+
+void StatsSampler::AddListener(Listener listener) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  listeners_.push_back(std::move(listener));
+}
+
+void StatsSampler::OnTimer() {
+  std::vector<std::shared_ptr<RTCConnection>> connections =
+      rtc_manager_->getConnections();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) {
+      return;
+    }
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (it->second.connection.expired()) {
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (const auto& connection : connections) {
+      Entry& entry = entries_[connection.get()];
+      if (entry.connection.lock() != connection) {
+        entry = Entry();
+        entry.id = next_id_++;
+        entry.connection = connection;
+      }
+    }
+  }
+
+  // io_context より後に破棄されないように、シグナリングスレッドには所有権を渡さない
+  std::weak_ptr<StatsSampler> weak_self = shared_from_this();
+  for (const auto& connection : connections) {
+    RTCConnection* key = connection.get();
+    connection->getStats(
+        [weak_self, key](
+            const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+          if (auto self = weak_self.lock()) {
+            self->OnStats(key, report);
+          }
+        });
+  }
+  Start();
+}
+
+void StatsSampler::OnStats(
+    RTCConnection* key,
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  Sample sample;
+  sample.timestamp_ms = rtc::TimeUTCMillis();
+  Totals totals = GetTotals(report, &sample);
+  sample.audio_playout_delay_ms = rtc_manager_->getAudioPlayoutDelayMs();
+
+  int id;
+  std::shared_ptr<RTCConnection> connection;
+  std::vector<Listener> listeners;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (stopped_ || it == entries_.end()) {
+      return;
+    }
+    Entry& entry = it->second;
+    connection = entry.connection.lock();
+    if (!connection) {
+      return;
+    }
+    if (entry.has_totals) {
+      SetDeltas(entry.totals, totals, &sample);
+    }
+    if (sample.audio_jitter_buffer_delay_ms > 0) {
+      sample.estimated_mouth_to_ear_ms = sample.rtt_ms / 2 +
+                                         sample.audio_jitter_buffer_delay_ms +
+                                         sample.audio_playout_delay_ms;
+    }
+    entry.totals = totals;
+    entry.has_totals = true;
+    entry.samples.push_back(sample);
+    while (entry.samples.size() > static_cast<size_t>(settings_.max_samples)) {
+      entry.samples.pop_front();
+    }
+    id = entry.id;
+    listeners = listeners_;
+  }
+
+  if (settings_.log) {
+    RTC_LOG(LS_INFO) << "StatsSampler: connection=" << id << " "
+                     << sample.ToJson().dump();
+  }
+  for (const auto& listener : listeners) {
+    listener(id, connection, sample);
+  }
+}
+
+StatsSampler::Totals StatsSampler::GetTotals(
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report,
+    Sample* sample) {
+  Totals totals;
+  totals.timestamp_us = report->timestamp_us();
+
+  // RTT と帯域の見積もりは差分ではなく今の値
+  for (const auto* transport :
+       report->GetStatsOfType<webrtc::RTCTransportStats>()) {
+    if (!transport->selected_candidate_pair_id.is_defined()) {
+      continue;
+    }
+    const webrtc::RTCStats* stats =
+        report->Get(*transport->selected_candidate_pair_id);
+    if (stats == nullptr ||
+        stats->type() != webrtc::RTCIceCandidatePairStats::kType) {
+      continue;
+    }
+    const auto& pair = stats->cast_to<webrtc::RTCIceCandidatePairStats>();
+    if (pair.current_round_trip_time.is_defined()) {
+      sample->rtt_ms = *pair.current_round_trip_time * 1000;
+    }
+    if (pair.available_outgoing_bitrate.is_defined()) {
+      sample->available_outgoing_bitrate_bps =
+          *pair.available_outgoing_bitrate;
+    }
+  }
+
+  for (const auto* outbound :
+       report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+    if (!outbound->kind.is_defined() || !outbound->bytes_sent.is_defined()) {
+      continue;
+    }
+    if (*outbound->kind == "audio") {
+      totals.audio_bytes_sent += *outbound->bytes_sent;
+      continue;
+    }
+    totals.video_bytes_sent += *outbound->bytes_sent;
+    if (outbound->packets_sent.is_defined()) {
+      totals.video_packets_sent += *outbound->packets_sent;
+    }
+    if (outbound->frames_encoded.is_defined()) {
+      totals.frames_encoded += *outbound->frames_encoded;
+    }
+    if (outbound->total_encode_time.is_defined()) {
+      totals.total_encode_time += *outbound->total_encode_time;
+    }
+    if (outbound->total_packet_send_delay.is_defined()) {
+      totals.total_packet_send_delay += *outbound->total_packet_send_delay;
+    }
+    if (outbound->retransmitted_bytes_sent.is_defined()) {
+      totals.retransmitted_bytes_sent += *outbound->retransmitted_bytes_sent;
+    }
+    if (outbound->nack_count.is_defined()) {
+      totals.nacks_received += *outbound->nack_count;
+    }
+  }
+
+  for (const auto* remote :
+       report->GetStatsOfType<webrtc::RTCRemoteInboundRtpStreamStats>()) {
+    if (!remote->kind.is_defined() || *remote->kind != "video") {
+      continue;
+    }
+    if (remote->packets_lost.is_defined()) {
+      totals.remote_packets_lost += *remote->packets_lost;
+    }
+    if (remote->jitter.is_defined()) {
+      sample->remote_jitter_ms =
+          std::max(sample->remote_jitter_ms, *remote->jitter * 1000);
+    }
+  }
+
+  for (const auto* inbound :
+       report->GetStatsOfType<webrtc::RTCInboundRTPStreamStats>()) {
+    if (!inbound->kind.is_defined()) {
+      continue;
+    }
+    if (*inbound->kind == "audio") {
+      if (inbound->jitter_buffer_delay.is_defined()) {
+        totals.audio_jitter_buffer_delay += *inbound->jitter_buffer_delay;
+      }
+      if (inbound->jitter_buffer_emitted_count.is_defined()) {
+        totals.audio_jitter_buffer_emitted_count +=
+            *inbound->jitter_buffer_emitted_count;
+      }
+      continue;
+    }
+    if (*inbound->kind != "video") {
+      continue;
+    }
+    if (inbound->bytes_received.is_defined()) {
+      totals.video_bytes_received += *inbound->bytes_received;
+    }
+    if (inbound->packets_received.is_defined()) {
+      totals.video_packets_received += *inbound->packets_received;
+    }
+    if (inbound->packets_lost.is_defined()) {
+      totals.video_packets_lost += *inbound->packets_lost;
+    }
+    if (inbound->frames_decoded.is_defined()) {
+      totals.frames_decoded += *inbound->frames_decoded;
+    }
+    if (inbound->jitter_buffer_delay.is_defined()) {
+      totals.jitter_buffer_delay += *inbound->jitter_buffer_delay;
+    }
+    if (inbound->jitter_buffer_emitted_count.is_defined()) {
+      totals.jitter_buffer_emitted_count +=
+          *inbound->jitter_buffer_emitted_count;
+    }
+    if (inbound->nack_count.is_defined()) {
+      totals.nacks_sent += *inbound->nack_count;
+    }
+    if (inbound->fec_packets_received.is_defined()) {
+      totals.fec_packets_received += *inbound->fec_packets_received;
+    }
+  }
+  return totals;
+}
+
+void StatsSampler::SetDeltas(const Totals& previous,
+                             const Totals& current,
+                             Sample* sample) {
+  const double interval_us =
+      Delta(previous.timestamp_us, current.timestamp_us);
+  sample->interval_ms = static_cast<int64_t>(interval_us / 1000);
+  if (interval_us <= 0) {
+    return;
+  }
+  const double interval_sec = interval_us / rtc::kNumMicrosecsPerSec;
+
+  sample->video_bitrate_bps =
+      Delta(previous.video_bytes_sent, current.video_bytes_sent) * 8 /
+      interval_sec;
+  sample->audio_bitrate_bps =
+      Delta(previous.audio_bytes_sent, current.audio_bytes_sent) * 8 /
+      interval_sec;
+  const double frames = Delta(previous.frames_encoded, current.frames_encoded);
+  sample->video_fps = frames / interval_sec;
+  sample->encode_ms_per_frame =
+      Ratio(Delta(previous.total_encode_time, current.total_encode_time) * 1000,
+            frames);
+  const double packets =
+      Delta(previous.video_packets_sent, current.video_packets_sent);
+  sample->pacer_delay_ms =
+      Ratio(Delta(previous.total_packet_send_delay,
+                  current.total_packet_send_delay) *
+                1000,
+            packets);
+  const double lost =
+      Delta(previous.remote_packets_lost, current.remote_packets_lost);
+  sample->loss_rate = std::min(Ratio(lost, packets), 1.0);
+  sample->retransmitted_bitrate_bps =
+      Delta(previous.retransmitted_bytes_sent,
+            current.retransmitted_bytes_sent) *
+      8 / interval_sec;
+  sample->nacks_received_per_sec =
+      Delta(previous.nacks_received, current.nacks_received) / interval_sec;
+
+  sample->received_video_bitrate_bps =
+      Delta(previous.video_bytes_received, current.video_bytes_received) * 8 /
+      interval_sec;
+  sample->received_video_fps =
+      Delta(previous.frames_decoded, current.frames_decoded) / interval_sec;
+  const double received_lost =
+      Delta(previous.video_packets_lost, current.video_packets_lost);
+  sample->received_loss_rate = Ratio(
+      received_lost,
+      Delta(previous.video_packets_received, current.video_packets_received) +
+          received_lost);
+  sample->jitter_buffer_delay_ms =
+      Ratio(Delta(previous.jitter_buffer_delay, current.jitter_buffer_delay) *
+                1000,
+            Delta(previous.jitter_buffer_emitted_count,
+                  current.jitter_buffer_emitted_count));
+  sample->audio_jitter_buffer_delay_ms =
+      Ratio(Delta(previous.audio_jitter_buffer_delay,
+                  current.audio_jitter_buffer_delay) *
+                1000,
+            Delta(previous.audio_jitter_buffer_emitted_count,
+                  current.audio_jitter_buffer_emitted_count));
+  sample->nacks_sent_per_sec =
+      Delta(previous.nacks_sent, current.nacks_sent) / interval_sec;
+  sample->received_fec_packets_per_sec =
+      Delta(previous.fec_packets_received, current.fec_packets_received) /
+      interval_sec;
+}
+
+std::vector<StatsSampler::Series> StatsSampler::GetSeries() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Series> series;
+  for (const auto& pair : entries_) {
+    Series s;
+    s.id = pair.second.id;
+    s.samples.assign(pair.second.samples.begin(), pair.second.samples.end());
+    series.push_back(std::move(s));
+  }
+  std::sort(series.begin(), series.end(),
+            [](const Series& a, const Series& b) { return a.id < b.id; });
+  return series;
+}
+
+std::vector<StatsSampler::Series> StatsSampler::GetLatest() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Series> series;
+  for (const auto& pair : entries_) {
+    if (pair.second.samples.empty()) {
+      continue;
+    }
+    Series s;
+    s.id = pair.second.id;
+    s.samples.push_back(pair.second.samples.back());
+    series.push_back(std::move(s));
+  }
+  std::sort(series.begin(), series.end(),
+            [](const Series& a, const Series& b) { return a.id < b.id; });
+  return series;
+}
+
+nlohmann::json StatsSampler::ToJson(size_t max_samples) {
+  nlohmann::json connections = nlohmann::json::array();
+  for (const auto& series : GetSeries()) {
+    nlohmann::json samples = nlohmann::json::array();
+    const size_t begin = series.samples.size() > max_samples
+                             ? series.samples.size() - max_samples
+                             : 0;
+    for (size_t i = begin; i < series.samples.size(); i++) {
+      samples.push_back(series.samples[i].ToJson());
+    }
+    connections.push_back({{"id", series.id}, {"samples", samples}});
+  }
+  return {{"interval_ms", settings_.interval_ms},
+          {"connections", connections}};
+}
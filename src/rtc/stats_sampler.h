@@ -0,0 +1,168 @@
+#ifndef STATS_SAMPLER_H_
+#define STATS_SAMPLER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// WebRTC
+#include "api/scoped_refptr.h"
+#include "api/stats/rtc_stats_report.h"
+
+class RTCConnection;
+class RTCManager;
+
+// 全ての接続の RTCStats を一定間隔で取得して、前回との差分から求めた値を接続毎に溜めておくクラス。
+//
+// 統計情報が届いたシグナリングスレッドで、必要な値だけを取り出して差分を計算する。
+// RTCStatsReport 全体を JSON にすることはせず、溜めた値はメトリクス、ログ、DataChannel、
+// LatencyController から参照する。
+// 溜める数は max_samples までで、古いものから捨てる。破棄された接続の値も捨てる。
+// Start() と Stop() は io_context のスレッドから呼び、それ以外は任意のスレッドから呼んで良い。
+class StatsSampler : public std::enable_shared_from_this<StatsSampler> {
+ public:
+  struct Settings {
+    // 0 以下の場合は Create() が nullptr を返す
+    int interval_ms = 0;
+    int max_samples = 60;
+    // true の場合、取得する度に INFO でログに出力する
+    bool log = false;
+  };
+
+  // 前回の取得からの差分で求めた値。値が無い場合は 0 になる
+  struct Sample {
+    // 取得した時刻 (UTC のミリ秒)
+    int64_t timestamp_ms = 0;
+    // 前回の取得からの時間。最初の取得では 0
+    int64_t interval_ms = 0;
+    double video_bitrate_bps = 0;
+    double audio_bitrate_bps = 0;
+    double video_fps = 0;
+    // エンコードと、ペーサーで送信を待った平均の時間
+    double encode_ms_per_frame = 0;
+    double pacer_delay_ms = 0;
+    // 受信側から報告された、送信したパケットのうち失われた割合
+    double loss_rate = 0;
+    double rtt_ms = 0;
+    double available_outgoing_bitrate_bps = 0;
+    double remote_jitter_ms = 0;
+    // --video-protection の効果を見るための値。
+    // 再送した映像のビットレートと、受信側から届いた NACK の数 (毎秒)
+    double retransmitted_bitrate_bps = 0;
+    double nacks_received_per_sec = 0;
+    // 受信している映像の値
+    double received_video_bitrate_bps = 0;
+    double received_video_fps = 0;
+    double received_loss_rate = 0;
+    double jitter_buffer_delay_ms = 0;
+    // 受信した映像のうち、自分が送った NACK の数と、受信した FEC パケットの数 (毎秒)
+    double nacks_sent_per_sec = 0;
+    double received_fec_packets_per_sec = 0;
+    // 受信している音声の値。
+    // estimated_mouth_to_ear_ms は RTT の半分、ジッターバッファ、スピーカーの遅延の合計で、
+    // 相手側の録音とエンコードの遅延は含まない
+    double audio_jitter_buffer_delay_ms = 0;
+    double audio_playout_delay_ms = 0;
+    double estimated_mouth_to_ear_ms = 0;
+
+    nlohmann::json ToJson() const;
+  };
+
+  struct Series {
+    // 接続毎に振る番号。接続が作り直されると新しい番号になる
+    int id = 0;
+    std::vector<Sample> samples;
+  };
+
+  // Sample を取得する度にシグナリングスレッドから呼ばれる
+  typedef std::function<void(int id,
+                             const std::shared_ptr<RTCConnection>& connection,
+                             const Sample& sample)>
+      Listener;
+
+  static std::shared_ptr<StatsSampler> Create(boost::asio::io_context& ioc,
+                                              RTCManager* rtc_manager,
+                                              Settings settings);
+
+  StatsSampler(boost::asio::io_context& ioc,
+               RTCManager* rtc_manager,
+               Settings settings);
+
+  int interval_ms() const { return settings_.interval_ms; }
+
+  void Start();
+  // 以降は Listener を呼ばない。Listener が参照しているオブジェクトを破棄する前に呼ぶこと
+  void Stop();
+  void AddListener(Listener listener);
+
+  // 接続毎に、最新の max_samples 個までの値を古いものから並べて返す
+  std::vector<Series> GetSeries();
+  // 接続毎の最新の値だけを返す
+  std::vector<Series> GetLatest();
+  // {"interval_ms": 1000, "connections": [{"id": 0, "samples": [...]}]}
+  nlohmann::json ToJson(size_t max_samples);
+
+ private:
+  // 差分を求めるために覚えておく前回の累積値
+  struct Totals {
+    int64_t timestamp_us = 0;
+    uint64_t video_bytes_sent = 0;
+    uint64_t audio_bytes_sent = 0;
+    uint64_t video_packets_sent = 0;
+    uint64_t frames_encoded = 0;
+    double total_encode_time = 0;
+    double total_packet_send_delay = 0;
+    uint64_t retransmitted_bytes_sent = 0;
+    uint64_t nacks_received = 0;
+    int64_t remote_packets_lost = 0;
+    uint64_t video_bytes_received = 0;
+    uint64_t video_packets_received = 0;
+    int64_t video_packets_lost = 0;
+    uint64_t frames_decoded = 0;
+    double jitter_buffer_delay = 0;
+    uint64_t jitter_buffer_emitted_count = 0;
+    uint64_t nacks_sent = 0;
+    uint64_t fec_packets_received = 0;
+    double audio_jitter_buffer_delay = 0;
+    uint64_t audio_jitter_buffer_emitted_count = 0;
+  };
+  struct Entry {
+    int id = 0;
+    std::weak_ptr<RTCConnection> connection;
+    bool has_totals = false;
+    Totals totals;
+    std::deque<Sample> samples;
+  };
+
+  void OnTimer();
+  void OnStats(RTCConnection* key,
+               const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+  static Totals GetTotals(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report,
+      Sample* sample);
+  static void SetDeltas(const Totals& previous,
+                        const Totals& current,
+                        Sample* sample);
+
+  boost::asio::steady_timer timer_;
+  RTCManager* rtc_manager_;
+  const Settings settings_;
+
+  std::mutex mutex_;
+  bool stopped_ = false;
+  std::vector<Listener> listeners_;
+  std::map<RTCConnection*, Entry> entries_;
+  int next_id_ = 0;
+};
+
+#endif  // STATS_SAMPLER_H_
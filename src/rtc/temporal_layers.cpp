@@ -0,0 +1,58 @@
+#include "temporal_layers.h"
+
+#include <algorithm>
+
+namespace {
+
+const int kMaxLayers = 3;
+// 各パターンの位置のレイヤー
+const uint8_t kPattern2[] = {0, 1};
+const uint8_t kPattern3[] = {0, 2, 1, 2};
+
+}  // namespace
+
+TemporalLayers::TemporalLayers(int num_layers)
+    : num_layers_(std::max(1, std::min(num_layers, kMaxLayers))) {}
+
+TemporalLayers::Frame TemporalLayers::NextFrame(bool key_frame) {
+  Frame frame;
+  if (num_layers_ <= 1) {
+    return frame;
+  }
+  if (key_frame) {
+    pattern_idx_ = 0;
+  }
+  if (num_layers_ == 2) {
+    frame.temporal_idx = kPattern2[pattern_idx_ % sizeof(kPattern2)];
+  } else {
+    frame.temporal_idx = kPattern3[pattern_idx_ % sizeof(kPattern3)];
+  }
+  frame.reference = frame.temporal_idx == 0;
+  pattern_idx_++;
+  return frame;
+}
+
+void TemporalLayers::SetCodecSpecific(
+    const Frame& frame,
+    bool key_frame,
+    webrtc::CodecSpecificInfoH264* info) const {
+  info->temporal_idx = frame.temporal_idx;
+  info->idr_frame = key_frame;
+  // TL1 以上のフレームは全て TL0 だけを参照している
+  info->base_layer_sync = frame.temporal_idx != webrtc::kNoTemporalIdx &&
+                          frame.temporal_idx > 0;
+}
+
+void TemporalLayers::SetFpsAllocation(
+    webrtc::VideoEncoder::EncoderInfo* info) const {
+  if (num_layers_ <= 1) {
+    return;
+  }
+  info->fps_allocation[0].clear();
+  // 上のレイヤーほどフレームレートが倍になる
+  for (int i = 0; i < num_layers_; i++) {
+    info->fps_allocation[0].push_back(
+        webrtc::VideoEncoder::EncoderInfo::kMaxFramerateFraction >>
+        (num_layers_ - 1 - i));
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef TEMPORAL_LAYERS_H_
+#define TEMPORAL_LAYERS_H_
+
+#include <stdint.h>
+
+// WebRTC
+#include "api/video_codecs/video_encoder.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+
+// ハードウェアの H264 エンコーダで時間方向のレイヤー (L1T2, L1T3) を作るために、
+// 各フレームのレイヤーを決めるクラス。
+//
+// TL0 だけを参照フレームにして、TL1 以上は参照されないフレームにする。
+// TL1 以上のフレームは直前の TL0 だけを参照するので、上のレイヤーをいくつ捨てても
+// 残りのフレームはデコードできる。
+// L1T2 は 0, 1 を、L1T3 は 0, 2, 1, 2 を繰り返し、キーフレームで最初に戻る。
+// エンコードするスレッドから呼び出すこと。
+class TemporalLayers {
+ public:
+  struct Frame {
+    // 1 レイヤーの場合は webrtc::kNoTemporalIdx
+    uint8_t temporal_idx = webrtc::kNoTemporalIdx;
+    // 後のフレームから参照されるかどうか
+    bool reference = true;
+  };
+
+  // num_layers は 1 から 3 に丸める
+  explicit TemporalLayers(int num_layers);
+
+  int num_layers() const { return num_layers_; }
+
+  // フレーム毎に呼び出して、このフレームのレイヤーを返す
+  Frame NextFrame(bool key_frame);
+  // CodecSpecificInfo に frame のレイヤーの情報を設定する
+  void SetCodecSpecific(const Frame& frame,
+                        bool key_frame,
+                        webrtc::CodecSpecificInfoH264* info) const;
+  // 各レイヤーまでのフレームレートの割合を info->fps_allocation に設定する
+  void SetFpsAllocation(webrtc::VideoEncoder::EncoderInfo* info) const;
+
+ private:
+  const int num_layers_;
+  uint32_t pattern_idx_ = 0;
+};
+
+#endif  // TEMPORAL_LAYERS_H_
@@ -0,0 +1,205 @@
+#include "thread_placement.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "rtc_base/logging.h"
+
+namespace {
+
+// cpu_set_t で扱える CPU の数
+const int kMaxCpus = 1024;
+
+// "0-1,3" を CPU の番号のリストにする
+bool ParseCpus(const std::string& str, std::vector<int>* cpus) {
+  cpus->clear();
+  size_t pos = 0;
+  while (pos <= str.size()) {
+    size_t end = str.find(',', pos);
+    if (end == std::string::npos) {
+      end = str.size();
+    }
+    std::string item = str.substr(pos, end - pos);
+    if (item.empty()) {
+      return false;
+    }
+    size_t dash = item.find('-');
+    char* p;
+    long first = strtol(item.c_str(), &p, 10);
+    long last = first;
+    if (dash == std::string::npos) {
+      if (*p != '\0') {
+        return false;
+      }
+    } else {
+      if (p != item.c_str() + dash) {
+        return false;
+      }
+      const char* second = item.c_str() + dash + 1;
+      last = strtol(second, &p, 10);
+      if (p == second || *p != '\0') {
+        return false;
+      }
+    }
+    if (first < 0 || last < first || last >= kMaxCpus) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(static_cast<int>(cpu));
+    }
+    pos = end + 1;
+  }
+  return !cpus->empty();
+}
+
+}  // namespace
+
+const std::vector<std::string>& ThreadPlacement::Roles() {
+  static const std::vector<std::string> roles = {
+      // WebRTC のスレッド
+      "network",
+      "worker",
+      "signaling",
+      // boost::asio の io_context を回すメインスレッド
+      "io",
+      // --io-threads が 2 以上の場合の、シリアルやソケットの DataChannel の入出力
+      "data",
+      // カメラのキャプチャと変換
+      "capture",
+      // エンコーダとデコーダ
+      "encoder",
+      "decoder",
+      // SDL と DRM の表示
+      "renderer",
+      // --record-dir の書き込み
+      "recorder",
+      // --shm-export の共有メモリへのコピー
+      "exporter",
+      // 大きなフレームの縮小
+      "scaler",
+  };
+  return roles;
+}
+
+ThreadPlacement& ThreadPlacement::Instance() {
+  static ThreadPlacement instance;
+  return instance;
+}
+
+bool ThreadPlacement::Parse(const std::string& spec,
+                            std::string* role,
+                            std::vector<int>* cpus,
+                            int* priority,
+                            std::string* error) {
+  size_t eq = spec.find('=');
+  if (eq == std::string::npos) {
+    *error = "Expected ROLE=CPUS[:PRIORITY]";
+    return false;
+  }
+  *role = spec.substr(0, eq);
+  const auto& roles = Roles();
+  if (std::find(roles.begin(), roles.end(), *role) == roles.end()) {
+    *error = "Unknown thread role: " + *role;
+    return false;
+  }
+  std::string value = spec.substr(eq + 1);
+  *priority = 0;
+  size_t colon = value.find(':');
+  if (colon != std::string::npos) {
+    std::string prio = value.substr(colon + 1);
+    char* p;
+    long n = strtol(prio.c_str(), &p, 10);
+    if (prio.empty() || *p != '\0' || n < 1 || n > 99) {
+      *error = "Priority must be between 1 and 99: " + prio;
+      return false;
+    }
+    *priority = static_cast<int>(n);
+    value = value.substr(0, colon);
+  }
+  if (!ParseCpus(value, cpus)) {
+    *error = "Invalid CPU list: " + value;
+    return false;
+  }
+  return true;
+}
+
+bool ThreadPlacement::Configure(const std::vector<std::string>& specs) {
+  std::map<std::string, Placement> placements;
+  for (const auto& spec : specs) {
+    std::string role;
+    Placement placement;
+    std::string error;
+    if (!Parse(spec, &role, &placement.cpus, &placement.priority, &error)) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": " << error;
+      return false;
+    }
+    placements[role] = placement;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  placements_ = std::move(placements);
+  return true;
+}
+
+void ThreadPlacement::Apply(const std::string& role, const char* name) {
+#if defined(__linux__)
+  if (name != nullptr) {
+    // スレッド名は終端を含めて 16 バイトまで
+    char buf[16];
+    strncpy(buf, name, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    pthread_setname_np(pthread_self(), buf);
+  }
+
+  Placement placement;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = placements_.find(role);
+    if (it == placements_.end()) {
+      return;
+    }
+    placement = it->second;
+  }
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : placement.cpus) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (err != 0) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Failed to set affinity of "
+                        << role << " thread. error = " << err;
+  }
+  if (placement.priority > 0) {
+    // CAP_SYS_NICE が無いと失敗するので、その場合は警告だけ出して続ける
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = placement.priority;
+    err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": Failed to set SCHED_FIFO "
+                          << placement.priority << " to " << role
+                          << " thread. error = " << err;
+    }
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": role=" << role
+                   << " cpus=" << placement.cpus.size()
+                   << " priority=" << placement.priority;
+#endif
+}
+
+void ThreadPlacement::ApplyOnce(const std::string& role, const char* name) {
+  static thread_local bool applied = false;
+  if (applied) {
+    return;
+  }
+  applied = true;
+  Apply(role, name);
+}
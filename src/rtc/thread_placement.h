@@ -0,0 +1,51 @@
+#ifndef THREAD_PLACEMENT_H_
+#define THREAD_PLACEMENT_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Momo のスレッドを役割毎にどの CPU で動かすか、どの優先度で動かすかの設定。
+//
+// 設定は ROLE=CPUS[:PRIORITY] の形式で、CPUS は "0-1,3" のような CPU の番号のリスト、
+// PRIORITY は 1〜99 の SCHED_FIFO の優先度を指定する。PRIORITY を省略した場合はスケジューリングポリシーを変えない。
+//
+// 各スレッドは自分自身の中で Apply() を呼び出して設定を反映する。
+// エンコーダのコールバックのようにライブラリが作ったスレッドは、
+// 最初のコールバックで ApplyOnce() を呼び出して設定を反映する。
+// Linux 以外では何もしない。
+class ThreadPlacement {
+ public:
+  // 設定できる役割の一覧
+  static const std::vector<std::string>& Roles();
+
+  static ThreadPlacement& Instance();
+
+  // 設定を 1 つ解釈する。形式が間違っている場合は false を返して error に理由を入れる
+  static bool Parse(const std::string& spec,
+                    std::string* role,
+                    std::vector<int>* cpus,
+                    int* priority,
+                    std::string* error);
+  // 起動時にスレッドを作る前に呼ぶこと
+  bool Configure(const std::vector<std::string>& specs);
+
+  // 呼び出したスレッドに role の設定を反映する。
+  // name が指定されている場合はスレッド名も設定する (15 文字まで)
+  void Apply(const std::string& role, const char* name = nullptr);
+  // 同じスレッドで 2 回目以降に呼び出された場合は何もしない
+  void ApplyOnce(const std::string& role, const char* name = nullptr);
+
+ private:
+  struct Placement {
+    std::vector<int> cpus;
+    // 0 の場合はスケジューリングポリシーを変えない
+    int priority = 0;
+  };
+
+  std::mutex mutex_;
+  std::map<std::string, Placement> placements_;
+};
+
+#endif  // THREAD_PLACEMENT_H_
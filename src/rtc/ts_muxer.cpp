@@ -0,0 +1,274 @@
+#include "ts_muxer.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace {
+
+const size_t kPacketSize = 188;
+const uint16_t kPatPid = 0x0000;
+const uint16_t kPmtPid = 0x1000;
+const uint16_t kVideoPid = 0x0100;
+const uint16_t kAudioPid = 0x0101;
+const uint8_t kVideoStreamId = 0xe0;
+// private_stream_1
+const uint8_t kAudioStreamId = 0xbd;
+const uint8_t kH264StreamType = 0x1b;
+const uint8_t kPrivateStreamType = 0x06;
+// PCR を入れる最大の間隔 (90kHz)。規格上の上限は 100 ミリ秒
+const int64_t kPcrInterval = 90000 / 25;
+
+// MPEG-2 の CRC32 (多項式 0x04C11DB7、反転なし)
+uint32_t Crc32(const uint8_t* data, size_t size) {
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= static_cast<uint32_t>(data[i]) << 24;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+void AppendPts(uint8_t prefix, int64_t pts, std::vector<uint8_t>* out) {
+  pts &= 0x1ffffffffLL;
+  out->push_back((prefix << 4) | (((pts >> 30) & 0x07) << 1) | 1);
+  out->push_back((pts >> 22) & 0xff);
+  out->push_back((((pts >> 15) & 0x7f) << 1) | 1);
+  out->push_back((pts >> 7) & 0xff);
+  out->push_back(((pts & 0x7f) << 1) | 1);
+}
+
+// PES ヘッダ。payload_size が 0 の場合は長さを指定しない (映像のみ許される)
+std::vector<uint8_t> PesHeader(uint8_t stream_id,
+                               int64_t pts,
+                               size_t payload_size) {
+  std::vector<uint8_t> header = {0x00, 0x00, 0x01, stream_id};
+  // PES_packet_length はこの後ろのヘッダ 3 バイトと PTS 5 バイトを含む
+  size_t length = payload_size == 0 ? 0 : payload_size + 8;
+  if (length > 0xffff) {
+    length = 0;
+  }
+  header.push_back((length >> 8) & 0xff);
+  header.push_back(length & 0xff);
+  // '10' + フラグ無し、PTS のみ、PES_header_data_length = 5
+  header.push_back(0x80);
+  header.push_back(0x80);
+  header.push_back(0x05);
+  AppendPts(0x02, pts, &header);
+  return header;
+}
+
+}  // namespace
+
+TsMuxer::TsMuxer(bool has_video, bool has_audio, int audio_channels)
+    : has_video_(has_video),
+      has_audio_(has_audio),
+      audio_channels_(audio_channels) {}
+
+void TsMuxer::WriteTables(std::vector<uint8_t>* out) {
+  // PAT: program_number 1 の PMT だけを載せる
+  std::vector<uint8_t> pat = {
+      0x00,        // table_id
+      0xb0, 0x0d,  // section_length = 13
+      0x00, 0x01,  // transport_stream_id
+      0xc1,        // version 0, current_next_indicator
+      0x00, 0x00,  // section_number, last_section_number
+      0x00, 0x01,  // program_number
+      static_cast<uint8_t>(0xe0 | (kPmtPid >> 8)),
+      static_cast<uint8_t>(kPmtPid & 0xff)};
+  WriteSection(kPatPid, pat, out);
+
+  const uint16_t pcr_pid = has_video_ ? kVideoPid : kAudioPid;
+  std::vector<uint8_t> pmt = {
+      0x02,        // table_id
+      0xb0, 0x00,  // section_length は後で埋める
+      0x00, 0x01,  // program_number
+      0xc1,        // version 0, current_next_indicator
+      0x00, 0x00,  // section_number, last_section_number
+      static_cast<uint8_t>(0xe0 | (pcr_pid >> 8)),
+      static_cast<uint8_t>(pcr_pid & 0xff),
+      0xf0, 0x00};  // program_info_length = 0
+  if (has_video_) {
+    pmt.insert(pmt.end(),
+               {kH264StreamType, static_cast<uint8_t>(0xe0 | (kVideoPid >> 8)),
+                static_cast<uint8_t>(kVideoPid & 0xff), 0xf0, 0x00});
+  }
+  if (has_audio_) {
+    pmt.insert(pmt.end(),
+               {kPrivateStreamType,
+                static_cast<uint8_t>(0xe0 | (kAudioPid >> 8)),
+                static_cast<uint8_t>(kAudioPid & 0xff), 0xf0, 0x0a,
+                // registration_descriptor 'Opus'
+                0x05, 0x04, 'O', 'p', 'u', 's',
+                // extension_descriptor: channel_config_code (1ch か 2ch)
+                0x7f, 0x02, 0x80,
+                static_cast<uint8_t>(std::min(std::max(audio_channels_, 1), 2))});
+  }
+  // section_length は CRC を含み、section_length の直後から数える
+  size_t section_length = pmt.size() - 3 + 4;
+  pmt[1] = 0xb0 | ((section_length >> 8) & 0x0f);
+  pmt[2] = section_length & 0xff;
+  WriteSection(kPmtPid, pmt, out);
+}
+
+void TsMuxer::WriteVideo(const uint8_t* data,
+                         size_t size,
+                         int64_t pts,
+                         bool key_frame,
+                         std::vector<uint8_t>* out) {
+  if (!has_video_) {
+    return;
+  }
+  if (key_frame) {
+    WriteTables(out);
+  }
+  std::vector<uint8_t> header = PesHeader(kVideoStreamId, pts, 0);
+  // 多くのデコーダが要求する Access Unit Delimiter を先頭に入れる
+  header.insert(header.end(), {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0});
+  bool with_pcr = key_frame || last_pcr_ < 0 || pts - last_pcr_ >= kPcrInterval;
+  WritePes(kVideoPid, header, data, size, with_pcr, pts,
+           key_frame, out);
+}
+
+void TsMuxer::WriteAudio(const uint8_t* data,
+                         size_t size,
+                         int64_t pts,
+                         std::vector<uint8_t>* out) {
+  if (!has_audio_) {
+    return;
+  }
+  // opus_control_header: 0x7fe0 に続けて、au_size を 0xff の連続と残りで表す
+  std::vector<uint8_t> control = {0x7f, 0xe0};
+  size_t remaining = size;
+  while (remaining >= 0xff) {
+    control.push_back(0xff);
+    remaining -= 0xff;
+  }
+  control.push_back(static_cast<uint8_t>(remaining));
+
+  std::vector<uint8_t> header =
+      PesHeader(kAudioStreamId, pts, control.size() + size);
+  header.insert(header.end(), control.begin(), control.end());
+  bool with_pcr =
+      !has_video_ && (last_pcr_ < 0 || pts - last_pcr_ >= kPcrInterval);
+  WritePes(kAudioPid, header, data, size, with_pcr, pts,
+           !has_video_, out);
+}
+
+void TsMuxer::WritePes(uint16_t pid,
+                       const std::vector<uint8_t>& header,
+                       const uint8_t* data,
+                       size_t size,
+                       bool with_pcr,
+                       int64_t pcr,
+                       bool random_access,
+                       std::vector<uint8_t>* out) {
+  const size_t total = header.size() + size;
+  size_t pos = 0;
+  bool first = true;
+  while (pos < total) {
+    uint8_t packet[kPacketSize];
+    packet[0] = 0x47;
+    packet[1] = (first ? 0x40 : 0x00) | ((pid >> 8) & 0x1f);
+    packet[2] = pid & 0xff;
+
+    // アダプテーションフィールドの中身 (長さのバイトを除く)
+    uint8_t adaptation[kPacketSize];
+    size_t adaptation_size = 0;
+    bool has_adaptation = false;
+    if (first && (with_pcr || random_access)) {
+      has_adaptation = true;
+      uint8_t flags = 0;
+      if (random_access) {
+        flags |= 0x40;
+      }
+      adaptation[adaptation_size++] = flags;
+      if (with_pcr) {
+        adaptation[0] |= 0x10;
+        int64_t base = pcr & 0x1ffffffffLL;
+        adaptation[adaptation_size++] = (base >> 25) & 0xff;
+        adaptation[adaptation_size++] = (base >> 17) & 0xff;
+        adaptation[adaptation_size++] = (base >> 9) & 0xff;
+        adaptation[adaptation_size++] = (base >> 1) & 0xff;
+        adaptation[adaptation_size++] = ((base & 0x01) << 7) | 0x7e;
+        adaptation[adaptation_size++] = 0x00;
+        last_pcr_ = pcr;
+      }
+    }
+
+    size_t capacity = kPacketSize - 4 - (has_adaptation ? 1 + adaptation_size : 0);
+    size_t payload_size = std::min(capacity, total - pos);
+    if (payload_size < capacity) {
+      // 足りない分はアダプテーションフィールドのスタッフィングで埋める
+      size_t stuffing = capacity - payload_size;
+      if (!has_adaptation) {
+        has_adaptation = true;
+        stuffing -= 1;
+        if (stuffing > 0) {
+          adaptation[adaptation_size++] = 0x00;
+          stuffing -= 1;
+        }
+      }
+      memset(adaptation + adaptation_size, 0xff, stuffing);
+      adaptation_size += stuffing;
+    }
+
+    packet[3] = (has_adaptation ? 0x30 : 0x10) | NextCounter(pid);
+    size_t offset = 4;
+    if (has_adaptation) {
+      packet[offset++] = static_cast<uint8_t>(adaptation_size);
+      memcpy(packet + offset, adaptation, adaptation_size);
+      offset += adaptation_size;
+    }
+    // ヘッダとデータの 2 つから続けてコピーする
+    size_t end = pos + payload_size;
+    while (pos < end) {
+      if (pos < header.size()) {
+        size_t n = std::min(header.size(), end) - pos;
+        memcpy(packet + offset, header.data() + pos, n);
+        offset += n;
+        pos += n;
+      } else {
+        size_t n = end - pos;
+        memcpy(packet + offset, data + (pos - header.size()), n);
+        offset += n;
+        pos += n;
+      }
+    }
+    out->insert(out->end(), packet, packet + kPacketSize);
+    first = false;
+  }
+}
+
+void TsMuxer::WriteSection(uint16_t pid,
+                           const std::vector<uint8_t>& section,
+                           std::vector<uint8_t>* out) {
+  uint8_t packet[kPacketSize];
+  memset(packet, 0xff, kPacketSize);
+  packet[0] = 0x47;
+  packet[1] = 0x40 | ((pid >> 8) & 0x1f);
+  packet[2] = pid & 0xff;
+  packet[3] = 0x10 | NextCounter(pid);
+  // pointer_field
+  packet[4] = 0x00;
+  memcpy(packet + 5, section.data(), section.size());
+  uint32_t crc = Crc32(section.data(), section.size());
+  uint8_t* p = packet + 5 + section.size();
+  p[0] = (crc >> 24) & 0xff;
+  p[1] = (crc >> 16) & 0xff;
+  p[2] = (crc >> 8) & 0xff;
+  p[3] = crc & 0xff;
+  out->insert(out->end(), packet, packet + kPacketSize);
+}
+
+uint8_t TsMuxer::NextCounter(uint16_t pid) {
+  uint8_t* counter = pid == kPatPid    ? &pat_counter_
+                     : pid == kPmtPid  ? &pmt_counter_
+                     : pid == kVideoPid ? &video_counter_
+                                        : &audio_counter_;
+  uint8_t value = *counter;
+  *counter = (*counter + 1) & 0x0f;
+  return value;
+}
@@ -0,0 +1,57 @@
+#ifndef TS_MUXER_H_
+#define TS_MUXER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// エンコード済みの H.264 (Annex B) と Opus を MPEG-TS (ISO/IEC 13818-1) に多重化する。
+//
+// MPEG-TS は 188 バイトのパケットが独立しているので、書いている途中でプロセスが落ちても
+// それまでに書いた部分はそのまま再生できる。
+// Opus は FFmpeg などと同じく private_stream_1 にして 'Opus' の registration_descriptor
+// を付け、各パケットの先頭に opus_control_header を入れる。
+//
+// タイムスタンプは全て 90kHz で渡すこと。出力は out の末尾に追加する。
+class TsMuxer {
+ public:
+  TsMuxer(bool has_video, bool has_audio, int audio_channels);
+
+  // PAT と PMT を書く。セグメントの先頭とキーフレームの前に書くこと
+  void WriteTables(std::vector<uint8_t>* out);
+  void WriteVideo(const uint8_t* data,
+                  size_t size,
+                  int64_t pts,
+                  bool key_frame,
+                  std::vector<uint8_t>* out);
+  void WriteAudio(const uint8_t* data,
+                  size_t size,
+                  int64_t pts,
+                  std::vector<uint8_t>* out);
+
+ private:
+  void WritePes(uint16_t pid,
+                const std::vector<uint8_t>& header,
+                const uint8_t* data,
+                size_t size,
+                bool with_pcr,
+                int64_t pcr,
+                bool random_access,
+                std::vector<uint8_t>* out);
+  void WriteSection(uint16_t pid,
+                    const std::vector<uint8_t>& section,
+                    std::vector<uint8_t>* out);
+  uint8_t NextCounter(uint16_t pid);
+
+  const bool has_video_;
+  const bool has_audio_;
+  const int audio_channels_;
+  uint8_t pat_counter_ = 0;
+  uint8_t pmt_counter_ = 0;
+  uint8_t video_counter_ = 0;
+  uint8_t audio_counter_ = 0;
+  int64_t last_pcr_ = -1;
+};
+
+#endif  // TS_MUXER_H_
@@ -0,0 +1,160 @@
+#include "video_protection_profile.h"
+
+#include <set>
+#include <vector>
+
+#include "absl/strings/match.h"
+
+namespace {
+
+const char kCrlf[] = "\r\n";
+
+// "a=rtpmap:116 red/90000" や "a=fmtp:98 apt=96" から 116 や 98 を取り出す
+bool ParsePayloadType(const std::string& line,
+                      const std::string& prefix,
+                      std::string* pt,
+                      std::string* rest) {
+  if (line.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  size_t space = line.find(' ', prefix.size());
+  if (space == std::string::npos) {
+    return false;
+  }
+  *pt = line.substr(prefix.size(), space - prefix.size());
+  *rest = line.substr(space + 1);
+  return true;
+}
+
+// "a=rtcp-fb:96 nack" のように、先頭の PT で対象を指定する属性か
+bool IsAttributeOf(const std::string& line, const std::set<std::string>& pts) {
+  static const char* const kPrefixes[] = {"a=rtpmap:", "a=fmtp:",
+                                          "a=rtcp-fb:"};
+  for (const char* prefix : kPrefixes) {
+    const std::string p = prefix;
+    if (line.compare(0, p.size(), p) != 0) {
+      continue;
+    }
+    size_t space = line.find(' ', p.size());
+    return pts.count(line.substr(p.size(), space - p.size())) != 0;
+  }
+  return false;
+}
+
+// m=video の 1 つのセクションから RED と ULPFEC を取り除く
+void RemoveUlpfec(std::vector<std::string>* section) {
+  std::set<std::string> removed;
+  std::string pt, rest;
+  for (const std::string& line : *section) {
+    if (ParsePayloadType(line, "a=rtpmap:", &pt, &rest) &&
+        (absl::StartsWithIgnoreCase(rest, "red/") ||
+         absl::StartsWithIgnoreCase(rest, "ulpfec/"))) {
+      removed.insert(pt);
+    }
+  }
+  if (removed.empty()) {
+    return;
+  }
+  // RED を再送するための RTX も要らなくなる
+  for (const std::string& line : *section) {
+    if (ParsePayloadType(line, "a=fmtp:", &pt, &rest) &&
+        absl::StartsWith(rest, "apt=") && removed.count(rest.substr(4)) != 0) {
+      removed.insert(pt);
+    }
+  }
+
+  std::vector<std::string> result;
+  for (const std::string& line : *section) {
+    if (line.compare(0, 2, "m=") == 0) {
+      // m=video 9 UDP/TLS/RTP/SAVPF 96 97 ... の 4 つ目以降が PT
+      std::vector<std::string> fields;
+      for (size_t pos = 0; pos <= line.size();) {
+        size_t end = line.find(' ', pos);
+        if (end == std::string::npos) {
+          end = line.size();
+        }
+        fields.push_back(line.substr(pos, end - pos));
+        pos = end + 1;
+      }
+      std::string m;
+      for (size_t i = 0; i < fields.size(); i++) {
+        if (i >= 3 && removed.count(fields[i]) != 0) {
+          continue;
+        }
+        m += (m.empty() ? "" : " ") + fields[i];
+      }
+      result.push_back(m);
+      continue;
+    }
+    if (IsAttributeOf(line, removed)) {
+      continue;
+    }
+    result.push_back(line);
+  }
+  section->swap(result);
+}
+
+}  // namespace
+
+bool VideoProtectionProfile::Parse(const std::string& name,
+                                   VideoProtectionProfile* profile) {
+  VideoProtectionProfile p;
+  p.name = name;
+  if (name == "nack") {
+    p.disable_ulpfec = true;
+  } else if (name == "ulpfec") {
+  } else if (name == "flexfec") {
+    p.flexfec = true;
+  } else if (!name.empty()) {
+    return false;
+  }
+  *profile = p;
+  return true;
+}
+
+std::string VideoProtectionProfile::FieldTrials() const {
+  std::string trials;
+  if (disable_ulpfec) {
+    trials += "WebRTC-DisableUlpFecExperiment/Enabled/";
+  }
+  if (flexfec) {
+    trials += "WebRTC-FlexFEC-03/Enabled/WebRTC-FlexFEC-03-Advertised/Enabled/";
+  }
+  return trials;
+}
+
+std::string VideoProtectionProfile::ApplyToSdp(const std::string& sdp) const {
+  if (!disable_ulpfec) {
+    return sdp;
+  }
+
+  // 最初の m= より前はセッションの記述なので、そのまま残す
+  std::vector<std::vector<std::string>> sections(1);
+  for (size_t pos = 0; pos < sdp.size();) {
+    size_t end = sdp.find('\n', pos);
+    if (end == std::string::npos) {
+      end = sdp.size();
+    }
+    std::string line = sdp.substr(pos, end - pos);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.compare(0, 2, "m=") == 0) {
+      sections.emplace_back();
+    }
+    sections.back().push_back(std::move(line));
+    pos = end + 1;
+  }
+
+  std::string out;
+  for (size_t i = 0; i < sections.size(); i++) {
+    if (i > 0 && sections[i][0].compare(0, 8, "m=video ") == 0) {
+      RemoveUlpfec(&sections[i]);
+    }
+    for (const std::string& line : sections[i]) {
+      out += line;
+      out += kCrlf;
+    }
+  }
+  return out;
+}
@@ -0,0 +1,34 @@
+#ifndef VIDEO_PROTECTION_PROFILE_H_
+#define VIDEO_PROTECTION_PROFILE_H_
+
+#include <string>
+
+// --video-protection で指定する、映像のパケットロスへの対策。
+//
+// - nack: 再送 (NACK) だけを使う。RED と ULPFEC を SDP から取り除き、送信もしない
+// - ulpfec: NACK と RED+ULPFEC を併用する。WebRTC のデフォルトと同じだが、
+//           M84 では NACK と併用する場合の ULPFEC は VP8 と VP9 でしか送信しない
+// - flexfec: FlexFEC を広告し、相手も対応していれば RED+ULPFEC の代わりに使う。
+//            H.264 でも FEC を付けられる
+//
+// FEC の冗長度は、受信側から届いたパケットロス率と RTT から WebRTC が決めるので、
+// ロスが無い間はほとんど帯域を使わない。
+// フィールドトライアルはプロセス全体の設定なので、全ての接続で同じプロファイルになる。
+struct VideoProtectionProfile {
+  // 空文字列の場合は何も変更しない
+  std::string name;
+  bool disable_ulpfec = false;
+  bool flexfec = false;
+
+  // name が不明な場合は false を返す
+  static bool Parse(const std::string& name, VideoProtectionProfile* profile);
+
+  bool empty() const { return name.empty(); }
+
+  // 必要なフィールドトライアルを "WebRTC-Foo/Enabled/" の形式で返す
+  std::string FieldTrials() const;
+  // disable_ulpfec の場合に、映像の RED と ULPFEC、その RTX を SDP から取り除く
+  std::string ApplyToSdp(const std::string& sdp) const;
+};
+
+#endif  // VIDEO_PROTECTION_PROFILE_H_
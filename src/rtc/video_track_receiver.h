@@ -1,6 +1,8 @@
 #ifndef VIDEO_TRACK_RECEIVER_HANDLER_H_
 #define VIDEO_TRACK_RECEIVER_HANDLER_H_
 
+#include <stdint.h>
+
 #include <string>
 
 #include "api/media_stream_interface.h"
@@ -9,6 +11,9 @@ class VideoTrackReceiver {
  public:
   virtual void AddTrack(webrtc::VideoTrackInterface* track) = 0;
   virtual void RemoveTrack(webrtc::VideoTrackInterface* track) = 0;
+  // 受信しているトラックのうち、最後にフレームが届いてから一番時間が経っているものの経過時間。
+  // トラックが無い場合や、対応していない場合は -1 を返す
+  virtual int64_t GetLongestFrameGapMs() { return -1; }
 };
 
 #endif
\ No newline at end of file
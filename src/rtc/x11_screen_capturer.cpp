@@ -0,0 +1,340 @@
+#include "x11_screen_capturer.h"
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "frame_buffer_pool.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
+#include "third_party/libyuv/include/libyuv.h"
+#include "thread_placement.h"
+
+// X11 のヘッダは None や Status などのマクロを定義するので最後にインクルードする
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+
+namespace {
+
+// 画面が変化していない間にフレームを送る間隔
+const int64_t kIdleIntervalUs = rtc::kNumMicrosecsPerSec;
+// 画面の解像度が変わっていないかを確認する間隔
+const int64_t kSizeCheckIntervalUs = rtc::kNumMicrosecsPerSec;
+
+struct Rect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+}  // namespace
+
+// X サーバへの接続と、画面を受け取る共有メモリ
+class X11ScreenCapturer::Session {
+ public:
+  static std::unique_ptr<Session> Open() {
+    std::unique_ptr<Session> session(new Session());
+    session->display_ = XOpenDisplay(nullptr);
+    if (session->display_ == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to open the X display";
+      return nullptr;
+    }
+    Display* display = session->display_;
+    if (!XShmQueryExtension(display)) {
+      RTC_LOG(LS_ERROR) << "The X server does not support MIT-SHM";
+      return nullptr;
+    }
+    session->root_ = DefaultRootWindow(display);
+    XWindowAttributes attributes;
+    if (!XGetWindowAttributes(display, session->root_, &attributes)) {
+      RTC_LOG(LS_ERROR) << "Failed to get the attributes of the root window";
+      return nullptr;
+    }
+    session->width_ = attributes.width;
+    session->height_ = attributes.height;
+
+    session->image_ = XShmCreateImage(
+        display, attributes.visual, attributes.depth, ZPixmap, nullptr,
+        &session->shm_info_, session->width_, session->height_);
+    if (session->image_ == nullptr) {
+      RTC_LOG(LS_ERROR) << "XShmCreateImage failed";
+      return nullptr;
+    }
+    // libyuv の ARGB (メモリ上は BGRA) として扱えるもののみ対応する
+    if (session->image_->bits_per_pixel != 32 ||
+        session->image_->byte_order != LSBFirst) {
+      RTC_LOG(LS_ERROR) << "Unsupported X image format: bits_per_pixel="
+                        << session->image_->bits_per_pixel;
+      return nullptr;
+    }
+    session->shm_info_.shmid =
+        shmget(IPC_PRIVATE, session->image_->bytes_per_line * session->height_,
+               IPC_CREAT | 0600);
+    if (session->shm_info_.shmid < 0) {
+      RTC_LOG(LS_ERROR) << "shmget failed";
+      return nullptr;
+    }
+    session->shm_info_.shmaddr =
+        static_cast<char*>(shmat(session->shm_info_.shmid, nullptr, 0));
+    // アタッチした後は削除しておけば、異常終了しても残らない
+    shmctl(session->shm_info_.shmid, IPC_RMID, nullptr);
+    if (session->shm_info_.shmaddr == reinterpret_cast<char*>(-1)) {
+      session->shm_info_.shmaddr = nullptr;
+      RTC_LOG(LS_ERROR) << "shmat failed";
+      return nullptr;
+    }
+    session->image_->data = session->shm_info_.shmaddr;
+    session->shm_info_.readOnly = False;
+    if (!XShmAttach(display, &session->shm_info_)) {
+      RTC_LOG(LS_ERROR) << "XShmAttach failed";
+      return nullptr;
+    }
+    session->shm_attached_ = true;
+
+    int event_base = 0;
+    int error_base = 0;
+    if (XDamageQueryExtension(display, &event_base, &error_base) &&
+        XFixesQueryExtension(display, &event_base, &error_base)) {
+      session->damage_ =
+          XDamageCreate(display, session->root_, XDamageReportNonEmpty);
+      session->region_ = XFixesCreateRegion(display, nullptr, 0);
+    } else {
+      RTC_LOG(LS_WARNING)
+          << "The X server does not support XDamage, converting whole frames";
+    }
+    XSync(display, False);
+    RTC_LOG(LS_INFO) << "Capturing the X11 screen " << session->width_ << "x"
+                     << session->height_
+                     << (session->damage_ ? " with XDamage" : "");
+    return session;
+  }
+
+  ~Session() {
+    if (display_ == nullptr) {
+      return;
+    }
+    if (region_) {
+      XFixesDestroyRegion(display_, region_);
+    }
+    if (damage_) {
+      XDamageDestroy(display_, damage_);
+    }
+    if (shm_attached_) {
+      XShmDetach(display_, &shm_info_);
+      XSync(display_, False);
+    }
+    if (image_ != nullptr) {
+      // data は共有メモリなので XDestroyImage に解放させない
+      image_->data = nullptr;
+      XDestroyImage(image_);
+    }
+    if (shm_info_.shmaddr != nullptr) {
+      shmdt(shm_info_.shmaddr);
+    }
+    XCloseDisplay(display_);
+  }
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  bool has_damage() const { return damage_ != 0; }
+  const uint8_t* data() const {
+    return reinterpret_cast<const uint8_t*>(image_->data);
+  }
+  int stride() const { return image_->bytes_per_line; }
+
+  // 画面の解像度が変わっていたら true を返す
+  bool SizeChanged() {
+    XWindowAttributes attributes;
+    if (!XGetWindowAttributes(display_, root_, &attributes)) {
+      return true;
+    }
+    return attributes.width != width_ || attributes.height != height_;
+  }
+
+  // 前回呼び出してから変化した矩形を取得して、溜まっている変化を消す。
+  // XDamage が使えない場合は常に画面全体を返す
+  void TakeDamage(std::vector<Rect>* rects) {
+    rects->clear();
+    if (!damage_) {
+      rects->push_back({0, 0, width_, height_});
+      return;
+    }
+    // 通知は使わず、溜まっている変化を直接取り出すので、イベントは捨てるだけ
+    while (XPending(display_) > 0) {
+      XEvent event;
+      XNextEvent(display_, &event);
+    }
+    XDamageSubtract(display_, damage_, None, region_);
+    int count = 0;
+    XRectangle* xrects = XFixesFetchRegion(display_, region_, &count);
+    if (xrects == nullptr) {
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      rects->push_back(
+          {xrects[i].x, xrects[i].y, xrects[i].width, xrects[i].height});
+    }
+    XFree(xrects);
+  }
+
+  bool GetImage() {
+    return XShmGetImage(display_, root_, image_, 0, 0, AllPlanes);
+  }
+
+ private:
+  Session() { shm_info_.shmaddr = nullptr; }
+
+  Display* display_ = nullptr;
+  Window root_ = 0;
+  int width_ = 0;
+  int height_ = 0;
+  XImage* image_ = nullptr;
+  XShmSegmentInfo shm_info_;
+  bool shm_attached_ = false;
+  Damage damage_ = 0;
+  XserverRegion region_ = 0;
+};
+
+rtc::scoped_refptr<X11ScreenCapturer> X11ScreenCapturer::Create(
+    const ConnectionSettings& cs) {
+  rtc::scoped_refptr<X11ScreenCapturer> capturer(
+      new rtc::RefCountedObject<X11ScreenCapturer>());
+  capturer->session_ = Session::Open();
+  if (!capturer->session_) {
+    return nullptr;
+  }
+  capturer->interval_ms_ = 1000 / std::max(cs.framerate, 1);
+  capturer->capture_thread_.reset(new rtc::PlatformThread(
+      X11ScreenCapturer::CaptureThread, capturer.get(), "X11Capture",
+      rtc::kHighPriority));
+  capturer->capture_thread_->Start();
+  return capturer;
+}
+
+X11ScreenCapturer::X11ScreenCapturer() {}
+
+X11ScreenCapturer::~X11ScreenCapturer() {
+  if (capture_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cond_.notify_all();
+    capture_thread_->Stop();
+    capture_thread_.reset();
+  }
+}
+
+void X11ScreenCapturer::CaptureThread(void* obj) {
+  ThreadPlacement::Instance().Apply("capture");
+  static_cast<X11ScreenCapturer*>(obj)->CaptureLoop();
+}
+
+void X11ScreenCapturer::CaptureLoop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (cond_.wait_for(lock, std::chrono::milliseconds(interval_ms_),
+                         [this] { return quit_; })) {
+        return;
+      }
+    }
+
+    const int64_t now_us = rtc::TimeMicros();
+    if (now_us - last_size_check_us_ > kSizeCheckIntervalUs) {
+      last_size_check_us_ = now_us;
+      if (!session_ || session_->SizeChanged()) {
+        session_ = nullptr;
+        canvas_ = nullptr;
+        session_ = Session::Open();
+      }
+    }
+    if (!session_) {
+      continue;
+    }
+
+    const bool updated = Update();
+    if (!canvas_ ||
+        (!updated && now_us - last_delivered_us_ < kIdleIntervalUs)) {
+      continue;
+    }
+    if (ShouldSkipFrame()) {
+      continue;
+    }
+    last_delivered_us_ = now_us;
+
+    // canvas_ は次のフレームでも書き換えるので、下流にはコピーを渡す
+    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+        FrameBufferPool::Instance().CreateI420Buffer(canvas_->width(),
+                                                     canvas_->height());
+    libyuv::I420Copy(canvas_->DataY(), canvas_->StrideY(), canvas_->DataU(),
+                     canvas_->StrideU(), canvas_->DataV(), canvas_->StrideV(),
+                     buffer->MutableDataY(), buffer->StrideY(),
+                     buffer->MutableDataU(), buffer->StrideU(),
+                     buffer->MutableDataV(), buffer->StrideV(),
+                     canvas_->width(), canvas_->height());
+    webrtc::VideoFrame video_frame =
+        webrtc::VideoFrame::Builder()
+            .set_video_frame_buffer(buffer)
+            .set_timestamp_rtp(0)
+            .set_timestamp_ms(now_us / rtc::kNumMicrosecsPerMillisec)
+            .set_timestamp_us(now_us)
+            .set_rotation(webrtc::kVideoRotation_0)
+            .build();
+    OnCapturedFrame(video_frame);
+  }
+}
+
+bool X11ScreenCapturer::Update() {
+  const int width = session_->width();
+  const int height = session_->height();
+  std::vector<Rect> rects;
+  if (!canvas_) {
+    // 最初は画面全体を変換する。それまでに溜まった変化は要らないので捨てる
+    session_->TakeDamage(&rects);
+    rects.assign(1, {0, 0, width, height});
+    canvas_ = webrtc::I420Buffer::Create(width, height);
+  } else {
+    session_->TakeDamage(&rects);
+    if (rects.empty()) {
+      return false;
+    }
+  }
+  // XDamage がある場合は変化の後に取得するので、取得中の変化は次のフレームで拾える
+  if (!session_->GetImage()) {
+    RTC_LOG(LS_WARNING) << "XShmGetImage failed";
+    session_ = nullptr;
+    canvas_ = nullptr;
+    return false;
+  }
+
+  const uint8_t* src = session_->data();
+  const int src_stride = session_->stride();
+  for (const Rect& r : rects) {
+    // 色差は 2x2 単位なので偶数に広げてから画面内に収める
+    int x0 = std::max(r.x & ~1, 0);
+    int y0 = std::max(r.y & ~1, 0);
+    int x1 = std::min((r.x + r.width + 1) & ~1, width);
+    int y1 = std::min((r.y + r.height + 1) & ~1, height);
+    if (x1 <= x0 || y1 <= y0) {
+      continue;
+    }
+    libyuv::ARGBToI420(
+        src + y0 * src_stride + x0 * 4, src_stride,
+        canvas_->MutableDataY() + y0 * canvas_->StrideY() + x0,
+        canvas_->StrideY(),
+        canvas_->MutableDataU() + (y0 / 2) * canvas_->StrideU() + x0 / 2,
+        canvas_->StrideU(),
+        canvas_->MutableDataV() + (y0 / 2) * canvas_->StrideV() + x0 / 2,
+        canvas_->StrideV(), x1 - x0, y1 - y0);
+  }
+  return true;
+}
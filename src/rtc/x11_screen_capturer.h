@@ -0,0 +1,58 @@
+#ifndef X11_SCREEN_CAPTURER_H_
+#define X11_SCREEN_CAPTURER_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "api/scoped_refptr.h"
+#include "api/video/i420_buffer.h"
+#include "connection_settings.h"
+#include "rtc_base/platform_thread.h"
+#include "scalable_track_source.h"
+
+// カメラの代わりに $DISPLAY の X11 の画面全体をキャプチャする (Linux のみ)。
+//
+// XDamage が変化を報告した時だけ XShm で画面を取得して、変化した矩形だけを
+// I420 に変換する。変換した結果は次のフレームでも使う。
+// 変化が無い間は 1 秒に 1 回だけフレームを送る。
+// XDamage が使えない X サーバの場合は毎フレーム全体を取得して変換する。
+// 画面の解像度が変わったら開き直す。
+// is_screencast() が true なので、エンコーダには画面共有として扱われる。
+class X11ScreenCapturer : public ScalableVideoTrackSource {
+ public:
+  // 画面を開けなかった場合は nullptr を返す
+  static rtc::scoped_refptr<X11ScreenCapturer> Create(
+      const ConnectionSettings& cs);
+  ~X11ScreenCapturer() override;
+
+  bool is_screencast() const override { return true; }
+
+ protected:
+  X11ScreenCapturer();
+
+ private:
+  class Session;
+
+  static void CaptureThread(void* obj);
+  void CaptureLoop();
+  // 画面を取得して、変化した部分を canvas_ に変換する。
+  // 変化が無かった場合や、取得できなかった場合は false を返す
+  bool Update();
+
+  std::unique_ptr<Session> session_;
+  int interval_ms_ = 33;
+  // 変換済みの画面。送る時はコピーを渡す
+  rtc::scoped_refptr<webrtc::I420Buffer> canvas_;
+  int64_t last_delivered_us_ = 0;
+  int64_t last_size_check_us_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool quit_ = false;
+  std::unique_ptr<rtc::PlatformThread> capture_thread_;
+};
+
+#endif  // X11_SCREEN_CAPTURER_H_
@@ -0,0 +1,64 @@
+#include "rtsp_server.h"
+
+#include "rtsp_session.h"
+#include "util.h"
+
+RtspServer::RtspServer(boost::asio::io_context& ioc,
+                       boost::asio::ip::tcp::endpoint endpoint,
+                       std::shared_ptr<RtspStream> stream)
+    : acceptor_(ioc), socket_(ioc), stream_(std::move(stream)) {
+  boost::system::error_code ec;
+
+  // Open the acceptor
+  acceptor_.open(endpoint.protocol(), ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "open");
+    return;
+  }
+
+  // Allow address reuse
+  acceptor_.set_option(boost::asio::socket_base::reuse_address(true), ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "set_option");
+    return;
+  }
+
+  // Bind to the server address
+  acceptor_.bind(endpoint, ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "bind");
+    return;
+  }
+
+  // Start listening for connections
+  acceptor_.listen(boost::asio::socket_base::max_listen_connections, ec);
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "listen");
+    return;
+  }
+}
+
+void RtspServer::run() {
+  if (!acceptor_.is_open())
+    return;
+  doAccept();
+}
+
+void RtspServer::doAccept() {
+  acceptor_.async_accept(socket_,
+                         std::bind(&RtspServer::onAccept, shared_from_this(),
+                                   std::placeholders::_1));
+}
+
+void RtspServer::onAccept(boost::system::error_code ec) {
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "accept");
+  } else {
+    // RTP を interleaved で送る場合に遅れないようにする
+    boost::system::error_code option_ec;
+    socket_.set_option(boost::asio::ip::tcp::no_delay(true), option_ec);
+    std::make_shared<RtspSession>(std::move(socket_), stream_)->run();
+  }
+
+  doAccept();
+}
@@ -0,0 +1,31 @@
+#ifndef RTSP_SERVER_H_
+#define RTSP_SERVER_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/system/error_code.hpp>
+#include <memory>
+
+#include "rtsp_stream.h"
+
+// 送信している H.264 を RTSP で配信するサーバ。
+// シグナリングのモードに関係なく、--rtsp-port を指定した場合に起動する。
+class RtspServer : public std::enable_shared_from_this<RtspServer> {
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::ip::tcp::socket socket_;
+
+  std::shared_ptr<RtspStream> stream_;
+
+ public:
+  RtspServer(boost::asio::io_context& ioc,
+             boost::asio::ip::tcp::endpoint endpoint,
+             std::shared_ptr<RtspStream> stream);
+
+  void run();
+
+ private:
+  void doAccept();
+  void onAccept(boost::system::error_code ec);
+};
+
+#endif  // RTSP_SERVER_H_
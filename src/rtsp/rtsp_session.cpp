@@ -0,0 +1,502 @@
+#include "rtsp_session.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/core/ignore_unused.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <chrono>
+#include <utility>
+
+#include "rtc_base/helpers.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "util.h"
+
+namespace {
+
+// ヘッダがこの大きさを超えるリクエストは受け付けない
+const size_t kMaxRequestSize = 64 * 1024;
+// interleaved の場合に送信待ちにしておく量の上限
+const size_t kMaxWriteQueueBytes = 4 * 1024 * 1024;
+// UDP の場合、この時間リクエストが来なければクライアントが居なくなったとみなす
+const int kSessionTimeoutSec = 60;
+const int64_t kSenderReportIntervalUs = 5 * 1000 * 1000;
+// 1900 年から 1970 年までの秒数
+const uint64_t kNtpUnixEpochOffset = 2208988800ULL;
+
+// "client_port=5000-5001" のような a-b の形の値を取り出す
+bool ParseRange(const std::string& transport,
+                const std::string& name,
+                int* first,
+                int* second) {
+  size_t pos = transport.find(name + "=");
+  if (pos == std::string::npos) {
+    return false;
+  }
+  const char* p = transport.c_str() + pos + name.size() + 1;
+  char* end = nullptr;
+  *first = strtol(p, &end, 10);
+  if (end == p) {
+    return false;
+  }
+  *second = *end == '-' ? strtol(end + 1, nullptr, 10) : *first + 1;
+  return true;
+}
+
+void WriteUint32(uint8_t* p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = (value >> 16) & 0xff;
+  p[2] = (value >> 8) & 0xff;
+  p[3] = value & 0xff;
+}
+
+}  // namespace
+
+RtspSession::RtspSession(boost::asio::ip::tcp::socket socket,
+                         std::shared_ptr<RtspStream> stream)
+    : socket_(std::move(socket)),
+      strand_(socket_.get_executor()),
+      timer_(socket_.get_executor()),
+      stream_(std::move(stream)),
+      rtp_socket_(socket_.get_executor()),
+      rtcp_socket_(socket_.get_executor()) {}
+
+void RtspSession::run() {
+  doRead();
+}
+
+void RtspSession::doRead() {
+  socket_.async_read_some(
+      boost::asio::buffer(read_buffer_),
+      boost::asio::bind_executor(
+          strand_, std::bind(&RtspSession::onRead, shared_from_this(),
+                             std::placeholders::_1, std::placeholders::_2)));
+}
+
+void RtspSession::onRead(boost::system::error_code ec,
+                         std::size_t bytes_transferred) {
+  if (closed_) {
+    return;
+  }
+  if (ec) {
+    if (ec != boost::asio::error::eof) {
+      MOMO_BOOST_ERROR(ec, "read");
+    }
+    return doClose();
+  }
+  input_.append(read_buffer_.data(), bytes_transferred);
+  if (!processInput()) {
+    return doClose();
+  }
+  doRead();
+}
+
+bool RtspSession::processInput() {
+  while (!input_.empty()) {
+    // interleaved で送られてきた RTCP は読み捨てる
+    if (input_[0] == '$') {
+      if (input_.size() < 4) {
+        return true;
+      }
+      const size_t size = (static_cast<uint8_t>(input_[2]) << 8) |
+                          static_cast<uint8_t>(input_[3]);
+      if (input_.size() < 4 + size) {
+        return true;
+      }
+      input_.erase(0, 4 + size);
+      continue;
+    }
+
+    const size_t end = input_.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return input_.size() <= kMaxRequestSize;
+    }
+    Request req;
+    size_t pos = 0;
+    while (pos < end) {
+      size_t eol = input_.find("\r\n", pos);
+      std::string line = input_.substr(pos, eol - pos);
+      pos = eol + 2;
+      if (req.method.empty()) {
+        size_t sp1 = line.find(' ');
+        size_t sp2 = line.find(' ', sp1 + 1);
+        if (sp1 == std::string::npos || sp2 == std::string::npos) {
+          RTC_LOG(LS_WARNING) << "Invalid RTSP request: " << line;
+          return false;
+        }
+        req.method = line.substr(0, sp1);
+        req.url = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        continue;
+      }
+      size_t colon = line.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      std::string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+      req.headers[name] = boost::algorithm::trim_copy(line.substr(colon + 1));
+    }
+    size_t content_length = 0;
+    auto it = req.headers.find("content-length");
+    if (it != req.headers.end()) {
+      content_length = strtoul(it->second.c_str(), nullptr, 10);
+    }
+    if (input_.size() < end + 4 + content_length) {
+      return end + 4 + content_length <= kMaxRequestSize;
+    }
+    input_.erase(0, end + 4 + content_length);
+    handleRequest(req);
+    if (close_after_write_) {
+      return true;
+    }
+  }
+  return true;
+}
+
+void RtspSession::handleRequest(const Request& req) {
+  resetTimeout();
+
+  if (req.method == "OPTIONS") {
+    return sendResponse(req, "200 OK",
+                        "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, "
+                        "TEARDOWN, GET_PARAMETER, SET_PARAMETER\r\n");
+  }
+
+  if (req.method == "DESCRIBE") {
+    boost::system::error_code ec;
+    auto local = socket_.local_endpoint(ec);
+    std::string sdp = stream_->CreateSdp(
+        ec ? std::string("0.0.0.0") : local.address().to_string());
+    std::string base = req.url;
+    if (base.empty() || base.back() != '/') {
+      base += "/";
+    }
+    return sendResponse(req, "200 OK",
+                        "Content-Base: " + base +
+                            "\r\n"
+                            "Content-Type: application/sdp\r\n",
+                        sdp);
+  }
+
+  if (req.method == "SETUP") {
+    return handleSetup(req);
+  }
+
+  if (req.method == "PLAY") {
+    return handlePlay(req);
+  }
+
+  if (req.method == "PAUSE") {
+    if (!checkSession(req)) {
+      return;
+    }
+    stopPlaying();
+    return sendResponse(req, "200 OK", "");
+  }
+
+  if (req.method == "TEARDOWN") {
+    stopPlaying();
+    sendResponse(req, "200 OK", "");
+    close_after_write_ = true;
+    return;
+  }
+
+  // クライアントが接続を保つために送ってくる
+  if (req.method == "GET_PARAMETER" || req.method == "SET_PARAMETER") {
+    return sendResponse(req, "200 OK", "");
+  }
+
+  sendResponse(req, "501 Not Implemented", "");
+}
+
+void RtspSession::handleSetup(const Request& req) {
+  auto it = req.headers.find("transport");
+  const std::string transport = it == req.headers.end() ? "" : it->second;
+  if (!session_id_.empty() && !checkSession(req)) {
+    return;
+  }
+  // 1 つのセッションで送るトラックは 1 つだけなので、2 回目の SETUP は受け付けない
+  if (!session_id_.empty()) {
+    return sendResponse(req, "459 Aggregate Operation Not Allowed", "");
+  }
+
+  std::string reply;
+  if (boost::algorithm::contains(transport, "RTP/AVP/TCP")) {
+    int rtp = 0;
+    int rtcp = 1;
+    ParseRange(transport, "interleaved", &rtp, &rtcp);
+    interleaved_ = true;
+    rtp_channel_ = static_cast<uint8_t>(rtp);
+    rtcp_channel_ = static_cast<uint8_t>(rtcp);
+    reply = "RTP/AVP/TCP;unicast;interleaved=" + std::to_string(rtp) + "-" +
+            std::to_string(rtcp);
+  } else {
+    int rtp_port = 0;
+    int rtcp_port = 0;
+    if (boost::algorithm::contains(transport, "multicast") ||
+        !ParseRange(transport, "client_port", &rtp_port, &rtcp_port)) {
+      return sendResponse(req, "461 Unsupported Transport", "");
+    }
+    boost::system::error_code ec;
+    const auto local_address = socket_.local_endpoint(ec).address();
+    const auto remote_address = socket_.remote_endpoint(ec).address();
+    for (auto* udp : {&rtp_socket_, &rtcp_socket_}) {
+      const boost::asio::ip::udp::endpoint endpoint(local_address, 0);
+      udp->open(endpoint.protocol(), ec);
+      if (!ec) {
+        udp->bind(endpoint, ec);
+      }
+      if (!ec) {
+        // 送れない時は待たずに捨てる
+        udp->non_blocking(true, ec);
+      }
+      if (ec) {
+        MOMO_BOOST_ERROR(ec, "udp");
+        return sendResponse(req, "500 Internal Server Error", "");
+      }
+    }
+    rtp_endpoint_ = boost::asio::ip::udp::endpoint(
+        remote_address, static_cast<unsigned short>(rtp_port));
+    rtcp_endpoint_ = boost::asio::ip::udp::endpoint(
+        remote_address, static_cast<unsigned short>(rtcp_port));
+    reply = "RTP/AVP;unicast;client_port=" + std::to_string(rtp_port) + "-" +
+            std::to_string(rtcp_port) + ";server_port=" +
+            std::to_string(rtp_socket_.local_endpoint(ec).port()) + "-" +
+            std::to_string(rtcp_socket_.local_endpoint(ec).port());
+  }
+
+  char ssrc[9];
+  snprintf(ssrc, sizeof(ssrc), "%08X", stream_->ssrc());
+  session_id_ = std::to_string(rtc::CreateRandomId64() & 0x7fffffffffffffffULL);
+  sendResponse(req, "200 OK",
+               "Transport: " + reply + ";ssrc=" + ssrc + "\r\n");
+}
+
+void RtspSession::handlePlay(const Request& req) {
+  if (!checkSession(req)) {
+    return;
+  }
+  if (!playing_) {
+    playing_ = true;
+    waiting_key_frame_ = true;
+    stream_->AddSubscriber(shared_from_this());
+  }
+  sendResponse(req, "200 OK", "Range: npt=0.000-\r\n");
+}
+
+bool RtspSession::checkSession(const Request& req) {
+  auto it = req.headers.find("session");
+  std::string id = it == req.headers.end() ? "" : it->second;
+  id = id.substr(0, id.find(';'));
+  if (session_id_.empty() || id != session_id_) {
+    sendResponse(req, "454 Session Not Found", "");
+    return false;
+  }
+  return true;
+}
+
+void RtspSession::sendResponse(const Request& req,
+                               const std::string& status,
+                               const std::string& headers,
+                               const std::string& body) {
+  std::string res = "RTSP/1.0 " + status + "\r\n";
+  auto it = req.headers.find("cseq");
+  if (it != req.headers.end()) {
+    res += "CSeq: " + it->second + "\r\n";
+  }
+  res += "Server: Momo\r\n";
+  if (!session_id_.empty()) {
+    res += "Session: " + session_id_ + ";timeout=" +
+           std::to_string(kSessionTimeoutSec) + "\r\n";
+  }
+  res += headers;
+  if (!body.empty()) {
+    res += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  }
+  res += "\r\n";
+  res += body;
+  enqueue(std::make_shared<std::vector<uint8_t>>(res.begin(), res.end()));
+}
+
+void RtspSession::OnPackets(RtspStream::Packets packets,
+                            bool key_frame,
+                            uint32_t rtp_timestamp,
+                            int64_t capture_time_us) {
+  boost::asio::post(strand_, std::bind(&RtspSession::onPackets,
+                                       shared_from_this(), std::move(packets),
+                                       key_frame, rtp_timestamp,
+                                       capture_time_us));
+}
+
+void RtspSession::onPackets(RtspStream::Packets packets,
+                            bool key_frame,
+                            uint32_t rtp_timestamp,
+                            int64_t capture_time_us) {
+  if (!playing_ || closed_ || (waiting_key_frame_ && !key_frame)) {
+    return;
+  }
+
+  size_t size = 0;
+  for (const auto& packet : *packets) {
+    size += packet.size();
+  }
+  if (interleaved_ &&
+      write_queue_bytes_ + size + 4 * packets->size() > kMaxWriteQueueBytes) {
+    if (!waiting_key_frame_) {
+      RTC_LOG(LS_WARNING) << "RTSP client is too slow, waiting key frame";
+      stream_->RequestKeyFrame();
+    }
+    waiting_key_frame_ = true;
+    return;
+  }
+  waiting_key_frame_ = false;
+
+  const int64_t now_us = rtc::TimeMicros();
+  if (last_sender_report_us_ < 0 ||
+      now_us - last_sender_report_us_ >= kSenderReportIntervalUs) {
+    last_sender_report_us_ = now_us;
+    // RTP のタイムスタンプと実際の時刻の対応をクライアントに知らせる
+    const int64_t utc_us = rtc::TimeUTCMicros();
+    const uint32_t rtp_now = rtp_timestamp + static_cast<uint32_t>(
+                                                 (now_us - capture_time_us) *
+                                                 90 / 1000);
+    const uint64_t ntp_sec = utc_us / 1000000 + kNtpUnixEpochOffset;
+    const uint64_t ntp_frac = (utc_us % 1000000) * (1ULL << 32) / 1000000;
+    std::vector<uint8_t> sr(28);
+    sr[0] = 0x80;
+    sr[1] = 200;
+    sr[3] = 6;
+    WriteUint32(&sr[4], stream_->ssrc());
+    WriteUint32(&sr[8], static_cast<uint32_t>(ntp_sec));
+    WriteUint32(&sr[12], static_cast<uint32_t>(ntp_frac));
+    WriteUint32(&sr[16], rtp_now);
+    WriteUint32(&sr[20], packet_count_);
+    WriteUint32(&sr[24], octet_count_);
+    sendRtcp(std::move(sr));
+  }
+
+  for (const auto& packet : *packets) {
+    packet_count_++;
+    octet_count_ += static_cast<uint32_t>(packet.size() - 12);
+  }
+
+  if (interleaved_) {
+    auto data = std::make_shared<std::vector<uint8_t>>();
+    data->reserve(size + 4 * packets->size());
+    for (const auto& packet : *packets) {
+      data->push_back('$');
+      data->push_back(rtp_channel_);
+      data->push_back(packet.size() >> 8);
+      data->push_back(packet.size() & 0xff);
+      data->insert(data->end(), packet.begin(), packet.end());
+    }
+    enqueue(std::move(data));
+    return;
+  }
+
+  boost::system::error_code ec;
+  for (const auto& packet : *packets) {
+    rtp_socket_.send_to(boost::asio::buffer(packet), rtp_endpoint_, 0, ec);
+  }
+}
+
+void RtspSession::sendRtcp(std::vector<uint8_t> packet) {
+  if (interleaved_) {
+    auto data = std::make_shared<std::vector<uint8_t>>();
+    data->push_back('$');
+    data->push_back(rtcp_channel_);
+    data->push_back(packet.size() >> 8);
+    data->push_back(packet.size() & 0xff);
+    data->insert(data->end(), packet.begin(), packet.end());
+    enqueue(std::move(data));
+    return;
+  }
+  boost::system::error_code ec;
+  rtcp_socket_.send_to(boost::asio::buffer(packet), rtcp_endpoint_, 0, ec);
+}
+
+void RtspSession::enqueue(std::shared_ptr<std::vector<uint8_t>> data) {
+  write_queue_bytes_ += data->size();
+  write_queue_.push_back(std::move(data));
+  if (write_queue_.size() == 1) {
+    doWrite();
+  }
+}
+
+void RtspSession::doWrite() {
+  boost::asio::async_write(
+      socket_, boost::asio::buffer(*write_queue_.front()),
+      boost::asio::bind_executor(
+          strand_, std::bind(&RtspSession::onWrite, shared_from_this(),
+                             std::placeholders::_1, std::placeholders::_2)));
+}
+
+void RtspSession::onWrite(boost::system::error_code ec,
+                          std::size_t bytes_transferred) {
+  boost::ignore_unused(bytes_transferred);
+  if (closed_) {
+    return;
+  }
+  if (ec) {
+    MOMO_BOOST_ERROR(ec, "write");
+    return doClose();
+  }
+  write_queue_bytes_ -= write_queue_.front()->size();
+  write_queue_.pop_front();
+  if (!write_queue_.empty()) {
+    return doWrite();
+  }
+  if (close_after_write_) {
+    doClose();
+  }
+}
+
+void RtspSession::resetTimeout() {
+  if (interleaved_) {
+    return;
+  }
+  timer_.expires_after(std::chrono::seconds(kSessionTimeoutSec));
+  timer_.async_wait(boost::asio::bind_executor(
+      strand_, std::bind(&RtspSession::onTimeout, shared_from_this(),
+                         std::placeholders::_1)));
+}
+
+void RtspSession::onTimeout(boost::system::error_code ec) {
+  if (ec == boost::asio::error::operation_aborted || closed_) {
+    return;
+  }
+  // interleaved の場合は送れなくなった時に分かるので、UDP の場合だけ見ている
+  if (interleaved_ || session_id_.empty()) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << "RTSP session timed out: " << session_id_;
+  doClose();
+}
+
+void RtspSession::stopPlaying() {
+  if (!playing_) {
+    return;
+  }
+  playing_ = false;
+  stream_->RemoveSubscriber(this);
+}
+
+void RtspSession::doClose() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  stopPlaying();
+  boost::system::error_code ec;
+  timer_.cancel(ec);
+  rtp_socket_.close(ec);
+  rtcp_socket_.close(ec);
+  socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  socket_.close(ec);
+}
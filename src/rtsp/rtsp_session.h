@@ -0,0 +1,102 @@
+#ifndef RTSP_SESSION_H_
+#define RTSP_SESSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/system/error_code.hpp>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtsp_stream.h"
+
+// RtspServer の 1 つの RTSP 接続を処理するためのクラス。
+//
+// RTP は SETUP で指定された方法で、UDP か RTSP の接続の上 (interleaved) で送る。
+// 接続が遅くて送れなかった分は捨てて、次のキーフレームから送り直す。
+class RtspSession : public std::enable_shared_from_this<RtspSession>,
+                    public RtspStream::Subscriber {
+ public:
+  RtspSession(boost::asio::ip::tcp::socket socket,
+              std::shared_ptr<RtspStream> stream);
+
+  void run();
+
+  void OnPackets(RtspStream::Packets packets,
+                 bool key_frame,
+                 uint32_t rtp_timestamp,
+                 int64_t capture_time_us) override;
+
+ private:
+  struct Request {
+    std::string method;
+    std::string url;
+    // キーは小文字にする
+    std::map<std::string, std::string> headers;
+  };
+
+  void doRead();
+  void onRead(boost::system::error_code ec, std::size_t bytes_transferred);
+  // 受け取ったリクエストを処理する。接続を閉じる場合は false を返す
+  bool processInput();
+  void handleRequest(const Request& req);
+  void handleSetup(const Request& req);
+  void handlePlay(const Request& req);
+  bool checkSession(const Request& req);
+  void sendResponse(const Request& req,
+                    const std::string& status,
+                    const std::string& headers,
+                    const std::string& body = "");
+
+  void onPackets(RtspStream::Packets packets,
+                 bool key_frame,
+                 uint32_t rtp_timestamp,
+                 int64_t capture_time_us);
+  void sendRtcp(std::vector<uint8_t> packet);
+
+  void enqueue(std::shared_ptr<std::vector<uint8_t>> data);
+  void doWrite();
+  void onWrite(boost::system::error_code ec, std::size_t bytes_transferred);
+  void resetTimeout();
+  void onTimeout(boost::system::error_code ec);
+  void stopPlaying();
+  void doClose();
+
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::strand<boost::asio::ip::tcp::socket::executor_type> strand_;
+  boost::asio::steady_timer timer_;
+  std::array<char, 4096> read_buffer_;
+  std::string input_;
+  std::shared_ptr<RtspStream> stream_;
+
+  std::string session_id_;
+  bool playing_ = false;
+  bool closed_ = false;
+  // interleaved の場合は RTSP の接続で送る
+  bool interleaved_ = false;
+  uint8_t rtp_channel_ = 0;
+  uint8_t rtcp_channel_ = 1;
+  boost::asio::ip::udp::socket rtp_socket_;
+  boost::asio::ip::udp::socket rtcp_socket_;
+  boost::asio::ip::udp::endpoint rtp_endpoint_;
+  boost::asio::ip::udp::endpoint rtcp_endpoint_;
+
+  std::deque<std::shared_ptr<std::vector<uint8_t>>> write_queue_;
+  size_t write_queue_bytes_ = 0;
+  bool close_after_write_ = false;
+
+  bool waiting_key_frame_ = true;
+  uint32_t packet_count_ = 0;
+  uint32_t octet_count_ = 0;
+  int64_t last_sender_report_us_ = -1;
+};
+
+#endif  // RTSP_SESSION_H_
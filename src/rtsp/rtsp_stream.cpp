@@ -0,0 +1,212 @@
+#include "rtsp_stream.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "common_video/h264/h264_common.h"
+#include "rtc_base/helpers.h"
+#include "rtc_base/third_party/base64/base64.h"
+
+namespace {
+
+const uint8_t kPayloadType = 96;
+const size_t kRtpHeaderSize = 12;
+const uint8_t kFuA = 28;
+
+std::string Base64(const std::vector<uint8_t>& data) {
+  return rtc::Base64::Encode(std::string(data.begin(), data.end()));
+}
+
+}  // namespace
+
+RtspStream::RtspStream()
+    : ssrc_(rtc::CreateRandomId()),
+      sequence_number_(static_cast<uint16_t>(rtc::CreateRandomId())) {}
+
+bool RtspStream::AttachVideo(const void* source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (video_source_ != nullptr && video_source_ != source) {
+    return false;
+  }
+  video_source_ = source;
+  key_frame_requested_ = true;
+  return true;
+}
+
+void RtspStream::DetachVideo(const void* source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (video_source_ == source) {
+    video_source_ = nullptr;
+  }
+}
+
+bool RtspStream::NeedsKeyFrame(const void* source) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (source != video_source_ || !key_frame_requested_) {
+    return false;
+  }
+  key_frame_requested_ = false;
+  return true;
+}
+
+void RtspStream::OnVideo(const void* source,
+                         const webrtc::EncodedImage& encoded_image,
+                         int64_t capture_time_us) {
+  const bool key_frame =
+      encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+  const uint32_t rtp_timestamp =
+      static_cast<uint32_t>(capture_time_us * 90 / 1000);
+  std::vector<std::shared_ptr<Subscriber>> subscribers;
+  auto packets = std::make_shared<std::vector<Packet>>();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (source != video_source_) {
+      return;
+    }
+    for (auto it = subscribers_.begin(); it != subscribers_.end();) {
+      auto subscriber = it->lock();
+      if (subscriber) {
+        subscribers.push_back(std::move(subscriber));
+        ++it;
+      } else {
+        it = subscribers_.erase(it);
+      }
+    }
+    // 再生しているクライアントが居なくても、SDP のために SPS と PPS は取っておく
+    Packetize(encoded_image.data(), encoded_image.size(), rtp_timestamp,
+              subscribers.empty() ? nullptr : packets.get());
+  }
+  if (subscribers.empty() || packets->empty()) {
+    return;
+  }
+  // フレームの最後のパケットに marker を立てる
+  packets->back()[1] |= 0x80;
+  for (const auto& subscriber : subscribers) {
+    subscriber->OnPackets(packets, key_frame, rtp_timestamp, capture_time_us);
+  }
+}
+
+void RtspStream::AddSubscriber(std::weak_ptr<Subscriber> subscriber) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  subscribers_.push_back(std::move(subscriber));
+  key_frame_requested_ = true;
+}
+
+void RtspStream::RemoveSubscriber(const Subscriber* subscriber) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  subscribers_.erase(
+      std::remove_if(subscribers_.begin(), subscribers_.end(),
+                     [subscriber](const std::weak_ptr<Subscriber>& p) {
+                       auto s = p.lock();
+                       return !s || s.get() == subscriber;
+                     }),
+      subscribers_.end());
+}
+
+void RtspStream::RequestKeyFrame() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  key_frame_requested_ = true;
+}
+
+std::string RtspStream::CreateSdp(const std::string& address) {
+  std::string fmtp = "packetization-mode=1";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sps_.size() >= 4 && !pps_.empty()) {
+      char profile_level_id[7];
+      snprintf(profile_level_id, sizeof(profile_level_id), "%02X%02X%02X",
+               sps_[1], sps_[2], sps_[3]);
+      fmtp += ";profile-level-id=" + std::string(profile_level_id) +
+              ";sprop-parameter-sets=" + Base64(sps_) + "," + Base64(pps_);
+    }
+  }
+  std::string sdp;
+  sdp += "v=0\r\n";
+  sdp += "o=- " + std::to_string(ssrc_) + " 1 IN IP4 " + address + "\r\n";
+  sdp += "s=Momo\r\n";
+  sdp += "c=IN IP4 0.0.0.0\r\n";
+  sdp += "t=0 0\r\n";
+  sdp += "a=control:*\r\n";
+  sdp += "a=range:npt=0-\r\n";
+  sdp += "m=video 0 RTP/AVP " + std::to_string(kPayloadType) + "\r\n";
+  sdp += "a=rtpmap:" + std::to_string(kPayloadType) + " H264/90000\r\n";
+  sdp += "a=fmtp:" + std::to_string(kPayloadType) + " " + fmtp + "\r\n";
+  sdp += "a=control:track1\r\n";
+  return sdp;
+}
+
+// packets が nullptr の場合は SPS と PPS を取り出すだけ
+void RtspStream::Packetize(const uint8_t* data,
+                           size_t size,
+                           uint32_t rtp_timestamp,
+                           std::vector<Packet>* packets) {
+  for (const auto& index : webrtc::H264::FindNaluIndices(data, size)) {
+    const uint8_t* nalu = data + index.payload_start_offset;
+    const size_t nalu_size = index.payload_size;
+    if (nalu_size == 0) {
+      continue;
+    }
+    const uint8_t type = nalu[0] & 0x1f;
+    if (type == webrtc::H264::kSps) {
+      sps_.assign(nalu, nalu + nalu_size);
+    } else if (type == webrtc::H264::kPps) {
+      pps_.assign(nalu, nalu + nalu_size);
+    }
+    if (packets == nullptr) {
+      continue;
+    }
+    if (nalu_size <= kMaxPayloadSize) {
+      // Single NAL Unit Packet
+      AddPacket(nullptr, 0, nalu, nalu_size, rtp_timestamp, packets);
+      continue;
+    }
+    // FU-A で分割する。NAL ヘッダは FU indicator と FU header に入れるので送らない
+    const uint8_t indicator = (nalu[0] & 0xe0) | kFuA;
+    size_t offset = 1;
+    while (offset < nalu_size) {
+      const size_t payload_size =
+          std::min(nalu_size - offset, kMaxPayloadSize - 2);
+      uint8_t header[2] = {indicator, type};
+      if (offset == 1) {
+        header[1] |= 0x80;
+      }
+      if (offset + payload_size == nalu_size) {
+        header[1] |= 0x40;
+      }
+      AddPacket(header, sizeof(header), nalu + offset, payload_size,
+                rtp_timestamp, packets);
+      offset += payload_size;
+    }
+  }
+}
+
+void RtspStream::AddPacket(const uint8_t* header,
+                           size_t header_size,
+                           const uint8_t* payload,
+                           size_t payload_size,
+                           uint32_t rtp_timestamp,
+                           std::vector<Packet>* packets) {
+  Packet packet(kRtpHeaderSize + header_size + payload_size);
+  uint8_t* p = packet.data();
+  const uint16_t seq = sequence_number_++;
+  p[0] = 0x80;
+  p[1] = kPayloadType;
+  p[2] = seq >> 8;
+  p[3] = seq & 0xff;
+  p[4] = rtp_timestamp >> 24;
+  p[5] = (rtp_timestamp >> 16) & 0xff;
+  p[6] = (rtp_timestamp >> 8) & 0xff;
+  p[7] = rtp_timestamp & 0xff;
+  p[8] = ssrc_ >> 24;
+  p[9] = (ssrc_ >> 16) & 0xff;
+  p[10] = (ssrc_ >> 8) & 0xff;
+  p[11] = ssrc_ & 0xff;
+  if (header_size > 0) {
+    memcpy(p + kRtpHeaderSize, header, header_size);
+  }
+  memcpy(p + kRtpHeaderSize + header_size, payload, payload_size);
+  packets->push_back(std::move(packet));
+}
@@ -0,0 +1,79 @@
+#ifndef RTSP_STREAM_H_
+#define RTSP_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rtc/encoded_video_sink.h"
+
+// 送信している H.264 を RTP (RFC 6184) にして、RTSP で再生しているクライアントに配る。
+//
+// WebRTC に送っているエンコーダの出力をそのまま使うので、RTSP のために別にエンコードはしない。
+// パケット化はフレーム毎に 1 回だけ行い、全てのクライアントで同じパケットを共有する。
+// そのためシーケンス番号と SSRC は全てのクライアントで同じになる。
+class RtspStream : public EncodedVideoSink {
+ public:
+  typedef std::vector<uint8_t> Packet;
+  typedef std::shared_ptr<const std::vector<Packet>> Packets;
+
+  // RTP のパケットを受け取るクライアント。OnPackets() はエンコーダのスレッドから呼ばれる
+  class Subscriber {
+   public:
+    virtual ~Subscriber() {}
+    // capture_time_us は rtp_timestamp に対応する rtc::TimeMicros() の時刻
+    virtual void OnPackets(Packets packets,
+                           bool key_frame,
+                           uint32_t rtp_timestamp,
+                           int64_t capture_time_us) = 0;
+  };
+
+  RtspStream();
+
+  bool AttachVideo(const void* source) override;
+  void DetachVideo(const void* source) override;
+  bool NeedsKeyFrame(const void* source) override;
+  void OnVideo(const void* source,
+               const webrtc::EncodedImage& encoded_image,
+               int64_t capture_time_us) override;
+
+  // 再生を始めたクライアントがすぐに映像を出せるように、キーフレームも要求する
+  void AddSubscriber(std::weak_ptr<Subscriber> subscriber);
+  void RemoveSubscriber(const Subscriber* subscriber);
+  void RequestKeyFrame();
+
+  // DESCRIBE に返す SDP。SPS と PPS を受け取っていれば sprop-parameter-sets を付ける
+  std::string CreateSdp(const std::string& address);
+  uint32_t ssrc() const { return ssrc_; }
+
+  // RTP のペイロードの上限。UDP でも IP フラグメントにならないようにする
+  static const size_t kMaxPayloadSize = 1400;
+
+ private:
+  void Packetize(const uint8_t* data,
+                 size_t size,
+                 uint32_t rtp_timestamp,
+                 std::vector<Packet>* packets);
+  void AddPacket(const uint8_t* header,
+                 size_t header_size,
+                 const uint8_t* payload,
+                 size_t payload_size,
+                 uint32_t rtp_timestamp,
+                 std::vector<Packet>* packets);
+
+  const uint32_t ssrc_;
+
+  std::mutex mutex_;
+  const void* video_source_ = nullptr;
+  bool key_frame_requested_ = false;
+  uint16_t sequence_number_;
+  std::vector<uint8_t> sps_;
+  std::vector<uint8_t> pps_;
+  std::vector<std::weak_ptr<Subscriber>> subscribers_;
+};
+
+#endif  // RTSP_STREAM_H_
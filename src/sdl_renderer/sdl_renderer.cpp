@@ -1,18 +1,29 @@
 #include "sdl_renderer.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <csignal>
 
+#include <string.h>
+
 #include "api/video/i420_buffer.h"
+#include "rtc/frame_tracer.h"
+#include "rtc/native_buffer.h"
+#include "rtc/thread_placement.h"
 #include "rtc_base/logging.h"
-#include "third_party/libyuv/include/libyuv/convert_from.h"
-#include "third_party/libyuv/include/libyuv/video_common.h"
+#include "rtc_base/time_utils.h"
 
 #define STD_ASPECT 1.33
 #define WIDE_ASPECT 1.78
-#define FRAME_INTERVAL (1000 / 30)
-
-SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
+// 新しいフレームが来なくても、この間隔でイベントを処理する
+#define EVENT_POLL_INTERVAL_MS 16
+
+SDLRenderer::SDLRenderer(int width,
+                         int height,
+                         bool fullscreen,
+                         bool latency_marker,
+                         int render_budget_fps)
     : running_(true),
       window_(nullptr),
       renderer_(nullptr),
@@ -20,7 +31,10 @@ SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
       width_(width),
       height_(height),
       rows_(1),
-      cols_(1) {
+      cols_(1),
+      latency_marker_(latency_marker),
+      render_budget_fps_(render_budget_fps),
+      window_hidden_(false) {
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_Init failed " << SDL_GetError();
     return;
@@ -45,6 +59,7 @@ SDLRenderer::SDLRenderer(int width, int height, bool fullscreen)
 
 SDLRenderer::~SDLRenderer() {
   running_ = false;
+  RequestRedraw();
   int ret = 0;
   SDL_WaitThread(thread_, &ret);
   if (ret != 0) {
@@ -77,6 +92,25 @@ void SDLRenderer::PollEvent() {
     height_ = e.window.data2;
     SetOutlines();
   }
+  if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_EXPOSED &&
+      e.window.windowID == SDL_GetWindowID(window_)) {
+    RequestRedraw();
+  }
+  if (e.type == SDL_WINDOWEVENT &&
+      e.window.windowID == SDL_GetWindowID(window_)) {
+    switch (e.window.event) {
+      case SDL_WINDOWEVENT_MINIMIZED:
+      case SDL_WINDOWEVENT_HIDDEN:
+        window_hidden_ = true;
+        break;
+      case SDL_WINDOWEVENT_RESTORED:
+      case SDL_WINDOWEVENT_MAXIMIZED:
+      case SDL_WINDOWEVENT_SHOWN:
+        window_hidden_ = false;
+        RequestRedraw();
+        break;
+    }
+  }
   if (e.type == SDL_KEYUP) {
     switch (e.key.keysym.sym) {
       case SDLK_f:
@@ -102,8 +136,26 @@ int SDLRenderer::RenderThreadExec(void* data) {
   return ((SDLRenderer*)data)->RenderThread();
 }
 
+void SDLRenderer::RequestRedraw() {
+  {
+    std::lock_guard<std::mutex> lock(redraw_mutex_);
+    redraw_requested_ = true;
+  }
+  redraw_cond_.notify_one();
+}
+
+void SDLRenderer::DestroyTextureLater(SDL_Texture* texture) {
+  rtc::CritScope lock(&sinks_lock_);
+  textures_to_destroy_.push_back(texture);
+}
+
 int SDLRenderer::RenderThread() {
-  renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
+  ThreadPlacement::Instance().Apply("renderer");
+  // テクスチャの拡大縮小は GPU で行うので、線形補間を有効にしておく
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+  // vsync に合わせて表示する。SDL_RenderPresent は次の vblank まで待つ
+  renderer_ = SDL_CreateRenderer(
+      window_, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
   if (renderer_ == nullptr) {
     RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateRenderer failed "
                       << SDL_GetError();
@@ -111,11 +163,34 @@ int SDLRenderer::RenderThread() {
   }
   SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
 
-  uint32_t start_time, duration;
   while (running_) {
-    start_time = SDL_GetTicks();
+    // 新しいフレームが来るか、画面の更新が必要になるまで待つ
+    bool redraw;
+    {
+      std::unique_lock<std::mutex> lock(redraw_mutex_);
+      redraw_cond_.wait_for(
+          lock, std::chrono::milliseconds(EVENT_POLL_INTERVAL_MS),
+          [this]() { return redraw_requested_ || !running_; });
+      redraw = redraw_requested_;
+      redraw_requested_ = false;
+    }
+    if (!running_)
+      break;
+
     {
       rtc::CritScope lock(&sinks_lock_);
+      if (dispatch_) {
+        dispatch_(std::bind(&SDLRenderer::PollEvent, this));
+      }
+      for (SDL_Texture* texture : textures_to_destroy_) {
+        SDL_DestroyTexture(texture);
+      }
+      textures_to_destroy_.clear();
+
+      // 何も変わっていなければ描画しない
+      if (!redraw)
+        continue;
+
       SDL_RenderClear(renderer_);
       for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
         Sink* sink = sinks.second.get();
@@ -125,37 +200,52 @@ int SDLRenderer::RenderThread() {
         if (!sink->GetOutlineChanged())
           continue;
 
-        int width = sink->GetFrameWidth();
-        int height = sink->GetFrameHeight();
+        int width = sink->GetWidth();
+        int height = sink->GetHeight();
 
         if (width == 0 || height == 0)
           continue;
 
-        SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(
-            sink->GetImage(), width, height, 32, width * 4, 0, 0, 0, 0);
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer_, surface);
-        SDL_FreeSurface(surface);
-
-        SDL_Rect image_rect = {0, 0, width, height};
-        SDL_Rect draw_rect = {sink->GetOffsetX(), sink->GetOffsetY(),
-                              sink->GetWidth(), sink->GetHeight()};
-
-        // flip (自画像とか？)
-        //SDL_RenderCopyEx(renderer_, texture, &image_rect, &draw_rect, 0, nullptr, SDL_FLIP_HORIZONTAL);
-        SDL_RenderCopy(renderer_, texture, &image_rect, &draw_rect);
+        SDL_Texture* texture = sink->UpdateTexture(renderer_);
+        if (texture == nullptr)
+          continue;
 
-        SDL_DestroyTexture(texture);
+        // 回転は描画時に GPU で行う。
+        // SDL_RenderCopyEx は描画先の矩形の中心で回転するので、
+        // 90 度か 270 度の場合は回転前の縦横を入れ替えた矩形を指定する
+        int angle = static_cast<int>(sink->GetRotation());
+        SDL_Rect draw_rect = {sink->GetOffsetX(), sink->GetOffsetY(), width,
+                              height};
+        if (angle == 90 || angle == 270) {
+          draw_rect = {sink->GetOffsetX() + (width - height) / 2,
+                       sink->GetOffsetY() + (height - width) / 2, height,
+                       width};
+        }
+
+        // flip (自画像とか？) は SDL_FLIP_HORIZONTAL を指定する
+        SDL_RenderCopyEx(renderer_, texture, nullptr, &draw_rect, angle,
+                         nullptr, SDL_FLIP_NONE);
       }
+    }
+    // vsync 待ちの間に sinks_lock_ を持っているとトラックの追加やリサイズが止まるので、
+    // ロックを外してから表示する
+    {
+      TraceScope trace("SDL_RenderPresent", 0);
       SDL_RenderPresent(renderer_);
-
-      if (dispatch_) {
-        dispatch_(std::bind(&SDLRenderer::PollEvent, this));
-      }
     }
-    duration = SDL_GetTicks() - start_time;
-    SDL_Delay(FRAME_INTERVAL - (duration % FRAME_INTERVAL));
   }
 
+  {
+    rtc::CritScope lock(&sinks_lock_);
+    for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
+      rtc::CritScope frame_lock(sinks.second->GetCriticalSection());
+      sinks.second->DestroyTexture();
+    }
+    for (SDL_Texture* texture : textures_to_destroy_) {
+      SDL_DestroyTexture(texture);
+    }
+    textures_to_destroy_.clear();
+  }
   SDL_DestroyRenderer(renderer_);
 
   return 0;
@@ -165,6 +255,11 @@ SDLRenderer::Sink::Sink(SDLRenderer* renderer,
                         webrtc::VideoTrackInterface* track)
     : renderer_(renderer),
       track_(track),
+      last_frame_ms_(rtc::TimeMillis()),
+      max_pixel_count_(0),
+      wants_fps_(0),
+      max_fps_(0),
+      next_render_ms_(0),
       outline_offset_x_(0),
       outline_offset_y_(0),
       outline_width_(0),
@@ -172,26 +267,93 @@ SDLRenderer::Sink::Sink(SDLRenderer* renderer,
       outline_changed_(false),
       input_width_(0),
       input_height_(0),
-      scaled_(false),
+      offset_x_(0),
+      offset_y_(0),
       width_(0),
-      height_(0) {
+      height_(0),
+      rotation_(webrtc::kVideoRotation_0),
+      texture_(nullptr),
+      texture_format_(0),
+      texture_width_(0),
+      texture_height_(0) {
+  if (renderer_->latency_marker_) {
+    latency_stats_.reset(new LatencyStats("SDLRenderer " + track_->id()));
+  }
   track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
 }
 
 SDLRenderer::Sink::~Sink() {
   track_->RemoveSink(this);
+  // テクスチャはレンダースレッドでしか破棄できない
+  if (texture_ != nullptr) {
+    renderer_->DestroyTextureLater(texture_);
+  }
+}
+
+void SDLRenderer::Sink::MeasureLatency(const webrtc::VideoFrame& frame) {
+  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+      frame.video_frame_buffer()->ToI420();
+  uint32_t timestamp_ms;
+  if (!LatencyMarker::Read(buffer->DataY(), buffer->StrideY(),
+                           buffer->width(), buffer->height(), &timestamp_ms)) {
+    latency_stats_->AddMissing();
+    return;
+  }
+  // 下位 32 ビットしか無いので、差を符号付きで解釈する
+  latency_stats_->Add(
+      static_cast<int32_t>(LatencyMarker::NowMs() - timestamp_ms));
 }
 
 void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
+  if (frame.width() == 0 || frame.height() == 0)
+    return;
+  last_frame_ms_ = rtc::TimeMillis();
+  if (latency_stats_) {
+    // 描画はレンダースレッドで行うので、
+    // 計測した値に描画と vsync 待ちの時間 (最大 1 リフレッシュ分) は含まれない
+    MeasureLatency(frame);
+  }
   if (outline_width_ == 0 || outline_height_ == 0)
     return;
-  if (frame.width() == 0 || frame.height() == 0)
+  // 見えないフレームや、割り当てたフレームレートを超えるフレームは変換する前に捨てる
+  if (renderer_->window_hidden_)
     return;
+  const int max_fps = max_fps_;
+  if (max_fps > 0) {
+    const int64_t now_ms = last_frame_ms_;
+    const int64_t interval_ms = 1000 / max_fps;
+    if (now_ms < next_render_ms_)
+      return;
+    // 少し遅れて届いたフレームの分は次の間隔を詰めて、平均で max_fps になるようにする
+    next_render_ms_ = now_ms - next_render_ms_ > interval_ms
+                          ? now_ms + interval_ms
+                          : next_render_ms_ + interval_ms;
+  }
+
+  // NV12 の NativeBuffer はそのまま NV12 のテクスチャに転送する。それ以外は I420 にする
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  NativeBuffer* native_buffer =
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative
+          ? dynamic_cast<NativeBuffer*>(buffer.get())
+          : nullptr;
+  if (native_buffer == nullptr ||
+      native_buffer->VideoType() != webrtc::VideoType::kNV12) {
+    buffer = buffer->ToI420();
+  }
+
+  const bool rotated = frame.rotation() == webrtc::kVideoRotation_90 ||
+                       frame.rotation() == webrtc::kVideoRotation_270;
+  const int frame_width = rotated ? frame.height() : frame.width();
+  const int frame_height = rotated ? frame.width() : frame.height();
+
   rtc::CritScope lock(GetCriticalSection());
-  if (outline_changed_ || frame.width() != input_width_ ||
-      frame.height() != input_height_) {
+  if (outline_changed_ || frame_width != input_width_ ||
+      frame_height != input_height_) {
     int width, height;
-    float frame_aspect = (float)frame.width() / (float)frame.height();
+    float frame_aspect = (float)frame_width / (float)frame_height;
+    offset_x_ = 0;
+    offset_y_ = 0;
     if (frame_aspect > outline_aspect_) {
       width = outline_width_;
       height = width / frame_aspect;
@@ -201,38 +363,85 @@ void SDLRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
       width = height * frame_aspect;
       offset_x_ = (outline_width_ - width) / 2;
     }
-    if (width_ != width || height_ != height) {
-      width_ = width;
-      height_ = height;
-    }
-    input_width_ = frame.width();
-    input_height_ = frame.height();
-    scaled_ = width_ < input_width_;
-    if (scaled_) {
-      image_.reset(new uint8_t[width_ * height_ * 4]);
-    } else {
-      image_.reset(new uint8_t[input_width_ * input_height_ * 4]);
-    }
-    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": scaled_=" << scaled_;
+    width_ = width;
+    height_ = height;
+    input_width_ = frame_width;
+    input_height_ = frame_height;
     outline_changed_ = false;
   }
-  rtc::scoped_refptr<webrtc::I420BufferInterface> buffer_if;
-  if (scaled_) {
-    rtc::scoped_refptr<webrtc::I420Buffer> buffer =
-        webrtc::I420Buffer::Create(width_, height_);
-    buffer->ScaleFrom(*frame.video_frame_buffer()->ToI420());
-    if (frame.rotation() != webrtc::kVideoRotation_0) {
-      buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
+  frame_buffer_ = buffer;
+  rotation_ = frame.rotation();
+  renderer_->RequestRedraw();
+}
+
+SDL_Texture* SDLRenderer::Sink::UpdateTexture(SDL_Renderer* renderer) {
+  if (!frame_buffer_) {
+    return texture_;
+  }
+
+  const bool is_nv12 =
+      frame_buffer_->type() == webrtc::VideoFrameBuffer::Type::kNative;
+  const Uint32 format =
+      is_nv12 ? SDL_PIXELFORMAT_NV12 : SDL_PIXELFORMAT_IYUV;
+  const int width = frame_buffer_->width();
+  const int height = frame_buffer_->height();
+  if (texture_ == nullptr || texture_format_ != format ||
+      texture_width_ != width || texture_height_ != height) {
+    DestroyTexture();
+    texture_ = SDL_CreateTexture(renderer, format,
+                                 SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (texture_ == nullptr) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__ << ": SDL_CreateTexture failed "
+                        << SDL_GetError();
+      frame_buffer_ = nullptr;
+      return nullptr;
+    }
+    texture_format_ = format;
+    texture_width_ = width;
+    texture_height_ = height;
+    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": width=" << width
+                        << " height=" << height << " nv12=" << is_nv12;
+  }
+
+  if (is_nv12) {
+    // SDL 2.0.12 には SDL_UpdateNVTexture が無いので、ロックして直接書き込む
+    NativeBuffer* native_buffer =
+        static_cast<NativeBuffer*>(frame_buffer_.get());
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(texture_, nullptr, &pixels, &pitch) == 0) {
+      uint8_t* dst_y = static_cast<uint8_t*>(pixels);
+      uint8_t* dst_uv = dst_y + pitch * height;
+      for (int y = 0; y < height; y++) {
+        memcpy(dst_y + pitch * y,
+               native_buffer->DataY() + native_buffer->StrideY() * y, width);
+      }
+      for (int y = 0; y < (height + 1) / 2; y++) {
+        memcpy(dst_uv + pitch * y,
+               native_buffer->DataUV() + native_buffer->StrideUV() * y,
+               (width + 1) / 2 * 2);
+      }
+      SDL_UnlockTexture(texture_);
     }
-    buffer_if = buffer;
   } else {
-    buffer_if = frame.video_frame_buffer()->ToI420();
+    rtc::scoped_refptr<webrtc::I420BufferInterface> i420_buffer =
+        frame_buffer_->ToI420();
+    SDL_UpdateYUVTexture(texture_, nullptr, i420_buffer->DataY(),
+                         i420_buffer->StrideY(), i420_buffer->DataU(),
+                         i420_buffer->StrideU(), i420_buffer->DataV(),
+                         i420_buffer->StrideV());
+  }
+
+  // 転送したらバッファは不要なので、デコーダのプールに返す
+  frame_buffer_ = nullptr;
+  return texture_;
+}
+
+void SDLRenderer::Sink::DestroyTexture() {
+  if (texture_ != nullptr) {
+    SDL_DestroyTexture(texture_);
+    texture_ = nullptr;
   }
-  libyuv::ConvertFromI420(
-      buffer_if->DataY(), buffer_if->StrideY(), buffer_if->DataU(),
-      buffer_if->StrideU(), buffer_if->DataV(), buffer_if->StrideV(),
-      image_.get(), (scaled_ ? width_ : input_width_) * 4, buffer_if->width(),
-      buffer_if->height(), libyuv::FOURCC_ARGB);
 }
 
 void SDLRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
@@ -250,6 +459,27 @@ void SDLRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
   outline_changed_ = true;
 }
 
+void SDLRenderer::Sink::SetRenderLimits(int max_pixel_count, int max_fps) {
+  max_fps_ = max_fps;
+  if (max_pixel_count == max_pixel_count_ && max_fps == wants_fps_) {
+    return;
+  }
+  max_pixel_count_ = max_pixel_count;
+  wants_fps_ = max_fps;
+  // ローカルのトラック (--show-me) に伝えると、送信する映像の解像度までタイルに合わせて下がってしまう
+  if (!track_->GetSource()->remote()) {
+    return;
+  }
+  rtc::VideoSinkWants wants;
+  if (max_pixel_count > 0) {
+    wants.max_pixel_count = max_pixel_count;
+  }
+  if (max_fps > 0) {
+    wants.max_framerate_fps = max_fps;
+  }
+  track_->AddOrUpdateSink(this, wants);
+}
+
 rtc::CriticalSection* SDLRenderer::Sink::GetCriticalSection() {
   return &frame_params_lock_;
 }
@@ -266,14 +496,6 @@ int SDLRenderer::Sink::GetOffsetY() {
   return outline_offset_y_ + offset_y_;
 }
 
-int SDLRenderer::Sink::GetFrameWidth() {
-  return scaled_ ? width_ : input_width_;
-}
-
-int SDLRenderer::Sink::GetFrameHeight() {
-  return scaled_ ? height_ : input_height_;
-}
-
 int SDLRenderer::Sink::GetWidth() {
   return width_;
 }
@@ -282,8 +504,8 @@ int SDLRenderer::Sink::GetHeight() {
   return height_;
 }
 
-uint8_t* SDLRenderer::Sink::GetImage() {
-  return image_.get();
+webrtc::VideoRotation SDLRenderer::Sink::GetRotation() {
+  return rotation_;
 }
 
 void SDLRenderer::SetOutlines() {
@@ -319,11 +541,16 @@ void SDLRenderer::SetOutlines() {
   int outline_width = std::floor(width_ / cols);
   int outline_height = std::floor(height_ / rows);
   int sinks_count = sinks_.size();
+  // 描画のフレームレートをトラックで分け合う
+  int max_fps = render_budget_fps_ > 0 && sinks_count > 0
+                    ? std::max(1, render_budget_fps_ / sinks_count)
+                    : 0;
   for (int i = 0; i < sinks_count; i++) {
     Sink* sink = sinks_[i].second.get();
     int offset_x = outline_width * (i % cols);
     int offset_y = outline_height * std::floor(i / cols);
     sink->SetOutlineRect(offset_x, offset_y, outline_width, outline_height);
+    sink->SetRenderLimits(outline_width * outline_height, max_fps);
     RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " offset_x:" << offset_x
                         << " offset_y:" << offset_y
                         << " outline_width:" << outline_width
@@ -331,6 +558,7 @@ void SDLRenderer::SetOutlines() {
   }
   rows_ = rows;
   cols_ = cols;
+  RequestRedraw();
 }
 
 void SDLRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
@@ -340,6 +568,16 @@ void SDLRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
   SetOutlines();
 }
 
+int64_t SDLRenderer::GetLongestFrameGapMs() {
+  const int64_t now_ms = rtc::TimeMillis();
+  int64_t gap_ms = -1;
+  rtc::CritScope lock(&sinks_lock_);
+  for (const VideoTrackSinkVector::value_type& sink : sinks_) {
+    gap_ms = std::max(gap_ms, now_ms - sink.second->GetLastFrameMs());
+  }
+  return gap_ms;
+}
+
 void SDLRenderer::RemoveTrack(webrtc::VideoTrackInterface* track) {
   rtc::CritScope lock(&sinks_lock_);
   sinks_.erase(
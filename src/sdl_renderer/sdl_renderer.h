@@ -3,8 +3,11 @@
 
 #include <SDL.h>
 
+#include <atomic>
 #include <boost/asio.hpp>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -12,12 +15,18 @@
 #include "api/scoped_refptr.h"
 #include "api/video/video_frame.h"
 #include "api/video/video_sink_interface.h"
+#include "rtc/latency_marker.h"
 #include "rtc/video_track_receiver.h"
 #include "rtc_base/critical_section.h"
 
 class SDLRenderer : public VideoTrackReceiver {
  public:
-  SDLRenderer(int width, int height, bool fullscreen);
+  // render_budget_fps が 0 より大きい場合、全てのトラックを合わせてこのフレームレートまでしか描画しない
+  SDLRenderer(int width,
+              int height,
+              bool fullscreen,
+              bool latency_marker,
+              int render_budget_fps = 0);
   ~SDLRenderer();
 
   void SetDispatchFunction(std::function<void(std::function<void()>)> dispatch);
@@ -28,6 +37,7 @@ class SDLRenderer : public VideoTrackReceiver {
   void SetOutlines();
   void AddTrack(webrtc::VideoTrackInterface* track) override;
   void RemoveTrack(webrtc::VideoTrackInterface* track) override;
+  int64_t GetLongestFrameGapMs() override;
 
  protected:
   class Sink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
@@ -38,20 +48,41 @@ class SDLRenderer : public VideoTrackReceiver {
     void OnFrame(const webrtc::VideoFrame& frame) override;
 
     void SetOutlineRect(int x, int y, int width, int height);
+    // 割り当てたフレームレートを超えるフレームは描画しない。
+    // 受信したトラックの場合は、タイルの大きさとフレームレートを VideoSinkWants でも伝える。
+    // max_fps が 0 の場合はフレームレートを制限しない
+    void SetRenderLimits(int max_pixel_count, int max_fps);
 
     rtc::CriticalSection* GetCriticalSection();
     bool GetOutlineChanged();
     int GetOffsetX();
     int GetOffsetY();
-    int GetFrameWidth();
-    int GetFrameHeight();
     int GetWidth();
     int GetHeight();
-    uint8_t* GetImage();
+    webrtc::VideoRotation GetRotation();
+    // 最後にフレームを受け取った時刻。まだ受け取っていない場合は作られた時刻
+    int64_t GetLastFrameMs() const { return last_frame_ms_; }
+
+    // 新しいフレームが届いていればテクスチャに転送して、描画するテクスチャを返す。
+    // レンダースレッドから GetCriticalSection() を持った状態で呼ぶこと
+    SDL_Texture* UpdateTexture(SDL_Renderer* renderer);
+    // レンダースレッドが終了する前に呼ぶ
+    void DestroyTexture();
 
    private:
+    void MeasureLatency(const webrtc::VideoFrame& frame);
+
     SDLRenderer* renderer_;
     rtc::scoped_refptr<webrtc::VideoTrackInterface> track_;
+    std::atomic<int64_t> last_frame_ms_;
+    // 最後に上流に伝えた VideoSinkWants
+    int max_pixel_count_;
+    int wants_fps_;
+    std::atomic<int> max_fps_;
+    // max_fps_ を超えないように、次に描画して良い時刻。OnFrame() だけが触る
+    int64_t next_render_ms_;
+    // latency_marker の場合に、受信したフレームの遅延を集計する
+    std::unique_ptr<LatencyStats> latency_stats_;
     rtc::CriticalSection frame_params_lock_;
     int outline_offset_x_;
     int outline_offset_y_;
@@ -59,27 +90,43 @@ class SDLRenderer : public VideoTrackReceiver {
     int outline_height_;
     bool outline_changed_;
     float outline_aspect_;
+    // 回転を適用した後のフレームのサイズ
     int input_width_;
     int input_height_;
-    bool scaled_;
-    std::unique_ptr<uint8_t[]> image_;
     int offset_x_;
     int offset_y_;
     int width_;
     int height_;
+    // 最後に受け取ったフレーム。I420 か NV12 の NativeBuffer で、
+    // 縮小や回転、色変換はせずにレンダースレッドでそのままテクスチャに転送する
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame_buffer_;
+    webrtc::VideoRotation rotation_;
+    // 以下はレンダースレッドだけが触る
+    SDL_Texture* texture_;
+    Uint32 texture_format_;
+    int texture_width_;
+    int texture_height_;
   };
 
  private:
   bool IsFullScreen();
   void SetFullScreen(bool fullscreen);
   void PollEvent();
+  // レンダースレッドを起こして再描画させる
+  void RequestRedraw();
+  // 別のスレッドで破棄された Sink のテクスチャを、レンダースレッドで破棄するために積んでおく
+  void DestroyTextureLater(SDL_Texture* texture);
 
   rtc::CriticalSection sinks_lock_;
   typedef std::vector<
       std::pair<webrtc::VideoTrackInterface*, std::unique_ptr<Sink> > >
       VideoTrackSinkVector;
   VideoTrackSinkVector sinks_;
+  std::vector<SDL_Texture*> textures_to_destroy_;
   std::atomic<bool> running_;
+  std::mutex redraw_mutex_;
+  std::condition_variable redraw_cond_;
+  bool redraw_requested_ = false;
   SDL_Thread* thread_;
   SDL_Window* window_;
   SDL_Renderer* renderer_;
@@ -88,6 +135,10 @@ class SDLRenderer : public VideoTrackReceiver {
   int height_;
   int rows_;
   int cols_;
+  bool latency_marker_;
+  const int render_budget_fps_;
+  // ウィンドウが最小化されているか隠れている間は、受け取ったフレームを変換せずに捨てる
+  std::atomic<bool> window_hidden_;
 };
 
 #endif
\ No newline at end of file
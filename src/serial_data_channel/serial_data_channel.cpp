@@ -27,11 +27,10 @@ void SerialDataChannel::OnMessage(const webrtc::DataBuffer& buffer) {
   serial_data_manager_->Send(data, length);
 }
 
-void SerialDataChannel::Send(uint8_t* data, size_t length) {
+void SerialDataChannel::Send(const rtc::CopyOnWriteBuffer& buffer) {
   if (data_channel_->state() != webrtc::DataChannelInterface::kOpen) {
     return;
   }
-  rtc::CopyOnWriteBuffer buffer(data, length);
   webrtc::DataBuffer data_buffer(buffer, true);
   data_channel_->Send(data_buffer);
 }
\ No newline at end of file
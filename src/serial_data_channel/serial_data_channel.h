@@ -14,7 +14,7 @@ class SerialDataChannel : public webrtc::DataChannelObserver {
       rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel);
   ~SerialDataChannel();
 
-  void Send(uint8_t* data, size_t length);
+  void Send(const rtc::CopyOnWriteBuffer& buffer);
 
   void OnStateChange() override;
   void OnMessage(const webrtc::DataBuffer& buffer) override;
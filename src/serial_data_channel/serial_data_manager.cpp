@@ -9,10 +9,21 @@
 #include "rtc_base/log_sinks.h"
 
 #define SERIAL_TX_BUFFER_SIZE 16
-#define SERIAL_RX_BUFFER_SIZE 256
-
-SerialDataManager::SerialDataManager(boost::asio::io_context& ioc)
-    : serial_port_(ioc), read_buffer_size_(SERIAL_RX_BUFFER_SIZE) {
+// バイナリのフレームはまとめて書き込む
+#define SERIAL_TX_BUFFER_SIZE_BINARY 4096
+#define SERIAL_RX_BUFFER_SIZE 4096
+
+SerialDataManager::SerialDataManager(boost::asio::io_context& ioc,
+                                     SerialFraming framing)
+    : serial_port_(ioc),
+      framing_(framing),
+      read_buffer_size_(SERIAL_RX_BUFFER_SIZE),
+      decoder_(framing),
+      write_offset_(0),
+      write_length_(0),
+      write_chunk_size_(framing == SerialFraming::kLine
+                            ? SERIAL_TX_BUFFER_SIZE
+                            : SERIAL_TX_BUFFER_SIZE_BINARY) {
   post_ = [&ioc](std::function<void()> f) {
     if (ioc.stopped())
       return;
@@ -96,7 +107,10 @@ bool SerialDataManager::Connect(std::string device, unsigned int rate) {
 }
 
 void SerialDataManager::Send(const uint8_t* data, size_t length) {
-  std::vector<uint8_t> v(data, data + length);
+  std::vector<uint8_t> v = EncodeSerialFrame(framing_, data, length);
+  if (v.empty()) {
+    return;
+  }
   post_(std::bind(&SerialDataManager::startWrite, this, std::move(v)));
 }
 
@@ -128,26 +142,26 @@ void SerialDataManager::onRead(const boost::system::error_code& error,
     doCloseSerial();
     return;
   }
-  read_line_buffer_.insert(read_line_buffer_.end(), read_buffer_.get(),
-                           read_buffer_.get() + bytes_transferred);
   {
+    // 1 回の読み込みで取り出せたフレームは、まとめて送信する
     rtc::CritScope lock(&channels_lock_);
-    sendLineFromSerial();
+    decoder_.Feed(read_buffer_.get(), bytes_transferred,
+                  [this](const uint8_t* data, size_t length) {
+                    sendFrameFromSerial(data, length);
+                  });
   }
   doRead();
 }
 
-void SerialDataManager::sendLineFromSerial() {
-  auto delimiter_iterator =
-      std::find(read_line_buffer_.begin(), read_line_buffer_.end(), '\n');
-  if (delimiter_iterator != read_line_buffer_.end()) {
-    size_t delimiter_index =
-        std::distance(read_line_buffer_.begin(), delimiter_iterator);
-    for (SerialDataChannel* serial_data_channel : serial_data_channels_) {
-      serial_data_channel->Send(read_line_buffer_.data(), delimiter_index);
-    }
-    read_line_buffer_.erase(read_line_buffer_.begin(), delimiter_iterator + 1);
-    sendLineFromSerial();
+void SerialDataManager::sendFrameFromSerial(const uint8_t* data,
+                                            size_t length) {
+  if (serial_data_channels_.empty()) {
+    return;
+  }
+  // 全ての DataChannel で同じバッファを共有する
+  rtc::CopyOnWriteBuffer buffer(data, length);
+  for (SerialDataChannel* serial_data_channel : serial_data_channels_) {
+    serial_data_channel->Send(buffer);
   }
 }
 
@@ -155,21 +169,18 @@ void SerialDataManager::startWrite(std::vector<uint8_t> v) {
   if (!serial_port_.is_open()) {
     return;
   }
-  bool empty = write_buffer_.empty();
-  write_buffer_.insert(write_buffer_.end(), v.begin(), v.end());
-  if (empty && !write_buffer_.empty()) {
+  bool empty = write_queue_.empty();
+  write_queue_.push_back(std::move(v));
+  if (empty) {
     doWrite();
   }
 }
 
 void SerialDataManager::doWrite() {
-  if (write_buffer_.size() < SERIAL_TX_BUFFER_SIZE) {
-    write_length_ = write_buffer_.size();
-  } else {
-    write_length_ = SERIAL_TX_BUFFER_SIZE;
-  }
+  const std::vector<uint8_t>& front = write_queue_.front();
+  write_length_ = std::min(front.size() - write_offset_, write_chunk_size_);
   async_write(serial_port_,
-              boost::asio::buffer(write_buffer_.data(), write_length_),
+              boost::asio::buffer(front.data() + write_offset_, write_length_),
               boost::bind(&SerialDataManager::onWrite, this,
                           boost::asio::placeholders::error));
 }
@@ -181,10 +192,13 @@ void SerialDataManager::onWrite(const boost::system::error_code& error) {
     doCloseSerial();
     return;
   }
-  write_buffer_.erase(write_buffer_.begin(),
-                      write_buffer_.begin() + write_length_);
-  if (write_buffer_.empty()) {
+  write_offset_ += write_length_;
+  if (write_offset_ >= write_queue_.front().size()) {
+    write_queue_.pop_front();
+    write_offset_ = 0;
+  }
+  if (write_queue_.empty()) {
     return;
   }
   doWrite();
-}
\ No newline at end of file
+}
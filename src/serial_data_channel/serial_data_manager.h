@@ -1,5 +1,6 @@
 #ifndef SERIAL_DATA_MANAGER_H_
 #define SERIAL_DATA_MANAGER_H_
+#include <deque>
 #include <vector>
 
 #include <boost/asio.hpp>
@@ -7,6 +8,7 @@
 #include "rtc/data_manager.h"
 #include "rtc_base/critical_section.h"
 #include "serial_data_channel.h"
+#include "serial_framing.h"
 
 class SerialDataChannel;
 
@@ -14,8 +16,10 @@ class SerialDataManager : public RTCDataManager {
  public:
   static std::unique_ptr<SerialDataManager> Create(boost::asio::io_context& ioc,
                                                    std::string device,
-                                                   unsigned int rate) {
-    std::unique_ptr<SerialDataManager> data_manager(new SerialDataManager(ioc));
+                                                   unsigned int rate,
+                                                   SerialFraming framing) {
+    std::unique_ptr<SerialDataManager> data_manager(
+        new SerialDataManager(ioc, framing));
     if (!data_manager->Connect(device, rate)) {
       return nullptr;
     }
@@ -30,12 +34,12 @@ class SerialDataManager : public RTCDataManager {
   void OnClosed(SerialDataChannel* serial_data_channel);
 
  private:
-  SerialDataManager(boost::asio::io_context& ioc);
+  SerialDataManager(boost::asio::io_context& ioc, SerialFraming framing);
   bool Connect(std::string device, unsigned int rate);
   void doCloseSerial();
   void doRead();
   void onRead(const boost::system::error_code& error, size_t bytes_transferred);
-  void sendLineFromSerial();
+  void sendFrameFromSerial(const uint8_t* data, size_t length);
   void startWrite(std::vector<uint8_t> v);
   void doWrite();
   void onWrite(const boost::system::error_code& error);
@@ -45,12 +49,16 @@ class SerialDataManager : public RTCDataManager {
   rtc::CriticalSection channels_lock_;
   std::vector<SerialDataChannel*> serial_data_channels_;
 
+  const SerialFraming framing_;
   std::unique_ptr<uint8_t[]> read_buffer_;
   size_t read_buffer_size_;
-  std::vector<uint8_t> read_line_buffer_;
+  SerialFrameDecoder decoder_;
 
-  std::vector<uint8_t> write_buffer_;
+  // 受け取ったメッセージはコピーせずにそのまま並べておき、先頭から順に書き込む
+  std::deque<std::vector<uint8_t>> write_queue_;
+  size_t write_offset_;
   size_t write_length_;
+  const size_t write_chunk_size_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include "serial_framing.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+
+// kCobs と kLength の 1 フレームの最大サイズ
+static const size_t kMaxFrameSize = 65535;
+
+bool ParseSerialFraming(const std::string& name, SerialFraming* framing) {
+  if (name == "line") {
+    *framing = SerialFraming::kLine;
+  } else if (name == "cobs") {
+    *framing = SerialFraming::kCobs;
+  } else if (name == "length") {
+    *framing = SerialFraming::kLength;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+SerialFrameDecoder::SerialFrameDecoder(SerialFraming framing)
+    : framing_(framing) {
+  if (framing_ != SerialFraming::kLine) {
+    frame_.reserve(kMaxFrameSize);
+  }
+}
+
+void SerialFrameDecoder::Feed(const uint8_t* data,
+                              size_t length,
+                              const frame_callback_t& on_frame) {
+  switch (framing_) {
+    case SerialFraming::kLine:
+      FeedLine(data, length, on_frame);
+      break;
+    case SerialFraming::kCobs:
+      FeedCobs(data, length, on_frame);
+      break;
+    case SerialFraming::kLength:
+      FeedLength(data, length, on_frame);
+      break;
+  }
+}
+
+void SerialFrameDecoder::FeedLine(const uint8_t* data,
+                                  size_t length,
+                                  const frame_callback_t& on_frame) {
+  const uint8_t* end = data + length;
+  while (data < end) {
+    const uint8_t* delimiter =
+        static_cast<const uint8_t*>(memchr(data, '\n', end - data));
+    if (delimiter == nullptr) {
+      frame_.insert(frame_.end(), data, end);
+      return;
+    }
+    if (frame_.empty()) {
+      // 前回の残りが無ければコピーせずにそのまま渡す
+      on_frame(data, delimiter - data);
+    } else {
+      frame_.insert(frame_.end(), data, delimiter);
+      on_frame(frame_.data(), frame_.size());
+      frame_.clear();
+    }
+    data = delimiter + 1;
+  }
+}
+
+void SerialFrameDecoder::FeedCobs(const uint8_t* data,
+                                  size_t length,
+                                  const frame_callback_t& on_frame) {
+  for (size_t i = 0; i < length; i++) {
+    uint8_t b = data[i];
+    if (b == 0) {
+      // フレームの終わり
+      if (!cobs_broken_ && cobs_remaining_ == 0 && !frame_.empty()) {
+        on_frame(frame_.data(), frame_.size());
+      } else if (cobs_broken_ || cobs_remaining_ != 0) {
+        RTC_LOG(LS_WARNING) << __FUNCTION__ << ": drop broken frame";
+      }
+      frame_.clear();
+      cobs_remaining_ = 0;
+      cobs_code_ = 0xff;
+      cobs_broken_ = false;
+      continue;
+    }
+    if (cobs_broken_) {
+      continue;
+    }
+    if (cobs_remaining_ == 0) {
+      // 次のブロックが始まる時に、前のブロックの終わりの 0x00 を復元する
+      if (cobs_code_ != 0xff) {
+        frame_.push_back(0);
+      }
+      cobs_code_ = b;
+      cobs_remaining_ = b - 1;
+    } else {
+      frame_.push_back(b);
+      cobs_remaining_--;
+    }
+    if (frame_.size() > kMaxFrameSize) {
+      RTC_LOG(LS_WARNING) << __FUNCTION__ << ": frame too large";
+      cobs_broken_ = true;
+      frame_.clear();
+    }
+  }
+}
+
+void SerialFrameDecoder::FeedLength(const uint8_t* data,
+                                    size_t length,
+                                    const frame_callback_t& on_frame) {
+  size_t i = 0;
+  while (i < length) {
+    if (header_read_ < 2) {
+      frame_length_ = (frame_length_ << 8) | data[i];
+      header_read_++;
+      i++;
+      if (header_read_ < 2 || frame_length_ != 0) {
+        continue;
+      }
+      // 長さ 0 のフレームは無視する
+      header_read_ = 0;
+      continue;
+    }
+    size_t n = std::min(length - i, frame_length_ - frame_.size());
+    if (frame_.empty() && n == frame_length_) {
+      // 1 回の読み込みにフレームが全部入っていればコピーせずにそのまま渡す
+      on_frame(data + i, n);
+    } else {
+      frame_.insert(frame_.end(), data + i, data + i + n);
+    }
+    i += n;
+    if (n == frame_length_ || frame_.size() == frame_length_) {
+      if (!frame_.empty()) {
+        on_frame(frame_.data(), frame_.size());
+        frame_.clear();
+      }
+      header_read_ = 0;
+      frame_length_ = 0;
+    }
+  }
+}
+
+std::vector<uint8_t> EncodeSerialFrame(SerialFraming framing,
+                                       const uint8_t* data,
+                                       size_t length) {
+  std::vector<uint8_t> out;
+  switch (framing) {
+    case SerialFraming::kLine:
+      out.assign(data, data + length);
+      break;
+    case SerialFraming::kCobs: {
+      out.reserve(length + length / 254 + 2);
+      size_t code_index = 0;
+      uint8_t code = 1;
+      out.push_back(0);
+      for (size_t i = 0; i < length; i++) {
+        if (data[i] == 0) {
+          out[code_index] = code;
+          code_index = out.size();
+          out.push_back(0);
+          code = 1;
+          continue;
+        }
+        out.push_back(data[i]);
+        code++;
+        if (code == 0xff) {
+          out[code_index] = code;
+          code_index = out.size();
+          out.push_back(0);
+          code = 1;
+        }
+      }
+      out[code_index] = code;
+      out.push_back(0);
+      break;
+    }
+    case SerialFraming::kLength:
+      if (length > kMaxFrameSize) {
+        RTC_LOG(LS_WARNING) << __FUNCTION__ << ": message too large: " << length;
+        break;
+      }
+      out.reserve(length + 2);
+      out.push_back(static_cast<uint8_t>(length >> 8));
+      out.push_back(static_cast<uint8_t>(length & 0xff));
+      out.insert(out.end(), data, data + length);
+      break;
+  }
+  return out;
+}
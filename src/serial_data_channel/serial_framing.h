@@ -0,0 +1,60 @@
+#ifndef SERIAL_FRAMING_H_
+#define SERIAL_FRAMING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// シリアルポートを流れるバイト列と DataChannel のメッセージの対応付け
+//
+// kLine:   '\n' 区切りの行を 1 メッセージにする。メッセージはそのままシリアルポートに書く
+// kCobs:   COBS でエンコードして 0x00 で区切ったフレームを 1 メッセージにする
+// kLength: 2 バイト (ビッグエンディアン) の長さを先頭に付けたフレームを 1 メッセージにする
+enum class SerialFraming { kLine, kCobs, kLength };
+
+bool ParseSerialFraming(const std::string& name, SerialFraming* framing);
+
+// シリアルポートから読んだバイト列からフレームを取り出すクラス。
+// 読んだバイト列は 1 回だけ走査するので、大量のデータが一度に来ても処理量はデータ量に比例する。
+class SerialFrameDecoder {
+ public:
+  typedef std::function<void(const uint8_t* data, size_t length)>
+      frame_callback_t;
+
+  explicit SerialFrameDecoder(SerialFraming framing);
+
+  // 取り出せたフレーム毎に on_frame を呼ぶ
+  void Feed(const uint8_t* data, size_t length, const frame_callback_t& on_frame);
+
+ private:
+  void FeedLine(const uint8_t* data,
+                size_t length,
+                const frame_callback_t& on_frame);
+  void FeedCobs(const uint8_t* data,
+                size_t length,
+                const frame_callback_t& on_frame);
+  void FeedLength(const uint8_t* data,
+                  size_t length,
+                  const frame_callback_t& on_frame);
+
+  const SerialFraming framing_;
+  std::vector<uint8_t> frame_;
+
+  // kCobs の状態
+  int cobs_remaining_ = 0;
+  uint8_t cobs_code_ = 0xff;
+  bool cobs_broken_ = false;
+
+  // kLength の状態
+  size_t header_read_ = 0;
+  size_t frame_length_ = 0;
+};
+
+// DataChannel のメッセージをシリアルポートに書くバイト列にする
+std::vector<uint8_t> EncodeSerialFrame(SerialFraming framing,
+                                       const uint8_t* data,
+                                       size_t length);
+
+#endif
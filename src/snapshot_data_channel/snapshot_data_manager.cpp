@@ -0,0 +1,186 @@
+#include "snapshot_data_manager.h"
+
+#include <algorithm>
+
+#include <nlohmann/json.hpp>
+
+#include "rtc_base/copy_on_write_buffer.h"
+#include "rtc_base/logging.h"
+
+const size_t SnapshotDataManager::kChunkSize;
+const uint64_t SnapshotDataManager::kHighWaterMark;
+const uint64_t SnapshotDataManager::kLowWaterMark;
+
+// DataChannel 毎の送信の状態。
+// Capture() と Pump() は SnapshotDataManager のスレッドだけから呼ぶ。
+// Send() の中でシグナリングスレッドから OnBufferedAmountChange() が呼ばれるので、
+// ロックを持ったまま Send() しないこと。
+class SnapshotDataManager::Channel : public webrtc::DataChannelObserver {
+ public:
+  Channel(SnapshotDataManager* manager,
+          rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+      : manager_(manager), data_channel_(data_channel) {
+    data_channel_->RegisterObserver(this);
+  }
+  ~Channel() { data_channel_->UnregisterObserver(); }
+
+  void OnStateChange() override {
+    if (data_channel_->state() == webrtc::DataChannelInterface::kClosed) {
+      manager_->OnClosed(this);
+    }
+  }
+  void OnMessage(const webrtc::DataBuffer& buffer) override {
+    manager_->Wake(this, true);
+  }
+  void OnBufferedAmountChange(uint64_t previous_amount) override {
+    if (data_channel_->buffered_amount() > kLowWaterMark) {
+      return;
+    }
+    manager_->Wake(this, false);
+  }
+
+  // 送りかけの JPEG を送ってから、溜まっている要求を順に処理する
+  void Process() {
+    while (Pump()) {
+      if (!manager_->TakeRequest(this)) {
+        return;
+      }
+      Capture();
+    }
+  }
+
+  // 以下は manager の mutex_ で守る
+  // 処理していない要求の数
+  int requests = 0;
+  // manager の queue_ に入っているかどうか
+  bool queued = false;
+
+ private:
+  void Capture() {
+    std::string jpeg;
+    if (!manager_->get_snapshot_(&jpeg)) {
+      nlohmann::json json = {{"type", "error"},
+                             {"message", "No frame to snapshot"}};
+      data_channel_->Send(webrtc::DataBuffer(json.dump()));
+      return;
+    }
+    RTC_LOG(LS_INFO) << "SnapshotDataManager: requested by "
+                     << data_channel_->label() << ", size=" << jpeg.size();
+    nlohmann::json json = {{"type", "snapshot"}, {"size", jpeg.size()}};
+    data_channel_->Send(webrtc::DataBuffer(json.dump()));
+    jpeg_ = std::move(jpeg);
+    offset_ = 0;
+  }
+
+  // 送り終わるか、送るのを諦めたら true を返す。
+  // bufferedAmount が多くて止めた場合は false を返し、続きは OnBufferedAmountChange() から再開する
+  bool Pump() {
+    while (offset_ < jpeg_.size()) {
+      if (data_channel_->state() != webrtc::DataChannelInterface::kOpen) {
+        break;
+      }
+      if (data_channel_->buffered_amount() > kHighWaterMark) {
+        return false;
+      }
+      const size_t length = std::min(kChunkSize, jpeg_.size() - offset_);
+      rtc::CopyOnWriteBuffer data(jpeg_.data() + offset_, length);
+      if (!data_channel_->Send(webrtc::DataBuffer(data, true))) {
+        RTC_LOG(LS_WARNING) << "SnapshotDataManager: failed to send";
+        break;
+      }
+      offset_ += length;
+    }
+    jpeg_.clear();
+    offset_ = 0;
+    return true;
+  }
+
+  SnapshotDataManager* manager_;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+  std::string jpeg_;
+  size_t offset_ = 0;
+};
+
+SnapshotDataManager::SnapshotDataManager(
+    std::function<bool(std::string* jpeg)> get_snapshot)
+    : get_snapshot_(std::move(get_snapshot)) {
+  thread_ = std::thread([this]() { Run(); });
+}
+
+SnapshotDataManager::~SnapshotDataManager() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+void SnapshotDataManager::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  channels_.emplace_back(new Channel(this, data_channel));
+}
+
+void SnapshotDataManager::OnClosed(Channel* channel) {
+  // ロックを外してから Channel を破棄する。
+  // スレッドが処理している途中であれば、スレッドが処理を終えた時に破棄される
+  std::shared_ptr<Channel> closed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(
+      channels_.begin(), channels_.end(),
+      [channel](const std::shared_ptr<Channel>& c) { return c.get() == channel; });
+  if (it != channels_.end()) {
+    closed = std::move(*it);
+    channels_.erase(it);
+  }
+}
+
+void SnapshotDataManager::Wake(Channel* channel, bool request) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (request) {
+      channel->requests += 1;
+    }
+    if (channel->queued) {
+      return;
+    }
+    channel->queued = true;
+    queue_.push_back(channel);
+  }
+  cond_.notify_all();
+}
+
+bool SnapshotDataManager::TakeRequest(Channel* channel) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (channel->requests == 0) {
+    return false;
+  }
+  channel->requests -= 1;
+  return true;
+}
+
+void SnapshotDataManager::Run() {
+  while (true) {
+    std::shared_ptr<Channel> channel;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return quit_ || !queue_.empty(); });
+      if (quit_) {
+        return;
+      }
+      Channel* p = queue_.front();
+      queue_.pop_front();
+      // 閉じた Channel は channels_ に無いので飛ばす
+      auto it = std::find_if(
+          channels_.begin(), channels_.end(),
+          [p](const std::shared_ptr<Channel>& c) { return c.get() == p; });
+      if (it == channels_.end()) {
+        continue;
+      }
+      channel = *it;
+      channel->queued = false;
+    }
+    channel->Process();
+  }
+}
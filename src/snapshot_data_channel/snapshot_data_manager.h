@@ -0,0 +1,59 @@
+#ifndef SNAPSHOT_DATA_MANAGER_H_
+#define SNAPSHOT_DATA_MANAGER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rtc/data_manager.h"
+
+// 相手が作った DataChannel にメッセージが届く度に get_snapshot を呼び、
+// 最新のフレームの JPEG をその DataChannel に送り返すクラス。メッセージの内容は見ない。
+//
+// 1 つのメッセージで送れる大きさには制限があるので、
+// {"type": "snapshot", "size": JPEG の大きさ} を送った後に JPEG を kChunkSize ずつのバイナリで送る。
+// JPEG を作れなかった場合は {"type": "error", "message": "..."} を送る。
+//
+// JPEG のエンコードでシグナリングスレッドを止めないように、get_snapshot の呼び出しと送信は
+// 専用のスレッドで行う。DataChannel の bufferedAmount が kHighWaterMark を超えたら送信を止め、
+// OnBufferedAmountChange() で kLowWaterMark まで減ったのを知ったら再開する。
+// 送っている間に届いた要求は、送り終わってから順に処理する。
+class SnapshotDataManager : public RTCDataManager {
+ public:
+  explicit SnapshotDataManager(
+      std::function<bool(std::string* jpeg)> get_snapshot);
+  ~SnapshotDataManager();
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+
+ private:
+  class Channel;
+  void OnClosed(Channel* channel);
+  // channel をスレッドで処理させる。request が true の場合は要求を 1 つ増やす
+  void Wake(Channel* channel, bool request);
+  // channel の要求を 1 つ取り出す。無ければ false を返す
+  bool TakeRequest(Channel* channel);
+  void Run();
+
+  static const size_t kChunkSize = 16 * 1024;
+  // bufferedAmount がこの量を超えたら送信を止めて、kLowWaterMark まで減ったら再開する
+  static const uint64_t kHighWaterMark = 1024 * 1024;
+  static const uint64_t kLowWaterMark = 256 * 1024;
+
+  std::function<bool(std::string* jpeg)> get_snapshot_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<std::shared_ptr<Channel>> channels_;
+  // スレッドで処理を待っている Channel。閉じた Channel が残っていても良い
+  std::deque<Channel*> queue_;
+  bool quit_ = false;
+  std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "socket_data_channel.h"
+
+#include "rtc_base/logging.h"
+#include "socket_data_manager.h"
+
+const uint64_t SocketDataChannel::kHighWaterMark;
+const uint64_t SocketDataChannel::kLowWaterMark;
+
+SocketDataChannel::SocketDataChannel(
+    SocketDataManager* socket_data_manager,
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+    : socket_data_manager_(socket_data_manager),
+      data_channel_(data_channel),
+      paused_(false),
+      dropped_(0) {
+  data_channel_->RegisterObserver(this);
+}
+
+SocketDataChannel::~SocketDataChannel() {
+  data_channel_->UnregisterObserver();
+}
+
+void SocketDataChannel::OnStateChange() {
+  webrtc::DataChannelInterface::DataState state = data_channel_->state();
+  if (state == webrtc::DataChannelInterface::kClosed) {
+    socket_data_manager_->OnClosed(this);
+  }
+}
+
+void SocketDataChannel::OnMessage(const webrtc::DataBuffer& buffer) {
+  const uint8_t* data = buffer.data.data<uint8_t>();
+  size_t length = buffer.data.size();
+
+  socket_data_manager_->Send(data, length);
+}
+
+void SocketDataChannel::OnBufferedAmountChange(uint64_t previous_amount) {
+  if (!paused_ || data_channel_->buffered_amount() > kLowWaterMark) {
+    return;
+  }
+  paused_ = false;
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": resume " << data_channel_->label()
+                   << " dropped=" << dropped_.exchange(0);
+}
+
+void SocketDataChannel::Send(const rtc::CopyOnWriteBuffer& buffer) {
+  if (data_channel_->state() != webrtc::DataChannelInterface::kOpen) {
+    return;
+  }
+  // OnBufferedAmountChange を取りこぼしても再開できるように、ここでも確認する
+  if (paused_ && data_channel_->buffered_amount() > kLowWaterMark) {
+    dropped_++;
+    return;
+  }
+  paused_ = false;
+  if (data_channel_->buffered_amount() + buffer.size() > kHighWaterMark) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": pause " << data_channel_->label()
+                        << " buffered_amount="
+                        << data_channel_->buffered_amount();
+    paused_ = true;
+    dropped_++;
+    return;
+  }
+  webrtc::DataBuffer data_buffer(buffer, true);
+  data_channel_->Send(data_buffer);
+}
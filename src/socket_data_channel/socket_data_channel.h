@@ -0,0 +1,38 @@
+#ifndef SOCKET_DATA_CHANNEL_H_
+#define SOCKET_DATA_CHANNEL_H_
+
+#include <atomic>
+
+#include "api/data_channel_interface.h"
+
+class SocketDataManager;
+
+// SocketDataManager が受け取ったデータを送る DataChannel。
+//
+// 送信バッファが溜まりすぎた場合は、減るまで新しいデータを捨てる。
+// テレメトリは新しいデータの方が価値があるので、古いデータを溜め込んで遅延させるよりも捨てた方が良い。
+class SocketDataChannel : public webrtc::DataChannelObserver {
+ public:
+  SocketDataChannel(
+      SocketDataManager* socket_data_manager,
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel);
+  ~SocketDataChannel();
+
+  void Send(const rtc::CopyOnWriteBuffer& buffer);
+
+  void OnStateChange() override;
+  void OnMessage(const webrtc::DataBuffer& buffer) override;
+  void OnBufferedAmountChange(uint64_t previous_amount) override;
+
+ private:
+  // この量を超えたら送信を止めて、kLowWaterMark まで減ったら再開する
+  static const uint64_t kHighWaterMark = 1024 * 1024;
+  static const uint64_t kLowWaterMark = 256 * 1024;
+
+  SocketDataManager* socket_data_manager_;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+  std::atomic<bool> paused_;
+  std::atomic<uint64_t> dropped_;
+};
+
+#endif
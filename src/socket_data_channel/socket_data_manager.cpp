@@ -0,0 +1,341 @@
+#include "socket_data_manager.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "rtc_base/logging.h"
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#include <unistd.h>
+#endif
+
+const size_t SocketDataManager::kCoalesceSize;
+const size_t SocketDataManager::kReadBufferSize;
+
+bool SocketDataManager::ParseSource(const std::string& spec,
+                                    Source* source,
+                                    std::string* error) {
+  const std::string format_error =
+      "Value " + spec + " is not LABEL=udp://HOST:PORT or LABEL=unix://PATH";
+  auto eq = spec.find('=');
+  if (eq == std::string::npos || eq == 0) {
+    *error = format_error;
+    return false;
+  }
+  source->label = spec.substr(0, eq);
+  std::string url = spec.substr(eq + 1);
+
+  auto sep = url.find("://");
+  if (sep == std::string::npos) {
+    *error = format_error;
+    return false;
+  }
+  source->scheme = url.substr(0, sep);
+  std::string rest = url.substr(sep + 3);
+
+  if (source->scheme == "unix") {
+#if !defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    *error = "Unix domain socket is not supported: " + spec;
+    return false;
+#endif
+    if (rest.empty()) {
+      *error = "Empty unix socket path: " + spec;
+      return false;
+    }
+    source->path = rest;
+    return true;
+  }
+  if (source->scheme != "udp") {
+    *error = "Unknown scheme " + source->scheme + ": " + spec;
+    return false;
+  }
+
+  auto colon = rest.rfind(':');
+  if (colon == std::string::npos) {
+    *error = "No port: " + spec;
+    return false;
+  }
+  source->host = rest.substr(0, colon);
+  // [::1]:9000 の形式
+  if (source->host.size() >= 2 && source->host.front() == '[' &&
+      source->host.back() == ']') {
+    source->host = source->host.substr(1, source->host.size() - 2);
+  }
+  if (source->host.empty()) {
+    source->host = "0.0.0.0";
+  }
+  int port;
+  try {
+    port = std::stoi(rest.substr(colon + 1));
+  } catch (std::exception& e) {
+    *error = "Invalid port: " + spec;
+    return false;
+  }
+  if (port <= 0 || port > 65535) {
+    *error = "Invalid port: " + spec;
+    return false;
+  }
+  source->port = static_cast<unsigned short>(port);
+  boost::system::error_code ec;
+  boost::asio::ip::make_address(source->host, ec);
+  if (ec) {
+    *error = "Invalid address " + source->host + ": " + spec;
+    return false;
+  }
+  return true;
+}
+
+SocketDataManager::SocketDataManager(boost::asio::io_context& ioc,
+                                     Source source,
+                                     Options options)
+    : source_(std::move(source)), options_(options) {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (source_.scheme == "unix") {
+    unix_socket_.reset(new boost::asio::local::datagram_protocol::socket(ioc));
+  }
+#endif
+  if (source_.scheme == "udp") {
+    udp_socket_.reset(new boost::asio::ip::udp::socket(ioc));
+  }
+  post_ = [&ioc](std::function<void()> f) {
+    if (ioc.stopped())
+      return;
+    ioc.post(f);
+  };
+  coalesce_buffer_.reserve(kCoalesceSize);
+}
+
+SocketDataManager::~SocketDataManager() {
+  {
+    rtc::CritScope lock(&channels_lock_);
+    for (SocketDataChannel* socket_data_channel : socket_data_channels_) {
+      delete socket_data_channel;
+    }
+  }
+
+  doClose();
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (unix_socket_) {
+    ::unlink(source_.path.c_str());
+  }
+#endif
+}
+
+bool SocketDataManager::Open() {
+  boost::system::error_code error;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (unix_socket_) {
+    // 前回の起動で残ったファイルがあると bind できないので消しておく
+    ::unlink(source_.path.c_str());
+    unix_socket_->open(boost::asio::local::datagram_protocol(), error);
+    if (!error) {
+      unix_socket_->bind(
+          boost::asio::local::datagram_protocol::endpoint(source_.path), error);
+    }
+  }
+#endif
+  if (udp_socket_) {
+    boost::asio::ip::udp::endpoint endpoint(
+        boost::asio::ip::make_address(source_.host), source_.port);
+    udp_socket_->open(endpoint.protocol(), error);
+    if (!error) {
+      udp_socket_->bind(endpoint, error);
+    }
+  }
+  if (error) {
+    std::cerr << "failed to open data channel source : " << source_.label
+              << " : " << error.message() << std::endl;
+    return false;
+  }
+
+  read_buffer_.reset(new uint8_t[kReadBufferSize]);
+  post_(std::bind(&SocketDataManager::doRead, this));
+  return true;
+}
+
+void SocketDataManager::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  rtc::CritScope lock(&channels_lock_);
+  socket_data_channels_.push_back(new SocketDataChannel(this, data_channel));
+}
+
+void SocketDataManager::OnCreateConnection(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) {
+  webrtc::DataChannelInit init;
+  init.ordered = options_.ordered;
+  if (options_.max_retransmits >= 0) {
+    init.maxRetransmits = options_.max_retransmits;
+  }
+  init.priority = options_.priority;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel =
+      connection->CreateDataChannel(source_.label, &init);
+  if (!data_channel) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__
+                        << ": CreateDataChannel failed: " << source_.label;
+    return;
+  }
+  OnDataChannel(data_channel);
+}
+
+void SocketDataManager::OnClosed(SocketDataChannel* socket_data_channel) {
+  rtc::CritScope lock(&channels_lock_);
+  socket_data_channels_.erase(
+      std::remove(socket_data_channels_.begin(), socket_data_channels_.end(),
+                  socket_data_channel),
+      socket_data_channels_.end());
+  delete socket_data_channel;
+}
+
+void SocketDataManager::Send(const uint8_t* data, size_t length) {
+  std::vector<uint8_t> v(data, data + length);
+  post_(std::bind(&SocketDataManager::doSend, this, std::move(v)));
+}
+
+void SocketDataManager::doClose() {
+  boost::system::error_code error;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (unix_socket_ && unix_socket_->is_open()) {
+    unix_socket_->cancel(error);
+    unix_socket_->close(error);
+  }
+#endif
+  if (udp_socket_ && udp_socket_->is_open()) {
+    udp_socket_->cancel(error);
+    udp_socket_->close(error);
+  }
+}
+
+void SocketDataManager::doRead() {
+  auto buffer = boost::asio::buffer(read_buffer_.get(), kReadBufferSize);
+  auto handler = std::bind(&SocketDataManager::onRead, this,
+                           std::placeholders::_1, std::placeholders::_2);
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (unix_socket_) {
+    if (unix_socket_->is_open()) {
+      unix_socket_->async_receive_from(buffer, unix_sender_, handler);
+    }
+    return;
+  }
+#endif
+  if (udp_socket_->is_open()) {
+    udp_socket_->async_receive_from(buffer, udp_sender_, handler);
+  }
+}
+
+void SocketDataManager::onRead(const boost::system::error_code& error,
+                               size_t bytes_transferred) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (error) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__
+                      << " async_receive_from failed  error :" << error;
+    doClose();
+    return;
+  }
+  has_sender_ = true;
+
+  {
+    rtc::CritScope lock(&channels_lock_);
+    deliver(read_buffer_.get(), bytes_transferred);
+    // 既に届いているデータグラムは、次の async_receive_from を待たずにまとめて処理する
+    while (available() > 0) {
+      size_t n = receiveAvailable();
+      if (n == 0) {
+        break;
+      }
+      deliver(read_buffer_.get(), n);
+    }
+    flush();
+  }
+  doRead();
+}
+
+size_t SocketDataManager::available() {
+  boost::system::error_code error;
+  size_t n;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (unix_socket_) {
+    n = unix_socket_->available(error);
+    return error ? 0 : n;
+  }
+#endif
+  n = udp_socket_->available(error);
+  return error ? 0 : n;
+}
+
+size_t SocketDataManager::receiveAvailable() {
+  auto buffer = boost::asio::buffer(read_buffer_.get(), kReadBufferSize);
+  boost::system::error_code error;
+  size_t n;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (unix_socket_) {
+    n = unix_socket_->receive_from(buffer, unix_sender_, 0, error);
+    return error ? 0 : n;
+  }
+#endif
+  n = udp_socket_->receive_from(buffer, udp_sender_, 0, error);
+  return error ? 0 : n;
+}
+
+void SocketDataManager::deliver(const uint8_t* data, size_t length) {
+  if (socket_data_channels_.empty()) {
+    return;
+  }
+  if (!options_.coalesce) {
+    rtc::CopyOnWriteBuffer buffer(data, length);
+    for (SocketDataChannel* socket_data_channel : socket_data_channels_) {
+      socket_data_channel->Send(buffer);
+    }
+    return;
+  }
+
+  // まとめる場合は、データグラム毎に 2 バイト (ビッグエンディアン) の長さを付ける
+  if (length > 0xffff) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": datagram too large: " << length;
+    return;
+  }
+  if (coalesce_buffer_.size() + 2 + length > kCoalesceSize) {
+    flush();
+  }
+  coalesce_buffer_.push_back(static_cast<uint8_t>(length >> 8));
+  coalesce_buffer_.push_back(static_cast<uint8_t>(length & 0xff));
+  coalesce_buffer_.insert(coalesce_buffer_.end(), data, data + length);
+  if (coalesce_buffer_.size() >= kCoalesceSize) {
+    flush();
+  }
+}
+
+void SocketDataManager::flush() {
+  if (coalesce_buffer_.empty()) {
+    return;
+  }
+  rtc::CopyOnWriteBuffer buffer(coalesce_buffer_.data(),
+                                coalesce_buffer_.size());
+  coalesce_buffer_.clear();
+  for (SocketDataChannel* socket_data_channel : socket_data_channels_) {
+    socket_data_channel->Send(buffer);
+  }
+}
+
+void SocketDataManager::doSend(std::vector<uint8_t> v) {
+  if (!has_sender_) {
+    return;
+  }
+  boost::system::error_code error;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  if (unix_socket_) {
+    if (unix_sender_.path().empty()) {
+      // 送ってきたソケットに名前が無い場合は送り返せない
+      return;
+    }
+    unix_socket_->send_to(boost::asio::buffer(v), unix_sender_, 0, error);
+  }
+#endif
+  if (udp_socket_) {
+    udp_socket_->send_to(boost::asio::buffer(v), udp_sender_, 0, error);
+  }
+  if (error) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << " send_to failed  error :" << error;
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef SOCKET_DATA_MANAGER_H_
+#define SOCKET_DATA_MANAGER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "absl/types/optional.h"
+#include "api/priority.h"
+#include "rtc/data_manager.h"
+#include "rtc_base/critical_section.h"
+#include "socket_data_channel.h"
+
+// UDP ソケットや Unix ドメインソケット (データグラム、Windows 以外) で受け取ったデータを、
+// 指定したラベルの DataChannel で送るクラス。
+//
+// DataChannel は PeerConnection の生成時に Momo 側から作るが、
+// 相手が同じラベルで作った DataChannel も使う。
+// DataChannel から受け取ったメッセージは、最後にデータを送ってきたアドレスに送り返す。
+class SocketDataManager : public RTCDataManager {
+ public:
+  struct Source {
+    std::string label;
+    // udp か unix
+    std::string scheme;
+    std::string host;
+    unsigned short port = 0;
+    std::string path;
+  };
+  struct Options {
+    // -1 の場合は届くまで再送する
+    int max_retransmits = 0;
+    bool ordered = false;
+    // 複数のデータグラムを MTU に収まる大きさまで 1 つのメッセージにまとめる
+    bool coalesce = false;
+    // 指定しない場合は libwebrtc の既定の優先度
+    absl::optional<webrtc::Priority> priority;
+  };
+
+  // LABEL=udp://HOST:PORT または LABEL=unix://PATH の形式
+  static bool ParseSource(const std::string& spec,
+                          Source* source,
+                          std::string* error);
+
+  static std::unique_ptr<SocketDataManager> Create(boost::asio::io_context& ioc,
+                                                   Source source,
+                                                   Options options) {
+    std::unique_ptr<SocketDataManager> data_manager(
+        new SocketDataManager(ioc, std::move(source), options));
+    if (!data_manager->Open()) {
+      return nullptr;
+    }
+    return data_manager;
+  }
+  ~SocketDataManager();
+
+  const std::string& label() const { return source_.label; }
+
+  void Send(const uint8_t* data, size_t length);
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+  void OnCreateConnection(
+      rtc::scoped_refptr<webrtc::PeerConnectionInterface> connection) override;
+  void OnClosed(SocketDataChannel* socket_data_channel);
+
+ private:
+  SocketDataManager(boost::asio::io_context& ioc,
+                    Source source,
+                    Options options);
+  bool Open();
+  void doClose();
+  void doRead();
+  void onRead(const boost::system::error_code& error, size_t bytes_transferred);
+  size_t available();
+  size_t receiveAvailable();
+  void deliver(const uint8_t* data, size_t length);
+  void flush();
+  void doSend(std::vector<uint8_t> v);
+
+  // まとめたメッセージの最大サイズ。SCTP で分割されずに送れる大きさにしておく
+  static const size_t kCoalesceSize = 1200;
+  static const size_t kReadBufferSize = 65536;
+
+  const Source source_;
+  const Options options_;
+
+  std::unique_ptr<boost::asio::ip::udp::socket> udp_socket_;
+  boost::asio::ip::udp::endpoint udp_sender_;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  std::unique_ptr<boost::asio::local::datagram_protocol::socket> unix_socket_;
+  boost::asio::local::datagram_protocol::endpoint unix_sender_;
+#endif
+  bool has_sender_ = false;
+
+  std::function<void(std::function<void()>)> post_;
+  rtc::CriticalSection channels_lock_;
+  std::vector<SocketDataChannel*> socket_data_channels_;
+
+  std::unique_ptr<uint8_t[]> read_buffer_;
+  std::vector<uint8_t> coalesce_buffer_;
+};
+
+#endif
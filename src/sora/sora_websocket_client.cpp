@@ -10,9 +10,12 @@
 #include <nlohmann/json.hpp>
 
 #include "momo_version.h"
+#include "rtc/startup_timer.h"
 #include "ssl_verifier.h"
 #include "url_parts.h"
 #include "util.h"
+#include "ws/dns_cache.h"
+#include "ws/signaling_message.h"
 
 using json = nlohmann::json;
 
@@ -40,6 +43,8 @@ boost::asio::ssl::context SoraWebsocketClient::createSSLContext() const {
                   boost::asio::ssl::context::no_sslv2 |
                   boost::asio::ssl::context::no_sslv3 |
                   boost::asio::ssl::context::single_dh_use);
+  // ルート証明書は全ての接続で共有しているものを使う
+  SSLVerifier::ApplyTo(ctx.native_handle());
   return ctx;
 }
 
@@ -61,16 +66,27 @@ SoraWebsocketClient::SoraWebsocketClient(boost::asio::io_context& ioc,
                                          RTCManager* manager,
                                          ConnectionSettings conn_settings)
     : ioc_(ioc),
-      resolver_(ioc),
       manager_(manager),
       retry_count_(0),
       conn_settings_(conn_settings),
       watchdog_(ioc, std::bind(&SoraWebsocketClient::onWatchdogExpired, this)) {
+  candidate_batcher_ = IceCandidateBatcher::Create(
+      ioc, conn_settings_.ice_candidate_batch_ms,
+      conn_settings_.ice_candidate_batch_size,
+      std::bind(&SoraWebsocketClient::sendCandidates, this, std::placeholders::_1));
   reset();
 }
 
 void SoraWebsocketClient::reset() {
   connection_ = nullptr;
+  if (connector_) {
+    connector_->Cancel();
+    connector_ = nullptr;
+  }
+  // 前の接続の candidate は送らない
+  if (candidate_batcher_) {
+    candidate_batcher_->Clear();
+  }
   connected_ = false;
 
   if (parseURL(parts_)) {
@@ -100,6 +116,11 @@ void SoraWebsocketClient::reset() {
                                    boost::asio::error::get_ssl_category()};
       MOMO_BOOST_ERROR(ec, "SSL_set_tlsext_host_name");
     }
+
+    if (conn_settings_.fast_reconnect) {
+      reconnect_cache_.applySession(
+          ws_->nativeSecureSocket().next_layer().native_handle());
+    }
   } else {
     boost::beast::websocket::stream<boost::asio::ip::tcp::socket> ws(ioc_);
     ws_.reset(new Websocket(ioc_));
@@ -107,6 +128,13 @@ void SoraWebsocketClient::reset() {
 }
 
 void SoraWebsocketClient::release() {
+  if (candidate_batcher_) {
+    candidate_batcher_->Stop();
+  }
+  if (connector_) {
+    connector_->Cancel();
+    connector_ = nullptr;
+  }
   connection_ = nullptr;
 }
 
@@ -117,20 +145,22 @@ bool SoraWebsocketClient::connect() {
     return false;
   }
 
-  std::string port;
   if (parts_.port.empty()) {
-    port = ws_->isSSL() ? "443" : "80";
+    port_ = ws_->isSSL() ? "443" : "80";
   } else {
-    port = parts_.port;
+    port_ = parts_.port;
   }
 
-  // DNS ルックアップ
-  resolver_.async_resolve(
-      parts_.host, port,
-      boost::asio::bind_executor(
-          ws_->strand(),
-          std::bind(&SoraWebsocketClient::onResolve, shared_from_this(),
-                    std::placeholders::_1, std::placeholders::_2)));
+  // DNS ルックアップ。キャッシュされていればすぐに返ってくる
+  auto self = shared_from_this();
+  DnsCache::Instance().Resolve(
+      ioc_, parts_.host, port_,
+      [self](boost::system::error_code ec,
+             boost::asio::ip::tcp::resolver::results_type results,
+             bool from_cache) {
+        self->using_cached_endpoints_ = from_cache;
+        self->onResolve(ec, std::move(results));
+      });
 
   watchdog_.enable(30);
 
@@ -139,15 +169,39 @@ bool SoraWebsocketClient::connect() {
 
 void SoraWebsocketClient::reconnectAfter() {
   int interval = 5 * (2 * retry_count_ + 1);
+  // --fast-reconnect の場合は、最初の 1 回は待たずに再接続する
+  if (conn_settings_.fast_reconnect && retry_count_ == 0) {
+    interval = 0;
+  }
   RTC_LOG(LS_INFO) << __FUNCTION__ << " reconnect after " << interval << " sec";
 
   watchdog_.enable(interval);
   retry_count_++;
 }
 
+// キャッシュしたアドレスに繋がらなかった場合は、待たずに DNS ルックアップからやり直す
+bool SoraWebsocketClient::retryWithoutCachedEndpoints() {
+  if (!using_cached_endpoints_) {
+    return false;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__;
+  DnsCache::Instance().Invalidate(parts_.host, port_);
+  auto self = shared_from_this();
+  boost::asio::post(ioc_, [self]() {
+    self->reset();
+    self->connect();
+  });
+  return true;
+}
+
 void SoraWebsocketClient::onWatchdogExpired() {
   RTC_LOG(LS_WARNING) << __FUNCTION__;
 
+  // 接続中にタイムアウトした場合は、キャッシュしたアドレスが繋がらなくなっている可能性がある
+  if (!connected_) {
+    DnsCache::Instance().Invalidate(parts_.host, port_);
+  }
+
   RTC_LOG(LS_INFO) << __FUNCTION__ << " reconnecting...:";
   reset();
   connect();
@@ -162,27 +216,33 @@ void SoraWebsocketClient::onResolve(
   }
 
   // DNS ルックアップで得られたエンドポイントに対して接続する
+  connector_ = HappyEyeballsConnector::Connect(
+      ioc_, results,
+      std::bind(&SoraWebsocketClient::onTCPConnect, shared_from_this(),
+                std::placeholders::_1, std::placeholders::_2));
+}
+
+void SoraWebsocketClient::onTCPConnect(boost::system::error_code ec,
+                                       boost::asio::ip::tcp::socket socket) {
+  connector_ = nullptr;
   if (ws_->isSSL()) {
-    boost::asio::async_connect(
-        ws_->nativeSecureSocket().next_layer().next_layer(), results.begin(),
-        results.end(),
-        boost::asio::bind_executor(
-            ws_->strand(),
-            std::bind(&SoraWebsocketClient::onSSLConnect, shared_from_this(),
-                      std::placeholders::_1)));
+    if (!ec) {
+      ws_->nativeSecureSocket().next_layer().next_layer() = std::move(socket);
+    }
+    onSSLConnect(ec);
   } else {
-    boost::asio::async_connect(
-        ws_->nativeSocket().next_layer(), results.begin(), results.end(),
-        boost::asio::bind_executor(
-            ws_->strand(),
-            std::bind(&SoraWebsocketClient::onConnect, shared_from_this(),
-                      std::placeholders::_1)));
+    if (!ec) {
+      ws_->nativeSocket().next_layer() = std::move(socket);
+    }
+    onConnect(ec);
   }
 }
 
 void SoraWebsocketClient::onSSLConnect(boost::system::error_code ec) {
   if (ec) {
-    reconnectAfter();
+    if (!retryWithoutCachedEndpoints()) {
+      reconnectAfter();
+    }
     return MOMO_BOOST_ERROR(ec, "SSLConnect");
   }
 
@@ -196,10 +256,17 @@ void SoraWebsocketClient::onSSLConnect(boost::system::error_code ec) {
 
 void SoraWebsocketClient::onSSLHandshake(boost::system::error_code ec) {
   if (ec) {
+    // 再開しようとしたセッションが原因の可能性もあるので捨てておく
+    reconnect_cache_.clearSession();
     reconnectAfter();
     return MOMO_BOOST_ERROR(ec, "SSLHandshake");
   }
 
+  if (conn_settings_.fast_reconnect) {
+    reconnect_cache_.saveSession(
+        ws_->nativeSecureSocket().next_layer().native_handle());
+  }
+
   // Websocket のハンドシェイク
   ws_->nativeSecureSocket().async_handshake(
       parts_.host, parts_.path_query_fragment,
@@ -210,7 +277,9 @@ void SoraWebsocketClient::onSSLHandshake(boost::system::error_code ec) {
 
 void SoraWebsocketClient::onConnect(boost::system::error_code ec) {
   if (ec) {
-    reconnectAfter();
+    if (!retryWithoutCachedEndpoints()) {
+      reconnectAfter();
+    }
     return MOMO_BOOST_ERROR(ec, "connect");
   }
 
@@ -229,6 +298,7 @@ void SoraWebsocketClient::onHandshake(boost::system::error_code ec) {
   }
 
   connected_ = true;
+  StartupTimer::Instance().Mark("signaling_connected");
 
   ws_->startToRead(std::bind(&SoraWebsocketClient::onRead, this,
                              std::placeholders::_1, std::placeholders::_2,
@@ -238,6 +308,11 @@ void SoraWebsocketClient::onHandshake(boost::system::error_code ec) {
 }
 
 void SoraWebsocketClient::doSendConnect() {
+  if (!connect_message_.empty()) {
+    ws_->sendText(connect_message_);
+    return;
+  }
+
   const auto& cs = conn_settings_;
   json json_message = {
       {"type", "connect"},
@@ -252,6 +327,10 @@ void SoraWebsocketClient::doSendConnect() {
     json_message["multistream"] = true;
   }
 
+  if (cs.sora_simulcast) {
+    json_message["simulcast"] = true;
+  }
+
   if (cs.sora_spotlight > 0) {
     json_message["multistream"] = true;
     json_message["spotlight"] = cs.sora_spotlight;
@@ -292,18 +371,16 @@ void SoraWebsocketClient::doSendConnect() {
     }
   }
 
-  ws_->sendText(json_message.dump());
+  connect_message_ = json_message.dump();
+  ws_->sendText(connect_message_);
 }
 void SoraWebsocketClient::doSendPong() {
-  json json_message = {{"type", "pong"}};
-  ws_->sendText(json_message.dump());
+  ws_->sendText(R"({"type":"pong"})");
 }
 void SoraWebsocketClient::doSendPong(
     const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
-  std::string stats = report->ToJson();
-  json json_message = {{"type", "pong"}, {"stats", stats}};
-  std::string str = R"({"type":"pong","stats":)" + stats + "}";
-  ws_->sendText(std::move(str));
+  ws_->sendText(
+      SignalingWriter("pong").AddRaw("stats", report->ToJson()).Finish());
 }
 
 void SoraWebsocketClient::createPeerFromConfig(json jconfig) {
@@ -326,7 +403,8 @@ void SoraWebsocketClient::createPeerFromConfig(json jconfig) {
 
   rtc_config.servers = ice_servers;
 
-  connection_ = manager_->createConnection(rtc_config, this);
+  connection_ = manager_->createConnection(
+      rtc_config, this, "sora:" + conn_settings_.sora_channel_id);
 }
 
 void SoraWebsocketClient::close() {
@@ -363,37 +441,62 @@ void SoraWebsocketClient::onRead(boost::system::error_code ec,
   if (ec == boost::asio::error::operation_aborted)
     return;
 
-  if (ec)
+  if (ec) {
+    // --fast-reconnect の場合は ping のタイムアウトを待たずに再接続する
+    if (conn_settings_.fast_reconnect) {
+      reconnectAfter();
+    }
     return MOMO_BOOST_ERROR(ec, "Read");
+  }
 
   RTC_LOG(LS_INFO) << __FUNCTION__ << ": text=" << text;
 
-  auto json_message = json::parse(text);
-  const std::string type = json_message["type"];
+  // ping と notify は DOM を作らずに必要な値だけを取り出す
+  SignalingMessage message;
+  if (!message.Parse(text, {"ping", "notify"})) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << ": Failed to parse JSON";
+    return;
+  }
+  const std::string& type = message.type();
   if (type == "offer") {
+    json& json_message = message.json();
     answer_sent_ = false;
+    connection_id_.clear();
+    if (json_message["connection_id"].is_string()) {
+      connection_id_ = json_message["connection_id"].get<std::string>();
+    }
     createPeerFromConfig(json_message["config"]);
     const std::string sdp = json_message["sdp"].get<std::string>();
     connection_->setOffer(sdp);
   } else if (type == "update") {
-    const std::string sdp = json_message["sdp"].get<std::string>();
+    const std::string sdp = message.json()["sdp"].get<std::string>();
     connection_->setOffer(sdp);
   } else if (type == "notify") {
-    const std::string event_type =
-        json_message["event_type"].get<std::string>();
+    std::string event_type;
+    message.GetString("event_type", &event_type);
     if (event_type == "connection.created" ||
         event_type == "connection.destroyed") {
       RTC_LOG(LS_INFO) << __FUNCTION__ << ": event_type=" << event_type
-                       << ": client_id=" << json_message["client_id"]
-                       << ": connection_id=" << json_message["connection_id"];
+                       << ": client_id=" << message.Get("client_id")
+                       << ": connection_id=" << message.Get("connection_id");
     } else if (event_type == "network.status") {
       RTC_LOG(LS_INFO) << __FUNCTION__ << ": event_type=" << event_type
-                       << ": unstable_level=" << json_message["unstable_level"];
+                       << ": unstable_level=" << message.Get("unstable_level");
     } else if (event_type == "spotlight.changed") {
       RTC_LOG(LS_INFO) << __FUNCTION__ << ": event_type=" << event_type
-                       << ": client_id=" << json_message["client_id"]
-                       << ": connection_id=" << json_message["connection_id"]
-                       << ": spotlight_id=" << json_message["spotlight_id"];
+                       << ": client_id=" << message.Get("client_id")
+                       << ": connection_id=" << message.Get("connection_id")
+                       << ": spotlight_id=" << message.Get("spotlight_id");
+    } else if (event_type == "spotlight.focused" ||
+               event_type == "spotlight.unfocused") {
+      std::string connection_id;
+      message.GetString("connection_id", &connection_id);
+      RTC_LOG(LS_INFO) << __FUNCTION__ << ": event_type=" << event_type
+                       << ": connection_id=" << connection_id;
+      if (conn_settings_.sora_spotlight_power_save && connection_ &&
+          !connection_id_.empty() && connection_id == connection_id_) {
+        setSpotlightFocused(event_type == "spotlight.focused");
+      }
     }
   } else if (type == "ping") {
     if (rtc_state_ != webrtc::PeerConnectionInterface::IceConnectionState::
@@ -401,7 +504,7 @@ void SoraWebsocketClient::onRead(boost::system::error_code ec,
       return;
     }
     watchdog_.reset();
-    bool stats = json_message.value("stats", false);
+    bool stats = message.GetBool("stats", false);
     if (stats) {
       connection_->getStats(
           [this](
@@ -414,6 +517,16 @@ void SoraWebsocketClient::onRead(boost::system::error_code ec,
   }
 }
 
+void SoraWebsocketClient::setSpotlightFocused(bool focused) {
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": focused=" << focused;
+  // フォーカスされると SFU はすぐに大きい映像を転送し始めるので、待たずに元に戻す。
+  // フレームレートの上限はキャプチャにも伝わり、変換する前にフレームが間引かれる
+  connection_->setVideoThumbnail(
+      !focused, conn_settings_.sora_spotlight_thumbnail_bitrate * 1000,
+      conn_settings_.sora_spotlight_thumbnail_fps,
+      conn_settings_.sora_spotlight_thumbnail_scale);
+}
+
 // WebRTC からのコールバック
 // これらは別スレッドからやってくるので取り扱い注意
 void SoraWebsocketClient::onIceConnectionStateChange(
@@ -426,19 +539,39 @@ void SoraWebsocketClient::onIceConnectionStateChange(
 void SoraWebsocketClient::onIceCandidate(const std::string sdp_mid,
                                          const int sdp_mlineindex,
                                          const std::string sdp) {
-  json json_message = {{"type", "candidate"}, {"candidate", sdp}};
-  ws_->sendText(json_message.dump());
+  if (candidate_batcher_) {
+    candidate_batcher_->Add(sdp_mid, sdp_mlineindex, sdp);
+    return;
+  }
+  ws_->sendText(candidateMessage(sdp_mid, sdp_mlineindex, sdp));
+}
+std::string SoraWebsocketClient::candidateMessage(const std::string& sdp_mid,
+                                                  int sdp_mlineindex,
+                                                  const std::string& sdp) {
+  return SignalingWriter("candidate", sdp.size())
+      .Add("candidate", sdp)
+      .Finish();
+}
+void SoraWebsocketClient::sendCandidates(
+    std::vector<IceCandidateBatcher::Candidate> candidates) {
+  // Sora は 1 つのメッセージに 1 つの candidate しか入れられないので、送信だけまとめる
+  std::vector<std::string> messages;
+  messages.reserve(candidates.size());
+  for (const auto& c : candidates) {
+    messages.push_back(candidateMessage(c.sdp_mid, c.sdp_mlineindex, c.sdp));
+  }
+  ws_->sendTexts(std::move(messages));
 }
 void SoraWebsocketClient::onCreateDescription(webrtc::SdpType type,
                                               const std::string sdp) {
   // 最初の１回目は answer、以降は update にする
   if (!answer_sent_) {
     answer_sent_ = true;
-    json json_message = {{"type", "answer"}, {"sdp", sdp}};
-    ws_->sendText(json_message.dump());
+    ws_->sendText(
+        SignalingWriter("answer", sdp.size()).Add("sdp", sdp).Finish());
   } else {
-    json json_message = {{"type", "update"}, {"sdp", sdp}};
-    ws_->sendText(json_message.dump());
+    ws_->sendText(
+        SignalingWriter("update", sdp.size()).Add("sdp", sdp).Finish());
   }
 }
 void SoraWebsocketClient::onSetDescription(webrtc::SdpType type) {
@@ -16,6 +16,9 @@
 #include "rtc/messagesender.h"
 #include "url_parts.h"
 #include "watchdog.h"
+#include "ws/happy_eyeballs_connector.h"
+#include "ws/ice_candidate_batcher.h"
+#include "ws/reconnect_cache.h"
 #include "ws/websocket.h"
 
 class SoraWebsocketClient
@@ -23,7 +26,9 @@ class SoraWebsocketClient
       public RTCMessageSender {
   boost::asio::io_context& ioc_;
 
-  boost::asio::ip::tcp::resolver resolver_;
+  // DNS ルックアップに使うポート
+  std::string port_;
+  std::shared_ptr<HappyEyeballsConnector> connector_;
 
   std::unique_ptr<Websocket> ws_;
 
@@ -37,12 +42,26 @@ class SoraWebsocketClient
   webrtc::PeerConnectionInterface::IceConnectionState rtc_state_;
 
   WatchDog watchdog_;
+  // --ice-candidate-batch-ms が指定されていない場合は nullptr
+  std::shared_ptr<IceCandidateBatcher> candidate_batcher_;
+  // --fast-reconnect の場合に、前回の接続で得た TLS セッションを覚えておく
+  ReconnectCache reconnect_cache_;
+  // DnsCache にキャッシュされていた結果に接続しているかどうか
+  bool using_cached_endpoints_ = false;
 
   bool connected_;
   bool answer_sent_ = false;
+  // connect メッセージは設定だけで決まるので、一度作ったら再接続の度に使い回す
+  std::string connect_message_;
+  // offer で通知された自分の接続の ID
+  std::string connection_id_;
 
  private:
   bool parseURL(URLParts& parts) const;
+  static std::string candidateMessage(const std::string& sdp_mid,
+                                      int sdp_mlineindex,
+                                      const std::string& sdp);
+  void sendCandidates(std::vector<IceCandidateBatcher::Candidate> candidates);
   boost::asio::ssl::context createSSLContext() const;
 
  public:
@@ -67,11 +86,14 @@ class SoraWebsocketClient
 
  private:
   void reconnectAfter();
+  bool retryWithoutCachedEndpoints();
   void onWatchdogExpired();
 
  private:
   void onResolve(boost::system::error_code ec,
                  boost::asio::ip::tcp::resolver::results_type results);
+  void onTCPConnect(boost::system::error_code ec,
+                    boost::asio::ip::tcp::socket socket);
   void onSSLConnect(boost::system::error_code ec);
   void onSSLHandshake(boost::system::error_code ec);
   void onConnect(boost::system::error_code ec);
@@ -81,6 +103,8 @@ class SoraWebsocketClient
   void doSendPong(
       const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
   void createPeerFromConfig(nlohmann::json jconfig);
+  // --spotlight-power-save の場合に、フォーカスされていない間はサムネイル用の設定でエンコードする
+  void setSpotlightFocused(bool focused);
 
  public:
   void close();
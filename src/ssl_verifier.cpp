@@ -5,6 +5,12 @@
 #include <rtc_base/openssl_utility.h>
 #include <rtc_base/ssl_roots.h>
 
+#include <ctime>
+#include <mutex>
+
+// webrtc
+#include <rtc_base/time_utils.h>
+
 // openssl
 #include <openssl/x509v3.h>
 
@@ -12,6 +18,7 @@
 #include <boost/asio/connect.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/filesystem/operations.hpp>
 
 const char isrg_root[] = R"(
 # Issuer: CN=ISRG Root X1 O=Internet Security Research Group
@@ -84,6 +91,110 @@ Ob8VZRzI9neWagqNdwvYkQsEjgfbKbYK7p2CNTUQ
 -----END CERTIFICATE-----
 )";
 
+namespace {
+
+struct StoreCache {
+  std::mutex mutex;
+  SSLVerifier::Settings settings;
+  std::shared_ptr<X509_STORE> store;
+  bool reload = false;
+  // store を作った時の root_file の更新時刻
+  std::time_t root_file_time = 0;
+};
+
+StoreCache& GetStoreCache() {
+  static StoreCache cache;
+  return cache;
+}
+
+std::time_t GetLastWriteTime(const std::string& path) {
+  if (path.empty()) {
+    return 0;
+  }
+  boost::system::error_code ec;
+  std::time_t t = boost::filesystem::last_write_time(path, ec);
+  return ec ? 0 : t;
+}
+
+}  // namespace
+
+void SSLVerifier::Configure(Settings settings) {
+  StoreCache& cache = GetStoreCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.settings = std::move(settings);
+  cache.reload = true;
+}
+
+void SSLVerifier::Reload() {
+  StoreCache& cache = GetStoreCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.reload = true;
+}
+
+std::shared_ptr<X509_STORE> SSLVerifier::GetStore() {
+  StoreCache& cache = GetStoreCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  const std::time_t root_file_time =
+      GetLastWriteTime(cache.settings.root_file);
+  if (cache.store && !cache.reload &&
+      root_file_time == cache.root_file_time) {
+    return cache.store;
+  }
+  std::shared_ptr<X509_STORE> store = CreateStore(cache.settings);
+  // 作り直せなかった場合は、前の X509_STORE を使い続ける
+  if (store || !cache.store) {
+    cache.store = store;
+  }
+  cache.reload = false;
+  cache.root_file_time = root_file_time;
+  return cache.store;
+}
+
+std::shared_ptr<X509_STORE> SSLVerifier::CreateStore(
+    const Settings& settings) {
+  const int64_t start_ms = rtc::TimeMillis();
+  X509_STORE* raw_store = X509_STORE_new();
+  if (raw_store == nullptr) {
+    RTC_LOG(LS_ERROR) << "X509_STORE_new failed";
+    return nullptr;
+  }
+  std::shared_ptr<X509_STORE> store(raw_store, X509_STORE_free);
+
+  // Let's Encrypt の証明書を追加
+  if (!AddCert(isrg_root, store.get())) {
+    return nullptr;
+  }
+  if (!AddCert(dst_root, store.get())) {
+    return nullptr;
+  }
+
+  // WebRTC が用意しているルート証明書の設定
+  LoadBuiltinSSLRootCertificates(store.get());
+  if (!settings.root_file.empty() &&
+      X509_STORE_load_locations(store.get(), settings.root_file.c_str(),
+                                nullptr) == 0) {
+    RTC_LOG(LS_ERROR) << "Failed to load " << settings.root_file;
+  }
+  if (settings.system_roots) {
+    // デフォルト証明書のパスの設定
+    X509_STORE_set_default_paths(store.get());
+    RTC_LOG(LS_INFO) << "default cert file: " << X509_get_default_cert_file();
+  }
+  RTC_LOG(LS_INFO) << "Loaded root certificates in "
+                   << rtc::TimeMillis() - start_ms << " ms";
+  return store;
+}
+
+void SSLVerifier::ApplyTo(SSL_CTX* ctx) {
+  std::shared_ptr<X509_STORE> store = GetStore();
+  if (!store) {
+    return;
+  }
+  // SSL_CTX_set_cert_store() は参照を引き取るので、増やしてから渡す
+  X509_STORE_up_ref(store.get());
+  SSL_CTX_set_cert_store(ctx, store.get());
+}
+
 bool SSLVerifier::AddCert(const std::string& pem, X509_STORE* store) {
   BIO* bio = BIO_new_mem_buf(pem.c_str(), pem.size());
   if (bio == nullptr) {
@@ -138,47 +249,20 @@ bool SSLVerifier::VerifyX509(X509* x509) {
     RTC_LOG(LS_INFO) << "Verifying " << subject_name;
   }
 
-  X509_STORE* store = nullptr;
-  X509_STORE_CTX* ctx = nullptr;
-
-  struct Guard {
-    std::function<void()> f;
-    Guard(std::function<void()> f) : f(std::move(f)) {}
-    ~Guard() { f(); }
-  };
-  Guard guard([&]() {
-    // nullptr を渡しても何もしない
-    X509_STORE_CTX_free(ctx);
-    X509_STORE_free(store);
-  });
-
-  store = X509_STORE_new();
-  if (store == nullptr) {
-    RTC_LOG(LS_ERROR) << "X509_STORE_new failed";
+  std::shared_ptr<X509_STORE> store = GetStore();
+  if (!store) {
     return false;
   }
 
-  // Let's Encrypt の証明書を追加
-  if (!AddCert(isrg_root, store)) {
-    return false;
-  }
-  if (!AddCert(dst_root, store)) {
-    return false;
-  }
-
-  // WebRTC が用意しているルート証明書の設定
-  LoadBuiltinSSLRootCertificates(store);
-  // デフォルト証明書のパスの設定
-  X509_STORE_set_default_paths(store);
-  RTC_LOG(LS_INFO) << "default cert file: " << X509_get_default_cert_file();
-
-  ctx = X509_STORE_CTX_new();
+  X509_STORE_CTX* ctx = X509_STORE_CTX_new();
   if (ctx == nullptr) {
     RTC_LOG(LS_ERROR) << "X509_STORE_CTX_new failed";
     return false;
   }
+  std::unique_ptr<X509_STORE_CTX, decltype(&X509_STORE_CTX_free)> ctx_guard(
+      ctx, X509_STORE_CTX_free);
   int r;
-  r = X509_STORE_CTX_init(ctx, store, x509, nullptr);
+  r = X509_STORE_CTX_init(ctx, store.get(), x509, nullptr);
   if (r == 0) {
     RTC_LOG(LS_ERROR) << "X509_STORE_CTX_init failed";
     return false;
@@ -1,17 +1,42 @@
 #ifndef SSL_VERIFIER_H_INCLUDED
 #define SSL_VERIFIER_H_INCLUDED
 
+#include <memory>
 #include <string>
 
 // openssl
 #include <openssl/ssl.h>
 
 // 自前で SSL の証明書検証を行うためのクラス
+//
+// 信頼するルート証明書の X509_STORE は最初に使う時に 1 回だけ作り、全ての接続で共有する。
+// 作り直すのは Reload() が呼ばれた場合と、root_file が更新された場合だけなので、
+// 再接続の度に組み込みのルート証明書をパースし直すことはない。
+// 全ての関数は任意のスレッドから呼んで良い。
 class SSLVerifier {
  public:
+  struct Settings {
+    // OpenSSL のデフォルトのパス (OS の証明書ストア) のルート証明書も信頼する
+    bool system_roots = true;
+    // 空でない場合、この PEM ファイルのルート証明書も信頼する
+    std::string root_file;
+  };
+
+  // 最初の接続より前に呼ぶこと。呼ばなかった場合はデフォルトの Settings を使う
+  static void Configure(Settings settings);
+  // 次の検証から、ルート証明書を読み込み直した X509_STORE を使う
+  static void Reload();
+
+  // 共有している X509_STORE を SSL_CTX に設定する。
+  // 設定しておけば、正しい証明書チェーンは OpenSSL の検証だけで通るので、
+  // set_verify_callback から VerifyX509() を呼ぶのは検証に失敗した場合だけになる
+  static void ApplyTo(SSL_CTX* ctx);
   static bool VerifyX509(X509* x509);
 
  private:
+  // 信頼するルート証明書を読み込んだ X509_STORE を返す。必要であれば作り直す
+  static std::shared_ptr<X509_STORE> GetStore();
+  static std::shared_ptr<X509_STORE> CreateStore(const Settings& settings);
   // PEM 形式のルート証明書を追加する
   static bool AddCert(const std::string& pem, X509_STORE* store);
   // WebRTC の組み込みルート証明書を追加する
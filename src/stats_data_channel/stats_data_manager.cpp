@@ -0,0 +1,63 @@
+#include "stats_data_manager.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+
+#include "rtc_base/logging.h"
+
+class StatsDataManager::Channel : public webrtc::DataChannelObserver {
+ public:
+  Channel(StatsDataManager* manager,
+          rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+      : manager_(manager), data_channel_(data_channel) {
+    data_channel_->RegisterObserver(this);
+  }
+  ~Channel() { data_channel_->UnregisterObserver(); }
+
+  void OnStateChange() override {
+    if (data_channel_->state() == webrtc::DataChannelInterface::kClosed) {
+      manager_->OnClosed(this);
+    }
+  }
+  void OnMessage(const webrtc::DataBuffer& buffer) override {
+    std::string text(buffer.data.data<char>(), buffer.data.size());
+    long count = strtol(text.c_str(), nullptr, 10);
+    size_t max_samples = count > 0 ? static_cast<size_t>(count)
+                                   : std::numeric_limits<size_t>::max();
+    data_channel_->Send(
+        webrtc::DataBuffer(manager_->sampler_->ToJson(max_samples).dump()));
+  }
+  void OnBufferedAmountChange(uint64_t previous_amount) override {}
+
+ private:
+  StatsDataManager* manager_;
+  rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+};
+
+StatsDataManager::StatsDataManager(std::shared_ptr<StatsSampler> sampler)
+    : sampler_(std::move(sampler)) {}
+
+StatsDataManager::~StatsDataManager() = default;
+
+void StatsDataManager::OnDataChannel(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  RTC_LOG(LS_INFO) << "StatsDataManager: opened " << data_channel->label();
+  std::lock_guard<std::mutex> lock(mutex_);
+  channels_.emplace_back(new Channel(this, data_channel));
+}
+
+void StatsDataManager::OnClosed(Channel* channel) {
+  // ロックを外してから Channel を破棄する
+  std::unique_ptr<Channel> closed;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(
+      channels_.begin(), channels_.end(),
+      [channel](const std::unique_ptr<Channel>& c) { return c.get() == channel; });
+  if (it != channels_.end()) {
+    closed = std::move(*it);
+    channels_.erase(it);
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef STATS_DATA_MANAGER_H_
+#define STATS_DATA_MANAGER_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "rtc/data_manager.h"
+#include "rtc/stats_sampler.h"
+
+// 相手が作った DataChannel にメッセージが届く度に、StatsSampler が溜めた値を
+// JSON にしてその DataChannel に送り返すクラス。
+// メッセージが正の整数の場合は、接続毎に最新のその個数分だけを返す。それ以外の内容は見ない。
+class StatsDataManager : public RTCDataManager {
+ public:
+  explicit StatsDataManager(std::shared_ptr<StatsSampler> sampler);
+  ~StatsDataManager();
+
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override;
+
+ private:
+  class Channel;
+  void OnClosed(Channel* channel);
+
+  std::shared_ptr<StatsSampler> sampler_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Channel>> channels_;
+};
+
+#endif
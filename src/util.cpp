@@ -11,7 +11,9 @@
 #include <nlohmann/json.hpp>
 
 #include "momo_version.h"
+#include "rtc/thread_placement.h"
 #include "rtc_base/helpers.h"
+#include "socket_data_channel/socket_data_manager.h"
 #if USE_ROS
 #include "ros/ros.h"
 #endif
@@ -30,10 +32,23 @@ void Util::parseArgs(int argc,
   ros::init(argc, argv, "momo", ros::init_options::AnonymousName);
 
   ros::NodeHandle nh;
+  ros::NodeHandle local_nh("~");
+  if (!parseROSParams(nh, local_nh, use_test, use_ayame, use_sora, log_level,
+                      cs)) {
+    exit(1);
+  }
+}
+
+bool Util::parseROSParams(const ros::NodeHandle& nh,
+                          const ros::NodeHandle& local_nh,
+                          bool& use_test,
+                          bool& use_ayame,
+                          bool& use_sora,
+                          int& log_level,
+                          ConnectionSettings& cs) {
   cs.camera_name = nh.resolveName("image");
   cs.audio_topic_name = nh.resolveName("audio");
 
-  ros::NodeHandle local_nh("~");
   local_nh.param<bool>("compressed", cs.image_compressed, cs.image_compressed);
 
   local_nh.param<bool>("use_test", use_test, use_test);
@@ -42,15 +57,117 @@ void Util::parseArgs(int argc,
 
   local_nh.param<bool>("no_google_stun", cs.no_google_stun,
                        cs.no_google_stun);
+  local_nh.param<int>("ice_candidate_batch_ms", cs.ice_candidate_batch_ms,
+                      cs.ice_candidate_batch_ms);
+  local_nh.param<int>("ice_candidate_batch_size", cs.ice_candidate_batch_size,
+                      cs.ice_candidate_batch_size);
+  local_nh.param<int>("dns_cache_ttl", cs.dns_cache_ttl, cs.dns_cache_ttl);
+  local_nh.param<bool>("fast_reconnect", cs.fast_reconnect,
+                       cs.fast_reconnect);
+  local_nh.param<std::string>("network_preference", cs.network_preference,
+                              cs.network_preference);
+  local_nh.param<int>("ice_check_interval_ms", cs.ice_check_interval_ms,
+                      cs.ice_check_interval_ms);
+  local_nh.param<bool>("dscp", cs.dscp, cs.dscp);
+  local_nh.param<std::string>("video_network_priority",
+                              cs.video_network_priority,
+                              cs.video_network_priority);
+  local_nh.param<std::string>("audio_network_priority",
+                              cs.audio_network_priority,
+                              cs.audio_network_priority);
+  local_nh.param<bool>("fast_startup", cs.fast_startup, cs.fast_startup);
+  local_nh.param<std::string>("latency_profile", cs.latency_profile,
+                              cs.latency_profile);
   local_nh.param<bool>("no_video_device", cs.no_video_device,
                        cs.no_video_device);
   local_nh.param<bool>("no_audio_device", cs.no_audio_device,
                        cs.no_audio_device);
+  local_nh.param<bool>("recv_only", cs.recv_only, cs.recv_only);
+  local_nh.param<bool>("prefer_hw_codec", cs.prefer_hw_codec,
+                       cs.prefer_hw_codec);
   local_nh.param<bool>("force_i420", cs.force_i420, cs.force_i420);
   local_nh.param<bool>("use_native", cs.use_native, cs.use_native);
+  local_nh.param<bool>("use_dmabuf", cs.use_dmabuf, cs.use_dmabuf);
+  local_nh.param<bool>("use_libcamera", cs.use_libcamera, cs.use_libcamera);
+  local_nh.param<int>("mjpeg_decoder_threads", cs.mjpeg_decoder_threads,
+                      cs.mjpeg_decoder_threads);
+  local_nh.param<int>("scaler_threads", cs.scaler_threads, cs.scaler_threads);
+  local_nh.param<int>("io_threads", cs.io_threads, cs.io_threads);
+  local_nh.param<bool>("nvcodec_async", cs.nvcodec_async, cs.nvcodec_async);
+  local_nh.param<int>("nvcodec_temporal_layers", cs.nvcodec_temporal_layers,
+                      cs.nvcodec_temporal_layers);
+  local_nh.param<bool>("roi_motion", cs.roi_motion, cs.roi_motion);
+  local_nh.param<int>("roi_motion_threshold", cs.roi_motion_threshold,
+                      cs.roi_motion_threshold);
+  local_nh.param<int>("roi_motion_qp_delta", cs.roi_motion_qp_delta,
+                      cs.roi_motion_qp_delta);
+  local_nh.param<int>("roi_background_qp_delta", cs.roi_background_qp_delta,
+                      cs.roi_background_qp_delta);
+  local_nh.param<std::string>("roi_label", cs.roi_label, cs.roi_label);
+  local_nh.param<bool>("low_latency_rate_control",
+                       cs.low_latency_rate_control,
+                       cs.low_latency_rate_control);
+  local_nh.param<int>("key_frame_min_interval_ms",
+                      cs.key_frame_min_interval_ms,
+                      cs.key_frame_min_interval_ms);
+  local_nh.param<bool>("key_frame_intra_refresh", cs.key_frame_intra_refresh,
+                       cs.key_frame_intra_refresh);
+  local_nh.param<bool>("shared_encoder", cs.shared_encoder,
+                       cs.shared_encoder);
+  local_nh.param<bool>("encoder_backpressure", cs.encoder_backpressure,
+                       cs.encoder_backpressure);
+  local_nh.param<int>("latency_target_ms", cs.latency_target_ms,
+                      cs.latency_target_ms);
+  local_nh.param<int>("latency_min_bitrate", cs.latency_min_bitrate,
+                      cs.latency_min_bitrate);
+  local_nh.param<int>("latency_min_framerate", cs.latency_min_framerate,
+                      cs.latency_min_framerate);
+  local_nh.param<int>("start_bitrate", cs.start_bitrate, cs.start_bitrate);
+  local_nh.param<int>("min_bitrate", cs.min_bitrate, cs.min_bitrate);
+  local_nh.param<int>("max_bitrate", cs.max_bitrate, cs.max_bitrate);
+  local_nh.param<std::string>("bitrate_cache", cs.bitrate_cache,
+                              cs.bitrate_cache);
+  local_nh.param<int>("stats_interval_ms", cs.stats_interval_ms,
+                      cs.stats_interval_ms);
+  local_nh.param<int>("stats_history", cs.stats_history, cs.stats_history);
+  local_nh.param<bool>("stats_log", cs.stats_log, cs.stats_log);
+  local_nh.param<std::string>("stats_label", cs.stats_label, cs.stats_label);
+  local_nh.param<std::string>("file_transfer_root", cs.file_transfer_root,
+                              cs.file_transfer_root);
+  local_nh.param<std::string>("file_transfer_label", cs.file_transfer_label,
+                              cs.file_transfer_label);
+  local_nh.param<int>("file_transfer_max_kbps", cs.file_transfer_max_kbps,
+                      cs.file_transfer_max_kbps);
+  local_nh.param<std::string>("record_dir", cs.record_dir, cs.record_dir);
+  local_nh.param<int>("record_segment_sec", cs.record_segment_sec,
+                      cs.record_segment_sec);
+  local_nh.param<int>("record_preallocate_mb", cs.record_preallocate_mb,
+                      cs.record_preallocate_mb);
+  local_nh.param<bool>("record_direct_io", cs.record_direct_io,
+                       cs.record_direct_io);
+  local_nh.param<int>("record_preroll_sec", cs.record_preroll_sec,
+                      cs.record_preroll_sec);
+  local_nh.param<int>("record_preroll_mb", cs.record_preroll_mb,
+                      cs.record_preroll_mb);
+  local_nh.param<std::string>("record_clip_label", cs.record_clip_label,
+                              cs.record_clip_label);
+  local_nh.param<bool>("latency_marker", cs.latency_marker,
+                       cs.latency_marker);
+  local_nh.param<int>("static_scene_fps", cs.static_scene_fps,
+                      cs.static_scene_fps);
+  local_nh.param<int>("static_scene_delay_ms", cs.static_scene_delay_ms,
+                      cs.static_scene_delay_ms);
+  local_nh.param<int>("static_scene_threshold", cs.static_scene_threshold,
+                      cs.static_scene_threshold);
 #if USE_MMAL_ENCODER || USE_JETSON_ENCODER
   local_nh.param<std::string>("video_device", cs.video_device, cs.video_device);
 #endif
+  local_nh.param<std::string>("video_file", cs.video_file, cs.video_file);
+  local_nh.param<std::string>("video_pattern", cs.video_pattern,
+                              cs.video_pattern);
+  local_nh.param<std::string>("video_shm", cs.video_shm, cs.video_shm);
+  local_nh.param<bool>("screen_capture", cs.screen_capture,
+                       cs.screen_capture);
   local_nh.param<std::string>("sora_video_codec", cs.sora_video_codec,
                               cs.sora_video_codec);
   local_nh.param<std::string>("sora_audio_codec", cs.sora_audio_codec,
@@ -61,6 +178,7 @@ void Util::parseArgs(int argc,
                       cs.sora_audio_bitrate);
   local_nh.param<std::string>("resolution", cs.resolution, cs.resolution);
   local_nh.param<int>("framerate", cs.framerate, cs.framerate);
+  local_nh.param<int>("video_rotation", cs.video_rotation, cs.video_rotation);
   local_nh.param<int>("audio_topic_rate", cs.audio_topic_rate,
                       cs.audio_topic_rate);
   local_nh.param<int>("audio_topic_ch", cs.audio_topic_ch, cs.audio_topic_ch);
@@ -68,6 +186,36 @@ void Util::parseArgs(int argc,
   local_nh.param<int>("sora_port", cs.sora_port, cs.sora_port);
   local_nh.param<int>("test_port", cs.test_port, cs.test_port);
   local_nh.param<bool>("insecure", cs.insecure, cs.insecure);
+  local_nh.param<std::string>("ssl_root_file", cs.ssl_root_file,
+                              cs.ssl_root_file);
+  local_nh.param<bool>("disable_system_ssl_roots", cs.disable_system_ssl_roots,
+                       cs.disable_system_ssl_roots);
+  local_nh.param<int>("metrics_port", cs.metrics_port, cs.metrics_port);
+  local_nh.param<int>("rtsp_port", cs.rtsp_port, cs.rtsp_port);
+  local_nh.param<int>("trace_events", cs.trace_events, cs.trace_events);
+  local_nh.param<std::string>("trace_file", cs.trace_file, cs.trace_file);
+  local_nh.param<int>("capture_stall_ms", cs.capture_stall_ms,
+                      cs.capture_stall_ms);
+  local_nh.param<bool>("on_demand_capture", cs.on_demand_capture,
+                       cs.on_demand_capture);
+  local_nh.param<int>("on_demand_linger_ms", cs.on_demand_linger_ms,
+                      cs.on_demand_linger_ms);
+  local_nh.param<bool>("low_power_idle", cs.low_power_idle,
+                       cs.low_power_idle);
+  local_nh.param<int>("encoder_stall_frames", cs.encoder_stall_frames,
+                      cs.encoder_stall_frames);
+  local_nh.param<int>("renderer_stall_ms", cs.renderer_stall_ms,
+                      cs.renderer_stall_ms);
+  local_nh.param<std::string>("shm_export", cs.shm_export, cs.shm_export);
+  local_nh.param<int>("shm_export_slots", cs.shm_export_slots,
+                      cs.shm_export_slots);
+  local_nh.param<int>("memory_budget_mb", cs.memory_budget_mb,
+                      cs.memory_budget_mb);
+  local_nh.param<bool>("snapshot", cs.snapshot, cs.snapshot);
+  local_nh.param<int>("snapshot_quality", cs.snapshot_quality,
+                      cs.snapshot_quality);
+  local_nh.param<std::string>("snapshot_label", cs.snapshot_label,
+                              cs.snapshot_label);
   local_nh.param<int>("log_level", log_level, log_level);
 
   // オーディオフラグ
@@ -87,6 +235,21 @@ void Util::parseArgs(int argc,
   local_nh.param<bool>("disable_residual_echo_detector",
                        cs.disable_residual_echo_detector,
                        cs.disable_residual_echo_detector);
+  local_nh.param<std::string>("audio_processing", cs.audio_processing,
+                              cs.audio_processing);
+  local_nh.param<std::string>("audio_profile", cs.audio_profile,
+                              cs.audio_profile);
+  local_nh.param<std::string>("video_protection", cs.video_protection,
+                              cs.video_protection);
+  local_nh.param<std::string>("rtc_config", cs.rtc_config_file,
+                              cs.rtc_config_file);
+  if (!cs.rtc_config_file.empty()) {
+    std::string error;
+    if (!RtcConfig::Load(cs.rtc_config_file, &cs.rtc_config, &error)) {
+      ROS_ERROR("%s", error.c_str());
+      return false;
+    }
+  }
 
   if (use_sora && local_nh.hasParam("SIGNALING_URL") &&
       local_nh.hasParam("CHANNEL_ID")) {
@@ -113,8 +276,9 @@ void Util::parseArgs(int argc,
     local_nh.param<std::string>("signaling_key", cs.ayame_signaling_key,
                                 cs.ayame_signaling_key);
   } else {
-    exit(1);
+    return false;
   }
+  return true;
 }
 
 #else
@@ -134,7 +298,8 @@ void Util::parseArgs(int argc,
 
   auto is_valid_force_i420 = CLI::Validator(
       [](std::string input) -> std::string {
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+    USE_V4L2_M2M || USE_VAAPI_ENCODER
         return std::string();
 #else
         return "Not available because your device does not have this feature.";
@@ -143,7 +308,71 @@ void Util::parseArgs(int argc,
       "");
   auto is_valid_use_native = CLI::Validator(
       [](std::string input) -> std::string {
-#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+    USE_V4L2_M2M || USE_VAAPI_ENCODER
+        return std::string();
+#else
+        return "Not available because your device does not have this feature.";
+#endif
+      },
+      "");
+
+  auto is_valid_hw_encoder = CLI::Validator(
+      [](std::string input) -> std::string {
+#if USE_MMAL_ENCODER || USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || \
+    USE_V4L2_M2M || USE_VAAPI_ENCODER
+        return std::string();
+#else
+        return "Not available because your device does not have this feature.";
+#endif
+      },
+      "");
+
+  auto is_valid_use_dmabuf = CLI::Validator(
+      [](std::string input) -> std::string {
+#if defined(__linux__) && \
+    (USE_JETSON_ENCODER || USE_NVCODEC_ENCODER || USE_V4L2_M2M || \
+     USE_VAAPI_ENCODER)
+        return std::string();
+#else
+        return "Not available because your device does not have this feature.";
+#endif
+      },
+      "");
+
+  auto is_valid_mf_hardware_decode = CLI::Validator(
+      [](std::string input) -> std::string {
+#if defined(_WIN32)
+        return std::string();
+#else
+        return "Not available because your device does not have this feature.";
+#endif
+      },
+      "");
+
+  auto is_valid_nvcodec = CLI::Validator(
+      [](std::string input) -> std::string {
+#if USE_NVCODEC_ENCODER
+        return std::string();
+#else
+        return "Not available because your device does not have this feature.";
+#endif
+      },
+      "");
+
+  auto is_valid_roi = CLI::Validator(
+      [](std::string input) -> std::string {
+#if USE_NVCODEC_ENCODER || USE_JETSON_ENCODER
+        return std::string();
+#else
+        return "Not available because your device does not have this feature.";
+#endif
+      },
+      "");
+
+  auto is_valid_mmal = CLI::Validator(
+      [](std::string input) -> std::string {
+#if USE_MMAL_ENCODER
         return std::string();
 #else
         return "Not available because your device does not have this feature.";
@@ -176,6 +405,27 @@ void Util::parseArgs(int argc,
       },
       "");
 
+  auto is_valid_libcamera = CLI::Validator(
+      [](std::string input) -> std::string {
+#if USE_LIBCAMERA
+        return std::string();
+#else
+        return "Not available because your device does not have this feature.";
+#endif
+      },
+      "");
+
+  auto is_drm_available = CLI::Validator(
+      [](std::string input) -> std::string {
+#if USE_DRM
+        return std::string();
+#else
+        return "Not available because your device does not have this "
+               "feature.";
+#endif
+      },
+      "");
+
   auto is_valid_resolution = CLI::Validator(
       [](std::string input) -> std::string {
         if (input == "QVGA" || input == "VGA" || input == "HD" ||
@@ -196,10 +446,58 @@ void Util::parseArgs(int argc,
 
   app.add_flag("--no-google-stun", cs.no_google_stun,
                "Do not use google stun");
+  app.add_option("--ice-candidate-batch-ms", cs.ice_candidate_batch_ms,
+                 "Collect local ICE candidates for the milliseconds and send "
+                 "them together (0 to send each candidate immediately)")
+      ->check(CLI::Range(0, 1000));
+  app.add_option("--ice-candidate-batch-size", cs.ice_candidate_batch_size,
+                 "Send collected ICE candidates when this many are collected "
+                 "(used with --ice-candidate-batch-ms)")
+      ->check(CLI::Range(1, 256));
+  app.add_option("--dns-cache-ttl", cs.dns_cache_ttl,
+                 "Seconds to cache DNS lookups of the signaling server "
+                 "(0 to disable)")
+      ->check(CLI::Range(0, 86400));
+  app.add_flag("--fast-reconnect", cs.fast_reconnect,
+               "Reuse TLS sessions and DTLS certificate on reconnect, and "
+               "try ICE restart before reconnecting");
+  app.add_option("--network-preference", cs.network_preference,
+                 "Prefer this type of network when several paths are "
+                 "available")
+      ->check(CLI::IsMember({"ethernet", "wifi", "cellular", "vpn"}));
+  app.add_option("--network-ignore", cs.network_ignores,
+                 "Do not gather ICE candidates on this type of network (can "
+                 "be specified multiple times)")
+      ->check(CLI::IsMember({"ethernet", "wifi", "cellular", "vpn",
+                             "loopback"}));
+  app.add_option("--ice-check-interval-ms", cs.ice_check_interval_ms,
+                 "Check the selected and backup ICE candidate pairs at this "
+                 "interval and switch paths as soon as the selected one "
+                 "stops receiving (0 to use the libwebrtc defaults)")
+      ->check(CLI::IsMember({0}) | CLI::Range(100, 5000));
+  app.add_flag("--dscp", cs.dscp,
+               "Mark outgoing packets with DSCP values according to the "
+               "network priority of each track");
+  app.add_option("--video-network-priority", cs.video_network_priority,
+                 "Network priority of video tracks")
+      ->check(CLI::IsMember({"very-low", "low", "medium", "high"}));
+  app.add_option("--audio-network-priority", cs.audio_network_priority,
+                 "Network priority of the audio track")
+      ->check(CLI::IsMember({"very-low", "low", "medium", "high"}));
+  app.add_flag("--fast-startup", cs.fast_startup,
+               "Create the PeerConnectionFactory in parallel with opening "
+               "the video device and connecting to the signaling server, "
+               "and initialize the video encoder once in advance");
   app.add_flag("--no-video-device", cs.no_video_device,
                "Do not use video device");
   app.add_flag("--no-audio-device", cs.no_audio_device,
                "Do not use audio device");
+  app.add_flag("--recv-only", cs.recv_only,
+               "Only receive video and audio without opening the video "
+               "device, the microphone or the hardware encoder");
+  app.add_flag("--prefer-hw-codec", cs.prefer_hw_codec,
+               "Probe hardware encoders at startup and put the codecs they "
+               "can encode first in codec negotiation");
   app.add_flag(
          "--force-i420", cs.force_i420,
          "Prefer I420 format for video capture (only on supported devices)")
@@ -208,6 +506,83 @@ void Util::parseArgs(int argc,
                "Perform MJPEG deoode and video resize by hardware acceleration "
                "(only on supported devices)")
       ->check(is_valid_use_native);
+  app.add_flag("--use-dmabuf", cs.use_dmabuf,
+               "Pass V4L2 capture buffers to the encoder without copying "
+               "(requires --use-native, only on supported devices)")
+      ->check(is_valid_use_dmabuf);
+  app.add_flag("--use-libcamera", cs.use_libcamera,
+               "Capture with libcamera and pass the ISP buffers to the V4L2 "
+               "hardware encoder without copying (only on Raspberry Pi)")
+      ->check(is_valid_libcamera);
+  app.add_flag("--mf-hardware-decode", cs.mf_hardware_decode,
+               "Decode MJPEG from the camera to NV12 by Media Foundation "
+               "hardware decoder (requires --use-native, only on Windows)")
+      ->check(is_valid_mf_hardware_decode);
+  app.add_flag("--nvcodec-async", cs.nvcodec_async,
+               "Encode on separate threads without waiting for the GPU "
+               "(only on NVIDIA GPU)")
+      ->check(is_valid_nvcodec);
+  app.add_option("--nvcodec-temporal-layers", cs.nvcodec_temporal_layers,
+                 "Number of H264 temporal layers, 2 for L1T2 and 3 for L1T3 "
+                 "(only on NVIDIA GPU)")
+      ->check(is_valid_nvcodec)
+      ->check(CLI::Range(1, 3));
+  app.add_flag("--roi-motion", cs.roi_motion,
+               "Lower the QP of macroblocks with motion "
+               "(only on NVIDIA GPU and Jetson)")
+      ->check(is_valid_roi);
+  app.add_option("--roi-motion-threshold", cs.roi_motion_threshold,
+                 "Average luma difference per pixel to detect motion")
+      ->check(CLI::Range(1, 255));
+  app.add_option("--roi-motion-qp-delta", cs.roi_motion_qp_delta,
+                 "QP delta for macroblocks with motion")
+      ->check(CLI::Range(-51, 51));
+  app.add_option("--roi-background-qp-delta", cs.roi_background_qp_delta,
+                 "QP delta for the other macroblocks (only on NVIDIA GPU)")
+      ->check(CLI::Range(-51, 51));
+  app.add_option("--roi-label", cs.roi_label,
+                 "Label of the DataChannel to receive regions to change "
+                 "the QP (only on NVIDIA GPU and Jetson)")
+      ->check(is_valid_roi);
+  app.add_flag("--low-latency-rate-control", cs.low_latency_rate_control,
+               "Use CBR with a one frame VBV buffer and intra refresh "
+               "instead of periodic key frames (only on hardware encoders)")
+      ->check(is_valid_hw_encoder);
+  app.add_option("--key-frame-min-interval-ms", cs.key_frame_min_interval_ms,
+                 "Send at most one key frame in this interval and coalesce "
+                 "the requests in between (only on hardware encoders)")
+      ->check(is_valid_hw_encoder)
+      ->check(CLI::Range(0, 60000));
+  app.add_flag("--key-frame-intra-refresh", cs.key_frame_intra_refresh,
+               "Answer key frame requests within --key-frame-min-interval-ms "
+               "with intra refresh (only on hardware encoders)")
+      ->check(is_valid_hw_encoder);
+  app.add_flag("--shared-encoder", cs.shared_encoder,
+               "Share one encoder between connections with the same "
+               "settings instead of encoding for each connection");
+  app.add_flag("--mmal-encoder-low-latency", cs.mmal_encoder_low_latency,
+               "Encode each frame in multiple slices and receive them "
+               "without waiting for the whole frame (only on Raspberry Pi)")
+      ->check(is_valid_mmal);
+  app.add_flag("--mmal-decoder-zero-copy", cs.mmal_decoder_zero_copy,
+               "Pass decoded MMAL buffers without copying "
+               "(only on Raspberry Pi)")
+      ->check(is_valid_mmal);
+  app.add_option("--mmal-decoder-input-buffers", cs.mmal_decoder_input_buffers,
+                 "Number of MMAL H264 decoder input buffers "
+                 "(only on Raspberry Pi)")
+      ->check(is_valid_mmal)
+      ->check(CLI::Range(1, 32));
+  app.add_option("--mmal-decoder-output-buffers",
+                 cs.mmal_decoder_output_buffers,
+                 "Number of MMAL H264 decoder output buffers "
+                 "(only on Raspberry Pi)")
+      ->check(is_valid_mmal)
+      ->check(CLI::Range(1, 32));
+  app.add_option("--max-hw-decoders", cs.max_hw_decoders,
+                 "Decode at most this many received tracks with the hardware "
+                 "decoder and the rest in software (0 for no limit)")
+      ->check(CLI::Range(0, 64));
 #if defined(__APPLE__) || defined(_WIN32)
   app.add_option("--video-device", cs.video_device,
                  "Use the video device specified by an index or a name "
@@ -217,17 +592,186 @@ void Util::parseArgs(int argc,
                  "Use the video input device specified by a name "
                  "(some device will be used if not specified)")
       ->check(CLI::ExistingFile);
+  app.add_option("--additional-video-device", cs.additional_video_devices,
+                 "Capture another video input device at the same time and "
+                 "send it as a separate track (can be specified multiple "
+                 "times)")
+      ->check(CLI::ExistingFile);
+#endif
+  auto video_file = app.add_option(
+      "--video-file", cs.video_file,
+      "Replay a Y4M, MJPEG or raw I420 (--resolution) file in a loop "
+      "instead of the video device");
+  video_file->check(CLI::ExistingFile);
+  app.add_option("--video-pattern", cs.video_pattern,
+                 "Generate a test pattern instead of the video device")
+      ->check(CLI::IsMember({"bars", "noise"}))
+      ->excludes(video_file);
+#if defined(__linux__)
+  app.add_option("--video-shm", cs.video_shm,
+                 "Stream frames written by another process to a POSIX shared "
+                 "memory ring with this name instead of the video device")
+      ->excludes(video_file);
+  app.add_flag("--screen-capture", cs.screen_capture,
+               "Capture the X11 screen of $DISPLAY instead of the video "
+               "device")
+      ->excludes(video_file);
+  app.add_option("--capture-cpus", cs.capture_cpus,
+                 "Comma separated CPU numbers to pin the capture thread of "
+                 "each video device to, in the order of --video-device and "
+                 "--additional-video-device")
+      ->delimiter(',')
+      ->check(CLI::NonNegativeNumber);
+  app.add_option("--compositor", cs.compositor,
+                 "Compose all video devices into one track instead of "
+                 "sending separate tracks")
+      ->check(CLI::IsMember({"grid", "pip"}));
+  auto is_valid_thread_placement = CLI::Validator(
+      [](std::string input) -> std::string {
+        std::string role;
+        std::vector<int> cpus;
+        int priority;
+        std::string error;
+        if (!ThreadPlacement::Parse(input, &role, &cpus, &priority, &error)) {
+          return error;
+        }
+        return std::string();
+      },
+      "");
+  app.add_option("--thread-placement", cs.thread_placements,
+                 "Pin threads of ROLE to CPUS and optionally run them with "
+                 "SCHED_FIFO PRIORITY, in the form of ROLE=CPUS[:PRIORITY] "
+                 "(ROLE: network, worker, signaling, io, capture, encoder, "
+                 "decoder, renderer, recorder, scaler; can be specified "
+                 "multiple times)")
+      ->check(is_valid_thread_placement);
+  app.add_option("--video-device-cache", cs.video_device_cache,
+                 "Cache probed video device capabilities in the file and "
+                 "open the cached device on the next start");
+  app.add_option("--v4l2-buffers", cs.v4l2_buffers,
+                 "Number of V4L2 capture buffers (more buffers tolerate "
+                 "jitter better, fewer buffers reduce latency)")
+      ->check(CLI::Range(2, 32));
+  app.add_flag("--capture-pipeline", cs.capture_pipeline,
+               "Convert captured frames on a separate thread so that "
+               "conversion does not delay the next capture");
+  app.add_flag("--encoder-backpressure", cs.encoder_backpressure,
+               "Skip converting captured frames while the encoder is "
+               "falling behind");
+  app.add_option("--latency-target-ms", cs.latency_target_ms,
+                 "Adjust the video bitrate, framerate and resolution of each "
+                 "connection to keep the estimated latency under this value "
+                 "(0 to disable)")
+      ->check(CLI::Range(0, 10000));
+  app.add_option("--latency-min-bitrate", cs.latency_min_bitrate,
+                 "Lowest video bitrate (kbps) set by --latency-target-ms")
+      ->check(CLI::Range(0, 30000));
+  app.add_option("--latency-min-framerate", cs.latency_min_framerate,
+                 "Lowest video framerate set by --latency-target-ms")
+      ->check(CLI::Range(1, 60));
+  app.add_option("--start-bitrate", cs.start_bitrate,
+                 "Initial bandwidth estimate of each connection in kbps "
+                 "(0 to use the libwebrtc default)")
+      ->check(CLI::Range(0, 100000));
+  app.add_option("--min-bitrate", cs.min_bitrate,
+                 "Lower limit of the bandwidth estimate in kbps (0 to use "
+                 "the libwebrtc default)")
+      ->check(CLI::Range(0, 100000));
+  app.add_option("--max-bitrate", cs.max_bitrate,
+                 "Upper limit of the bandwidth estimate in kbps (0 to use "
+                 "the libwebrtc default)")
+      ->check(CLI::Range(0, 100000));
+  app.add_option("--bitrate-cache", cs.bitrate_cache,
+                 "Remember the last bandwidth estimate of each remote in the "
+                 "file and start the next connection to it from that rate");
+  app.add_option("--stats-interval-ms", cs.stats_interval_ms,
+                 "Interval to sample the stats of each connection for "
+                 "metrics, logs and the DataChannel (0 to disable)")
+      ->check(CLI::Range(0, 60000));
+  app.add_option("--stats-history", cs.stats_history,
+                 "Number of samples kept for each connection")
+      ->check(CLI::Range(1, 3600));
+  app.add_flag("--stats-log", cs.stats_log, "Log every sampled stats");
+  app.add_option("--stats-label", cs.stats_label,
+                 "Label of the DataChannel to request the sampled stats");
+  app.add_option("--file-transfer-root", cs.file_transfer_root,
+                 "Send files under this directory when requested through "
+                 "the DataChannel")
+      ->check(CLI::ExistingDirectory);
+  app.add_option("--file-transfer-label", cs.file_transfer_label,
+                 "Label of the DataChannel to request files");
+  app.add_option("--file-transfer-max-kbps", cs.file_transfer_max_kbps,
+                 "Upper limit of the file transfer rate in kbps")
+      ->check(CLI::Range(64, 1000000));
+  app.add_option("--record-dir", cs.record_dir,
+                 "Record the sent H.264 and Opus streams to MPEG-TS files "
+                 "in this directory without encoding again");
+  app.add_option("--record-segment-sec", cs.record_segment_sec,
+                 "Length of each recorded file in seconds")
+      ->check(CLI::Range(1, 86400));
+  app.add_option("--record-preallocate-mb", cs.record_preallocate_mb,
+                 "Preallocate this many MB for each recorded file "
+                 "(only on Linux)")
+      ->check(CLI::Range(0, 65536));
+  app.add_flag("--record-direct-io", cs.record_direct_io,
+               "Write recorded files with O_DIRECT bypassing the page cache "
+               "(only on Linux)");
+  app.add_option("--record-preroll-sec", cs.record_preroll_sec,
+                 "Keep the last seconds of the sent streams in memory instead "
+                 "of recording continuously, and save them on request")
+      ->check(CLI::Range(0, 3600));
+  app.add_option("--record-preroll-mb", cs.record_preroll_mb,
+                 "Memory limit in MB for --record-preroll-sec")
+      ->check(CLI::Range(1, 4096));
+  app.add_option("--record-clip-label", cs.record_clip_label,
+                 "Label of the DataChannel to request saving the preroll");
+  app.add_option("--mjpeg-decoder-threads", cs.mjpeg_decoder_threads,
+                 "Number of threads to decode MJPEG frames in parallel "
+                 "(when --use-native is not specified)")
+      ->check(CLI::Range(1, 16));
 #endif
+  app.add_option("--scaler-threads", cs.scaler_threads,
+                 "Number of threads to downscale large frames in parallel "
+                 "(0 means the number of CPUs, up to 4)")
+      ->check(CLI::Range(0, 16));
+  app.add_option("--io-threads", cs.io_threads,
+                 "Number of threads to run network and DataChannel I/O "
+                 "(2 or more moves DataChannel I/O and HTTP servers off the "
+                 "signaling thread)")
+      ->check(CLI::Range(1, 16));
+  app.add_option("--gateway-config", cs.gateway_config,
+                 "Run one session per line of this file in a single process, "
+                 "sharing the WebRTC threads (gateway mode)")
+      ->check(CLI::ExistingFile);
   app.add_option("--resolution", cs.resolution,
                  "Video resolution (one of QVGA, VGA, HD, FHD, 4K, or "
                  "[WIDTH]x[HEIGHT])")
       ->check(is_valid_resolution);
   app.add_option("--framerate", cs.framerate, "Video framerate")
       ->check(CLI::Range(1, 60));
+  app.add_option("--video-rotation", cs.video_rotation,
+                 "Rotate the captured video clockwise by this angle "
+                 "(flipped by the camera when it supports 180)")
+      ->check(CLI::IsMember({0, 90, 180, 270}));
+  app.add_option("--static-scene-fps", cs.static_scene_fps,
+                 "Lower the video framerate to this value while the scene "
+                 "is not changing (0 means disabled)")
+      ->check(CLI::Range(0, 60));
+  app.add_option("--static-scene-delay-ms", cs.static_scene_delay_ms,
+                 "Time in milliseconds without changes before lowering the "
+                 "framerate with --static-scene-fps")
+      ->check(CLI::Range(0, 600000));
+  app.add_option("--static-scene-threshold", cs.static_scene_threshold,
+                 "Luma difference of the downscaled frame to detect changes "
+                 "for --static-scene-fps")
+      ->check(CLI::Range(1, 255));
   app.add_flag("--fixed-resolution", cs.fixed_resolution,
                "Maintain video resolution in degradation");
   app.add_set("--priority", cs.priority, {"BALANCE", "FRAMERATE", "RESOLUTION"},
               "Preference in video degradation (experimental)");
+  app.add_flag("--latency-marker", cs.latency_marker,
+               "Stamp the capture time on sent frames and measure "
+               "glass-to-glass latency of received frames");
   app.add_flag("--use-sdl", cs.use_sdl,
                "Show video using SDL (if SDL is available)")
       ->check(is_sdl_available);
@@ -244,13 +788,92 @@ void Util::parseArgs(int argc,
   app.add_flag("--fullscreen", cs.fullscreen,
                "Use fullscreen window for videos (if SDL is available)")
       ->check(is_sdl_available);
+  app.add_option("--sdl-render-budget-fps", cs.sdl_render_budget_fps,
+                 "Total frame rate shared by all received videos "
+                 "(0 for no limit, if SDL is available)")
+      ->check(is_sdl_available)
+      ->check(CLI::Range(0, 1000));
+  app.add_flag("--use-drm", cs.use_drm,
+               "Show video directly on the display using DRM/KMS "
+               "(if DRM is available)")
+      ->check(is_drm_available)
+      ->excludes("--use-sdl");
+  app.add_option("--drm-device", cs.drm_device,
+                 "DRM device to show video (if DRM is available)")
+      ->check(is_drm_available)
+      ->check(CLI::ExistingFile);
   app.add_flag("--version", version, "Show version information");
   app.add_flag("--insecure", cs.insecure,
                "Allow insecure server connections when using SSL");
+  app.add_option("--ssl-root-file", cs.ssl_root_file,
+                 "PEM file of additional trusted root certificates, reloaded "
+                 "when modified or on SIGHUP")
+      ->check(CLI::ExistingFile);
+  app.add_flag("--disable-system-ssl-roots", cs.disable_system_ssl_roots,
+               "Do not trust the root certificates of the system store");
+  app.add_option("--metrics-port", cs.metrics_port,
+                 "Port number of the HTTP server that serves /metrics "
+                 "(disabled if not specified)")
+      ->check(CLI::Range(0, 65535));
+  app.add_option("--rtsp-port", cs.rtsp_port,
+                 "Port number of the RTSP server that serves the sent H.264 "
+                 "stream (disabled if not specified)")
+      ->check(CLI::Range(0, 65535));
   auto log_level_map = std::vector<std::pair<std::string, int> >(
       {{"verbose", 0}, {"info", 1}, {"warning", 2}, {"error", 3}, {"none", 4}});
   app.add_option("--log-level", log_level, "Log severity level threshold")
       ->transform(CLI::CheckedTransformer(log_level_map, CLI::ignore_case));
+  app.add_option("--log-queue-size", cs.log_queue_size,
+                 "Number of log messages buffered for the log file writer "
+                 "thread (0 to write on the logging thread)")
+      ->check(CLI::Range(0, 1 << 20));
+  app.add_option("--trace-events", cs.trace_events,
+                 "Record this many frame timeline events per thread and dump "
+                 "them as a Chrome trace on SIGUSR1 or GET /trace of "
+                 "--metrics-port (0 to disable)")
+      ->check(CLI::Range(0, 1 << 20));
+  app.add_option("--trace-file", cs.trace_file,
+                 "File to dump the frame timeline on SIGUSR1");
+  app.add_option("--capture-stall-ms", cs.capture_stall_ms,
+                 "Reopen the capture device when no frame arrives for this "
+                 "duration (0 to disable)")
+      ->check(CLI::Range(0, 60000));
+  app.add_flag("--on-demand-capture", cs.on_demand_capture,
+               "Capture from the V4L2 camera only while someone is watching");
+  app.add_option("--on-demand-linger-ms", cs.on_demand_linger_ms,
+                 "Keep capturing for this duration after the last viewer "
+                 "leaves with --on-demand-capture")
+      ->check(CLI::Range(0, 600000));
+  app.add_flag("--low-power-idle", cs.low_power_idle,
+               "Like --on-demand-capture, and also release the ISP and frame "
+               "buffer pools while nobody is watching");
+  app.add_option("--encoder-stall-frames", cs.encoder_stall_frames,
+                 "Reinitialize the hardware encoder when this many submitted "
+                 "frames produce no output (0 to disable)")
+      ->check(CLI::Range(0, 60));
+  app.add_option("--renderer-stall-ms", cs.renderer_stall_ms,
+                 "Warn when no received video frame arrives for this "
+                 "duration (0 to disable)")
+      ->check(CLI::Range(0, 60000));
+  app.add_option("--shm-export", cs.shm_export,
+                 "Export captured frames to a POSIX shared memory ring with "
+                 "this name for local processes (Linux only)");
+  app.add_option("--shm-export-slots", cs.shm_export_slots,
+                 "Number of frames kept in the --shm-export ring")
+      ->check(CLI::Range(2, 16));
+  app.add_option("--memory-budget", cs.memory_budget_mb,
+                 "Memory budget in MB. Buffer counts, the preroll size and, "
+                 "if needed, the resolution are reduced to fit (0 to disable)")
+      ->check(CLI::Range(0, 65536));
+  app.add_flag("--snapshot", cs.snapshot,
+               "Serve the latest frame as JPEG at GET /snapshot.jpg on "
+               "--metrics-port and through the DataChannel");
+  app.add_option("--snapshot-quality", cs.snapshot_quality,
+                 "JPEG quality of snapshots (not used when the camera "
+                 "produces MJPEG)")
+      ->check(CLI::Range(1, 100));
+  app.add_option("--snapshot-label", cs.snapshot_label,
+                 "Label of the DataChannel to request snapshots");
 
   // オーディオフラグ
   app.add_flag("--disable-echo-cancellation", cs.disable_echo_cancellation,
@@ -266,6 +889,38 @@ void Util::parseArgs(int argc,
   app.add_flag("--disable-residual-echo-detector",
                cs.disable_residual_echo_detector,
                "Disable residual echo detector for audio");
+  app.add_option("--audio-processing", cs.audio_processing,
+                 "Audio processing profile (default: WebRTC default, "
+                 "light: without echo cancellation, bypass: no processing)")
+      ->check(CLI::IsMember({"default", "light", "bypass"}));
+  app.add_flag("--audio-processing-benchmark", cs.audio_processing_benchmark,
+               "Print the CPU time of each audio processing module and exit");
+  app.add_option("--audio-profile", cs.audio_profile,
+                 "Opus encoder profile (low-cpu: complexity 0 and 20 ms frames, "
+                 "low-bandwidth: DTX and 12 kbps, loss-resilient: inband FEC, "
+                 "low-latency: 10 ms frames, small device buffers and jitter "
+                 "buffer)")
+      ->check(CLI::IsMember(
+          {"", "low-cpu", "low-bandwidth", "loss-resilient", "low-latency"}));
+  app.add_option("--video-protection", cs.video_protection,
+                 "Video loss protection (nack: retransmission only, "
+                 "ulpfec: NACK and RED+ULPFEC, flexfec: NACK and FlexFEC)")
+      ->check(CLI::IsMember({"", "nack", "ulpfec", "flexfec"}));
+  auto is_valid_rtc_config = CLI::Validator(
+      [](std::string input) -> std::string {
+        RtcConfig config;
+        std::string error;
+        if (!RtcConfig::Load(input, &config, &error)) {
+          return error;
+        }
+        return std::string();
+      },
+      "");
+  app.add_option("--rtc-config", cs.rtc_config_file,
+                 "JSON file with WebRTC field trials, advertised H264 "
+                 "profiles and levels, video codec preference and disabled "
+                 "RTP header extensions")
+      ->check(is_valid_rtc_config);
 
   auto is_serial_setting_format = CLI::Validator(
       [](std::string input) -> std::string {
@@ -288,6 +943,41 @@ void Util::parseArgs(int argc,
          "--serial", serial_setting,
          "Serial port settings for datachannel passthrough [DEVICE],[BAUDRATE]")
       ->check(is_serial_setting_format);
+  app.add_option("--serial-framing", cs.serial_framing,
+                 "How to split serial data into datachannel messages "
+                 "(line: newline delimited, cobs: COBS encoded and zero "
+                 "delimited, length: 2 byte big endian length prefixed)")
+      ->check(CLI::IsMember({"line", "cobs", "length"}));
+
+  auto is_valid_data_channel_source = CLI::Validator(
+      [](std::string input) -> std::string {
+        SocketDataManager::Source source;
+        std::string error;
+        if (!SocketDataManager::ParseSource(input, &source, &error)) {
+          return error;
+        }
+        return std::string();
+      },
+      "");
+  app.add_option("--data-channel-source", cs.data_channel_sources,
+                 "Send datagrams received on the socket over the datachannel "
+                 "LABEL, in the form of LABEL=udp://HOST:PORT or "
+                 "LABEL=unix://PATH (can be specified multiple times)")
+      ->check(is_valid_data_channel_source);
+  app.add_option("--data-channel-max-retransmits",
+                 cs.data_channel_max_retransmits,
+                 "Max retransmits of datachannels for --data-channel-source "
+                 "(-1 to retransmit until delivered)")
+      ->check(CLI::Range(-1, 65535));
+  app.add_flag("--data-channel-ordered", cs.data_channel_ordered,
+               "Deliver messages of datachannels for --data-channel-source "
+               "in order");
+  app.add_flag("--data-channel-coalesce", cs.data_channel_coalesce,
+               "Pack datagrams for --data-channel-source into messages up "
+               "to the MTU size, each prefixed with a 2 byte length");
+  app.add_option("--data-channel-priority", cs.data_channel_priority,
+                 "Priority of datachannels for --data-channel-source")
+      ->check(CLI::IsMember({"very-low", "low", "medium", "high"}));
 
   auto test_app = app.add_subcommand(
       "test", "Mode for momo development with simple HTTP server");
@@ -313,6 +1003,7 @@ void Util::parseArgs(int argc,
 
   sora_app->add_option("SIGNALING-URL", cs.sora_signaling_host, "Signaling URL")
       ->required();
+
   sora_app->add_option("CHANNEL-ID", cs.sora_channel_id, "Channel ID")
       ->required();
   sora_app->add_flag("--auto", cs.sora_auto_connect,
@@ -341,6 +1032,7 @@ void Util::parseArgs(int argc,
       ->add_option("--audio-bitrate", cs.sora_audio_bitrate, "Audio bitrate")
       ->check(CLI::Range(0, 510));
   sora_app->add_flag("--multistream", cs.sora_multistream, "Use multistream");
+  sora_app->add_flag("--simulcast", cs.sora_simulcast, "Use simulcast");
   sora_app->add_set(
       "--role", cs.sora_role,
       {"upstream", "downstream", "sendonly", "recvonly", "sendrecv"},
@@ -349,6 +1041,24 @@ void Util::parseArgs(int argc,
       ->add_option("--spotlight", cs.sora_spotlight,
                    "Stream count delivered in spotlight")
       ->check(CLI::Range(1, 10));
+  sora_app->add_flag("--spotlight-power-save", cs.sora_spotlight_power_save,
+                     "Encode video at thumbnail size, framerate and bitrate "
+                     "while not focused in spotlight");
+  sora_app
+      ->add_option("--spotlight-thumbnail-scale",
+                   cs.sora_spotlight_thumbnail_scale,
+                   "Scale down factor of the video while not focused")
+      ->check(CLI::Range(1, 16));
+  sora_app
+      ->add_option("--spotlight-thumbnail-fps",
+                   cs.sora_spotlight_thumbnail_fps,
+                   "Framerate of the video while not focused")
+      ->check(CLI::Range(1, 60));
+  sora_app
+      ->add_option("--spotlight-thumbnail-bitrate",
+                   cs.sora_spotlight_thumbnail_bitrate,
+                   "Video bitrate while not focused (kbps)")
+      ->check(CLI::Range(30, 30000));
   sora_app->add_option("--port", cs.sora_port, "Port number (default: -1)")
       ->check(CLI::Range(-1, 65535));
 
@@ -368,6 +1078,15 @@ void Util::parseArgs(int argc,
                    "Signaling metadata used in connect message")
       ->check(is_json);
 
+  // 操縦用と監視用のように、モード毎に受信の遅延の設定を指定する
+  for (CLI::App* mode_app : {test_app, ayame_app, sora_app}) {
+    mode_app
+        ->add_option("--latency-profile", cs.latency_profile,
+                     "Receive latency profile (ultra-low: minimal jitter "
+                     "buffer and render decoded frames immediately)")
+        ->check(CLI::IsMember({"default", "ultra-low"}));
+  }
+
   try {
     app.parse(argc, argv);
   } catch (const CLI::ParseError& e) {
@@ -381,6 +1100,11 @@ void Util::parseArgs(int argc,
     cs.serial_rate = std::stoi(baudrate_str);
   }
 
+  if (!cs.rtc_config_file.empty()) {
+    std::string error;
+    RtcConfig::Load(cs.rtc_config_file, &cs.rtc_config, &error);
+  }
+
   // メタデータのパース
   if (!sora_metadata.empty()) {
     cs.sora_metadata = json::parse(sora_metadata);
@@ -403,17 +1127,29 @@ void Util::parseArgs(int argc,
               << std::endl;
     std::cout << "USE_NVCODEC_ENCODER=" BOOST_PP_STRINGIZE(USE_NVCODEC_ENCODER)
               << std::endl;
+    std::cout << "USE_VAAPI_ENCODER=" BOOST_PP_STRINGIZE(USE_VAAPI_ENCODER)
+              << std::endl;
+    std::cout << "USE_LIBCAMERA=" BOOST_PP_STRINGIZE(USE_LIBCAMERA)
+              << std::endl;
+    std::cout << "USE_V4L2_M2M=" BOOST_PP_STRINGIZE(USE_V4L2_M2M)
+              << std::endl;
     std::cout << "USE_SDL2=" BOOST_PP_STRINGIZE(USE_SDL2) << std::endl;
     exit(0);
   }
 
-  if (!test_app->parsed() && !sora_app->parsed() && !ayame_app->parsed()) {
+  // ゲートウェイモードではモードをセッション毎に指定する
+  if (!test_app->parsed() && !sora_app->parsed() && !ayame_app->parsed() &&
+      cs.gateway_config.empty()) {
     std::cout << app.help() << std::endl;
     exit(1);
   }
 
   if (sora_app->parsed()) {
     use_sora = true;
+    // downstream では送信しないので、送信の準備も要らない
+    if (cs.sora_role == "downstream" || cs.sora_role == "recvonly") {
+      cs.recv_only = true;
+    }
   }
 
   if (test_app->parsed()) {
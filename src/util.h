@@ -8,6 +8,12 @@
 #include "api/peer_connection_interface.h"
 #include "connection_settings.h"
 
+#if USE_ROS
+namespace ros {
+class NodeHandle;
+}
+#endif
+
 class Util {
  public:
   static void parseArgs(int argc,
@@ -17,6 +23,17 @@ class Util {
                         bool& use_sora,
                         int& log_level,
                         ConnectionSettings& cs);
+#if USE_ROS
+  // nh でトピック名を解決し、local_nh からパラメータを読む。
+  // nodelet の場合は getNodeHandle() と getPrivateNodeHandle() を渡す
+  static bool parseROSParams(const ros::NodeHandle& nh,
+                             const ros::NodeHandle& local_nh,
+                             bool& use_test,
+                             bool& use_ayame,
+                             bool& use_sora,
+                             int& log_level,
+                             ConnectionSettings& cs);
+#endif
   static std::string generateRandomChars();
   static std::string generateRandomChars(size_t length);
   static std::string generateRandomNumericChars(size_t length);
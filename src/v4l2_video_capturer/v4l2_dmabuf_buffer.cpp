@@ -0,0 +1,160 @@
+#include "v4l2_dmabuf_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+
+rtc::scoped_refptr<V4L2DmabufPool> V4L2DmabufPool::Create(int device_fd) {
+  return new rtc::RefCountedObject<V4L2DmabufPool>(device_fd);
+}
+
+V4L2DmabufPool::V4L2DmabufPool(int device_fd)
+    : device_fd_(device_fd), stopped_(false) {}
+
+V4L2DmabufPool::~V4L2DmabufPool() {
+  for (auto& slot : slots_) {
+    if (slot.release) {
+      slot.release();
+      continue;
+    }
+    if (slot.dmabuf_fd != -1) {
+      close(slot.dmabuf_fd);
+    }
+    if (slot.start != nullptr) {
+      munmap(slot.start, slot.length);
+    }
+  }
+}
+
+bool V4L2DmabufPool::Add(unsigned int index, void* start, size_t length) {
+  struct v4l2_exportbuffer expbuf;
+  memset(&expbuf, 0, sizeof(expbuf));
+  expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  expbuf.index = index;
+  expbuf.flags = O_CLOEXEC | O_RDWR;
+
+  {
+    rtc::CritScope lock(&crit_);
+    if (ioctl(device_fd_, VIDIOC_EXPBUF, &expbuf) < 0) {
+      RTC_LOG(LS_ERROR) << __FUNCTION__
+                        << " Failed to VIDIOC_EXPBUF. errno = " << errno;
+      return false;
+    }
+  }
+
+  if (slots_.size() <= index) {
+    slots_.resize(index + 1, Slot{nullptr, 0, -1, V4L2_MEMORY_MMAP, nullptr});
+  }
+  slots_[index] = Slot{start, length, expbuf.fd, V4L2_MEMORY_MMAP, nullptr};
+  return true;
+}
+
+void V4L2DmabufPool::AddMapped(unsigned int index,
+                               void* start,
+                               size_t length) {
+  if (slots_.size() <= index) {
+    slots_.resize(index + 1, Slot{nullptr, 0, -1, V4L2_MEMORY_MMAP, nullptr});
+  }
+  slots_[index] = Slot{start, length, -1, V4L2_MEMORY_MMAP, nullptr};
+}
+
+void V4L2DmabufPool::Import(unsigned int index,
+                            int dmabuf_fd,
+                            void* start,
+                            size_t length,
+                            std::function<void()> release) {
+  if (slots_.size() <= index) {
+    slots_.resize(index + 1, Slot{nullptr, 0, -1, V4L2_MEMORY_MMAP, nullptr});
+  }
+  slots_[index] =
+      Slot{start, length, dmabuf_fd, V4L2_MEMORY_DMABUF, std::move(release)};
+}
+
+void V4L2DmabufPool::CloseExported() {
+  for (auto& slot : slots_) {
+    if (!slot.release && slot.dmabuf_fd != -1) {
+      close(slot.dmabuf_fd);
+    }
+  }
+  slots_.clear();
+}
+
+void V4L2DmabufPool::Stop() {
+  rtc::CritScope lock(&crit_);
+  stopped_ = true;
+  device_fd_ = -1;
+}
+
+void V4L2DmabufPool::Queue(unsigned int index) {
+  rtc::CritScope lock(&crit_);
+  if (stopped_) {
+    return;
+  }
+
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = slots_[index].memory;
+  buf.index = index;
+  if (buf.memory == V4L2_MEMORY_DMABUF) {
+    buf.m.fd = slots_[index].dmabuf_fd;
+    buf.length = slots_[index].length;
+  }
+  if (ioctl(device_fd_, VIDIOC_QBUF, &buf) == -1) {
+    RTC_LOG(LS_ERROR) << __FUNCTION__ << " Failed to enqueue capture buffer";
+  }
+}
+
+uint8_t* V4L2DmabufPool::Data(unsigned int index) const {
+  return static_cast<uint8_t*>(slots_[index].start);
+}
+
+size_t V4L2DmabufPool::Length(unsigned int index) const {
+  return slots_[index].length;
+}
+
+int V4L2DmabufPool::DmabufFd(unsigned int index) const {
+  return slots_[index].dmabuf_fd;
+}
+
+rtc::scoped_refptr<V4L2DmabufBuffer> V4L2DmabufBuffer::Create(
+    rtc::scoped_refptr<V4L2DmabufPool> pool,
+    unsigned int index,
+    webrtc::VideoType video_type,
+    int width,
+    int height,
+    size_t bytesused) {
+  return new rtc::RefCountedObject<V4L2DmabufBuffer>(
+      pool, index, video_type, width, height, bytesused);
+}
+
+V4L2DmabufBuffer::V4L2DmabufBuffer(rtc::scoped_refptr<V4L2DmabufPool> pool,
+                                   unsigned int index,
+                                   webrtc::VideoType video_type,
+                                   int width,
+                                   int height,
+                                   size_t bytesused)
+    : NativeBuffer(video_type,
+                   width,
+                   height,
+                   pool->Data(index),
+                   pool->Length(index)),
+      pool_(pool),
+      index_(index) {
+  SetLength(bytesused);
+}
+
+V4L2DmabufBuffer::~V4L2DmabufBuffer() {
+  pool_->Queue(index_);
+}
+
+int V4L2DmabufBuffer::dmabuf_fd() const {
+  return pool_->DmabufFd(index_);
+}
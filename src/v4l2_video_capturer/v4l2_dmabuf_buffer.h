@@ -0,0 +1,100 @@
+#ifndef V4L2_DMABUF_BUFFER_H_
+#define V4L2_DMABUF_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+#include "api/scoped_refptr.h"
+#include "rtc/native_buffer.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/ref_count.h"
+
+// VIDIOC_EXPBUF でエクスポートした V4L2 のキャプチャバッファ、
+// または V4L2_MEMORY_DMABUF でインポートした dmabuf を管理するクラス。
+//
+// mmap した領域と dmabuf の fd は、このクラスの参照が全て無くなるまで解放しない。
+// そのため V4L2DmabufBuffer がエンコーダなどで保持されている間にキャプチャを停止しても安全に扱える。
+class V4L2DmabufPool : public rtc::RefCountInterface {
+ public:
+  static rtc::scoped_refptr<V4L2DmabufPool> Create(int device_fd);
+
+  // mmap 済みのバッファを登録して VIDIOC_EXPBUF を行う
+  bool Add(unsigned int index, void* start, size_t length);
+  // VIDIOC_EXPBUF せずに、mmap 済みのバッファを CPU から参照するためだけに登録する。
+  // DmabufFd() は -1 を返す
+  void AddMapped(unsigned int index, void* start, size_t length);
+  // V4L2_MEMORY_DMABUF で利用する、外部で確保した dmabuf を登録する。
+  // start は CPU からアクセスするためにマップ済みのアドレス。
+  // release はプールの破棄時に呼ばれるので、そこで dmabuf を解放すること。
+  void Import(unsigned int index,
+              int dmabuf_fd,
+              void* start,
+              size_t length,
+              std::function<void()> release);
+  // Add() に途中で失敗した場合に、まだ誰にも渡していないプールを捨てるために呼ぶ。
+  // エクスポートした fd だけを閉じ、mmap した領域は unmap せずに呼び出し元に返す。
+  void CloseExported();
+  // 以降のバッファ返却時に VIDIOC_QBUF しないようにする。
+  // デバイスの fd を close する前に必ず呼ぶこと。
+  void Stop();
+  // 指定したバッファを再度ドライバに queue する。
+  // 任意のスレッドから呼ばれる可能性がある。
+  void Queue(unsigned int index);
+
+  uint8_t* Data(unsigned int index) const;
+  size_t Length(unsigned int index) const;
+  int DmabufFd(unsigned int index) const;
+
+ protected:
+  explicit V4L2DmabufPool(int device_fd);
+  ~V4L2DmabufPool() override;
+
+ private:
+  struct Slot {
+    void* start;
+    size_t length;
+    int dmabuf_fd;
+    // V4L2_MEMORY_MMAP か V4L2_MEMORY_DMABUF
+    uint32_t memory;
+    // Import した場合のみ設定される
+    std::function<void()> release;
+  };
+
+  rtc::CriticalSection crit_;
+  int device_fd_ RTC_GUARDED_BY(crit_);
+  bool stopped_ RTC_GUARDED_BY(crit_);
+  std::vector<Slot> slots_;
+};
+
+// V4L2 のキャプチャバッファをコピーせずに参照する NativeBuffer。
+// 最後の参照が無くなった時点でバッファをドライバに返却する。
+class V4L2DmabufBuffer : public NativeBuffer {
+ public:
+  static rtc::scoped_refptr<V4L2DmabufBuffer> Create(
+      rtc::scoped_refptr<V4L2DmabufPool> pool,
+      unsigned int index,
+      webrtc::VideoType video_type,
+      int width,
+      int height,
+      size_t bytesused);
+
+  int dmabuf_fd() const override;
+
+ protected:
+  V4L2DmabufBuffer(rtc::scoped_refptr<V4L2DmabufPool> pool,
+                   unsigned int index,
+                   webrtc::VideoType video_type,
+                   int width,
+                   int height,
+                   size_t bytesused);
+  ~V4L2DmabufBuffer() override;
+
+ private:
+  const rtc::scoped_refptr<V4L2DmabufPool> pool_;
+  const unsigned int index_;
+};
+
+#endif  // V4L2_DMABUF_BUFFER_H_
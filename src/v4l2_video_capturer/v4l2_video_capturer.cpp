@@ -13,30 +13,87 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/videodev2.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <sys/select.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <fstream>
 #include <new>
 #include <string>
 
+#include <nlohmann/json.hpp>
+
 #include "api/scoped_refptr.h"
 #include "api/video/i420_buffer.h"
 #include "media/base/video_common.h"
 #include "modules/video_capture/video_capture.h"
 #include "modules/video_capture/video_capture_factory.h"
+#include "rtc/capture_pipeline.h"
+#include "rtc/frame_buffer_pool.h"
+#include "rtc/frame_tracer.h"
+#include "rtc/memory_accounting.h"
 #include "rtc/native_buffer.h"
+#include "rtc/thread_placement.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/ref_counted_object.h"
+#include "rtc_base/time_utils.h"
 #include "third_party/libyuv/include/libyuv.h"
 
+namespace {
+
+// ドライバのタイムスタンプがこれより古い場合は信用せずに今の時刻を使う
+const int64_t kMaxDriverTimestampDelayUs = rtc::kNumMicrosecsPerSec;
+
+// デバイスの bus_info と card を取得する
+bool QueryDevice(int fd, std::string* bus_info, std::string* card) {
+  struct v4l2_capability cap;
+  if (ioctl(fd, VIDIOC_QUERYCAP, &cap) != 0 || cap.bus_info[0] == 0) {
+    return false;
+  }
+  *bus_info = std::string((const char*)cap.bus_info);
+  *card = std::string((const char*)cap.card);
+  return true;
+}
+
+nlohmann::json LoadDeviceCache(const std::string& path) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    return nlohmann::json::object();
+  }
+  nlohmann::json cache = nlohmann::json::parse(ifs, nullptr, false);
+  if (cache.is_discarded() || !cache.is_object() ||
+      !cache["devices"].is_array()) {
+    RTC_LOG(LS_WARNING) << "Ignore invalid video device cache: " << path;
+    return nlohmann::json::object();
+  }
+  return cache;
+}
+
+}  // namespace
+
 rtc::scoped_refptr<V4L2VideoCapture> V4L2VideoCapture::Create(
     ConnectionSettings cs) {
   rtc::scoped_refptr<V4L2VideoCapture> capturer;
+  if (!cs.video_device_cache.empty()) {
+    // デバイスの列挙には時間がかかるので、前回使ったデバイスを先に試す
+    capturer = new rtc::RefCountedObject<V4L2VideoCapture>();
+    if (capturer->InitFromCache(cs) && capturer->StartCapture(cs) == 0) {
+      RTC_LOG(LS_INFO) << "Get Capture from cache";
+      if (cs.on_demand_capture || cs.low_power_idle) {
+        capturer->EnableOnDemand(cs.on_demand_linger_ms, cs.low_power_idle);
+      }
+      return capturer;
+    }
+    capturer = nullptr;
+  }
   std::unique_ptr<webrtc::VideoCaptureModule::DeviceInfo> device_info(
       webrtc::VideoCaptureFactory::CreateDeviceInfo());
   if (!device_info) {
@@ -50,6 +107,9 @@ rtc::scoped_refptr<V4L2VideoCapture> V4L2VideoCapture::Create(
     capturer = Create(device_info.get(), cs, i);
     if (capturer) {
       RTC_LOG(LS_INFO) << "Get Capture";
+      if (cs.on_demand_capture || cs.low_power_idle) {
+        capturer->EnableOnDemand(cs.on_demand_linger_ms, cs.low_power_idle);
+      }
       return capturer;
     }
   }
@@ -105,11 +165,17 @@ rtc::scoped_refptr<V4L2VideoCapture> V4L2VideoCapture::Create(
 
 V4L2VideoCapture::V4L2VideoCapture()
     : _deviceFd(-1),
+      _epollFd(-1),
+      _stopEventFd(-1),
+      _buffersRequested(4),
       _buffersAllocatedByDevice(-1),
+      _captureCpu(-1),
       _currentWidth(-1),
       _currentHeight(-1),
       _currentFrameRate(-1),
       _useNative(false),
+      _useDmabuf(false),
+      _memoryType(V4L2_MEMORY_MMAP),
       _captureStarted(false),
       _captureVideoType(webrtc::VideoType::kI420),
       _pool(NULL) {}
@@ -169,52 +235,122 @@ int32_t V4L2VideoCapture::Init(const char* deviceUniqueIdUTF8,
   return 0;
 }
 
-V4L2VideoCapture::~V4L2VideoCapture() {
-  StopCapture();
-  if (_deviceFd != -1)
-    close(_deviceFd);
-}
+bool V4L2VideoCapture::InitFromCache(const ConnectionSettings& cs) {
+  nlohmann::json cache = LoadDeviceCache(cs.video_device_cache);
+  if (!cache.is_object() || !cache.contains("devices")) {
+    return false;
+  }
+  // 先頭が前回使ったデバイス
+  for (const nlohmann::json& device : cache["devices"]) {
+    try {
+      std::string path = device.at("device").get<std::string>();
+      if (!cs.video_device.empty() && path != cs.video_device) {
+        continue;
+      }
+      // 追加のカメラとして指定されているデバイスは使わない
+      if (std::find(cs.additional_video_devices.begin(),
+                    cs.additional_video_devices.end(),
+                    path) != cs.additional_video_devices.end()) {
+        continue;
+      }
+      // 抜き差しでデバイスのパスが変わっていないか確認する
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd == -1) {
+        continue;
+      }
+      std::string bus_info;
+      std::string card;
+      bool found = QueryDevice(fd, &bus_info, &card) &&
+                   bus_info == device.at("bus_info").get<std::string>() &&
+                   card == device.at("card").get<std::string>();
+      close(fd);
+      if (!found) {
+        RTC_LOG(LS_INFO) << "Cached video device is changed: " << path;
+        continue;
+      }
 
-int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
-  auto size = cs.getSize();
-  if (_captureStarted) {
-    if (size.width == _currentWidth && size.height == _currentHeight) {
-      return 0;
-    } else {
-      StopCapture();
+      _captureFormats.clear();
+      for (const nlohmann::json& f : device.at("formats")) {
+        CaptureFormat format;
+        format.pixelformat = f.at("pixelformat").get<uint32_t>();
+        format.width = f.at("width").get<uint32_t>();
+        format.height = f.at("height").get<uint32_t>();
+        format.max_fps = f.at("max_fps").get<double>();
+        _captureFormats.push_back(format);
+      }
+      if (_captureFormats.empty()) {
+        continue;
+      }
+      _videoDevice = path;
+      RTC_LOG(LS_INFO) << "Use cached video device: " << path
+                       << " bus_info=" << bus_info;
+      return true;
+    } catch (const nlohmann::json::exception& e) {
+      RTC_LOG(LS_WARNING) << "Ignore invalid video device cache entry: "
+                          << e.what();
     }
   }
+  return false;
+}
 
-  rtc::CritScope critScope(&_captureCritSect);
-  // first open /dev/video device
-  if ((_deviceFd = open(_videoDevice.c_str(), O_RDWR | O_NONBLOCK, 0)) < 0) {
-    RTC_LOG(LS_INFO) << "error in opening " << _videoDevice
-                     << " errono = " << errno;
-    return -1;
+void V4L2VideoCapture::SaveDeviceCache(const std::string& path) {
+  std::string bus_info;
+  std::string card;
+  if (!QueryDevice(_deviceFd, &bus_info, &card)) {
+    return;
+  }
+  nlohmann::json formats = nlohmann::json::array();
+  for (const CaptureFormat& format : _captureFormats) {
+    formats.push_back({{"pixelformat", format.pixelformat},
+                       {"width", format.width},
+                       {"height", format.height},
+                       {"max_fps", format.max_fps}});
   }
 
-  // Supported video formats in preferred order.
-  // If the requested resolution is larger than VGA, we prefer MJPEG. Go for
-  // I420 otherwise.
-  const int nFormats = 5;
-  unsigned int fmts[nFormats];
-  if (!cs.force_i420 && (size.width > 640 || size.height > 480)) {
-    fmts[0] = V4L2_PIX_FMT_MJPEG;
-    fmts[1] = V4L2_PIX_FMT_YUV420;
-    fmts[2] = V4L2_PIX_FMT_YUYV;
-    fmts[3] = V4L2_PIX_FMT_UYVY;
-    fmts[4] = V4L2_PIX_FMT_JPEG;
-  } else {
-    fmts[0] = V4L2_PIX_FMT_YUV420;
-    fmts[1] = V4L2_PIX_FMT_YUYV;
-    fmts[2] = V4L2_PIX_FMT_UYVY;
-    fmts[3] = V4L2_PIX_FMT_MJPEG;
-    fmts[4] = V4L2_PIX_FMT_JPEG;
+  // 同じデバイスの古いエントリを消して先頭に追加する
+  nlohmann::json cache = LoadDeviceCache(path);
+  nlohmann::json devices = nlohmann::json::array();
+  devices.push_back({{"device", _videoDevice},
+                     {"bus_info", bus_info},
+                     {"card", card},
+                     {"formats", formats}});
+  if (cache.contains("devices")) {
+    for (const nlohmann::json& device : cache["devices"]) {
+      if (device.value("bus_info", "") != bus_info) {
+        devices.push_back(device);
+      }
+    }
   }
+  cache["devices"] = devices;
+
+  // 書き込み途中で落ちても壊れたファイルが残らないように、別のファイルに書いてから置き換える
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream ofs(tmp_path);
+    if (!ofs) {
+      RTC_LOG(LS_WARNING) << "Failed to write video device cache: " << path;
+      return;
+    }
+    ofs << cache.dump(2);
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    RTC_LOG(LS_WARNING) << "Failed to rename video device cache. errno = "
+                        << errno;
+  }
+}
+
+V4L2VideoCapture::~V4L2VideoCapture() {
+  // キャプチャを始めたり止めたりするスレッドを先に止める
+  _onDemand.reset();
+  StopCapture();
+  if (_deviceFd != -1)
+    close(_deviceFd);
+}
+
+void V4L2VideoCapture::ProbeCaptureFormats() {
+  _captureFormats.clear();
 
-  // Enumerate image formats.
   struct v4l2_fmtdesc fmt;
-  int fmtsIdx = nFormats;
   memset(&fmt, 0, sizeof(fmt));
   fmt.index = 0;
   fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -223,22 +359,206 @@ int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
     RTC_LOG(LS_INFO) << "  { pixelformat = "
                      << cricket::GetFourccName(fmt.pixelformat)
                      << ", description = '" << fmt.description << "' }";
-    // Match the preferred order.
-    for (int i = 0; i < nFormats; i++) {
-      if (fmt.pixelformat == fmts[i] && i < fmtsIdx)
-        fmtsIdx = i;
+
+    struct v4l2_frmsizeenum frmsize;
+    memset(&frmsize, 0, sizeof(frmsize));
+    frmsize.pixel_format = fmt.pixelformat;
+    bool size_found = false;
+    while (ioctl(_deviceFd, VIDIOC_ENUM_FRAMESIZES, &frmsize) == 0) {
+      if (frmsize.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+        break;
+      }
+      CaptureFormat format;
+      format.pixelformat = fmt.pixelformat;
+      format.width = frmsize.discrete.width;
+      format.height = frmsize.discrete.height;
+      format.max_fps = 0;
+
+      struct v4l2_frmivalenum frmival;
+      memset(&frmival, 0, sizeof(frmival));
+      frmival.pixel_format = fmt.pixelformat;
+      frmival.width = format.width;
+      frmival.height = format.height;
+      while (ioctl(_deviceFd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival) == 0) {
+        const struct v4l2_fract& interval =
+            frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE ? frmival.discrete
+                                                       : frmival.stepwise.min;
+        if (interval.numerator != 0) {
+          format.max_fps =
+              std::max(format.max_fps, static_cast<double>(interval.denominator) /
+                                           interval.numerator);
+        }
+        if (frmival.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+          break;
+        }
+        frmival.index++;
+      }
+      RTC_LOG(LS_VERBOSE) << "    " << format.width << "x" << format.height
+                          << " max_fps=" << format.max_fps;
+      _captureFormats.push_back(format);
+      size_found = true;
+      frmsize.index++;
+    }
+    if (!size_found) {
+      // サイズを列挙できない場合は任意のサイズに対応しているとみなす
+      CaptureFormat format;
+      format.pixelformat = fmt.pixelformat;
+      format.width = 0;
+      format.height = 0;
+      format.max_fps = 0;
+      _captureFormats.push_back(format);
     }
     // Keep enumerating.
     fmt.index++;
   }
+}
 
-  if (fmtsIdx == nFormats) {
-    RTC_LOG(LS_INFO) << "no supporting video formats found";
-    return -1;
+int V4L2VideoCapture::ConversionCost(uint32_t pixelformat,
+                                     const ConnectionSettings& cs) {
+  if (cs.use_native) {
+    // ハードウェアでデコードやリサイズをするので MJPEG が一番軽く、USB の帯域も使わない。
+    // UYVY はネイティブバッファにできないのでソフトウェアで変換する
+    switch (pixelformat) {
+      case V4L2_PIX_FMT_MJPEG:
+      case V4L2_PIX_FMT_JPEG:
+        return 0;
+      case V4L2_PIX_FMT_NV12:
+      case V4L2_PIX_FMT_YUV420:
+        return 1;
+      case V4L2_PIX_FMT_YUYV:
+        return 2;
+      case V4L2_PIX_FMT_UYVY:
+        return 3;
+    }
   } else {
-    RTC_LOG(LS_INFO) << "We prefer format "
-                     << cricket::GetFourccName(fmts[fmtsIdx]);
+    // I420 はそのまま、YUYV などは 1 回の変換で済むが、MJPEG はソフトウェアでデコードする
+    switch (pixelformat) {
+      case V4L2_PIX_FMT_YUV420:
+        return 0;
+      case V4L2_PIX_FMT_NV12:
+        return 1;
+      case V4L2_PIX_FMT_YUYV:
+        return 2;
+      case V4L2_PIX_FMT_UYVY:
+        return 2;
+      case V4L2_PIX_FMT_MJPEG:
+        return 4;
+      case V4L2_PIX_FMT_JPEG:
+        return 5;
+    }
+  }
+  return -1;
+}
+
+uint32_t V4L2VideoCapture::ChooseCaptureFormat(int width,
+                                               int height,
+                                               int framerate,
+                                               const ConnectionSettings& cs) {
+  // フレームレートを出せる形式の中で一番軽いもの、無ければ一番フレームレートが出るものを選ぶ
+  const CaptureFormat* best = nullptr;
+  int best_cost = 0;
+  bool best_fps_ok = false;
+  for (const CaptureFormat& format : _captureFormats) {
+    if (format.width != 0 && (format.width != static_cast<uint32_t>(width) ||
+                              format.height != static_cast<uint32_t>(height))) {
+      continue;
+    }
+    int cost = ConversionCost(format.pixelformat, cs);
+    if (cost < 0) {
+      continue;
+    }
+    if (cs.force_i420 && (format.pixelformat == V4L2_PIX_FMT_MJPEG ||
+                          format.pixelformat == V4L2_PIX_FMT_JPEG)) {
+      // 非圧縮の形式が無い場合だけ使う
+      cost += 100;
+    }
+    bool fps_ok = format.max_fps == 0 || format.max_fps >= framerate;
+    bool better;
+    if (best == nullptr) {
+      better = true;
+    } else if (fps_ok != best_fps_ok) {
+      better = fps_ok;
+    } else if (!fps_ok && format.max_fps != best->max_fps) {
+      better = format.max_fps > best->max_fps;
+    } else {
+      better = cost < best_cost;
+    }
+    if (better) {
+      best = &format;
+      best_cost = cost;
+      best_fps_ok = fps_ok;
+    }
+  }
+  return best != nullptr ? best->pixelformat : 0;
+}
+
+int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
+  _settings = cs;
+  auto size = cs.getSize();
+  if (_captureStarted) {
+    if (size.width == _currentWidth && size.height == _currentHeight) {
+      return 0;
+    } else {
+      // デバイスを開き直すと時間がかかるので、ストリームだけを止めて設定し直す
+      StopStreaming();
+    }
+  }
+
+  rtc::CritScope critScope(&_captureCritSect);
+  // first open /dev/video device
+  if (_deviceFd == -1) {
+    if ((_deviceFd = open(_videoDevice.c_str(), O_RDWR | O_NONBLOCK, 0)) < 0) {
+      RTC_LOG(LS_INFO) << "error in opening " << _videoDevice
+                       << " errono = " << errno;
+      return -1;
+    }
+    if (_captureFormats.empty()) {
+      ProbeCaptureFormats();
+      if (!cs.video_device_cache.empty()) {
+        SaveDeviceCache(cs.video_device_cache);
+      }
+    }
+  }
+
+  uint32_t pixelformat =
+      ChooseCaptureFormat(size.width, size.height, cs.framerate, cs);
+  if (pixelformat == 0) {
+    // このサイズを列挙していない場合は、以前と同じ優先順位で選ぶ。
+    // If the requested resolution is larger than VGA, we prefer MJPEG. Go for
+    // I420 otherwise.
+    const int nFormats = 6;
+    unsigned int fmts[nFormats];
+    if (!cs.force_i420 && (size.width > 640 || size.height > 480)) {
+      fmts[0] = V4L2_PIX_FMT_MJPEG;
+      fmts[1] = V4L2_PIX_FMT_YUV420;
+      fmts[2] = V4L2_PIX_FMT_NV12;
+      fmts[3] = V4L2_PIX_FMT_YUYV;
+      fmts[4] = V4L2_PIX_FMT_UYVY;
+      fmts[5] = V4L2_PIX_FMT_JPEG;
+    } else {
+      fmts[0] = V4L2_PIX_FMT_YUV420;
+      fmts[1] = V4L2_PIX_FMT_NV12;
+      fmts[2] = V4L2_PIX_FMT_YUYV;
+      fmts[3] = V4L2_PIX_FMT_UYVY;
+      fmts[4] = V4L2_PIX_FMT_MJPEG;
+      fmts[5] = V4L2_PIX_FMT_JPEG;
+    }
+    int fmtsIdx = nFormats;
+    for (const CaptureFormat& format : _captureFormats) {
+      for (int i = 0; i < fmtsIdx; i++) {
+        if (format.pixelformat == fmts[i]) {
+          fmtsIdx = i;
+          break;
+        }
+      }
+    }
+    if (fmtsIdx == nFormats) {
+      RTC_LOG(LS_INFO) << "no supporting video formats found";
+      return -1;
+    }
+    pixelformat = fmts[fmtsIdx];
   }
+  RTC_LOG(LS_INFO) << "We prefer format " << cricket::GetFourccName(pixelformat);
 
   struct v4l2_format video_fmt;
   memset(&video_fmt, 0, sizeof(struct v4l2_format));
@@ -246,7 +566,7 @@ int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
   video_fmt.fmt.pix.sizeimage = 0;
   video_fmt.fmt.pix.width = size.width;
   video_fmt.fmt.pix.height = size.height;
-  video_fmt.fmt.pix.pixelformat = fmts[fmtsIdx];
+  video_fmt.fmt.pix.pixelformat = pixelformat;
 
   if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV)
     _captureVideoType = webrtc::VideoType::kYUY2;
@@ -254,6 +574,8 @@ int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
     _captureVideoType = webrtc::VideoType::kI420;
   else if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_UYVY)
     _captureVideoType = webrtc::VideoType::kUYVY;
+  else if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_NV12)
+    _captureVideoType = webrtc::VideoType::kNV12;
   else if (video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG ||
            video_fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_JPEG)
     _captureVideoType = webrtc::VideoType::kMJPEG;
@@ -304,13 +626,55 @@ int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
     }
   }
 
+  if (_deviceFlip && !SetDeviceFlip(true)) {
+    RTC_LOG(LS_WARNING) << "Failed to flip " << _videoDevice;
+  }
+
+  // ネイティブバッファを使う場合のみ、ドライバのバッファをそのまま下流に渡す
+  _useDmabuf =
+      cs.use_dmabuf && cs.use_native && CanPassDmabuf(_captureVideoType);
+  _passMapped = cs.use_native && CanPassMappedBuffer(_captureVideoType);
+  _i420Converter = I420Converter(_captureVideoType);
+  _buffersRequested = cs.v4l2_buffers;
+
   if (!AllocateVideoBuffers()) {
     RTC_LOG(LS_INFO) << "failed to allocate video capture buffers";
     return -1;
   }
 
+  if (!CreateEventFds()) {
+    RTC_LOG(LS_INFO) << "failed to create event fds for capture thread";
+    return -1;
+  }
+
+  if (cs.mjpeg_decoder_threads > 1 && !cs.use_native &&
+      _captureVideoType == webrtc::VideoType::kMJPEG) {
+    _mjpegDecoder.reset(new ParallelMJPEGDecoder(
+        cs.mjpeg_decoder_threads,
+        [this](rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+               int64_t timestamp_us) { DeliverFrame(buffer, timestamp_us); }));
+  }
+
+  // ネイティブバッファの場合は変換しないのでパイプラインは不要
+  if (cs.capture_pipeline && !cs.use_native) {
+    // キャプチャスレッドが DQBUF できるように、ドライバに最低 1 つはバッファを残しておく
+    size_t queue_size = std::max(1, _buffersAllocatedByDevice - 2);
+    rtc::CritScope pipelineScope(&_pipelineCritSect);
+    _pipeline.reset(new CapturePipeline(
+        queue_size,
+        [this](const CapturePipeline::Item& item) {
+          return ConvertCapturedBuffer(item.data, item.size);
+        },
+        [this](const CapturePipeline::Item& item) { QueueBuffer(item.index); },
+        [this](const CapturePipeline::Item& item) {
+          DeliverFrame(item.buffer, item.timestamp_us);
+        }));
+    _pipeline->Start();
+  }
+
   // start capture thread;
   if (!_captureThread) {
+    _captureCpu = cs.capture_cpu;
     quit_ = false;
     _captureThread.reset(
         new rtc::PlatformThread(V4L2VideoCapture::CaptureThread, this,
@@ -331,32 +695,226 @@ int32_t V4L2VideoCapture::StartCapture(ConnectionSettings cs) {
   return 0;
 }
 
+bool V4L2VideoCapture::GetPipelineStats(CapturePipeline::StageStats* convert,
+                                        CapturePipeline::StageStats* deliver) {
+  rtc::CritScope pipelineScope(&_pipelineCritSect);
+  if (!_pipeline) {
+    return false;
+  }
+  _pipeline->GetTotalStats(convert, deliver);
+  return true;
+}
+
+bool V4L2VideoCapture::Restart() {
+  std::lock_guard<std::mutex> lock(_restartMtx);
+  if (_onDemand && _onDemand->IsPaused()) {
+    // 止めている間に開き直すと、キャプチャが動き出してしまう
+    return true;
+  }
+  RTC_LOG(LS_WARNING) << "Reopening " << _videoDevice;
+  StopCapture();
+  if (StartCapture(_settings) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to reopen " << _videoDevice;
+    // 途中まで開いたものは閉じておき、次に呼ばれた時に最初からやり直す
+    StopCapture();
+    return false;
+  }
+  return true;
+}
+
+webrtc::VideoRotation V4L2VideoCapture::ApplyDeviceRotation(
+    webrtc::VideoRotation rotation) {
+  std::lock_guard<std::mutex> lock(_restartMtx);
+  // 90 度と 270 度は縦横が入れ替わるので、デバイスでは回転できない
+  if (rotation != webrtc::kVideoRotation_180 || _deviceFd < 0 ||
+      !SetDeviceFlip(true)) {
+    return rotation;
+  }
+  _deviceFlip = true;
+  return webrtc::kVideoRotation_0;
+}
+
+bool V4L2VideoCapture::SetDeviceFlip(bool flip) {
+  struct v4l2_control control;
+  memset(&control, 0, sizeof(control));
+  control.id = V4L2_CID_HFLIP;
+  control.value = flip ? 1 : 0;
+  if (ioctl(_deviceFd, VIDIOC_S_CTRL, &control) < 0) {
+    RTC_LOG(LS_INFO) << "V4L2_CID_HFLIP is not supported. errno=" << errno;
+    return false;
+  }
+  control.id = V4L2_CID_VFLIP;
+  if (ioctl(_deviceFd, VIDIOC_S_CTRL, &control) < 0) {
+    RTC_LOG(LS_INFO) << "V4L2_CID_VFLIP is not supported. errno=" << errno;
+    // 片方だけ反転した状態にはしない
+    control.id = V4L2_CID_HFLIP;
+    control.value = flip ? 0 : 1;
+    ioctl(_deviceFd, VIDIOC_S_CTRL, &control);
+    return false;
+  }
+  return true;
+}
+
+void V4L2VideoCapture::EnableOnDemand(int linger_ms, bool release_on_idle) {
+  _onDemand.reset(new OnDemandCapture(
+      linger_ms,
+      [this]() {
+        std::lock_guard<std::mutex> lock(_restartMtx);
+        const int64_t start_ms = rtc::TimeMillis();
+        if (StartCapture(_settings) < 0) {
+          StopStreaming();
+          return false;
+        }
+        RTC_LOG(LS_INFO) << "Resumed " << _videoDevice << " in "
+                         << rtc::TimeMillis() - start_ms << " ms";
+        return true;
+      },
+      [this, release_on_idle]() {
+        std::lock_guard<std::mutex> lock(_restartMtx);
+        StopStreaming();
+        if (release_on_idle) {
+          ReleaseIdleResources();
+          // 他のカメラが使っているバッファは参照が無くなるまで残る
+          FrameBufferPool::Instance().Release();
+          RTC_LOG(LS_INFO) << "Released idle resources of " << _videoDevice;
+        }
+      }));
+}
+
+void V4L2VideoCapture::AddOrUpdateSink(
+    rtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+    const rtc::VideoSinkWants& wants) {
+  ScalableVideoTrackSource::AddOrUpdateSink(sink, wants);
+  if (_onDemand) {
+    _onDemand->AddSink(sink);
+  }
+}
+
+void V4L2VideoCapture::RemoveSink(
+    rtc::VideoSinkInterface<webrtc::VideoFrame>* sink) {
+  ScalableVideoTrackSource::RemoveSink(sink);
+  if (_onDemand) {
+    _onDemand->RemoveSink(sink);
+  }
+}
+
+bool V4L2VideoCapture::IsCapturePaused() {
+  return _onDemand && _onDemand->IsPaused();
+}
+
 int32_t V4L2VideoCapture::StopCapture() {
+  StopStreaming();
+
+  rtc::CritScope cs(&_captureCritSect);
+  if (_deviceFd != -1) {
+    close(_deviceFd);
+    _deviceFd = -1;
+  }
+  return 0;
+}
+
+void V4L2VideoCapture::StopStreaming() {
   if (_captureThread) {
     {
       rtc::CritScope cs(&_captureCritSect);
       quit_ = true;
     }
+    // epoll_wait で待っているキャプチャスレッドを起こす
+    if (_stopEventFd != -1) {
+      uint64_t value = 1;
+      if (write(_stopEventFd, &value, sizeof(value)) < 0) {
+        RTC_LOG(LS_WARNING) << "Failed to write eventfd. errno = " << errno;
+      }
+    }
     // Make sure the capture thread stop stop using the critsect.
     _captureThread->Stop();
     _captureThread.reset();
   }
 
+  // キャプチャスレッドが止まってからパイプラインを止める
+  if (_pipeline) {
+    _pipeline->Stop();
+    rtc::CritScope pipelineScope(&_pipelineCritSect);
+    _pipeline.reset();
+  }
+  _mjpegDecoder.reset();
+
   rtc::CritScope cs(&_captureCritSect);
   if (_captureStarted) {
     _captureStarted = false;
 
+    uint32_t memory_type = _memoryType;
     DeAllocateVideoBuffers();
-    close(_deviceFd);
-    _deviceFd = -1;
+    // 別のサイズで VIDIOC_S_FMT できるように、ドライバのバッファも解放する
+    struct v4l2_requestbuffers rbuffer;
+    memset(&rbuffer, 0, sizeof(rbuffer));
+    rbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    rbuffer.memory = memory_type;
+    rbuffer.count = 0;
+    if (ioctl(_deviceFd, VIDIOC_REQBUFS, &rbuffer) < 0) {
+      RTC_LOG(LS_INFO) << "Failed to release capture buffers. errno = "
+                       << errno;
+    }
   }
+  CloseEventFds();
+}
 
-  return 0;
+bool V4L2VideoCapture::CreateEventFds() {
+  CloseEventFds();
+
+  _stopEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (_stopEventFd < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to eventfd. errno = " << errno;
+    return false;
+  }
+  _epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (_epollFd < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to epoll_create1. errno = " << errno;
+    CloseEventFds();
+    return false;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = _deviceFd;
+  if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, _deviceFd, &ev) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to add device fd to epoll. errno = "
+                      << errno;
+    CloseEventFds();
+    return false;
+  }
+  ev.data.fd = _stopEventFd;
+  if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, _stopEventFd, &ev) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to add eventfd to epoll. errno = " << errno;
+    CloseEventFds();
+    return false;
+  }
+  return true;
+}
+
+void V4L2VideoCapture::CloseEventFds() {
+  if (_epollFd != -1) {
+    close(_epollFd);
+    _epollFd = -1;
+  }
+  if (_stopEventFd != -1) {
+    close(_stopEventFd);
+    _stopEventFd = -1;
+  }
+}
+
+bool V4L2VideoCapture::CanPassDmabuf(webrtc::VideoType video_type) {
+  // YUYV は NV12 に変換してから渡すので、ドライバのバッファは渡さない
+  return video_type != webrtc::VideoType::kYUY2;
 }
 
 bool V4L2VideoCapture::useNativeBuffer() {
+  // YUYV は I420 ではなく NV12 のネイティブバッファに変換して渡す
   return _useNative && (_captureVideoType == webrtc::VideoType::kMJPEG ||
-                        _captureVideoType == webrtc::VideoType::kI420);
+                        _captureVideoType == webrtc::VideoType::kI420 ||
+                        _captureVideoType == webrtc::VideoType::kNV12 ||
+                        _captureVideoType == webrtc::VideoType::kYUY2);
 }
 
 // critical section protected by the caller
@@ -367,15 +925,16 @@ bool V4L2VideoCapture::AllocateVideoBuffers() {
 
   rbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   rbuffer.memory = V4L2_MEMORY_MMAP;
-  rbuffer.count = kNoOfV4L2Bufffers;
+  rbuffer.count = _buffersRequested;
 
   if (ioctl(_deviceFd, VIDIOC_REQBUFS, &rbuffer) < 0) {
     RTC_LOG(LS_INFO) << "Could not get buffers from device. errno = " << errno;
     return false;
   }
 
-  if (rbuffer.count > kNoOfV4L2Bufffers)
-    rbuffer.count = kNoOfV4L2Bufffers;
+  if (rbuffer.count > static_cast<uint32_t>(_buffersRequested))
+    rbuffer.count = _buffersRequested;
+  RTC_LOG(LS_INFO) << "Allocated " << rbuffer.count << " capture buffers";
 
   _buffersAllocatedByDevice = rbuffer.count;
 
@@ -408,15 +967,49 @@ bool V4L2VideoCapture::AllocateVideoBuffers() {
       return false;
     }
   }
+  for (unsigned int i = 0; i < rbuffer.count; i++) {
+    _poolBytes += _pool[i].length;
+  }
+  MemoryAccounting::Instance().Add(MemoryAccounting::kCapture, _poolBytes);
+
+  if (_useDmabuf) {
+    // mmap した領域の解放はプールに任せる
+    _dmabufPool = V4L2DmabufPool::Create(_deviceFd);
+    for (unsigned int i = 0; i < rbuffer.count; i++) {
+      if (!_dmabufPool->Add(i, _pool[i].start, _pool[i].length)) {
+        RTC_LOG(LS_WARNING) << "VIDIOC_EXPBUF is not supported. "
+                               "Fallback to copying capture buffers";
+        // mmap した領域はまだ _pool で使うので、プールには unmap させない
+        _dmabufPool->CloseExported();
+        _dmabufPool = nullptr;
+        break;
+      }
+    }
+  }
+  if (!_dmabufPool && _passMapped) {
+    _dmabufPool = V4L2DmabufPool::Create(_deviceFd);
+    for (unsigned int i = 0; i < rbuffer.count; i++) {
+      _dmabufPool->AddMapped(i, _pool[i].start, _pool[i].length);
+    }
+  }
   return true;
 }
 
 bool V4L2VideoCapture::DeAllocateVideoBuffers() {
-  // unmap buffers
-  for (int i = 0; i < _buffersAllocatedByDevice; i++)
-    munmap(_pool[i].start, _pool[i].length);
+  _memoryType = V4L2_MEMORY_MMAP;
+  if (_dmabufPool) {
+    // 使用中のバッファがあるかもしれないので、unmap はプールの破棄時に行う
+    _dmabufPool->Stop();
+    _dmabufPool = nullptr;
+  } else {
+    // unmap buffers
+    for (int i = 0; i < _buffersAllocatedByDevice; i++)
+      munmap(_pool[i].start, _pool[i].length);
+  }
 
   delete[] _pool;
+  MemoryAccounting::Instance().Add(MemoryAccounting::kCapture, -_poolBytes);
+  _poolBytes = 0;
 
   // turn off stream
   enum v4l2_buf_type type;
@@ -430,34 +1023,61 @@ bool V4L2VideoCapture::DeAllocateVideoBuffers() {
 
 void V4L2VideoCapture::CaptureThread(void* obj) {
   V4L2VideoCapture* capture = static_cast<V4L2VideoCapture*>(obj);
+  ThreadPlacement::Instance().Apply("capture");
+  // カメラ毎に指定された CPU があれば、--thread-placement の設定より優先する
+  if (capture->_captureCpu >= 0) {
+    // 複数のカメラを使う場合に、キャプチャスレッド同士が同じ CPU を取り合わないようにする
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(capture->_captureCpu, &cpu_set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (err != 0) {
+      RTC_LOG(LS_WARNING) << "Failed to pin capture thread to CPU "
+                          << capture->_captureCpu << ". error = " << err;
+    } else {
+      RTC_LOG(LS_INFO) << "Pinned capture thread to CPU "
+                       << capture->_captureCpu;
+    }
+  }
   while (capture->CaptureProcess()) {
   }
 }
 
 bool V4L2VideoCapture::CaptureProcess() {
-  int retVal = 0;
-  fd_set rSet;
-  struct timeval timeout;
-
-  FD_ZERO(&rSet);
-  FD_SET(_deviceFd, &rSet);
-  timeout.tv_sec = 1;
-  timeout.tv_usec = 0;
-
-  // _deviceFd written only in StartCapture, when this thread isn't running.
-  retVal = select(_deviceFd + 1, &rSet, NULL, NULL, &timeout);
-  if (retVal < 0 && errno != EINTR)  // continue if interrupted
-  {
-    // select failed
-    return false;
-  } else if (retVal == 0) {
-    // select timed out
-    return true;
-  } else if (!FD_ISSET(_deviceFd, &rSet)) {
-    // not event on camera handle
+  struct epoll_event events[2];
+
+  // _deviceFd と _epollFd は StartCapture の中でしか書き換えないので、
+  // このスレッドが動いている間はロック無しで読んで良い
+  int n = epoll_wait(_epollFd, events, 2, -1);
+  if (n < 0) {
+    // continue if interrupted
+    return errno == EINTR;
+  }
+
+  bool readable = false;
+  for (int i = 0; i < n; i++) {
+    if (events[i].data.fd == _stopEventFd) {
+      // StopCapture から起こされた
+      return false;
+    }
+    if (events[i].data.fd != _deviceFd) {
+      continue;
+    }
+    // デバイスが抜かれた場合などは EPOLLIN にならないまま返り続けるので、ここで止める
+    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+      RTC_LOG(LS_ERROR) << "Capture device error or disconnected: "
+                        << _videoDevice;
+      return false;
+    }
+    if (events[i].events & EPOLLIN) {
+      readable = true;
+    }
+  }
+  if (!readable) {
     return true;
   }
 
+  struct v4l2_buffer buf;
   {
     rtc::CritScope cs(&_captureCritSect);
 
@@ -465,73 +1085,170 @@ bool V4L2VideoCapture::CaptureProcess() {
       return false;
     }
 
-    if (_captureStarted) {
-      struct v4l2_buffer buf;
-      memset(&buf, 0, sizeof(struct v4l2_buffer));
-      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory = V4L2_MEMORY_MMAP;
-      // dequeue a buffer - repeat until dequeued properly!
-      while (ioctl(_deviceFd, VIDIOC_DQBUF, &buf) < 0) {
-        if (errno != EINTR) {
-          RTC_LOG(LS_INFO) << "could not sync on a buffer on device "
-                           << strerror(errno);
-          return true;
-        }
-      }
+    if (!_captureStarted) {
+      return true;
+    }
 
-      if (!OnCaptured(buf)) {
-        // enqueue the buffer again
-        if (ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
-          RTC_LOG(LS_INFO) << __FUNCTION__
-                           << " Failed to enqueue capture buffer";
-        }
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = _memoryType;
+    // dequeue a buffer - repeat until dequeued properly!
+    while (ioctl(_deviceFd, VIDIOC_DQBUF, &buf) < 0) {
+      if (errno != EINTR) {
+        RTC_LOG(LS_INFO) << "could not sync on a buffer on device "
+                         << strerror(errno);
+        return true;
       }
     }
   }
-  usleep(0);
+  FrameTracer::Instance().Instant("v4l2.dequeue", buf.sequence);
+
+  // 変換やエンコーダへの受け渡しはロックを持たずに行う。
+  // バッファの解放はこのスレッドを止めてから行うので、ここで触っても問題ない。
+  if (!OnCaptured(buf)) {
+    // enqueue the buffer again
+    if (ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
+      RTC_LOG(LS_INFO) << __FUNCTION__ << " Failed to enqueue capture buffer";
+    }
+  }
   return true;
 }
 
 bool V4L2VideoCapture::OnCaptured(struct v4l2_buffer& buf) {
+  TraceScope trace("v4l2.OnCaptured", buf.sequence);
+  // どうせ捨てられるフレームは変換せずにドライバへ返す
+  if (ShouldSkipFrame()) {
+    return false;
+  }
+  const int64_t timestamp_us = CaptureTimestampUs(buf);
+
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> dst_buffer = nullptr;
-  if (useNativeBuffer()) {
+  bool requeue = true;
+  if (useNativeBuffer() && _dmabufPool) {
+    // バッファの返却は V4L2DmabufBuffer の破棄時に行われる
+    dst_buffer = V4L2DmabufBuffer::Create(_dmabufPool, buf.index,
+                                          _captureVideoType, _currentWidth,
+                                          _currentHeight, buf.bytesused);
+    requeue = false;
+  } else if (useNativeBuffer() &&
+             _captureVideoType == webrtc::VideoType::kYUY2) {
     rtc::scoped_refptr<NativeBuffer> native_buffer(
-        NativeBuffer::Create(_captureVideoType, _currentWidth, _currentHeight));
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            webrtc::VideoType::kNV12, _currentWidth, _currentHeight));
+    libyuv::YUY2ToNV12((const uint8_t*)_pool[buf.index].start,
+                       _currentWidth * 2, native_buffer->MutableDataY(),
+                       native_buffer->StrideY(),
+                       native_buffer->MutableDataUV(),
+                       native_buffer->StrideUV(), _currentWidth,
+                       _currentHeight);
+    native_buffer->SetLength(_currentWidth * _currentHeight * 3 / 2);
+    dst_buffer = native_buffer;
+  } else if (useNativeBuffer()) {
+    rtc::scoped_refptr<NativeBuffer> native_buffer(
+        FrameBufferPool::Instance().CreateNativeBuffer(
+            _captureVideoType, _currentWidth, _currentHeight));
     memcpy(native_buffer->MutableData(), (unsigned char*)_pool[buf.index].start,
            buf.bytesused);
     native_buffer->SetLength(buf.bytesused);
     dst_buffer = native_buffer;
+  } else if (_mjpegDecoder) {
+    // 圧縮データはコピーされるので、バッファはすぐにドライバへ返却して良い
+    _mjpegDecoder->Decode((const uint8_t*)_pool[buf.index].start,
+                          buf.bytesused, _currentWidth, _currentHeight,
+                          timestamp_us);
+  } else if (_pipeline) {
+    // 変換と配信はパイプラインの別スレッドで行う。
+    // バッファの返却は変換が終わった時点で行われる。
+    CapturePipeline::Item item;
+    item.index = buf.index;
+    item.data = (const uint8_t*)_pool[buf.index].start;
+    item.size = buf.bytesused;
+    item.timestamp_us = timestamp_us;
+    _pipeline->Push(std::move(item));
+    return true;
   } else {
-    rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
-        webrtc::I420Buffer::Create(_currentWidth, _currentHeight));
-    i420_buffer->InitializeData();
-    if (libyuv::ConvertToI420(
-            (unsigned char*)_pool[buf.index].start, buf.bytesused,
-            i420_buffer.get()->MutableDataY(), i420_buffer.get()->StrideY(),
-            i420_buffer.get()->MutableDataU(), i420_buffer.get()->StrideU(),
-            i420_buffer.get()->MutableDataV(), i420_buffer.get()->StrideV(), 0,
-            0, _currentWidth, _currentHeight, _currentWidth, _currentHeight,
-            libyuv::kRotate0, ConvertVideoType(_captureVideoType)) < 0) {
-      RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
-    } else {
-      dst_buffer = i420_buffer;
-    }
+    dst_buffer = ConvertCapturedBuffer((const uint8_t*)_pool[buf.index].start,
+                                       buf.bytesused);
   }
 
   if (dst_buffer) {
-    webrtc::VideoFrame video_frame = webrtc::VideoFrame::Builder()
-                                         .set_video_frame_buffer(dst_buffer)
-                                         .set_timestamp_rtp(0)
-                                         .set_timestamp_ms(rtc::TimeMillis())
-                                         .set_timestamp_us(rtc::TimeMicros())
-                                         .set_rotation(webrtc::kVideoRotation_0)
-                                         .build();
-    OnCapturedFrame(video_frame);
+    DeliverFrame(dst_buffer, timestamp_us);
   }
 
   // enqueue the buffer again
+  if (requeue && ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
+    RTC_LOG(LS_ERROR) << "Failed to enqueue capture buffer";
+  }
+  return true;
+}
+
+int64_t V4L2VideoCapture::CaptureTimestampUs(const struct v4l2_buffer& buf) {
+  const int64_t now_us = rtc::TimeMicros();
+  if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+      V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+    return now_us;
+  }
+  // rtc::TimeMicros() も CLOCK_MONOTONIC なので、そのまま比べられる。
+  // 未来の時刻や古すぎる時刻を返すドライバでは使わない
+  const int64_t timestamp_us =
+      buf.timestamp.tv_sec * rtc::kNumMicrosecsPerSec + buf.timestamp.tv_usec;
+  if (timestamp_us <= 0 || timestamp_us > now_us ||
+      now_us - timestamp_us > kMaxDriverTimestampDelayUs) {
+    if (_driverTimestamp) {
+      RTC_LOG(LS_WARNING) << "Ignore invalid driver timestamp: "
+                          << timestamp_us << " now: " << now_us;
+      _driverTimestamp = false;
+    }
+    return now_us;
+  }
+  if (!_driverTimestamp) {
+    RTC_LOG(LS_INFO) << "Use driver timestamps, "
+                     << (now_us - timestamp_us) << "us before dequeue";
+    _driverTimestamp = true;
+  }
+  return timestamp_us;
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer>
+V4L2VideoCapture::ConvertCapturedBuffer(const uint8_t* data, size_t size) {
+  TraceScope trace("v4l2.convert", 0);
+  rtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
+      FrameBufferPool::Instance().CreateI420Buffer(_currentWidth,
+                                                   _currentHeight));
+  if (!_i420Converter.Convert(data, size, _currentWidth, _currentHeight,
+                              i420_buffer.get())) {
+    RTC_LOG(LS_ERROR) << "ConvertToI420 Failed";
+    return nullptr;
+  }
+  return i420_buffer;
+}
+
+void V4L2VideoCapture::DeliverFrame(
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+    int64_t timestamp_us) {
+  webrtc::VideoFrame video_frame =
+      webrtc::VideoFrame::Builder()
+          .set_video_frame_buffer(buffer)
+          .set_timestamp_rtp(0)
+          .set_timestamp_ms(timestamp_us / rtc::kNumMicrosecsPerMillisec)
+          .set_timestamp_us(timestamp_us)
+          .set_rotation(webrtc::kVideoRotation_0)
+          .build();
+  OnCapturedFrame(video_frame);
+}
+
+void V4L2VideoCapture::QueueBuffer(int index) {
+  if (_dmabufPool) {
+    // V4L2_MEMORY_DMABUF の場合は fd も指定する必要があるのでプールに任せる
+    _dmabufPool->Queue(index);
+    return;
+  }
+  struct v4l2_buffer buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = index;
   if (ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
     RTC_LOG(LS_INFO) << "Failed to enqueue capture buffer";
   }
-  return true;
 }
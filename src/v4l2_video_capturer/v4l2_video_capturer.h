@@ -15,8 +15,15 @@
 #include <stdint.h>
 
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "connection_settings.h"
+#include "rtc/capture_pipeline.h"
+#include "rtc/i420_converter.h"
+#include "rtc/on_demand_capture.h"
+#include "rtc/parallel_mjpeg_decoder.h"
+#include "v4l2_dmabuf_buffer.h"
 #include "modules/video_capture/video_capture_defines.h"
 #include "modules/video_capture/video_capture_impl.h"
 #include "rtc/scalable_track_source.h"
@@ -33,10 +40,26 @@ class V4L2VideoCapture : public ScalableVideoTrackSource {
 
   int32_t Init(const char* deviceUniqueId,
                const std::string& specifiedVideoDevice);
+  // cs.video_device_cache に保存されているデバイスとキャプチャ形式を使う。
+  // 保存されていなかったり、デバイスが変わっている場合は false を返す
+  bool InitFromCache(const ConnectionSettings& cs);
   virtual int32_t StartCapture(ConnectionSettings cs);
   virtual int32_t StopCapture();
   virtual bool useNativeBuffer() override;
   virtual bool OnCaptured(struct v4l2_buffer& buf);
+  bool GetPipelineStats(CapturePipeline::StageStats* convert,
+                        CapturePipeline::StageStats* deliver) override;
+  // デバイスを閉じて、最後に StartCapture() した設定で開き直す
+  bool Restart() override;
+  // シンクが付いている間だけキャプチャするようにする (--on-demand-capture)。
+  // 止めている間もデバイスは開いたままにして、キャプチャ形式も調べ直さない。
+  // release_on_idle の場合は、止めている間 ReleaseIdleResources() で解放したものと
+  // FrameBufferPool も解放する (--low-power-idle)
+  void EnableOnDemand(int linger_ms, bool release_on_idle);
+  void AddOrUpdateSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+                       const rtc::VideoSinkWants& wants) override;
+  void RemoveSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink) override;
+  bool IsCapturePaused() override;
 
  protected:
   int32_t _deviceFd;
@@ -44,11 +67,51 @@ class V4L2VideoCapture : public ScalableVideoTrackSource {
   int32_t _currentHeight;
   int32_t _currentFrameRate;
   webrtc::VideoType _captureVideoType;
+  // _captureVideoType から I420 への変換。StartCapture() で選ぶ
+  I420Converter _i420Converter;
   struct Buffer {
     void* start;
     size_t length;
   };
   Buffer* _pool;
+  // MemoryAccounting に計上している _pool の大きさ
+  int64_t _poolBytes = 0;
+  // use_dmabuf の場合に、キャプチャバッファを所有するプール
+  rtc::scoped_refptr<V4L2DmabufPool> _dmabufPool;
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> ConvertCapturedBuffer(
+      const uint8_t* data,
+      size_t size);
+  void DeliverFrame(rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+                    int64_t timestamp_us);
+  // ドライバがフレームを取り込んだ時刻 (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)。
+  // 取得できない場合は今の時刻を返す。rtc の時計とのずれは timestamp_aligner_ が吸収する
+  int64_t CaptureTimestampUs(const struct v4l2_buffer& buf);
+  void QueueBuffer(int index);
+
+  // キャプチャバッファの確保と解放。_captureCritSect を持った状態で呼ばれる。
+  virtual bool AllocateVideoBuffers();
+  virtual bool DeAllocateVideoBuffers();
+  // use_dmabuf の場合に、この形式のキャプチャバッファを下流に直接渡して良いか
+  virtual bool CanPassDmabuf(webrtc::VideoType video_type);
+  // use_native の場合に、この形式のキャプチャバッファを変換もコピーもせずに
+  // 下流に参照で渡して良いか。エンコーダが自分の入力バッファに直接変換できる場合に true を返す
+  virtual bool CanPassMappedBuffer(webrtc::VideoType video_type) {
+    return false;
+  }
+  // --low-power-idle でキャプチャを止めた時に呼ばれる。キャプチャスレッドは止まっている。
+  // 次の StartCapture() か最初のフレームで作り直せるものを解放すること
+  virtual void ReleaseIdleResources() {}
+
+  int32_t _buffersRequested;
+  int32_t _buffersAllocatedByDevice;
+  bool _useDmabuf;
+  // dmabuf を使わない場合も、mmap したキャプチャバッファを参照で渡す
+  bool _passMapped = false;
+  // VIDIOC_DQBUF で指定するメモリの種類
+  uint32_t _memoryType;
+  // 直前のフレームでドライバのタイムスタンプを使った。切り替わった時だけログを出す
+  bool _driverTimestamp = false;
 
  private:
   static rtc::scoped_refptr<V4L2VideoCapture> Create(
@@ -57,22 +120,72 @@ class V4L2VideoCapture : public ScalableVideoTrackSource {
       size_t capture_device_index);
   bool FindDevice(const char* deviceUniqueIdUTF8, const std::string& device);
 
-  enum { kNoOfV4L2Bufffers = 4 };
+  // デバイスが対応しているキャプチャ形式
+  struct CaptureFormat {
+    uint32_t pixelformat;
+    // 0 の場合は任意のサイズに対応している (V4L2_FRMSIZE_TYPE_STEPWISE など)
+    uint32_t width;
+    uint32_t height;
+    // このサイズで出せる最大のフレームレート。分からない場合は 0
+    double max_fps;
+  };
+  // VIDIOC_ENUM_FMT / VIDIOC_ENUM_FRAMESIZES / VIDIOC_ENUM_FRAMEINTERVALS で
+  // 対応しているキャプチャ形式を調べておく
+  void ProbeCaptureFormats();
+  // 指定した解像度とフレームレートを出せる形式の中から、変換が一番軽いものを選ぶ。
+  // 見つからない場合は 0 を返す
+  uint32_t ChooseCaptureFormat(int width,
+                               int height,
+                               int framerate,
+                               const ConnectionSettings& cs);
+  // pixelformat を変換して下流に渡す時のコスト。小さい方が軽い
+  int ConversionCost(uint32_t pixelformat, const ConnectionSettings& cs);
+  // キャプチャを止めてバッファを解放する。デバイスは閉じない
+  void StopStreaming();
+  // 調べたキャプチャ形式を path に保存する
+  void SaveDeviceCache(const std::string& path);
 
-  bool AllocateVideoBuffers();
-  bool DeAllocateVideoBuffers();
   static void CaptureThread(void*);
   bool CaptureProcess();
+  bool CreateEventFds();
+  void CloseEventFds();
 
   // TODO(pbos): Stop using unique_ptr and resetting the thread.
   std::unique_ptr<rtc::PlatformThread> _captureThread;
+  // キャプチャスレッドを割り当てる CPU。-1 の場合は割り当てない
+  int _captureCpu;
   rtc::CriticalSection _captureCritSect;
   bool quit_ RTC_GUARDED_BY(_captureCritSect);
   std::string _videoDevice;
+  // デバイスを開いた時に調べたキャプチャ形式。解像度を変える時はこれを使って選び直す
+  std::vector<CaptureFormat> _captureFormats;
+
+  // epoll で _deviceFd と _stopEventFd を監視する
+  int _epollFd;
+  // キャプチャスレッドを止めるための eventfd
+  int _stopEventFd;
+
+  // capture_pipeline の場合に、変換と配信を別スレッドで行う
+  std::unique_ptr<CapturePipeline> _pipeline;
+  // _pipeline の生成と破棄を、統計情報を取得するスレッドから守る
+  rtc::CriticalSection _pipelineCritSect;
+  // mjpeg_decoder_threads が 2 以上の場合に、MJPEG を並列でデコードする
+  std::unique_ptr<ParallelMJPEGDecoder> _mjpegDecoder;
 
-  int32_t _buffersAllocatedByDevice;
   bool _useNative;
   bool _captureStarted;
+  // Restart() で使う、最後に StartCapture() した設定
+  ConnectionSettings _settings;
+  // Restart() と、_onDemand によるキャプチャの開始と停止が重ならないようにする
+  std::mutex _restartMtx;
+  std::unique_ptr<OnDemandCapture> _onDemand;
+
+  webrtc::VideoRotation ApplyDeviceRotation(
+      webrtc::VideoRotation rotation) override;
+  // V4L2_CID_HFLIP と V4L2_CID_VFLIP で 180 度回転させる
+  bool SetDeviceFlip(bool flip);
+  // 180 度の回転をデバイスで行っている。開き直した時にも設定し直す
+  bool _deviceFlip = false;
 };
 
 #endif  // V4L2_VIDEO_CAPTURE_H_
@@ -0,0 +1,150 @@
+#include "dns_cache.h"
+
+#include <boost/asio/post.hpp>
+
+#include "rtc_base/logging.h"
+
+constexpr int DnsCache::kMaxStaleSec;
+
+// io_context が破棄される時に、その io_context で結果を待っている callback を取り除く。
+// 破棄された io_context に post しないようにするため
+class DnsCache::ContextService
+    : public boost::asio::execution_context::service {
+ public:
+  static boost::asio::execution_context::id id;
+
+  explicit ContextService(boost::asio::execution_context& context)
+      : boost::asio::execution_context::service(context) {}
+
+ private:
+  void shutdown() override {
+    DnsCache::Instance().OnContextShutdown(&context());
+  }
+};
+
+boost::asio::execution_context::id DnsCache::ContextService::id;
+
+DnsCache& DnsCache::Instance() {
+  static DnsCache instance;
+  return instance;
+}
+
+DnsCache::~DnsCache() {
+  if (resolver_thread_.joinable()) {
+    resolver_work_.reset();
+    resolver_ioc_->stop();
+    resolver_thread_.join();
+  }
+}
+
+void DnsCache::SetTtl(int ttl_sec) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ttl_sec_ = ttl_sec;
+}
+
+void DnsCache::Resolve(boost::asio::io_context& ioc,
+                       const std::string& host,
+                       const std::string& port,
+                       callback_t callback) {
+  boost::asio::use_service<ContextService>(ioc);
+
+  const std::string key = host + ":" + port;
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry& entry = entries_[key];
+
+  if (!entry.results.empty() &&
+      now < entry.expires_at + std::chrono::seconds(kMaxStaleSec)) {
+    if (entry.expires_at <= now && !entry.resolving) {
+      // 古い結果を返しつつ、裏でルックアップし直す
+      RTC_LOG(LS_INFO) << __FUNCTION__ << ": revalidate " << key;
+      StartLookup(key, host, port);
+    }
+    boost::asio::post(ioc, std::bind(callback, boost::system::error_code(),
+                                     entry.results, true));
+    return;
+  }
+
+  entry.waiters.push_back(Waiter{&ioc, std::move(callback)});
+  if (!entry.resolving) {
+    StartLookup(key, host, port);
+  }
+}
+
+void DnsCache::Invalidate(const std::string& host, const std::string& port) {
+  const std::string key = host + ":" + port;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << key;
+  it->second.results = results_type();
+}
+
+void DnsCache::StartLookup(const std::string& key,
+                           const std::string& host,
+                           const std::string& port) {
+  entries_[key].resolving = true;
+
+  if (!resolver_ioc_) {
+    resolver_ioc_.reset(new boost::asio::io_context(1));
+    resolver_work_.reset(new boost::asio::executor_work_guard<
+                         boost::asio::io_context::executor_type>(
+        resolver_ioc_->get_executor()));
+    resolver_thread_ = std::thread([this]() { resolver_ioc_->run(); });
+  }
+
+  auto resolver =
+      std::make_shared<boost::asio::ip::tcp::resolver>(*resolver_ioc_);
+  resolver->async_resolve(
+      host, port,
+      [this, key, resolver](boost::system::error_code ec,
+                            results_type results) {
+        OnLookup(key, ec, std::move(results));
+      });
+}
+
+void DnsCache::OnLookup(const std::string& key,
+                        boost::system::error_code ec,
+                        results_type results) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry& entry = entries_[key];
+  entry.resolving = false;
+
+  if (ec) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": " << key
+                        << " failed: " << ec.message();
+  } else if (ttl_sec_ > 0) {
+    entry.results = results;
+    entry.expires_at =
+        std::chrono::steady_clock::now() + std::chrono::seconds(ttl_sec_);
+  }
+
+  // 待っていた要求には、失敗した場合も含めてこのルックアップの結果を返す。
+  // ContextService::shutdown() と競合しないように、ロックを持ったまま post する
+  for (auto& waiter : entry.waiters) {
+    boost::asio::post(*waiter.ioc,
+                      std::bind(waiter.callback, ec, results, false));
+  }
+  entry.waiters.clear();
+}
+
+void DnsCache::OnContextShutdown(boost::asio::execution_context* context) {
+  // callback が持っているオブジェクトの破棄でこのクラスが呼ばれても良いように、ロックの外で破棄する
+  std::vector<Waiter> removed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& kv : entries_) {
+      auto& waiters = kv.second.waiters;
+      for (auto it = waiters.begin(); it != waiters.end();) {
+        if (static_cast<boost::asio::execution_context*>(it->ioc) == context) {
+          removed.push_back(std::move(*it));
+          it = waiters.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef WS_DNS_CACHE_H_
+#define WS_DNS_CACHE_H_
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// シグナリングクライアントで共有する DNS ルックアップのキャッシュ。
+//
+// TTL 内であればキャッシュした結果をすぐに返す。TTL を過ぎていても一定時間内であれば
+// 古い結果をすぐに返しつつ、裏でルックアップし直す (stale-while-revalidate)。
+// 同じホストへのルックアップが同時に要求された場合は 1 回のルックアップにまとめる。
+//
+// ゲートウェイモードではセッション毎に別の io_context のスレッドから呼ばれるので、
+// キャッシュはロックで守り、ルックアップはどのセッションにも依存しない専用のスレッドで行う。
+// 結果は要求した io_context に post するので、callback は要求した側のスレッドで呼ばれる。
+class DnsCache {
+ public:
+  typedef boost::asio::ip::tcp::resolver::results_type results_type;
+  // from_cache はルックアップせずにキャッシュした結果を返した場合 true
+  typedef std::function<
+      void(boost::system::error_code ec, results_type results, bool from_cache)>
+      callback_t;
+
+  static DnsCache& Instance();
+
+  // 0 の場合はキャッシュしない
+  void SetTtl(int ttl_sec);
+
+  // 任意のスレッドから呼んで良い。callback は必ず ioc 経由で呼ばれる。
+  // 結果を待っている間に ioc が破棄された場合、callback は呼ばれずに破棄される
+  void Resolve(boost::asio::io_context& ioc,
+               const std::string& host,
+               const std::string& port,
+               callback_t callback);
+  // キャッシュした結果に繋がらなかった場合に呼ぶ
+  void Invalidate(const std::string& host, const std::string& port);
+
+ private:
+  // io_context の破棄を知るためのサービス
+  class ContextService;
+
+  DnsCache() = default;
+  ~DnsCache();
+  // mutex_ を持った状態で呼ぶこと
+  void StartLookup(const std::string& key,
+                   const std::string& host,
+                   const std::string& port);
+  void OnLookup(const std::string& key,
+                boost::system::error_code ec,
+                results_type results);
+  void OnContextShutdown(boost::asio::execution_context* context);
+
+  struct Waiter {
+    boost::asio::io_context* ioc;
+    callback_t callback;
+  };
+  struct Entry {
+    results_type results;
+    std::chrono::steady_clock::time_point expires_at;
+    bool resolving = false;
+    std::vector<Waiter> waiters;
+  };
+
+  // TTL を過ぎた結果を返して良い時間
+  static constexpr int kMaxStaleSec = 24 * 60 * 60;
+
+  std::mutex mutex_;
+  int ttl_sec_ = 60;
+  std::map<std::string, Entry> entries_;
+
+  // ルックアップ用のスレッド。最初のルックアップで作る
+  std::unique_ptr<boost::asio::io_context> resolver_ioc_;
+  std::unique_ptr<
+      boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>
+      resolver_work_;
+  std::thread resolver_thread_;
+};
+
+#endif  // WS_DNS_CACHE_H_
@@ -0,0 +1,121 @@
+#include "happy_eyeballs_connector.h"
+
+#include <boost/asio/connect.hpp>
+#include <chrono>
+
+#include "rtc_base/logging.h"
+
+constexpr int HappyEyeballsConnector::kConnectionAttemptDelayMs;
+
+std::shared_ptr<HappyEyeballsConnector> HappyEyeballsConnector::Connect(
+    boost::asio::io_context& ioc,
+    const boost::asio::ip::tcp::resolver::results_type& results,
+    callback_t callback) {
+  auto connector =
+      std::make_shared<HappyEyeballsConnector>(ioc, std::move(callback));
+  connector->Start(results);
+  return connector;
+}
+
+HappyEyeballsConnector::HappyEyeballsConnector(boost::asio::io_context& ioc,
+                                               callback_t callback)
+    : timer_(ioc),
+      callback_(std::move(callback)),
+      attempts_{Attempt(ioc), Attempt(ioc)},
+      last_error_(boost::asio::error::host_not_found) {}
+
+void HappyEyeballsConnector::Cancel() {
+  callback_ = nullptr;
+  timer_.cancel();
+  for (auto& attempt : attempts_) {
+    boost::system::error_code ec;
+    attempt.socket.close(ec);
+  }
+}
+
+void HappyEyeballsConnector::Start(
+    const boost::asio::ip::tcp::resolver::results_type& results) {
+  // 先頭のアドレスと同じファミリーを 0 番目、それ以外を 1 番目にする
+  bool first_is_v6 = false;
+  bool first = true;
+  for (const auto& entry : results) {
+    const auto& endpoint = entry.endpoint();
+    if (first) {
+      first_is_v6 = endpoint.address().is_v6();
+      first = false;
+    }
+    int index = endpoint.address().is_v6() == first_is_v6 ? 0 : 1;
+    attempts_[index].endpoints.push_back(endpoint);
+  }
+
+  StartAttempt(0);
+  if (attempts_[1].endpoints.empty()) {
+    return;
+  }
+
+  auto self = shared_from_this();
+  timer_.expires_after(std::chrono::milliseconds(kConnectionAttemptDelayMs));
+  timer_.async_wait([self](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      return;
+    }
+    self->StartAttempt(1);
+  });
+}
+
+void HappyEyeballsConnector::StartAttempt(int index) {
+  Attempt& attempt = attempts_[index];
+  if (attempt.started || !callback_) {
+    return;
+  }
+  attempt.started = true;
+  if (attempt.endpoints.empty()) {
+    attempt.finished = true;
+    OnConnect(index, boost::asio::error::host_not_found);
+    return;
+  }
+
+  auto self = shared_from_this();
+  boost::asio::async_connect(
+      attempt.socket, attempt.endpoints.begin(), attempt.endpoints.end(),
+      [self, index](boost::system::error_code ec,
+                    std::vector<boost::asio::ip::tcp::endpoint>::iterator) {
+        self->attempts_[index].finished = true;
+        self->OnConnect(index, ec);
+      });
+}
+
+void HappyEyeballsConnector::OnConnect(int index,
+                                       boost::system::error_code ec) {
+  if (!callback_) {
+    return;
+  }
+
+  if (!ec) {
+    RTC_LOG(LS_INFO) << __FUNCTION__ << ": connected with "
+                     << (index == 0 ? "first" : "second") << " family";
+    Finish(boost::system::error_code(), std::move(attempts_[index].socket));
+    return;
+  }
+
+  last_error_ = ec;
+  Attempt& other = attempts_[1 - index];
+  if (!other.endpoints.empty() && !other.started) {
+    // 待たずにもう一方のファミリーへの接続を始める
+    timer_.cancel();
+    StartAttempt(1 - index);
+    return;
+  }
+  if (other.started && !other.finished) {
+    return;
+  }
+  Finish(last_error_, std::move(attempts_[index].socket));
+}
+
+void HappyEyeballsConnector::Finish(boost::system::error_code ec,
+                                    boost::asio::ip::tcp::socket socket) {
+  auto callback = std::move(callback_);
+  callback_ = nullptr;
+  Cancel();
+  callback(ec, std::move(socket));
+}
@@ -0,0 +1,57 @@
+#ifndef WS_HAPPY_EYEBALLS_CONNECTOR_H_
+#define WS_HAPPY_EYEBALLS_CONNECTOR_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// DNS ルックアップの結果に IPv6 と IPv4 の両方のアドレスがある場合に、
+// 先頭のアドレスと同じファミリーから接続を始め、少し待っても繋がらなければ
+// もう一方のファミリーへの接続も並行して始めるクラス (Happy Eyeballs, RFC 8305)。
+//
+// 先に繋がったソケットを callback に渡し、もう一方の接続はキャンセルする。
+// io_context は 1 スレッドで回していること。
+class HappyEyeballsConnector
+    : public std::enable_shared_from_this<HappyEyeballsConnector> {
+ public:
+  typedef std::function<void(boost::system::error_code ec,
+                             boost::asio::ip::tcp::socket socket)>
+      callback_t;
+
+  static std::shared_ptr<HappyEyeballsConnector> Connect(
+      boost::asio::io_context& ioc,
+      const boost::asio::ip::tcp::resolver::results_type& results,
+      callback_t callback);
+
+  HappyEyeballsConnector(boost::asio::io_context& ioc, callback_t callback);
+
+  // 以降は callback を呼ばない
+  void Cancel();
+
+ private:
+  struct Attempt {
+    explicit Attempt(boost::asio::io_context& ioc) : socket(ioc) {}
+    boost::asio::ip::tcp::socket socket;
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+    bool started = false;
+    bool finished = false;
+  };
+
+  void Start(const boost::asio::ip::tcp::resolver::results_type& results);
+  void StartAttempt(int index);
+  void OnConnect(int index, boost::system::error_code ec);
+  void Finish(boost::system::error_code ec, boost::asio::ip::tcp::socket socket);
+
+  // 2 つ目のファミリーへの接続を始めるまでの時間
+  static constexpr int kConnectionAttemptDelayMs = 250;
+
+  boost::asio::steady_timer timer_;
+  callback_t callback_;
+  Attempt attempts_[2];
+  boost::system::error_code last_error_;
+};
+
+#endif  // WS_HAPPY_EYEBALLS_CONNECTOR_H_
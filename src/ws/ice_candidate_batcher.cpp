@@ -0,0 +1,105 @@
+#include "ice_candidate_batcher.h"
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
+#include <chrono>
+
+#include "rtc_base/logging.h"
+
+std::shared_ptr<IceCandidateBatcher> IceCandidateBatcher::Create(
+    boost::asio::io_context& ioc,
+    int window_ms,
+    int max_candidates,
+    flush_callback_t callback) {
+  if (window_ms <= 0) {
+    return nullptr;
+  }
+  return std::make_shared<IceCandidateBatcher>(ioc, window_ms, max_candidates,
+                                               std::move(callback));
+}
+
+IceCandidateBatcher::IceCandidateBatcher(boost::asio::io_context& ioc,
+                                         int window_ms,
+                                         int max_candidates,
+                                         flush_callback_t callback)
+    : strand_(ioc.get_executor()),
+      timer_(ioc),
+      window_ms_(window_ms),
+      max_candidates_(max_candidates > 0 ? max_candidates : 1),
+      callback_(std::move(callback)) {
+  pending_.reserve(max_candidates_);
+}
+
+void IceCandidateBatcher::Add(std::string sdp_mid,
+                              int sdp_mlineindex,
+                              std::string sdp) {
+  bool flush = false;
+  bool start_timer = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!callback_) {
+      return;
+    }
+    pending_.push_back(
+        Candidate{std::move(sdp_mid), sdp_mlineindex, std::move(sdp)});
+    if (pending_.size() >= max_candidates_) {
+      flush = true;
+    } else if (!timer_started_) {
+      timer_started_ = true;
+      start_timer = true;
+    }
+  }
+  // タイマーは strand からしか触らない
+  auto self = shared_from_this();
+  if (flush) {
+    boost::asio::post(strand_, [self]() { self->Flush(); });
+  } else if (start_timer) {
+    boost::asio::post(strand_, [self]() { self->StartTimer(); });
+  }
+}
+
+void IceCandidateBatcher::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_.clear();
+}
+
+void IceCandidateBatcher::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    callback_ = nullptr;
+    pending_.clear();
+  }
+  // 待っているタイマーが自身を保持し続けないように止める
+  auto self = shared_from_this();
+  boost::asio::post(strand_, [self]() { self->timer_.cancel(); });
+}
+
+void IceCandidateBatcher::StartTimer() {
+  auto self = shared_from_this();
+  timer_.expires_after(std::chrono::milliseconds(window_ms_));
+  timer_.async_wait(boost::asio::bind_executor(
+      strand_, [self](const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+          return;
+        }
+        self->Flush();
+      }));
+}
+
+void IceCandidateBatcher::Flush() {
+  std::vector<Candidate> candidates;
+  flush_callback_t callback;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    candidates.swap(pending_);
+    pending_.reserve(max_candidates_);
+    timer_started_ = false;
+    callback = callback_;
+  }
+  timer_.cancel();
+  if (candidates.empty() || !callback) {
+    return;
+  }
+  RTC_LOG(LS_INFO) << __FUNCTION__ << ": candidates=" << candidates.size();
+  callback(std::move(candidates));
+}
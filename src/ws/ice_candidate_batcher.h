@@ -0,0 +1,65 @@
+#ifndef WS_ICE_CANDIDATE_BATCHER_H_
+#define WS_ICE_CANDIDATE_BATCHER_H_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// WebRTC のスレッドから 1 つずつ来るローカルの ICE candidate を溜めておき、
+// 一定時間経つか一定数溜まったら io_context のスレッドでまとめて flush するクラス。
+//
+// 接続毎に 1 つずつ送信するとスレッド間の受け渡しと送信処理が candidate の数だけ発生するので、
+// 多数の接続が同時に再接続した時にシグナリングの処理が詰まる。
+// Add() は任意のスレッドから呼んで良いが、callback は io_context のスレッドから呼ばれる。
+// --io-threads の HTTP サーバのように複数スレッドで回している io_context でも良いように、
+// タイマーと flush は strand で 1 つずつ処理する。
+class IceCandidateBatcher
+    : public std::enable_shared_from_this<IceCandidateBatcher> {
+ public:
+  struct Candidate {
+    std::string sdp_mid;
+    int sdp_mlineindex;
+    std::string sdp;
+  };
+  typedef std::function<void(std::vector<Candidate>)> flush_callback_t;
+
+  // window_ms が 0 以下の場合は nullptr を返す
+  static std::shared_ptr<IceCandidateBatcher> Create(
+      boost::asio::io_context& ioc,
+      int window_ms,
+      int max_candidates,
+      flush_callback_t callback);
+
+  IceCandidateBatcher(boost::asio::io_context& ioc,
+                      int window_ms,
+                      int max_candidates,
+                      flush_callback_t callback);
+
+  void Add(std::string sdp_mid, int sdp_mlineindex, std::string sdp);
+  // 溜まっている candidate を捨てる。再接続する時に呼ぶこと
+  void Clear();
+  // 以降は callback を呼ばない。callback が参照しているオブジェクトを破棄する前に呼ぶこと
+  void Stop();
+
+ private:
+  void StartTimer();
+  void Flush();
+
+  // timer_ は strand_ からしか触らない
+  boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+  boost::asio::steady_timer timer_;
+  const int window_ms_;
+  const size_t max_candidates_;
+
+  std::mutex mutex_;
+  flush_callback_t callback_;
+  std::vector<Candidate> pending_;
+  bool timer_started_ = false;
+};
+
+#endif  // WS_ICE_CANDIDATE_BATCHER_H_
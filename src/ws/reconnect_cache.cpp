@@ -0,0 +1,30 @@
+#include "reconnect_cache.h"
+
+#include "rtc_base/logging.h"
+
+void ReconnectCache::saveSession(SSL* ssl) {
+  SSL_SESSION* session = SSL_get1_session(ssl);
+  if (session == nullptr) {
+    return;
+  }
+  if (!SSL_SESSION_is_resumable(session)) {
+    SSL_SESSION_free(session);
+    return;
+  }
+  session_.reset(session, SSL_SESSION_free);
+}
+
+void ReconnectCache::applySession(SSL* ssl) const {
+  if (!session_) {
+    return;
+  }
+  // サーバがセッションの再開を受け付けなければ通常のハンドシェイクになるだけなので、
+  // 失敗しても接続は続ける
+  if (!SSL_set_session(ssl, session_.get())) {
+    RTC_LOG(LS_WARNING) << __FUNCTION__ << ": SSL_set_session failed";
+  }
+}
+
+void ReconnectCache::clearSession() {
+  session_.reset();
+}
@@ -0,0 +1,27 @@
+#ifndef WS_RECONNECT_CACHE_H_
+#define WS_RECONNECT_CACHE_H_
+
+#include <memory>
+
+// openssl
+#include <openssl/ssl.h>
+
+// シグナリングサーバへ再接続する時に、前回の接続で得た情報を使い回すためのクラス。
+//
+// TLS のセッションを覚えておいて、次の接続では TLS のハンドシェイクを
+// セッション再開 (session ticket) で済ませる。
+// DNS ルックアップの結果は DnsCache でキャッシュしている。
+// マルチスレッド下では動作しないので注意。
+class ReconnectCache {
+ public:
+  // 再開できるセッションであれば覚えておく。ハンドシェイクが終わった後の SSL を渡すこと
+  void saveSession(SSL* ssl);
+  // 覚えているセッションがあれば、ハンドシェイクの前に SSL に設定する
+  void applySession(SSL* ssl) const;
+  void clearSession();
+
+ private:
+  std::shared_ptr<SSL_SESSION> session_;
+};
+
+#endif  // WS_RECONNECT_CACHE_H_
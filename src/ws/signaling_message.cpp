@@ -0,0 +1,345 @@
+#include "signaling_message.h"
+
+#include <string.h>
+
+namespace {
+
+using json = nlohmann::json;
+
+// 最上位とその 1 段下のオブジェクトにある値だけを集める SAX のハンドラ。
+// 最上位の type が fast_types に含まれていなければ、そこで打ち切って false を返す
+class FieldCollector {
+ public:
+  FieldCollector(std::initializer_list<const char*> fast_types,
+                 std::string* type,
+                 std::vector<std::pair<std::string, json>>* fields)
+      : fast_types_(fast_types), type_(type), fields_(fields) {}
+
+  bool error() const { return error_; }
+
+  bool null() { return Value(nullptr); }
+  bool boolean(bool value) { return Value(value); }
+  bool number_integer(json::number_integer_t value) { return Value(value); }
+  bool number_unsigned(json::number_unsigned_t value) { return Value(value); }
+  bool number_float(json::number_float_t value, const json::string_t&) {
+    return Value(value);
+  }
+  bool string(json::string_t& value) {
+    if (levels_.size() == 1 && !levels_[0].array &&
+        levels_[0].key == "type") {
+      *type_ = value;
+      bool fast = false;
+      for (const char* t : fast_types_) {
+        if (value == t) {
+          fast = true;
+          break;
+        }
+      }
+      if (!fast) {
+        return false;
+      }
+    }
+    return Value(std::move(value));
+  }
+#if NLOHMANN_JSON_VERSION_MAJOR > 3 || \
+    (NLOHMANN_JSON_VERSION_MAJOR == 3 && NLOHMANN_JSON_VERSION_MINOR >= 8)
+  bool binary(json::binary_t&) { return true; }
+#endif
+
+  bool start_object(std::size_t) {
+    levels_.push_back(Level{false, std::string()});
+    return true;
+  }
+  bool key(json::string_t& key) {
+    levels_.back().key = std::move(key);
+    return true;
+  }
+  bool end_object() {
+    levels_.pop_back();
+    return true;
+  }
+  bool start_array(std::size_t) {
+    // 最上位が配列のメッセージは扱わない
+    if (levels_.empty()) {
+      return false;
+    }
+    levels_.push_back(Level{true, std::string()});
+    return true;
+  }
+  bool end_array() {
+    levels_.pop_back();
+    return true;
+  }
+  bool parse_error(std::size_t,
+                   const std::string&,
+                   const nlohmann::detail::exception&) {
+    error_ = true;
+    return false;
+  }
+
+ private:
+  struct Level {
+    bool array;
+    std::string key;
+  };
+
+  bool Value(json value) {
+    // 最上位がオブジェクトでないメッセージも扱わない
+    if (levels_.empty()) {
+      return false;
+    }
+    if (levels_.size() > 2 || levels_[0].array ||
+        (levels_.size() == 2 && levels_[1].array)) {
+      return true;
+    }
+    std::string name = levels_[0].key;
+    if (levels_.size() == 2) {
+      name += '.';
+      name += levels_[1].key;
+    }
+    fields_->emplace_back(std::move(name), std::move(value));
+    return true;
+  }
+
+  std::initializer_list<const char*> fast_types_;
+  std::string* type_;
+  std::vector<std::pair<std::string, json>>* fields_;
+  std::vector<Level> levels_;
+  bool error_ = false;
+};
+
+}  // namespace
+
+bool SignalingMessage::Parse(const std::string& text,
+                             std::initializer_list<const char*> fast_types) {
+  type_.clear();
+  json_ = nullptr;
+  fields_.clear();
+
+  FieldCollector collector(fast_types, &type_, &fields_);
+  bool ok = nlohmann::json::sax_parse(text, &collector);
+  if (collector.error()) {
+    return false;
+  }
+  if (ok && !type_.empty()) {
+    return true;
+  }
+
+  // type が無いか、fast_types 以外のメッセージ
+  fields_.clear();
+  json_ = nlohmann::json::parse(text, nullptr, false);
+  if (json_.is_discarded()) {
+    json_ = nullptr;
+    return false;
+  }
+  type_.clear();
+  if (json_.is_object()) {
+    auto it = json_.find("type");
+    if (it != json_.end() && it->is_string()) {
+      type_ = it->get<std::string>();
+    }
+  }
+  return true;
+}
+
+const nlohmann::json* SignalingMessage::Find(const std::string& name) const {
+  if (!json_.is_null()) {
+    const nlohmann::json* value = &json_;
+    size_t begin = 0;
+    while (true) {
+      if (!value->is_object()) {
+        return nullptr;
+      }
+      size_t end = name.find('.', begin);
+      auto it = value->find(name.substr(begin, end - begin));
+      if (it == value->end()) {
+        return nullptr;
+      }
+      value = &*it;
+      if (end == std::string::npos) {
+        return value;
+      }
+      begin = end + 1;
+    }
+  }
+  for (const auto& field : fields_) {
+    if (field.first == name) {
+      return &field.second;
+    }
+  }
+  return nullptr;
+}
+
+const nlohmann::json& SignalingMessage::Get(const std::string& name) const {
+  static const nlohmann::json null_value;
+  const nlohmann::json* v = Find(name);
+  return v != nullptr ? *v : null_value;
+}
+
+bool SignalingMessage::GetString(const std::string& name,
+                                 std::string* value) const {
+  const nlohmann::json* v = Find(name);
+  if (v == nullptr || !v->is_string()) {
+    return false;
+  }
+  *value = v->get_ref<const std::string&>();
+  return true;
+}
+
+bool SignalingMessage::GetInt(const std::string& name, int* value) const {
+  const nlohmann::json* v = Find(name);
+  if (v == nullptr || !v->is_number_integer()) {
+    return false;
+  }
+  *value = v->get<int>();
+  return true;
+}
+
+bool SignalingMessage::GetBool(const std::string& name,
+                               bool default_value) const {
+  const nlohmann::json* v = Find(name);
+  if (v == nullptr || !v->is_boolean()) {
+    return default_value;
+  }
+  return v->get<bool>();
+}
+
+SignalingWriter::SignalingWriter(const std::string& type, size_t reserve) {
+  out_.reserve(reserve + type.size());
+  out_ += "{\"type\":";
+  AppendString(&out_, type.data(), type.size());
+  closers_.push_back('}');
+}
+
+SignalingWriter& SignalingWriter::Add(const char* key,
+                                      const std::string& value) {
+  out_.reserve(out_.size() + strlen(key) + value.size() + 8);
+  AppendKey(key);
+  AppendString(&out_, value.data(), value.size());
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::Add(const char* key, const char* value) {
+  AppendKey(key);
+  AppendString(&out_, value, strlen(value));
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::Add(const char* key, int value) {
+  AppendKey(key);
+  out_ += std::to_string(value);
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::Add(const char* key, bool value) {
+  AppendKey(key);
+  out_ += value ? "true" : "false";
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::AddRaw(const char* key,
+                                         const std::string& json) {
+  out_.reserve(out_.size() + strlen(key) + json.size() + 4);
+  AppendKey(key);
+  out_ += json;
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::BeginObject(const char* key) {
+  AppendKey(key);
+  out_ += '{';
+  closers_.push_back('}');
+  first_ = true;
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::BeginArray(const char* key) {
+  AppendKey(key);
+  out_ += '[';
+  closers_.push_back(']');
+  first_ = true;
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::BeginObject() {
+  if (!first_) {
+    out_ += ',';
+  }
+  out_ += '{';
+  closers_.push_back('}');
+  first_ = true;
+  return *this;
+}
+
+SignalingWriter& SignalingWriter::End() {
+  if (!closers_.empty()) {
+    out_ += closers_.back();
+    closers_.pop_back();
+  }
+  first_ = false;
+  return *this;
+}
+
+std::string SignalingWriter::Finish() {
+  while (!closers_.empty()) {
+    End();
+  }
+  return std::move(out_);
+}
+
+void SignalingWriter::AppendKey(const char* key) {
+  if (!first_) {
+    out_ += ',';
+  }
+  first_ = false;
+  AppendString(&out_, key, strlen(key));
+  out_ += ':';
+}
+
+void SignalingWriter::AppendString(std::string* out,
+                                   const char* data,
+                                   size_t size) {
+  static const char kHex[] = "0123456789abcdef";
+  out->reserve(out->size() + size + 2);
+  out->push_back('"');
+  // エスケープが不要な部分はまとめて追加する
+  size_t begin = 0;
+  for (size_t i = 0; i < size; i++) {
+    const unsigned char c = static_cast<unsigned char>(data[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out->append(data + begin, i - begin);
+    begin = i + 1;
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      case '\b':
+        out->append("\\b");
+        break;
+      case '\f':
+        out->append("\\f");
+        break;
+      default:
+        out->append("\\u00");
+        out->push_back(kHex[c >> 4]);
+        out->push_back(kHex[c & 0xf]);
+        break;
+    }
+  }
+  out->append(data + begin, size - begin);
+  out->push_back('"');
+}
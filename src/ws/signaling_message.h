@@ -0,0 +1,89 @@
+#ifndef WS_SIGNALING_MESSAGE_H_
+#define WS_SIGNALING_MESSAGE_H_
+
+#include <initializer_list>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 受信したシグナリングのメッセージ。
+//
+// candidate や ping のように頻繁に届いて中身の小さいメッセージは、
+// nlohmann::json の DOM を作らずに SAX で最上位とその 1 段下の値だけを取り出す。
+// offer のようにそれ以外の type のメッセージは、type を読んだ所で打ち切って全体を nlohmann::json にパースする。
+// type が先頭にあれば、大きな SDP を 2 回読むことはない。
+class SignalingMessage {
+ public:
+  // fast_types に含まれる type のメッセージは値だけを取り出し、それ以外は json() にパースする。
+  // JSON として不正な場合は false を返す
+  bool Parse(const std::string& text,
+             std::initializer_list<const char*> fast_types);
+
+  // type が無い場合は空文字列
+  const std::string& type() const { return type_; }
+  // fast_types に含まれる type のメッセージでは null になる
+  nlohmann::json& json() { return json_; }
+
+  // 最上位とその 1 段下の値を返す。1 段下は "ice.sdpMid" のように . で繋いだ名前で引く。
+  // どちらの方法でパースした場合でも使える。見つからない場合は nullptr
+  const nlohmann::json* Find(const std::string& name) const;
+  // 見つからない場合は null を返す。ログに出す時などに使う
+  const nlohmann::json& Get(const std::string& name) const;
+  bool GetString(const std::string& name, std::string* value) const;
+  bool GetInt(const std::string& name, int* value) const;
+  bool GetBool(const std::string& name, bool default_value) const;
+
+ private:
+  std::string type_;
+  nlohmann::json json_;
+  // SAX で取り出した値。数が少ないので map にせず順に探す
+  std::vector<std::pair<std::string, nlohmann::json>> fields_;
+};
+
+// 送信するシグナリングのメッセージを、nlohmann::json を組み立てずに文字列へ直接書き出すクラス。
+//
+// SDP や candidate を一度 nlohmann::json にコピーしてから dump() するのを避ける。
+// 書き出したメッセージは Websocket の送信キューにそのまま渡すので、バッファは使い回さずに
+// 値の大きさに合わせて確保する。
+//
+//   std::string text = SignalingWriter("candidate")
+//                          .BeginObject("ice")
+//                          .Add("candidate", sdp)
+//                          .End()
+//                          .Finish();
+class SignalingWriter {
+ public:
+  // {"type":"<type>" を書き込んだ状態から始める
+  explicit SignalingWriter(const std::string& type, size_t reserve = 64);
+
+  SignalingWriter& Add(const char* key, const std::string& value);
+  SignalingWriter& Add(const char* key, const char* value);
+  SignalingWriter& Add(const char* key, int value);
+  SignalingWriter& Add(const char* key, bool value);
+  // 既に JSON になっている値をそのまま書き込む
+  SignalingWriter& AddRaw(const char* key, const std::string& json);
+
+  SignalingWriter& BeginObject(const char* key);
+  SignalingWriter& BeginArray(const char* key);
+  // 配列の要素としてオブジェクトを始める
+  SignalingWriter& BeginObject();
+  // 最後に始めたオブジェクトか配列を閉じる
+  SignalingWriter& End();
+
+  // 開いているオブジェクトと配列を全て閉じて、書き出した文字列を返す
+  std::string Finish();
+
+  // JSON の文字列としてエスケープして out に追加する
+  static void AppendString(std::string* out, const char* data, size_t size);
+
+ private:
+  void AppendKey(const char* key);
+
+  std::string out_;
+  // 閉じていないオブジェクトと配列の閉じ括弧
+  std::vector<char> closers_;
+  bool first_ = false;
+};
+
+#endif  // WS_SIGNALING_MESSAGE_H_
@@ -2,10 +2,11 @@
 
 #include <boost/asio/bind_executor.hpp>
 #include <boost/asio/post.hpp>
-#include <boost/beast/core/buffers_to_string.hpp>
 #include <boost/beast/websocket/stream.hpp>
 #include <utility>
 
+#include "rtc/memory_accounting.h"
+#include "rtc_base/logging.h"
 #include "util.h"
 
 Websocket::Websocket(boost::asio::io_context& ioc)
@@ -24,6 +25,10 @@ Websocket::Websocket(boost::asio::ip::tcp::socket socket)
 
 Websocket::~Websocket() {
   RTC_LOG(LS_INFO) << __FUNCTION__;
+  for (const auto& text : write_queue_) {
+    MemoryAccounting::Instance().Add(MemoryAccounting::kWebsocket,
+                                     -(int64_t)text.size());
+  }
 }
 
 bool Websocket::isSSL() const {
@@ -46,17 +51,19 @@ void Websocket::startToRead(read_callback_t on_read) {
 }
 
 void Websocket::doRead(read_callback_t on_read) {
-  RTC_LOG(LS_INFO) << __FUNCTION__;
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__;
 
+  read_text_.clear();
+  read_buffer_.emplace(boost::asio::dynamic_buffer(read_text_));
   if (isSSL()) {
     wss_->async_read(
-        read_buffer_,
+        *read_buffer_,
         boost::asio::bind_executor(
             strand_, std::bind(&Websocket::onRead, this, on_read,
                                std::placeholders::_1, std::placeholders::_2)));
   } else {
     ws_->async_read(
-        read_buffer_,
+        *read_buffer_,
         boost::asio::bind_executor(
             strand_, std::bind(&Websocket::onRead, this, on_read,
                                std::placeholders::_1, std::placeholders::_2)));
@@ -66,14 +73,12 @@ void Websocket::doRead(read_callback_t on_read) {
 void Websocket::onRead(read_callback_t on_read,
                        boost::system::error_code ec,
                        std::size_t bytes_transferred) {
-  RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << ec.message();
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": " << ec.message();
 
   // エラーだろうが何だろうが on_read コールバック関数は必ず呼ぶ
 
-  const auto text = boost::beast::buffers_to_string(read_buffer_.data());
-  read_buffer_.consume(read_buffer_.size());
-
-  on_read(ec, bytes_transferred, std::move(text));
+  read_buffer_.reset();
+  on_read(ec, bytes_transferred, std::move(read_text_));
 
   if (ec == boost::asio::error::operation_aborted)
     return;
@@ -85,59 +90,57 @@ void Websocket::onRead(read_callback_t on_read,
 }
 
 void Websocket::sendText(std::string text) {
-  RTC_LOG(LS_INFO) << __FUNCTION__;
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__;
   boost::asio::post(strand_,
                     std::bind(&Websocket::doSendText, this, std::move(text)));
 }
 
-void Websocket::doSendText(std::string text) {
-  RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << text;
-
-  bool empty = write_buffer_.empty();
-  boost::beast::flat_buffer buffer;
+void Websocket::sendTexts(std::vector<std::string> texts) {
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": count=" << texts.size();
+  boost::asio::post(strand_, std::bind(&Websocket::doSendTexts, this,
+                                       std::move(texts)));
+}
 
-  const auto n = boost::asio::buffer_copy(buffer.prepare(text.size()),
-                                          boost::asio::buffer(text));
-  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": n=" << n;
-  buffer.commit(n);
+void Websocket::doSendTexts(std::vector<std::string> texts) {
+  for (auto& text : texts) {
+    doSendText(std::move(text));
+  }
+}
 
-  {
-    std::string tmp = boost::beast::buffers_to_string(buffer.data());
-    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": size=" << tmp.size()
-                        << " text=" << tmp;
+void Websocket::doSendText(std::string text) {
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": size=" << text.size();
+  // RTC_LOG は無効なログレベルでも引数を評価するので、本文は必要な時だけ出力する
+  if (!rtc::LogMessage::IsNoop(rtc::LS_VERBOSE)) {
+    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": text=" << text;
   }
 
-  write_buffer_.push_back(std::move(buffer));
+  bool empty = write_queue_.empty();
+  MemoryAccounting::Instance().Add(MemoryAccounting::kWebsocket, text.size());
+  // コピーせずにそのまま送信キューに入れる
+  write_queue_.push_back(std::move(text));
 
   if (empty) {
     doWrite();
   }
 }
 void Websocket::doWrite() {
-  RTC_LOG(LS_INFO) << __FUNCTION__;
-
-  auto& buffer = write_buffer_.front();
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__;
 
-  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": "
-                      << boost::beast::buffers_to_string(buffer.data());
-
-  {
-    std::string tmp = boost::beast::buffers_to_string(buffer.data());
-    RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": size=" << tmp.size()
-                        << " text=" << tmp;
-  }
+  // WebSocket は 1 回の async_write で 1 つのメッセージになるので、
+  // 複数のメッセージを 1 回で書き込むことはできない。先頭から 1 つずつ送る
+  const std::string& text = write_queue_.front();
 
   if (isSSL()) {
     wss_->text(true);
     wss_->async_write(
-        buffer.data(),
+        boost::asio::buffer(text),
         boost::asio::bind_executor(
             strand_, std::bind(&Websocket::onWrite, this, std::placeholders::_1,
                                std::placeholders::_2)));
   } else {
     ws_->text(true);
     ws_->async_write(
-        buffer.data(),
+        boost::asio::buffer(text),
         boost::asio::bind_executor(
             strand_, std::bind(&Websocket::onWrite, this, std::placeholders::_1,
                                std::placeholders::_2)));
@@ -146,7 +149,7 @@ void Websocket::doWrite() {
 
 void Websocket::onWrite(boost::system::error_code ec,
                         std::size_t bytes_transferred) {
-  RTC_LOG(LS_INFO) << __FUNCTION__ << ": " << ec.message();
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": " << ec.message();
 
   // エラーだろうが何だろうが on_write_ コールバック関数は必ず呼ぶ
   // on_write(ec, bytes_transferred);
@@ -157,17 +160,15 @@ void Websocket::onWrite(boost::system::error_code ec,
   if (ec)
     return MOMO_BOOST_ERROR(ec, "onWrite");
 
-  {
-    std::string tmp =
-        boost::beast::buffers_to_string(write_buffer_.front().data());
-    RTC_LOG(LS_VERBOSE) << __FUNCTION__
-                        << ": bytes_transferred=" << bytes_transferred
-                        << " size=" << tmp.size() << " text=" << tmp;
-  }
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__
+                      << ": bytes_transferred=" << bytes_transferred
+                      << " size=" << write_queue_.front().size();
 
-  write_buffer_.erase(write_buffer_.begin());
+  MemoryAccounting::Instance().Add(MemoryAccounting::kWebsocket,
+                                   -(int64_t)write_queue_.front().size());
+  write_queue_.pop_front();
 
-  if (!write_buffer_.empty()) {
+  if (!write_queue_.empty()) {
     doWrite();
   }
 }
@@ -1,17 +1,20 @@
 #ifndef WS_WEBSOCKET_H_
 #define WS_WEBSOCKET_H_
 
+#include <boost/asio/buffer.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/asio/strand.hpp>
-#include <boost/beast/core/flat_buffer.hpp>
-#include <boost/beast/core/multi_buffer.hpp>
 #include <boost/beast/websocket/ssl.hpp>
 #include <boost/beast/websocket/stream.hpp>
+#include <boost/optional.hpp>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 // ずっと Read しつつ、書き込みが来たら送信してくれる WebSocket
 // サーバ用、クライアント用どちらからでも使える。
@@ -36,8 +39,15 @@ class Websocket {
 
   boost::asio::strand<websocket_t::executor_type> strand_;
 
-  boost::beast::multi_buffer read_buffer_;
-  std::vector<boost::beast::flat_buffer> write_buffer_;
+  // 受信したメッセージを std::string に直接読み込み、コピーせずに on_read に渡す。
+  // read_buffer_ は read_text_ を参照していて、読み込みを始める度に作り直す
+  std::string read_text_;
+  boost::optional<boost::asio::dynamic_string_buffer<char,
+                                                     std::char_traits<char>,
+                                                     std::allocator<char>>>
+      read_buffer_;
+  // 送信待ちのメッセージ。先頭は送信中なので、送信が終わるまで触らないこと
+  std::deque<std::string> write_queue_;
 
  public:
   // 非SSL
@@ -67,9 +77,12 @@ class Websocket {
 
  public:
   void sendText(std::string text);
+  // 複数のメッセージを 1 回のスレッドの受け渡しで送信する。メッセージは 1 つずつ別のフレームで送る
+  void sendTexts(std::vector<std::string> texts);
 
  private:
   void doSendText(std::string text);
+  void doSendTexts(std::vector<std::string> texts);
   void doWrite();
   void onWrite(boost::system::error_code ec, std::size_t bytes_transferred);
 };